@@ -0,0 +1,197 @@
+#include <time.h>
+#include "esp_log.h"
+#include "sdkconfig.h"
+#if CONFIG_SPEAKER_MODE_SDCARD
+#include "phrase.h"
+#include "sdcard_player.h"
+#endif
+#include "alarm_clock.h"
+
+static const char *TAG = "ALARM_CLOCK";
+
+/* Interval of the volume steps of a fade */
+#define FADE_STEP_MS 250
+
+static scheduler_timer_t chime_timer;
+static scheduler_timer_t alarm_timer;
+static scheduler_timer_t sleep_timer;
+static scheduler_timer_t fade_timer;
+
+#if CONFIG_SPEAKER_MODE_SDCARD
+#if CONFIG_TALKING_CLOCK_COLLOQUIAL
+#define TALKING_CLOCK_STYLE PHRASE_TIME_COLLOQUIAL
+#else
+#define TALKING_CLOCK_STYLE PHRASE_TIME_DIGITAL
+#endif
+
+// Announcement built ahead for the minute of the next chime, the chime only plays it
+static phrase_plan_t next_plan;
+static time_t next_plan_minute = -1;
+// Day of the last announcement, the first one of a day says the date when enabled
+static int announced_day = -1;
+
+static int day_of(const struct tm *timeinfo)
+{
+    return timeinfo->tm_year * 366 + timeinfo->tm_yday;
+}
+
+static void prepare_announcement(time_t at)
+{
+    struct tm timeinfo;
+    localtime_r(&at, &timeinfo);
+#if CONFIG_TALKING_CLOCK_DATE
+    bool with_date = day_of(&timeinfo) != announced_day;
+#else
+    bool with_date = false;
+#endif
+    phrase_announcement(&next_plan, &timeinfo, TALKING_CLOCK_STYLE, with_date);
+    next_plan_minute = at / 60;
+}
+#endif
+
+static player_mode_t alarm_mode = PLAYER_MODE_DEFAULT;
+static int alarm_volume = 50;
+
+// Running fade, the volume goes from fade_from to fade_to in fade_steps steps
+static int fade_from, fade_to, fade_steps, fade_step;
+static bool fade_to_off;
+static int volume_before_off;
+
+static void fade_cb(scheduler_timer_t *timer, void *arg)
+{
+    fade_step++;
+    mode_manager_set_volume(fade_from + (fade_to - fade_from) * fade_step / fade_steps);
+    if (fade_step < fade_steps) {
+        scheduler_start_after(timer, FADE_STEP_MS);
+        return;
+    }
+    if (fade_to_off) {
+        // Park the pipeline and leave the volume as it was for the next time something plays
+        ESP_LOGI(TAG, "[ * ] Sleep timer ended");
+        mode_manager_switch(PLAYER_MODE_TUNER);
+        mode_manager_set_volume(volume_before_off);
+    }
+}
+
+static void start_fade(int from, int to, int duration_ms, bool to_off)
+{
+    scheduler_cancel(&fade_timer);
+    fade_from = from;
+    fade_to = to;
+    fade_steps = duration_ms / FADE_STEP_MS > 0 ? duration_ms / FADE_STEP_MS : 1;
+    fade_step = 0;
+    fade_to_off = to_off;
+    mode_manager_set_volume(from);
+    scheduler_start_after(&fade_timer, FADE_STEP_MS);
+}
+
+static void chime_cb(scheduler_timer_t *timer, void *arg)
+{
+    if (alarm_clock_announce_time() != ESP_OK) {
+        ESP_LOGI(TAG, "[ * ] Hourly announcement skipped, the SD card player is not active");
+    }
+}
+
+static void alarm_cb(scheduler_timer_t *timer, void *arg)
+{
+    ESP_LOGI(TAG, "[ * ] Alarm, starting mode %d", (int)alarm_mode);
+    scheduler_cancel(&sleep_timer);
+    mode_manager_set_volume(0);
+    mode_manager_switch(alarm_mode);
+    start_fade(0, alarm_volume, ALARM_CLOCK_FADE_IN_MS, false);
+}
+
+static void sleep_cb(scheduler_timer_t *timer, void *arg)
+{
+    volume_before_off = mode_manager_get_volume();
+    start_fade(volume_before_off, 0, ALARM_CLOCK_FADE_OUT_MS, true);
+}
+
+/**
+ * @brief Starts the hourly announcement when enabled in menuconfig.
+ */
+esp_err_t alarm_clock_init(void)
+{
+    scheduler_timer_init(&chime_timer, chime_cb, NULL);
+    scheduler_timer_init(&alarm_timer, alarm_cb, NULL);
+    scheduler_timer_init(&sleep_timer, sleep_cb, NULL);
+    scheduler_timer_init(&fade_timer, fade_cb, NULL);
+#if CONFIG_SPEAKER_MODE_SDCARD
+    phrase_init();
+#endif
+#if CONFIG_TALKING_CLOCK_HOURLY
+    mode_manager_lock();
+    prepare_announcement(scheduler_next_hour(time(NULL)));
+    mode_manager_unlock();
+    scheduler_start_hourly(&chime_timer);
+#endif
+    return ESP_OK;
+}
+
+/**
+ * @brief Announces the current time through the voice pack.
+ */
+esp_err_t alarm_clock_announce_time(void)
+{
+#if CONFIG_SPEAKER_MODE_SDCARD
+    time_t now = time(NULL);
+    mode_manager_lock();
+    // The plan of the chime was built an hour ahead, anything else is built now
+    if (now / 60 != next_plan_minute) {
+        prepare_announcement(now);
+    }
+    esp_err_t ret = play_announcement(next_plan.clips, next_plan.count);
+    if (ret == ESP_OK) {
+        struct tm timeinfo;
+        localtime_r(&now, &timeinfo);
+        announced_day = day_of(&timeinfo);
+    }
+#if CONFIG_TALKING_CLOCK_HOURLY
+    prepare_announcement(scheduler_next_hour(now));
+#endif
+    mode_manager_unlock();
+    return ret;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+/**
+ * @brief Sets the daily alarm, replacing the previous one.
+ */
+void alarm_clock_set_alarm(int hour, int minute, player_mode_t mode, int volume)
+{
+    alarm_mode = mode;
+    alarm_volume = volume;
+    scheduler_start_daily(&alarm_timer, hour, minute);
+    ESP_LOGI(TAG, "[ * ] Alarm set to %02d:%02d", hour, minute);
+}
+
+/**
+ * @brief Turns the daily alarm off.
+ */
+void alarm_clock_cancel_alarm(void)
+{
+    scheduler_cancel(&alarm_timer);
+}
+
+/**
+ * @brief Fades out and parks the pipeline after a number of minutes, replacing a running sleep timer.
+ */
+void alarm_clock_start_sleep_timer(int minutes)
+{
+    scheduler_start_after(&sleep_timer, minutes * 60 * 1000);
+    ESP_LOGI(TAG, "[ * ] Sleep timer set to %d minutes", minutes);
+}
+
+/**
+ * @brief Stops the sleep timer, and its fade out when it already started.
+ */
+void alarm_clock_cancel_sleep_timer(void)
+{
+    scheduler_cancel(&sleep_timer);
+    if (fade_to_off && scheduler_is_running(&fade_timer)) {
+        scheduler_cancel(&fade_timer);
+        mode_manager_set_volume(volume_before_off);
+    }
+}
@@ -0,0 +1,154 @@
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_timer.h"
+#include "binlog.h"
+
+static const char *TAG = "BINLOG";
+
+#define RING_MASK (BINLOG_RING_SIZE - 1)
+
+/**
+ * @brief One log record.
+ *
+ * seq is the reservation index plus one once the record is complete, 0 or an older
+ * value while it is written.
+ */
+typedef struct {
+    atomic_uint seq;
+    const char *format;
+    const char *tag;
+    uint32_t time_ms;
+    uint8_t level;
+    uint8_t nargs;
+    uintptr_t args[BINLOG_MAX_ARGS];
+} binlog_record_t;
+
+/**
+ * @brief Ring of one core, written by the tasks of that core and read by the drain task.
+ */
+typedef struct {
+    atomic_uint head;
+    uint32_t tail;
+    binlog_record_t records[BINLOG_RING_SIZE];
+} binlog_ring_t;
+
+static binlog_ring_t rings[portNUM_PROCESSORS];
+static uint32_t dropped = 0;
+
+/**
+ * @brief Stores a record, use the BINLOG macros instead.
+ */
+void binlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...)
+{
+    binlog_ring_t *ring = &rings[xPortGetCoreID()];
+    uint32_t index = atomic_fetch_add_explicit(&ring->head, 1, memory_order_relaxed);
+    binlog_record_t *rec = &ring->records[index & RING_MASK];
+
+    atomic_store_explicit(&rec->seq, 0, memory_order_relaxed);
+    rec->format = format;
+    rec->tag = tag;
+    rec->time_ms = esp_timer_get_time() / 1000;
+    rec->level = level;
+    rec->nargs = nargs > BINLOG_MAX_ARGS ? BINLOG_MAX_ARGS : nargs;
+
+    va_list ap;
+    va_start(ap, nargs);
+    for (int i = 0; i < rec->nargs; i++) {
+        rec->args[i] = va_arg(ap, uintptr_t);
+    }
+    va_end(ap);
+    atomic_store_explicit(&rec->seq, index + 1, memory_order_release);
+}
+
+// Print one record in the format of ESP_LOGx
+static void print_record(const binlog_record_t *rec)
+{
+    static const char letters[] = {'N', 'E', 'W', 'I', 'D', 'V'};
+    esp_log_level_t level = (esp_log_level_t)rec->level;
+    char letter = rec->level < sizeof(letters) ? letters[rec->level] : '?';
+    esp_log_write(level, rec->tag, "%c (%u) %s: ", letter, (unsigned)rec->time_ms, rec->tag);
+    esp_log_write(level, rec->tag, rec->format, rec->args[0], rec->args[1], rec->args[2], rec->args[3]);
+    esp_log_write(level, rec->tag, "\n");
+}
+
+/**
+ * @brief Prints all complete records of one ring in order.
+ */
+static int drain_ring(binlog_ring_t *ring)
+{
+    int printed = 0;
+    while (1) {
+        binlog_record_t *slot = &ring->records[ring->tail & RING_MASK];
+        uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        if (seq != ring->tail + 1) {
+            uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+            if (head - ring->tail > BINLOG_RING_SIZE) {
+                // The writers lapped the drain task, skip to the oldest record still in the ring
+                dropped += head - ring->tail - BINLOG_RING_SIZE;
+                ring->tail = head - BINLOG_RING_SIZE;
+                continue;
+            }
+            // Not written yet, or still being written
+            break;
+        }
+
+        binlog_record_t rec;
+        memcpy(&rec, slot, sizeof(rec));
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) != seq) {
+            // Overwritten while copying
+            dropped++;
+        } else {
+            print_record(&rec);
+            printed++;
+        }
+        ring->tail++;
+    }
+    return printed;
+}
+
+/**
+ * @brief Prints all records in the rings.
+ */
+int binlog_flush(void)
+{
+    int printed = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        printed += drain_ring(&rings[core]);
+    }
+    return printed;
+}
+
+/**
+ * @brief Returns the number of records overwritten before they were printed.
+ */
+uint32_t binlog_get_dropped(void)
+{
+    return dropped;
+}
+
+static void binlog_task(void *pvParameters)
+{
+    uint32_t reported = 0;
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(BINLOG_DRAIN_MS));
+        binlog_flush();
+        if (dropped != reported) {
+            ESP_LOGW(TAG, "%u log records dropped", (unsigned)(dropped - reported));
+            reported = dropped;
+        }
+    }
+}
+
+/**
+ * @brief Starts the task that prints the records.
+ */
+esp_err_t binlog_init(int task_prio)
+{
+    if (xTaskCreate(binlog_task, "binlog", 3072, NULL, task_prio, NULL) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -6,3 +6,34 @@
 # in the build directory. This behaviour is entirely configurable,
 # please read the ESP-IDF documents if you need to do this.
 #
+
+# Features selected in menuconfig, see Kconfig.projbuild
+ifndef CONFIG_SPEAKER_MODE_RADIO
+COMPONENT_OBJEXCLUDE += radio.o timeshift.o mp3_frame.o resilient_http.o lean_http.o station_probe.o
+endif
+ifndef CONFIG_SPEAKER_MODE_SDCARD
+COMPONENT_OBJEXCLUDE += sdcard_player.o playlist.o phrase.o voicepack.o wav_stream.o
+endif
+ifndef CONFIG_SDCARD_FUSED_PLAYBACK
+COMPONENT_OBJEXCLUDE += fused_player.o
+endif
+ifndef CONFIG_SPEAKER_MODE_RADIO
+ifndef CONFIG_SPEAKER_MODE_SDCARD
+COMPONENT_OBJEXCLUDE += playlist_file.o
+endif
+endif
+ifndef CONFIG_SPEAKER_UI_LCD
+COMPONENT_OBJEXCLUDE += lcd.o lcd_glyphs.o lcd_menu.o vu_meter.o
+endif
+ifndef CONFIG_SPEAKER_CONTROL_API
+COMPONENT_OBJEXCLUDE += control_server.o
+endif
+ifndef CONFIG_SPEAKER_EQUALIZER
+COMPONENT_OBJEXCLUDE += eq.o
+endif
+ifndef CONFIG_SPEAKER_TRACE
+COMPONENT_OBJEXCLUDE += trace_recorder.o
+endif
+ifndef CONFIG_SPEAKER_GROUP
+COMPONENT_OBJEXCLUDE += group.o group_sync.o
+endif
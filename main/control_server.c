@@ -0,0 +1,471 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "esp_http_server.h"
+#include "input_key_service.h"
+#include "mode_manager.h"
+#if CONFIG_SPEAKER_MODE_RADIO
+#include "radio.h"
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+#include "sdcard_player.h"
+#endif
+#include "playback_clock.h"
+#include "scheduler.h"
+#include "trace_recorder.h"
+#if CONFIG_SPEAKER_GROUP
+#include "group.h"
+#endif
+#include "control_server.h"
+
+static const char *TAG = "CONTROL_SERVER";
+
+/* Longest query string and value read from a request */
+#define QUERY_MAX 64
+#define VALUE_MAX 16
+
+/* Longest status message, a track path is cut to fit. The group state lists up to GROUP_PEER_MAX speakers. */
+#if CONFIG_SPEAKER_GROUP
+#define STATUS_MAX 768
+#else
+#define STATUS_MAX 384
+#endif
+#define TRACK_MAX 128
+
+/* Room the fields after the track need in a status message */
+#define AFTER_TRACK_MAX 160
+
+/* Longest frame read from a WebSocket client, clients only listen */
+#define WS_RX_MAX 64
+
+/* The buffered audio is pushed in steps of this, so it does not change every check */
+#define BUFFER_STEP_MS 100
+
+typedef struct {
+    int mode;
+    int volume;
+    int station;
+    bool playing;
+    int position_s;
+    int duration_s;
+    int buffer_ms;
+    uint32_t underruns;
+    char track[TRACK_MAX];
+} status_t;
+
+static const char *mode_names[PLAYER_MODE_COUNT] = {
+#if CONFIG_SPEAKER_MODE_RADIO
+    [PLAYER_MODE_RADIO] = "radio",
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    [PLAYER_MODE_SDCARD] = "sdcard",
+#endif
+    [PLAYER_MODE_TUNER] = "tuner",
+#if CONFIG_SPEAKER_GROUP
+    [PLAYER_MODE_GROUP] = "group",
+#endif
+};
+
+static control_server_cfg_t server_cfg;
+static httpd_handle_t server = NULL;
+static scheduler_timer_t push_timer;
+
+// Owned by the server task: the handlers and the push work run there
+static int ws_fds[CONTROL_SERVER_WS_CLIENTS];
+static status_t pushed;
+static char message[STATUS_MAX];
+
+// Written by the server task, read by the scheduler task
+static atomic_int ws_count = 0;
+static atomic_bool push_queued = false;
+
+static void read_status(status_t *s)
+{
+    playback_position_t pos;
+    playback_clock_get(&pos);
+
+    memset(s, 0, sizeof(*s));
+    mode_manager_lock();
+    s->mode = mode_manager_get_mode();
+    s->volume = mode_manager_get_volume();
+    s->station = -1;
+    const char *track = NULL;
+#if CONFIG_SPEAKER_MODE_RADIO
+    s->station = radio_get_station();
+    if (s->mode == PLAYER_MODE_RADIO) {
+        track = radio_get_station_url(s->station);
+    }
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    if (s->mode == PLAYER_MODE_SDCARD) {
+        track = sdcard_player_get_track();
+    }
+#endif
+    snprintf(s->track, sizeof(s->track), "%s", track ? track : "");
+    mode_manager_unlock();
+
+    s->playing = pos.running;
+    s->position_s = pos.position_ms / 1000;
+    s->duration_s = pos.duration_ms < 0 ? -1 : pos.duration_ms / 1000;
+    s->buffer_ms = pos.latency_ms / BUFFER_STEP_MS * BUFFER_STEP_MS;
+    s->underruns = pos.underruns;
+}
+
+// Appends a JSON string, escaping quotes, backslashes and control characters
+static int put_string(char *out, int size, const char *str)
+{
+    int n = 0;
+    out[n++] = '"';
+    for (const char *p = str; *p && n < size - 8; p++) {
+        if (*p == '"' || *p == '\\') {
+            out[n++] = '\\';
+            out[n++] = *p;
+        } else if ((unsigned char)*p < 0x20) {
+            n += snprintf(out + n, size - n, "\\u%04x", (unsigned char)*p);
+        } else {
+            out[n++] = *p;
+        }
+    }
+    out[n++] = '"';
+    out[n] = '\0';
+    return n;
+}
+
+// Writes the fields of s that differ from prev as a JSON object, all of them without prev. Returns the field count.
+static int format_status(char *out, int size, const status_t *s, const status_t *prev)
+{
+    int fields = 0;
+    int n = snprintf(out, size, "{");
+#define FIELD(changed, ...)                                                         \
+    if (prev == NULL || (changed)) {                                                \
+        n += snprintf(out + n, size - n, "%s", fields++ ? "," : "");                \
+        n += snprintf(out + n, size - n, __VA_ARGS__);                              \
+    }
+    FIELD(s->mode != prev->mode, "\"mode\":\"%s\"", s->mode >= 0 && s->mode < PLAYER_MODE_COUNT ? mode_names[s->mode] : "none");
+    if (prev == NULL || strcmp(s->track, prev->track) != 0) {
+        n += snprintf(out + n, size - n, "%s\"track\":", fields++ ? "," : "");
+        n += put_string(out + n, size - n - AFTER_TRACK_MAX, s->track);
+    }
+    FIELD(s->playing != prev->playing, "\"playing\":%s", s->playing ? "true" : "false");
+    FIELD(s->position_s != prev->position_s, "\"position\":%d", s->position_s);
+    FIELD(s->duration_s != prev->duration_s, "\"duration\":%d", s->duration_s);
+    FIELD(s->volume != prev->volume, "\"volume\":%d", s->volume);
+    FIELD(s->station != prev->station, "\"station\":%d", s->station);
+    FIELD(s->buffer_ms != prev->buffer_ms, "\"buffer_ms\":%d", s->buffer_ms);
+    FIELD(s->underruns != prev->underruns, "\"underruns\":%u", (unsigned)s->underruns);
+#undef FIELD
+    snprintf(out + n, size - n, "}");
+    return fields;
+}
+
+static esp_err_t send_status(httpd_req_t *req)
+{
+    status_t s;
+    read_status(&s);
+    format_status(message, sizeof(message), &s, NULL);
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, message, HTTPD_RESP_USE_STRLEN);
+}
+
+// Reads an integer query parameter
+static bool query_int(httpd_req_t *req, const char *key, int *value)
+{
+    char query[QUERY_MAX];
+    char text[VALUE_MAX];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, key, text, sizeof(text)) != ESP_OK) {
+        return false;
+    }
+    char *end;
+    long v = strtol(text, &end, 10);
+    if (end == text || *end != '\0') {
+        return false;
+    }
+    *value = (int)v;
+    return true;
+}
+
+static esp_err_t status_handler(httpd_req_t *req)
+{
+    return send_status(req);
+}
+
+static esp_err_t play_handler(httpd_req_t *req)
+{
+    mode_manager_inject_key(INPUT_KEY_USER_ID_PLAY, INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE);
+    return send_status(req);
+}
+
+static esp_err_t next_handler(httpd_req_t *req)
+{
+    mode_manager_inject_key(INPUT_KEY_USER_ID_SET, INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE);
+    return send_status(req);
+}
+
+static esp_err_t volume_handler(httpd_req_t *req)
+{
+    int value;
+    if (query_int(req, "level", &value)) {
+        mode_manager_set_volume(value);
+    } else if (query_int(req, "delta", &value)) {
+        mode_manager_set_volume(mode_manager_get_volume() + value);
+    } else {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "level or delta expected");
+    }
+    return send_status(req);
+}
+
+#if CONFIG_SPEAKER_MODE_RADIO
+static esp_err_t station_handler(httpd_req_t *req)
+{
+    int index;
+    if (!query_int(req, "index", &index)) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "index expected");
+    }
+    mode_manager_lock();
+    esp_err_t ret = radio_select_station(index);
+    mode_manager_unlock();
+    if (ret == ESP_ERR_INVALID_ARG) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "unknown station");
+    }
+    return send_status(req);
+}
+#endif
+
+static esp_err_t mode_handler(httpd_req_t *req)
+{
+    char query[QUERY_MAX];
+    char name[VALUE_MAX];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "name", name, sizeof(name)) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "name expected");
+    }
+    for (int i = 0; i < PLAYER_MODE_COUNT; i++) {
+        if (strcmp(name, mode_names[i]) == 0) {
+            // A switch needs more stack than the server task has, the mode manager task runs it
+            if (mode_manager_request_switch((player_mode_t)i) != ESP_OK) {
+                return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "mode switch not queued");
+            }
+            return send_status(req);
+        }
+    }
+    return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "unknown mode");
+}
+
+#if CONFIG_SPEAKER_TRACE
+static esp_err_t trace_handler(httpd_req_t *req)
+{
+    char query[QUERY_MAX];
+    char action[VALUE_MAX];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "action", action, sizeof(action)) != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "action expected");
+    }
+    esp_err_t ret;
+    if (strcmp(action, "save") == 0) {
+        ret = trace_recorder_save(TRACE_PATH);
+    } else if (strcmp(action, "replay") == 0) {
+        ret = trace_recorder_replay(TRACE_PATH, TRACE_REPLAY_PATH);
+    } else {
+        return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "save or replay expected");
+    }
+    if (ret != ESP_OK) {
+        return httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, esp_err_to_name(ret));
+    }
+    return send_status(req);
+}
+#endif
+
+#if CONFIG_SPEAKER_GROUP
+// Answers with the state of the group instead of the status
+static esp_err_t group_handler(httpd_req_t *req)
+{
+    int leader;
+    if (req->method == HTTP_POST) {
+        if (!query_int(req, "leader", &leader)) {
+            return httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "leader expected");
+        }
+        mode_manager_lock();
+        group_set_leader(leader != 0);
+#if CONFIG_SPEAKER_MODE_RADIO
+        // The radio picks the role up when its chain starts
+        if (mode_manager_get_mode() == PLAYER_MODE_RADIO) {
+            radio_select_station(radio_get_station());
+        }
+#endif
+        mode_manager_unlock();
+    }
+
+    group_status_t g;
+    group_get_status(&g);
+    int n = snprintf(message, sizeof(message),
+                     "{\"running\":%s,\"leader\":%s,\"node\":\"%08x\",\"locked\":%s,\"error_us\":%d,"
+                     "\"rtt_us\":%d,\"correction_ppb\":%d,\"received\":%u,\"concealed\":%u,\"late\":%u,"
+                     "\"resyncs\":%u,\"spread_us\":%d,\"peers\":[",
+                     g.running ? "true" : "false", group_is_leader() ? "true" : "false", (unsigned)g.node,
+                     g.stats.locked ? "true" : "false", (int)g.stats.error_us, (int)g.stats.rtt_us,
+                     (int)g.stats.correction_ppb, (unsigned)g.stats.received, (unsigned)g.stats.concealed,
+                     (unsigned)g.stats.late, (unsigned)g.stats.resyncs, (int)g.spread_us);
+    for (int i = 0; i < g.peer_count && n < sizeof(message) - 64; i++) {
+        const group_stats_t *s = &g.peers[i].stats;
+        n += snprintf(message + n, sizeof(message) - n, "%s{\"node\":\"%08x\",\"leader\":%s,\"error_us\":%d}",
+                      i ? "," : "", (unsigned)g.peers[i].node, s->leader ? "true" : "false", (int)s->error_us);
+    }
+    snprintf(message + n, sizeof(message) - n, "]}");
+    httpd_resp_set_type(req, "application/json");
+    return httpd_resp_send(req, message, HTTPD_RESP_USE_STRLEN);
+}
+#endif
+
+static void remove_client(int fd)
+{
+    for (int i = 0; i < CONTROL_SERVER_WS_CLIENTS; i++) {
+        if (ws_fds[i] == fd) {
+            ws_fds[i] = -1;
+            atomic_fetch_sub(&ws_count, 1);
+        }
+    }
+}
+
+static esp_err_t send_text(int fd, const char *text)
+{
+    httpd_ws_frame_t frame = {
+        .final = true,
+        .type = HTTPD_WS_TYPE_TEXT,
+        .payload = (uint8_t *)text,
+        .len = strlen(text),
+    };
+    return httpd_ws_send_frame_async(server, fd, &frame);
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    if (req->method == HTTP_GET) {
+        // Handshake done, the new client starts with the full status
+        int fd = httpd_req_to_sockfd(req);
+        for (int i = 0; i < CONTROL_SERVER_WS_CLIENTS; i++) {
+            if (ws_fds[i] < 0) {
+                ws_fds[i] = fd;
+                atomic_fetch_add(&ws_count, 1);
+                status_t s;
+                read_status(&s);
+                format_status(message, sizeof(message), &s, NULL);
+                return send_text(fd, message);
+            }
+        }
+        ESP_LOGW(TAG, "[ * ] WebSocket client refused, %d are connected", CONTROL_SERVER_WS_CLIENTS);
+        return ESP_FAIL;
+    }
+
+    // Clients only listen, read and drop what they send
+    uint8_t buf[WS_RX_MAX];
+    httpd_ws_frame_t frame = { 0 };
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if (ret != ESP_OK || frame.len > sizeof(buf)) {
+        return ESP_FAIL;
+    }
+    frame.payload = buf;
+    return httpd_ws_recv_frame(req, &frame, frame.len);
+}
+
+// Called by the server when it closes a socket, it is ours to close then
+static void close_cb(httpd_handle_t hd, int fd)
+{
+    remove_client(fd);
+    close(fd);
+}
+
+// Runs in the server task, sends what changed since the last push to every WebSocket client
+static void push_work(void *arg)
+{
+    atomic_store(&push_queued, false);
+    status_t s;
+    read_status(&s);
+    if (format_status(message, sizeof(message), &s, &pushed) == 0) {
+        return;
+    }
+    pushed = s;
+    for (int i = 0; i < CONTROL_SERVER_WS_CLIENTS; i++) {
+        if (ws_fds[i] < 0) {
+            continue;
+        }
+        if (httpd_ws_get_fd_info(server, ws_fds[i]) != HTTPD_WS_CLIENT_WEBSOCKET || send_text(ws_fds[i], message) != ESP_OK) {
+            // The server closes the socket and calls close_cb
+            httpd_sess_trigger_close(server, ws_fds[i]);
+            remove_client(ws_fds[i]);
+        }
+    }
+}
+
+// Scheduler callback, hands the push to the server task when someone listens
+static void push_cb(scheduler_timer_t *timer, void *arg)
+{
+    if (atomic_load(&ws_count) > 0 && !atomic_exchange(&push_queued, true)) {
+        if (httpd_queue_work(server, push_work, NULL) != ESP_OK) {
+            atomic_store(&push_queued, false);
+        }
+    }
+    scheduler_start_after(timer, server_cfg.push_interval_ms);
+}
+
+static const httpd_uri_t handlers[] = {
+    { .uri = "/api/status", .method = HTTP_GET, .handler = status_handler },
+    { .uri = "/api/play", .method = HTTP_POST, .handler = play_handler },
+    { .uri = "/api/next", .method = HTTP_POST, .handler = next_handler },
+    { .uri = "/api/volume", .method = HTTP_POST, .handler = volume_handler },
+#if CONFIG_SPEAKER_MODE_RADIO
+    { .uri = "/api/station", .method = HTTP_POST, .handler = station_handler },
+#endif
+    { .uri = "/api/mode", .method = HTTP_POST, .handler = mode_handler },
+#if CONFIG_SPEAKER_TRACE
+    { .uri = "/api/trace", .method = HTTP_POST, .handler = trace_handler },
+#endif
+#if CONFIG_SPEAKER_GROUP
+    { .uri = "/api/group", .method = HTTP_GET, .handler = group_handler },
+    { .uri = "/api/group", .method = HTTP_POST, .handler = group_handler },
+#endif
+    { .uri = "/ws", .method = HTTP_GET, .handler = ws_handler, .is_websocket = true },
+};
+
+/**
+ * @brief Starts the control server.
+ */
+esp_err_t control_server_start(const control_server_cfg_t *config)
+{
+    server_cfg = *config;
+    for (int i = 0; i < CONTROL_SERVER_WS_CLIENTS; i++) {
+        ws_fds[i] = -1;
+    }
+
+    httpd_config_t httpd_cfg = HTTPD_DEFAULT_CONFIG();
+    httpd_cfg.server_port = config->port;
+    httpd_cfg.task_priority = config->task_prio;
+    httpd_cfg.stack_size = config->task_stack;
+    httpd_cfg.max_open_sockets = config->max_sockets;
+    httpd_cfg.max_uri_handlers = sizeof(handlers) / sizeof(handlers[0]);
+    httpd_cfg.backlog_conn = 2;
+    // A client beyond the limit closes the least recently used socket instead of waiting
+    httpd_cfg.lru_purge_enable = true;
+    // A stalled client holds the server task for at most this long
+    httpd_cfg.recv_wait_timeout = 2;
+    httpd_cfg.send_wait_timeout = 2;
+    httpd_cfg.close_fn = close_cb;
+
+    esp_err_t ret = httpd_start(&server, &httpd_cfg);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the server: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    for (int i = 0; i < (int)(sizeof(handlers) / sizeof(handlers[0])); i++) {
+        httpd_register_uri_handler(server, &handlers[i]);
+    }
+
+    read_status(&pushed);
+    scheduler_timer_init(&push_timer, push_cb, NULL);
+    scheduler_start_after(&push_timer, config->push_interval_ms);
+    ESP_LOGI(TAG, "[ * ] Control API listening on port %d", config->port);
+    return ESP_OK;
+}
@@ -0,0 +1,470 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "eq.h"
+
+static const char *TAG = "EQ";
+
+#define NVS_NAMESPACE "eq"
+#define NVS_KEY_ACTIVE "active"
+#define NVS_KEY_BYPASS "bypass"
+
+/* Fraction bits of the coefficients, they range from -8 to 8 */
+#define COEF_SHIFT 28
+
+/* Fraction bits the samples get between the bands, leaves 7 bits of headroom above 16-bit */
+#define WORK_SHIFT 8
+
+/* Ranges the design clamps to, the coefficients of steeper filters do not fit in Q28 */
+#define GAIN_DB10_MAX 150
+#define Q100_MIN 10
+#define Q100_MAX 1000
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct {
+    int32_t b0, b1, b2, a1, a2;
+} biquad_t;
+
+// Delay line of one channel of one band, err carries the fraction the output dropped
+typedef struct {
+    int32_t x1, x2, y1, y2, err;
+} biquad_state_t;
+
+typedef struct {
+    int bands;
+    biquad_t bq[EQ_MAX_BANDS];
+} cascade_t;
+
+static const eq_preset_t builtin_presets[EQ_PRESET_COUNT] = {
+    [EQ_PRESET_FLAT] = { .name = "Flat" },
+    [EQ_PRESET_LYRAT_SPEAKER] = {
+        .name = "LyraT speaker",
+        .preamp_db10 = -45,
+        .band_count = 5,
+        .bands = {
+            // The speakers cannot move below this, cutting it leaves room for the shelf
+            { EQ_BAND_HIGH_PASS, 70, 0, 71 },
+            { EQ_BAND_LOW_SHELF, 180, 60, 71 },
+            { EQ_BAND_PEAK, 500, -20, 100 },
+            { EQ_BAND_PEAK, 3000, 30, 100 },
+            { EQ_BAND_HIGH_SHELF, 8000, 20, 71 },
+        },
+    },
+    [EQ_PRESET_VOICE] = {
+        .name = "Voice",
+        .preamp_db10 = -25,
+        .band_count = 4,
+        .bands = {
+            { EQ_BAND_HIGH_PASS, 120, 0, 71 },
+            { EQ_BAND_PEAK, 250, -30, 100 },
+            { EQ_BAND_PEAK, 2500, 30, 120 },
+            { EQ_BAND_HIGH_SHELF, 6000, 15, 71 },
+        },
+    },
+};
+
+static portMUX_TYPE eq_lock = portMUX_INITIALIZER_UNLOCKED;
+static nvs_handle_t nvs = 0;
+static bool nvs_ready = false;
+
+// Set by the control tasks under eq_lock
+static eq_preset_t preset;
+static bool bypass = false;
+static int out_rate = 48000;
+static int out_channels = 2;
+static volatile int out_bits = 16;
+static uint32_t generation = 0;
+static cascade_t pending;
+static volatile bool pending_set = false;
+
+// State of the I2S write path
+static cascade_t active;
+static biquad_state_t state[EQ_MAX_BANDS][2];
+static biquad_state_t next_state[EQ_MAX_BANDS][2];
+static int32_t work[EQ_BLOCK_FRAMES * 2];
+static int32_t fade[EQ_BLOCK_FRAMES * 2];
+
+static int32_t to_coef(double v)
+{
+    return (int32_t)llround(v * (1 << COEF_SHIFT));
+}
+
+static int clamp(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+// Designs one band with the formulas of the Audio EQ Cookbook, normalized to a0
+static void design_band(const eq_band_t *band, int rate, biquad_t *bq, double scale)
+{
+    double f = clamp(band->freq_hz, 20, rate * 45 / 100);
+    double q = clamp(band->q100, Q100_MIN, Q100_MAX) / 100.0;
+    double a = pow(10.0, clamp(band->gain_db10, -GAIN_DB10_MAX, GAIN_DB10_MAX) / 400.0);
+    double w0 = 2 * M_PI * f / rate;
+    double cw = cos(w0);
+    double alpha = sin(w0) / (2 * q);
+    double sa = 2 * sqrt(a) * alpha;
+    double b0, b1, b2, a0, a1, a2;
+
+    switch (band->type) {
+    case EQ_BAND_LOW_SHELF:
+        b0 = a * ((a + 1) - (a - 1) * cw + sa);
+        b1 = 2 * a * ((a - 1) - (a + 1) * cw);
+        b2 = a * ((a + 1) - (a - 1) * cw - sa);
+        a0 = (a + 1) + (a - 1) * cw + sa;
+        a1 = -2 * ((a - 1) + (a + 1) * cw);
+        a2 = (a + 1) + (a - 1) * cw - sa;
+        break;
+    case EQ_BAND_HIGH_SHELF:
+        b0 = a * ((a + 1) + (a - 1) * cw + sa);
+        b1 = -2 * a * ((a - 1) + (a + 1) * cw);
+        b2 = a * ((a + 1) + (a - 1) * cw - sa);
+        a0 = (a + 1) - (a - 1) * cw + sa;
+        a1 = 2 * ((a - 1) - (a + 1) * cw);
+        a2 = (a + 1) - (a - 1) * cw - sa;
+        break;
+    case EQ_BAND_HIGH_PASS:
+        b0 = (1 + cw) / 2;
+        b1 = -(1 + cw);
+        b2 = (1 + cw) / 2;
+        a0 = 1 + alpha;
+        a1 = -2 * cw;
+        a2 = 1 - alpha;
+        break;
+    default:
+        b0 = 1 + alpha * a;
+        b1 = -2 * cw;
+        b2 = 1 - alpha * a;
+        a0 = 1 + alpha / a;
+        a1 = -2 * cw;
+        a2 = 1 - alpha / a;
+        break;
+    }
+    bq->b0 = to_coef(b0 / a0 * scale);
+    bq->b1 = to_coef(b1 / a0 * scale);
+    bq->b2 = to_coef(b2 / a0 * scale);
+    bq->a1 = to_coef(a1 / a0);
+    bq->a2 = to_coef(a2 / a0);
+}
+
+// Designs the cascade of a preset, the preamp is folded into the first band
+static void design(const eq_preset_t *p, int rate, bool off, cascade_t *c)
+{
+    memset(c, 0, sizeof(*c));
+    if (off) {
+        return;
+    }
+    double scale = pow(10.0, clamp(p->preamp_db10, -GAIN_DB10_MAX, GAIN_DB10_MAX) / 200.0);
+    for (int i = 0; i < p->band_count; i++) {
+        if (p->bands[i].type == EQ_BAND_OFF) {
+            continue;
+        }
+        design_band(&p->bands[i], rate, &c->bq[c->bands++], scale);
+        scale = 1;
+    }
+    if (c->bands == 0 && p->preamp_db10 != 0) {
+        c->bq[0].b0 = to_coef(scale);
+        c->bands = 1;
+    }
+}
+
+// Designs the cascade for the current settings and hands it to the write path
+static void publish(void)
+{
+    eq_preset_t p;
+    portENTER_CRITICAL(&eq_lock);
+    p = preset;
+    int rate = out_rate;
+    bool off = bypass;
+    uint32_t gen = ++generation;
+    portEXIT_CRITICAL(&eq_lock);
+
+    cascade_t c;
+    design(&p, rate, off, &c);
+
+    portENTER_CRITICAL(&eq_lock);
+    // A newer change publishes its own design
+    if (gen == generation) {
+        pending = c;
+        pending_set = true;
+    }
+    portEXIT_CRITICAL(&eq_lock);
+}
+
+static bool preset_valid(const eq_preset_t *p)
+{
+    if (p->band_count > EQ_MAX_BANDS) {
+        return false;
+    }
+    for (int i = 0; i < p->band_count; i++) {
+        if (p->bands[i].type > EQ_BAND_HIGH_PASS || p->bands[i].freq_hz == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One sample through one band, in Direct Form I with first-order error feedback
+static inline int32_t biquad_step(const biquad_t *k, biquad_state_t *s, int32_t x)
+{
+    int64_t acc = (int64_t)k->b0 * x + (int64_t)k->b1 * s->x1 + (int64_t)k->b2 * s->x2
+                  - (int64_t)k->a1 * s->y1 - (int64_t)k->a2 * s->y2 + s->err;
+    int32_t y = (int32_t)(acc >> COEF_SHIFT);
+    s->err = (int32_t)(acc & ((1 << COEF_SHIFT) - 1));
+    s->x2 = s->x1;
+    s->x1 = x;
+    s->y2 = s->y1;
+    s->y1 = y;
+    return y;
+}
+
+// Runs a block through a cascade, band by band so the coefficients and both delay lines stay in registers
+static void run_cascade(const cascade_t *c, biquad_state_t (*st)[2], int32_t *x, int frames, int channels)
+{
+    for (int b = 0; b < c->bands; b++) {
+        const biquad_t k = c->bq[b];
+        biquad_state_t l = st[b][0];
+        if (channels == 2) {
+            biquad_state_t r = st[b][1];
+            for (int i = 0; i < frames; i++) {
+                x[2 * i] = biquad_step(&k, &l, x[2 * i]);
+                x[2 * i + 1] = biquad_step(&k, &r, x[2 * i + 1]);
+            }
+            st[b][1] = r;
+        } else {
+            for (int i = 0; i < frames; i++) {
+                x[i] = biquad_step(&k, &l, x[i]);
+            }
+        }
+        st[b][0] = l;
+    }
+}
+
+
+// Takes the cascade published by the control tasks, if any
+static bool take_pending(cascade_t *c)
+{
+    bool taken = false;
+    portENTER_CRITICAL(&eq_lock);
+    if (pending_set) {
+        *c = pending;
+        pending_set = false;
+        taken = true;
+    }
+    portEXIT_CRITICAL(&eq_lock);
+    return taken;
+}
+
+static void load_settings(void)
+{
+    size_t size = sizeof(preset);
+    if (nvs_get_blob(nvs, NVS_KEY_ACTIVE, &preset, &size) != ESP_OK || size != sizeof(preset) ||
+        !preset_valid(&preset)) {
+        preset = builtin_presets[EQ_PRESET_LYRAT_SPEAKER];
+    }
+    uint8_t off = 0;
+    nvs_get_u8(nvs, NVS_KEY_BYPASS, &off);
+    bypass = off != 0;
+}
+
+static esp_err_t save(const char *key, const eq_preset_t *p)
+{
+    esp_err_t ret = nvs_set_blob(nvs, key, p, sizeof(*p));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(nvs);
+    }
+    return ret;
+}
+
+/**
+ * @brief Loads the active preset from NVS, or the LyraT speaker preset the first time.
+ */
+esp_err_t eq_init(void)
+{
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
+        preset = builtin_presets[EQ_PRESET_LYRAT_SPEAKER];
+        publish();
+        return ret;
+    }
+    nvs_ready = true;
+    load_settings();
+    ESP_LOGI(TAG, "[ * ] Equalizer preset %s%s", preset.name, bypass ? ", bypassed" : "");
+    publish();
+    return ESP_OK;
+}
+
+/**
+ * @brief Returns a built-in preset.
+ */
+const eq_preset_t *eq_get_builtin(eq_builtin_t index)
+{
+    if ((int)index < 0 || index >= EQ_PRESET_COUNT) {
+        return NULL;
+    }
+    return &builtin_presets[index];
+}
+
+/**
+ * @brief Crossfades to a preset.
+ */
+esp_err_t eq_apply(const eq_preset_t *p, bool store)
+{
+    if (p == NULL || !preset_valid(p)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    portENTER_CRITICAL(&eq_lock);
+    preset = *p;
+    preset.name[EQ_NAME_MAX - 1] = '\0';
+    portEXIT_CRITICAL(&eq_lock);
+    publish();
+    if (store && nvs_ready) {
+        return save(NVS_KEY_ACTIVE, p);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Reads the active preset.
+ */
+void eq_get_active(eq_preset_t *p)
+{
+    portENTER_CRITICAL(&eq_lock);
+    *p = preset;
+    portEXIT_CRITICAL(&eq_lock);
+}
+
+/**
+ * @brief Stores a preset in a user slot in NVS.
+ */
+esp_err_t eq_store_preset(int slot, const eq_preset_t *p)
+{
+    if (slot < 0 || slot >= EQ_USER_PRESETS || p == NULL || !preset_valid(p)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!nvs_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char key[8];
+    snprintf(key, sizeof(key), "user%d", slot);
+    return save(key, p);
+}
+
+/**
+ * @brief Reads a preset from a user slot in NVS.
+ */
+esp_err_t eq_load_preset(int slot, eq_preset_t *p)
+{
+    if (slot < 0 || slot >= EQ_USER_PRESETS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!nvs_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    char key[8];
+    snprintf(key, sizeof(key), "user%d", slot);
+    size_t size = sizeof(*p);
+    esp_err_t ret = nvs_get_blob(nvs, key, p, &size);
+    if (ret == ESP_OK && (size != sizeof(*p) || !preset_valid(p))) {
+        ret = ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    return ret;
+}
+
+/**
+ * @brief Turns the equalizer off or on again, with a crossfade, without changing the preset.
+ */
+void eq_set_bypass(bool off)
+{
+    portENTER_CRITICAL(&eq_lock);
+    bypass = off;
+    portEXIT_CRITICAL(&eq_lock);
+    publish();
+    if (nvs_ready && nvs_set_u8(nvs, NVS_KEY_BYPASS, off) == ESP_OK) {
+        nvs_commit(nvs);
+    }
+}
+
+/**
+ * @brief Sets the format of the audio written to I2S.
+ */
+void eq_set_format(int rate, int channels, int bits)
+{
+    if (rate <= 0 || channels < 1 || channels > 2) {
+        return;
+    }
+    portENTER_CRITICAL(&eq_lock);
+    bool changed = rate != out_rate || channels != out_channels;
+    out_rate = rate;
+    out_channels = channels;
+    out_bits = bits;
+    portEXIT_CRITICAL(&eq_lock);
+    if (changed) {
+        publish();
+    }
+}
+
+/**
+ * @brief Filters in place.
+ *
+ * A pending cascade is run next to the active one for the first block and the output
+ * fades from the old to the new over that block. Both start from the same delay lines,
+ * so the new one has no start-up transient to hide.
+ */
+void eq_process(char *buffer, int len)
+{
+    // Nothing to filter and nothing to fade to: the bypass costs this test
+    if (active.bands == 0 && !pending_set) {
+        return;
+    }
+    int channels = out_channels;
+    if (out_bits != 16) {
+        return;
+    }
+    int16_t *pcm = (int16_t *)buffer;
+    int frames = len / (channels * sizeof(int16_t));
+    cascade_t next;
+
+    while (frames > 0) {
+        int n = frames < EQ_BLOCK_FRAMES ? frames : EQ_BLOCK_FRAMES;
+        int count = n * channels;
+        for (int i = 0; i < count; i++) {
+            work[i] = (int32_t)pcm[i] << WORK_SHIFT;
+        }
+
+        if (take_pending(&next)) {
+            memcpy(fade, work, count * sizeof(int32_t));
+            memcpy(next_state, state, sizeof(state));
+            run_cascade(&active, state, fade, n, channels);
+            run_cascade(&next, next_state, work, n, channels);
+            for (int i = 0; i < n; i++) {
+                int32_t w = (i << 15) / n;
+                for (int c = 0; c < channels; c++) {
+                    int32_t from = fade[i * channels + c];
+                    work[i * channels + c] = from + (int32_t)(((int64_t)(work[i * channels + c] - from) * w) >> 15);
+                }
+            }
+            // Bands the new cascade does not use start clean when they are used again
+            memcpy(state, next_state, sizeof(state));
+            memset(state[next.bands], 0, sizeof(state[0]) * (EQ_MAX_BANDS - next.bands));
+            active = next;
+        } else {
+            run_cascade(&active, state, work, n, channels);
+        }
+
+        for (int i = 0; i < count; i++) {
+            int32_t v = (work[i] + (1 << (WORK_SHIFT - 1))) >> WORK_SHIFT;
+            pcm[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+        }
+        pcm += count;
+        frames -= n;
+    }
+}
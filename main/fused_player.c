@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "audio_mem.h"
+#include "fused_player.h"
+#include "playback_clock.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "power_governor.h"
+#include "wav_file.h"
+#include "pcm_convert.h"
+#include "trace_recorder.h"
+#include "playlist_file.h"
+
+static const char *TAG = "FUSED_PLAYER";
+
+/**
+ * @brief Private state of the fused playback element.
+ */
+typedef struct {
+    fused_player_cfg_t cfg;
+    FILE *file;
+    char *out_buf;
+    int out_sz;
+
+    // Format of the current file
+    int in_rate;
+    int in_channels;
+    wav_file_info_t wav;
+    pcm_convert_t conv;
+    uint32_t data_left;
+
+    // Seek requested by fused_player_seek(), -1 when none is pending
+    volatile int32_t seek_ms;
+
+    // Linear resampler state, position is Q16 relative to the last frame of the previous buffer
+    uint32_t step;
+    uint32_t pos;
+    int16_t last[2];
+
+    // CPU accounting for the current file
+    int64_t busy_us;
+    int64_t frames_out;
+} fused_player_t;
+
+/**
+ * @brief Parses the RIFF/WAVE header and leaves the file at the start of the data chunk.
+ *
+ * @param fp Element state, the file must be open.
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED for formats pcm_format_of() refuses, ESP_FAIL on a malformed file.
+ */
+static esp_err_t parse_wav_header(fused_player_t *fp)
+{
+    if (wav_file_parse(fp->file, &fp->wav) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    pcm_format_t format = pcm_format_of(&fp->wav);
+    if (format == PCM_FORMAT_NONE) {
+        ESP_LOGE(TAG, "Unsupported format %d, %d bits, %d channels", fp->wav.format, fp->wav.bits, fp->wav.channels);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    pcm_convert_init(&fp->conv, format);
+    fp->in_channels = fp->wav.channels;
+    fp->in_rate = fp->wav.sample_rate;
+    fp->data_left = fp->wav.data_size;
+    return ESP_OK;
+}
+
+/**
+ * @brief Moves the file to a new position and restarts the resampler there.
+ *
+ * Runs in the element task between two buffers, so the next write continues at the
+ * new position and no buffer holds audio from both sides of the jump.
+ *
+ * @param fp Element state.
+ * @param position_ms Time from the start of the data.
+ * @return Offset into the data chunk, or -1 when the file could not be moved.
+ */
+static int64_t apply_seek(fused_player_t *fp, int32_t position_ms)
+{
+    uint32_t offset = wav_file_offset(&fp->wav, position_ms);
+    if (fseek(fp->file, fp->wav.data_offset + offset, SEEK_SET) != 0) {
+        return -1;
+    }
+    fp->data_left = fp->wav.data_size - offset;
+    fp->pos = 1 << 16;
+    fp->last[0] = fp->last[1] = 0;
+    return offset;
+}
+
+/**
+ * @brief Converts interleaved 16-bit input frames to stereo frames at the output rate.
+ *
+ * @param fp Element state.
+ * @param in Input samples.
+ * @param in_frames Number of input frames.
+ * @return Number of bytes written to the output buffer.
+ */
+static int convert(fused_player_t *fp, const int16_t *in, int in_frames)
+{
+    int16_t *out = (int16_t *)fp->out_buf;
+    int max_frames = fp->out_sz / (2 * sizeof(int16_t));
+    int ch = fp->in_channels;
+    int n = 0;
+
+    while ((int)(fp->pos >> 16) < in_frames && n < max_frames) {
+        int i = fp->pos >> 16;
+        int32_t frac = fp->pos & 0xFFFF;
+        // Frame i-1 of the buffer is the last frame of the previous buffer
+        const int16_t *a = i == 0 ? fp->last : &in[(i - 1) * ch];
+        const int16_t *b = &in[i * ch];
+        // A full scale step times a Q16 fraction does not fit in 32 bits
+        int32_t l = a[0] + (int32_t)(((int64_t)(b[0] - a[0]) * frac) >> 16);
+        int32_t r = ch == 2 ? a[1] + (int32_t)(((int64_t)(b[1] - a[1]) * frac) >> 16) : l;
+        out[2 * n] = l;
+        out[2 * n + 1] = r;
+        n++;
+        fp->pos += fp->step;
+    }
+
+    fp->pos -= (uint32_t)in_frames << 16;
+    fp->last[0] = in[(in_frames - 1) * ch];
+    fp->last[1] = in[(in_frames - 1) * ch + ch - 1];
+    return n * 2 * sizeof(int16_t);
+}
+
+static esp_err_t _fused_open(audio_element_handle_t self)
+{
+    fused_player_t *fp = (fused_player_t *)audio_element_getdata(self);
+    audio_element_info_t info = {0};
+    audio_element_getinfo(self, &info);
+    if (info.uri == NULL) {
+        ESP_LOGE(TAG, "No file set");
+        return ESP_FAIL;
+    }
+
+    int64_t open_start = trace_recorder_now();
+    fp->file = fopen(playlist_file_vfs_path(info.uri), "rb");
+    if (fp->file == NULL) {
+        ESP_LOGE(TAG, "Failed to open %s", info.uri);
+        return ESP_FAIL;
+    }
+    esp_err_t ret = parse_wav_header(fp);
+    trace_recorder_io(TRACE_IO_SD_OPEN, open_start, ret);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to parse %s", info.uri);
+        fclose(fp->file);
+        fp->file = NULL;
+        return ESP_FAIL;
+    }
+
+    fp->step = ((uint64_t)fp->in_rate << 16) / fp->cfg.out_rate;
+    fp->pos = 1 << 16;
+    fp->last[0] = fp->last[1] = 0;
+    fp->busy_us = 0;
+    fp->frames_out = 0;
+
+    info.sample_rates = fp->in_rate;
+    info.channels = fp->in_channels;
+    info.bits = 16;
+    info.byte_pos = 0;
+    info.total_bytes = fp->data_left;
+    audio_element_setinfo(self, &info);
+    audio_element_report_info(self);
+
+    // Nothing of this file reached the DMA yet, the clock counts the track from here
+    playback_clock_set_format(fp->cfg.out_rate, 2, 16);
+    normalizer_set_format(fp->cfg.out_rate, 2, 16);
+    eq_set_format(fp->cfg.out_rate, 2, 16);
+    playback_clock_start_track(wav_file_duration_ms(&fp->wav));
+    return ESP_OK;
+}
+
+static int _fused_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    fused_player_t *fp = (fused_player_t *)audio_element_getdata(self);
+    int frame_size = fp->wav.block_align;
+    int64_t start = esp_timer_get_time();
+
+    int32_t seek_ms = fp->seek_ms;
+    if (seek_ms >= 0) {
+        fp->seek_ms = -1;
+        int64_t offset = apply_seek(fp, seek_ms);
+        if (offset < 0) {
+            ESP_LOGE(TAG, "Failed to seek to %d ms", (int)seek_ms);
+            return AEL_IO_FAIL;
+        }
+        audio_element_set_byte_pos(self, offset);
+        playback_clock_seek(offset / frame_size * 1000 / fp->in_rate);
+    }
+
+    // Read no more input than fits in the output buffer after resampling
+    int max_frames = (int)(((int64_t)fp->out_sz / 4) * fp->in_rate / fp->cfg.out_rate);
+    if (max_frames < 1) {
+        max_frames = 1;
+    }
+    // Converted to 16 bits the samples shrink or stay, 8-bit ones grow and are read into the upper half
+    int room = fp->conv.format == PCM_FORMAT_U8 ? in_len / 2 : in_len;
+    int want = max_frames * frame_size;
+    if (want > room) {
+        want = room - room % frame_size;
+    }
+    if ((uint32_t)want > fp->data_left) {
+        want = fp->data_left - fp->data_left % frame_size;
+    }
+    if (want <= 0) {
+        return AEL_IO_DONE;
+    }
+
+    int64_t read_start = trace_recorder_now();
+    char *raw = fp->conv.format == PCM_FORMAT_U8 ? in_buffer + want : in_buffer;
+    int r = fread(raw, 1, want, fp->file);
+    trace_recorder_io(TRACE_IO_SD_READ, read_start, r);
+    if (r < frame_size) {
+        return AEL_IO_DONE;
+    }
+    r -= r % frame_size;
+    fp->data_left -= r;
+    int frames = r / frame_size;
+    pcm_convert_to_s16(&fp->conv, raw, frames * fp->in_channels, (int16_t *)in_buffer);
+
+    char *out;
+    int out_len;
+    if (fp->in_rate == fp->cfg.out_rate && fp->in_channels == 2) {
+        // Already in the output format, write the converted file data as is
+        out = in_buffer;
+        out_len = frames * 2 * sizeof(int16_t);
+    } else {
+        out = fp->out_buf;
+        out_len = convert(fp, (const int16_t *)in_buffer, frames);
+    }
+    // In the order of clock_write_cb, the limiter of the normalizer catches the EQ boost
+    eq_process(out, out_len);
+    normalizer_process(out, out_len);
+    fp->busy_us += esp_timer_get_time() - start;
+    fp->frames_out += out_len / 4;
+
+    size_t written = 0;
+    power_governor_audio_begin();
+    esp_err_t ret = out_len > 0 ? i2s_write(fp->cfg.i2s_port, out, out_len, &written, portMAX_DELAY) : ESP_OK;
+    power_governor_audio_end();
+    if (ret != ESP_OK) {
+        return AEL_IO_FAIL;
+    }
+    playback_clock_on_write(written);
+    if (out_len > 0) {
+        audio_element_multi_output(self, (char *)out, out_len, 0);
+    }
+    audio_element_update_byte_pos(self, r);
+    return r;
+}
+
+static esp_err_t _fused_close(audio_element_handle_t self)
+{
+    fused_player_t *fp = (fused_player_t *)audio_element_getdata(self);
+    if (fp->file) {
+        fclose(fp->file);
+        fp->file = NULL;
+    }
+    if (fp->frames_out > 0) {
+        // Time spent reading and converting, I2S DMA waits excluded
+        int64_t audio_us = fp->frames_out * 1000000 / fp->cfg.out_rate;
+        ESP_LOGI(TAG, "CPU load %d.%02d%% over %d s of audio",
+                 (int)(fp->busy_us * 100 / audio_us), (int)(fp->busy_us * 10000 / audio_us % 100),
+                 (int)(audio_us / 1000000));
+    }
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+        fp->seek_ms = -1;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _fused_destroy(audio_element_handle_t self)
+{
+    fused_player_t *fp = (fused_player_t *)audio_element_getdata(self);
+    audio_free(fp->out_buf);
+    audio_free(fp);
+    return ESP_OK;
+}
+
+/**
+ * @brief Jumps to a time in the playing file.
+ */
+esp_err_t fused_player_seek(audio_element_handle_t self, int64_t position_ms)
+{
+    fused_player_t *fp = (fused_player_t *)audio_element_getdata(self);
+    if (position_ms < 0 || position_ms > INT32_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    fp->seek_ms = position_ms;
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates the fused playback element.
+ */
+audio_element_handle_t fused_player_init(fused_player_cfg_t *config)
+{
+    fused_player_t *fp = audio_calloc(1, sizeof(fused_player_t));
+    AUDIO_MEM_CHECK(TAG, fp, return NULL);
+    fp->cfg = *config;
+    fp->seek_ms = -1;
+    fp->out_sz = config->buf_sz * 2;
+    fp->out_buf = audio_malloc(fp->out_sz);
+    AUDIO_MEM_CHECK(TAG, fp->out_buf, {
+        audio_free(fp);
+        return NULL;
+    });
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _fused_open;
+    cfg.process = _fused_process;
+    cfg.close = _fused_close;
+    cfg.destroy = _fused_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.buffer_len = config->buf_sz;
+    cfg.out_rb_size = 0;
+    cfg.multi_out_rb_num = config->multi_out_num;
+    cfg.tag = "fused";
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(fp->out_buf);
+        audio_free(fp);
+        return NULL;
+    });
+    audio_element_setdata(el, fp);
+    return el;
+}
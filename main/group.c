@@ -0,0 +1,580 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_mac.h"
+#include "esp_heap_caps.h"
+#include "lwip/sockets.h"
+#include "audio_mem.h"
+#include "i2s_stream.h"
+#include "filter_resample.h"
+#include "group.h"
+#include "playback_clock.h"
+#include "vu_meter.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "power_governor.h"
+
+static const char *TAG = "GROUP";
+
+#define DELAY_US (CONFIG_SPEAKER_GROUP_DELAY_MS * 1000)
+
+/* The delay in packets, plus room for the audio queued in front of I2S and for jitter */
+#define SLOT_COUNT (CONFIG_SPEAKER_GROUP_DELAY_MS * 1000 / GROUP_PACKET_US + 8)
+
+/* The group task wakes up at least this often to start clock exchanges and reports */
+#define RECEIVE_TIMEOUT_MS 20
+
+#define TASK_STACK 3072
+#define TASK_PRIO 7
+
+/* Elements: two packets in front of the writer keep the audio queued before I2S short */
+#define ELEMENT_STACK 3072
+#define ELEMENT_PRIO 6
+#define ELEMENT_OUT_RB_SIZE (2 * GROUP_PACKET_BYTES)
+
+/**
+ * @brief Private state of the send and receive elements.
+ */
+typedef struct {
+    bool send;
+    int16_t out[GROUP_PACKET_FRAMES * GROUP_CHANNELS];
+
+    // Leader: the packet being filled, its number in the timeline and the base of the timeline
+    int16_t packet[GROUP_PACKET_FRAMES * GROUP_CHANNELS];
+    int fill;
+    uint32_t seq;
+    int64_t base_us;
+    bool timeline;
+    uint8_t datagram[GROUP_DATAGRAM_MAX];
+} group_stream_t;
+
+static const char *group_link_tag[2] = {"grecv", "i2s"};
+
+static audio_element_handle_t filter_el, send_el, recv_el;
+static uint32_t node_id = 0;
+#if CONFIG_SPEAKER_GROUP_LEADER
+static bool leader_role = true;
+#else
+static bool leader_role = false;
+#endif
+
+// Shared by the group task, the element tasks and the control API
+static SemaphoreHandle_t lock = NULL;
+static group_slot_t *slots = NULL;
+static group_jitter_t jitter;
+static group_player_t player;
+static group_clock_t clock_filter;
+static group_peer_t peers[GROUP_PEER_MAX];
+static int64_t peer_seen_us[GROUP_PEER_MAX];
+static int peer_count = 0;
+
+// Set while the send element runs, this speaker is the leader then
+static volatile bool sending = false;
+
+// Owned by the group task between group_start() and group_stop()
+static volatile bool running = false;
+static SemaphoreHandle_t task_done = NULL;
+static int sock = -1;
+static struct sockaddr_in group_addr;
+static struct sockaddr_in leader_addr;
+static uint32_t leader_node = 0;
+static bool power_held = false;
+
+static esp_err_t group_mode_init(void);
+static esp_err_t group_activate(void);
+static void group_deactivate(void);
+
+const player_mode_ops_t group_mode_ops = {
+    .name = "Group",
+    .init = group_mode_init,
+    .activate = group_activate,
+    .deactivate = group_deactivate,
+};
+
+// Statistics of this speaker, with the lock held
+static void own_stats(group_stats_t *s, int64_t now)
+{
+    memset(s, 0, sizeof(*s));
+    s->leader = sending;
+    s->locked = player.locked;
+    s->error_us = player.error * 1000000 / GROUP_RATE;
+    s->correction_ppb = player.ppm * 1000;
+    s->received = jitter.received;
+    s->concealed = jitter.concealed;
+    s->late = jitter.late;
+    s->resyncs = player.resyncs;
+    int64_t offset;
+    int32_t rtt;
+    if (!sending && group_clock_get(&clock_filter, now, &offset, &rtt)) {
+        s->rtt_us = rtt;
+    }
+}
+
+static void send_to(const group_msg_t *msg, const struct sockaddr_in *to, uint8_t *buf)
+{
+    int len = group_msg_encode(buf, msg);
+    // A full Wi-Fi queue drops the datagram, the receivers conceal it
+    sendto(sock, buf, len, 0, (const struct sockaddr *)to, sizeof(*to));
+}
+
+static void update_peer(uint32_t node, const group_stats_t *stats, int64_t now)
+{
+    int i = 0;
+    while (i < peer_count && peers[i].node != node) {
+        i++;
+    }
+    if (i == peer_count) {
+        if (peer_count == GROUP_PEER_MAX) {
+            return;
+        }
+        peer_count++;
+    }
+    peers[i].node = node;
+    peers[i].stats = *stats;
+    peer_seen_us[i] = now;
+}
+
+static void handle_message(const group_msg_t *msg, const struct sockaddr_in *from, int64_t now, uint8_t *tx)
+{
+    switch (msg->type) {
+    case GROUP_MSG_AUDIO:
+        if (sending) {
+            break;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        if (msg->node != leader_node) {
+            // A new leader, its clock has another offset
+            ESP_LOGI(TAG, "[ * ] Following %08x", (unsigned)msg->node);
+            leader_node = msg->node;
+            leader_addr = *from;
+            group_clock_reset(&clock_filter);
+        }
+        group_jitter_push(&jitter, msg->time_us[0], msg->seq, msg->pcm);
+        xSemaphoreGive(lock);
+        break;
+    case GROUP_MSG_CLOCK_REQ:
+        if (sending) {
+            group_msg_t resp = {
+                .type = GROUP_MSG_CLOCK_RESP,
+                .node = node_id,
+                .time_us = {msg->time_us[0], now, esp_timer_get_time()},
+            };
+            send_to(&resp, from, tx);
+        }
+        break;
+    case GROUP_MSG_CLOCK_RESP:
+        if (msg->node == leader_node) {
+            xSemaphoreTake(lock, portMAX_DELAY);
+            group_clock_add(&clock_filter, msg->time_us[0], msg->time_us[1], msg->time_us[2], now);
+            xSemaphoreGive(lock);
+        }
+        break;
+    case GROUP_MSG_REPORT:
+        xSemaphoreTake(lock, portMAX_DELAY);
+        update_peer(msg->node, &msg->stats, now);
+        xSemaphoreGive(lock);
+        break;
+    }
+}
+
+// Receives the datagrams, timestamps them at once, and starts the clock exchanges and reports
+static void group_task(void *pvParameters)
+{
+    static uint8_t rx[GROUP_DATAGRAM_MAX];
+    static uint8_t tx[GROUP_HEADER_SIZE + 32];
+    int64_t next_clock_us = 0;
+    int64_t next_report_us = 0;
+
+    while (running) {
+        struct sockaddr_in from;
+        socklen_t from_len = sizeof(from);
+        int len = recvfrom(sock, rx, sizeof(rx), 0, (struct sockaddr *)&from, &from_len);
+        int64_t now = esp_timer_get_time();
+        group_msg_t msg;
+        if (len > 0 && group_msg_decode(rx, len, &msg) && msg.node != node_id) {
+            handle_message(&msg, &from, now, tx);
+        }
+
+        if (now >= next_clock_us) {
+            next_clock_us = now + GROUP_CLOCK_INTERVAL_MS * 1000;
+            if (!sending && leader_node) {
+                group_msg_t req = {
+                    .type = GROUP_MSG_CLOCK_REQ,
+                    .node = node_id,
+                    .time_us = {esp_timer_get_time()},
+                };
+                send_to(&req, &leader_addr, tx);
+            }
+        }
+        if (now >= next_report_us) {
+            next_report_us = now + GROUP_REPORT_INTERVAL_MS * 1000;
+            group_msg_t report = {
+                .type = GROUP_MSG_REPORT,
+                .node = node_id,
+            };
+            xSemaphoreTake(lock, portMAX_DELAY);
+            own_stats(&report.stats, now);
+            xSemaphoreGive(lock);
+            send_to(&report, &group_addr, tx);
+        }
+    }
+    xSemaphoreGive(task_done);
+    vTaskDelete(NULL);
+}
+
+// Renders the next packet of the timeline, placed by when the writer will play it
+static void render(int16_t *out)
+{
+    int64_t now = esp_timer_get_time();
+    int64_t play_us = now + playback_clock_get_latency_us(now);
+    int64_t offset = 0;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    if (running && (sending || group_clock_get(&clock_filter, now, &offset, NULL))) {
+        group_player_render(&player, &jitter, play_us + offset, out, GROUP_PACKET_FRAMES);
+    } else {
+        player.locked = false;
+        memset(out, 0, GROUP_PACKET_BYTES);
+    }
+    xSemaphoreGive(lock);
+}
+
+// Leader: reads the decoded audio and sends it until the timeline is the group delay ahead
+static int send_ahead(audio_element_handle_t self, group_stream_t *gs)
+{
+    while (!gs->timeline || gs->base_us + (int64_t)gs->seq * GROUP_PACKET_US < esp_timer_get_time() + DELAY_US) {
+        int r = audio_element_input(self, (char *)gs->packet + gs->fill, GROUP_PACKET_BYTES - gs->fill);
+        if (r == AEL_IO_TIMEOUT) {
+            // Nothing decoded yet, what was sent plays on meanwhile
+            return 0;
+        }
+        if (r <= 0) {
+            return r;
+        }
+        gs->fill += r;
+        if (gs->fill < GROUP_PACKET_BYTES) {
+            continue;
+        }
+        gs->fill = 0;
+
+        int64_t now = esp_timer_get_time();
+        if (!gs->timeline || gs->base_us + (int64_t)gs->seq * GROUP_PACKET_US < now + DELAY_US / 2) {
+            // The start, or the stream stalled until the packets would come too late: a new timeline
+            gs->base_us = now + DELAY_US;
+            gs->seq = 0;
+            gs->timeline = true;
+        }
+        group_msg_t msg = {
+            .type = GROUP_MSG_AUDIO,
+            .node = node_id,
+            .seq = gs->seq,
+            .time_us = {gs->base_us},
+            .pcm = gs->packet,
+        };
+        send_to(&msg, &group_addr, gs->datagram);
+        xSemaphoreTake(lock, portMAX_DELAY);
+        group_jitter_push(&jitter, gs->base_us, gs->seq, gs->packet);
+        xSemaphoreGive(lock);
+        gs->seq++;
+    }
+    return 0;
+}
+
+static esp_err_t _group_open(audio_element_handle_t self)
+{
+    group_stream_t *gs = (group_stream_t *)audio_element_getdata(self);
+    gs->fill = 0;
+    gs->timeline = false;
+    if (gs->send) {
+        // Waiting for the decoder must not hold up the audio already sent
+        audio_element_set_input_timeout(self, pdMS_TO_TICKS(GROUP_PACKET_US / 1000));
+        sending = true;
+    }
+    return ESP_OK;
+}
+
+static int _group_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    group_stream_t *gs = (group_stream_t *)audio_element_getdata(self);
+    if (gs->send) {
+        int r = send_ahead(self, gs);
+        if (r < 0) {
+            return r;
+        }
+    }
+    // The writer blocks while I2S is full, that paces the element
+    render(gs->out);
+    return audio_element_output(self, (char *)gs->out, GROUP_PACKET_BYTES);
+}
+
+static esp_err_t _group_close(audio_element_handle_t self)
+{
+    group_stream_t *gs = (group_stream_t *)audio_element_getdata(self);
+    if (gs->send) {
+        sending = false;
+    }
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _group_destroy(audio_element_handle_t self)
+{
+    audio_free(audio_element_getdata(self));
+    return ESP_OK;
+}
+
+static audio_element_handle_t group_stream_init(bool send, const char *tag)
+{
+    group_stream_t *gs = audio_calloc(1, sizeof(group_stream_t));
+    AUDIO_MEM_CHECK(TAG, gs, return NULL);
+    gs->send = send;
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _group_open;
+    cfg.process = _group_process;
+    cfg.close = _group_close;
+    cfg.destroy = _group_destroy;
+    cfg.task_stack = ELEMENT_STACK;
+    cfg.task_prio = ELEMENT_PRIO;
+    cfg.out_rb_size = ELEMENT_OUT_RB_SIZE;
+    cfg.buffer_len = GROUP_PACKET_BYTES;
+    cfg.tag = tag;
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(gs);
+        return NULL;
+    });
+    audio_element_setdata(el, gs);
+    return el;
+}
+
+/**
+ * @brief Creates the group elements and registers them in the shared pipeline.
+ */
+static esp_err_t group_mode_init(void)
+{
+    uint8_t mac[6];
+    esp_read_mac(mac, ESP_MAC_WIFI_STA);
+    node_id = (uint32_t)mac[2] << 24 | mac[3] << 16 | mac[4] << 8 | mac[5];
+    group_addr.sin_family = AF_INET;
+    group_addr.sin_port = htons(CONFIG_SPEAKER_GROUP_PORT);
+    if (!inet_aton(CONFIG_SPEAKER_GROUP_ADDRESS, &group_addr.sin_addr)) {
+        ESP_LOGE(TAG, "Invalid group address %s", CONFIG_SPEAKER_GROUP_ADDRESS);
+        return ESP_ERR_INVALID_ARG;
+    }
+    lock = xSemaphoreCreateMutex();
+    task_done = xSemaphoreCreateBinary();
+    if (lock == NULL || task_done == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    ESP_LOGI(TAG, "[2.1] Create the group elements, node %08x", (unsigned)node_id);
+    rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
+    rsp_cfg.dest_rate = GROUP_RATE;
+    rsp_cfg.dest_ch = GROUP_CHANNELS;
+    filter_el = rsp_filter_init(&rsp_cfg);
+    send_el = group_stream_init(true, "gsend");
+    recv_el = group_stream_init(false, "grecv");
+    if (filter_el == NULL || send_el == NULL || recv_el == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    audio_pipeline_handle_t pipeline = mode_manager_get_pipeline();
+    audio_pipeline_register(pipeline, filter_el, "gfilter");
+    audio_pipeline_register(pipeline, send_el, "gsend");
+    audio_pipeline_register(pipeline, recv_el, "grecv");
+    return ESP_OK;
+}
+
+/**
+ * @brief Links grecv-->i2s_stream and plays what the leader sends.
+ */
+static esp_err_t group_activate(void)
+{
+    esp_err_t ret = group_start();
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    playback_clock_start_track(-1);
+    normalizer_follow_stream();
+    return mode_manager_run_chain(group_link_tag, 2);
+}
+
+static void group_deactivate(void)
+{
+    group_stop();
+}
+
+/**
+ * @brief Returns whether the radio is sent to the group.
+ */
+bool group_is_leader(void)
+{
+    return leader_role;
+}
+
+/**
+ * @brief Sets whether the radio is sent to the group.
+ */
+void group_set_leader(bool leader)
+{
+    leader_role = leader;
+}
+
+// Opens the socket and joins the group
+static int open_socket(void)
+{
+    int s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (s < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(CONFIG_SPEAKER_GROUP_PORT),
+        .sin_addr.s_addr = htonl(INADDR_ANY),
+    };
+    struct ip_mreq mreq = {
+        .imr_multiaddr = group_addr.sin_addr,
+        .imr_interface.s_addr = htonl(INADDR_ANY),
+    };
+    uint8_t ttl = 1;
+    uint8_t loop = 0;
+    struct timeval timeout = {
+        .tv_sec = 0,
+        .tv_usec = RECEIVE_TIMEOUT_MS * 1000,
+    };
+    if (bind(s, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        setsockopt(s, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0 ||
+        setsockopt(s, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0 ||
+        setsockopt(s, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(s);
+        return -1;
+    }
+    return s;
+}
+
+/**
+ * @brief Joins the group and starts the group task.
+ */
+esp_err_t group_start(void)
+{
+    if (running) {
+        return ESP_OK;
+    }
+    group_slot_t *mem = heap_caps_calloc(SLOT_COUNT, sizeof(group_slot_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (mem == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %d packets for the jitter buffer", SLOT_COUNT);
+        return ESP_ERR_NO_MEM;
+    }
+    sock = open_socket();
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Failed to join %s:%d", CONFIG_SPEAKER_GROUP_ADDRESS, CONFIG_SPEAKER_GROUP_PORT);
+        free(mem);
+        return ESP_FAIL;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    slots = mem;
+    group_jitter_init(&jitter, slots, SLOT_COUNT);
+    group_player_reset(&player);
+    group_clock_reset(&clock_filter);
+    leader_node = 0;
+    peer_count = 0;
+    running = true;
+    xSemaphoreGive(lock);
+
+    if (xTaskCreate(group_task, "group", TASK_STACK, NULL, TASK_PRIO, NULL) != pdPASS) {
+        running = false;
+        group_stop();
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Every speaker of the group plays the same format
+    i2s_stream_set_clk(mode_manager_get_i2s_writer(), GROUP_RATE, 16, GROUP_CHANNELS);
+    vu_meter_set_format(GROUP_RATE, GROUP_CHANNELS);
+    playback_clock_set_format(GROUP_RATE, GROUP_CHANNELS, 16);
+    normalizer_set_format(GROUP_RATE, GROUP_CHANNELS, 16);
+    eq_set_format(GROUP_RATE, GROUP_CHANNELS, 16);
+
+    // The packets keep coming while the speaker is quiet, Wi-Fi must not sleep
+    if (!power_held) {
+        power_governor_hold();
+        power_held = true;
+    }
+    ESP_LOGI(TAG, "[ * ] Joined %s:%d, %d ms delay", CONFIG_SPEAKER_GROUP_ADDRESS, CONFIG_SPEAKER_GROUP_PORT,
+             CONFIG_SPEAKER_GROUP_DELAY_MS);
+    return ESP_OK;
+}
+
+/**
+ * @brief Stops the group task and leaves the group.
+ */
+void group_stop(void)
+{
+    if (running) {
+        running = false;
+        xSemaphoreTake(task_done, pdMS_TO_TICKS(1000));
+    }
+    if (sock >= 0) {
+        // Closing the socket leaves the multicast group
+        close(sock);
+        sock = -1;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    free(slots);
+    slots = NULL;
+    xSemaphoreGive(lock);
+    if (power_held) {
+        power_governor_release();
+        power_held = false;
+    }
+}
+
+/**
+ * @brief Sets the format of the decoded audio the leader sends.
+ */
+void group_set_source_format(int rate, int channels)
+{
+    rsp_filter_set_src_info(filter_el, rate, channels);
+}
+
+/**
+ * @brief Reads the state of the group.
+ */
+void group_get_status(group_status_t *status)
+{
+    int64_t now = esp_timer_get_time();
+    memset(status, 0, sizeof(*status));
+    status->node = node_id;
+    xSemaphoreTake(lock, portMAX_DELAY);
+    status->running = running;
+    own_stats(&status->stats, now);
+    int locked = 0;
+    int32_t low = 0;
+    int32_t high = 0;
+    if (status->stats.locked) {
+        low = high = status->stats.error_us;
+        locked++;
+    }
+    for (int i = 0; i < peer_count; i++) {
+        if (now - peer_seen_us[i] > GROUP_PEER_TIMEOUT_US) {
+            continue;
+        }
+        const group_stats_t *s = &peers[i].stats;
+        status->peers[status->peer_count++] = peers[i];
+        if (s->locked) {
+            low = locked == 0 || s->error_us < low ? s->error_us : low;
+            high = locked == 0 || s->error_us > high ? s->error_us : high;
+            locked++;
+        }
+    }
+    xSemaphoreGive(lock);
+    status->spread_us = high - low;
+}
@@ -0,0 +1,407 @@
+#include <string.h>
+#include "group_sync.h"
+
+#define GROUP_VERSION 1
+
+/* Controller: ppm per frame of error, ppm per frame and render added to the integral */
+#define KP 5.0f
+#define KI 0.0015f
+
+/* Weight of a new error measurement in the smoothed error, 1/16 */
+#define ERROR_SMOOTHING 0.0625f
+
+/* Frames of the timeline per microsecond of the leader's clock, as a Q16 fraction of 1000 */
+#define FRAMES_Q16_PER_MS ((int64_t)GROUP_RATE * 65536 / 1000)
+
+static void put32(uint8_t *out, uint32_t v)
+{
+    out[0] = v;
+    out[1] = v >> 8;
+    out[2] = v >> 16;
+    out[3] = v >> 24;
+}
+
+static uint32_t get32(const uint8_t *in)
+{
+    return in[0] | (in[1] << 8) | (in[2] << 16) | ((uint32_t)in[3] << 24);
+}
+
+static void put64(uint8_t *out, int64_t v)
+{
+    put32(out, (uint64_t)v);
+    put32(out + 4, (uint64_t)v >> 32);
+}
+
+static int64_t get64(const uint8_t *in)
+{
+    return (int64_t)(get32(in) | ((uint64_t)get32(in + 4) << 32));
+}
+
+/**
+ * @brief Encodes a datagram.
+ */
+int group_msg_encode(uint8_t *out, const group_msg_t *msg)
+{
+    out[0] = 'G';
+    out[1] = 'S';
+    out[2] = GROUP_VERSION;
+    out[3] = msg->type;
+    put32(out + 4, msg->node);
+    put32(out + 8, msg->seq);
+    int n = GROUP_HEADER_SIZE;
+    switch (msg->type) {
+    case GROUP_MSG_AUDIO:
+        put64(out + n, msg->time_us[0]);
+        n += 8;
+        // Both ends are little endian, the samples go as they are
+        memcpy(out + n, msg->pcm, GROUP_PACKET_BYTES);
+        n += GROUP_PACKET_BYTES;
+        break;
+    case GROUP_MSG_CLOCK_REQ:
+    case GROUP_MSG_CLOCK_RESP:
+        for (int i = 0; i < 3; i++) {
+            put64(out + n, msg->time_us[i]);
+            n += 8;
+        }
+        break;
+    case GROUP_MSG_REPORT: {
+        const group_stats_t *s = &msg->stats;
+        out[n++] = s->leader;
+        out[n++] = s->locked;
+        out[n++] = 0;
+        out[n++] = 0;
+        uint32_t fields[] = {s->error_us, s->rtt_us, s->correction_ppb, s->received, s->concealed, s->late,
+                             s->resyncs};
+        for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+            put32(out + n, fields[i]);
+            n += 4;
+        }
+        break;
+    }
+    }
+    return n;
+}
+
+/**
+ * @brief Decodes a datagram.
+ */
+bool group_msg_decode(const uint8_t *in, int len, group_msg_t *msg)
+{
+    if (len < GROUP_HEADER_SIZE || in[0] != 'G' || in[1] != 'S' || in[2] != GROUP_VERSION) {
+        return false;
+    }
+    memset(msg, 0, sizeof(*msg));
+    msg->type = in[3];
+    msg->node = get32(in + 4);
+    msg->seq = get32(in + 8);
+    const uint8_t *p = in + GROUP_HEADER_SIZE;
+    len -= GROUP_HEADER_SIZE;
+    switch (msg->type) {
+    case GROUP_MSG_AUDIO:
+        if (len != 8 + GROUP_PACKET_BYTES) {
+            return false;
+        }
+        msg->time_us[0] = get64(p);
+        msg->pcm = (const int16_t *)(p + 8);
+        return true;
+    case GROUP_MSG_CLOCK_REQ:
+    case GROUP_MSG_CLOCK_RESP:
+        if (len != 24) {
+            return false;
+        }
+        for (int i = 0; i < 3; i++) {
+            msg->time_us[i] = get64(p + 8 * i);
+        }
+        return true;
+    case GROUP_MSG_REPORT: {
+        if (len != 32) {
+            return false;
+        }
+        group_stats_t *s = &msg->stats;
+        s->leader = p[0];
+        s->locked = p[1];
+        p += 4;
+        s->error_us = get32(p);
+        s->rtt_us = get32(p + 4);
+        s->correction_ppb = get32(p + 8);
+        s->received = get32(p + 12);
+        s->concealed = get32(p + 16);
+        s->late = get32(p + 20);
+        s->resyncs = get32(p + 24);
+        return true;
+    }
+    }
+    return false;
+}
+
+/**
+ * @brief Forgets all exchanges.
+ */
+void group_clock_reset(group_clock_t *clock)
+{
+    memset(clock, 0, sizeof(*clock));
+}
+
+/**
+ * @brief Adds an exchange.
+ */
+void group_clock_add(group_clock_t *clock, int64_t t1, int64_t t2, int64_t t3, int64_t t4)
+{
+    int64_t rtt = (t4 - t1) - (t3 - t2);
+    if (rtt < 0 || rtt > GROUP_CLOCK_RTT_MAX_US) {
+        return;
+    }
+    clock->offset_us[clock->next] = ((t2 - t1) + (t3 - t4)) / 2;
+    clock->time_us[clock->next] = t4;
+    clock->rtt_us[clock->next] = rtt;
+    clock->next = (clock->next + 1) % GROUP_CLOCK_WINDOW;
+    if (clock->count < GROUP_CLOCK_WINDOW) {
+        clock->count++;
+    }
+}
+
+/**
+ * @brief Returns the offset of the exchange with the smallest error bound now.
+ */
+bool group_clock_get(const group_clock_t *clock, int64_t now_us, int64_t *offset_us, int32_t *rtt_us)
+{
+    if (clock->count == 0) {
+        return false;
+    }
+    // Queueing only ever delays one direction, a fast exchange has the least asymmetry
+    int best = -1;
+    int64_t best_bound = 0;
+    for (int i = 0; i < clock->count; i++) {
+        int64_t bound = clock->rtt_us[i] / 2 + (now_us - clock->time_us[i]) * GROUP_CLOCK_DRIFT_PPM / 1000000;
+        if (best < 0 || bound < best_bound) {
+            best = i;
+            best_bound = bound;
+        }
+    }
+    *offset_us = clock->offset_us[best];
+    if (rtt_us) {
+        *rtt_us = clock->rtt_us[best];
+    }
+    return true;
+}
+
+/**
+ * @brief Initializes an empty jitter buffer.
+ */
+void group_jitter_init(group_jitter_t *jitter, group_slot_t *slots, int count)
+{
+    memset(jitter, 0, sizeof(*jitter));
+    jitter->slots = slots;
+    jitter->slot_count = count;
+    group_jitter_reset(jitter);
+}
+
+/**
+ * @brief Forgets the timeline and all packets.
+ */
+void group_jitter_reset(group_jitter_t *jitter)
+{
+    for (int i = 0; i < jitter->slot_count; i++) {
+        jitter->slots[i].state = GROUP_SLOT_EMPTY;
+    }
+    jitter->started = false;
+    jitter->read_seq = 0;
+    jitter->read_slot = 0;
+    jitter->conceal_run = GROUP_CONCEAL_MAX;
+    jitter->last_seq = UINT32_MAX;
+    memset(jitter->last, 0, sizeof(jitter->last));
+}
+
+// Slot of a packet at most slot_count after read_seq. By the distance, as seq % slot_count
+// jumps where the packet number wraps unless the count divides 2^32
+static group_slot_t *slot_of(group_jitter_t *jitter, uint32_t seq)
+{
+    return &jitter->slots[(jitter->read_slot + (seq - jitter->read_seq)) % jitter->slot_count];
+}
+
+/**
+ * @brief Stores a received audio packet.
+ */
+group_push_result_t group_jitter_push(group_jitter_t *jitter, int64_t base_us, uint32_t seq, const int16_t *pcm)
+{
+    group_push_result_t result = GROUP_PUSH_STORED;
+    int64_t moved = base_us - jitter->base_us;
+    if (!jitter->started || moved > GROUP_TIMELINE_SLACK_US || moved < -GROUP_TIMELINE_SLACK_US) {
+        // The leader started over, after a station change or a stall
+        group_jitter_reset(jitter);
+        jitter->started = true;
+        jitter->base_us = base_us;
+        jitter->read_seq = seq;
+        result = GROUP_PUSH_NEW_TIMELINE;
+    }
+    // Wraps after 248 days, the distance stays right across it
+    uint32_t ahead = seq - jitter->read_seq;
+    if (ahead >= (uint32_t)jitter->slot_count) {
+        jitter->late++;
+        return GROUP_PUSH_DROPPED;
+    }
+    group_slot_t *slot = slot_of(jitter, seq);
+    if (slot->state != GROUP_SLOT_EMPTY && slot->seq == seq) {
+        jitter->late++;
+        return GROUP_PUSH_DROPPED;
+    }
+    slot->seq = seq;
+    slot->state = GROUP_SLOT_READY;
+    memcpy(slot->pcm, pcm, GROUP_PACKET_BYTES);
+    jitter->received++;
+    return result;
+}
+
+// Releases the packets before seq
+static void release(group_jitter_t *jitter, uint32_t seq)
+{
+    int32_t behind = seq - jitter->read_seq;
+    if (behind <= 0) {
+        return;
+    }
+    int count = behind < jitter->slot_count ? behind : jitter->slot_count;
+    for (int i = 0; i < count; i++) {
+        group_slot_t *slot = slot_of(jitter, jitter->read_seq + i);
+        if (slot->seq == jitter->read_seq + i) {
+            slot->state = GROUP_SLOT_EMPTY;
+        }
+    }
+    jitter->read_slot = (jitter->read_slot + behind % jitter->slot_count) % jitter->slot_count;
+    jitter->read_seq = seq;
+}
+
+// Repeats the last packet played, each repetition at half the gain, fading within the packet
+static void conceal(group_jitter_t *jitter, group_slot_t *slot)
+{
+    int run = jitter->conceal_run < GROUP_CONCEAL_MAX ? jitter->conceal_run : GROUP_CONCEAL_MAX;
+    int32_t from = run < GROUP_CONCEAL_MAX ? 65536 >> run : 0;
+    int32_t to = run + 1 < GROUP_CONCEAL_MAX ? 65536 >> (run + 1) : 0;
+    for (int i = 0; i < GROUP_PACKET_FRAMES; i++) {
+        int32_t gain = from + (to - from) * i / GROUP_PACKET_FRAMES;
+        for (int c = 0; c < GROUP_CHANNELS; c++) {
+            int k = i * GROUP_CHANNELS + c;
+            slot->pcm[k] = (jitter->last[k] * gain) >> 16;
+        }
+    }
+    slot->state = GROUP_SLOT_CONCEALED;
+    jitter->concealed++;
+}
+
+// Returns the packet seq, received or concealed when it is needed the first time
+static const int16_t *packet(group_jitter_t *jitter, uint32_t seq)
+{
+    group_slot_t *slot = slot_of(jitter, seq);
+    if (slot->state == GROUP_SLOT_EMPTY || slot->seq != seq) {
+        slot->seq = seq;
+        conceal(jitter, slot);
+        jitter->conceal_run++;
+        memcpy(jitter->last, slot->pcm, GROUP_PACKET_BYTES);
+    } else if (slot->state == GROUP_SLOT_READY && jitter->last_seq != seq) {
+        jitter->conceal_run = 0;
+        memcpy(jitter->last, slot->pcm, GROUP_PACKET_BYTES);
+    }
+    jitter->last_seq = seq;
+    return slot->pcm;
+}
+
+/**
+ * @brief Copies frames of the timeline, concealing missing packets.
+ */
+void group_jitter_read(group_jitter_t *jitter, int64_t first, int count, int16_t *out)
+{
+    if (!jitter->started) {
+        memset(out, 0, count * GROUP_CHANNELS * 2);
+        return;
+    }
+    if (first >= 0) {
+        release(jitter, first / GROUP_PACKET_FRAMES);
+    }
+    while (count > 0) {
+        int n;
+        if (first < 0) {
+            n = -first < count ? -first : count;
+            memset(out, 0, n * GROUP_CHANNELS * 2);
+        } else {
+            uint32_t seq = first / GROUP_PACKET_FRAMES;
+            int offset = first % GROUP_PACKET_FRAMES;
+            n = GROUP_PACKET_FRAMES - offset < count ? GROUP_PACKET_FRAMES - offset : count;
+            if (seq - jitter->read_seq >= (uint32_t)jitter->slot_count) {
+                // Beyond the buffer, only after a jump of the position
+                memset(out, 0, n * GROUP_CHANNELS * 2);
+            } else {
+                memcpy(out, packet(jitter, seq) + offset * GROUP_CHANNELS, n * GROUP_CHANNELS * 2);
+            }
+        }
+        out += n * GROUP_CHANNELS;
+        first += n;
+        count -= n;
+    }
+}
+
+/**
+ * @brief Resets the play position.
+ */
+void group_player_reset(group_player_t *player)
+{
+    player->locked = false;
+    player->pos = 0;
+    player->frac = 0;
+    player->error = 0;
+}
+
+/**
+ * @brief Renders the next frames of the timeline.
+ */
+void group_player_render(group_player_t *player, group_jitter_t *jitter, int64_t play_us, int16_t *out, int frames)
+{
+    if (!jitter->started) {
+        player->locked = false;
+        memset(out, 0, frames * GROUP_CHANNELS * 2);
+        return;
+    }
+
+    // Frame of the timeline that should be heard at play_us, Q16
+    int64_t target = (play_us - jitter->base_us) * FRAMES_Q16_PER_MS / 1000;
+    int64_t pos = player->pos * 65536 + (player->frac >> 16);
+    float error = (target - pos) / 65536.0f;
+    if (!player->locked || error > GROUP_RESYNC_FRAMES || error < -GROUP_RESYNC_FRAMES) {
+        if (player->locked) {
+            player->resyncs++;
+        }
+        player->locked = true;
+        player->pos = target >> 16;
+        player->frac = (uint32_t)(target & 0xffff) << 16;
+        player->error = 0;
+    } else {
+        player->error += (error - player->error) * ERROR_SMOOTHING;
+        player->integral += KI * player->error;
+        if (player->integral > GROUP_PPM_MAX) {
+            player->integral = GROUP_PPM_MAX;
+        } else if (player->integral < -GROUP_PPM_MAX) {
+            player->integral = -GROUP_PPM_MAX;
+        }
+        float ppm = KP * player->error + player->integral;
+        player->ppm = ppm > GROUP_PPM_MAX ? GROUP_PPM_MAX : (ppm < -GROUP_PPM_MAX ? -GROUP_PPM_MAX : ppm);
+    }
+
+    // Late speakers step through the timeline a little faster than one frame per frame
+    uint64_t step = (1ULL << 32) + (int64_t)(player->ppm * 4294.967296f);
+    uint64_t end = player->frac + step * (frames - 1);
+    int needed = (int)(end >> 32) + 2;
+    int16_t *in = player->scratch;
+    group_jitter_read(jitter, player->pos, needed, in);
+
+    uint64_t at = player->frac;
+    for (int i = 0; i < frames; i++) {
+        int k = (int)(at >> 32) * GROUP_CHANNELS;
+        int32_t f = (at >> 16) & 0xffff;
+        for (int c = 0; c < GROUP_CHANNELS; c++) {
+            int32_t a = in[k + c];
+            int32_t b = in[k + GROUP_CHANNELS + c];
+            out[i * GROUP_CHANNELS + c] = a + (int32_t)(((int64_t)(b - a) * f) >> 16);
+        }
+        at += step;
+    }
+    player->pos += at >> 32;
+    player->frac = (uint32_t)at;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "esp_err.h"
+#include "mode_manager.h"
+#include "scheduler.h"
+
+/**
+ * @brief Talking clock, wake-up alarm and sleep timer, driven by the scheduler.
+ *
+ * The talking clock announces the time on every full hour through the voice pack,
+ * while the SD card player is active. The alarm starts a mode every day at a local
+ * time and fades the volume in, the sleep timer fades the volume out and parks the
+ * pipeline. All of them follow the daylight saving time changes, see scheduler.h.
+ */
+
+/* Time the alarm takes to fade in to its volume */
+#define ALARM_CLOCK_FADE_IN_MS (60 * 1000)
+
+/* Time the sleep timer takes to fade out */
+#define ALARM_CLOCK_FADE_OUT_MS (30 * 1000)
+
+/**
+ * @brief Starts the hourly announcement when enabled in menuconfig.
+ *
+ * The scheduler and the mode manager must be running.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t alarm_clock_init(void);
+
+/**
+ * @brief Announces the current time through the voice pack.
+ *
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE when the SD card player is not active,
+ * ESP_ERR_NOT_SUPPORTED when it is not built.
+ */
+esp_err_t alarm_clock_announce_time(void);
+
+/**
+ * @brief Sets the daily alarm, replacing the previous one.
+ *
+ * @param hour Hour, 0 to 23.
+ * @param minute Minute, 0 to 59.
+ * @param mode Mode the alarm starts.
+ * @param volume Volume the alarm fades in to, in percent.
+ */
+void alarm_clock_set_alarm(int hour, int minute, player_mode_t mode, int volume);
+
+/**
+ * @brief Turns the daily alarm off.
+ */
+void alarm_clock_cancel_alarm(void);
+
+/**
+ * @brief Fades out and parks the pipeline after a number of minutes, replacing a running sleep timer.
+ *
+ * @param minutes Minutes until the fade out starts.
+ */
+void alarm_clock_start_sleep_timer(int minutes);
+
+/**
+ * @brief Stops the sleep timer, and its fade out when it already started.
+ */
+void alarm_clock_cancel_sleep_timer(void);
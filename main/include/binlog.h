@@ -0,0 +1,72 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_log.h"
+
+/**
+ * @brief Deferred binary logging for the audio and key paths.
+ *
+ * A log call stores the address of its format string, the tag, a timestamp and up to
+ * four raw arguments in a ring of the calling core. Nothing is formatted and no
+ * lock is taken: a slot is reserved with an atomic increment and published with a
+ * sequence number, so tasks and interrupts on the same core can log concurrently. A
+ * low priority task drains both rings and prints the records through esp_log_write(),
+ * which applies the normal log level filter.
+ *
+ * Arguments are read as words the size of a pointer, 32 bits on the ESP32: integers,
+ * characters and pointers work, 64-bit integers and floating point do not. A %s argument is read when the record is printed,
+ * so it must point to a string that stays valid, such as a literal. When the drain task
+ * falls behind, the oldest records are overwritten and counted as dropped.
+ */
+
+/* Records per core, a power of two */
+#define BINLOG_RING_SIZE 64
+
+/* Maximum number of arguments of one record */
+#define BINLOG_MAX_ARGS 4
+
+/* Interval of the drain task */
+#define BINLOG_DRAIN_MS 100
+
+#define BINLOG_NARGS(...) BINLOG_NARGS_(0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define BINLOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+
+#define BINLOGE(tag, format, ...) binlog_write(ESP_LOG_ERROR, tag, format, BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define BINLOGW(tag, format, ...) binlog_write(ESP_LOG_WARN, tag, format, BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define BINLOGI(tag, format, ...) binlog_write(ESP_LOG_INFO, tag, format, BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+#define BINLOGD(tag, format, ...) binlog_write(ESP_LOG_DEBUG, tag, format, BINLOG_NARGS(__VA_ARGS__), ##__VA_ARGS__)
+
+/**
+ * @brief Starts the task that prints the records.
+ *
+ * Records written before the task starts are kept until the ring wraps.
+ *
+ * @param task_prio Priority of the drain task, below the audio tasks.
+ * @return ESP_OK on success.
+ */
+esp_err_t binlog_init(int task_prio);
+
+/**
+ * @brief Stores a record, use the BINLOG macros instead.
+ *
+ * @param level Log level.
+ * @param tag Tag, must stay valid.
+ * @param format Format string, must stay valid.
+ * @param nargs Number of arguments that follow, at most BINLOG_MAX_ARGS.
+ */
+void binlog_write(esp_log_level_t level, const char *tag, const char *format, int nargs, ...) __attribute__((format(printf, 3, 5)));
+
+/**
+ * @brief Prints all records in the rings.
+ *
+ * Called by the drain task, may also be called before a restart.
+ *
+ * @return Number of records printed.
+ */
+int binlog_flush(void);
+
+/**
+ * @brief Returns the number of records overwritten before they were printed.
+ */
+uint32_t binlog_get_dropped(void);
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "esp_err.h"
+
+/**
+ * @brief HTTP control API and WebSocket status push.
+ *
+ * A small REST surface on the local network does what the board keys do, all calls
+ * answer with the status as JSON:
+ *
+ *   GET  /api/status
+ *   POST /api/play                 play or pause, like [Play]
+ *   POST /api/next                 next song or station, like [Set]
+ *   POST /api/volume?level=N       or ?delta=N
+ *   POST /api/station?index=N      only with the radio mode built
+ *   POST /api/mode?name=radio      radio, sdcard, tuner or group, the modes built, answers
+ *                                  before the switch is done, the push shows the new mode
+ *   POST /api/trace?action=save    or replay, with CONFIG_SPEAKER_TRACE, see trace_recorder.h
+ *   GET  /api/group                with CONFIG_SPEAKER_GROUP, answers with the group state
+ *   POST /api/group?leader=1       or 0, sends the radio to the group, see group.h
+ *
+ * A WebSocket on /ws gets the full status when it connects and afterwards only the
+ * fields that changed, checked every push interval: mode, track, playing, position,
+ * volume, station, the buffered audio and the underrun count of the playback clock.
+ *
+ * The server task runs below the audio tasks. Open sockets, WebSocket clients, query
+ * strings and messages are bounded and nothing is allocated per request, a new
+ * connection beyond the limit closes the least recently used one.
+ */
+
+/* Most WebSocket clients that get the status push */
+#define CONTROL_SERVER_WS_CLIENTS 2
+
+/**
+ * @brief Configuration of the control server.
+ */
+typedef struct {
+    int port;               /*!< TCP port */
+    int max_sockets;        /*!< Open sockets, HTTP and WebSocket together */
+    int task_stack;         /*!< Stack size of the server task */
+    int task_prio;          /*!< Priority of the server task, below the audio tasks */
+    int push_interval_ms;   /*!< Interval of the status check for the WebSocket push */
+} control_server_cfg_t;
+
+#define CONTROL_SERVER_CFG_DEFAULT() {  \
+    .port = 80,                         \
+    .max_sockets = 4,                   \
+    .task_stack = 4096,                 \
+    .task_prio = 2,                     \
+    .push_interval_ms = 250,            \
+}
+
+/**
+ * @brief Starts the control server.
+ *
+ * The mode manager and the scheduler must be running, the server listens on all
+ * interfaces once the network is up.
+ *
+ * @param config Server configuration.
+ * @return ESP_OK on success.
+ */
+esp_err_t control_server_start(const control_server_cfg_t *config);
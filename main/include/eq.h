@@ -0,0 +1,170 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Parametric equalizer of everything written to I2S.
+ *
+ * A cascade of up to EQ_MAX_BANDS biquad filters, designed in floating point when a
+ * preset or the sample rate changes and run in fixed point in the I2S write path,
+ * before the normalizer so its limiter catches what the boosts add. Both channels of
+ * a frame go through a band together, with Q28 coefficients, 64-bit accumulators and
+ * error feedback so low shelves stay clean at 48 kHz.
+ *
+ * A new preset is crossfaded from the old one over one block of EQ_BLOCK_FRAMES, so
+ * changes do not click. A preset without bands and preamp leaves the write path
+ * untouched.
+ *
+ * The active preset is kept in NVS, EQ_USER_PRESETS more can be stored there.
+ *
+ * Without CONFIG_SPEAKER_EQUALIZER only the calls of the write path remain, as empty
+ * inline functions.
+ */
+
+/* Most bands of a preset */
+#define EQ_MAX_BANDS 6
+
+/* Frames processed per block, also the length of the crossfade */
+#define EQ_BLOCK_FRAMES 256
+
+/* Presets that can be stored in NVS besides the active one */
+#define EQ_USER_PRESETS 4
+
+/* Longest preset name, with the terminator */
+#define EQ_NAME_MAX 16
+
+typedef enum {
+    EQ_BAND_OFF = 0,
+    EQ_BAND_PEAK,           /*!< Bell around the frequency */
+    EQ_BAND_LOW_SHELF,      /*!< Everything below the frequency */
+    EQ_BAND_HIGH_SHELF,     /*!< Everything above the frequency */
+    EQ_BAND_HIGH_PASS,      /*!< Cuts below the frequency, the gain is ignored */
+} eq_band_type_t;
+
+/**
+ * @brief One band of a preset.
+ */
+typedef struct {
+    uint8_t type;           /*!< eq_band_type_t */
+    uint16_t freq_hz;       /*!< Center or corner frequency */
+    int16_t gain_db10;      /*!< Gain in dB times 10 */
+    uint16_t q100;          /*!< Quality factor times 100, the slope for shelves */
+} eq_band_t;
+
+/**
+ * @brief An equalizer setting, stored as a blob in NVS.
+ */
+typedef struct {
+    char name[EQ_NAME_MAX];
+    int16_t preamp_db10;    /*!< Gain before the bands in dB times 10, negative to leave room for boosts */
+    uint8_t band_count;
+    eq_band_t bands[EQ_MAX_BANDS];
+} eq_preset_t;
+
+/* Built-in presets */
+typedef enum {
+    EQ_PRESET_FLAT = 0,
+    EQ_PRESET_LYRAT_SPEAKER,    /*!< Bass and presence for the speakers of the LyraT */
+    EQ_PRESET_VOICE,            /*!< Speech clarity for radio talk and announcements */
+    EQ_PRESET_COUNT,
+} eq_builtin_t;
+
+#if CONFIG_SPEAKER_EQUALIZER
+
+/**
+ * @brief Loads the active preset from NVS, or the LyraT speaker preset the first time.
+ *
+ * NVS must be initialized.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t eq_init(void);
+
+/**
+ * @brief Returns a built-in preset.
+ *
+ * @param preset Built-in preset.
+ * @return The preset, NULL when out of range.
+ */
+const eq_preset_t *eq_get_builtin(eq_builtin_t preset);
+
+/**
+ * @brief Crossfades to a preset.
+ *
+ * @param preset Preset to apply, copied.
+ * @param save Store it in NVS as the preset to start with.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an invalid preset.
+ */
+esp_err_t eq_apply(const eq_preset_t *preset, bool save);
+
+/**
+ * @brief Reads the active preset.
+ *
+ * @param preset Receives the preset.
+ */
+void eq_get_active(eq_preset_t *preset);
+
+/**
+ * @brief Stores a preset in a user slot in NVS.
+ *
+ * @param slot Slot, 0 to EQ_USER_PRESETS - 1.
+ * @param preset Preset to store.
+ * @return ESP_OK on success.
+ */
+esp_err_t eq_store_preset(int slot, const eq_preset_t *preset);
+
+/**
+ * @brief Reads a preset from a user slot in NVS.
+ *
+ * @param slot Slot, 0 to EQ_USER_PRESETS - 1.
+ * @param preset Receives the preset.
+ * @return ESP_OK on success, ESP_ERR_NVS_NOT_FOUND for an empty slot.
+ */
+esp_err_t eq_load_preset(int slot, eq_preset_t *preset);
+
+/**
+ * @brief Turns the equalizer off or on again, with a crossfade, without changing the preset.
+ *
+ * @param bypass True to pass the audio unchanged.
+ */
+void eq_set_bypass(bool bypass);
+
+/**
+ * @brief Sets the format of the audio written to I2S, call it together with i2s_stream_set_clk().
+ *
+ * The filters are designed again for the new rate. Only 16-bit audio with one or two
+ * channels is equalized, other formats pass unchanged.
+ *
+ * @param rate Sample rate in Hz.
+ * @param channels Number of channels.
+ * @param bits Bits per sample.
+ */
+void eq_set_format(int rate, int channels, int bits);
+
+/**
+ * @brief Filters in place, called by the elements that write to I2S.
+ *
+ * @param buffer Interleaved samples.
+ * @param len Length in bytes.
+ */
+void eq_process(char *buffer, int len);
+
+#else
+
+static inline esp_err_t eq_init(void)
+{
+    return ESP_OK;
+}
+
+static inline void eq_set_format(int rate, int channels, int bits)
+{
+}
+
+static inline void eq_process(char *buffer, int len)
+{
+}
+
+#endif
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "audio_element.h"
+#include "driver/i2s.h"
+
+/**
+ * @brief Single-task WAV playback element for the SD card player.
+ *
+ * The element reads the file set with audio_element_set_uri(), parses the RIFF/WAVE
+ * header, converts the PCM to the output format and writes it to the I2S DMA
+ * buffers itself. It replaces the fatfs_stream-->wav_decoder-->resample-->i2s_stream
+ * chain with one task and one buffer, so it has no ring buffers and no task switches
+ * per buffer. The I2S driver must already be installed, i2s_stream_init() does that.
+ *
+ * Supported input: what pcm_format_of() accepts, 8 to 32-bit integer or 32-bit float
+ * PCM, mono or stereo, any sample rate. 16-bit stereo at the output rate is written
+ * without a copy, other formats are converted in the read buffer first.
+ */
+
+/**
+ * @brief Configuration of the fused playback element.
+ */
+typedef struct {
+    i2s_port_t i2s_port;    /*!< I2S port the driver was installed on */
+    int out_rate;           /*!< Output sample rate, the I2S clock */
+    int buf_sz;             /*!< Bytes read from the file per iteration */
+    int task_stack;         /*!< Task stack size */
+    int task_core;          /*!< Task running core */
+    int task_prio;          /*!< Task priority */
+    int multi_out_num;      /*!< Multi output ring buffers that get a copy of the output, written without waiting */
+} fused_player_cfg_t;
+
+#define FUSED_PLAYER_CFG_DEFAULT() {    \
+    .i2s_port = I2S_NUM_0,              \
+    .out_rate = 48000,                  \
+    .buf_sz = 2048,                     \
+    .task_stack = 4096,                 \
+    .task_core = 0,                     \
+    .task_prio = 23,                    \
+    .multi_out_num = 0,                 \
+}
+
+/**
+ * @brief Creates the fused playback element.
+ *
+ * The element reports the music info of every file it opens and finishes like
+ * i2s_stream does, so the player can treat it as the last element of the chain.
+ *
+ * @param config Element configuration.
+ * @return Element handle, or NULL on failure.
+ */
+audio_element_handle_t fused_player_init(fused_player_cfg_t *config);
+
+/**
+ * @brief Jumps to a time in the playing file.
+ *
+ * The element task moves the file before its next buffer, so the audio continues at
+ * the new position after the DMA buffers already written, without stopping the
+ * element. A time past the end finishes the file. A seek while paused is applied on
+ * resume, a seek while stopped applies to the next file the element opens.
+ *
+ * @param self The fused playback element.
+ * @param position_ms Time from the start of the file.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for a negative time.
+ */
+esp_err_t fused_player_seek(audio_element_handle_t self, int64_t position_ms);
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "mode_manager.h"
+#include "group_sync.h"
+
+/**
+ * @brief Synchronized playback on several speakers over UDP multicast.
+ *
+ * One speaker is the leader. While it plays the radio, the decoded stream is resampled
+ * to 48 kHz stereo by the "gfilter" element and the "gsend" element multicasts it to
+ * CONFIG_SPEAKER_GROUP_ADDRESS in packets stamped with the leader's clock, to be heard
+ * CONFIG_SPEAKER_GROUP_DELAY_MS after they were sent. The leader plays its own packets
+ * through the same jitter buffer and rate control as every other speaker, so it is just
+ * one more speaker of the group.
+ *
+ * The other speakers are in the Group mode, where the "grecv" element renders the
+ * packets received by the group task. The task also answers or sends the clock
+ * exchanges and multicasts a report of the speaker once a second. Each speaker knows
+ * from the playback clock when the audio it writes will be heard and steers its rate
+ * so that this happens at the time the leader gave, see group_sync.h.
+ *
+ * The reports of all speakers are collected, group_get_status() returns them with the
+ * spread of the sync errors, the offset between the earliest and the latest speaker as
+ * far as each of them can tell. tools/group.py shows the reports on a computer in the
+ * same network.
+ *
+ * The audio is sent as PCM, about 1.6 Mbit/s. The access point must forward multicast
+ * and Wi-Fi power save is held off while a group plays.
+ *
+ * Without CONFIG_SPEAKER_GROUP the leader calls are empty inline functions.
+ */
+
+/* Speakers whose reports are kept */
+#define GROUP_PEER_MAX 8
+
+/* A speaker that sent no report for this long has left */
+#define GROUP_PEER_TIMEOUT_US (5 * 1000 * 1000)
+
+/* Interval of the reports */
+#define GROUP_REPORT_INTERVAL_MS 1000
+
+/**
+ * @brief Report of another speaker.
+ */
+typedef struct {
+    uint32_t node;              /*!< Id, the last 4 bytes of the MAC address */
+    group_stats_t stats;
+} group_peer_t;
+
+/**
+ * @brief State of the group as seen by this speaker.
+ */
+typedef struct {
+    bool running;               /*!< This speaker plays or sends in the group */
+    uint32_t node;
+    group_stats_t stats;        /*!< Of this speaker */
+    int peer_count;
+    group_peer_t peers[GROUP_PEER_MAX];
+    int32_t spread_us;          /*!< Largest minus smallest sync error of the locked speakers */
+} group_status_t;
+
+#if CONFIG_SPEAKER_GROUP
+
+// Group mode for the mode manager, plays what the leader sends
+extern const player_mode_ops_t group_mode_ops;
+
+/**
+ * @brief Returns whether the radio is sent to the group.
+ */
+bool group_is_leader(void);
+
+/**
+ * @brief Sets whether the radio is sent to the group, from the next start of the radio.
+ */
+void group_set_leader(bool leader);
+
+/**
+ * @brief Joins the group and starts the group task, for the leader or the Group mode.
+ *
+ * Sets the I2S format to the one of the group. Does nothing while the group runs.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t group_start(void);
+
+/**
+ * @brief Stops the group task and leaves the group.
+ *
+ * Call it after the pipeline was stopped.
+ */
+void group_stop(void);
+
+/**
+ * @brief Sets the format of the decoded audio the leader sends, for the resampler.
+ */
+void group_set_source_format(int rate, int channels);
+
+/**
+ * @brief Reads the state of the group.
+ */
+void group_get_status(group_status_t *status);
+
+#else
+
+static inline bool group_is_leader(void)
+{
+    return false;
+}
+
+static inline esp_err_t group_start(void)
+{
+    return ESP_OK;
+}
+
+static inline void group_stop(void)
+{
+}
+
+static inline void group_set_source_format(int rate, int channels)
+{
+}
+
+#endif
@@ -0,0 +1,266 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Media clock, jitter buffer and rate control of synchronized group playback.
+ *
+ * The leader of a group cuts the audio into packets of GROUP_PACKET_FRAMES frames and
+ * multicasts them with the time of the leader's clock at which the first frame of
+ * packet 0 must be heard, the base of the timeline. Packet n plays GROUP_PACKET_US * n
+ * after the base, a few tens of milliseconds after it was sent, so every speaker has
+ * it in time.
+ *
+ * Each follower estimates the offset of the leader's clock to its own with NTP style
+ * request and response pairs. Of the last GROUP_CLOCK_WINDOW it uses the one with the
+ * smallest error bound, half its round trip plus the drift the two crystals can have
+ * had since, so a fast exchange is preferred until it is too old. Before handing audio
+ * to I2S a speaker knows when that audio will be heard, converts the time to the
+ * leader's clock and from there to a frame of the timeline. The difference to the frame
+ * it is about to play is the sync error. A proportional and integral controller turns
+ * the smoothed error into a rate correction of a few ppm, applied by resampling with
+ * linear interpolation, so the crystal of every speaker is followed without clicks. An
+ * error larger than GROUP_RESYNC_FRAMES jumps instead.
+ *
+ * A packet that is missing when it is needed is concealed by repeating the last packet
+ * with a falling gain, after GROUP_CONCEAL_MAX in a row it is silence. Packets that come
+ * after they were needed are dropped.
+ *
+ * All audio in a group is 48 kHz 16-bit stereo. Nothing here locks, allocates or does
+ * I/O, see group.h for the sockets and the tasks on the speaker.
+ */
+
+#define GROUP_RATE 48000
+#define GROUP_CHANNELS 2
+
+/* 5 ms of audio in a packet, 960 bytes so a datagram stays below the MTU */
+#define GROUP_PACKET_FRAMES 240
+#define GROUP_PACKET_US 5000
+#define GROUP_PACKET_BYTES (GROUP_PACKET_FRAMES * GROUP_CHANNELS * 2)
+
+/* Longest datagram */
+#define GROUP_HEADER_SIZE 12
+#define GROUP_DATAGRAM_MAX (GROUP_HEADER_SIZE + 8 + GROUP_PACKET_BYTES)
+
+/* A base further from the one in use than this starts a new timeline */
+#define GROUP_TIMELINE_SLACK_US 1000
+
+/* Clock exchanges the offset is picked from, and how often a follower starts one */
+#define GROUP_CLOCK_WINDOW 32
+#define GROUP_CLOCK_INTERVAL_MS 125
+
+/* Drift of one crystal against another assumed when an exchange ages */
+#define GROUP_CLOCK_DRIFT_PPM 50
+
+/* Exchanges with a longer round trip than this say nothing about the offset */
+#define GROUP_CLOCK_RTT_MAX_US 100000
+
+/* Sync error beyond which the player jumps instead of adjusting the rate, 10 ms */
+#define GROUP_RESYNC_FRAMES 480
+
+/* Largest rate correction */
+#define GROUP_PPM_MAX 300
+
+/* Packets concealed in a row before the output is silent */
+#define GROUP_CONCEAL_MAX 3
+
+/**
+ * @brief Datagram types.
+ */
+typedef enum {
+    GROUP_MSG_AUDIO = 1,    /*!< A packet of audio, multicast by the leader */
+    GROUP_MSG_CLOCK_REQ,    /*!< t1, sent by a follower to the leader */
+    GROUP_MSG_CLOCK_RESP,   /*!< t1 echoed, t2 and t3, sent back by the leader */
+    GROUP_MSG_REPORT,       /*!< Statistics, multicast by every speaker once a second */
+} group_msg_type_t;
+
+/**
+ * @brief Statistics of a speaker, also sent in reports.
+ */
+typedef struct {
+    uint8_t leader;             /*!< Sends the audio */
+    uint8_t locked;             /*!< Plays the timeline with a known clock offset */
+    int32_t error_us;           /*!< Smoothed sync error, positive when the speaker is late */
+    int32_t rtt_us;             /*!< Round trip of the clock exchange in use */
+    int32_t correction_ppb;     /*!< Rate correction in parts per billion, positive plays faster */
+    uint32_t received;          /*!< Audio packets stored */
+    uint32_t concealed;         /*!< Packets missing when needed */
+    uint32_t late;              /*!< Packets that came after they were needed or too early */
+    uint32_t resyncs;           /*!< Jumps of the play position */
+} group_stats_t;
+
+/**
+ * @brief One decoded datagram.
+ */
+typedef struct {
+    uint8_t type;               /*!< group_msg_type_t */
+    uint32_t node;              /*!< Id of the sender */
+    uint32_t seq;               /*!< Packet number of the timeline, audio only */
+    int64_t time_us[3];         /*!< Audio: timeline base. Clock: t1, t2, t3 */
+    group_stats_t stats;        /*!< Report only */
+    const int16_t *pcm;         /*!< Audio only, GROUP_PACKET_FRAMES frames, little endian */
+} group_msg_t;
+
+/**
+ * @brief Encodes a datagram.
+ *
+ * @param out At least GROUP_DATAGRAM_MAX bytes.
+ * @param msg Datagram, the fields of its type are used.
+ * @return Bytes written.
+ */
+int group_msg_encode(uint8_t *out, const group_msg_t *msg);
+
+/**
+ * @brief Decodes a datagram.
+ *
+ * @param in Datagram as received.
+ * @param len Its length.
+ * @param msg Receives the datagram, pcm points into in.
+ * @return True when the datagram is one of this version.
+ */
+bool group_msg_decode(const uint8_t *in, int len, group_msg_t *msg);
+
+/**
+ * @brief Offset of the leader's clock, picked from the last exchanges.
+ */
+typedef struct {
+    int64_t offset_us[GROUP_CLOCK_WINDOW];
+    int64_t time_us[GROUP_CLOCK_WINDOW];    /*!< When the response came, follower clock */
+    int32_t rtt_us[GROUP_CLOCK_WINDOW];
+    int count;
+    int next;
+} group_clock_t;
+
+/**
+ * @brief Forgets all exchanges, when the leader changes.
+ */
+void group_clock_reset(group_clock_t *clock);
+
+/**
+ * @brief Adds an exchange.
+ *
+ * @param t1 Request sent, follower clock.
+ * @param t2 Request received, leader clock.
+ * @param t3 Response sent, leader clock.
+ * @param t4 Response received, follower clock.
+ */
+void group_clock_add(group_clock_t *clock, int64_t t1, int64_t t2, int64_t t3, int64_t t4);
+
+/**
+ * @brief Returns the offset of the exchange with the smallest error bound now.
+ *
+ * @param now_us Follower clock.
+ * @param offset_us Receives leader clock minus follower clock.
+ * @param rtt_us Receives the round trip of that exchange, may be NULL.
+ * @return False before the first exchange.
+ */
+bool group_clock_get(const group_clock_t *clock, int64_t now_us, int64_t *offset_us, int32_t *rtt_us);
+
+/**
+ * @brief State of a slot of the jitter buffer.
+ */
+typedef enum {
+    GROUP_SLOT_EMPTY = 0,
+    GROUP_SLOT_READY,           /*!< Holds the received packet */
+    GROUP_SLOT_CONCEALED,       /*!< Was missing when needed, holds the concealment */
+} group_slot_state_t;
+
+/**
+ * @brief A slot of the jitter buffer, allocated by the caller.
+ */
+typedef struct {
+    uint32_t seq;
+    uint8_t state;              /*!< group_slot_state_t */
+    int16_t pcm[GROUP_PACKET_FRAMES * GROUP_CHANNELS];
+} group_slot_t;
+
+/**
+ * @brief Jitter buffer, the packets of one timeline by packet number.
+ */
+typedef struct {
+    group_slot_t *slots;
+    int slot_count;
+    bool started;
+    int64_t base_us;            /*!< Play time of packet 0 in the leader's clock */
+    uint32_t read_seq;          /*!< Oldest packet still needed */
+    int read_slot;              /*!< Slot of read_seq */
+    int conceal_run;            /*!< Packets concealed in a row */
+    uint32_t last_seq;          /*!< Packet in last */
+    int16_t last[GROUP_PACKET_FRAMES * GROUP_CHANNELS];    /*!< Last packet played, for the concealment */
+    uint32_t received;
+    uint32_t concealed;
+    uint32_t late;
+} group_jitter_t;
+
+/**
+ * @brief Result of group_jitter_push().
+ */
+typedef enum {
+    GROUP_PUSH_DROPPED = 0,     /*!< Late, too early or a duplicate */
+    GROUP_PUSH_STORED,
+    GROUP_PUSH_NEW_TIMELINE,    /*!< The base changed, the buffer was flushed and the packet stored */
+} group_push_result_t;
+
+/**
+ * @brief Initializes an empty jitter buffer.
+ *
+ * @param slots Slots, room for the group delay in packets plus a few.
+ * @param count Number of slots.
+ */
+void group_jitter_init(group_jitter_t *jitter, group_slot_t *slots, int count);
+
+/**
+ * @brief Forgets the timeline and all packets.
+ */
+void group_jitter_reset(group_jitter_t *jitter);
+
+/**
+ * @brief Stores a received audio packet.
+ *
+ * @param base_us Timeline base of the packet.
+ * @param seq Packet number.
+ * @param pcm GROUP_PACKET_FRAMES frames.
+ */
+group_push_result_t group_jitter_push(group_jitter_t *jitter, int64_t base_us, uint32_t seq, const int16_t *pcm);
+
+/**
+ * @brief Copies frames of the timeline, concealing missing packets.
+ *
+ * Packets before the first frame are released. Frames before packet 0 are silence.
+ *
+ * @param first Frame of the timeline, frame 0 is the first of packet 0.
+ * @param count Frames to copy.
+ * @param out Receives the frames.
+ */
+void group_jitter_read(group_jitter_t *jitter, int64_t first, int count, int16_t *out);
+
+/**
+ * @brief Play position and rate control of a speaker.
+ */
+typedef struct {
+    bool locked;                /*!< Position follows the timeline */
+    int64_t pos;                /*!< Frame of the timeline of the next output frame */
+    uint32_t frac;              /*!< Fraction of that frame */
+    float error;                /*!< Smoothed sync error in frames, positive when late */
+    float integral;             /*!< Integral part of the correction in ppm */
+    float ppm;                  /*!< Rate correction in use */
+    uint32_t resyncs;
+    int16_t scratch[(GROUP_PACKET_FRAMES + 16) * GROUP_CHANNELS];
+} group_player_t;
+
+/**
+ * @brief Resets the play position, the rate correction is kept as a starting point.
+ */
+void group_player_reset(group_player_t *player);
+
+/**
+ * @brief Renders the next frames of the timeline.
+ *
+ * Silence while the jitter buffer has no timeline.
+ *
+ * @param play_us When the first rendered frame will be heard, in the leader's clock.
+ * @param out Receives frames frames.
+ * @param frames At most GROUP_PACKET_FRAMES.
+ */
+void group_player_render(group_player_t *player, group_jitter_t *jitter, int64_t play_us, int16_t *out, int frames);
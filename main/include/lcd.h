@@ -15,6 +15,11 @@
 #include <hd44780.h>
 #include <pcf8574.h>
 
+#include "lcd_glyphs.h"
+#include "vu_meter.h"
+#include "playback_clock.h"
+#include "mode_manager.h"
+
 
 /* Define the I2C Master SDA pin for the LCD communication */
 #define LCD_I2C_MASTER_SDA 18
@@ -25,21 +30,44 @@
 /* Define the I2C address of the LCD device */
 #define LCD_I2C_ADDRESS 0x27
 
+/* Define how often the menu task redraws the spectrum, in frames per second */
+#define LCD_FRAME_RATE 10
+
+/* Define after how long without a key the open menu closes */
+#define LCD_MENU_TIMEOUT_MS 10000
+
+/* Define how many messages wait for the menu task */
+#define LCD_MENU_QUEUE_LEN 8
+
+/* Define how many radio stations the station page lists */
+#define LCD_MENU_STATIONS_MAX 32
+
 /** 
  * @brief Implements a simple menu for an LCD display using ESP32_LyraT board.
  * 
  * This module provides functionality to display a menu system on an LCD screen
  * using the ESP32_LyraT development board. It utilizes the HD44780 driver 
  * library along with the PCF8574 I2C expander for communication.
+ *
+ * The pages are tables for lcd_menu.h: the modes, the radio stations and the settings.
+ * Closed, the menu shows the modes with the arrow at the active one and the spectrum
+ * while audio plays. A long press on [Mode] opens it: [Vol+] and [Vol-] move the
+ * arrow, [Mode] and [Rec] go to the next and previous page, [Play] selects and [Set]
+ * goes back. It closes on a long press on [Mode], on [Set] on a top level page or
+ * LCD_MENU_TIMEOUT_MS after the last key.
+ *
+ * The menu task draws only when a key, the mode manager or the level analysis reports
+ * a change, or when the spectrum or the shown playback time is due. In between it
+ * sleeps on its queue.
  */
 
 // Method Declarations
 
 /**
- * @brief Makes the necesseray configurations for the LCD and uploads custom characters.
+ * @brief Makes the necesseray configurations for the LCD and initializes the glyph cache.
  * 
- * This function is setting up the configurations for the LCD module and uploads the custom 
- * characters that are used for the menu. 
+ * This function is setting up the configurations for the LCD module. The custom characters
+ * that are used for the menu are uploaded by the glyph cache when a frame needs them.
 */
 void lcd_init();
 
@@ -47,12 +75,31 @@ void lcd_init();
  * @brief Task function to display the menu on the LCD.
  * 
  * This task function runs in the FreeRTOS environment to manage the menu
- * displayed on the LCD screen.
+ * displayed on the LCD screen, see above.
  * 
  * @param pvParameters Pointer to task parameters (not used).
  */
 void menu(void *pvParameters);
 
+/**
+ * @brief Takes a key action for the menu.
+ *
+ * Called by the mode manager for every key action before it acts on it. A long press
+ * on [Mode] opens and closes the menu, while it is open every key belongs to it.
+ *
+ * @param key_id Id of the key, see input_key_user_id_t.
+ * @param action Action, see input_key_service_action_id_t.
+ * @return True when the menu took the action and the mode manager must ignore it.
+ */
+bool menu_handle_key(int key_id, int action);
+
+/**
+ * @brief Asks the menu task to redraw, after a mode switch or a pipeline event.
+ *
+ * Does not wait, may be called from any task.
+ */
+void menu_refresh(void);
+
 /**
  * @brief Writes a string at the specified position on the LCD.
  * 
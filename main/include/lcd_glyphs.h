@@ -0,0 +1,191 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <hd44780.h>
+
+/**
+ * @brief Glyph cache for the 8 CGRAM slots of the HD44780.
+ *
+ * The screen is described as a frame of 20x4 cells. A cell holds either a character
+ * from the character ROM or a glyph from the glyph library below. Rendering a frame
+ * uploads only the glyphs the frame needs that are not in CGRAM yet, evicting the least
+ * recently used slots first and preferring slots that are not visible on screen.
+ * Glyphs with identical bitmaps share a slot, glyphs that exist in the character ROM
+ * (blank, full block) never use one. Only cells that changed since the last frame are
+ * written to DDRAM.
+ *
+ * Every frame has a budget in I2C bytes. Uploads that do not fit are deferred to the
+ * next frame and their cells show a fallback character until then.
+ */
+
+/* Size of the display */
+#define LCD_COLS 20
+#define LCD_ROWS 4
+
+/* I2C bytes the PCF8574 needs for one byte to the LCD: two nibbles, each strobed with E high and low */
+#define LCD_GLYPHS_I2C_PER_LCD_BYTE 4
+
+/* Default frame budget, about 35 ms of a 100 kHz bus: a full line of text and several glyph uploads */
+#define LCD_GLYPHS_DEFAULT_BUDGET 400
+
+/**
+ * @brief Glyph library.
+ */
+typedef enum {
+    GLYPH_INTERNET_RADIO = 0,
+    GLYPH_SAMPLER,
+    GLYPH_TUNER,
+    GLYPH_GROUP,
+    GLYPH_MENU_PAGE,
+    GLYPH_CURRENT_PAGE,         /*!< Full block, from the character ROM */
+    GLYPH_ARROW,
+    GLYPH_EMPTY,                /*!< Blank, from the character ROM */
+    GLYPH_HBAR_1,               /*!< Horizontal bar, 1 of 5 columns filled */
+    GLYPH_HBAR_2,
+    GLYPH_HBAR_3,
+    GLYPH_HBAR_4,
+    GLYPH_VBAR_1,               /*!< Vertical bar, 1 of 8 rows filled */
+    GLYPH_VBAR_2,
+    GLYPH_VBAR_3,
+    GLYPH_VBAR_4,
+    GLYPH_VBAR_5,
+    GLYPH_VBAR_6,
+    GLYPH_VBAR_7,
+    GLYPH_NEEDLE_0,             /*!< Tuner needle in column 0 of the cell */
+    GLYPH_NEEDLE_1,
+    GLYPH_NEEDLE_2,
+    GLYPH_NEEDLE_3,
+    GLYPH_NEEDLE_4,
+    GLYPH_COUNT,
+} lcd_glyph_id_t;
+
+/* Cell value of a glyph, plain characters are stored as their character code */
+#define LCD_CELL_GLYPH(id) ((uint16_t)(0x100 | (id)))
+
+/**
+ * @brief Contents of the screen.
+ */
+typedef struct {
+    uint16_t cells[LCD_ROWS][LCD_COLS];
+} lcd_frame_t;
+
+/**
+ * @brief Glyph cache statistics.
+ */
+typedef struct {
+    uint32_t frames;            /*!< Frames rendered */
+    uint32_t uploads;           /*!< Glyphs uploaded to CGRAM */
+    uint32_t visible_reuploads; /*!< Uploads into a slot that was still shown in a cell that changes */
+    uint32_t deferred;          /*!< Uploads moved to a later frame by the budget */
+    uint32_t fallbacks;         /*!< Cells drawn with a fallback character */
+    uint32_t i2c_bytes;         /*!< I2C bytes sent for all frames */
+    int last_frame_bytes;       /*!< I2C bytes sent for the last frame */
+} lcd_glyphs_stats_t;
+
+/**
+ * @brief Initializes the glyph cache.
+ *
+ * CGRAM is considered empty and the whole screen unknown, so the first frame
+ * redraws every cell.
+ *
+ * @param lcd Initialized display.
+ * @param budget I2C bytes per frame, 0 for no limit.
+ */
+void lcd_glyphs_init(hd44780_t *lcd, int budget);
+
+/**
+ * @brief Renders a frame, writing only what changed since the last frame.
+ *
+ * @param frame Frame to show.
+ * @return I2C bytes sent.
+ */
+int lcd_glyphs_render(const lcd_frame_t *frame);
+
+/**
+ * @brief Returns whether the last frame showed every glyph.
+ *
+ * False when uploads were deferred by the budget, rendering the same frame again
+ * completes it.
+ */
+bool lcd_glyphs_complete(void);
+
+/**
+ * @brief Marks cells as unknown after they were written without the glyph cache.
+ *
+ * @param x First column.
+ * @param y Row.
+ * @param count Number of cells.
+ */
+void lcd_glyphs_invalidate_cells(int x, int y, int count);
+
+/**
+ * @brief Reads the glyph cache statistics.
+ *
+ * @param stats Receives the statistics.
+ */
+void lcd_glyphs_get_stats(lcd_glyphs_stats_t *stats);
+
+/**
+ * @brief Fills a frame with blanks.
+ *
+ * @param frame Frame to clear.
+ */
+void lcd_frame_clear(lcd_frame_t *frame);
+
+/**
+ * @brief Writes a string into a frame, clipped at the end of the row.
+ *
+ * @param frame Frame to write to.
+ * @param x Column.
+ * @param y Row.
+ * @param string String to write.
+ */
+void lcd_frame_puts(lcd_frame_t *frame, int x, int y, const char *string);
+
+/**
+ * @brief Places a glyph in a frame.
+ *
+ * @param frame Frame to write to.
+ * @param x Column.
+ * @param y Row.
+ * @param glyph Glyph to place.
+ */
+void lcd_frame_put_glyph(lcd_frame_t *frame, int x, int y, lcd_glyph_id_t glyph);
+
+/**
+ * @brief Draws a horizontal bar with a resolution of 5 steps per cell.
+ *
+ * Only the partially filled cell needs a CGRAM slot.
+ *
+ * @param frame Frame to write to.
+ * @param x First column.
+ * @param y Row.
+ * @param width Width of the bar in cells.
+ * @param value Value to show.
+ * @param max Value of a full bar.
+ */
+void lcd_frame_hbar(lcd_frame_t *frame, int x, int y, int width, int value, int max);
+
+/**
+ * @brief Draws a vertical bar of 8 steps in one cell.
+ *
+ * @param frame Frame to write to.
+ * @param x Column.
+ * @param y Row.
+ * @param level Bar height from 0 to 8.
+ */
+void lcd_frame_vbar(lcd_frame_t *frame, int x, int y, int level);
+
+/**
+ * @brief Draws a tuner needle on a scale with a resolution of 5 steps per cell.
+ *
+ * @param frame Frame to write to.
+ * @param x First column of the scale.
+ * @param y Row.
+ * @param width Width of the scale in cells.
+ * @param value Needle position.
+ * @param max Value at the right end of the scale.
+ */
+void lcd_frame_needle(lcd_frame_t *frame, int x, int y, int width, int value, int max);
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+
+#include "lcd_glyphs.h"
+
+/**
+ * @brief Hierarchical menu of the LCD, described by constant tables.
+ *
+ * A menu is a list of top level pages, one per cell of the page bar in the top line.
+ * A page is a list of items. Enter on an item opens its submenu or calls its action,
+ * Back returns to the page above. The three lines below the page bar show a window of
+ * the items that scrolls with the cursor.
+ *
+ * The engine only keeps the position and draws it into a frame, the caller decides
+ * when to draw and lcd_glyphs_render() sends only the cells that changed. Nothing here
+ * blocks or touches the display.
+ */
+
+/* Submenus that can be open below a top level page */
+#define LCD_MENU_DEPTH_MAX 4
+
+/* Lines for items, below the page bar */
+#define LCD_MENU_ROWS (LCD_ROWS - 1)
+
+typedef struct lcd_menu_page lcd_menu_page_t;
+
+/**
+ * @brief An item of a page.
+ */
+typedef struct {
+    const char *label;
+    lcd_glyph_id_t icon;                /*!< Shown left of the label, GLYPH_EMPTY for none */
+    const lcd_menu_page_t *submenu;     /*!< Opened by Enter, NULL for an action */
+    void (*action)(int arg);            /*!< Called by Enter when there is no submenu, may be NULL */
+    bool (*checked)(int arg);           /*!< Marks the current choice at the end of the line, may be NULL */
+    int arg;                            /*!< Passed to action and checked */
+} lcd_menu_item_t;
+
+/**
+ * @brief A page of items.
+ */
+struct lcd_menu_page {
+    const char *title;                  /*!< Shown right of the page bar */
+    const lcd_menu_item_t *items;
+    int item_count;
+    /* Draws an item from column 2 to the end of line y, NULL for the label and the mark */
+    void (*draw_item)(lcd_frame_t *frame, int y, const lcd_menu_item_t *item);
+};
+
+/**
+ * @brief Navigation events.
+ */
+typedef enum {
+    LCD_MENU_UP = 0,
+    LCD_MENU_DOWN,
+    LCD_MENU_PREV_PAGE,     /*!< Previous top level page, closes the submenus */
+    LCD_MENU_NEXT_PAGE,
+    LCD_MENU_ENTER,
+    LCD_MENU_BACK,
+} lcd_menu_event_t;
+
+/**
+ * @brief Position in a menu.
+ */
+typedef struct {
+    const lcd_menu_page_t *const *pages;
+    int page_count;
+    int page;                                           /*!< Top level page */
+    int depth;                                          /*!< Open submenus */
+    const lcd_menu_page_t *stack[LCD_MENU_DEPTH_MAX + 1]; /*!< Page shown at each depth */
+    int cursor[LCD_MENU_DEPTH_MAX + 1];                 /*!< Selected item at each depth */
+    int first[LCD_MENU_DEPTH_MAX + 1];                  /*!< First item in the window at each depth */
+} lcd_menu_t;
+
+/**
+ * @brief Initializes a menu on the first item of the first page.
+ *
+ * @param menu Menu to initialize.
+ * @param pages Top level pages, kept by reference.
+ * @param count Number of pages, at most LCD_COLS - 2.
+ */
+void lcd_menu_init(lcd_menu_t *menu, const lcd_menu_page_t *const *pages, int count);
+
+/**
+ * @brief Returns to the first page and puts the cursor on an item of it.
+ *
+ * @param item Item to select.
+ */
+void lcd_menu_home(lcd_menu_t *menu, int item);
+
+/**
+ * @brief Returns whether the first page is shown, without a submenu.
+ */
+bool lcd_menu_is_home(const lcd_menu_t *menu);
+
+/**
+ * @brief Moves in the menu, runs the action of an item on Enter.
+ *
+ * @param event Navigation event.
+ * @return False when the event changed nothing: Back on a top level page, Enter on an
+ *         item without submenu and action, or a move on an empty page.
+ */
+bool lcd_menu_handle(lcd_menu_t *menu, lcd_menu_event_t event);
+
+/**
+ * @brief Draws the page bar: a cell per top level page and the title of the page shown.
+ *
+ * @param frame Frame to draw in.
+ * @param y Line to draw on.
+ */
+void lcd_menu_draw_page_bar(const lcd_menu_t *menu, lcd_frame_t *frame, int y);
+
+/**
+ * @brief Draws the window of items in the lines below the page bar.
+ *
+ * @param frame Frame to draw in.
+ * @param cursor Draws the arrow at the selected item.
+ */
+void lcd_menu_draw_items(const lcd_menu_t *menu, lcd_frame_t *frame, bool cursor);
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Memory-lean HTTP(S) GET connections for the radio streams.
+ *
+ * esp_http_client gives no access to the mbedTLS configuration of its connections, so the
+ * radio opens its streams through this small HTTP/1.0 client on mbedTLS directly, with a
+ * TLS profile for one long download on a board without PSRAM:
+ *
+ * - The handshake asks for a maximum fragment length (RFC 6066). A server that honours it
+ *   sends records of at most that size, and with CONFIG_MBEDTLS_DYNAMIC_BUFFER the receive
+ *   buffer is allocated per record at the size of the record, a send buffer per message.
+ *   Between records a connection holds neither. mbedTLS cannot take a handshake message
+ *   split over records, so a server whose handshake fails while asked, with a certificate
+ *   chain longer than the fragment for example, is asked without it from then on.
+ * - The peer certificate is freed after the handshake (CONFIG_MBEDTLS_SSL_KEEP_PEER_CERTIFICATE
+ *   off).
+ * - The session of the last servers, with its session ticket, is kept across connections.
+ *   A reconnect or a switch back to a station resumes it with an abbreviated handshake,
+ *   without the certificate chain and the key exchange.
+ * - When the policy allows, a server whose TLS handshakes keep failing is asked for the same
+ *   path over plain HTTP on port 80.
+ *
+ * Every connection measures its handshake time and what mbedTLS takes while it runs, see
+ * mem_plan_tls_usage(). Other TLS sessions at the same time are counted too.
+ *
+ * A connection is used by one task at a time, the servers are shared by all connections.
+ */
+
+/* Servers whose session, fragment length support and fallback are remembered */
+#define LEAN_HTTP_SERVERS 4
+
+/* Longest url, also of a redirect */
+#define LEAN_HTTP_URL_MAX 256
+
+/* Redirects followed by one lean_http_open() */
+#define LEAN_HTTP_MAX_REDIRECTS 3
+
+/**
+ * @brief TLS profile, shared by all connections.
+ */
+typedef struct {
+    int max_fragment_len;       /*!< 512, 1024, 2048 or 4096 asked in the handshake, 0 to not ask */
+    bool resume_sessions;       /*!< Resume the sessions of the last LEAN_HTTP_SERVERS servers */
+    bool plain_fallback;        /*!< Use plain HTTP for a server after tls_failures failed handshakes */
+    int tls_failures;           /*!< Failed handshakes in a row before the fallback */
+} lean_http_cfg_t;
+
+#define LEAN_HTTP_CFG_DEFAULT() {   \
+    .max_fragment_len = 4096,       \
+    .resume_sessions = true,        \
+    .plain_fallback = false,        \
+    .tls_failures = 3,              \
+}
+
+typedef struct lean_http *lean_http_handle_t;
+
+/**
+ * @brief Response to a request.
+ */
+typedef struct {
+    int status;                 /*!< HTTP status code, also of an "ICY 200 OK" status line */
+    int64_t content_length;     /*!< -1 when not sent, for live streams */
+    bool accept_ranges;         /*!< The server sent "Accept-Ranges: bytes" */
+} lean_http_response_t;
+
+/**
+ * @brief Measurements of the last connection.
+ */
+typedef struct {
+    bool tls;                   /*!< Over TLS, false for http urls and the plain fallback */
+    bool plain_fallback;        /*!< An https url served over plain HTTP */
+    bool resumed;               /*!< The TLS session was resumed */
+    int max_fragment_len;       /*!< Fragment length asked, 0 for none */
+    int connect_ms;             /*!< Name lookup and TCP connect */
+    int handshake_ms;           /*!< TLS handshake */
+    uint32_t tls_heap_peak;     /*!< Most bytes mbedTLS held more than before, during the handshake */
+    uint32_t tls_heap;          /*!< Bytes mbedTLS held more than before, after the handshake */
+    uint32_t tls_heap_stream;   /*!< Most bytes mbedTLS held more than before, while streaming */
+} lean_http_stats_t;
+
+/**
+ * @brief Sets the TLS profile.
+ *
+ * Call it once, before the first connection.
+ *
+ * @param config TLS profile.
+ * @return ESP_OK on success, ESP_ERR_NO_MEM when the lock could not be created.
+ */
+esp_err_t lean_http_init(const lean_http_cfg_t *config);
+
+/**
+ * @brief Creates a connection, closed.
+ *
+ * @return Handle, or NULL when out of memory.
+ */
+lean_http_handle_t lean_http_create(void);
+
+/**
+ * @brief Connects and sends a GET request, reads the status line and the headers.
+ *
+ * Redirects (301, 302, 303, 307 and 308) are followed up to LEAN_HTTP_MAX_REDIRECTS
+ * times, the stats are those of the last connection.
+ *
+ * @param h Connection, closed.
+ * @param url http:// or https:// url.
+ * @param range_from First byte asked with a Range header, 0 for the whole resource.
+ * @param timeout_ms Timeout of the connect and of every read.
+ * @param response Receives the status and the headers.
+ * @return ESP_OK when a status line was read, the connection is then open whatever the status,
+ *         a redirect status after too many redirects.
+ */
+esp_err_t lean_http_open(lean_http_handle_t h, const char *url, int64_t range_from, int timeout_ms,
+                         lean_http_response_t *response);
+
+/**
+ * @brief Reads from the body.
+ *
+ * @param h Open connection.
+ * @param buf Buffer.
+ * @param len Size of the buffer.
+ * @return Bytes read, 0 at the end of the body, -1 on an error or a timeout.
+ */
+int lean_http_read(lean_http_handle_t h, char *buf, int len);
+
+/**
+ * @brief Closes the connection, nothing happens when it is closed.
+ */
+void lean_http_close(lean_http_handle_t h);
+
+/**
+ * @brief Closes and frees a connection.
+ */
+void lean_http_destroy(lean_http_handle_t h);
+
+/**
+ * @brief Reads the measurements of the last connection.
+ *
+ * @param h Connection.
+ * @param stats Receives the measurements.
+ */
+void lean_http_get_stats(lean_http_handle_t h, lean_http_stats_t *stats);
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Loudness meter after ITU-R BS.1770 / EBU R128.
+ *
+ * The audio is K-weighted, its energy is summed in 100 ms sub-blocks, and every
+ * 100 ms the last four sub-blocks form a 400 ms block. Blocks above the absolute gate
+ * of -70 LUFS go into a histogram of 0.25 LU bins, from which the integrated loudness
+ * is computed with the relative gate of -10 LU. The histogram keeps the state of a
+ * whole track in a fixed size, so a meter can be fed in any number of calls. The
+ * short-term loudness is the energy of the last 3 seconds.
+ *
+ * Loudness values are in LUFS times 10.
+ */
+
+/* Returned when there is not enough audio above the gate to measure */
+#define LOUDNESS_UNKNOWN INT16_MIN
+
+/* Histogram range and resolution of the block loudness */
+#define LOUDNESS_MIN_LUFS -70
+#define LOUDNESS_MAX_LUFS 5
+#define LOUDNESS_BINS_PER_LU 4
+#define LOUDNESS_BINS ((LOUDNESS_MAX_LUFS - LOUDNESS_MIN_LUFS) * LOUDNESS_BINS_PER_LU)
+
+/* Sub-blocks in a 400 ms block and in the 3 s short-term window */
+#define LOUDNESS_BLOCK_SUBS 4
+#define LOUDNESS_SHORT_TERM_SUBS 30
+
+/**
+ * @brief K-weighting filter of one channel, two biquads.
+ */
+typedef struct {
+    float z[2][2];
+} loudness_filter_t;
+
+/**
+ * @brief State of one meter.
+ */
+typedef struct {
+    int channels;
+    int sub_len;                                /*!< Frames per 100 ms sub-block */
+    float b[2][3], a[2][2];                     /*!< Shelf and high-pass coefficients */
+    loudness_filter_t filter[2];
+    float sub_sum;                              /*!< Energy of the sub-block being filled */
+    int sub_frames;
+    float subs[LOUDNESS_SHORT_TERM_SUBS];       /*!< Mean square of the last sub-blocks */
+    int sub_count;                              /*!< Sub-blocks since the reset */
+    uint32_t hist[LOUDNESS_BINS];               /*!< Gated 400 ms blocks per loudness bin */
+    uint32_t blocks;                            /*!< Blocks in the histogram */
+} loudness_meter_t;
+
+/**
+ * @brief Resets a meter for a new track.
+ *
+ * @param m Meter.
+ * @param rate Sample rate in Hz.
+ * @param channels 1 or 2.
+ */
+void loudness_meter_init(loudness_meter_t *m, int rate, int channels);
+
+/**
+ * @brief Feeds interleaved 16-bit samples.
+ *
+ * @param m Meter.
+ * @param pcm Samples.
+ * @param frames Number of frames.
+ */
+void loudness_meter_process(loudness_meter_t *m, const int16_t *pcm, int frames);
+
+/**
+ * @brief Returns the gated integrated loudness of everything fed since the reset.
+ *
+ * @param m Meter.
+ * @return Loudness in LUFS times 10, LOUDNESS_UNKNOWN before the first block above the gate.
+ */
+int loudness_meter_integrated(const loudness_meter_t *m);
+
+/**
+ * @brief Returns the loudness of the last 3 seconds.
+ *
+ * @param m Meter.
+ * @return Loudness in LUFS times 10, LOUDNESS_UNKNOWN for the first 3 seconds or for silence.
+ */
+int loudness_meter_short_term(const loudness_meter_t *m);
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "mem_pool.h"
+
+/**
+ * @brief Memory budget of the speaker and the pool of the TLS buffers.
+ *
+ * Without PSRAM the pipelines of all modes, Wi-Fi, mbedTLS and the FAT file cache share
+ * about 300 KB. The pipelines, their ring buffers and element tasks are allocated once
+ * at boot and parked between modes, see mode_manager.h. What was left allocating and
+ * freeing large blocks is TLS: every reconnect and station change of the radio allocates
+ * a 16 KB input record buffer, a 4 KB output record buffer and the handshake state. The
+ * small blocks that stay allocated in between split the heap, until the 16 KB buffer no
+ * longer fits.
+ *
+ * mem_plan_init() reserves a pool of fixed blocks for everything mbedTLS allocates,
+ * before anything else allocates, and mbedTLS allocates from it through
+ * CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC. TLS then never touches the heap the rest shares.
+ * When a class is used up, by a second session at boot, the allocation comes from the
+ * internal heap as before. The heap log shows the peak use of each class, to size them.
+ *
+ * The allocator also counts what mbedTLS holds, in pool blocks and heap allocations, so
+ * the radio can report what a connection takes, see lean_http.h.
+ *
+ * The mode manager measures what each subsystem takes from the heap while it starts,
+ * mem_plan_report() logs that budget. At runtime a scheduler timer tracks the free heap,
+ * the largest free block and the fragmentation, and logs when the fragmentation grows.
+ */
+
+/* Subsystems measured at boot */
+#define MEM_PLAN_MAX_SUBSYSTEMS 16
+
+/**
+ * @brief Configuration of the heap monitor.
+ */
+typedef struct {
+    int sample_s;           /*!< Interval of the heap measurement */
+    int report_s;           /*!< Interval of the heap log, 0 for none */
+    int frag_step_pct;      /*!< Fragmentation above the last logged peak that is logged at once */
+} mem_plan_cfg_t;
+
+#define MEM_PLAN_CFG_DEFAULT() {    \
+    .sample_s = 10,                 \
+    .report_s = 600,                \
+    .frag_step_pct = 5,             \
+}
+
+/**
+ * @brief Heap statistics.
+ */
+typedef struct {
+    uint32_t free_bytes;            /*!< Free internal heap */
+    uint32_t min_free_bytes;        /*!< Lowest free heap since boot */
+    uint32_t largest_block;         /*!< Largest free block */
+    int frag_pct;                   /*!< 100 - largest block * 100 / free */
+    int peak_frag_pct;              /*!< Highest fragmentation measured since the monitor started */
+    uint32_t tls_fallbacks;         /*!< TLS allocations the pool could have served but was used up */
+    mem_pool_t tls_pool;            /*!< Copy of the TLS pool, with the use of each class */
+} mem_plan_stats_t;
+
+/**
+ * @brief Reserves the TLS pool.
+ *
+ * Call it first, before Wi-Fi and the pipelines allocate. Without the radio mode built nothing
+ * is reserved.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM when the region could not be reserved,
+ * mbedTLS then allocates from the heap.
+ */
+esp_err_t mem_plan_init(void);
+
+/**
+ * @brief Starts measuring what a subsystem allocates while it starts.
+ *
+ * Other tasks allocating at the same time are counted too, the budget is approximate.
+ *
+ * @param subsystem Name, must stay valid.
+ */
+void mem_plan_begin(const char *subsystem);
+
+/**
+ * @brief Ends the measurement started by mem_plan_begin().
+ */
+void mem_plan_end(void);
+
+/**
+ * @brief Logs the budget of every subsystem measured, the pools and the free heap.
+ */
+void mem_plan_report(void);
+
+/**
+ * @brief Starts the heap monitor.
+ *
+ * The scheduler must be running.
+ *
+ * @param config Monitor configuration.
+ * @return ESP_OK on success.
+ */
+esp_err_t mem_plan_monitor_start(const mem_plan_cfg_t *config);
+
+/**
+ * @brief Reads the heap statistics, measured now.
+ *
+ * @param stats Receives the statistics.
+ */
+void mem_plan_get_stats(mem_plan_stats_t *stats);
+
+/**
+ * @brief Reads what mbedTLS holds, in pool blocks and heap allocations.
+ *
+ * Counted by the allocator of CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC, for all TLS sessions
+ * together, zero without it.
+ *
+ * @param in_use Receives the bytes held now, may be NULL.
+ * @param peak Receives the most bytes held since mem_plan_tls_reset_peak(), may be NULL.
+ */
+void mem_plan_tls_usage(uint32_t *in_use, uint32_t *peak);
+
+/**
+ * @brief Restarts the peak of mem_plan_tls_usage() from the bytes held now.
+ */
+void mem_plan_tls_reset_peak(void);
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Fixed block pools carved from one region reserved at boot.
+ *
+ * A pool has a few classes of equal sized blocks. An allocation takes a block of the
+ * smallest class it fits, or fails when that class is used up, so a larger class stays
+ * free for what needs it. Blocks go back on the free list of their class and the region
+ * is never returned: however often blocks are allocated and freed, and whichever of
+ * them stay allocated, a block of each class stays as easy to get as at boot.
+ *
+ * The pool does no locking and has no hardware access, see mem_plan.h for the
+ * reservation and the locking.
+ */
+
+#define MEM_POOL_MAX_CLASSES 6
+
+/**
+ * @brief Size and number of the blocks of one class.
+ */
+typedef struct {
+    uint32_t block_size;    /*!< Rounded up to 8 bytes */
+    uint16_t count;
+} mem_pool_class_cfg_t;
+
+/**
+ * @brief One class of blocks.
+ */
+typedef struct {
+    uint32_t block_size;
+    uint16_t count;
+    uint16_t used;
+    uint16_t peak;          /*!< Most blocks in use at once */
+    uint32_t full;          /*!< Allocations that fitted this class when all its blocks were used */
+    uint8_t *base;
+    void *free_list;
+} mem_pool_class_t;
+
+/**
+ * @brief A pool.
+ */
+typedef struct {
+    mem_pool_class_t classes[MEM_POOL_MAX_CLASSES];
+    int class_count;
+    uint8_t *base;
+    size_t size;
+} mem_pool_t;
+
+/**
+ * @brief Returns the size of the region the classes need.
+ *
+ * @param classes Classes in ascending block size.
+ * @param count Number of classes, at most MEM_POOL_MAX_CLASSES.
+ * @return Size in bytes.
+ */
+size_t mem_pool_region_size(const mem_pool_class_cfg_t *classes, int count);
+
+/**
+ * @brief Lays out the classes in a region and puts all blocks on the free lists.
+ *
+ * @param p Pool.
+ * @param region At least mem_pool_region_size() bytes, 8 byte aligned.
+ * @param classes Classes in ascending block size.
+ * @param count Number of classes, at most MEM_POOL_MAX_CLASSES.
+ */
+void mem_pool_init(mem_pool_t *p, void *region, const mem_pool_class_cfg_t *classes, int count);
+
+/**
+ * @brief Takes a block.
+ *
+ * @param p Pool.
+ * @param size Bytes needed.
+ * @return The block, or NULL when the size is larger than every class or its class is used up.
+ */
+void *mem_pool_alloc(mem_pool_t *p, size_t size);
+
+/**
+ * @brief Returns a block.
+ *
+ * @param p Pool.
+ * @param ptr Block, may be memory that is not from the pool.
+ * @return False when ptr is not from the pool and must be freed elsewhere.
+ */
+bool mem_pool_free(mem_pool_t *p, void *ptr);
+
+/**
+ * @brief Returns the size of the block a pointer points in.
+ *
+ * @param p Pool.
+ * @param ptr Block, may be memory that is not from the pool.
+ * @return Block size of its class, 0 when ptr is not from the pool.
+ */
+size_t mem_pool_block_size(const mem_pool_t *p, const void *ptr);
+
+/**
+ * @brief Tells whether a pointer is in the region of the pool.
+ */
+bool mem_pool_owns(const mem_pool_t *p, const void *ptr);
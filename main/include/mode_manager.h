@@ -0,0 +1,214 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "binlog.h"
+#include "audio_element.h"
+#include "audio_pipeline.h"
+#include "audio_event_iface.h"
+#include "esp_peripherals.h"
+#include "periph_service.h"
+#include "board.h"
+#include "resume_state.h"
+#include "sdkconfig.h"
+
+/**
+ * @brief Switches between the playback modes of the speaker.
+ *
+ * The mode manager initializes everything the modes share exactly once: the
+ * peripheral set (keys, SD card and Wi-Fi), the codec, the input key service, the
+ * audio pipeline, its event interface and the i2s_stream writer. Every mode registers
+ * its own elements into the shared pipeline when the manager starts. Switching modes
+ * stops the linked elements, relinks the pipeline with the elements of the new mode
+ * and runs it again. Elements of inactive modes stay allocated and parked, so a
+ * switch allocates nothing and takes a few milliseconds.
+ *
+ * The modes follow the menu drawn by menu(): Internet Radio, Sampler (the SD card
+ * player), Tuner and Group (playing with other speakers, see group.h). The tuner has
+ * no audio chain yet, selecting it parks the pipeline.
+ * Modes left out in menuconfig are not in the enum and not built, the indices of the
+ * remaining modes and the mode saved by resume_state.h depend on the build.
+ */
+
+/**
+ * @brief Playback modes, in menu order.
+ */
+typedef enum {
+#if CONFIG_SPEAKER_MODE_RADIO
+    PLAYER_MODE_RADIO,
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    PLAYER_MODE_SDCARD,
+#endif
+    PLAYER_MODE_TUNER,
+#if CONFIG_SPEAKER_GROUP
+    PLAYER_MODE_GROUP,
+#endif
+    PLAYER_MODE_COUNT,
+    PLAYER_MODE_NONE = -1,
+} player_mode_t;
+
+/* Mode to start in and to wake up to, the first one built */
+#if CONFIG_SPEAKER_MODE_RADIO
+#define PLAYER_MODE_DEFAULT PLAYER_MODE_RADIO
+#elif CONFIG_SPEAKER_MODE_SDCARD
+#define PLAYER_MODE_DEFAULT PLAYER_MODE_SDCARD
+#else
+#define PLAYER_MODE_DEFAULT PLAYER_MODE_TUNER
+#endif
+
+/**
+ * @brief Operations a playback mode implements for the mode manager.
+ *
+ * All operations are optional. They are called with the mode lock held.
+ */
+typedef struct {
+    const char *name;                                       /*!< Name used in logs */
+    esp_err_t (*init)(void);                                /*!< Creates and registers the elements, called once */
+    esp_err_t (*activate)(void);                            /*!< Relinks the pipeline and starts playback */
+    void (*deactivate)(void);                               /*!< Called after the pipeline was stopped */
+    void (*handle_event)(audio_event_iface_msg_t *msg);     /*!< Pipeline and peripheral events */
+    void (*handle_key)(int key_id);                         /*!< Key clicks not handled by the manager */
+    void (*handle_scrub)(int direction);                    /*!< Long press on Vol+ (1) or Vol- (-1), 0 on release */
+} player_mode_ops_t;
+
+/**
+ * @brief Task that initializes the shared resources and all modes, then dispatches events.
+ *
+ * The mode, volume and radio station saved before the last power cycle are restored,
+ * see resume_state.h.
+ *
+ * @param pvParameters Mode to start in when no state was saved, cast from player_mode_t.
+ */
+void mode_manager_task(void *pvParameters);
+
+/**
+ * @brief Switches to another mode.
+ *
+ * May be called from any task.
+ *
+ * @param mode Mode to switch to.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE before the manager is initialized.
+ */
+esp_err_t mode_manager_switch(player_mode_t mode);
+
+/**
+ * @brief Asks the mode manager task to switch to another mode, without waiting for it.
+ *
+ * A switch stops and starts pipelines, opens files and connects to servers. Tasks with
+ * a small stack, like the control server, leave that to the mode manager task.
+ *
+ * @param mode Mode to switch to.
+ * @return ESP_OK when the switch was queued, ESP_ERR_INVALID_STATE before the manager is
+ * initialized, ESP_ERR_INVALID_ARG for an unknown mode.
+ */
+esp_err_t mode_manager_request_switch(player_mode_t mode);
+
+/**
+ * @brief Returns the active mode.
+ *
+ * @return The active mode, PLAYER_MODE_NONE before the first switch.
+ */
+player_mode_t mode_manager_get_mode(void);
+
+/**
+ * @brief Returns the shared audio pipeline.
+ */
+audio_pipeline_handle_t mode_manager_get_pipeline(void);
+
+/**
+ * @brief Returns the shared i2s_stream writer, registered in the pipeline as "i2s".
+ */
+audio_element_handle_t mode_manager_get_i2s_writer(void);
+
+/**
+ * @brief Returns the shared event interface that listens to the pipeline.
+ */
+audio_event_iface_handle_t mode_manager_get_event_iface(void);
+
+/**
+ * @brief Returns the shared peripheral set.
+ */
+esp_periph_set_handle_t mode_manager_get_periph_set(void);
+
+/**
+ * @brief Returns the shared audio board handle.
+ */
+audio_board_handle_t mode_manager_get_board(void);
+
+/**
+ * @brief Returns the playback state saved before the last power cycle.
+ *
+ * Fields that were never saved are -1, the song path is empty then.
+ */
+const resume_state_t *mode_manager_get_resume_state(void);
+
+/**
+ * @brief Relinks the shared pipeline for the active mode and starts it.
+ *
+ * Helper for player_mode_ops_t::activate.
+ *
+ * @param link_tag Tags of the elements to link, in data order.
+ * @param link_num Number of tags.
+ * @return ESP_OK on success.
+ */
+esp_err_t mode_manager_run_chain(const char **link_tag, int link_num);
+
+/**
+ * @brief Takes the mode lock, for tasks that call into the active mode.
+ *
+ * The mode operations and events run with this lock held. The lock is created when
+ * mode_manager_task() starts, before the peripherals and the modes.
+ */
+void mode_manager_lock(void);
+
+/**
+ * @brief Releases the mode lock.
+ */
+void mode_manager_unlock(void);
+
+/**
+ * @brief Passes a key click to the active mode, as if the key was clicked on the board.
+ *
+ * May be called from any task.
+ *
+ * @param key_id Id of the key, see input_key_user_id_t.
+ */
+void mode_manager_send_key(int key_id);
+
+/**
+ * @brief Acts on a key action as if it came from the board keys.
+ *
+ * Unlike mode_manager_send_key() the mode and volume keys, presses and releases work
+ * too. Used by the trace replay, may be called from any task.
+ *
+ * @param key_id Id of the key, see input_key_user_id_t.
+ * @param action Action, see input_key_service_action_id_t.
+ */
+void mode_manager_inject_key(int key_id, int action);
+
+/**
+ * @brief Sets the codec volume, shared by all modes.
+ *
+ * The volume is saved for a resume after a power cycle.
+ *
+ * @param volume Volume in percent, clamped to 0 to 100.
+ */
+void mode_manager_set_volume(int volume);
+
+/**
+ * @brief Returns the codec volume in percent.
+ */
+int mode_manager_get_volume(void);
+
+/**
+ * @brief Raises the volume by 10%, shared by all modes.
+ */
+void handle_volume_up();
+
+/**
+ * @brief Lowers the volume by 10%, shared by all modes.
+ */
+void handle_volume_down();
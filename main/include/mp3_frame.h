@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdint.h>
+
+/**
+ * @brief Minimal MPEG audio layer III frame header parser.
+ *
+ * Used to find the start of a frame in a stream after the data was cut, for example
+ * after a reconnect, so the decoder never sees a partial frame.
+ */
+
+/* Length of an MPEG audio frame header */
+#define MP3_FRAME_HEADER_LEN 4
+
+/**
+ * @brief Fields of a parsed frame header.
+ */
+typedef struct {
+    int sample_rate;    /*!< Sample rate in Hz */
+    int bitrate;        /*!< Bitrate in kbit/s */
+    int channels;       /*!< 1 for mono, 2 otherwise */
+    int frame_len;      /*!< Length of the frame in bytes, header included */
+} mp3_frame_info_t;
+
+/**
+ * @brief Parses a layer III frame header.
+ *
+ * @param header At least MP3_FRAME_HEADER_LEN bytes.
+ * @param info Receives the header fields, may be NULL.
+ * @return The frame length in bytes, or 0 when the bytes are not a valid header.
+ */
+int mp3_frame_parse_header(const uint8_t *header, mp3_frame_info_t *info);
+
+/**
+ * @brief Finds the first frame header in a buffer.
+ *
+ * A header only counts when the header of the following frame is also valid and has
+ * the same sample rate, or when the following frame starts beyond the buffer.
+ *
+ * @param buf Stream data.
+ * @param len Length of the stream data.
+ * @return Offset of the frame header, or -1 when the buffer holds none.
+ */
+int mp3_frame_find_sync(const uint8_t *buf, int len);
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief Loudness normalization of everything written to I2S.
+ *
+ * The WAV files on the SD card are measured in the background by a task at idle
+ * priority, and the integrated loudness of every file is stored in NVS, so the scan
+ * resumes at the first file that was not measured after a restart. A playlist song
+ * that was measured gets the fixed gain that brings it to the target loudness. Radio
+ * streams and songs that were not measured yet follow a running estimate instead:
+ * the gated loudness since the start of the stream, measured on the way to I2S, with
+ * the gain moving at most NORMALIZER_SLEW_DB_PER_S.
+ *
+ * The gain is applied in Q12 fixed point in the I2S write path, followed by a peak
+ * limiter with instant attack that keeps samples below the ceiling.
+ */
+
+/* Fastest change of the running estimate gain */
+#define NORMALIZER_SLEW_DB_PER_S 1
+
+/**
+ * @brief Configuration of the normalizer.
+ */
+typedef struct {
+    int target_lufs;        /*!< Loudness the gain aims for */
+    int max_gain_db;        /*!< Largest boost and cut */
+    int ceiling_db;         /*!< Limiter ceiling in dBFS */
+    int scan_stack;         /*!< Stack size of the scan task */
+} normalizer_cfg_t;
+
+#define NORMALIZER_CFG_DEFAULT() {  \
+    .target_lufs = -18,             \
+    .max_gain_db = 12,              \
+    .ceiling_db = -1,               \
+    .scan_stack = 4096,             \
+}
+
+/**
+ * @brief Opens the loudness store.
+ *
+ * NVS must be initialized.
+ *
+ * @param config Normalizer configuration.
+ * @return ESP_OK on success.
+ */
+esp_err_t normalizer_init(const normalizer_cfg_t *config);
+
+/**
+ * @brief Starts measuring the WAV files in a directory in the background.
+ *
+ * The task runs at idle priority and ends when every file was measured.
+ *
+ * @param dir Directory to scan, with its subdirectories.
+ * @return ESP_OK when the task was started.
+ */
+esp_err_t normalizer_scan_start(const char *dir);
+
+/**
+ * @brief Uses the stored loudness of a file, or the running estimate when it was not measured yet.
+ *
+ * @param path Path of the file that starts playing.
+ */
+void normalizer_select_track(const char *path);
+
+/**
+ * @brief Follows the running estimate of a stream from its start.
+ */
+void normalizer_follow_stream(void);
+
+/**
+ * @brief Plays at unity gain, for announcements and sounds.
+ */
+void normalizer_bypass(void);
+
+/**
+ * @brief Sets the format of the audio written to I2S, call it together with i2s_stream_set_clk().
+ *
+ * Only 16-bit audio is normalized, other formats pass unchanged.
+ *
+ * @param rate Sample rate in Hz.
+ * @param channels Number of channels.
+ * @param bits Bits per sample.
+ */
+void normalizer_set_format(int rate, int channels, int bits);
+
+/**
+ * @brief Applies the gain and the limiter in place, called by the elements that write to I2S.
+ *
+ * @param buffer Interleaved samples.
+ * @param len Length in bytes.
+ */
+void normalizer_process(char *buffer, int len);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <stdint.h>
+#include "wav_file.h"
+
+/**
+ * @brief Converts the samples of a WAV file to the 16-bit PCM of the output chain.
+ *
+ * I2S, the equalizer, the normalizer and the fused player all run on 16-bit samples,
+ * so higher resolution files are brought down to 16 bits once, right after reading.
+ * Every format is first loaded into 32-bit integers with full scale at 2^31, blocks of
+ * PCM_CONVERT_BLOCK samples at a time, and then narrowed to 16 bits in one shared loop
+ * with TPDF dither: two uniform values of one xorshift32 per sample, four generators
+ * side by side so consecutive samples do not wait for each other. Both loops are free
+ * of branches, the clamps compile to MIN/MAX and CLAMPS on the ESP32.
+ *
+ * 8 and 16-bit samples fit exactly and are converted without dither.
+ */
+
+/* Samples converted per step, the size of the intermediate buffer on the stack */
+#define PCM_CONVERT_BLOCK 64
+
+/**
+ * @brief Sample formats of WAV files that can be played.
+ */
+typedef enum {
+    PCM_FORMAT_NONE = 0,    /*!< Not supported */
+    PCM_FORMAT_U8,          /*!< Unsigned 8-bit */
+    PCM_FORMAT_S16,         /*!< Signed 16-bit */
+    PCM_FORMAT_S24,         /*!< Signed 24-bit, packed in 3 bytes */
+    PCM_FORMAT_S32,         /*!< Signed 32-bit, also 20 and 24 valid bits in 32 */
+    PCM_FORMAT_F32,         /*!< IEEE float, full scale at 1.0 */
+} pcm_format_t;
+
+/**
+ * @brief State of a converter.
+ */
+typedef struct {
+    pcm_format_t format;
+    int bytes;              /*!< Bytes per sample of the input */
+    uint32_t seed[4];       /*!< Dither generators */
+} pcm_convert_t;
+
+/**
+ * @brief Returns the sample format of a WAV file.
+ *
+ * @param info Parsed header.
+ * @return The format, PCM_FORMAT_NONE for other encodings, more than two channels or
+ * frames that do not match the sample size.
+ */
+pcm_format_t pcm_format_of(const wav_file_info_t *info);
+
+/**
+ * @brief Sets up a converter.
+ *
+ * @param conv Converter.
+ * @param format Input format, not PCM_FORMAT_NONE.
+ */
+void pcm_convert_init(pcm_convert_t *conv, pcm_format_t format);
+
+/**
+ * @brief Converts samples to 16-bit.
+ *
+ * 16, 24 and 32-bit input may be converted in place, out at in. 8-bit input grows,
+ * it may share the buffer when it starts at or after (uint8_t *)out + samples. 32-bit
+ * input must be aligned to 4 bytes.
+ *
+ * @param conv Converter.
+ * @param in Samples in the input format, channels interleaved.
+ * @param samples Number of samples, all channels.
+ * @param out Receives the 16-bit samples.
+ */
+void pcm_convert_to_s16(pcm_convert_t *conv, const void *in, int samples, int16_t *out);
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "playlist.h"
+
+/**
+ * @brief Talking clock phrases, compiled from grammar rules into plans of voice pack clips.
+ *
+ * The wording is described by tables of rules: a rule covers a range of values, the
+ * minutes of an hour for example, and lists the words said for them. phrase_init()
+ * expands every rule once into a compact plan per value, one byte per clip, with slots
+ * for the parts that are only known later such as the hour. Building a phrase then
+ * copies the plan and fills in its slots, there is no branching on the wording left.
+ *
+ * Numbers 0 to 9999 are spelled from the compiled plans of 0 to 99 and the groups
+ * "honderd" and "duizend". The clips are listed in voice_clip_id_t.
+ */
+
+/* Maximum number of clips in a plan, a time with seconds and a date take at most 25 */
+#define PHRASE_MAX_CLIPS 32
+
+/* Largest number phrase_number() spells */
+#define PHRASE_NUMBER_MAX 9999
+
+/**
+ * @brief Styles of a time.
+ */
+typedef enum {
+    PHRASE_TIME_DIGITAL = 0,        /*!< As a 24 hour clock shows it: "vijftien uur twintig" */
+    PHRASE_TIME_DIGITAL_SECONDS,    /*!< With the seconds: "vijftien uur twintig en vijf seconden" */
+    PHRASE_TIME_COLLOQUIAL,         /*!< On a 12 hour dial: "tien voor half vier 's middags" */
+} phrase_time_style_t;
+
+/**
+ * @brief Clips of a phrase, in the order they are played.
+ */
+typedef struct {
+    uint16_t clips[PHRASE_MAX_CLIPS];
+    int count;
+    bool overflow;                  /*!< Clips were dropped because the plan was full */
+} phrase_plan_t;
+
+/**
+ * @brief Compiles the rules, only the first call does the work.
+ *
+ * Called by every function below, calling it at start keeps the first announcement short.
+ *
+ * @return False when the compiled plans do not fit, which the rule tables rule out.
+ */
+bool phrase_init(void);
+
+/**
+ * @brief Empties a plan.
+ */
+void phrase_clear(phrase_plan_t *plan);
+
+/**
+ * @brief Appends a clip.
+ *
+ * @return False when the plan is full.
+ */
+bool phrase_add(phrase_plan_t *plan, uint16_t clip);
+
+/**
+ * @brief Appends the words of a number.
+ *
+ * @param num Number, 0 to PHRASE_NUMBER_MAX.
+ * @return False when the number is out of range, VOICE_CLIP_INVALID is appended instead,
+ *         or the plan is full.
+ */
+bool phrase_number(phrase_plan_t *plan, int num);
+
+/**
+ * @brief Appends the words of a year: "negentienhonderd vierentachtig", "tweeduizend zes".
+ *
+ * @param year Year, 0 to PHRASE_NUMBER_MAX.
+ * @return False when the year is out of range or the plan is full.
+ */
+bool phrase_year(phrase_plan_t *plan, int year);
+
+/**
+ * @brief Appends the words of a time, without "het is".
+ *
+ * @param timeinfo Local time, tm_hour, tm_min and tm_sec are used.
+ * @param style Style of the time.
+ * @return False when the time is out of range or the plan is full.
+ */
+bool phrase_time(phrase_plan_t *plan, const struct tm *timeinfo, phrase_time_style_t style);
+
+/**
+ * @brief Appends the words of a date: weekday, day, month and year.
+ *
+ * @param timeinfo Local time, tm_wday, tm_mday, tm_mon and tm_year are used.
+ * @return False when the date is out of range or the plan is full.
+ */
+bool phrase_date(phrase_plan_t *plan, const struct tm *timeinfo);
+
+/**
+ * @brief Builds the announcement of a time: "het is", the time and optionally the date.
+ *
+ * @param timeinfo Local time.
+ * @param style Style of the time.
+ * @param with_date Appends the date after the time.
+ * @return False when the time is out of range or the plan is full.
+ */
+bool phrase_announcement(phrase_plan_t *plan, const struct tm *timeinfo, phrase_time_style_t style,
+                         bool with_date);
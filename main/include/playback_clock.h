@@ -0,0 +1,109 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "audio_element.h"
+#include "driver/i2s.h"
+
+/**
+ * @brief Playback position derived from the audio the I2S DMA clocked out.
+ *
+ * The clock counts the frames the I2S driver accepted into its DMA buffers. The DMA
+ * drains at the sample rate and i2s_write() returns as soon as one DMA buffer is free, so
+ * while the writer keeps up the DMA holds about its full capacity after every write, and
+ * after an underrun only what was written since. The frames heard are the frames written
+ * minus what is still in the DMA, which keeps the position within one DMA buffer of the
+ * audio and makes it stop when playback pauses or underruns instead of following the
+ * bytes the decoder reads ahead.
+ *
+ * The shared i2s_stream writer is counted through its write callback, elements that
+ * write to the I2S driver themselves call playback_clock_on_write().
+ */
+
+/**
+ * @brief Position of the current track or stream.
+ */
+typedef struct {
+    bool running;               /*!< Audio of the current track is being clocked out */
+    int64_t frames;             /*!< Frames of the current track heard so far */
+    int64_t position_ms;        /*!< Time heard so far */
+    int64_t duration_ms;        /*!< Length of the track, -1 for streams */
+    int64_t remaining_ms;       /*!< Time left, -1 when the length is unknown */
+    int latency_ms;             /*!< Audio written but not heard yet */
+    uint32_t underruns;         /*!< Times the DMA ran empty while audio was written, since boot */
+} playback_position_t;
+
+/**
+ * @brief Counts the audio written by an i2s_stream writer.
+ *
+ * Replaces the write callback of the element with one that writes to the I2S driver
+ * and counts the accepted frames.
+ *
+ * @param i2s_writer i2s_stream writer element.
+ * @param port I2S port the driver was installed on.
+ * @param dma_frames DMA capacity in frames, dma_buf_count * dma_buf_len.
+ * @return ESP_OK on success.
+ */
+esp_err_t playback_clock_attach(audio_element_handle_t i2s_writer, i2s_port_t port, int dma_frames);
+
+/**
+ * @brief Sets the I2S format, call it together with i2s_stream_set_clk().
+ *
+ * @param rate Sample rate in Hz.
+ * @param channels Number of channels.
+ * @param bits Bits per sample.
+ */
+void playback_clock_set_format(int rate, int channels, int bits);
+
+/**
+ * @brief Starts counting a new track at the current write position.
+ *
+ * Call it before the first frame of the track is written.
+ *
+ * @param duration_ms Length of the track, -1 for streams or when unknown.
+ */
+void playback_clock_start_track(int64_t duration_ms);
+
+/**
+ * @brief Sets the length of the current track once it is known.
+ *
+ * @param duration_ms Length of the track, -1 when unknown.
+ */
+void playback_clock_set_duration(int64_t duration_ms);
+
+/**
+ * @brief Moves the position of the current track after a seek.
+ *
+ * Call it before the first frame from the new position is written. The audio still
+ * in the DMA plays out first, so the position reaches the new time when it is heard.
+ *
+ * @param position_ms Time in the track the next written frame belongs to.
+ */
+void playback_clock_seek(int64_t position_ms);
+
+/**
+ * @brief Counts audio an element wrote to the I2S driver itself.
+ *
+ * @param bytes Bytes accepted by i2s_write().
+ */
+void playback_clock_on_write(int bytes);
+
+/**
+ * @brief Reads the position of the current track.
+ *
+ * Takes a spinlock for a few instructions, cheap enough to call for every LCD frame.
+ *
+ * @param pos Receives the position.
+ */
+void playback_clock_get(playback_position_t *pos);
+
+/**
+ * @brief Returns how long after now a frame handed to the writer now will be heard.
+ *
+ * The frames in front of the writer and in the DMA, within one DMA buffer. Used to
+ * place audio on a shared clock, see group.h.
+ *
+ * @param now esp_timer_get_time() of the caller.
+ * @return Time in microseconds.
+ */
+int64_t playback_clock_get_latency_us(int64_t now);
@@ -6,12 +6,44 @@
 #define PLAYLIST_ATTEMPT_PLAYLIST_H
 
 #include <stdio.h>
+#include <stdint.h>
 #include "time.h"
 
 // Define the maximum and minimum numbers for valid input
 #define MAX_NUM 60
 #define MIN_NUM 0
 
+// Maximum number of clips returned by get_clips_based_on_num() and get_clips_based_on_time()
+#define MAX_NUM_CLIPS 3
+#define MAX_TIME_CLIPS 8
+
+/**
+ * @brief Ids of the talking clock clips inside the voice pack.
+ *
+ * Number clips use the number itself as id (0 to 19 and the tens 20 to 90),
+ * the words follow from VOICE_CLIP_EN onwards. All ids fit in a byte, see phrase.h.
+ */
+typedef enum {
+    VOICE_CLIP_EN = 100,
+    VOICE_CLIP_HET_IS = 101,
+    VOICE_CLIP_UUR = 102,
+    VOICE_CLIP_INVALID = 103,
+    VOICE_CLIP_HONDERD = 104,
+    VOICE_CLIP_DUIZEND = 105,
+    VOICE_CLIP_KWART = 106,
+    VOICE_CLIP_HALF = 107,
+    VOICE_CLIP_OVER = 108,
+    VOICE_CLIP_VOOR = 109,
+    VOICE_CLIP_SECONDE = 110,
+    VOICE_CLIP_SECONDEN = 111,
+    VOICE_CLIP_S_NACHTS = 112,
+    VOICE_CLIP_S_OCHTENDS = 113,
+    VOICE_CLIP_S_MIDDAGS = 114,
+    VOICE_CLIP_S_AVONDS = 115,
+    VOICE_CLIP_ZONDAG = 116,    // Weekdays in the order of tm_wday, up to VOICE_CLIP_ZONDAG + 6 (zaterdag)
+    VOICE_CLIP_JANUARI = 123,   // Months in the order of tm_mon, up to VOICE_CLIP_JANUARI + 11 (december)
+} voice_clip_id_t;
+
 /**
  * @brief Prints the text representation of a number based on its value.
  *
@@ -54,4 +86,26 @@ char ** get_filenames_based_on_num(int num);
  */
 char ** get_filenames_based_on_time(struct tm *timeinfo);
 
+/**
+ * @brief Fills an array with the voice pack clip ids for a given number.
+ *
+ * Spelled by phrase_number(), 14 to 19 are single clips unlike get_filenames_based_on_num().
+ *
+ * @param num The number for which the clips are to be returned.
+ * @param clips Array of at least MAX_NUM_CLIPS entries that receives the clip ids.
+ * @return The number of clip ids written.
+ */
+int get_clips_based_on_num(int num, uint16_t *clips);
+
+/**
+ * @brief Fills an array with the voice pack clip ids for the full time.
+ *
+ * Spelled by phrase_time() in the digital style: "het is", hour, "uur", minute.
+ *
+ * @param timeinfo Pointer to the struct tm containing the time information.
+ * @param clips Array of at least MAX_TIME_CLIPS entries that receives the clip ids.
+ * @return The number of clip ids written.
+ */
+int get_clips_based_on_time(struct tm *timeinfo, uint16_t *clips);
+
 #endif //PLAYLIST_ATTEMPT_PLAYLIST_H
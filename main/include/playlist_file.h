@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdbool.h>
+#include <string.h>
+#include "esp_err.h"
+
+/**
+ * @brief Streaming parser of M3U, M3U8 and PLS playlists.
+ *
+ * The parser is fed the file in chunks of any size and calls back once per entry, so
+ * it runs in the fixed size of playlist_file_parser_t however long the playlist is.
+ * Relative entries are resolved against the location of the playlist, which can be a
+ * path on the SD card or an http(s) url. Lines longer than PLAYLIST_FILE_LINE_MAX are
+ * skipped and counted.
+ */
+
+/* Longest line, and so the longest entry, the parser keeps */
+#define PLAYLIST_FILE_LINE_MAX 256
+
+/* Longest title kept for an entry */
+#define PLAYLIST_FILE_TITLE_MAX 64
+
+/**
+ * @brief Playlist formats.
+ */
+typedef enum {
+    PLAYLIST_FILE_UNKNOWN,      /*!< Detected from the first line */
+    PLAYLIST_FILE_M3U,          /*!< M3U and M3U8, one entry per line */
+    PLAYLIST_FILE_PLS,          /*!< PLS, FileN= and TitleN= keys */
+} playlist_file_format_t;
+
+/**
+ * @brief Called for every entry in the order of the playlist.
+ *
+ * @param ctx Context passed to the parser.
+ * @param uri Resolved path or url of the entry.
+ * @param title Title from #EXTINF or TitleN=, an empty string when there is none.
+ */
+typedef void (*playlist_file_entry_cb_t)(void *ctx, const char *uri, const char *title);
+
+/**
+ * @brief State of one parse.
+ */
+typedef struct {
+    playlist_file_format_t format;
+    playlist_file_entry_cb_t cb;
+    void *ctx;
+    char base[PLAYLIST_FILE_LINE_MAX];          /*!< Location of the playlist up to the last '/' */
+    char line[PLAYLIST_FILE_LINE_MAX];          /*!< Line being collected */
+    int line_len;
+    bool line_overflow;                         /*!< The line being collected is too long */
+    bool first_line;
+    char title[PLAYLIST_FILE_TITLE_MAX];        /*!< Title of the next M3U entry, or a PLS title before its file */
+    int title_index;                            /*!< PLS entry of that title */
+    int pending_index;                          /*!< PLS entry held until its title is known, 0 when none */
+    char pending_uri[PLAYLIST_FILE_LINE_MAX];
+    char pending_title[PLAYLIST_FILE_TITLE_MAX];
+    int entries;                                /*!< Entries reported */
+    int skipped;                                /*!< Lines skipped for their length */
+} playlist_file_parser_t;
+
+/**
+ * @brief Prepares a parse.
+ *
+ * @param p Parser.
+ * @param location Path or url of the playlist, relative entries are resolved against it.
+ * @param format Format, or PLAYLIST_FILE_UNKNOWN to go by the extension of the location and the first line.
+ * @param cb Called for every entry.
+ * @param ctx Passed to cb.
+ */
+void playlist_file_parser_init(playlist_file_parser_t *p, const char *location, playlist_file_format_t format,
+                               playlist_file_entry_cb_t cb, void *ctx);
+
+/**
+ * @brief Feeds the next chunk of the playlist.
+ *
+ * @param p Parser.
+ * @param data Bytes of the playlist.
+ * @param len Number of bytes.
+ */
+void playlist_file_parser_feed(playlist_file_parser_t *p, const char *data, int len);
+
+/**
+ * @brief Ends the parse, reporting an entry held back by a missing newline or PLS title.
+ *
+ * @param p Parser.
+ * @return Number of entries reported.
+ */
+int playlist_file_parser_finish(playlist_file_parser_t *p);
+
+/**
+ * @brief Resolves a playlist entry against the location of the playlist.
+ *
+ * Absolute urls are kept, paths starting with '/' keep the scheme and host of a url
+ * base, other paths are appended to the base. Backslashes become slashes and "." and
+ * ".." segments are removed.
+ *
+ * @param base Location of the playlist up to and including the last '/'.
+ * @param ref Entry as written in the playlist.
+ * @param out Receives the resolved entry.
+ * @param size Size of out.
+ * @return ESP_OK, or ESP_ERR_INVALID_SIZE when the result does not fit.
+ */
+esp_err_t playlist_file_resolve(const char *base, const char *ref, char *out, int size);
+
+/**
+ * @brief Reads a playlist from the SD card or over http(s) and reports its entries.
+ *
+ * The file is read in small chunks, nothing but the parser and one chunk is in memory.
+ *
+ * @param location Path or url of the playlist.
+ * @param cb Called for every entry.
+ * @param ctx Passed to cb.
+ * @return Number of entries, or -1 when the playlist could not be read.
+ */
+int playlist_file_load(const char *location, playlist_file_entry_cb_t cb, void *ctx);
+
+/**
+ * @brief Path to open an SD card playlist entry with, without its file:// scheme.
+ *
+ * sdcard_scan() reports "file://sdcard/..." urls, which fatfs_stream strips itself.
+ * Code that calls fopen() or stat() on an entry goes through this instead. Paths are
+ * returned as they are.
+ *
+ * @param uri Path or file:// url of an entry.
+ * @return Path in the VFS, pointing into uri.
+ */
+static inline const char *playlist_file_vfs_path(const char *uri)
+{
+    if (strncmp(uri, "file://", 7) != 0) {
+        return uri;
+    }
+    // "file://sdcard/a.wav" and "file:///sdcard/a.wav" both open "/sdcard/a.wav"
+    return uri[7] == '/' ? uri + 7 : uri + 6;
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "driver/i2s.h"
+#include "power_policy.h"
+
+/**
+ * @brief CPU frequency and light sleep governor.
+ *
+ * A scheduler timer measures the CPU load of both cores from the run time of their
+ * idle tasks, and whether audio is being clocked out from the playback clock. The
+ * decisions are made by power_policy.h: MP3 and TLS decoding run at 160 or 240 MHz,
+ * WAV passthrough at 80 MHz. A while after the audio stopped, for a pause or the
+ * tuner, automatic light sleep is enabled and I2S is stopped, so its DMA does not
+ * keep the APB clock up. The first write to I2S starts it again.
+ *
+ * Modules that use Wi-Fi or the SD card without audio playing hold the governor
+ * awake with power_governor_hold().
+ */
+
+/**
+ * @brief Configuration of the governor.
+ */
+typedef struct {
+    int sample_ms;              /*!< Interval of the load measurement */
+    int report_s;               /*!< Interval of the residency log, 0 for none */
+    i2s_port_t i2s_port;        /*!< I2S port stopped while asleep */
+    power_policy_cfg_t policy;
+} power_governor_cfg_t;
+
+#define POWER_GOVERNOR_CFG_DEFAULT() {          \
+    .sample_ms = 100,                           \
+    .report_s = 300,                            \
+    .i2s_port = I2S_NUM_0,                      \
+    .policy = POWER_POLICY_CFG_DEFAULT(),       \
+}
+
+/**
+ * @brief Time spent at each frequency.
+ */
+typedef struct {
+    uint32_t residency_ms[POWER_LEVEL_COUNT];   /*!< Awake at each of power_level_mhz */
+    uint32_t sleep_ms;                          /*!< With light sleep allowed */
+    uint32_t changes;                           /*!< Frequency or sleep changes */
+    int mhz;                                    /*!< Current frequency */
+    bool sleep;                                 /*!< Light sleep allowed now */
+    int load_pct;                               /*!< Last measured load of the busiest core */
+} power_stats_t;
+
+/**
+ * @brief Starts the governor.
+ *
+ * The scheduler must be running. Needs CONFIG_PM_ENABLE and the FreeRTOS run time
+ * statistics counted with esp_timer.
+ *
+ * @param config Governor configuration.
+ * @return ESP_OK on success, ESP_ERR_NOT_SUPPORTED without power management.
+ */
+esp_err_t power_governor_init(const power_governor_cfg_t *config);
+
+/**
+ * @brief Keeps the chip out of light sleep until power_governor_release().
+ *
+ * Calls nest. May be called before the governor is started.
+ */
+void power_governor_hold(void);
+
+/**
+ * @brief Ends a power_governor_hold().
+ */
+void power_governor_release(void);
+
+/**
+ * @brief Called before writing to I2S, starts I2S again when it was stopped for light sleep.
+ */
+void power_governor_audio_begin(void);
+
+/**
+ * @brief Called after writing to I2S.
+ */
+void power_governor_audio_end(void);
+
+/**
+ * @brief Reads the residency statistics.
+ *
+ * @param stats Receives the statistics.
+ */
+void power_governor_get_stats(power_stats_t *stats);
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Decisions of the power governor, without any hardware access so they can be
+ * replayed on the host against recorded load traces.
+ *
+ * Every sample the policy gets the CPU load measured at the current frequency and
+ * picks the lowest frequency that would keep the load under the target. It goes up
+ * at once when the load passes the up threshold, and down only after the lower
+ * frequency would have been enough for a number of samples in a row, so a short dip
+ * does not make it oscillate. An underrun jumps to the highest frequency and holds it
+ * for a while. When nothing plays for a number of samples, the policy allows light
+ * sleep at the lowest frequency, and starts again at the highest when audio returns.
+ */
+
+/* Frequencies the governor chooses from */
+#define POWER_LEVEL_COUNT 3
+extern const int power_level_mhz[POWER_LEVEL_COUNT];
+
+/**
+ * @brief Configuration of the policy.
+ */
+typedef struct {
+    int up_pct;             /*!< Load above which the frequency goes up at once */
+    int target_pct;         /*!< Load the chosen frequency aims for */
+    int down_samples;       /*!< Samples a lower frequency must have been enough before going down */
+    int boost_samples;      /*!< Samples at the highest frequency after an underrun */
+    int idle_samples;       /*!< Samples without audio before light sleep is allowed */
+} power_policy_cfg_t;
+
+#define POWER_POLICY_CFG_DEFAULT() {    \
+    .up_pct = 75,                       \
+    .target_pct = 50,                   \
+    .down_samples = 15,                 \
+    .boost_samples = 50,                \
+    .idle_samples = 20,                 \
+}
+
+/**
+ * @brief One measurement.
+ */
+typedef struct {
+    int load_pct;           /*!< CPU load of the busiest core at the current frequency */
+    bool playing;           /*!< Audio was clocked out since the last sample */
+    bool hold;              /*!< A module asked to stay awake, see power_governor_hold() */
+    uint32_t underruns;     /*!< Underrun count of the playback clock */
+} power_sample_t;
+
+/**
+ * @brief State of the policy.
+ */
+typedef struct {
+    power_policy_cfg_t cfg;
+    int level;              /*!< Index in power_level_mhz */
+    bool sleep;             /*!< Light sleep allowed */
+    int below;              /*!< Samples in a row a lower level was enough */
+    int boost;              /*!< Samples left at the highest level */
+    int quiet;              /*!< Samples in a row without audio */
+    uint32_t underruns;
+} power_policy_t;
+
+/**
+ * @brief Starts a policy at the highest frequency, awake.
+ *
+ * @param p Policy.
+ * @param config Policy configuration.
+ */
+void power_policy_init(power_policy_t *p, const power_policy_cfg_t *config);
+
+/**
+ * @brief Takes a sample and updates the level and the sleep permission.
+ *
+ * @param p Policy.
+ * @param s Sample.
+ * @return True when the level or the sleep permission changed.
+ */
+bool power_policy_update(power_policy_t *p, const power_sample_t *s);
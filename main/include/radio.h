@@ -19,23 +19,110 @@
 
 #include "esp_peripherals.h"
 #include "periph_wifi.h"
+#include "input_key_service.h"
 #include "board.h"
 
 #include "esp_netif.h"
 
-// Define radio stream URLs
-static const char* radio_streams[3] = {
-    "https://www.mp3streams.nl/zender/radio-538/stream/4-mp3-128", 
-    "https://www.mp3streams.nl/zender/qmusic-non-stop/stream/125-mp3-96", 
-    "https://www.mp3streams.nl/zender/concertzender-klassiek/stream/110-mp3-128"};
+#include "mode_manager.h"
+
+// Largest number of stations taken from the station list
+#define RADIO_STATION_MAX 16
+
+// Station probing at startup, HTTPS probes hold their own TLS buffers so only two run at a time
+#define RADIO_PROBE_PARALLEL 2
+#define RADIO_PROBE_TIMEOUT_MS 4000
+
+// Restart of a chain that stopped by itself, the delay doubles while the restarted chain stops again quickly
+#define RADIO_RESTART_MIN_MS 1000
+#define RADIO_RESTART_MAX_MS 60000
+// A chain that played this long before it stopped restarts after the shortest delay again
+#define RADIO_RESTART_RESET_MS 60000
+
+// Radio mode for the mode manager
+extern const player_mode_ops_t radio_mode_ops;
+
+/**
+ * @brief Creates the radio elements and registers them in the shared pipeline.
+ *
+ * Loads the stations from the station list, CONFIG_RADIO_STATION_LIST, falling back
+ * to the built-in stations, and probes them to start with the fastest one. The Wi-Fi connection, codec,
+ * pipeline and i2s writer are owned by the mode manager.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t radio_init(void);
 
 /**
- * @brief Initializes the radio streaming functionality.
+ * @brief Links the radio chain in the shared pipeline and starts it.
  *
- * This function sets up the necessary components for streaming radio content.
- * It prepares the audio pipeline, configures the Wi-Fi connection, and sets up
- * the audio output to the I2S interface.
+ * @return ESP_OK on success.
+ */
+esp_err_t radio_activate(void);
+
+/**
+ * @brief Called by the mode manager after the radio chain was stopped.
+ */
+void radio_deactivate(void);
+
+/**
+ * @brief Handles pipeline events while the radio is active.
+ *
+ * @param msg Event from the shared event interface.
+ */
+void radio_handle_event(audio_event_iface_msg_t *msg);
+
+/**
+ * @brief Handles the keys while the radio is active.
+ *
+ * @param key_id Id of the clicked key.
+ */
+void radio_handle_key(int key_id);
+
+/**
+ * @brief Restarts the radio chain on the next station.
+ */
+void radio_next_station(void);
+
+/**
+ * @brief Selects a station, restarting the radio chain on it when the radio is active.
+ *
+ * Call it with the mode lock held.
+ *
+ * @param index Station index, 0 to radio_get_station_count() - 1.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG for an unknown station.
+ */
+esp_err_t radio_select_station(int index);
+
+/**
+ * @brief Returns the index of the selected station.
+ */
+int radio_get_station(void);
+
+/**
+ * @brief Returns the number of stations.
+ */
+int radio_get_station_count(void);
+
+/**
+ * @brief Returns the URL of a station.
+ *
+ * @param index Station index.
+ * @return The URL, NULL for an unknown station.
+ */
+const char *radio_get_station_url(int index);
+
+/**
+ * @brief Pauses or resumes the radio without dropping the stream.
+ *
+ * While paused the stream keeps being recorded in the timeshift buffer,
+ * resuming continues from the paused point.
+ */
+void radio_toggle_pause(void);
+
+/**
+ * @brief Continues the radio at the live point.
  *
- * @param arg Optional argument for passing additional initialization parameters.
+ * Drops the recorded history and resumes playback if it was paused.
  */
-void init_radio(void* arg);
+void radio_jump_to_live(void);
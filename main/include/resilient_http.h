@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include "audio_element.h"
+#include "lean_http.h"
+
+/**
+ * @brief Reconnecting HTTP(S) stream reader for internet radio.
+ *
+ * Drop-in replacement for the ADF http_stream reader in the radio pipeline. When the
+ * connection drops or a read fails, the element reconnects with exponential backoff
+ * instead of finishing the pipeline, rotating through the configured mirrors after
+ * repeated failures. After max_failures failed attempts in a row the reader gives up and
+ * finishes the stream, so the pipeline stops and the radio moves on. Files served with "Accept-Ranges: bytes" are resumed with a
+ * Range request. After every (re)connect the output restarts at the next MP3 frame
+ * header so the decoder never sees a partial frame. Connections use the memory-lean TLS
+ * profile of lean_http.h.
+ */
+
+/**
+ * @brief Configuration of the resilient http reader.
+ */
+typedef struct {
+    const char *const *urls;    /*!< Stream mirrors, tried in order */
+    int url_count;              /*!< Number of mirrors */
+    int start_index;            /*!< Mirror to connect to first */
+    int timeout_ms;             /*!< Connect and read timeout */
+    int backoff_min_ms;         /*!< First reconnect delay */
+    int backoff_max_ms;         /*!< Reconnect delay cap */
+    int retries_per_url;        /*!< Failed attempts before moving to the next mirror */
+    int max_failures;           /*!< Failed attempts in a row before giving up, 0 to retry forever */
+    int out_rb_size;            /*!< Size of the output ring buffer */
+    int task_stack;             /*!< Task stack size */
+    int task_core;              /*!< Task running core */
+    int task_prio;              /*!< Task priority */
+    int buf_sz;                 /*!< Bytes read per iteration */
+} resilient_http_cfg_t;
+
+#define RESILIENT_HTTP_CFG_DEFAULT() {      \
+    .urls = NULL,                           \
+    .url_count = 0,                         \
+    .start_index = 0,                       \
+    .timeout_ms = 5000,                     \
+    .backoff_min_ms = 250,                  \
+    .backoff_max_ms = 16000,                \
+    .retries_per_url = 3,                   \
+    .max_failures = 12,                     \
+    .out_rb_size = 20 * 1024,               \
+    .task_stack = 6 * 1024,                 \
+    .task_core = 0,                         \
+    .task_prio = 4,                         \
+    .buf_sz = 2048,                         \
+}
+
+/**
+ * @brief Reconnect statistics of the resilient http reader.
+ */
+typedef struct {
+    int url_index;              /*!< Mirror currently in use */
+    int reconnects;             /*!< Successful reconnects since the element opened */
+    int last_recovery_ms;       /*!< Time from the last drop until audio flowed again */
+    int max_recovery_ms;        /*!< Longest recovery since the element opened */
+    int64_t bytes_read;         /*!< Stream bytes read since the element opened */
+    bool gave_up;               /*!< Out of retries, the stream was finished */
+    lean_http_stats_t connection;   /*!< Handshake time and TLS heap of the last connection */
+} resilient_http_stats_t;
+
+/**
+ * @brief Creates the resilient http reader.
+ *
+ * @param config Reader configuration, the url array must outlive the element.
+ * @return Element handle, or NULL on failure.
+ */
+audio_element_handle_t resilient_http_init(resilient_http_cfg_t *config);
+
+/**
+ * @brief Selects the mirror used on the next open.
+ *
+ * @param el Reader element.
+ * @param index Index in the configured url array.
+ */
+void resilient_http_set_url_index(audio_element_handle_t el, int index);
+
+/**
+ * @brief Reads the reconnect statistics.
+ *
+ * @param el Reader element.
+ * @param stats Receives the statistics.
+ */
+void resilient_http_get_stats(audio_element_handle_t el, resilient_http_stats_t *stats);
@@ -0,0 +1,106 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Playback state kept in NVS, so a power cycle resumes where the speaker left off.
+ *
+ * Setters only update a copy in RAM. A low priority task writes the copy as one blob
+ * when it differs from what was written last, and never more often than the intervals
+ * in the configuration: changes of mode, song, station or volume are written after
+ * change_interval_ms, a position that merely advanced after position_interval_ms. The
+ * position is polled from a source the active player registers. esp_restart() flushes
+ * the state through a shutdown handler.
+ *
+ * A write costs a few 32-byte NVS entries, so a position written every 30 s fills a
+ * 4 kB page about every 10 minutes. NVS spreads the page erases over the partition.
+ */
+
+/* Longest song path that is saved, longer paths resume from the top of the playlist */
+#define RESUME_STATE_PATH_LEN 96
+
+/**
+ * @brief Saved playback state.
+ */
+typedef struct {
+    int32_t mode;                       /*!< Active player_mode_t */
+    int32_t volume;                     /*!< Codec volume in percent */
+    int32_t station;                    /*!< Radio station index */
+    int32_t track_id;                   /*!< Index of the song in the SD card playlist */
+    int32_t position_ms;                /*!< Position in the song */
+    char track[RESUME_STATE_PATH_LEN];  /*!< Path of the song, empty when none was played */
+} resume_state_t;
+
+/**
+ * @brief Configuration of the state writer.
+ */
+typedef struct {
+    int change_interval_ms;     /*!< Minimum time between writes for a changed mode, song, station or volume */
+    int position_interval_ms;   /*!< Minimum time between writes for an advanced position */
+    int task_prio;              /*!< Priority of the writer task */
+} resume_state_cfg_t;
+
+#define RESUME_STATE_CFG_DEFAULT() {    \
+    .change_interval_ms = 5000,         \
+    .position_interval_ms = 30000,      \
+    .task_prio = 1,                     \
+}
+
+/**
+ * @brief Returns the playback position to save, or -1 when nothing that can be resumed plays.
+ */
+typedef int32_t (*resume_position_source_t)(void);
+
+/**
+ * @brief Loads the saved state and starts the writer task.
+ *
+ * NVS must be initialized.
+ *
+ * @param config Writer configuration.
+ * @param state Receives the saved state, or all -1 and an empty path when nothing was saved.
+ * @return ESP_OK when a saved state was loaded, ESP_ERR_NOT_FOUND when none was saved,
+ *         ESP_FAIL when the writer could not be started.
+ */
+esp_err_t resume_state_init(const resume_state_cfg_t *config, resume_state_t *state);
+
+/**
+ * @brief Saves the active mode.
+ */
+void resume_state_set_mode(int mode);
+
+/**
+ * @brief Saves the codec volume.
+ */
+void resume_state_set_volume(int volume);
+
+/**
+ * @brief Saves the radio station.
+ */
+void resume_state_set_station(int station);
+
+/**
+ * @brief Saves the song that starts playing, at position 0.
+ *
+ * @param track_id Index in the playlist.
+ * @param path Path of the song.
+ */
+void resume_state_set_track(int track_id, const char *path);
+
+/**
+ * @brief Sets the source the writer polls for the position, NULL to stop polling.
+ */
+void resume_state_set_position_source(resume_position_source_t source);
+
+/**
+ * @brief Writes the state now if it changed, regardless of the intervals.
+ *
+ * @return ESP_OK on success or when nothing changed.
+ */
+esp_err_t resume_state_flush(void);
+
+/**
+ * @brief Returns the number of NVS writes since boot.
+ */
+uint32_t resume_state_get_writes(void);
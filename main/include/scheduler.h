@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include "esp_err.h"
+#include "timer_wheel.h"
+
+/**
+ * @brief Timer service for alarms, chimes, sleep timers and animations.
+ *
+ * One task runs a timer wheel with 10 ms ticks and calls back every expired timer, so
+ * any number of timers costs no task or FreeRTOS timer each. The task sleeps until the
+ * wheel has work.
+ *
+ * Besides timers that expire after a delay, timers can follow the wall clock: every
+ * hour on the hour, or every day at a local time. Their next expiry is computed from
+ * the local time under the time zone set by timesync_set_timezone(), so they follow
+ * the daylight saving time changes. They are computed again when the clock is set,
+ * and wait while the time was never set.
+ *
+ * Callbacks run in the scheduler task without the scheduler lock, so they may start and
+ * cancel timers and call into other modules. A timer cancelled by another task while
+ * its callback is about to run still runs that once.
+ */
+
+/* Length of a tick of the timer wheel */
+#define SCHEDULER_TICK_MS 10
+
+/**
+ * @brief Configuration of the scheduler.
+ */
+typedef struct {
+    int task_stack;         /*!< Stack size of the scheduler task */
+    int task_prio;          /*!< Priority of the scheduler task */
+} scheduler_cfg_t;
+
+#define SCHEDULER_CFG_DEFAULT() {   \
+    .task_stack = 4096,             \
+    .task_prio = 5,                 \
+}
+
+typedef struct scheduler_timer scheduler_timer_t;
+
+/**
+ * @brief Called when a timer expires.
+ *
+ * @param timer The expired timer, may be started again.
+ * @param arg Argument of the timer.
+ */
+typedef void (*scheduler_cb_t)(scheduler_timer_t *timer, void *arg);
+
+/**
+ * @brief A timer, owned by the user.
+ */
+struct scheduler_timer {
+    timer_wheel_timer_t wheel;
+    scheduler_cb_t cb;
+    void *arg;
+    int64_t due_us;                     /*!< esp_timer time the timer is due */
+    time_t at;                          /*!< Wall clock time of a wall clock timer, 0 while the time is unknown */
+    int8_t hour, minute;                /*!< Daily at hour:minute, hour -1 for hourly, -2 for a delay timer */
+    scheduler_timer_t *wall_next;
+    scheduler_timer_t **wall_pprev;     /*!< NULL when not a running wall clock timer */
+};
+
+/**
+ * @brief Dispatch statistics.
+ */
+typedef struct {
+    uint32_t dispatched;        /*!< Callbacks run since boot */
+    int64_t max_late_us;        /*!< Longest delay from due to callback */
+    int64_t total_late_us;      /*!< Sum of the delays, for the mean */
+} scheduler_stats_t;
+
+/**
+ * @brief Starts the scheduler task.
+ *
+ * @param config Scheduler configuration.
+ * @return ESP_OK on success.
+ */
+esp_err_t scheduler_init(const scheduler_cfg_t *config);
+
+/**
+ * @brief Prepares a timer, call it once before starting the timer.
+ *
+ * @param t Timer.
+ * @param cb Called when the timer expires.
+ * @param arg Passed to cb.
+ */
+void scheduler_timer_init(scheduler_timer_t *t, scheduler_cb_t cb, void *arg);
+
+/**
+ * @brief Starts a timer that expires once after a delay, restarting it when it runs.
+ *
+ * @param t Timer.
+ * @param delay_ms Delay, rounded up to a tick.
+ */
+void scheduler_start_after(scheduler_timer_t *t, uint32_t delay_ms);
+
+/**
+ * @brief Starts a timer that expires every hour on the hour, local time.
+ *
+ * @param t Timer.
+ */
+void scheduler_start_hourly(scheduler_timer_t *t);
+
+/**
+ * @brief Starts a timer that expires every day at a local time.
+ *
+ * A time skipped by the change to summer time expires at the same wall clock time one
+ * hour later, a time that occurs twice at the change to winter time expires once.
+ *
+ * @param t Timer.
+ * @param hour Hour, 0 to 23.
+ * @param minute Minute, 0 to 59.
+ */
+void scheduler_start_daily(scheduler_timer_t *t, int hour, int minute);
+
+/**
+ * @brief Stops a timer, nothing happens when it is not running.
+ *
+ * @param t Timer.
+ */
+void scheduler_cancel(scheduler_timer_t *t);
+
+/**
+ * @brief Returns whether a timer is running.
+ *
+ * @param t Timer.
+ */
+bool scheduler_is_running(scheduler_timer_t *t);
+
+/**
+ * @brief Computes the wall clock timers again after the clock was set.
+ *
+ * Called on SNTP synchronization. Steps of the clock are also noticed by the scheduler itself.
+ */
+void scheduler_time_changed(void);
+
+/**
+ * @brief Returns the next time after a time at which the local clock shows hour:minute.
+ *
+ * @param after Time to start from.
+ * @param hour Hour, 0 to 23.
+ * @param minute Minute, 0 to 59.
+ * @return The next occurrence.
+ */
+time_t scheduler_next_daily(time_t after, int hour, int minute);
+
+/**
+ * @brief Returns the next full hour after a time.
+ *
+ * @param after Time to start from.
+ * @return The next full hour, local time.
+ */
+time_t scheduler_next_hour(time_t after);
+
+/**
+ * @brief Reads the dispatch statistics.
+ *
+ * @param stats Receives the statistics.
+ */
+void scheduler_get_stats(scheduler_stats_t *stats);
@@ -1,10 +1,14 @@
 #pragma once
 
 #include <string.h>
+#include <sys/stat.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 
+#include "esp_system.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "audio_element.h"
@@ -13,7 +17,7 @@
 #include "audio_common.h"
 #include "fatfs_stream.h"
 #include "i2s_stream.h"
-#include "wav_decoder.h"
+#include "wav_stream.h"
 #include "filter_resample.h"
 
 #include "esp_peripherals.h"
@@ -27,27 +31,81 @@
 #include "sdcard_list.h"
 #include "sdcard_scan.h"
 
-void initialize_peripherals();
+#include "voicepack.h"
+#include "fused_player.h"
+#include "mode_manager.h"
+#include "vu_meter.h"
+#include "playback_clock.h"
+#include "wav_file.h"
+#include "pcm_convert.h"
+#include "resume_state.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "playlist_file.h"
+#include "trace_recorder.h"
+
+// SD card player mode for the mode manager
+extern const player_mode_ops_t sdcard_mode_ops;
+
 void setup_sdcard_playlist();
-void start_codec_chip();
-void create_input_key_service();
-void create_audio_pipeline();
 void create_audio_elements();
-void set_up_event_listener();
 
-void sdcard_player_init();
-void sdcard_player_start();
+esp_err_t sdcard_player_init();
+esp_err_t sdcard_player_activate();
+void sdcard_player_deactivate();
+void sdcard_player_handle_event(audio_event_iface_msg_t *msg);
+void sdcard_player_handle_key(int key_id);
+void sdcard_player_handle_scrub(int direction);
 
 void sdcard_url_save_cb(void *user_data, char *url);
 
-esp_err_t input_key_service_cb(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx);
-
-esp_err_t handle_touchpad_event(periph_service_event_t *evt, void *ctx);
 void handle_play_pause_resume(audio_element_state_t el_state);
 void handle_next_song();
-void handle_volume_up();
-void handle_volume_down();
 void play_sound(const char *sound_file);
 void play_sound_by_filename(const char *sound_filename);
 
+/**
+ * @brief Plays a sequence of clips from the voice pack.
+ *
+ * The pipeline is relinked to read from the voice pack instead of the playlist file.
+ * When the announcement finishes the playlist chain is restored and the current
+ * song is started again. Only available while the SD card player is the active mode.
+ *
+ * @param clip_ids Array of clip ids, see voice_clip_id_t.
+ * @param count Number of clip ids.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE when no voice pack is loaded or another mode is active.
+ */
+esp_err_t play_announcement(const uint16_t *clip_ids, int count);
+
+/**
+ * @brief Jumps to a time in the current song.
+ *
+ * The offset is computed from the fmt and data chunks of the file and rounded down to
+ * a frame. The fused player moves its file without stopping. The four element chain is
+ * stopped, the file reader reopens at the offset and feeds the resampler directly, so
+ * the header is not parsed again. The next song goes back to the normal chain.
+ *
+ * @param position_ms Time from the start of the song, clamped to the song.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE during an announcement or in another mode,
+ *         ESP_ERR_NOT_SUPPORTED when the file is not in a format the player supports.
+ */
+esp_err_t sdcard_player_seek(int64_t position_ms);
+
+/**
+ * @brief Jumps forward or back from the position that is heard.
+ *
+ * @param delta_ms Time to jump, negative to go back.
+ * @return See sdcard_player_seek().
+ */
+esp_err_t sdcard_player_seek_relative(int64_t delta_ms);
+
+/**
+ * @brief Returns the path of the current song.
+ *
+ * Call it with the mode lock held, the path changes with the song.
+ *
+ * @return The path, NULL before the first song.
+ */
+const char *sdcard_player_get_track(void);
+
 
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+
+/**
+ * @brief Result of probing one radio station.
+ */
+typedef struct {
+    bool healthy;       /*!< Server answered 200 and sent an MP3 frame header */
+    int status;         /*!< HTTP status code, 0 when the connection failed */
+    int latency_ms;     /*!< Time from connect until the first frame header */
+} station_probe_result_t;
+
+/**
+ * @brief Probes radio stations concurrently and picks the fastest healthy one.
+ *
+ * One short-lived task per station connects, checks the response and reads until
+ * the first MP3 frame header. The call returns when every probe has finished or
+ * timed out.
+ *
+ * @param urls Station urls.
+ * @param count Number of stations.
+ * @param max_parallel Maximum number of probes connected at the same time, each
+ *                     HTTPS probe holds its own TLS buffers.
+ * @param timeout_ms Connect and read timeout of a probe.
+ * @param results Array of count entries that receives the result per station, may be NULL.
+ * @return Index of the fastest healthy station, or -1 when none is healthy.
+ */
+int station_probe_fastest(const char *const *urls, int count, int max_parallel, int timeout_ms,
+                          station_probe_result_t *results);
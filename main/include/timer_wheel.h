@@ -0,0 +1,118 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Hierarchical timer wheel.
+ *
+ * Four levels of 64 slots, each slot a list of timers, cover 2^24 ticks; timers
+ * further away wait in the last level and move down when they come in range. Adding
+ * and cancelling a timer are O(1), every 64 ticks one slot of the next level is
+ * cascaded into the level below. The timers are owned by the caller, the wheel
+ * allocates nothing.
+ *
+ * The wheel knows nothing about time, its owner advances it to the current tick.
+ * Ticks are unsigned 32-bit and may wrap. Not thread safe.
+ */
+
+#define TIMER_WHEEL_LEVELS 4
+#define TIMER_WHEEL_SLOT_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_SLOT_BITS)
+
+/* Returned by timer_wheel_next_due() when no timer is pending */
+#define TIMER_WHEEL_IDLE UINT32_MAX
+
+typedef struct timer_wheel_timer timer_wheel_timer_t;
+
+/**
+ * @brief Called when a timer expires, the timer may be added again from the callback.
+ *
+ * @param timer The expired timer.
+ * @param arg Argument of the timer.
+ */
+typedef void (*timer_wheel_cb_t)(timer_wheel_timer_t *timer, void *arg);
+
+/**
+ * @brief A timer, embedded by the user.
+ */
+struct timer_wheel_timer {
+    timer_wheel_timer_t *next;
+    timer_wheel_timer_t **pprev;        /*!< NULL when not pending */
+    uint32_t expires;                   /*!< Tick the timer expires on */
+    uint8_t level, slot;
+    timer_wheel_cb_t cb;
+    void *arg;
+};
+
+/**
+ * @brief State of a wheel.
+ */
+typedef struct {
+    uint32_t now;                                               /*!< Next tick to process */
+    uint64_t used[TIMER_WHEEL_LEVELS];                          /*!< Slots with timers, one bit per slot */
+    timer_wheel_timer_t *slots[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+} timer_wheel_t;
+
+/**
+ * @brief Empties a wheel.
+ *
+ * @param w Wheel.
+ * @param now Current tick.
+ */
+void timer_wheel_init(timer_wheel_t *w, uint32_t now);
+
+/**
+ * @brief Prepares a timer, it is not pending until added.
+ *
+ * @param t Timer.
+ * @param cb Called when the timer expires.
+ * @param arg Passed to cb.
+ */
+void timer_wheel_timer_init(timer_wheel_timer_t *t, timer_wheel_cb_t cb, void *arg);
+
+/**
+ * @brief Adds a timer, or moves it when it is pending.
+ *
+ * @param w Wheel.
+ * @param t Timer.
+ * @param expires Tick to expire on, a tick before the next tick to process expires on the next one.
+ */
+void timer_wheel_add(timer_wheel_t *w, timer_wheel_timer_t *t, uint32_t expires);
+
+/**
+ * @brief Cancels a timer, nothing happens when it is not pending.
+ *
+ * @param w Wheel.
+ * @param t Timer.
+ */
+void timer_wheel_cancel(timer_wheel_t *w, timer_wheel_timer_t *t);
+
+/**
+ * @brief Returns whether a timer waits to expire.
+ */
+static inline bool timer_wheel_pending(const timer_wheel_timer_t *t)
+{
+    return t->pprev != 0;
+}
+
+/**
+ * @brief Processes all ticks up to and including a tick, calling back every expired timer.
+ *
+ * Ticks without a timer or a cascade to do are skipped, so advancing over a long time is cheap.
+ *
+ * @param w Wheel.
+ * @param now Current tick.
+ */
+void timer_wheel_advance(timer_wheel_t *w, uint32_t now);
+
+/**
+ * @brief Returns the number of ticks from the next tick to process until the wheel has work.
+ *
+ * The work may be a cascade that expires nothing, so the result is a safe time to sleep,
+ * not the exact time of the next expiry.
+ *
+ * @param w Wheel.
+ * @return Ticks, 0 when the next tick has work, TIMER_WHEEL_IDLE when no timer is pending.
+ */
+uint32_t timer_wheel_next_due(const timer_wheel_t *w);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "audio_element.h"
+
+/**
+ * @brief Timeshift buffer for live radio streams.
+ *
+ * The element sits between the http stream and the mp3 decoder and keeps a bounded
+ * history of the compressed stream. It never stops reading from the http stream, so
+ * the connection stays alive while playback is paused. On resume playback continues
+ * from the paused point, or from the live point after timeshift_jump_to_live().
+ *
+ * The history is kept in a RAM ring and can optionally be spilled to a preallocated
+ * ring file on the SD card for minutes of history at a few kB of RAM.
+ */
+
+/* 8.3 name, the sdkconfig builds FATFS without long filename support */
+#define TIMESHIFT_SPILL_PATH "/sdcard/TSHIFT.BIN"
+
+/**
+ * @brief Configuration of the timeshift element.
+ */
+typedef struct {
+    int ram_size;           /*!< Size of the RAM ring in bytes */
+    const char *spill_path; /*!< Ring file on the SD card, NULL to keep the history in RAM only */
+    int spill_size;         /*!< Size of the ring file in bytes */
+    int out_rb_size;        /*!< Size of the output ring buffer */
+    int task_stack;         /*!< Task stack size */
+    int task_core;          /*!< Task running core */
+    int task_prio;          /*!< Task priority */
+    int buf_sz;             /*!< Bytes moved per iteration */
+} timeshift_cfg_t;
+
+#define TIMESHIFT_CFG_DEFAULT() {           \
+    .ram_size = 32 * 1024,                  \
+    .spill_path = NULL,                     \
+    .spill_size = 4 * 1024 * 1024,          \
+    .out_rb_size = 8 * 1024,                \
+    .task_stack = 3072,                     \
+    .task_core = 0,                         \
+    .task_prio = 5,                         \
+    .buf_sz = 2048,                         \
+}
+
+/**
+ * @brief Statistics of the timeshift element.
+ */
+typedef struct {
+    int64_t behind_live;    /*!< Bytes between the play point and the live point */
+    int64_t available;      /*!< Bytes of history that can still be played */
+    int64_t dropped;        /*!< Bytes dropped because the history overflowed */
+    int64_t spill_written;  /*!< Bytes written to the ring file */
+} timeshift_stats_t;
+
+/**
+ * @brief Creates the timeshift element.
+ *
+ * @param config Element configuration.
+ * @return Element handle, or NULL on failure.
+ */
+audio_element_handle_t timeshift_init(timeshift_cfg_t *config);
+
+/**
+ * @brief Pauses or resumes output while input keeps being recorded.
+ *
+ * @param el Timeshift element.
+ * @param paused true to pause, false to resume from the paused point.
+ */
+void timeshift_set_paused(audio_element_handle_t el, bool paused);
+
+/**
+ * @brief Returns whether output is paused.
+ *
+ * @param el Timeshift element.
+ * @return true when paused.
+ */
+bool timeshift_is_paused(audio_element_handle_t el);
+
+/**
+ * @brief Drops the recorded history and continues at the live point.
+ *
+ * @param el Timeshift element.
+ */
+void timeshift_jump_to_live(audio_element_handle_t el);
+
+/**
+ * @brief Reads the statistics of the timeshift element.
+ *
+ * @param el Timeshift element.
+ * @param stats Receives the statistics.
+ */
+void timeshift_get_stats(audio_element_handle_t el, timeshift_stats_t *stats);
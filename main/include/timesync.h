@@ -13,6 +13,10 @@
 #include "radio.h"
 #include "sdkconfig.h"
 #include "protocol_examples_common.h"
+#include "scheduler.h"
+
+/* Central European Time, summer time from the last Sunday of March to the last Sunday of October */
+#define TIMESYNC_TZ "CET-1CEST,M3.5.0,M10.5.0/3"
 
 /**
  * @brief Callback function for time synchronization notification.
@@ -23,6 +27,13 @@
  */
 void time_sync_notification_cb(struct timeval *tv);
 
+/**
+ * @brief Sets the local time zone, with its daylight saving time rules.
+ *
+ * Local times, and the wall clock timers of the scheduler, follow this time zone.
+ */
+void timesync_set_timezone(void);
+
 /**
  * @brief Obtains the current time.
  *
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * @brief Compact binary encoding of the records of an input and event trace.
+ *
+ * A trace file is a TRACE_HEADER_SIZE byte header followed by records. A record is a
+ * byte with the type in the low nibble and the number of arguments in the high nibble,
+ * the time since the previous record in microseconds as an unsigned LEB128 varint, and
+ * the arguments as zigzag varints. A key action takes about 6 bytes, a pipeline event about 9.
+ *
+ * The encoding does no locking, no allocation and no I/O, see trace_recorder.h for
+ * the recorder on the speaker and tools/trace.py for the host side.
+ */
+
+#define TRACE_MAGIC "TRC1"
+#define TRACE_HEADER_SIZE 8
+
+/* Arguments of one record */
+#define TRACE_MAX_ARGS 4
+
+/* Longest encoded record */
+#define TRACE_RECORD_MAX (1 + 10 + TRACE_MAX_ARGS * 5)
+
+/* Bytes a trace_reader_t reads at a time, at least TRACE_RECORD_MAX */
+#define TRACE_READ_CHUNK 256
+
+/**
+ * @brief Record types, the arguments are listed in order.
+ */
+typedef enum {
+    TRACE_KEY = 1,      /*!< Key id, input key service action */
+    TRACE_EVENT,        /*!< Source type, source id (tag hash or periph id), command, data */
+    TRACE_MODE,         /*!< Mode, switch time in ms */
+    TRACE_IO,           /*!< trace_io_t, duration in us, bytes or result */
+    TRACE_CPU,          /*!< Load of the busiest core in percent, CPU MHz, underruns since boot */
+    TRACE_MARK,         /*!< Start of a replay, no arguments */
+} trace_type_t;
+
+/**
+ * @brief Kinds of I/O timed in TRACE_IO records.
+ */
+typedef enum {
+    TRACE_IO_HTTP_CONNECT = 1,  /*!< Connect and headers, result is the HTTP status or -1 */
+    TRACE_IO_HTTP_READ,         /*!< A slow read of the stream */
+    TRACE_IO_SD_OPEN,           /*!< Opening and parsing a file */
+    TRACE_IO_SD_READ,           /*!< A slow read of a file */
+} trace_io_t;
+
+/**
+ * @brief One decoded record.
+ */
+typedef struct {
+    int64_t time_us;                /*!< Time since the start of the trace */
+    uint8_t type;                   /*!< trace_type_t */
+    uint8_t nargs;
+    int32_t args[TRACE_MAX_ARGS];
+} trace_record_t;
+
+/**
+ * @brief Reads up to size bytes of a trace, returns the bytes read, 0 at the end.
+ */
+typedef int (*trace_read_fn)(void *ctx, uint8_t *buf, int size);
+
+/**
+ * @brief Decodes the records of a trace read in chunks of TRACE_READ_CHUNK bytes.
+ *
+ * A trace of any length is replayed in this fixed buffer instead of being read whole.
+ */
+typedef struct {
+    trace_read_fn read;
+    void *ctx;
+    uint8_t buf[TRACE_READ_CHUNK];
+    int pos;                        /*!< Next byte to decode in buf */
+    int len;                        /*!< Bytes in buf */
+    bool end;                       /*!< read returned 0 */
+    int64_t last_us;                /*!< Time of the previous record */
+    long offset;                    /*!< Bytes of the trace before buf */
+} trace_reader_t;
+
+/**
+ * @brief Writes the file header.
+ *
+ * @param out At least TRACE_HEADER_SIZE bytes.
+ */
+void trace_write_header(uint8_t *out);
+
+/**
+ * @brief Checks the file header.
+ *
+ * @return True when the buffer starts with a header of this version.
+ */
+bool trace_check_header(const uint8_t *in, int len);
+
+/**
+ * @brief Encodes a record.
+ *
+ * @param out Buffer.
+ * @param size Room in the buffer.
+ * @param rec Record, its time must not be before the previous one.
+ * @param last_us Time of the previous record, updated.
+ * @return Bytes written, 0 when the record does not fit.
+ */
+int trace_encode(uint8_t *out, int size, const trace_record_t *rec, int64_t *last_us);
+
+/**
+ * @brief Decodes a record.
+ *
+ * @param in Encoded records.
+ * @param len Bytes left.
+ * @param rec Receives the record.
+ * @param last_us Time of the previous record, updated.
+ * @return Bytes read, 0 at the end, -1 when the record is cut off or invalid.
+ */
+int trace_decode(const uint8_t *in, int len, trace_record_t *rec, int64_t *last_us);
+
+/**
+ * @brief Starts reading a trace, reads and checks its header.
+ *
+ * @param reader Reader to initialize.
+ * @param read Reads the next bytes of the trace.
+ * @param ctx Passed to read.
+ * @return True when the trace starts with a header of this version.
+ */
+bool trace_reader_init(trace_reader_t *reader, trace_read_fn read, void *ctx);
+
+/**
+ * @brief Decodes the next record, reading the next chunk when the buffer runs low.
+ *
+ * @param reader Reader.
+ * @param rec Receives the record.
+ * @return 1 for a record, 0 at the end, -1 when the record is cut off or invalid.
+ */
+int trace_reader_next(trace_reader_t *reader, trace_record_t *rec);
+
+/**
+ * @brief Returns the 16-bit id of an element tag stored in TRACE_EVENT records.
+ *
+ * FNV-1a folded to 16 bits, tools/trace.py hashes the known tags the same way.
+ */
+uint16_t trace_tag_id(const char *tag);
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "audio_event_iface.h"
+#include "trace.h"
+
+/**
+ * @brief Records key presses, pipeline events and I/O timing, and replays the keys.
+ *
+ * Gaps and slow reactions that depend on when a key is pressed relative to a track end
+ * or a reconnect do not show up twice in a row by hand. With CONFIG_SPEAKER_TRACE the
+ * speaker appends every key action, every message of the mode manager's event
+ * interface, every mode switch, the HTTP connects, stream and file reads slower than
+ * TRACE_SLOW_IO_US and the load sample of the power governor to a RAM buffer, in the
+ * encoding of trace.h. Recording starts at boot and stops when the buffer is full.
+ *
+ * trace_recorder_save() writes the buffer to the SD card. trace_recorder_replay()
+ * presses the keys of a saved trace again with the same spacing, through the same
+ * dispatch as the board keys, while recording a new trace. tools/trace.py turns a trace
+ * into latency, gap, I/O and CPU metrics on the trace's own clock and diffs the metrics
+ * of two revisions.
+ *
+ * Without CONFIG_SPEAKER_TRACE all calls are empty inline functions.
+ */
+
+#define TRACE_PATH "/sdcard/TRACE.BIN"
+#define TRACE_REPLAY_PATH "/sdcard/REPLAY.BIN"
+
+/* Stream and file reads faster than this are not recorded */
+#define TRACE_SLOW_IO_US 10000
+
+/* Time recorded after the last replayed key, for the reactions to it */
+#define TRACE_REPLAY_TAIL_MS 5000
+
+#if CONFIG_SPEAKER_TRACE
+
+/**
+ * @brief Allocates the buffer and starts recording.
+ *
+ * @return ESP_OK on success, ESP_ERR_NO_MEM when the buffer could not be allocated.
+ */
+esp_err_t trace_recorder_init(void);
+
+/**
+ * @brief Returns the clock of the I/O records, to pass to trace_recorder_io().
+ */
+static inline int64_t trace_recorder_now(void)
+{
+    return esp_timer_get_time();
+}
+
+/**
+ * @brief Records a key action of the input key service.
+ */
+void trace_recorder_key(int key_id, int action);
+
+/**
+ * @brief Records a message of the event interface of the mode manager.
+ */
+void trace_recorder_event(const audio_event_iface_msg_t *msg);
+
+/**
+ * @brief Records a mode switch.
+ */
+void trace_recorder_mode(int mode, int switch_ms);
+
+/**
+ * @brief Records an I/O operation that started at start_us, reads only when slow.
+ *
+ * @param kind Kind of I/O.
+ * @param start_us trace_recorder_now() before the operation.
+ * @param result Bytes read or the result of the operation.
+ */
+void trace_recorder_io(trace_io_t kind, int64_t start_us, int result);
+
+/**
+ * @brief Records a load sample.
+ */
+void trace_recorder_cpu(int load_pct, int mhz, uint32_t underruns);
+
+/**
+ * @brief Writes what was recorded so far to a file.
+ *
+ * @param path File, replaced.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE when the recorder is not running.
+ */
+esp_err_t trace_recorder_save(const char *path);
+
+/**
+ * @brief Starts replaying the keys of a trace in a task.
+ *
+ * The recording restarts with the replay and is saved to out_path TRACE_REPLAY_TAIL_MS
+ * after the last key.
+ *
+ * @param path Trace to replay.
+ * @param out_path File for the trace of the replay.
+ * @return ESP_OK when the replay started, ESP_ERR_INVALID_STATE while one runs,
+ * ESP_ERR_NOT_FOUND when the trace could not be read.
+ */
+esp_err_t trace_recorder_replay(const char *path, const char *out_path);
+
+#else
+
+static inline esp_err_t trace_recorder_init(void)
+{
+    return ESP_OK;
+}
+
+static inline int64_t trace_recorder_now(void)
+{
+    return 0;
+}
+
+static inline void trace_recorder_key(int key_id, int action)
+{
+}
+
+static inline void trace_recorder_event(const audio_event_iface_msg_t *msg)
+{
+}
+
+static inline void trace_recorder_mode(int mode, int switch_ms)
+{
+}
+
+static inline void trace_recorder_io(trace_io_t kind, int64_t start_us, int result)
+{
+}
+
+static inline void trace_recorder_cpu(int load_pct, int mhz, uint32_t underruns)
+{
+}
+
+#endif
@@ -0,0 +1,166 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "audio_element.h"
+
+/**
+ * @brief Packed voice clips for spoken announcements.
+ *
+ * A voice pack is a single file on the SD card that holds the raw PCM of every
+ * announcement clip for one or more voices/languages. The file starts with a
+ * fixed header, followed by a voice table and a clip table sorted on
+ * (voice, clip id). Every clip payload starts on a sector boundary, so clips are
+ * read with sector-aligned sequential reads after a single open.
+ *
+ * Layout (all fields little-endian):
+ *   header     : voicepack_header_t
+ *   voices     : voice_count * voicepack_voice_t
+ *   clips      : clip_count  * voicepack_clip_t
+ *   payloads   : PCM data, each padded to VOICEPACK_SECTOR_SIZE
+ *
+ * Use tools/voicepack.py to build and verify a pack from a directory of WAVs.
+ */
+
+/* 8.3 name, the sdkconfig builds FATFS without long filename support */
+#define VOICEPACK_PATH "/sdcard/VOICE.VPK"
+
+#define VOICEPACK_MAGIC "VPAK"
+#define VOICEPACK_VERSION 1
+#define VOICEPACK_SECTOR_SIZE 512
+#define VOICEPACK_LANG_LEN 4
+#define VOICEPACK_NAME_LEN 12
+
+typedef struct __attribute__((packed)) {
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint16_t voice_count;
+    uint16_t clip_count;
+    uint16_t sector_size;
+    uint16_t reserved0;
+    uint32_t voice_table_offset;
+    uint32_t clip_table_offset;
+    uint32_t reserved1[2];
+} voicepack_header_t;
+
+typedef struct __attribute__((packed)) {
+    char lang[VOICEPACK_LANG_LEN];
+    char name[VOICEPACK_NAME_LEN];
+} voicepack_voice_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t voice;
+    uint16_t clip_id;
+    uint32_t offset;
+    uint32_t length;
+    uint32_t sample_rate;
+    uint8_t bits;
+    uint8_t channels;
+    uint16_t reserved;
+} voicepack_clip_t;
+
+/**
+ * @brief Handle to an opened voice pack.
+ */
+typedef struct voicepack {
+    FILE *file;
+    voicepack_header_t header;
+    voicepack_voice_t *voices;
+    voicepack_clip_t *clips;
+    int voice;
+} voicepack_t;
+
+/**
+ * @brief Opens a voice pack and loads its voice and clip tables.
+ *
+ * The first voice in the pack is selected by default.
+ *
+ * @param path Path of the pack file, usually VOICEPACK_PATH.
+ * @param pack Pointer that receives the allocated pack handle.
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND when the file is missing,
+ *         ESP_ERR_INVALID_VERSION or ESP_ERR_INVALID_RESPONSE on a malformed pack.
+ */
+esp_err_t voicepack_open(const char *path, voicepack_t **pack);
+
+/**
+ * @brief Closes the pack file and releases its tables.
+ *
+ * @param pack Pack handle, may be NULL.
+ */
+void voicepack_close(voicepack_t *pack);
+
+/**
+ * @brief Selects the voice used by voicepack_find_clip().
+ *
+ * @param pack Pack handle.
+ * @param lang Language code of the voice, e.g. "nl".
+ * @return ESP_OK on success, ESP_ERR_NOT_FOUND when the pack has no such voice.
+ */
+esp_err_t voicepack_select_voice(voicepack_t *pack, const char *lang);
+
+/**
+ * @brief Looks up a clip of the selected voice.
+ *
+ * The clip table is sorted, so the lookup is a binary search without file access.
+ *
+ * @param pack Pack handle.
+ * @param clip_id Id of the clip, see voice_clip_id_t in playlist.h.
+ * @return Pointer to the clip entry, or NULL when the voice has no such clip.
+ */
+const voicepack_clip_t *voicepack_find_clip(const voicepack_t *pack, uint16_t clip_id);
+
+/**
+ * @brief Reads PCM data of a clip.
+ *
+ * @param pack Pack handle.
+ * @param clip Clip returned by voicepack_find_clip().
+ * @param offset Byte offset inside the clip payload.
+ * @param buf Destination buffer.
+ * @param len Maximum number of bytes to read.
+ * @return Number of bytes read, 0 at the end of the clip, or -1 on a read error.
+ */
+int voicepack_read(voicepack_t *pack, const voicepack_clip_t *clip, uint32_t offset, char *buf, int len);
+
+/**
+ * @brief Configuration of the voice pack reader element.
+ */
+typedef struct {
+    voicepack_t *pack;  /*!< Opened voice pack */
+    int out_rb_size;    /*!< Size of the output ring buffer */
+    int task_stack;     /*!< Task stack size */
+    int task_core;      /*!< Task running core */
+    int task_prio;      /*!< Task priority */
+    int buf_sz;         /*!< Read size, a multiple of VOICEPACK_SECTOR_SIZE */
+} voicepack_stream_cfg_t;
+
+#define VOICEPACK_STREAM_CFG_DEFAULT() {        \
+    .pack = NULL,                               \
+    .out_rb_size = 8 * 1024,                    \
+    .task_stack = 3072,                         \
+    .task_core = 0,                             \
+    .task_prio = 4,                             \
+    .buf_sz = 4 * VOICEPACK_SECTOR_SIZE,        \
+}
+
+/**
+ * @brief Creates an audio element that outputs a sequence of clips as PCM.
+ *
+ * The element reports the PCM format of the first clip as music info when it opens,
+ * so it can be linked straight into the resample filter.
+ *
+ * @param config Element configuration.
+ * @return Element handle, or NULL on failure.
+ */
+audio_element_handle_t voicepack_stream_init(voicepack_stream_cfg_t *config);
+
+/**
+ * @brief Sets the clips played by the element on its next run.
+ *
+ * @param el Element created by voicepack_stream_init().
+ * @param clip_ids Array of clip ids, copied by the element.
+ * @param count Number of clip ids.
+ * @return ESP_OK on success, ESP_ERR_INVALID_ARG when a clip is missing from the pack.
+ */
+esp_err_t voicepack_stream_set_clips(audio_element_handle_t el, const uint16_t *clip_ids, int count);
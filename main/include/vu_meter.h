@@ -0,0 +1,130 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "esp_err.h"
+#include "sdkconfig.h"
+#include "audio_element.h"
+
+/**
+ * @brief Level and spectrum analysis of the audio sent to the codec.
+ *
+ * The analyzer taps the PCM written by the last element of the running chain through
+ * an ADF multi output ring buffer. The element writes to it with a zero timeout, so a
+ * full tap drops data instead of delaying the I2S writer. The analysis task runs at its
+ * own frame rate: it empties the tap, waits for one FFT window of fresh audio and
+ * computes peak and RMS per channel and a spectrum with a 256 point Q15 FFT summed
+ * into logarithmically spaced bands. The result is published as a small vu_frame_t the
+ * LCD task reads whenever it draws.
+ *
+ * Only one window per frame is copied out of the writer, about 1 KB every 40 ms at
+ * 48 kHz stereo.
+ *
+ * The analysis only feeds the LCD. Without CONFIG_SPEAKER_UI_LCD the calls of the modes
+ * remain as empty inline functions.
+ */
+
+/* FFT length in samples */
+#define VU_METER_FFT_SIZE 256
+
+/* Maximum number of spectrum bands */
+#define VU_METER_BANDS 16
+
+/* Lowest level reported, in dBFS */
+#define VU_METER_FLOOR_DB (-96)
+
+/**
+ * @brief Configuration of the analyzer.
+ */
+typedef struct {
+    int bands;                  /*!< Spectrum bands, 8 to VU_METER_BANDS */
+    int frame_ms;               /*!< Analysis period */
+    int task_stack;             /*!< Task stack size */
+    int task_core;              /*!< Task running core */
+    int task_prio;              /*!< Task priority, below the audio elements */
+} vu_meter_cfg_t;
+
+#define VU_METER_CFG_DEFAULT() {    \
+    .bands = VU_METER_BANDS,        \
+    .frame_ms = 40,                 \
+    .task_stack = 3072,             \
+    .task_core = 0,                 \
+    .task_prio = 2,                 \
+}
+
+/**
+ * @brief One analysis result.
+ */
+typedef struct {
+    uint32_t seq;                       /*!< Incremented for every published frame */
+    bool active;                        /*!< Audio arrived during the last period */
+    uint8_t bands;                      /*!< Number of valid entries in band_db */
+    int8_t peak_db[2];                  /*!< Peak level of the left and right channel in dBFS */
+    int8_t rms_db[2];                   /*!< RMS level of the left and right channel in dBFS */
+    int8_t band_db[VU_METER_BANDS];     /*!< Spectrum from low to high in dBFS */
+} vu_frame_t;
+
+#if CONFIG_SPEAKER_UI_LCD
+
+/**
+ * @brief Creates the tap ring buffer and starts the analysis task.
+ *
+ * @param config Analyzer configuration.
+ * @return ESP_OK on success.
+ */
+esp_err_t vu_meter_init(const vu_meter_cfg_t *config);
+
+/**
+ * @brief Connects the tap to an element.
+ *
+ * The element must be created with one multi output ring buffer and write its output
+ * to it with audio_element_multi_output(), as i2s_stream does. Only one of the
+ * attached elements may run at a time.
+ *
+ * @param el Element writing to the codec.
+ * @return ESP_OK on success.
+ */
+esp_err_t vu_meter_attach(audio_element_handle_t el);
+
+/**
+ * @brief Sets the format of the tapped audio, always 16-bit.
+ *
+ * @param rate Sample rate in Hz.
+ * @param channels 1 or 2.
+ */
+void vu_meter_set_format(int rate, int channels);
+
+/**
+ * @brief Reads the latest frame without waiting.
+ *
+ * @param frame Receives the frame.
+ * @return true when a frame was available.
+ */
+bool vu_meter_get_frame(vu_frame_t *frame);
+
+/**
+ * @brief Sets a function the analysis task calls when audio starts or stops arriving.
+ *
+ * Lets the LCD draw the spectrum only while there is one. The function must not block.
+ *
+ * @param listener Called with the new vu_frame_t::active, NULL for none.
+ */
+void vu_meter_set_listener(void (*listener)(bool active));
+
+#else
+
+static inline esp_err_t vu_meter_init(const vu_meter_cfg_t *config)
+{
+    return ESP_OK;
+}
+
+static inline esp_err_t vu_meter_attach(audio_element_handle_t el)
+{
+    return ESP_OK;
+}
+
+static inline void vu_meter_set_format(int rate, int channels)
+{
+}
+
+#endif
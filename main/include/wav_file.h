@@ -0,0 +1,120 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/**
+ * @brief RIFF/WAVE header parser and seek offsets.
+ *
+ * Shared by the fused player, the WAV stream decoder and the seek of the SD card
+ * player, all need the format and the position of the data chunk to turn a time into
+ * a file offset. wav_file_parse() reads the header from a file, wav_parser_feed()
+ * takes it in pieces as they come out of a stream.
+ *
+ * WAVE_FORMAT_EXTENSIBLE headers are resolved to the format tag of their sub format,
+ * so the rest of the firmware only sees WAV_FORMAT_PCM and WAV_FORMAT_IEEE_FLOAT.
+ */
+
+/* Format tag of integer PCM */
+#define WAV_FORMAT_PCM 1
+
+/* Format tag of IEEE float samples */
+#define WAV_FORMAT_IEEE_FLOAT 3
+
+/* Format tag of a header with a sub format GUID and the valid bits */
+#define WAV_FORMAT_EXTENSIBLE 0xFFFE
+
+/* Bytes of the fmt chunk that are parsed, the rest is skipped */
+#define WAV_FMT_MAX 40
+
+/**
+ * @brief Format and data chunk of a WAV file.
+ */
+typedef struct {
+    int format;             /*!< Format tag, the sub format of an extensible header */
+    int channels;           /*!< Number of channels */
+    int sample_rate;        /*!< Sample rate in Hz */
+    int bits;               /*!< Bits per sample in the file, the container size */
+    int valid_bits;         /*!< Bits of each sample that are used, at most bits */
+    int block_align;        /*!< Bytes per frame, all channels */
+    uint32_t data_offset;   /*!< File offset of the first sample */
+    uint32_t data_size;     /*!< Size of the data chunk, whole frames, UINT32_MAX when unknown */
+} wav_file_info_t;
+
+/**
+ * @brief State of the streaming header parser.
+ */
+typedef struct {
+    int state;                  /*!< Part of the header being read */
+    uint8_t buf[WAV_FMT_MAX];   /*!< Bytes of the part being read */
+    uint32_t have;              /*!< Bytes in buf */
+    uint32_t need;              /*!< Bytes of the part that go into buf */
+    uint32_t skip;              /*!< Bytes of the current chunk still to skip */
+    uint32_t offset;            /*!< Bytes taken so far */
+    bool have_fmt;              /*!< The fmt chunk was parsed */
+    wav_file_info_t info;       /*!< Result */
+} wav_parser_t;
+
+/**
+ * @brief Results of wav_parser_feed().
+ */
+typedef enum {
+    WAV_PARSER_ERROR = -1,      /*!< Not a WAV stream or a malformed header */
+    WAV_PARSER_MORE = 0,        /*!< All bytes taken, the header goes on */
+    WAV_PARSER_DATA = 1,        /*!< The data chunk starts, info is valid */
+} wav_parser_result_t;
+
+/**
+ * @brief Parses the RIFF/WAVE header and leaves the file at the start of the data chunk.
+ *
+ * Chunks before the data chunk are skipped. A data size beyond the end of the file, as
+ * written by recorders that were cut off, is truncated to the file size.
+ *
+ * @param file Open file, positioned at the start.
+ * @param info Receives the format and the data chunk.
+ * @return ESP_OK on success, ESP_FAIL on a malformed file.
+ */
+esp_err_t wav_file_parse(FILE *file, wav_file_info_t *info);
+
+/**
+ * @brief Resets the streaming parser to the start of a RIFF/WAVE header.
+ */
+void wav_parser_init(wav_parser_t *parser);
+
+/**
+ * @brief Feeds the next bytes of a stream to the parser.
+ *
+ * Chunks before the data chunk are skipped by counting, whatever their size, only
+ * WAV_FMT_MAX bytes of the fmt chunk are kept. The data size is the one in the header,
+ * the stream decides where it really ends.
+ *
+ * @param parser Parser.
+ * @param data Next bytes of the stream.
+ * @param len Number of bytes.
+ * @param used Receives the number of bytes taken, the rest are samples on WAV_PARSER_DATA.
+ * @return WAV_PARSER_DATA when the data chunk starts, WAV_PARSER_MORE when all bytes were
+ * taken, WAV_PARSER_ERROR on a malformed header.
+ */
+wav_parser_result_t wav_parser_feed(wav_parser_t *parser, const uint8_t *data, int len, int *used);
+
+/**
+ * @brief Converts a time to an offset into the data chunk.
+ *
+ * The offset is rounded down to a frame boundary and clamped to the data chunk, so
+ * reading from there starts on the first sample of the left channel.
+ *
+ * @param info Parsed header.
+ * @param position_ms Time from the start of the data.
+ * @return Offset in bytes from data_offset.
+ */
+uint32_t wav_file_offset(const wav_file_info_t *info, int64_t position_ms);
+
+/**
+ * @brief Returns the length of the data chunk.
+ *
+ * @param info Parsed header.
+ * @return Length in milliseconds.
+ */
+int64_t wav_file_duration_ms(const wav_file_info_t *info);
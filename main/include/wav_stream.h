@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include "audio_element.h"
+#include "wav_file.h"
+
+/**
+ * @brief WAV decoder element for the SD card chain.
+ *
+ * Takes the place of the ESP-ADF wav_decoder between the fatfs stream and the
+ * resampler. The header is parsed as it streams in with wav_parser_feed(), so chunks
+ * of any size before the data chunk are skipped without being buffered, and the
+ * samples are converted to 16-bit with pcm_convert_to_s16(). It plays what
+ * pcm_format_of() accepts: 8, 16, 24 and 32-bit integer and 32-bit float, plain or
+ * WAVE_FORMAT_EXTENSIBLE, mono or stereo. The music info it reports is always 16-bit.
+ *
+ * The element stops at the end of the data chunk, chunks after it are not read.
+ */
+
+/**
+ * @brief Configuration of the WAV decoder element.
+ */
+typedef struct {
+    int out_rb_size;        /*!< Size of the output ring buffer */
+    int task_stack;         /*!< Task stack size */
+    int task_core;          /*!< Task running core */
+    int task_prio;          /*!< Task priority */
+    int buf_sz;             /*!< Bytes read from the stream per iteration */
+} wav_stream_cfg_t;
+
+#define WAV_STREAM_CFG_DEFAULT() {          \
+    .out_rb_size = 8 * 1024,                \
+    .task_stack = 4 * 1024,                 \
+    .task_core = 0,                         \
+    .task_prio = 5,                         \
+    .buf_sz = 2048,                         \
+}
+
+/**
+ * @brief Creates the WAV decoder element.
+ *
+ * @param config Element configuration.
+ * @return Element handle, or NULL on failure.
+ */
+audio_element_handle_t wav_stream_init(wav_stream_cfg_t *config);
+
+/**
+ * @brief Makes the next run start inside the data chunk, for a seek.
+ *
+ * The stream must deliver the samples from offset on, fatfs_stream does after
+ * audio_element_set_byte_pos() with info->data_offset + offset. The header is not
+ * parsed, the format is taken from info.
+ *
+ * @param el WAV decoder element.
+ * @param info Header of the file, from wav_file_parse().
+ * @param offset Offset into the data chunk, on a frame boundary.
+ */
+void wav_stream_start_at(audio_element_handle_t el, const wav_file_info_t *info, uint32_t offset);
+
+/**
+ * @brief Returns the header of the stream that plays.
+ *
+ * Valid after the element reported its music info.
+ *
+ * @param el WAV decoder element.
+ * @param info Receives the format and the data chunk, data_size is UINT32_MAX when the
+ * header left it open.
+ */
+void wav_stream_get_format(audio_element_handle_t el, wav_file_info_t *info);
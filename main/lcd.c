@@ -1,5 +1,17 @@
 #include "lcd.h"
 #include "string.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "input_key_service.h"
+#include "lcd_menu.h"
+#include "alarm_clock.h"
+#include "eq.h"
+#if CONFIG_SPEAKER_MODE_RADIO
+#include "radio.h"
+#endif
+#if CONFIG_SPEAKER_GROUP
+#include "group.h"
+#endif
 
 /**
  * @brief Static variable for PCF8574 I2C GPIO expander configuration.
@@ -9,25 +21,6 @@
  */
 static i2c_dev_t pcf8574;
 
-/**
- * @brief Bitmaps for LCD display icons, each icon consists of 8 rows to match LCD segment rows.
- *
- * - tuner: Icon for tuner.
- * - internet_radio: Icon for internet radio.
- * - sampler: Icon for sampler.
- * - menu_pages: Icon for page structure for the menu.
- * - current_page: Icon for page structure that shows the current selected page.
- * - arrow: Arrow icon to show the current option in the menu.
- * - empty: Icon to help clear on certain areas.
- */
-const uint8_t tuner[] = {0b00000, 0b00100, 0b01110, 0b10101, 0b10101, 0b10101, 0b11111, 0b11111};
-const uint8_t internet_radio[] = {0b00000, 0b00110, 0b01001, 0b10001, 0b10101, 0b10001, 0b01001, 0b00110};
-const uint8_t sampler[] = {0b00000, 0b01000, 0b11000, 0b01000, 0b01110, 0b01111, 0b01110, 0b01100};
-const uint8_t menu_pages[] = {0b11111, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b11111};
-const uint8_t current_page[] = {0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111};
-const uint8_t arrow[] = {0b00000, 0b00100, 0b00010, 0b11111, 0b11111, 0b00010, 0b00100, 0b00000};
-const uint8_t empty[] = {0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000};
-
 /**
  * @brief Writes data to the LCD using the PCF8574 I2C GPIO expander.
  *
@@ -46,7 +39,7 @@ static esp_err_t write_lcd_data(const hd44780_t *lcd, uint8_t data)
 hd44780_t lcd;
 
 /**
- * @brief Initializes the LCD display and uploads custom icons.
+ * @brief Initializes the LCD display and the glyph cache for custom icons.
  */
 void lcd_init()
 {
@@ -70,43 +63,443 @@ void lcd_init()
     ESP_ERROR_CHECK(hd44780_init(&lcd));
     hd44780_switch_backlight(&lcd, true);
 
-    // Upload custom icons to LCD
-    hd44780_upload_character(&lcd, 0, internet_radio);
-    hd44780_upload_character(&lcd, 1, sampler);
-    hd44780_upload_character(&lcd, 2, tuner);
-    hd44780_upload_character(&lcd, 3, menu_pages);
-    hd44780_upload_character(&lcd, 4, arrow);
-    hd44780_upload_character(&lcd, 5, empty);
-    hd44780_upload_character(&lcd, 6, current_page);
+    // Custom icons are uploaded by the glyph cache when a frame needs them
+    lcd_glyphs_init(&lcd, LCD_GLYPHS_DEFAULT_BUDGET);
 }
 
 /**
- * @brief Initializes and displays a simple menu on the LCD.
+ * @brief Converts a level in dBFS to a bar height of 0 to 8 over the top 48 dB.
  *
- * @param pvParameters Pointer to task parameters (not used).
+ * Only even heights are used, so a full spectrum needs at most three CGRAM slots
+ * and the menu icons stay loaded.
  */
-void menu(void *pvParameters)
+static int level_to_height(int db)
 {
-    lcd_init();
+    int height = (db + 48) / 6;
+    height = height < 0 ? 0 : (height > 8 ? 8 : height);
+    return height & ~1;
+}
+
+/**
+ * @brief Draws the spectrum bands followed by the left and right RMS level on a line.
+ *
+ * @param frame Frame to draw in.
+ * @param y Line to draw on.
+ * @param vu Analysis result to show.
+ */
+static void draw_spectrum(lcd_frame_t *frame, int y, const vu_frame_t *vu)
+{
+    lcd_frame_puts(frame, 0, y, "                    ");
+    for (int b = 0; b < vu->bands && b < LCD_COLS - 4; b++)
+    {
+        lcd_frame_vbar(frame, b, y, level_to_height(vu->band_db[b]));
+    }
+    lcd_frame_vbar(frame, LCD_COLS - 3, y, level_to_height(vu->rms_db[0]));
+    lcd_frame_vbar(frame, LCD_COLS - 2, y, level_to_height(vu->rms_db[1]));
+}
+
+/**
+ * @brief Formats a time as m:ss, minutes keep counting past the hour.
+ */
+static int format_time(char *buf, int size, int64_t ms)
+{
+    int64_t s = ms / 1000;
+    return snprintf(buf, size, "%d:%02d", (int)(s / 60), (int)(s % 60));
+}
+
+/**
+ * @brief Draws a menu line, with the elapsed and remaining time of the playback clock when it runs.
+ *
+ * The time is computed from the audio clocked out for every frame, so it never drifts from
+ * what is heard and changes exactly when a second of audio has played.
+ *
+ * @param frame Frame to draw in.
+ * @param y Line to draw on.
+ * @param label Label shown while nothing plays.
+ * @param short_label Label shown next to the time.
+ * @param pos Playback position, NULL when this line is not the active mode.
+ */
+static void draw_mode_line(lcd_frame_t *frame, int y, const char *label, const char *short_label,
+                           const playback_position_t *pos)
+{
+    char line[LCD_COLS];
+    if (pos == NULL || !pos->running)
+    {
+        snprintf(line, sizeof(line), " %-17s", label);
+    }
+    else
+    {
+        char time[16];
+        int n = format_time(time, sizeof(time), pos->position_ms);
+        if (pos->remaining_ms >= 0)
+        {
+            snprintf(time + n, sizeof(time) - n, " -");
+            format_time(time + n + 2, sizeof(time) - n - 2, pos->remaining_ms);
+        }
+        // The label gives way to the time on the 18 columns right of the icon
+        int width = LCD_COLS - 2 - (int)strlen(time);
+        snprintf(line, sizeof(line), " %-*.*s%s", width - 1, width - 2, short_label, time);
+    }
+    lcd_frame_puts(frame, 2, y, line);
+}
+
+/**
+ * @brief Message to the menu task, a navigation event or only a reason to redraw.
+ */
+typedef struct
+{
+    bool navigate;
+    lcd_menu_event_t event;
+} menu_msg_t;
+
+static QueueHandle_t menu_queue = NULL;
 
-    // Page bar creating at the top
-    for (int i = 0; i < 20; i++)
+// Set by the key service on a long press of Mode, cleared by the menu task when the menu closes
+static volatile bool menu_open = false;
+
+// Playback position of the frame being drawn
+static playback_position_t frame_pos;
+
+static const char *mode_labels[PLAYER_MODE_COUNT][2] = {
+#if CONFIG_SPEAKER_MODE_RADIO
+    [PLAYER_MODE_RADIO] = {"Internet Radio", "Radio"},
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    [PLAYER_MODE_SDCARD] = {"Sampler", "Sampler"},
+#endif
+    [PLAYER_MODE_TUNER] = {"Tuner", "Tuner"},
+#if CONFIG_SPEAKER_GROUP
+    [PLAYER_MODE_GROUP] = {"Group", "Group"},
+#endif
+};
+
+static void select_mode(int mode)
+{
+    mode_manager_switch((player_mode_t)mode);
+}
+
+// The line of the active mode follows its playback clock
+static void draw_mode_item(lcd_frame_t *frame, int y, const lcd_menu_item_t *item)
+{
+    int m = item->arg;
+    draw_mode_line(frame, y, mode_labels[m][0], mode_labels[m][1], m == mode_manager_get_mode() ? &frame_pos : NULL);
+}
+
+static const lcd_menu_item_t mode_items[PLAYER_MODE_COUNT] = {
+#if CONFIG_SPEAKER_MODE_RADIO
+    [PLAYER_MODE_RADIO] = {"Internet Radio", GLYPH_INTERNET_RADIO, NULL, select_mode, NULL, PLAYER_MODE_RADIO},
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    [PLAYER_MODE_SDCARD] = {"Sampler", GLYPH_SAMPLER, NULL, select_mode, NULL, PLAYER_MODE_SDCARD},
+#endif
+    [PLAYER_MODE_TUNER] = {"Tuner", GLYPH_TUNER, NULL, select_mode, NULL, PLAYER_MODE_TUNER},
+#if CONFIG_SPEAKER_GROUP
+    [PLAYER_MODE_GROUP] = {"Group", GLYPH_GROUP, NULL, select_mode, NULL, PLAYER_MODE_GROUP},
+#endif
+};
+
+static const lcd_menu_page_t mode_page = {"Modes", mode_items, PLAYER_MODE_COUNT, draw_mode_item};
+
+#if CONFIG_SPEAKER_MODE_RADIO
+static char station_labels[LCD_MENU_STATIONS_MAX][17];
+static lcd_menu_item_t station_items[LCD_MENU_STATIONS_MAX];
+static lcd_menu_page_t station_page = {"Stations", station_items, 0, NULL};
+
+// Selecting a station from another mode switches to the radio
+static void select_station(int index)
+{
+    mode_manager_lock();
+    radio_select_station(index);
+    mode_manager_unlock();
+    mode_manager_switch(PLAYER_MODE_RADIO);
+}
+
+static bool is_station(int index)
+{
+    return radio_get_station() == index;
+}
+
+/**
+ * @brief Fills the station page, each station labeled with the host of its URL.
+ *
+ * The radio loads its stations after the menu task started, so this runs when the menu opens.
+ */
+static void load_stations(void)
+{
+    int count = radio_get_station_count();
+    count = count < LCD_MENU_STATIONS_MAX ? count : LCD_MENU_STATIONS_MAX;
+    for (int i = 0; i < count; i++)
     {
-        write_char_on_pos(i, 0, 3);
+        const char *url = radio_get_station_url(i);
+        const char *host = strstr(url, "://");
+        host = host ? host + 3 : url;
+        int n = strcspn(host, ":/");
+        snprintf(station_labels[i], sizeof(station_labels[i]), "%.*s", n, host);
+        station_items[i] = (lcd_menu_item_t){station_labels[i], GLYPH_EMPTY, NULL, select_station, is_station, i};
     }
+    station_page.item_count = count;
+}
+#endif
+
+#if CONFIG_SPEAKER_EQUALIZER
+static void select_preset(int preset)
+{
+    eq_apply(eq_get_builtin((eq_builtin_t)preset), true);
+}
+
+static bool is_preset(int preset)
+{
+    eq_preset_t active;
+    eq_get_active(&active);
+    return strcmp(active.name, eq_get_builtin((eq_builtin_t)preset)->name) == 0;
+}
+
+static const lcd_menu_item_t eq_items[] = {
+    {"Flat", GLYPH_EMPTY, NULL, select_preset, is_preset, EQ_PRESET_FLAT},
+    {"LyraT speaker", GLYPH_EMPTY, NULL, select_preset, is_preset, EQ_PRESET_LYRAT_SPEAKER},
+    {"Voice", GLYPH_EMPTY, NULL, select_preset, is_preset, EQ_PRESET_VOICE},
+};
 
-    // Writing the lines
-    write_and_upload_char(1, 1, 0, " Internet Radio");
-    write_and_upload_char(1, 2, 1, " Sampler");
-    write_and_upload_char(1, 3, 2, " Tuner");
+static const lcd_menu_page_t eq_page = {"Equalizer", eq_items, sizeof(eq_items) / sizeof(eq_items[0]), NULL};
+#endif
+
+// Minutes of the sleep timer set here, 0 when off
+static int sleep_minutes = 0;
+
+static void set_sleep_timer(int minutes)
+{
+    if (minutes > 0)
+    {
+        alarm_clock_start_sleep_timer(minutes);
+    }
+    else
+    {
+        alarm_clock_cancel_sleep_timer();
+    }
+    sleep_minutes = minutes;
+}
+
+static bool is_sleep_timer(int minutes)
+{
+    return sleep_minutes == minutes;
+}
+
+static const lcd_menu_item_t sleep_items[] = {
+    {"Off", GLYPH_EMPTY, NULL, set_sleep_timer, is_sleep_timer, 0},
+    {"15 minutes", GLYPH_EMPTY, NULL, set_sleep_timer, is_sleep_timer, 15},
+    {"30 minutes", GLYPH_EMPTY, NULL, set_sleep_timer, is_sleep_timer, 30},
+    {"60 minutes", GLYPH_EMPTY, NULL, set_sleep_timer, is_sleep_timer, 60},
+    {"90 minutes", GLYPH_EMPTY, NULL, set_sleep_timer, is_sleep_timer, 90},
+};
+
+static const lcd_menu_page_t sleep_page = {"Sleep timer", sleep_items, sizeof(sleep_items) / sizeof(sleep_items[0]), NULL};
+
+#if CONFIG_SPEAKER_GROUP && CONFIG_SPEAKER_MODE_RADIO
+// The radio picks the role up when its chain starts
+static void toggle_leader(int arg)
+{
+    mode_manager_lock();
+    group_set_leader(!group_is_leader());
+    if (mode_manager_get_mode() == PLAYER_MODE_RADIO)
+    {
+        radio_select_station(radio_get_station());
+    }
+    mode_manager_unlock();
+}
+
+static bool is_leader(int arg)
+{
+    return group_is_leader();
+}
+#endif
+
+static const lcd_menu_item_t settings_items[] = {
+#if CONFIG_SPEAKER_EQUALIZER
+    {"Equalizer", GLYPH_EMPTY, &eq_page, NULL, NULL, 0},
+#endif
+    {"Sleep timer", GLYPH_EMPTY, &sleep_page, NULL, NULL, 0},
+#if CONFIG_SPEAKER_GROUP && CONFIG_SPEAKER_MODE_RADIO
+    {"Group leader", GLYPH_EMPTY, NULL, toggle_leader, is_leader, 0},
+#endif
+};
+
+static const lcd_menu_page_t settings_page = {"Settings", settings_items,
+                                              sizeof(settings_items) / sizeof(settings_items[0]), NULL};
+
+// Top level pages, in page bar order
+static const lcd_menu_page_t *const pages[] = {
+    &mode_page,
+#if CONFIG_SPEAKER_MODE_RADIO
+    &station_page,
+#endif
+    &settings_page,
+};
+
+// Queue a redraw, or a navigation event, without waiting
+static void post(bool navigate, lcd_menu_event_t event)
+{
+    menu_msg_t msg = {navigate, event};
+    if (menu_queue)
+    {
+        xQueueSend(menu_queue, &msg, 0);
+    }
+}
+
+static void on_audio_activity(bool active)
+{
+    post(false, LCD_MENU_UP);
+}
+
+/**
+ * @brief Asks the menu task to redraw, for changes the menu cannot see by itself.
+ */
+void menu_refresh(void)
+{
+    post(false, LCD_MENU_UP);
+}
+
+/**
+ * @brief Takes a key action for the menu while it is open.
+ */
+bool menu_handle_key(int key_id, int action)
+{
+    if (menu_queue == NULL)
+    {
+        return false;
+    }
+    if (key_id == INPUT_KEY_USER_ID_MODE && action == INPUT_KEY_SERVICE_ACTION_PRESS)
+    {
+        menu_open = !menu_open;
+        post(false, LCD_MENU_UP);
+        return true;
+    }
+    if (!menu_open)
+    {
+        return false;
+    }
+    // While the menu is open every key is its own, they act on release
+    if (action == INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE)
+    {
+        switch (key_id)
+        {
+        case INPUT_KEY_USER_ID_VOLUP:
+            post(true, LCD_MENU_UP);
+            break;
+        case INPUT_KEY_USER_ID_VOLDOWN:
+            post(true, LCD_MENU_DOWN);
+            break;
+        case INPUT_KEY_USER_ID_REC:
+            post(true, LCD_MENU_PREV_PAGE);
+            break;
+        case INPUT_KEY_USER_ID_MODE:
+            post(true, LCD_MENU_NEXT_PAGE);
+            break;
+        case INPUT_KEY_USER_ID_PLAY:
+            post(true, LCD_MENU_ENTER);
+            break;
+        case INPUT_KEY_USER_ID_SET:
+            post(true, LCD_MENU_BACK);
+            break;
+        }
+    }
+    return true;
+}
+
+// Ticks until a time of esp_timer, at least one
+static TickType_t ticks_until(int64_t now, int64_t at)
+{
+    int64_t ms = (at - now + 999) / 1000;
+    return ms < 1 ? 1 : pdMS_TO_TICKS(ms) + 1;
+}
+
+/**
+ * @brief Draws the menu whenever something on it changes and sleeps otherwise.
+ *
+ * @param pvParameters Pointer to task parameters (not used).
+ */
+void menu(void *pvParameters)
+{
+    lcd_init();
+    menu_queue = xQueueCreate(LCD_MENU_QUEUE_LEN, sizeof(menu_msg_t));
+    vu_meter_set_listener(on_audio_activity);
+
+    lcd_menu_t nav;
+    lcd_menu_init(&nav, pages, sizeof(pages) / sizeof(pages[0]));
+    lcd_frame_t frame;
+    lcd_frame_clear(&frame);
+    bool shown_open = false;
+    int64_t last_input_us = 0;
 
-    // Arrow blinking
     while (1)
     {
-        write_char_on_pos(0, 1, 4);
-        vTaskDelay(pdMS_TO_TICKS(1000));
-        write_char_on_pos(0, 1, 5);
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        int64_t now = esp_timer_get_time();
+        if (menu_open && now - last_input_us >= LCD_MENU_TIMEOUT_MS * 1000LL && shown_open)
+        {
+            menu_open = false;
+        }
+        bool open = menu_open;
+        if (open && !shown_open)
+        {
+#if CONFIG_SPEAKER_MODE_RADIO
+            load_stations();
+#endif
+            last_input_us = now;
+        }
+        shown_open = open;
+        // Closed, the menu shows the modes with the arrow at the active one
+        if (!open)
+        {
+            lcd_menu_home(&nav, mode_manager_get_mode());
+        }
+
+        // Spectrum in the top line while audio plays and the menu is closed
+        vu_frame_t vu;
+        bool spectrum = !open && vu_meter_get_frame(&vu) && vu.active;
+        if (spectrum)
+        {
+            draw_spectrum(&frame, 0, &vu);
+        }
+        else
+        {
+            lcd_menu_draw_page_bar(&nav, &frame, 0);
+        }
+        playback_clock_get(&frame_pos);
+        lcd_menu_draw_items(&nav, &frame, true);
+        lcd_glyphs_render(&frame);
+
+        // Sleep until the next thing on screen changes by itself, or an event comes
+        TickType_t wait = portMAX_DELAY;
+        if (spectrum || !lcd_glyphs_complete())
+        {
+            // Glyph uploads the budget deferred follow in the next frame
+            wait = pdMS_TO_TICKS(1000 / LCD_FRAME_RATE);
+        }
+        else if (lcd_menu_is_home(&nav) && frame_pos.running)
+        {
+            // The shown seconds of the position and the remaining time tick over
+            int64_t ms = 1000 - frame_pos.position_ms % 1000;
+            if (frame_pos.remaining_ms >= 0 && frame_pos.remaining_ms % 1000 + 1 < ms)
+            {
+                ms = frame_pos.remaining_ms % 1000 + 1;
+            }
+            wait = pdMS_TO_TICKS(ms) + 1;
+        }
+        if (open)
+        {
+            TickType_t close = ticks_until(now, last_input_us + LCD_MENU_TIMEOUT_MS * 1000LL);
+            wait = close < wait ? close : wait;
+        }
+
+        menu_msg_t msg;
+        if (xQueueReceive(menu_queue, &msg, wait) == pdTRUE && msg.navigate && menu_open && shown_open)
+        {
+            last_input_us = esp_timer_get_time();
+            // Back on a top level page closes the menu
+            if (!lcd_menu_handle(&nav, msg.event) && msg.event == LCD_MENU_BACK)
+            {
+                menu_open = false;
+            }
+        }
     }
 }
 
@@ -121,6 +514,7 @@ void write_string_on_pos(int x, int y, const char *string)
 {
     hd44780_gotoxy(&lcd, x, y); // Move cursor to the specified coordinates
     hd44780_puts(&lcd, string); // Output the specified string
+    lcd_glyphs_invalidate_cells(x, y, strlen(string));
 }
 
 /**
@@ -134,6 +528,7 @@ void write_char_on_pos(int x, int y, char c)
 {
     hd44780_gotoxy(&lcd, x, y); // Move cursor to the specified coordinates
     hd44780_putc(&lcd, c);      // Output the specified character
+    lcd_glyphs_invalidate_cells(x, y, 1);
 }
 
 /**
@@ -149,6 +544,7 @@ void write_and_upload_char(int x, int y, char c, const char *string)
     hd44780_gotoxy(&lcd, x, y); // Move cursor to the specified coordinates
     hd44780_putc(&lcd, c);      // Output the specified string
     hd44780_puts(&lcd, string); // Output the specified character
+    lcd_glyphs_invalidate_cells(x, y, 1 + strlen(string));
 }
 
 /**
@@ -160,7 +556,8 @@ void write_and_upload_char(int x, int y, char c, const char *string)
 void clear_at_position(int x, int y)
 {
     hd44780_gotoxy(&lcd, x, y); // Move cursor to the specified coordinates
-    hd44780_putc(&lcd, 5);      // Output the specified string
+    hd44780_putc(&lcd, ' ');    // Output the specified string
+    lcd_glyphs_invalidate_cells(x, y, 1);
 }
 
 /**
@@ -0,0 +1,481 @@
+#include <string.h>
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "lcd_glyphs.h"
+
+static const char *TAG = "LCD_GLYPHS";
+
+#define SLOT_COUNT 8
+#define SLOT_FREE 0xFF
+#define SHADOW_UNKNOWN 0xFFFF
+
+/* Set CGRAM address, 8 rows and the cursor reset done by hd44780_upload_character() */
+#define UPLOAD_I2C_BYTES ((1 + 8 + 1) * LCD_GLYPHS_I2C_PER_LCD_BYTE)
+
+/* Interval of the upload rate log */
+#define STATS_INTERVAL_US (10 * 1000 * 1000)
+
+/**
+ * @brief Glyph of the library.
+ *
+ * - bitmap: 8 rows of 5 pixels.
+ * - rom: Character ROM code with the same bitmap, 0 when the glyph needs a CGRAM slot.
+ * - fallback: Character shown while the glyph does not fit in CGRAM.
+ */
+typedef struct
+{
+    uint8_t bitmap[8];
+    uint8_t rom;
+    char fallback;
+} lcd_glyph_t;
+
+static const lcd_glyph_t library[GLYPH_COUNT] = {
+    [GLYPH_INTERNET_RADIO] = {{0b00000, 0b00110, 0b01001, 0b10001, 0b10101, 0b10001, 0b01001, 0b00110}, 0, 'R'},
+    [GLYPH_SAMPLER] = {{0b00000, 0b01000, 0b11000, 0b01000, 0b01110, 0b01111, 0b01110, 0b01100}, 0, 'S'},
+    [GLYPH_TUNER] = {{0b00000, 0b00100, 0b01110, 0b10101, 0b10101, 0b10101, 0b11111, 0b11111}, 0, 'T'},
+    [GLYPH_GROUP] = {{0b00000, 0b11011, 0b11011, 0b00000, 0b11011, 0b11011, 0b11011, 0b00000}, 0, 'G'},
+    [GLYPH_MENU_PAGE] = {{0b11111, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b10001, 0b11111}, 0, 'o'},
+    [GLYPH_CURRENT_PAGE] = {{0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111}, 0xFF, '#'},
+    [GLYPH_ARROW] = {{0b00000, 0b00100, 0b00010, 0b11111, 0b11111, 0b00010, 0b00100, 0b00000}, 0, '>'},
+    [GLYPH_EMPTY] = {{0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000}, ' ', ' '},
+    [GLYPH_HBAR_1] = {{0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000}, 0, ' '},
+    [GLYPH_HBAR_2] = {{0b11000, 0b11000, 0b11000, 0b11000, 0b11000, 0b11000, 0b11000, 0b11000}, 0, ' '},
+    [GLYPH_HBAR_3] = {{0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100, 0b11100}, 0, 0xFF},
+    [GLYPH_HBAR_4] = {{0b11110, 0b11110, 0b11110, 0b11110, 0b11110, 0b11110, 0b11110, 0b11110}, 0, 0xFF},
+    [GLYPH_VBAR_1] = {{0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b11111}, 0, '_'},
+    [GLYPH_VBAR_2] = {{0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b11111, 0b11111}, 0, '_'},
+    [GLYPH_VBAR_3] = {{0b00000, 0b00000, 0b00000, 0b00000, 0b00000, 0b11111, 0b11111, 0b11111}, 0, '_'},
+    [GLYPH_VBAR_4] = {{0b00000, 0b00000, 0b00000, 0b00000, 0b11111, 0b11111, 0b11111, 0b11111}, 0, '='},
+    [GLYPH_VBAR_5] = {{0b00000, 0b00000, 0b00000, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111}, 0, '='},
+    [GLYPH_VBAR_6] = {{0b00000, 0b00000, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111}, 0, 0xFF},
+    [GLYPH_VBAR_7] = {{0b00000, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111, 0b11111}, 0, 0xFF},
+    [GLYPH_NEEDLE_0] = {{0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000, 0b10000}, 0, '|'},
+    [GLYPH_NEEDLE_1] = {{0b01000, 0b01000, 0b01000, 0b01000, 0b01000, 0b01000, 0b01000, 0b01000}, 0, '|'},
+    [GLYPH_NEEDLE_2] = {{0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100, 0b00100}, 0, '|'},
+    [GLYPH_NEEDLE_3] = {{0b00010, 0b00010, 0b00010, 0b00010, 0b00010, 0b00010, 0b00010, 0b00010}, 0, '|'},
+    [GLYPH_NEEDLE_4] = {{0b00001, 0b00001, 0b00001, 0b00001, 0b00001, 0b00001, 0b00001, 0b00001}, 0, '|'},
+};
+
+static hd44780_t *glyph_lcd = NULL;
+static int frame_budget = 0;
+
+// Lowest glyph id with the same bitmap, glyphs with the same canonical id share a slot
+static uint8_t canonical[GLYPH_COUNT];
+
+// Glyph held by each CGRAM slot and the frame that last showed it
+static uint8_t slot_glyph[SLOT_COUNT];
+static uint32_t slot_used[SLOT_COUNT];
+
+// Byte currently shown in each cell
+static uint16_t shadow[LCD_ROWS][LCD_COLS];
+
+static lcd_glyphs_stats_t stats;
+
+// Cells of the last frame drawn with a fallback character
+static int frame_fallbacks = 0;
+static int64_t window_start_us;
+static uint32_t window_uploads;
+
+/**
+ * @brief Initializes the glyph cache.
+ */
+void lcd_glyphs_init(hd44780_t *lcd, int budget)
+{
+    glyph_lcd = lcd;
+    frame_budget = budget;
+
+    for (int i = 0; i < GLYPH_COUNT; i++)
+    {
+        canonical[i] = i;
+        for (int j = 0; j < i; j++)
+        {
+            if (memcmp(library[i].bitmap, library[j].bitmap, 8) == 0)
+            {
+                canonical[i] = canonical[j];
+                break;
+            }
+        }
+    }
+
+    memset(slot_glyph, SLOT_FREE, sizeof(slot_glyph));
+    memset(slot_used, 0, sizeof(slot_used));
+    lcd_glyphs_invalidate_cells(0, 0, LCD_ROWS * LCD_COLS);
+    memset(&stats, 0, sizeof(stats));
+    window_start_us = esp_timer_get_time();
+    window_uploads = 0;
+}
+
+/**
+ * @brief Marks cells as unknown after they were written without the glyph cache.
+ */
+void lcd_glyphs_invalidate_cells(int x, int y, int count)
+{
+    for (int i = y * LCD_COLS + x; count > 0 && i >= 0 && i < LCD_ROWS * LCD_COLS; i++, count--)
+    {
+        shadow[i / LCD_COLS][i % LCD_COLS] = SHADOW_UNKNOWN;
+    }
+}
+
+/**
+ * @brief Picks the slot to load a missing glyph into.
+ *
+ * Free slots come first, then slots not shown on screen, then shown slots whose
+ * cells will show the new glyph anyway so the upload itself updates them. Ties go
+ * to the least recently used slot.
+ */
+static int pick_victim(const bool *slot_taken, uint8_t glyph, const uint8_t want[LCD_ROWS][LCD_COLS])
+{
+    int best = -1;
+    int best_class = -1, best_overlap = -1;
+    for (int s = 0; s < SLOT_COUNT; s++)
+    {
+        if (slot_taken[s])
+        {
+            continue;
+        }
+        int shown = 0, overlap = 0;
+        for (int y = 0; y < LCD_ROWS; y++)
+        {
+            for (int x = 0; x < LCD_COLS; x++)
+            {
+                if (shadow[y][x] == s)
+                {
+                    shown++;
+                    overlap += want[y][x] == glyph;
+                }
+            }
+        }
+        int cls = slot_glyph[s] == SLOT_FREE ? 3 : (shown == 0 ? 2 : 1);
+        if (cls > best_class || (cls == best_class && overlap > best_overlap) ||
+            (cls == best_class && overlap == best_overlap && slot_used[s] < slot_used[best]))
+        {
+            best = s;
+            best_class = cls;
+            best_overlap = overlap;
+        }
+    }
+    return best;
+}
+
+// Write the changed cells of one phase, moving the cursor only at gaps
+static int write_cells(const uint16_t out[LCD_ROWS][LCD_COLS], const bool pending[LCD_ROWS][LCD_COLS], bool phase)
+{
+    int lcd_bytes = 0;
+    for (int y = 0; y < LCD_ROWS; y++)
+    {
+        int cursor = -1;
+        for (int x = 0; x < LCD_COLS; x++)
+        {
+            if (pending[y][x] != phase || out[y][x] == shadow[y][x])
+            {
+                continue;
+            }
+            if (cursor != x)
+            {
+                hd44780_gotoxy(glyph_lcd, x, y);
+                lcd_bytes++;
+            }
+            hd44780_putc(glyph_lcd, (char)out[y][x]);
+            lcd_bytes++;
+            shadow[y][x] = out[y][x];
+            cursor = x + 1;
+        }
+    }
+    return lcd_bytes * LCD_GLYPHS_I2C_PER_LCD_BYTE;
+}
+
+/**
+ * @brief Renders a frame, writing only what changed since the last frame.
+ *
+ * Cells that do not depend on a new upload are written first, which clears most
+ * cells still showing an evicted slot. Then the glyphs are uploaded and finally
+ * the cells showing them are written.
+ */
+int lcd_glyphs_render(const lcd_frame_t *frame)
+{
+    uint8_t want[LCD_ROWS][LCD_COLS];
+    uint16_t out[LCD_ROWS][LCD_COLS];
+    bool pending[LCD_ROWS][LCD_COLS];
+    bool needed[GLYPH_COUNT] = {false};
+    bool slot_taken[SLOT_COUNT] = {false};
+    int8_t glyph_slot[GLYPH_COUNT];
+    uint8_t upload_glyph[SLOT_COUNT];
+    int8_t upload_slot[SLOT_COUNT];
+    int upload_count = 0;
+    int changed = 0;
+
+    if (glyph_lcd == NULL)
+    {
+        return 0;
+    }
+    stats.frames++;
+    frame_fallbacks = 0;
+    memset(glyph_slot, -1, sizeof(glyph_slot));
+
+    // Canonical glyph of every cell, SLOT_FREE for text and ROM glyphs
+    for (int y = 0; y < LCD_ROWS; y++)
+    {
+        for (int x = 0; x < LCD_COLS; x++)
+        {
+            uint16_t cell = frame->cells[y][x];
+            want[y][x] = SLOT_FREE;
+            if (cell & 0x100)
+            {
+                uint8_t g = canonical[(cell & 0xFF) % GLYPH_COUNT];
+                if (library[g].rom == 0)
+                {
+                    want[y][x] = g;
+                    needed[g] = true;
+                }
+            }
+        }
+    }
+
+    // Glyphs already in CGRAM
+    for (int s = 0; s < SLOT_COUNT; s++)
+    {
+        if (slot_glyph[s] != SLOT_FREE && needed[slot_glyph[s]])
+        {
+            slot_taken[s] = true;
+            slot_used[s] = stats.frames;
+            glyph_slot[slot_glyph[s]] = s;
+        }
+    }
+
+    // Cells that will change, a cell of a missing glyph always does
+    for (int y = 0; y < LCD_ROWS; y++)
+    {
+        for (int x = 0; x < LCD_COLS; x++)
+        {
+            uint16_t cell = frame->cells[y][x];
+            uint8_t g = want[y][x];
+            if (g != SLOT_FREE)
+            {
+                changed += glyph_slot[g] < 0 || shadow[y][x] != glyph_slot[g];
+            }
+            else
+            {
+                uint16_t byte = (cell & 0x100) ? library[canonical[(cell & 0xFF) % GLYPH_COUNT]].rom : cell;
+                changed += shadow[y][x] != byte;
+            }
+        }
+    }
+
+    // Missing glyphs in screen order, within what is left of the budget after the cells and a cursor move per row
+    int remaining = frame_budget - (changed + LCD_ROWS) * LCD_GLYPHS_I2C_PER_LCD_BYTE;
+    for (int i = 0; i < LCD_ROWS * LCD_COLS; i++)
+    {
+        uint8_t g = want[i / LCD_COLS][i % LCD_COLS];
+        if (g == SLOT_FREE || glyph_slot[g] >= 0)
+        {
+            continue;
+        }
+        int s = pick_victim(slot_taken, g, want);
+        if (s < 0)
+        {
+            break;
+        }
+        if (frame_budget > 0 && remaining < UPLOAD_I2C_BYTES)
+        {
+            stats.deferred++;
+            glyph_slot[g] = -2;
+            continue;
+        }
+        remaining -= UPLOAD_I2C_BYTES;
+        slot_taken[s] = true;
+        glyph_slot[g] = s;
+        upload_glyph[upload_count] = g;
+        upload_slot[upload_count++] = s;
+    }
+
+    // Bytes to show, cells of glyphs uploaded in this frame are written last
+    for (int y = 0; y < LCD_ROWS; y++)
+    {
+        for (int x = 0; x < LCD_COLS; x++)
+        {
+            uint16_t cell = frame->cells[y][x];
+            uint8_t g = want[y][x];
+            pending[y][x] = false;
+            if (!(cell & 0x100))
+            {
+                out[y][x] = cell & 0xFF;
+            }
+            else if (g == SLOT_FREE)
+            {
+                out[y][x] = library[canonical[(cell & 0xFF) % GLYPH_COUNT]].rom;
+            }
+            else if (glyph_slot[g] >= 0)
+            {
+                out[y][x] = glyph_slot[g];
+                pending[y][x] = slot_glyph[glyph_slot[g]] != g;
+            }
+            else
+            {
+                out[y][x] = (uint8_t)library[g].fallback;
+                stats.fallbacks++;
+                frame_fallbacks++;
+            }
+        }
+    }
+
+    int bytes = write_cells(out, pending, false);
+
+    for (int i = 0; i < upload_count; i++)
+    {
+        int s = upload_slot[i];
+        for (int c = 0; c < LCD_ROWS * LCD_COLS; c++)
+        {
+            int y = c / LCD_COLS, x = c % LCD_COLS;
+            if (shadow[y][x] == s && out[y][x] != s)
+            {
+                stats.visible_reuploads++;
+                break;
+            }
+        }
+        hd44780_upload_character(glyph_lcd, s, library[upload_glyph[i]].bitmap);
+        slot_glyph[s] = upload_glyph[i];
+        slot_used[s] = stats.frames;
+        bytes += UPLOAD_I2C_BYTES;
+    }
+    stats.uploads += upload_count;
+    window_uploads += upload_count;
+
+    bytes += write_cells(out, pending, true);
+    stats.i2c_bytes += bytes;
+    stats.last_frame_bytes = bytes;
+
+    int64_t now = esp_timer_get_time();
+    if (now - window_start_us >= STATS_INTERVAL_US)
+    {
+        ESP_LOGI(TAG, "%d glyph uploads/s, %d visible re-uploads, %d deferred, %d bytes last frame",
+                 (int)(window_uploads * 1000000LL / (now - window_start_us)), (int)stats.visible_reuploads,
+                 (int)stats.deferred, bytes);
+        window_start_us = now;
+        window_uploads = 0;
+    }
+    return bytes;
+}
+
+/**
+ * @brief Returns whether the last frame showed every glyph.
+ */
+bool lcd_glyphs_complete(void)
+{
+    return frame_fallbacks == 0;
+}
+
+/**
+ * @brief Reads the glyph cache statistics.
+ */
+void lcd_glyphs_get_stats(lcd_glyphs_stats_t *out)
+{
+    *out = stats;
+}
+
+/**
+ * @brief Fills a frame with blanks.
+ */
+void lcd_frame_clear(lcd_frame_t *frame)
+{
+    for (int y = 0; y < LCD_ROWS; y++)
+    {
+        for (int x = 0; x < LCD_COLS; x++)
+        {
+            frame->cells[y][x] = ' ';
+        }
+    }
+}
+
+/**
+ * @brief Writes a string into a frame, clipped at the end of the row.
+ */
+void lcd_frame_puts(lcd_frame_t *frame, int x, int y, const char *string)
+{
+    if (y < 0 || y >= LCD_ROWS)
+    {
+        return;
+    }
+    for (; *string && x < LCD_COLS; string++, x++)
+    {
+        if (x >= 0)
+        {
+            // Codes 0-15 address CGRAM, glyphs go through lcd_frame_put_glyph()
+            frame->cells[y][x] = (uint8_t)*string < 16 ? ' ' : (uint8_t)*string;
+        }
+    }
+}
+
+/**
+ * @brief Places a glyph in a frame.
+ */
+void lcd_frame_put_glyph(lcd_frame_t *frame, int x, int y, lcd_glyph_id_t glyph)
+{
+    if (x >= 0 && x < LCD_COLS && y >= 0 && y < LCD_ROWS)
+    {
+        frame->cells[y][x] = LCD_CELL_GLYPH(glyph);
+    }
+}
+
+/**
+ * @brief Draws a horizontal bar with a resolution of 5 steps per cell.
+ */
+void lcd_frame_hbar(lcd_frame_t *frame, int x, int y, int width, int value, int max)
+{
+    if (max <= 0)
+    {
+        return;
+    }
+    value = value < 0 ? 0 : (value > max ? max : value);
+    int steps = value * width * 5 / max;
+    for (int i = 0; i < width; i++, steps -= 5)
+    {
+        if (steps >= 5)
+        {
+            lcd_frame_put_glyph(frame, x + i, y, GLYPH_CURRENT_PAGE);
+        }
+        else if (steps > 0)
+        {
+            lcd_frame_put_glyph(frame, x + i, y, GLYPH_HBAR_1 + steps - 1);
+        }
+        else
+        {
+            lcd_frame_put_glyph(frame, x + i, y, GLYPH_EMPTY);
+        }
+    }
+}
+
+/**
+ * @brief Draws a vertical bar of 8 steps in one cell.
+ */
+void lcd_frame_vbar(lcd_frame_t *frame, int x, int y, int level)
+{
+    if (level <= 0)
+    {
+        lcd_frame_put_glyph(frame, x, y, GLYPH_EMPTY);
+    }
+    else if (level >= 8)
+    {
+        lcd_frame_put_glyph(frame, x, y, GLYPH_CURRENT_PAGE);
+    }
+    else
+    {
+        lcd_frame_put_glyph(frame, x, y, GLYPH_VBAR_1 + level - 1);
+    }
+}
+
+/**
+ * @brief Draws a tuner needle on a scale with a resolution of 5 steps per cell.
+ */
+void lcd_frame_needle(lcd_frame_t *frame, int x, int y, int width, int value, int max)
+{
+    if (max <= 0 || width <= 0)
+    {
+        return;
+    }
+    value = value < 0 ? 0 : (value > max ? max : value);
+    int pos = value * (width * 5 - 1) / max;
+    for (int i = 0; i < width; i++)
+    {
+        lcd_frame_put_glyph(frame, x + i, y, i == pos / 5 ? GLYPH_NEEDLE_0 + pos % 5 : GLYPH_EMPTY);
+    }
+}
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <string.h>
+#include "lcd_menu.h"
+
+// Page shown at the current depth
+static const lcd_menu_page_t *shown(const lcd_menu_t *menu)
+{
+    return menu->stack[menu->depth];
+}
+
+// Open a top level page at its first item
+static void open_page(lcd_menu_t *menu, int page)
+{
+    menu->page = page;
+    menu->depth = 0;
+    menu->stack[0] = menu->page_count > 0 ? menu->pages[page] : NULL;
+    menu->cursor[0] = 0;
+    menu->first[0] = 0;
+}
+
+// Scroll the window of the current depth so the cursor is in it
+static void follow_cursor(lcd_menu_t *menu)
+{
+    int d = menu->depth;
+    if (menu->cursor[d] < menu->first[d])
+    {
+        menu->first[d] = menu->cursor[d];
+    }
+    else if (menu->cursor[d] >= menu->first[d] + LCD_MENU_ROWS)
+    {
+        menu->first[d] = menu->cursor[d] - LCD_MENU_ROWS + 1;
+    }
+}
+
+/**
+ * @brief Initializes a menu on the first item of the first page.
+ */
+void lcd_menu_init(lcd_menu_t *menu, const lcd_menu_page_t *const *pages, int count)
+{
+    memset(menu, 0, sizeof(*menu));
+    menu->pages = pages;
+    menu->page_count = count;
+    open_page(menu, 0);
+}
+
+/**
+ * @brief Returns to the first page and puts the cursor on an item of it.
+ */
+void lcd_menu_home(lcd_menu_t *menu, int item)
+{
+    open_page(menu, 0);
+    if (menu->stack[0] && item >= 0 && item < menu->stack[0]->item_count)
+    {
+        menu->cursor[0] = item;
+        follow_cursor(menu);
+    }
+}
+
+/**
+ * @brief Returns whether the first page is shown, without a submenu.
+ */
+bool lcd_menu_is_home(const lcd_menu_t *menu)
+{
+    return menu->page == 0 && menu->depth == 0;
+}
+
+/**
+ * @brief Moves in the menu, runs the action of an item on Enter.
+ */
+bool lcd_menu_handle(lcd_menu_t *menu, lcd_menu_event_t event)
+{
+    const lcd_menu_page_t *page = shown(menu);
+    if (page == NULL)
+    {
+        return false;
+    }
+    int d = menu->depth;
+    int count = page->item_count;
+    switch (event)
+    {
+    case LCD_MENU_UP:
+    case LCD_MENU_DOWN:
+        if (count == 0)
+        {
+            return false;
+        }
+        // The cursor wraps, a short list needs no way back
+        menu->cursor[d] = (menu->cursor[d] + (event == LCD_MENU_DOWN ? 1 : count - 1)) % count;
+        follow_cursor(menu);
+        return true;
+    case LCD_MENU_PREV_PAGE:
+    case LCD_MENU_NEXT_PAGE:
+    {
+        int n = menu->page_count;
+        open_page(menu, (menu->page + (event == LCD_MENU_NEXT_PAGE ? 1 : n - 1)) % n);
+        return true;
+    }
+    case LCD_MENU_ENTER:
+    {
+        if (count == 0)
+        {
+            return false;
+        }
+        const lcd_menu_item_t *item = &page->items[menu->cursor[d]];
+        if (item->submenu && d < LCD_MENU_DEPTH_MAX)
+        {
+            menu->depth = d + 1;
+            menu->stack[d + 1] = item->submenu;
+            // A submenu opens at its current choice
+            menu->cursor[d + 1] = 0;
+            menu->first[d + 1] = 0;
+            for (int i = 0; i < item->submenu->item_count; i++)
+            {
+                const lcd_menu_item_t *sub = &item->submenu->items[i];
+                if (sub->checked && sub->checked(sub->arg))
+                {
+                    menu->cursor[d + 1] = i;
+                    follow_cursor(menu);
+                    break;
+                }
+            }
+            return true;
+        }
+        if (item->action)
+        {
+            item->action(item->arg);
+            return true;
+        }
+        return false;
+    }
+    case LCD_MENU_BACK:
+        if (d == 0)
+        {
+            return false;
+        }
+        menu->depth = d - 1;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Draws the page bar: a cell per top level page and the title of the page shown.
+ */
+void lcd_menu_draw_page_bar(const lcd_menu_t *menu, lcd_frame_t *frame, int y)
+{
+    for (int i = 0; i < menu->page_count; i++)
+    {
+        lcd_frame_put_glyph(frame, i, y, i == menu->page ? GLYPH_CURRENT_PAGE : GLYPH_MENU_PAGE);
+    }
+    char title[LCD_COLS + 1];
+    const lcd_menu_page_t *page = shown(menu);
+    snprintf(title, sizeof(title), " %-*.*s", LCD_COLS - 1, LCD_COLS - 1, page ? page->title : "");
+    lcd_frame_puts(frame, menu->page_count, y, title);
+}
+
+/**
+ * @brief Draws the window of items in the lines below the page bar.
+ */
+void lcd_menu_draw_items(const lcd_menu_t *menu, lcd_frame_t *frame, bool cursor)
+{
+    const lcd_menu_page_t *page = shown(menu);
+    int d = menu->depth;
+    for (int r = 0; r < LCD_MENU_ROWS; r++)
+    {
+        int i = menu->first[d] + r;
+        int y = r + 1;
+        if (page == NULL || i >= page->item_count)
+        {
+            lcd_frame_puts(frame, 0, y, "                    ");
+            continue;
+        }
+        const lcd_menu_item_t *item = &page->items[i];
+        lcd_frame_put_glyph(frame, 0, y, cursor && i == menu->cursor[d] ? GLYPH_ARROW : GLYPH_EMPTY);
+        lcd_frame_put_glyph(frame, 1, y, item->icon);
+        if (page->draw_item)
+        {
+            page->draw_item(frame, y, item);
+            continue;
+        }
+        // Label on the 18 columns right of the icon, a submenu or the current choice marked at the end
+        char line[LCD_COLS];
+        char mark = item->submenu ? '>' : (item->checked && item->checked(item->arg) ? '*' : ' ');
+        snprintf(line, sizeof(line), " %-16.16s%c", item->label, mark);
+        lcd_frame_puts(frame, 2, y, line);
+    }
+}
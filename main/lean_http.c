@@ -0,0 +1,647 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "sdkconfig.h"
+#if CONFIG_MBEDTLS_CERTIFICATE_BUNDLE && !CONFIG_ESP_TLS_SKIP_SERVER_CERT_VERIFY
+#include "esp_crt_bundle.h"
+#define VERIFY_SERVERS 1
+#endif
+#include "binlog.h"
+#include "mem_plan.h"
+#include "playlist_file.h"
+#include "lean_http.h"
+
+static const char *TAG = "LEAN_HTTP";
+
+#define HOST_MAX 64
+/* Header lines longer than this are skipped, the ones used are short */
+#define HEAD_LINE_MAX 512
+/* Gives up on headers longer than this */
+#define HEAD_LIMIT (8 * 1024)
+#define HTTP_PORT 80
+#define HTTPS_PORT 443
+
+/**
+ * @brief What is remembered of a server.
+ */
+typedef struct {
+    char host[HOST_MAX];
+    uint16_t port;
+    uint32_t used;                  // Stamp of the last use, the least recent entry is replaced
+    bool no_fragment;               // The handshake failed while asked for the fragment length
+    bool plain;                     // Asked over plain HTTP since its handshakes kept failing
+    int tls_failures;               // Failed handshakes in a row
+    bool has_session;
+    mbedtls_ssl_session session;
+} server_t;
+
+/**
+ * @brief Private state of a connection.
+ */
+struct lean_http {
+    int sock;
+    bool tls;
+    mbedtls_ssl_config conf;
+    mbedtls_ssl_context ssl;
+    uint32_t tls_base;              // Bytes mbedTLS held before the handshake
+    char head[HEAD_LINE_MAX];       // Header lines, then the first bytes of the body
+    char location[LEAN_HTTP_URL_MAX];   // Location header of a redirect
+    int body_pos;
+    int body_len;
+    lean_http_stats_t stats;
+};
+
+static lean_http_cfg_t profile = LEAN_HTTP_CFG_DEFAULT();
+static SemaphoreHandle_t servers_lock = NULL;
+static server_t servers[LEAN_HTTP_SERVERS];
+static uint32_t use_stamp = 0;
+
+// Code of a fragment length in the max_fragment_length extension
+static unsigned char fragment_code(int len)
+{
+    switch (len) {
+    case 512:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_512;
+    case 1024:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_1024;
+    case 2048:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_2048;
+    case 4096:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_4096;
+    default:
+        return MBEDTLS_SSL_MAX_FRAG_LEN_NONE;
+    }
+}
+
+// Entry of a server, a new one replaces the least recently used, call with the lock held
+static server_t *find_server(const char *host, uint16_t port)
+{
+    server_t *oldest = &servers[0];
+    for (int i = 0; i < LEAN_HTTP_SERVERS; i++) {
+        server_t *s = &servers[i];
+        if (s->port == port && strcmp(s->host, host) == 0) {
+            s->used = ++use_stamp;
+            return s;
+        }
+        if (s->used < oldest->used) {
+            oldest = s;
+        }
+    }
+    mbedtls_ssl_session_free(&oldest->session);
+    memset(oldest, 0, sizeof(*oldest));
+    mbedtls_ssl_session_init(&oldest->session);
+    snprintf(oldest->host, sizeof(oldest->host), "%s", host);
+    oldest->port = port;
+    oldest->used = ++use_stamp;
+    return oldest;
+}
+
+static int rng(void *ctx, unsigned char *buf, size_t len)
+{
+    esp_fill_random(buf, len);
+    return 0;
+}
+
+static int tls_send(void *ctx, const unsigned char *buf, size_t len)
+{
+    int sock = *(int *)ctx;
+    int r = send(sock, buf, len, 0);
+    if (r < 0) {
+        return errno == EAGAIN || errno == EWOULDBLOCK ? MBEDTLS_ERR_SSL_TIMEOUT : MBEDTLS_ERR_NET_SEND_FAILED;
+    }
+    return r;
+}
+
+static int tls_recv(void *ctx, unsigned char *buf, size_t len)
+{
+    int sock = *(int *)ctx;
+    int r = recv(sock, buf, len, 0);
+    if (r < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            return MBEDTLS_ERR_SSL_TIMEOUT;
+        }
+        return errno == ECONNRESET ? MBEDTLS_ERR_NET_CONN_RESET : MBEDTLS_ERR_NET_RECV_FAILED;
+    }
+    return r;
+}
+
+// A handshake that failed on the network rather than on what the server sent
+static bool network_error(int err)
+{
+    return err == MBEDTLS_ERR_SSL_TIMEOUT || err == MBEDTLS_ERR_NET_SEND_FAILED ||
+           err == MBEDTLS_ERR_NET_RECV_FAILED || err == MBEDTLS_ERR_NET_CONN_RESET;
+}
+
+/**
+ * @brief Splits an http or https url into its host, port and path.
+ */
+static bool parse_url(const char *url, bool *https, char *host, uint16_t *port, const char **path)
+{
+    if (strncasecmp(url, "https://", 8) == 0) {
+        *https = true;
+        url += 8;
+    } else if (strncasecmp(url, "http://", 7) == 0) {
+        *https = false;
+        url += 7;
+    } else {
+        return false;
+    }
+    size_t host_len = strcspn(url, ":/?");
+    if (host_len == 0 || host_len >= HOST_MAX) {
+        return false;
+    }
+    memcpy(host, url, host_len);
+    host[host_len] = '\0';
+    url += host_len;
+
+    *port = *https ? HTTPS_PORT : HTTP_PORT;
+    if (*url == ':') {
+        char *end;
+        long p = strtol(url + 1, &end, 10);
+        if (end == url + 1 || p <= 0 || p > 65535) {
+            return false;
+        }
+        *port = p;
+        url = end;
+    }
+    *path = *url == '/' ? url : "/";
+    return *url == '\0' || *url == '/';
+}
+
+/**
+ * @brief Connects a TCP socket within the timeout, reads and writes time out after it too.
+ *
+ * @return Socket, or -1 on a failure.
+ */
+static int open_socket(const char *host, uint16_t port, int timeout_ms)
+{
+    struct addrinfo hints = {
+        .ai_family = AF_INET,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res = NULL;
+    char service[8];
+    snprintf(service, sizeof(service), "%u", port);
+    if (getaddrinfo(host, service, &hints, &res) != 0 || res == NULL) {
+        return -1;
+    }
+    int sock = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+    if (sock < 0) {
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    // Connect without blocking so the timeout also covers a server that does not answer
+    int flags = fcntl(sock, F_GETFL, 0);
+    fcntl(sock, F_SETFL, flags | O_NONBLOCK);
+    int ret = connect(sock, res->ai_addr, res->ai_addrlen);
+    freeaddrinfo(res);
+    if (ret < 0 && errno == EINPROGRESS) {
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(sock, &fds);
+        struct timeval tv = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+        int error = 0;
+        socklen_t error_len = sizeof(error);
+        if (select(sock + 1, NULL, &fds, NULL, &tv) > 0 &&
+            getsockopt(sock, SOL_SOCKET, SO_ERROR, &error, &error_len) == 0 && error == 0) {
+            ret = 0;
+        }
+    }
+    struct timeval timeout = { .tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000 };
+    if (ret < 0 || fcntl(sock, F_SETFL, flags) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+/**
+ * @brief Runs the TLS handshake, resuming the session of the server when there is one.
+ *
+ * Remembers the outcome for the server: its new session, whether it takes the fragment
+ * length, and the failed handshakes that lead to the plain HTTP fallback.
+ */
+static esp_err_t tls_handshake(lean_http_handle_t h, const char *host, uint16_t port)
+{
+    mem_plan_tls_reset_peak();
+    mem_plan_tls_usage(&h->tls_base, NULL);
+    int64_t start = esp_timer_get_time();
+
+    xSemaphoreTake(servers_lock, portMAX_DELAY);
+    server_t *server = find_server(host, port);
+    int fragment = server->no_fragment ? 0 : profile.max_fragment_len;
+    mbedtls_ssl_conf_max_frag_len(&h->conf, fragment_code(fragment));
+    mbedtls_ssl_init(&h->ssl);
+    int err = mbedtls_ssl_setup(&h->ssl, &h->conf);
+    if (err == 0) {
+        err = mbedtls_ssl_set_hostname(&h->ssl, host);
+    }
+    bool resuming = false;
+    if (err == 0 && profile.resume_sessions && server->has_session) {
+        resuming = mbedtls_ssl_set_session(&h->ssl, &server->session) == 0;
+    }
+    xSemaphoreGive(servers_lock);
+    h->stats.max_fragment_len = fragment;
+    if (err != 0) {
+        BINLOGW(TAG, "TLS setup failed: -0x%x", -err);
+        return ESP_ERR_NO_MEM;
+    }
+
+    mbedtls_ssl_set_bio(&h->ssl, &h->sock, tls_send, tls_recv, NULL);
+    do {
+        err = mbedtls_ssl_handshake(&h->ssl);
+    } while (err == MBEDTLS_ERR_SSL_WANT_READ || err == MBEDTLS_ERR_SSL_WANT_WRITE);
+    h->stats.handshake_ms = (esp_timer_get_time() - start) / 1000;
+
+    xSemaphoreTake(servers_lock, portMAX_DELAY);
+    server = find_server(host, port);
+    if (err == 0) {
+        const mbedtls_ssl_session *session = mbedtls_ssl_get_session_pointer(&h->ssl);
+        h->stats.resumed = resuming && memcmp(session->master, server->session.master, sizeof(session->master)) == 0;
+        server->tls_failures = 0;
+        if (profile.resume_sessions) {
+            mbedtls_ssl_session_free(&server->session);
+            mbedtls_ssl_session_init(&server->session);
+            server->has_session = mbedtls_ssl_get_session(&h->ssl, &server->session) == 0;
+        }
+    } else if (!network_error(err)) {
+        if (resuming) {
+            // The server may refuse the session, the next handshake is a full one
+            server->has_session = false;
+        } else {
+            server->no_fragment |= fragment != 0;
+            if (++server->tls_failures >= profile.tls_failures && profile.plain_fallback) {
+                server->plain = true;
+            }
+        }
+    }
+    bool plain = server->plain;
+    xSemaphoreGive(servers_lock);
+
+    uint32_t in_use, peak;
+    mem_plan_tls_usage(&in_use, &peak);
+    h->stats.tls_heap_peak = peak > h->tls_base ? peak - h->tls_base : 0;
+    h->stats.tls_heap = in_use > h->tls_base ? in_use - h->tls_base : 0;
+    if (err != 0) {
+        // Not deferred, host does not outlive the call
+        ESP_LOGW(TAG, "TLS handshake with %s failed: -0x%x%s", host, -err,
+                 plain ? ", using plain HTTP from now on" : "");
+        return ESP_FAIL;
+    }
+    mem_plan_tls_reset_peak();
+    return ESP_OK;
+}
+
+// Reads what the server sent, 0 at the end, -1 on an error or a timeout
+static int raw_read(lean_http_handle_t h, char *buf, int len)
+{
+    if (!h->tls) {
+        int r = recv(h->sock, buf, len, 0);
+        return r < 0 ? -1 : r;
+    }
+    int r;
+    do {
+        r = mbedtls_ssl_read(&h->ssl, (unsigned char *)buf, len);
+    } while (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE);
+    if (r == MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY) {
+        return 0;
+    }
+    return r < 0 ? -1 : r;
+}
+
+static esp_err_t raw_write(lean_http_handle_t h, const char *buf, int len)
+{
+    while (len > 0) {
+        int r;
+        if (h->tls) {
+            r = mbedtls_ssl_write(&h->ssl, (const unsigned char *)buf, len);
+            if (r == MBEDTLS_ERR_SSL_WANT_READ || r == MBEDTLS_ERR_SSL_WANT_WRITE) {
+                continue;
+            }
+        } else {
+            r = send(h->sock, buf, len, 0);
+        }
+        if (r <= 0) {
+            return ESP_FAIL;
+        }
+        buf += r;
+        len -= r;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t send_request(lean_http_handle_t h, const char *host, uint16_t port, const char *path,
+                              int64_t range_from)
+{
+    // HTTP/1.0 so the body is never chunked and ends when the server closes
+    char request[HEAD_LINE_MAX];
+    int len = snprintf(request, sizeof(request), "GET %s HTTP/1.0\r\nHost: %s", path, host);
+    if (port != (h->tls ? HTTPS_PORT : HTTP_PORT)) {
+        len += snprintf(request + len, sizeof(request) - len, ":%u", port);
+    }
+    len += snprintf(request + len, sizeof(request) - len, "\r\nUser-Agent: ESP32 HTTP Client/1.0\r\n");
+    if (range_from > 0) {
+        len += snprintf(request + len, sizeof(request) - len, "Range: bytes=%lld-\r\n", (long long)range_from);
+    }
+    len += snprintf(request + len, sizeof(request) - len, "\r\n");
+    if (len >= (int)sizeof(request)) {
+        BINLOGW(TAG, "Request too long");
+        return ESP_FAIL;
+    }
+    return raw_write(h, request, len);
+}
+
+// Takes what the connection needs from one header line
+static void parse_header(lean_http_handle_t h, char *line, lean_http_response_t *response)
+{
+    char *value = strchr(line, ':');
+    if (value == NULL) {
+        return;
+    }
+    *value++ = '\0';
+    value += strspn(value, " \t");
+    if (strcasecmp(line, "Content-Length") == 0) {
+        response->content_length = strtoll(value, NULL, 10);
+    } else if (strcasecmp(line, "Accept-Ranges") == 0) {
+        response->accept_ranges = strncasecmp(value, "bytes", 5) == 0;
+    } else if (strcasecmp(line, "Location") == 0) {
+        snprintf(h->location, sizeof(h->location), "%s", value);
+    }
+}
+
+/**
+ * @brief Reads the status line and the headers, keeps the body bytes read with them.
+ */
+static esp_err_t read_head(lean_http_handle_t h, lean_http_response_t *response)
+{
+    int start = 0;          // First byte of the line being read
+    int len = 0;            // Bytes in the buffer
+    int total = 0;
+    bool status_read = false;
+    bool skipping = false;  // In a line longer than the buffer
+    for (;;) {
+        char *eol = memchr(h->head + start, '\n', len - start);
+        if (eol == NULL) {
+            if (start > 0) {
+                memmove(h->head, h->head + start, len - start);
+                len -= start;
+                start = 0;
+            } else if (len == sizeof(h->head)) {
+                skipping = true;
+                len = 0;
+            }
+            int r = total < HEAD_LIMIT ? raw_read(h, h->head + len, sizeof(h->head) - len) : -1;
+            if (r <= 0) {
+                return ESP_FAIL;
+            }
+            len += r;
+            total += r;
+            continue;
+        }
+
+        char *line = h->head + start;
+        start = eol - h->head + 1;
+        *eol = '\0';
+        if (eol > line && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        if (skipping) {
+            skipping = false;
+        } else if (!status_read) {
+            // "HTTP/1.1 200 OK", or "ICY 200 OK" from older SHOUTcast servers
+            if (strncmp(line, "HTTP/", 5) != 0 && strncmp(line, "ICY ", 4) != 0) {
+                return ESP_FAIL;
+            }
+            char *code = strchr(line, ' ');
+            response->status = code ? atoi(code + 1) : 0;
+            status_read = true;
+        } else if (line[0] == '\0') {
+            h->body_pos = start;
+            h->body_len = len;
+            return ESP_OK;
+        } else {
+            parse_header(h, line, response);
+        }
+    }
+}
+
+/**
+ * @brief Sets the TLS profile.
+ */
+esp_err_t lean_http_init(const lean_http_cfg_t *config)
+{
+    if (servers_lock == NULL) {
+        servers_lock = xSemaphoreCreateMutex();
+        if (servers_lock == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        for (int i = 0; i < LEAN_HTTP_SERVERS; i++) {
+            mbedtls_ssl_session_init(&servers[i].session);
+        }
+    }
+    profile = *config;
+    if (fragment_code(profile.max_fragment_len) == MBEDTLS_SSL_MAX_FRAG_LEN_NONE) {
+        profile.max_fragment_len = 0;
+    }
+    ESP_LOGI(TAG, "[ * ] TLS fragment length %d, session resumption %s, plain HTTP fallback %s",
+             profile.max_fragment_len, profile.resume_sessions ? "on" : "off",
+             profile.plain_fallback ? "on" : "off");
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates a connection, closed.
+ */
+lean_http_handle_t lean_http_create(void)
+{
+    lean_http_handle_t h = calloc(1, sizeof(struct lean_http));
+    if (h == NULL) {
+        return NULL;
+    }
+    h->sock = -1;
+    mbedtls_ssl_config_init(&h->conf);
+    if (mbedtls_ssl_config_defaults(&h->conf, MBEDTLS_SSL_IS_CLIENT, MBEDTLS_SSL_TRANSPORT_STREAM,
+                                    MBEDTLS_SSL_PRESET_DEFAULT) != 0) {
+        mbedtls_ssl_config_free(&h->conf);
+        free(h);
+        return NULL;
+    }
+    mbedtls_ssl_conf_rng(&h->conf, rng, NULL);
+#if VERIFY_SERVERS
+    mbedtls_ssl_conf_authmode(&h->conf, MBEDTLS_SSL_VERIFY_REQUIRED);
+    esp_crt_bundle_attach(&h->conf);
+#else
+    mbedtls_ssl_conf_authmode(&h->conf, MBEDTLS_SSL_VERIFY_NONE);
+#endif
+    mbedtls_ssl_conf_session_tickets(&h->conf, profile.resume_sessions ? MBEDTLS_SSL_SESSION_TICKETS_ENABLED
+                                                                       : MBEDTLS_SSL_SESSION_TICKETS_DISABLED);
+    return h;
+}
+
+static bool is_redirect(int status)
+{
+    return status == 301 || status == 302 || status == 303 || status == 307 || status == 308;
+}
+
+/**
+ * @brief Replaces a url by the Location of its redirect, which may be relative.
+ */
+static esp_err_t follow_location(char *url, int size, const char *location)
+{
+    // The base is the url up to the last '/' of its path
+    char base[LEAN_HTTP_URL_MAX];
+    const char *host = strstr(url, "://");
+    const char *slash = host ? strrchr(host + 3, '/') : NULL;
+    int len = slash ? (int)(slash - url) + 1 : (int)strlen(url);
+    snprintf(base, sizeof(base), "%.*s%s", len, url, slash ? "" : "/");
+    return playlist_file_resolve(base, location, url, size);
+}
+
+// One request, without following redirects
+static esp_err_t open_once(lean_http_handle_t h, const char *url, int64_t range_from, int timeout_ms,
+                           lean_http_response_t *response)
+{
+    char host[HOST_MAX];
+    uint16_t port;
+    const char *path;
+    bool https;
+    if (!parse_url(url, &https, host, &port, &path)) {
+        BINLOGW(TAG, "Unsupported url");
+        return ESP_ERR_INVALID_ARG;
+    }
+    memset(&h->stats, 0, sizeof(h->stats));
+    memset(response, 0, sizeof(*response));
+    response->content_length = -1;
+    h->body_pos = 0;
+    h->body_len = 0;
+    h->location[0] = '\0';
+
+    bool plain = false;
+    if (https) {
+        xSemaphoreTake(servers_lock, portMAX_DELAY);
+        plain = find_server(host, port)->plain;
+        xSemaphoreGive(servers_lock);
+    }
+    h->tls = https && !plain;
+    h->stats.tls = h->tls;
+    h->stats.plain_fallback = plain;
+
+    int64_t start = esp_timer_get_time();
+    h->sock = open_socket(host, plain ? HTTP_PORT : port, timeout_ms);
+    h->stats.connect_ms = (esp_timer_get_time() - start) / 1000;
+    if (h->sock < 0) {
+        return ESP_FAIL;
+    }
+    esp_err_t err = h->tls ? tls_handshake(h, host, port) : ESP_OK;
+    if (err == ESP_OK) {
+        err = send_request(h, host, plain ? HTTP_PORT : port, path, range_from);
+    }
+    if (err == ESP_OK) {
+        err = read_head(h, response);
+    }
+    if (err != ESP_OK) {
+        lean_http_close(h);
+    }
+    return err;
+}
+
+/**
+ * @brief Connects and sends a GET request, reads the status line and the headers.
+ */
+esp_err_t lean_http_open(lean_http_handle_t h, const char *url, int64_t range_from, int timeout_ms,
+                         lean_http_response_t *response)
+{
+    char target[LEAN_HTTP_URL_MAX];
+    if (snprintf(target, sizeof(target), "%s", url) >= (int)sizeof(target)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    for (int redirects = 0;; redirects++) {
+        esp_err_t err = open_once(h, target, range_from, timeout_ms, response);
+        if (err != ESP_OK || !is_redirect(response->status) || h->location[0] == '\0') {
+            return err;
+        }
+        // The redirect stays open with its status when there are too many
+        if (redirects == LEAN_HTTP_MAX_REDIRECTS) {
+            BINLOGW(TAG, "More than %d redirects", LEAN_HTTP_MAX_REDIRECTS);
+            return ESP_OK;
+        }
+        lean_http_close(h);
+        if (follow_location(target, sizeof(target), h->location) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+}
+
+/**
+ * @brief Reads from the body.
+ */
+int lean_http_read(lean_http_handle_t h, char *buf, int len)
+{
+    if (h->sock < 0) {
+        return -1;
+    }
+    if (h->body_pos < h->body_len) {
+        int n = h->body_len - h->body_pos < len ? h->body_len - h->body_pos : len;
+        memcpy(buf, h->head + h->body_pos, n);
+        h->body_pos += n;
+        return n;
+    }
+    return raw_read(h, buf, len);
+}
+
+/**
+ * @brief Closes the connection, nothing happens when it is closed.
+ */
+void lean_http_close(lean_http_handle_t h)
+{
+    if (h->sock < 0) {
+        return;
+    }
+    if (h->tls) {
+        mbedtls_ssl_close_notify(&h->ssl);
+        mbedtls_ssl_free(&h->ssl);
+    }
+    close(h->sock);
+    h->sock = -1;
+}
+
+/**
+ * @brief Closes and frees a connection.
+ */
+void lean_http_destroy(lean_http_handle_t h)
+{
+    if (h == NULL) {
+        return;
+    }
+    lean_http_close(h);
+    mbedtls_ssl_config_free(&h->conf);
+    free(h);
+}
+
+/**
+ * @brief Reads the measurements of the last connection.
+ */
+void lean_http_get_stats(lean_http_handle_t h, lean_http_stats_t *stats)
+{
+    *stats = h->stats;
+    if (h->tls && h->sock >= 0) {
+        uint32_t peak;
+        mem_plan_tls_usage(NULL, &peak);
+        stats->tls_heap_stream = peak > h->tls_base ? peak - h->tls_base : 0;
+    }
+}
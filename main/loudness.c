@@ -0,0 +1,167 @@
+#include <math.h>
+#include <string.h>
+#include "loudness.h"
+
+/* Offset of the loudness formula, L = -0.691 + 10 * log10(energy) */
+#define LOUDNESS_OFFSET -0.691f
+
+/* Relative gate below the absolute-gated loudness */
+#define RELATIVE_GATE_LU 10
+
+static float energy_to_lufs(float energy)
+{
+    return LOUDNESS_OFFSET + 10.0f * log10f(energy);
+}
+
+static float lufs_to_energy(float lufs)
+{
+    return powf(10.0f, (lufs - LOUDNESS_OFFSET) / 10.0f);
+}
+
+// Energy of the centre of a histogram bin
+static float bin_energy(int bin)
+{
+    return lufs_to_energy(LOUDNESS_MIN_LUFS + (bin + 0.5f) / LOUDNESS_BINS_PER_LU);
+}
+
+/**
+ * @brief Resets a meter for a new track.
+ *
+ * The K-weighting coefficients follow the analog prototypes of BS.1770, so the
+ * filter is right at any sample rate, not only at 48 kHz.
+ */
+void loudness_meter_init(loudness_meter_t *m, int rate, int channels)
+{
+    memset(m, 0, sizeof(*m));
+    m->channels = channels > 2 ? 2 : channels;
+    m->sub_len = rate / 10;
+
+    // High shelf modelling the head
+    float f0 = 1681.974450955533f;
+    float gain_db = 3.999843853973347f;
+    float q = 0.7071752369554196f;
+    float k = tanf((float)M_PI * f0 / rate);
+    float vh = powf(10.0f, gain_db / 20.0f);
+    float vb = powf(vh, 0.4996667741545416f);
+    float a0 = 1.0f + k / q + k * k;
+    m->b[0][0] = (vh + vb * k / q + k * k) / a0;
+    m->b[0][1] = 2.0f * (k * k - vh) / a0;
+    m->b[0][2] = (vh - vb * k / q + k * k) / a0;
+    m->a[0][0] = 2.0f * (k * k - 1.0f) / a0;
+    m->a[0][1] = (1.0f - k / q + k * k) / a0;
+
+    // RLB high-pass
+    f0 = 38.13547087602444f;
+    q = 0.5003270373238773f;
+    k = tanf((float)M_PI * f0 / rate);
+    a0 = 1.0f + k / q + k * k;
+    m->b[1][0] = 1.0f;
+    m->b[1][1] = -2.0f;
+    m->b[1][2] = 1.0f;
+    m->a[1][0] = 2.0f * (k * k - 1.0f) / a0;
+    m->a[1][1] = (1.0f - k / q + k * k) / a0;
+}
+
+// Closes a 100 ms sub-block and adds the 400 ms block ending with it to the histogram
+static void end_sub_block(loudness_meter_t *m)
+{
+    memmove(&m->subs[1], &m->subs[0], (LOUDNESS_SHORT_TERM_SUBS - 1) * sizeof(float));
+    m->subs[0] = m->sub_sum / m->sub_len;
+    m->sub_sum = 0;
+    m->sub_frames = 0;
+    m->sub_count++;
+    if (m->sub_count < LOUDNESS_BLOCK_SUBS) {
+        return;
+    }
+
+    float energy = 0;
+    for (int i = 0; i < LOUDNESS_BLOCK_SUBS; i++) {
+        energy += m->subs[i];
+    }
+    energy /= LOUDNESS_BLOCK_SUBS;
+    if (energy <= 0) {
+        return;
+    }
+    int bin = (int)floorf((energy_to_lufs(energy) - LOUDNESS_MIN_LUFS) * LOUDNESS_BINS_PER_LU);
+    if (bin < 0) {
+        // Below the absolute gate
+        return;
+    }
+    m->hist[bin < LOUDNESS_BINS ? bin : LOUDNESS_BINS - 1]++;
+    m->blocks++;
+}
+
+/**
+ * @brief Feeds interleaved 16-bit samples.
+ */
+void loudness_meter_process(loudness_meter_t *m, const int16_t *pcm, int frames)
+{
+    const float scale = 1.0f / 32768.0f;
+    int ch = m->channels;
+    for (int i = 0; i < frames; i++) {
+        for (int c = 0; c < ch; c++) {
+            float x = pcm[i * ch + c] * scale;
+            for (int s = 0; s < 2; s++) {
+                // Transposed direct form II
+                float *z = m->filter[c].z[s];
+                float y = m->b[s][0] * x + z[0];
+                z[0] = m->b[s][1] * x - m->a[s][0] * y + z[1];
+                z[1] = m->b[s][2] * x - m->a[s][1] * y;
+                x = y;
+            }
+            m->sub_sum += x * x;
+        }
+        if (++m->sub_frames == m->sub_len) {
+            end_sub_block(m);
+        }
+    }
+}
+
+/**
+ * @brief Returns the gated integrated loudness of everything fed since the reset.
+ */
+int loudness_meter_integrated(const loudness_meter_t *m)
+{
+    if (m->blocks == 0) {
+        return LOUDNESS_UNKNOWN;
+    }
+
+    // Mean energy above the absolute gate sets the relative gate
+    float sum = 0;
+    for (int bin = 0; bin < LOUDNESS_BINS; bin++) {
+        sum += m->hist[bin] * bin_energy(bin);
+    }
+    float gate = energy_to_lufs(sum / m->blocks) - RELATIVE_GATE_LU;
+    int first = (int)ceilf((gate - LOUDNESS_MIN_LUFS) * LOUDNESS_BINS_PER_LU);
+    first = first < 0 ? 0 : first;
+
+    sum = 0;
+    uint32_t count = 0;
+    for (int bin = first; bin < LOUDNESS_BINS; bin++) {
+        sum += m->hist[bin] * bin_energy(bin);
+        count += m->hist[bin];
+    }
+    if (count == 0) {
+        return LOUDNESS_UNKNOWN;
+    }
+    return (int)lroundf(energy_to_lufs(sum / count) * 10.0f);
+}
+
+/**
+ * @brief Returns the loudness of the last 3 seconds.
+ */
+int loudness_meter_short_term(const loudness_meter_t *m)
+{
+    if (m->sub_count < LOUDNESS_SHORT_TERM_SUBS) {
+        return LOUDNESS_UNKNOWN;
+    }
+    float energy = 0;
+    for (int i = 0; i < LOUDNESS_SHORT_TERM_SUBS; i++) {
+        energy += m->subs[i];
+    }
+    energy /= LOUDNESS_SHORT_TERM_SUBS;
+    if (energy <= 0 || energy_to_lufs(energy) < LOUDNESS_MIN_LUFS) {
+        return LOUDNESS_UNKNOWN;
+    }
+    return (int)lroundf(energy_to_lufs(energy) * 10.0f);
+}
@@ -8,8 +8,10 @@
 #include "esp_sntp.h"
 #include "sdkconfig.h"
 
+#if CONFIG_SPEAKER_UI_LCD
 #include "lcd.h"
-#include "radio.h"
+#endif
+#include "mode_manager.h"
 #include "timesync.h"
 
 static const char* TAG = "MAIN";
@@ -18,6 +20,7 @@ void app_main(void)
 {
     time_t now;
     struct tm timeinfo;
+    timesync_set_timezone();
     time(&now);
     localtime_r(&now, &timeinfo);
     // Is time set? If not, tm_year will be (1970 - 1900).
@@ -28,10 +31,12 @@ void app_main(void)
         time(&now);
     }
 
+#if CONFIG_SPEAKER_UI_LCD
     ESP_ERROR_CHECK(i2cdev_init());
 
     xTaskCreate(menu, "lcd_test", configMINIMAL_STACK_SIZE * 5, NULL, 1, NULL);
+#endif
     
-    xTaskCreate(init_radio, "radio_test", configMINIMAL_STACK_SIZE * 5, NULL, 5, NULL);
+    xTaskCreate(mode_manager_task, "mode_manager", CONFIG_SPEAKER_MODE_MANAGER_STACK_SIZE, (void *)PLAYER_MODE_DEFAULT, 5, NULL);
 
 }
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "sdkconfig.h"
+#include "scheduler.h"
+#include "mem_plan.h"
+
+static const char *TAG = "MEM_PLAN";
+
+#define HEAP_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+
+/* Record header, IV, MAC and padding mbedTLS adds to the content length, rounded up */
+#define TLS_RECORD_OVERHEAD 512
+
+// Sized for one session, the radio stream; probes and playlist downloads at boot overflow to the heap
+static const mem_pool_class_cfg_t tls_classes[] = {
+    { 64, 16 },     // Big numbers of the key exchange
+    { 256, 28 },    // RSA 2048 numbers, digests
+    { 640, 32 },    // Montgomery temporaries, parsed certificates, the SSL configuration
+    { 2048, 4 },    // Raw certificates and the handshake state
+    // The output record buffer. With CONFIG_MBEDTLS_DYNAMIC_BUFFER also the receive buffer of the
+    // records a server sends when it honours the fragment length the radio asks, see lean_http.h
+    { CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN + TLS_RECORD_OVERHEAD, 2 },
+    { CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN + TLS_RECORD_OVERHEAD, 1 },
+};
+
+static portMUX_TYPE pool_lock = portMUX_INITIALIZER_UNLOCKED;
+static mem_pool_t tls_pool;
+static bool tls_ready = false;
+// Bytes mbedTLS holds in pool blocks and heap allocations
+static uint32_t tls_in_use = 0;
+static uint32_t tls_peak = 0;
+
+// Heap taken by each subsystem while it started
+static struct {
+    const char *name;
+    int bytes;
+} budget[MEM_PLAN_MAX_SUBSYSTEMS];
+static int budget_count = 0;
+static const char *measuring = NULL;
+static int free_at_begin = 0;
+
+static mem_plan_cfg_t monitor_cfg;
+static scheduler_timer_t monitor_timer;
+static int peak_frag = 0;
+static int logged_frag = 0;
+static uint32_t report_elapsed_s = 0;
+
+/**
+ * @brief Reserves the TLS pool.
+ */
+esp_err_t mem_plan_init(void)
+{
+#if !CONFIG_SPEAKER_MODE_RADIO
+    // Only the radio streams over HTTPS, mbedTLS allocates from the heap the few times it runs
+    ESP_LOGI(TAG, "[ * ] No TLS pool without the radio");
+    return ESP_OK;
+#else
+    int count = sizeof(tls_classes) / sizeof(tls_classes[0]);
+    size_t size = mem_pool_region_size(tls_classes, count);
+    void *region = heap_caps_malloc(size, HEAP_CAPS);
+    if (region == NULL) {
+        ESP_LOGE(TAG, "Failed to reserve %d bytes for the TLS pool", (int)size);
+        return ESP_ERR_NO_MEM;
+    }
+    mem_pool_init(&tls_pool, region, tls_classes, count);
+    tls_ready = true;
+    ESP_LOGI(TAG, "[ * ] Reserved %d bytes for the TLS buffers", (int)size);
+    return ESP_OK;
+#endif
+}
+
+#if CONFIG_MBEDTLS_CUSTOM_MEM_ALLOC
+// Allocator of mbedTLS, from the pool and from the internal heap when its class is used up
+void *esp_mbedtls_mem_calloc(size_t n, size_t size)
+{
+    if (size != 0 && n > SIZE_MAX / size) {
+        return NULL;
+    }
+    size_t bytes = n * size;
+    void *ptr = NULL;
+    size_t held = 0;
+    if (tls_ready) {
+        portENTER_CRITICAL(&pool_lock);
+        ptr = mem_pool_alloc(&tls_pool, bytes);
+        held = ptr ? mem_pool_block_size(&tls_pool, ptr) : 0;
+        portEXIT_CRITICAL(&pool_lock);
+    }
+    if (ptr) {
+        memset(ptr, 0, bytes);
+    } else {
+        ptr = heap_caps_calloc(n, size, HEAP_CAPS);
+        held = ptr ? heap_caps_get_allocated_size(ptr) : 0;
+    }
+    portENTER_CRITICAL(&pool_lock);
+    tls_in_use += held;
+    if (tls_in_use > tls_peak) {
+        tls_peak = tls_in_use;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+    return ptr;
+}
+
+void esp_mbedtls_mem_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    size_t held = 0;
+    if (tls_ready) {
+        portENTER_CRITICAL(&pool_lock);
+        held = mem_pool_block_size(&tls_pool, ptr);
+        if (held) {
+            mem_pool_free(&tls_pool, ptr);
+        }
+        portEXIT_CRITICAL(&pool_lock);
+    }
+    if (held == 0) {
+        held = heap_caps_get_allocated_size(ptr);
+        heap_caps_free(ptr);
+    }
+    portENTER_CRITICAL(&pool_lock);
+    tls_in_use -= held;
+    portEXIT_CRITICAL(&pool_lock);
+}
+#endif
+
+/**
+ * @brief Starts measuring what a subsystem allocates while it starts.
+ */
+void mem_plan_begin(const char *subsystem)
+{
+    measuring = subsystem;
+    free_at_begin = heap_caps_get_free_size(HEAP_CAPS);
+}
+
+/**
+ * @brief Ends the measurement started by mem_plan_begin().
+ */
+void mem_plan_end(void)
+{
+    if (measuring == NULL) {
+        return;
+    }
+    if (budget_count < MEM_PLAN_MAX_SUBSYSTEMS) {
+        budget[budget_count].name = measuring;
+        budget[budget_count].bytes = free_at_begin - (int)heap_caps_get_free_size(HEAP_CAPS);
+        budget_count++;
+    }
+    measuring = NULL;
+}
+
+/**
+ * @brief Logs the budget of every subsystem measured, the pools and the free heap.
+ */
+void mem_plan_report(void)
+{
+    mem_plan_stats_t stats;
+    mem_plan_get_stats(&stats);
+    int total = stats.free_bytes + (tls_ready ? tls_pool.size : 0);
+    for (int i = 0; i < budget_count; i++) {
+        total += budget[i].bytes;
+    }
+
+    ESP_LOGI(TAG, "[ * ] Heap budget at boot, of %d bytes:", total);
+    for (int i = 0; i < budget_count; i++) {
+        ESP_LOGI(TAG, "[ * ]   %-16s %7d bytes %3d%%", budget[i].name, budget[i].bytes,
+                 total > 0 ? budget[i].bytes * 100 / total : 0);
+    }
+    if (tls_ready) {
+        char classes[96];
+        int len = 0;
+        for (int i = 0; i < tls_pool.class_count && len < (int)sizeof(classes); i++) {
+            len += snprintf(classes + len, sizeof(classes) - len, "%s%u x %u", i ? ", " : "",
+                            (unsigned)tls_pool.classes[i].count, (unsigned)tls_pool.classes[i].block_size);
+        }
+        ESP_LOGI(TAG, "[ * ]   %-16s %7d bytes %3d%%, %s", "TLS pool", (int)tls_pool.size,
+                 (int)(tls_pool.size * 100 / total), classes);
+    }
+    ESP_LOGI(TAG, "[ * ]   %-16s %7d bytes %3d%%, largest block %d bytes", "free", (int)stats.free_bytes,
+             (int)((uint64_t)stats.free_bytes * 100 / total), (int)stats.largest_block);
+}
+
+static void report(const mem_plan_stats_t *s)
+{
+    char classes[96];
+    int len = 0;
+    for (int i = 0; i < s->tls_pool.class_count && len < (int)sizeof(classes); i++) {
+        len += snprintf(classes + len, sizeof(classes) - len, "%s%u/%u", i ? " " : "",
+                        (unsigned)s->tls_pool.classes[i].peak, (unsigned)s->tls_pool.classes[i].count);
+    }
+    ESP_LOGI(TAG, "[ * ] Heap %d bytes free, lowest %d, largest block %d, fragmentation %d%% (peak %d%%), "
+             "TLS pool peak %s, %d from the heap", (int)s->free_bytes, (int)s->min_free_bytes,
+             (int)s->largest_block, s->frag_pct, s->peak_frag_pct, len ? classes : "-", (int)s->tls_fallbacks);
+}
+
+static void monitor_cb(scheduler_timer_t *timer, void *arg)
+{
+    mem_plan_stats_t stats;
+    mem_plan_get_stats(&stats);
+    if (stats.frag_pct > peak_frag) {
+        peak_frag = stats.frag_pct;
+    }
+    if (peak_frag >= logged_frag + monitor_cfg.frag_step_pct) {
+        // The internal heap is made of several regions, it starts out fragmented, growth is what counts
+        ESP_LOGW(TAG, "Heap fragmentation grew to %d%%", peak_frag);
+        logged_frag = peak_frag;
+        report(&stats);
+    }
+
+    report_elapsed_s += monitor_cfg.sample_s;
+    if (monitor_cfg.report_s > 0 && report_elapsed_s >= (uint32_t)monitor_cfg.report_s) {
+        report_elapsed_s = 0;
+        report(&stats);
+    }
+    scheduler_start_after(timer, monitor_cfg.sample_s * 1000);
+}
+
+/**
+ * @brief Starts the heap monitor.
+ */
+esp_err_t mem_plan_monitor_start(const mem_plan_cfg_t *config)
+{
+    monitor_cfg = *config;
+    mem_plan_stats_t stats;
+    mem_plan_get_stats(&stats);
+    peak_frag = stats.frag_pct;
+    logged_frag = peak_frag;
+    scheduler_timer_init(&monitor_timer, monitor_cb, NULL);
+    scheduler_start_after(&monitor_timer, monitor_cfg.sample_s * 1000);
+    return ESP_OK;
+}
+
+/**
+ * @brief Reads the heap statistics, measured now.
+ */
+void mem_plan_get_stats(mem_plan_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    stats->free_bytes = heap_caps_get_free_size(HEAP_CAPS);
+    stats->min_free_bytes = heap_caps_get_minimum_free_size(HEAP_CAPS);
+    stats->largest_block = heap_caps_get_largest_free_block(HEAP_CAPS);
+    stats->frag_pct = stats->free_bytes ? 100 - (int)((uint64_t)stats->largest_block * 100 / stats->free_bytes) : 0;
+    stats->peak_frag_pct = peak_frag > stats->frag_pct ? peak_frag : stats->frag_pct;
+    if (tls_ready) {
+        portENTER_CRITICAL(&pool_lock);
+        stats->tls_pool = tls_pool;
+        portEXIT_CRITICAL(&pool_lock);
+        for (int i = 0; i < stats->tls_pool.class_count; i++) {
+            stats->tls_fallbacks += stats->tls_pool.classes[i].full;
+        }
+    }
+}
+
+/**
+ * @brief Reads what mbedTLS holds, in pool blocks and heap allocations.
+ */
+void mem_plan_tls_usage(uint32_t *in_use, uint32_t *peak)
+{
+    portENTER_CRITICAL(&pool_lock);
+    if (in_use) {
+        *in_use = tls_in_use;
+    }
+    if (peak) {
+        *peak = tls_peak;
+    }
+    portEXIT_CRITICAL(&pool_lock);
+}
+
+/**
+ * @brief Restarts the peak of mem_plan_tls_usage() from the bytes held now.
+ */
+void mem_plan_tls_reset_peak(void)
+{
+    portENTER_CRITICAL(&pool_lock);
+    tls_peak = tls_in_use;
+    portEXIT_CRITICAL(&pool_lock);
+}
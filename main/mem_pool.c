@@ -0,0 +1,110 @@
+#include <string.h>
+#include "mem_pool.h"
+
+#define ALIGN_UP(x) (((x) + 7u) & ~7u)
+
+/**
+ * @brief Returns the size of the region the classes need.
+ */
+size_t mem_pool_region_size(const mem_pool_class_cfg_t *classes, int count)
+{
+    size_t size = 0;
+    for (int i = 0; i < count && i < MEM_POOL_MAX_CLASSES; i++) {
+        size += (size_t)ALIGN_UP(classes[i].block_size) * classes[i].count;
+    }
+    return size;
+}
+
+/**
+ * @brief Lays out the classes in a region and puts all blocks on the free lists.
+ */
+void mem_pool_init(mem_pool_t *p, void *region, const mem_pool_class_cfg_t *classes, int count)
+{
+    memset(p, 0, sizeof(*p));
+    p->class_count = count < MEM_POOL_MAX_CLASSES ? count : MEM_POOL_MAX_CLASSES;
+    p->base = region;
+    uint8_t *next = region;
+    for (int i = 0; i < p->class_count; i++) {
+        mem_pool_class_t *c = &p->classes[i];
+        c->block_size = ALIGN_UP(classes[i].block_size);
+        c->count = classes[i].count;
+        c->base = next;
+        // Thread the blocks in address order, the first allocation takes the lowest
+        for (int b = c->count - 1; b >= 0; b--) {
+            void **block = (void **)(c->base + (size_t)b * c->block_size);
+            *block = c->free_list;
+            c->free_list = block;
+        }
+        next += (size_t)c->block_size * c->count;
+    }
+    p->size = next - p->base;
+}
+
+/**
+ * @brief Takes a block.
+ */
+void *mem_pool_alloc(mem_pool_t *p, size_t size)
+{
+    for (int i = 0; i < p->class_count; i++) {
+        mem_pool_class_t *c = &p->classes[i];
+        if (size > c->block_size) {
+            continue;
+        }
+        void **block = c->free_list;
+        if (block == NULL) {
+            c->full++;
+            return NULL;
+        }
+        c->free_list = *block;
+        if (++c->used > c->peak) {
+            c->peak = c->used;
+        }
+        return block;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Returns a block.
+ */
+bool mem_pool_free(mem_pool_t *p, void *ptr)
+{
+    if (!mem_pool_owns(p, ptr)) {
+        return false;
+    }
+    for (int i = p->class_count - 1; i >= 0; i--) {
+        mem_pool_class_t *c = &p->classes[i];
+        if ((uint8_t *)ptr >= c->base) {
+            void **block = ptr;
+            *block = c->free_list;
+            c->free_list = block;
+            c->used--;
+            break;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Returns the size of the block a pointer points in.
+ */
+size_t mem_pool_block_size(const mem_pool_t *p, const void *ptr)
+{
+    if (!mem_pool_owns(p, ptr)) {
+        return 0;
+    }
+    for (int i = p->class_count - 1; i >= 0; i--) {
+        if ((const uint8_t *)ptr >= p->classes[i].base) {
+            return p->classes[i].block_size;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Tells whether a pointer is in the region of the pool.
+ */
+bool mem_pool_owns(const mem_pool_t *p, const void *ptr)
+{
+    return (const uint8_t *)ptr >= p->base && (const uint8_t *)ptr < p->base + p->size;
+}
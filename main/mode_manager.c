@@ -0,0 +1,550 @@
+#include "mode_manager.h"
+
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "esp_netif.h"
+#include "nvs_flash.h"
+#include "i2s_stream.h"
+#include "input_key_service.h"
+#include "periph_wifi.h"
+#include "sdkconfig.h"
+
+#if CONFIG_SPEAKER_MODE_RADIO
+#include "radio.h"
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+#include "sdcard_player.h"
+#endif
+#include "vu_meter.h"
+#include "playback_clock.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "alarm_clock.h"
+#if CONFIG_SPEAKER_CONTROL_API
+#include "control_server.h"
+#endif
+#if CONFIG_SPEAKER_GROUP
+#include "group.h"
+#endif
+#if CONFIG_SPEAKER_UI_LCD
+#include "lcd.h"
+#endif
+#include "power_governor.h"
+#include "mem_plan.h"
+#include "trace_recorder.h"
+
+static const char *TAG = "MODE_MANAGER";
+
+/* The tuner has no audio chain yet, selecting it only parks the pipeline */
+static const player_mode_ops_t tuner_mode_ops = {
+    .name = "Tuner",
+};
+
+static const player_mode_ops_t *modes[PLAYER_MODE_COUNT] = {
+#if CONFIG_SPEAKER_MODE_RADIO
+    [PLAYER_MODE_RADIO] = &radio_mode_ops,
+#endif
+#if CONFIG_SPEAKER_MODE_SDCARD
+    [PLAYER_MODE_SDCARD] = &sdcard_mode_ops,
+#endif
+    [PLAYER_MODE_TUNER] = &tuner_mode_ops,
+#if CONFIG_SPEAKER_GROUP
+    [PLAYER_MODE_GROUP] = &group_mode_ops,
+#endif
+};
+
+static esp_periph_set_handle_t set;
+static audio_board_handle_t board_handle;
+static periph_service_handle_t input_ser;
+static audio_pipeline_handle_t pipeline;
+static audio_element_handle_t i2s_stream_writer;
+static audio_event_iface_handle_t evt;
+
+static resume_state_t resumed;
+
+static SemaphoreHandle_t mode_lock = NULL;
+// Set once every mode is initialized, keys pressed while booting are dropped
+static volatile bool modes_ready = false;
+// Carries the switches other tasks ask for to the event loop of the mode manager task
+static audio_event_iface_handle_t request_evt = NULL;
+// Unused stack of the mode manager task last logged
+static UBaseType_t stack_unused = 0;
+static player_mode_t current_mode = PLAYER_MODE_NONE;
+int player_volume = 0;
+
+// Dispatches an action of a key, the mode and volume keys work the same in every mode
+static void dispatch_key(int key_id, int action)
+{
+    if (!modes_ready)
+    {
+        return;
+    }
+    trace_recorder_key(key_id, action);
+#if CONFIG_SPEAKER_UI_LCD
+    // The open menu takes the keys, a long press on [Mode] opens it
+    if (menu_handle_key(key_id, action))
+    {
+        return;
+    }
+#endif
+    // Holding a volume key scrubs in modes that support it, a click still changes the volume
+    if ((key_id == INPUT_KEY_USER_ID_VOLUP || key_id == INPUT_KEY_USER_ID_VOLDOWN) &&
+        (action == INPUT_KEY_SERVICE_ACTION_PRESS || action == INPUT_KEY_SERVICE_ACTION_PRESS_RELEASE))
+    {
+        xSemaphoreTakeRecursive(mode_lock, portMAX_DELAY);
+        if (current_mode != PLAYER_MODE_NONE && modes[current_mode]->handle_scrub)
+        {
+            int direction = action == INPUT_KEY_SERVICE_ACTION_PRESS_RELEASE ? 0 : (key_id == INPUT_KEY_USER_ID_VOLUP ? 1 : -1);
+            modes[current_mode]->handle_scrub(direction);
+        }
+        xSemaphoreGiveRecursive(mode_lock);
+        return;
+    }
+    if (action != INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE)
+    {
+        return;
+    }
+
+    audio_hal_get_volume(board_handle->audio_hal, &player_volume);
+    switch (key_id)
+    {
+    case INPUT_KEY_USER_ID_MODE:
+        mode_manager_switch((mode_manager_get_mode() + 1) % PLAYER_MODE_COUNT);
+        break;
+    case INPUT_KEY_USER_ID_VOLUP:
+        handle_volume_up();
+        break;
+    case INPUT_KEY_USER_ID_VOLDOWN:
+        handle_volume_down();
+        break;
+    default:
+        mode_manager_send_key(key_id);
+        break;
+    }
+}
+
+// Logs the unused stack of the mode manager task when it shrank by more than a step since the last log
+static void log_stack_unused(void)
+{
+    UBaseType_t unused = uxTaskGetStackHighWaterMark(NULL);
+    if (stack_unused == 0 || unused + 256 < stack_unused)
+    {
+        BINLOGI(TAG, "[ * ] Mode manager stack: %d of %d bytes unused", (int)unused, CONFIG_SPEAKER_MODE_MANAGER_STACK_SIZE);
+        stack_unused = unused;
+    }
+}
+
+// Callback function for input key service
+static esp_err_t input_key_service_cb(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx)
+{
+    dispatch_key((int)evt->data, evt->type);
+    return ESP_OK;
+}
+
+// Initialize NVS, peripherals, Wi-Fi and the codec, shared by all modes
+static void init_peripherals()
+{
+    ESP_LOGI(TAG, "[1.0] Initialize NVS and network interface");
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES)
+    {
+        ESP_ERROR_CHECK(nvs_flash_erase());
+        err = nvs_flash_init();
+    }
+    ESP_ERROR_CHECK(esp_netif_init());
+
+    ESP_LOGI(TAG, "[1.1] Initialize peripherals: keys, sdcard and Wi-Fi");
+    esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
+    set = esp_periph_set_init(&periph_cfg);
+    audio_board_key_init(set);
+    audio_board_sdcard_init(set, SD_MODE_1_LINE);
+
+    periph_wifi_cfg_t wifi_cfg = {
+        .ssid = CONFIG_ESP_WIFI_SSID,
+        .password = CONFIG_ESP_WIFI_PASSWORD,
+    };
+    esp_periph_handle_t wifi_handle = periph_wifi_init(&wifi_cfg);
+    esp_periph_start(set, wifi_handle);
+    periph_wifi_wait_for_connected(wifi_handle, portMAX_DELAY);
+
+    ESP_LOGI(TAG, "[1.2] Start codec chip");
+    board_handle = audio_board_init();
+    audio_hal_ctrl_codec(board_handle->audio_hal, AUDIO_HAL_CODEC_MODE_DECODE, AUDIO_HAL_CTRL_START);
+
+    ESP_LOGI(TAG, "[1.3] Create and start input key service");
+    input_key_service_info_t input_key_info[] = INPUT_KEY_DEFAULT_INFO();
+    input_key_service_cfg_t input_cfg = INPUT_KEY_SERVICE_DEFAULT_CONFIG();
+    input_cfg.handle = set;
+    input_ser = input_key_service_create(&input_cfg);
+    input_key_service_add_key(input_ser, input_key_info, INPUT_KEY_NUM);
+    periph_service_set_callback(input_ser, input_key_service_cb, NULL);
+}
+
+// Create the pipeline, the i2s writer and the event interface, shared by all modes
+static void init_pipeline()
+{
+    ESP_LOGI(TAG, "[2.0] Create shared audio pipeline");
+    audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
+    pipeline = audio_pipeline_init(&pipeline_cfg);
+    mem_assert(pipeline);
+
+    ESP_LOGI(TAG, "[2.1] Create i2s stream to write data to codec chip");
+    i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
+    i2s_cfg.type = AUDIO_STREAM_WRITER;
+    // Play silence instead of repeating the last DMA buffer when a mode stops feeding data
+    i2s_cfg.i2s_config.tx_desc_auto_clear = true;
+#if CONFIG_SPEAKER_UI_LCD
+    // Non-blocking copy of the played audio for the level and spectrum display
+    i2s_cfg.multi_out_num = 1;
+#endif
+    i2s_stream_writer = i2s_stream_init(&i2s_cfg);
+    i2s_stream_set_clk(i2s_stream_writer, 48000, 16, 2);
+    vu_meter_attach(i2s_stream_writer);
+    // Count the frames handed to the DMA for the playback position
+    playback_clock_attach(i2s_stream_writer, i2s_cfg.i2s_port,
+                          i2s_cfg.i2s_config.dma_buf_count * i2s_cfg.i2s_config.dma_buf_len);
+    playback_clock_set_format(48000, 2, 16);
+    normalizer_set_format(48000, 2, 16);
+    eq_set_format(48000, 2, 16);
+    audio_pipeline_register(pipeline, i2s_stream_writer, "i2s");
+
+    ESP_LOGI(TAG, "[2.2] Listen for pipeline and peripheral events");
+    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    evt = audio_event_iface_init(&evt_cfg);
+    audio_pipeline_set_listener(pipeline, evt);
+    audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), evt);
+    audio_event_iface_cfg_t request_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    request_evt = audio_event_iface_init(&request_cfg);
+    audio_event_iface_set_listener(request_evt, evt);
+}
+
+/**
+ * @brief Task that initializes the shared resources and all modes, then dispatches events.
+ *
+ * The mode, volume and radio station saved before the last power cycle are restored,
+ * see resume_state.h.
+ *
+ * @param pvParameters Mode to start in when no state was saved, cast from player_mode_t.
+ */
+void mode_manager_task(void *pvParameters)
+{
+    // Created before the key callback and the tasks that call into the modes can run
+    mode_lock = xSemaphoreCreateRecursiveMutex();
+    // The TLS buffers are reserved before Wi-Fi and the pipelines split the heap
+    mem_plan_init();
+    // Audio, key and event paths log through the binary log ring, printed by a low priority task
+    binlog_init(1);
+    trace_recorder_init();
+    mem_plan_begin("peripherals");
+    init_peripherals();
+    mem_plan_end();
+
+    ESP_LOGI(TAG, "[1.4] Load the playback state saved before the last power cycle");
+    resume_state_cfg_t resume_cfg = RESUME_STATE_CFG_DEFAULT();
+    if (resume_state_init(&resume_cfg, &resumed) == ESP_OK)
+    {
+        ESP_LOGI(TAG, "[ * ] Saved mode %d, volume %d, station %d, song %d at %d ms", (int)resumed.mode,
+                 (int)resumed.volume, (int)resumed.station, (int)resumed.track_id, (int)resumed.position_ms);
+    }
+    if (resumed.volume >= 0 && resumed.volume <= 100)
+    {
+        player_volume = resumed.volume;
+        audio_hal_set_volume(board_handle->audio_hal, player_volume);
+    }
+
+    mem_plan_begin("vu_meter");
+    vu_meter_cfg_t vu_cfg = VU_METER_CFG_DEFAULT();
+    if (vu_meter_init(&vu_cfg) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ * ] Failed to start the level and spectrum analysis");
+    }
+    mem_plan_end();
+    normalizer_cfg_t norm_cfg = NORMALIZER_CFG_DEFAULT();
+    if (normalizer_init(&norm_cfg) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ * ] Failed to open the loudness store, songs play with the running estimate");
+    }
+    if (eq_init() != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ * ] Failed to load the equalizer preset, using the LyraT speaker preset");
+    }
+    mem_plan_begin("pipeline");
+    init_pipeline();
+    mem_plan_end();
+
+    ESP_LOGI(TAG, "[ 3 ] Initialize all modes");
+    for (int i = 0; i < PLAYER_MODE_COUNT; i++)
+    {
+        mem_plan_begin(modes[i]->name);
+        if (modes[i]->init && modes[i]->init() != ESP_OK)
+        {
+            ESP_LOGE(TAG, "[ * ] Failed to initialize %s", modes[i]->name);
+        }
+        mem_plan_end();
+    }
+    ESP_LOGI(TAG, "[ * ] Free heap with all modes allocated: %d bytes", (int)esp_get_free_heap_size());
+
+    modes_ready = true;
+    player_mode_t initial_mode = (player_mode_t)(int)pvParameters;
+    if (resumed.mode >= 0 && resumed.mode < PLAYER_MODE_COUNT)
+    {
+        initial_mode = (player_mode_t)resumed.mode;
+    }
+    mode_manager_switch(initial_mode);
+
+    ESP_LOGI(TAG, "[3.1] Start the scheduler for the talking clock, alarm and sleep timer");
+    mem_plan_begin("scheduler");
+    scheduler_cfg_t scheduler_cfg = SCHEDULER_CFG_DEFAULT();
+    if (scheduler_init(&scheduler_cfg) == ESP_OK)
+    {
+        alarm_clock_init();
+
+        ESP_LOGI(TAG, "[3.3] Start the power governor");
+        power_governor_cfg_t power_cfg = POWER_GOVERNOR_CFG_DEFAULT();
+        if (power_governor_init(&power_cfg) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "[ * ] Failed to start the power governor, the CPU stays at %d MHz", CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ);
+        }
+
+        ESP_LOGI(TAG, "[3.4] Monitor the heap fragmentation");
+        mem_plan_cfg_t mem_cfg = MEM_PLAN_CFG_DEFAULT();
+        mem_plan_monitor_start(&mem_cfg);
+    }
+    mem_plan_end();
+
+#if CONFIG_SPEAKER_CONTROL_API
+    ESP_LOGI(TAG, "[3.2] Start the control API");
+    mem_plan_begin("control_api");
+    control_server_cfg_t server_cfg = CONTROL_SERVER_CFG_DEFAULT();
+    if (control_server_start(&server_cfg) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ * ] Failed to start the control API, only the keys control the speaker");
+    }
+    mem_plan_end();
+#endif
+    mem_plan_report();
+
+    ESP_LOGI(TAG, "[ * ] Boot took %d ms", (int)(esp_timer_get_time() / 1000));
+    log_stack_unused();
+    ESP_LOGI(TAG, "[ 4 ] Press [Mode] to switch between the modes");
+#if CONFIG_SPEAKER_UI_LCD
+    ESP_LOGI(TAG, "[ * ] Hold [Mode] to open the menu");
+#endif
+    while (1)
+    {
+        audio_event_iface_msg_t msg;
+        esp_err_t ret = audio_event_iface_listen(evt, &msg, portMAX_DELAY);
+        if (ret != ESP_OK)
+        {
+            BINLOGE(TAG, "[ * ] Event interface error : %d", ret);
+            continue;
+        }
+
+        if (msg.source == (void *)request_evt)
+        {
+            mode_manager_switch((player_mode_t)msg.cmd);
+            log_stack_unused();
+            continue;
+        }
+
+        trace_recorder_event(&msg);
+        xSemaphoreTakeRecursive(mode_lock, portMAX_DELAY);
+        if (current_mode != PLAYER_MODE_NONE && modes[current_mode]->handle_event)
+        {
+            modes[current_mode]->handle_event(&msg);
+        }
+        xSemaphoreGiveRecursive(mode_lock);
+        log_stack_unused();
+#if CONFIG_SPEAKER_UI_LCD
+        // Playback starting or stopping changes the time shown
+        menu_refresh();
+#endif
+    }
+}
+
+/**
+ * @brief Switches to another mode.
+ */
+esp_err_t mode_manager_switch(player_mode_t mode)
+{
+    if (!modes_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (mode < 0 || mode >= PLAYER_MODE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    xSemaphoreTakeRecursive(mode_lock, portMAX_DELAY);
+    if (mode == current_mode)
+    {
+        xSemaphoreGiveRecursive(mode_lock);
+        return ESP_OK;
+    }
+
+    int64_t start = esp_timer_get_time();
+    int heap_before = esp_get_free_heap_size();
+
+    // Park the active mode: its element tasks stay alive, nothing is freed
+    if (current_mode != PLAYER_MODE_NONE)
+    {
+        audio_pipeline_stop(pipeline);
+        audio_pipeline_wait_for_stop(pipeline);
+        if (modes[current_mode]->deactivate)
+        {
+            modes[current_mode]->deactivate();
+        }
+    }
+
+    current_mode = mode;
+    resume_state_set_mode(mode);
+    esp_err_t ret = ESP_OK;
+    if (modes[mode]->activate)
+    {
+        ret = modes[mode]->activate();
+    }
+
+    int switch_ms = (esp_timer_get_time() - start) / 1000;
+    trace_recorder_mode(mode, switch_ms);
+    BINLOGI(TAG, "[ * ] Switched to %s in %d ms, free heap %d -> %d bytes", modes[mode]->name,
+             switch_ms, heap_before, (int)esp_get_free_heap_size());
+    xSemaphoreGiveRecursive(mode_lock);
+#if CONFIG_SPEAKER_UI_LCD
+    menu_refresh();
+#endif
+    return ret;
+}
+
+/**
+ * @brief Asks the mode manager task to switch to another mode.
+ */
+esp_err_t mode_manager_request_switch(player_mode_t mode)
+{
+    if (!modes_ready)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (mode < 0 || mode >= PLAYER_MODE_COUNT)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    audio_event_iface_msg_t msg = {0};
+    msg.source = (void *)request_evt;
+    msg.cmd = mode;
+    return audio_event_iface_sendout(request_evt, &msg);
+}
+
+/**
+ * @brief Returns the active mode.
+ */
+player_mode_t mode_manager_get_mode(void)
+{
+    return current_mode;
+}
+
+/**
+ * @brief Relinks the shared pipeline for the active mode and starts it.
+ */
+esp_err_t mode_manager_run_chain(const char **link_tag, int link_num)
+{
+    audio_pipeline_relink(pipeline, link_tag, link_num);
+    audio_pipeline_set_listener(pipeline, evt);
+    audio_pipeline_reset_ringbuffer(pipeline);
+    audio_pipeline_reset_elements(pipeline);
+    audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
+    return audio_pipeline_run(pipeline);
+}
+
+audio_pipeline_handle_t mode_manager_get_pipeline(void)
+{
+    return pipeline;
+}
+
+audio_element_handle_t mode_manager_get_i2s_writer(void)
+{
+    return i2s_stream_writer;
+}
+
+audio_event_iface_handle_t mode_manager_get_event_iface(void)
+{
+    return evt;
+}
+
+esp_periph_set_handle_t mode_manager_get_periph_set(void)
+{
+    return set;
+}
+
+audio_board_handle_t mode_manager_get_board(void)
+{
+    return board_handle;
+}
+
+const resume_state_t *mode_manager_get_resume_state(void)
+{
+    return &resumed;
+}
+
+/**
+ * @brief Takes the mode lock, for tasks that call into the active mode.
+ */
+void mode_manager_lock(void)
+{
+    xSemaphoreTakeRecursive(mode_lock, portMAX_DELAY);
+}
+
+void mode_manager_unlock(void)
+{
+    xSemaphoreGiveRecursive(mode_lock);
+}
+
+/**
+ * @brief Passes a key click to the active mode, as if the key was clicked on the board.
+ */
+void mode_manager_send_key(int key_id)
+{
+    xSemaphoreTakeRecursive(mode_lock, portMAX_DELAY);
+    if (current_mode != PLAYER_MODE_NONE && modes[current_mode]->handle_key)
+    {
+        modes[current_mode]->handle_key(key_id);
+    }
+    xSemaphoreGiveRecursive(mode_lock);
+}
+
+/**
+ * @brief Acts on a key action as if it came from the board keys.
+ */
+void mode_manager_inject_key(int key_id, int action)
+{
+    dispatch_key(key_id, action);
+}
+
+/**
+ * @brief Sets the codec volume, shared by all modes.
+ */
+void mode_manager_set_volume(int volume)
+{
+    player_volume = volume < 0 ? 0 : (volume > 100 ? 100 : volume);
+    audio_hal_set_volume(board_handle->audio_hal, player_volume);
+    resume_state_set_volume(player_volume);
+}
+
+int mode_manager_get_volume(void)
+{
+    return player_volume;
+}
+
+// Adjust volume up
+void handle_volume_up()
+{
+    mode_manager_set_volume(player_volume + 10);
+    BINLOGW(TAG, "[ * ] Volume set to %d %%", player_volume);
+}
+
+// Adjust volume down
+void handle_volume_down()
+{
+    mode_manager_set_volume(player_volume - 10);
+    BINLOGW(TAG, "[ * ] Volume set to %d %%", player_volume);
+}
@@ -0,0 +1,66 @@
+#include <stddef.h>
+#include "mp3_frame.h"
+
+// Layer III bitrates in kbit/s, MPEG-1 and MPEG-2/2.5
+static const uint16_t bitrates[2][15] = {
+    {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320},
+    {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+};
+
+// MPEG-1 sample rates, halved for MPEG-2 and quartered for MPEG-2.5
+static const uint16_t sample_rates[3] = {44100, 48000, 32000};
+
+/**
+ * @brief Parses a layer III frame header.
+ */
+int mp3_frame_parse_header(const uint8_t *header, mp3_frame_info_t *info)
+{
+    if (header[0] != 0xFF || (header[1] & 0xE0) != 0xE0) {
+        return 0;
+    }
+
+    int version = (header[1] >> 3) & 0x03;  // 0: MPEG-2.5, 1: reserved, 2: MPEG-2, 3: MPEG-1
+    int layer = (header[1] >> 1) & 0x03;    // 1: layer III
+    int bitrate_index = header[2] >> 4;
+    int rate_index = (header[2] >> 2) & 0x03;
+    int padding = (header[2] >> 1) & 0x01;
+    if (version == 1 || layer != 1 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return 0;
+    }
+
+    int mpeg1 = version == 3;
+    int bitrate = bitrates[mpeg1 ? 0 : 1][bitrate_index];
+    int sample_rate = sample_rates[rate_index] >> (mpeg1 ? 0 : (version == 2 ? 1 : 2));
+    int frame_len = (mpeg1 ? 144 : 72) * bitrate * 1000 / sample_rate + padding;
+
+    if (info) {
+        info->sample_rate = sample_rate;
+        info->bitrate = bitrate;
+        info->channels = (header[3] >> 6) == 3 ? 1 : 2;
+        info->frame_len = frame_len;
+    }
+    return frame_len;
+}
+
+/**
+ * @brief Finds the first frame header in a buffer.
+ */
+int mp3_frame_find_sync(const uint8_t *buf, int len)
+{
+    for (int i = 0; i + MP3_FRAME_HEADER_LEN <= len; i++) {
+        mp3_frame_info_t info;
+        if (buf[i] != 0xFF || mp3_frame_parse_header(&buf[i], &info) == 0) {
+            continue;
+        }
+
+        int next = i + info.frame_len;
+        if (next + MP3_FRAME_HEADER_LEN > len) {
+            return i;
+        }
+        mp3_frame_info_t next_info;
+        if (mp3_frame_parse_header(&buf[next], &next_info) != 0 && next_info.sample_rate == info.sample_rate) {
+            return i;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,314 @@
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "sdcard_scan.h"
+#include "loudness.h"
+#include "wav_file.h"
+#include "pcm_convert.h"
+#include "normalizer.h"
+#include "power_governor.h"
+#include "playlist_file.h"
+
+static const char *TAG = "NORMALIZER";
+
+#define NVS_NAMESPACE "loudness"
+
+/* Unity gain in Q12 */
+#define GAIN_ONE 4096
+
+/* Limiter release, the reduction recovers by 1/2^RELEASE_SHIFT per frame, about 170 ms at 48 kHz */
+#define RELEASE_SHIFT 13
+
+/* Blocks the running estimate needs before it moves the gain, 3 seconds */
+#define FOLLOW_MIN_BLOCKS 30
+
+typedef enum {
+    GAIN_BYPASS,
+    GAIN_FIXED,
+    GAIN_FOLLOW,
+} gain_mode_t;
+
+static normalizer_cfg_t norm_cfg;
+static nvs_handle_t nvs = 0;
+static bool nvs_ready = false;
+static int32_t ceiling = 32767;
+
+// Set by the control tasks, read by the I2S write path
+static volatile gain_mode_t gain_mode = GAIN_BYPASS;
+static volatile int32_t fixed_gain = GAIN_ONE;
+static volatile bool restart_estimate = true;
+static volatile int out_rate = 48000;
+static volatile int out_channels = 2;
+static volatile int out_bits = 16;
+
+// State of the I2S write path
+static loudness_meter_t live_meter;
+static int32_t gain = GAIN_ONE;
+static int32_t limit = GAIN_ONE;
+static float follow_db = 0;
+static int32_t follow_gain = GAIN_ONE;
+static int follow_frames = 0;
+
+// State of the scan task
+static loudness_meter_t scan_meter;
+static pcm_convert_t scan_conv;
+// Aligned for 32-bit samples
+static int16_t scan_buf[1024] __attribute__((aligned(4)));
+
+static int32_t db_to_gain(float db)
+{
+    return (int32_t)lroundf(GAIN_ONE * powf(10.0f, db / 20.0f));
+}
+
+// Gain in dB that brings a loudness in LUFS times 10 to the target, within the configured range
+static float gain_for_loudness(int lufs10)
+{
+    float db = norm_cfg.target_lufs - lufs10 / 10.0f;
+    db = db > norm_cfg.max_gain_db ? norm_cfg.max_gain_db : db;
+    return db < -norm_cfg.max_gain_db ? -norm_cfg.max_gain_db : db;
+}
+
+// NVS key of a file, a hash of its path since keys are limited to 15 characters
+static void make_key(const char *path, char *key, int size)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *p = path; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    snprintf(key, size, "l%08x", (unsigned)hash);
+}
+
+static esp_err_t load_loudness(const char *path, int16_t *lufs10)
+{
+    char key[16];
+    make_key(path, key, sizeof(key));
+    return nvs_ready ? nvs_get_i16(nvs, key, lufs10) : ESP_ERR_INVALID_STATE;
+}
+
+static void store_loudness(const char *path, int16_t lufs10)
+{
+    char key[16];
+    make_key(path, key, sizeof(key));
+    if (nvs_set_i16(nvs, key, lufs10) != ESP_OK || nvs_commit(nvs) != ESP_OK) {
+        ESP_LOGW(TAG, "Failed to store the loudness of %s", path);
+    }
+}
+
+/**
+ * @brief Measures one file, called by sdcard_scan() for every WAV file.
+ *
+ * Files that were measured before are skipped, so an interrupted scan continues where
+ * it stopped. Files that cannot be measured are stored as LOUDNESS_UNKNOWN and play
+ * with the running estimate.
+ */
+static void scan_file(void *user_data, char *path)
+{
+    int16_t lufs10;
+    if (load_loudness(path, &lufs10) == ESP_OK) {
+        return;
+    }
+
+    FILE *file = fopen(playlist_file_vfs_path(path), "rb");
+    if (file == NULL) {
+        return;
+    }
+    wav_file_info_t wav;
+    int result = LOUDNESS_UNKNOWN;
+    int64_t start_us = esp_timer_get_time();
+    if (wav_file_parse(file, &wav) == ESP_OK && pcm_format_of(&wav) != PCM_FORMAT_NONE) {
+        pcm_convert_init(&scan_conv, pcm_format_of(&wav));
+        loudness_meter_init(&scan_meter, wav.sample_rate, wav.channels);
+        // Whole frames, 8-bit samples are read into the upper half and grow into the buffer
+        int room = scan_conv.format == PCM_FORMAT_U8 ? sizeof(scan_buf) / 2 : sizeof(scan_buf);
+        room -= room % wav.block_align;
+        uint32_t left = wav.data_size;
+        while (left > 0) {
+            int want = left < (uint32_t)room ? (int)left : room;
+            uint8_t *raw = (uint8_t *)scan_buf + (scan_conv.format == PCM_FORMAT_U8 ? want : 0);
+            int r = fread(raw, 1, want, file);
+            if (r < wav.block_align) {
+                break;
+            }
+            int frames = r / wav.block_align;
+            pcm_convert_to_s16(&scan_conv, raw, frames * wav.channels, scan_buf);
+            loudness_meter_process(&scan_meter, scan_buf, frames);
+            left -= r;
+        }
+        result = loudness_meter_integrated(&scan_meter);
+    }
+    fclose(file);
+
+    store_loudness(path, result);
+    if (result != LOUDNESS_UNKNOWN) {
+        // Seconds of audio measured per second of scanning
+        int64_t elapsed_us = esp_timer_get_time() - start_us;
+        uint32_t audio_ms = wav_file_duration_ms(&wav);
+        ESP_LOGI(TAG, "%s: %d.%d LUFS, %u ms of audio in %u ms", path, result / 10,
+                 (result < 0 ? -result : result) % 10, (unsigned)audio_ms, (unsigned)(elapsed_us / 1000));
+    }
+}
+
+static void scan_task(void *pvParameters)
+{
+    const char *dir = (const char *)pvParameters;
+    ESP_LOGI(TAG, "[ * ] Measuring the loudness of the WAV files in %s", dir);
+    power_governor_hold();
+    sdcard_scan(scan_file, dir, 0, (const char *[]){"wav"}, 1, NULL);
+    power_governor_release();
+    ESP_LOGI(TAG, "[ * ] Loudness of all WAV files in %s measured", dir);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Opens the loudness store.
+ */
+esp_err_t normalizer_init(const normalizer_cfg_t *config)
+{
+    norm_cfg = *config;
+    ceiling = db_to_gain(norm_cfg.ceiling_db) * 32767 / GAIN_ONE;
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    nvs_ready = true;
+    return ESP_OK;
+}
+
+/**
+ * @brief Starts measuring the WAV files in a directory in the background.
+ */
+esp_err_t normalizer_scan_start(const char *dir)
+{
+    if (!nvs_ready) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Idle priority: the scan only gets the CPU time nothing else wants
+    if (xTaskCreate(scan_task, "loudness_scan", norm_cfg.scan_stack, (void *)dir, tskIDLE_PRIORITY, NULL) != pdPASS) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Uses the stored loudness of a file, or the running estimate when it was not measured yet.
+ */
+void normalizer_select_track(const char *path)
+{
+    int16_t lufs10;
+    if (path && load_loudness(path, &lufs10) == ESP_OK && lufs10 != LOUDNESS_UNKNOWN) {
+        fixed_gain = db_to_gain(gain_for_loudness(lufs10));
+        gain_mode = GAIN_FIXED;
+        return;
+    }
+    normalizer_follow_stream();
+}
+
+/**
+ * @brief Follows the running estimate of a stream from its start.
+ */
+void normalizer_follow_stream(void)
+{
+    restart_estimate = true;
+    gain_mode = GAIN_FOLLOW;
+}
+
+/**
+ * @brief Plays at unity gain, for announcements and sounds.
+ */
+void normalizer_bypass(void)
+{
+    gain_mode = GAIN_BYPASS;
+}
+
+/**
+ * @brief Sets the format of the audio written to I2S.
+ */
+void normalizer_set_format(int rate, int channels, int bits)
+{
+    if (rate <= 0 || channels < 1 || channels > 2) {
+        return;
+    }
+    out_rate = rate;
+    out_channels = channels;
+    out_bits = bits;
+    restart_estimate = true;
+}
+
+// Moves the running estimate gain towards the measured loudness, once per second of audio
+static void update_follow_gain(const int16_t *pcm, int frames, int rate, int channels)
+{
+    if (restart_estimate) {
+        restart_estimate = false;
+        loudness_meter_init(&live_meter, rate, channels);
+        follow_frames = 0;
+    }
+    loudness_meter_process(&live_meter, pcm, frames);
+    follow_frames += frames;
+    if (follow_frames < rate) {
+        return;
+    }
+    follow_frames -= rate;
+
+    int lufs10 = loudness_meter_integrated(&live_meter);
+    if (live_meter.blocks < FOLLOW_MIN_BLOCKS || lufs10 == LOUDNESS_UNKNOWN) {
+        return;
+    }
+    float step = gain_for_loudness(lufs10) - follow_db;
+    step = step > NORMALIZER_SLEW_DB_PER_S ? NORMALIZER_SLEW_DB_PER_S : step;
+    step = step < -NORMALIZER_SLEW_DB_PER_S ? -NORMALIZER_SLEW_DB_PER_S : step;
+    follow_db += step;
+    follow_gain = db_to_gain(follow_db);
+}
+
+/**
+ * @brief Applies the gain and the limiter in place.
+ *
+ * The gain ramps linearly over the buffer to a new value, so changes do not click.
+ */
+void normalizer_process(char *buffer, int len)
+{
+    gain_mode_t mode = gain_mode;
+    int channels = out_channels;
+    if (out_bits != 16 || (mode == GAIN_BYPASS && gain == GAIN_ONE && limit == GAIN_ONE)) {
+        return;
+    }
+    int16_t *pcm = (int16_t *)buffer;
+    int frames = len / (channels * sizeof(int16_t));
+    if (frames <= 0) {
+        return;
+    }
+
+    int32_t target = GAIN_ONE;
+    if (mode == GAIN_FIXED) {
+        target = fixed_gain;
+    } else if (mode == GAIN_FOLLOW) {
+        update_follow_gain(pcm, frames, out_rate, channels);
+        target = follow_gain;
+    }
+
+    // Q12 gain stepped in Q20 for a smooth ramp
+    int32_t g = gain << 8;
+    int32_t step = ((target - gain) << 8) / frames;
+    for (int i = 0; i < frames; i++) {
+        g += step;
+        int32_t frame_gain = g >> 8;
+        for (int c = 0; c < channels; c++) {
+            int32_t v = (pcm[i * channels + c] * frame_gain) >> 12;
+            int32_t a = v < 0 ? -v : v;
+            // Instant attack: reduce just enough to keep this sample at the ceiling
+            if (((a * limit) >> 12) > ceiling) {
+                limit = ceiling * GAIN_ONE / a;
+            }
+            pcm[i * channels + c] = (v * limit) >> 12;
+        }
+        limit += (GAIN_ONE - limit + (1 << RELEASE_SHIFT) - 1) >> RELEASE_SHIFT;
+    }
+    gain = target;
+}
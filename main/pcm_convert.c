@@ -0,0 +1,159 @@
+#include <string.h>
+#include "pcm_convert.h"
+
+/* Largest float below 1.0, scaled by 2^31 it still fits into int32_t */
+#define FLOAT_MAX 0.99999994f
+
+/**
+ * @brief Returns the sample format of a WAV file.
+ */
+pcm_format_t pcm_format_of(const wav_file_info_t *info)
+{
+    pcm_format_t format = PCM_FORMAT_NONE;
+    if (info->format == WAV_FORMAT_PCM) {
+        switch (info->bits) {
+        case 8:
+            format = PCM_FORMAT_U8;
+            break;
+        case 16:
+            format = PCM_FORMAT_S16;
+            break;
+        case 24:
+            format = PCM_FORMAT_S24;
+            break;
+        case 32:
+            format = PCM_FORMAT_S32;
+            break;
+        }
+    } else if (info->format == WAV_FORMAT_IEEE_FLOAT && info->bits == 32) {
+        format = PCM_FORMAT_F32;
+    }
+    if (info->channels < 1 || info->channels > 2 || info->block_align != info->channels * info->bits / 8) {
+        return PCM_FORMAT_NONE;
+    }
+    return format;
+}
+
+/**
+ * @brief Sets up a converter.
+ */
+void pcm_convert_init(pcm_convert_t *conv, pcm_format_t format)
+{
+    static const uint8_t bytes[] = {
+        [PCM_FORMAT_U8] = 1,
+        [PCM_FORMAT_S16] = 2,
+        [PCM_FORMAT_S24] = 3,
+        [PCM_FORMAT_S32] = 4,
+        [PCM_FORMAT_F32] = 4,
+    };
+    conv->format = format;
+    conv->bytes = bytes[format];
+    // Any non-zero seeds, different per lane
+    conv->seed[0] = 0x9E3779B9;
+    conv->seed[1] = 0x7F4A7C15;
+    conv->seed[2] = 0xF39CC060;
+    conv->seed[3] = 0x5CEDC834;
+}
+
+static void load_s24(const uint8_t *in, int n, int32_t *x)
+{
+    for (int i = 0; i < n; i++, in += 3) {
+        x[i] = (int32_t)((uint32_t)in[0] << 8 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 24);
+    }
+}
+
+static void load_f32(const float *in, int n, int32_t *x)
+{
+    for (int i = 0; i < n; i++) {
+        float f = in[i];
+        f = f > FLOAT_MAX ? FLOAT_MAX : f;
+        // Also turns NaN into silence, it fails both comparisons
+        f = f >= -1.0f ? f : (f < 0.0f ? -1.0f : 0.0f);
+        x[i] = (int32_t)(f * 2147483648.0f);
+    }
+}
+
+static inline uint32_t xorshift32(uint32_t s)
+{
+    s ^= s << 13;
+    s ^= s >> 17;
+    s ^= s << 5;
+    return s;
+}
+
+static inline int16_t narrow(int32_t x, uint32_t r)
+{
+    // Difference of two uniform 16-bit values: triangular, +-1 LSB of the output
+    int32_t d = (int32_t)(r & 0xffff) - (int32_t)(r >> 16);
+    // Halved first so x + d + rounding cannot overflow
+    int32_t v = ((x >> 1) + (d >> 1) + (1 << 14)) >> 15;
+    v = v < INT16_MIN ? INT16_MIN : v;
+    v = v > INT16_MAX ? INT16_MAX : v;
+    return v;
+}
+
+static void narrow_dither(pcm_convert_t *conv, const int32_t *x, int n, int16_t *out)
+{
+    uint32_t s0 = conv->seed[0], s1 = conv->seed[1], s2 = conv->seed[2], s3 = conv->seed[3];
+    int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 = xorshift32(s0);
+        s1 = xorshift32(s1);
+        s2 = xorshift32(s2);
+        s3 = xorshift32(s3);
+        out[i] = narrow(x[i], s0);
+        out[i + 1] = narrow(x[i + 1], s1);
+        out[i + 2] = narrow(x[i + 2], s2);
+        out[i + 3] = narrow(x[i + 3], s3);
+    }
+    for (; i < n; i++) {
+        s0 = xorshift32(s0);
+        out[i] = narrow(x[i], s0);
+    }
+    conv->seed[0] = s0;
+    conv->seed[1] = s1;
+    conv->seed[2] = s2;
+    conv->seed[3] = s3;
+}
+
+/**
+ * @brief Converts samples to 16-bit.
+ */
+void pcm_convert_to_s16(pcm_convert_t *conv, const void *in, int samples, int16_t *out)
+{
+    const uint8_t *src = in;
+    if (conv->format == PCM_FORMAT_S16) {
+        if ((const void *)out != in) {
+            memmove(out, in, samples * sizeof(int16_t));
+        }
+        return;
+    }
+    if (conv->format == PCM_FORMAT_U8) {
+        for (int i = 0; i < samples; i++) {
+            out[i] = (int16_t)((src[i] - 128) * 256);
+        }
+        return;
+    }
+
+    // A block is loaded whole before it is written, and the output is never wider
+    // than the input, so converting in place does not overwrite unread samples
+    int32_t x[PCM_CONVERT_BLOCK];
+    for (int done = 0; done < samples; done += PCM_CONVERT_BLOCK) {
+        int n = samples - done < PCM_CONVERT_BLOCK ? samples - done : PCM_CONVERT_BLOCK;
+        const uint8_t *block = src + done * conv->bytes;
+        switch (conv->format) {
+        case PCM_FORMAT_S24:
+            load_s24(block, n, x);
+            break;
+        case PCM_FORMAT_S32:
+            memcpy(x, block, n * sizeof(int32_t));
+            break;
+        case PCM_FORMAT_F32:
+            load_f32((const float *)block, n, x);
+            break;
+        default:
+            return;
+        }
+        narrow_dither(conv, x, n, out + done);
+    }
+}
@@ -0,0 +1,334 @@
+#include "phrase.h"
+
+/* Bytes of compiled plans, the rules below take 1010 */
+#define POOL_SIZE 1088
+
+/*
+ * Slots of a compiled plan, above every clip id. They are filled when a phrase is built.
+ */
+#define SLOT_HOUR_12 0xf0       /* Hour on a 12 hour dial, 0xf1 for the next hour */
+#define SLOT_HOUR_24 0xf2       /* Hour as a 24 hour clock shows it */
+#define SLOT_DAYPART 0xf3       /* Part of the day of the hour */
+
+/* How a token gets a value from the value x the rule is compiled for */
+typedef enum {
+    VALUE_X,            /* x + add */
+    VALUE_MINUS_X,      /* add - x */
+    VALUE_UNITS,        /* x % 10 */
+    VALUE_TENS,         /* x - x % 10 */
+} value_t;
+
+typedef enum {
+    TOKEN_END = 0,
+    TOKEN_WORD,         /* The clip in add */
+    TOKEN_CLIP,         /* The clip whose id is the value, for the numbers below 100 */
+    TOKEN_NUMBER,       /* The compiled plan of the number the value is, 0 to 99 */
+    TOKEN_SLOT,         /* The slot in add */
+} token_kind_t;
+
+typedef struct {
+    uint8_t kind;
+    uint8_t value;
+    int16_t add;
+} token_t;
+
+#define WORD(clip) {TOKEN_WORD, VALUE_X, (clip)}
+#define CLIP(value) {TOKEN_CLIP, (value), 0}
+#define NUMBER(value, add) {TOKEN_NUMBER, (value), (add)}
+#define SLOT(slot) {TOKEN_SLOT, VALUE_X, (slot)}
+
+/* Words of the values from..to in steps of step, the first rule that covers a value is used */
+typedef struct {
+    uint8_t from;
+    uint8_t to;
+    uint8_t step;
+    token_t tokens[6];
+} rule_t;
+
+static const rule_t number_rules[] = {
+    {0, 19, 1, {CLIP(VALUE_X)}},                                                // nul .. negentien
+    {20, 90, 10, {CLIP(VALUE_X)}},                                              // twintig .. negentig
+    {21, 99, 1, {CLIP(VALUE_UNITS), WORD(VOICE_CLIP_EN), CLIP(VALUE_TENS)}},    // een en twintig
+};
+
+static const rule_t digital_rules[] = {
+    {0, 0, 1, {SLOT(SLOT_HOUR_24), WORD(VOICE_CLIP_UUR)}},                              // drie uur
+    {1, 59, 1, {SLOT(SLOT_HOUR_24), WORD(VOICE_CLIP_UUR), NUMBER(VALUE_X, 0)}},         // drie uur twintig
+};
+
+static const rule_t second_rules[] = {
+    {0, 0, 1, {{TOKEN_END}}},
+    {1, 1, 1, {WORD(VOICE_CLIP_EN), NUMBER(VALUE_X, 0), WORD(VOICE_CLIP_SECONDE)}},     // en een seconde
+    {2, 59, 1, {WORD(VOICE_CLIP_EN), NUMBER(VALUE_X, 0), WORD(VOICE_CLIP_SECONDEN)}},   // en vijf seconden
+};
+
+static const rule_t colloquial_rules[] = {
+    {0, 0, 1, {SLOT(SLOT_HOUR_12), WORD(VOICE_CLIP_UUR), SLOT(SLOT_DAYPART)}},
+    {15, 15, 1, {WORD(VOICE_CLIP_KWART), WORD(VOICE_CLIP_OVER), SLOT(SLOT_HOUR_12), SLOT(SLOT_DAYPART)}},
+    {1, 14, 1, {NUMBER(VALUE_X, 0), WORD(VOICE_CLIP_OVER), SLOT(SLOT_HOUR_12), SLOT(SLOT_DAYPART)}},
+    {16, 29, 1, {NUMBER(VALUE_MINUS_X, 30), WORD(VOICE_CLIP_VOOR), WORD(VOICE_CLIP_HALF),
+                 SLOT(SLOT_HOUR_12 + 1), SLOT(SLOT_DAYPART)}},                          // tien voor half vier
+    {30, 30, 1, {WORD(VOICE_CLIP_HALF), SLOT(SLOT_HOUR_12 + 1), SLOT(SLOT_DAYPART)}},
+    {31, 44, 1, {NUMBER(VALUE_X, -30), WORD(VOICE_CLIP_OVER), WORD(VOICE_CLIP_HALF),
+                 SLOT(SLOT_HOUR_12 + 1), SLOT(SLOT_DAYPART)}},                          // vijf over half vier
+    {45, 45, 1, {WORD(VOICE_CLIP_KWART), WORD(VOICE_CLIP_VOOR), SLOT(SLOT_HOUR_12 + 1), SLOT(SLOT_DAYPART)}},
+    {46, 59, 1, {NUMBER(VALUE_MINUS_X, 60), WORD(VOICE_CLIP_VOOR), SLOT(SLOT_HOUR_12 + 1), SLOT(SLOT_DAYPART)}},
+};
+
+/* Part of the day said after a colloquial time, by the hour */
+static const uint8_t dayparts[24] = {
+    VOICE_CLIP_S_NACHTS, VOICE_CLIP_S_NACHTS, VOICE_CLIP_S_NACHTS,
+    VOICE_CLIP_S_NACHTS, VOICE_CLIP_S_NACHTS, VOICE_CLIP_S_NACHTS,
+    VOICE_CLIP_S_OCHTENDS, VOICE_CLIP_S_OCHTENDS, VOICE_CLIP_S_OCHTENDS,
+    VOICE_CLIP_S_OCHTENDS, VOICE_CLIP_S_OCHTENDS, VOICE_CLIP_S_OCHTENDS,
+    VOICE_CLIP_S_MIDDAGS, VOICE_CLIP_S_MIDDAGS, VOICE_CLIP_S_MIDDAGS,
+    VOICE_CLIP_S_MIDDAGS, VOICE_CLIP_S_MIDDAGS, VOICE_CLIP_S_MIDDAGS,
+    VOICE_CLIP_S_AVONDS, VOICE_CLIP_S_AVONDS, VOICE_CLIP_S_AVONDS,
+    VOICE_CLIP_S_AVONDS, VOICE_CLIP_S_AVONDS, VOICE_CLIP_S_AVONDS,
+};
+
+/* Groups of a number above 99, largest first. Their count is said before the word, a count of one is left out */
+static const struct {
+    int value;
+    uint8_t word;
+} groups[] = {
+    {1000, VOICE_CLIP_DUIZEND},
+    {100, VOICE_CLIP_HONDERD},
+};
+
+/* Compiled plan of a value: count bytes from offset in the pool */
+typedef struct {
+    uint16_t offset;
+    uint8_t count;
+} plan_ref_t;
+
+static uint8_t pool[POOL_SIZE];
+static int pool_used;
+static plan_ref_t numbers[100];
+static plan_ref_t digital[60];
+static plan_ref_t seconds[60];
+static plan_ref_t colloquial[60];
+static bool compiled;
+
+static int token_value(const token_t *token, int x)
+{
+    switch (token->value) {
+    case VALUE_MINUS_X:
+        return token->add - x;
+    case VALUE_UNITS:
+        return x % 10;
+    case VALUE_TENS:
+        return x - x % 10;
+    default:
+        return x + token->add;
+    }
+}
+
+static bool emit(uint8_t byte)
+{
+    if (pool_used >= POOL_SIZE) {
+        return false;
+    }
+    pool[pool_used++] = byte;
+    return true;
+}
+
+// Expands the rules into a plan for each value 0..count-1, a value without rule gets an empty plan
+static bool compile(const rule_t *rules, int rule_count, plan_ref_t *plans, int count)
+{
+    for (int x = 0; x < count; x++) {
+        const rule_t *rule = NULL;
+        for (int r = 0; r < rule_count && rule == NULL; r++) {
+            if (x >= rules[r].from && x <= rules[r].to && (x - rules[r].from) % rules[r].step == 0) {
+                rule = &rules[r];
+            }
+        }
+        plans[x].offset = pool_used;
+        for (const token_t *token = rule ? rule->tokens : NULL; token && token->kind != TOKEN_END; token++) {
+            bool ok = true;
+            switch (token->kind) {
+            case TOKEN_WORD:
+            case TOKEN_SLOT:
+                ok = emit(token->add);
+                break;
+            case TOKEN_CLIP:
+                ok = emit(token_value(token, x));
+                break;
+            case TOKEN_NUMBER: {
+                // Only refers to numbers, which are compiled first
+                const plan_ref_t *number = &numbers[token_value(token, x)];
+                for (int i = 0; i < number->count && ok; i++) {
+                    ok = emit(pool[number->offset + i]);
+                }
+                break;
+            }
+            }
+            if (!ok) {
+                return false;
+            }
+        }
+        plans[x].count = pool_used - plans[x].offset;
+    }
+    return true;
+}
+
+#define COMPILE(rules, plans) compile(rules, sizeof(rules) / sizeof(rules[0]), plans, sizeof(plans) / sizeof(plans[0]))
+
+/**
+ * @brief Compiles the rules, only the first call does the work.
+ */
+bool phrase_init(void)
+{
+    if (compiled) {
+        return true;
+    }
+    pool_used = 0;
+    compiled = COMPILE(number_rules, numbers) && COMPILE(digital_rules, digital) &&
+               COMPILE(second_rules, seconds) && COMPILE(colloquial_rules, colloquial);
+    return compiled;
+}
+
+/**
+ * @brief Empties a plan.
+ */
+void phrase_clear(phrase_plan_t *plan)
+{
+    plan->count = 0;
+    plan->overflow = false;
+}
+
+/**
+ * @brief Appends a clip.
+ */
+bool phrase_add(phrase_plan_t *plan, uint16_t clip)
+{
+    if (plan->count >= PHRASE_MAX_CLIPS) {
+        plan->overflow = true;
+        return false;
+    }
+    plan->clips[plan->count++] = clip;
+    return true;
+}
+
+// Appends a compiled plan, filling its slots for an hour
+static bool add_plan(phrase_plan_t *plan, const plan_ref_t *ref, int hour)
+{
+    for (int i = 0; i < ref->count; i++) {
+        uint8_t byte = pool[ref->offset + i];
+        switch (byte) {
+        case SLOT_HOUR_12:
+        case SLOT_HOUR_12 + 1: {
+            int dial = (hour + byte - SLOT_HOUR_12) % 12;
+            add_plan(plan, &numbers[dial == 0 ? 12 : dial], 0);
+            break;
+        }
+        case SLOT_HOUR_24:
+            add_plan(plan, &numbers[hour], 0);
+            break;
+        case SLOT_DAYPART:
+            phrase_add(plan, dayparts[hour]);
+            break;
+        default:
+            phrase_add(plan, byte);
+            break;
+        }
+    }
+    return !plan->overflow;
+}
+
+/**
+ * @brief Appends the words of a number.
+ */
+bool phrase_number(phrase_plan_t *plan, int num)
+{
+    if (!phrase_init() || num < 0 || num > PHRASE_NUMBER_MAX) {
+        phrase_add(plan, VOICE_CLIP_INVALID);
+        return false;
+    }
+    for (int i = 0; i < (int)(sizeof(groups) / sizeof(groups[0])); i++) {
+        int count = num / groups[i].value;
+        if (count == 0) {
+            continue;
+        }
+        if (count > 1) {
+            add_plan(plan, &numbers[count], 0);
+        }
+        phrase_add(plan, groups[i].word);
+        num %= groups[i].value;
+        if (num == 0) {
+            return !plan->overflow;
+        }
+    }
+    return add_plan(plan, &numbers[num], 0);
+}
+
+/**
+ * @brief Appends the words of a year: "negentienhonderd vierentachtig", "tweeduizend zes".
+ */
+bool phrase_year(phrase_plan_t *plan, int year)
+{
+    // Years of the second millennium are said in hundreds, from elfhonderd to negentienhonderd negenennegentig
+    if (year >= 1100 && year < 2000) {
+        if (!phrase_init()) {
+            return false;
+        }
+        add_plan(plan, &numbers[year / 100], 0);
+        phrase_add(plan, VOICE_CLIP_HONDERD);
+        return year % 100 == 0 ? !plan->overflow : add_plan(plan, &numbers[year % 100], 0);
+    }
+    return phrase_number(plan, year);
+}
+
+/**
+ * @brief Appends the words of a time, without "het is".
+ */
+bool phrase_time(phrase_plan_t *plan, const struct tm *timeinfo, phrase_time_style_t style)
+{
+    int hour = timeinfo->tm_hour;
+    int min = timeinfo->tm_min;
+    int sec = timeinfo->tm_sec;
+    // A leap second is said as the last second of the minute
+    if (!phrase_init() || hour < 0 || hour > 23 || min < 0 || min > 59 || sec < 0 || sec > 60) {
+        phrase_add(plan, VOICE_CLIP_INVALID);
+        return false;
+    }
+    if (style == PHRASE_TIME_COLLOQUIAL) {
+        return add_plan(plan, &colloquial[min], hour);
+    }
+    add_plan(plan, &digital[min], hour);
+    if (style == PHRASE_TIME_DIGITAL_SECONDS) {
+        add_plan(plan, &seconds[sec > 59 ? 59 : sec], hour);
+    }
+    return !plan->overflow;
+}
+
+/**
+ * @brief Appends the words of a date: weekday, day, month and year.
+ */
+bool phrase_date(phrase_plan_t *plan, const struct tm *timeinfo)
+{
+    int year = timeinfo->tm_year + 1900;
+    if (timeinfo->tm_wday < 0 || timeinfo->tm_wday > 6 || timeinfo->tm_mday < 1 || timeinfo->tm_mday > 31 ||
+        timeinfo->tm_mon < 0 || timeinfo->tm_mon > 11 || year < 0 || year > PHRASE_NUMBER_MAX) {
+        phrase_add(plan, VOICE_CLIP_INVALID);
+        return false;
+    }
+    phrase_add(plan, VOICE_CLIP_ZONDAG + timeinfo->tm_wday);
+    phrase_number(plan, timeinfo->tm_mday);
+    phrase_add(plan, VOICE_CLIP_JANUARI + timeinfo->tm_mon);
+    return phrase_year(plan, year);
+}
+
+/**
+ * @brief Builds the announcement of a time: "het is", the time and optionally the date.
+ */
+bool phrase_announcement(phrase_plan_t *plan, const struct tm *timeinfo, phrase_time_style_t style,
+                         bool with_date)
+{
+    phrase_clear(plan);
+    phrase_add(plan, VOICE_CLIP_HET_IS);
+    if (!phrase_time(plan, timeinfo, style)) {
+        return false;
+    }
+    return with_date ? phrase_date(plan, timeinfo) : !plan->overflow;
+}
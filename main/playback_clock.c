@@ -0,0 +1,200 @@
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ringbuf.h"
+#include "playback_clock.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "power_governor.h"
+
+static const char *TAG = "PLAYBACK_CLOCK";
+
+/* Time after the last write for which the clock still counts as running */
+#define IDLE_TIMEOUT_US (500 * 1000)
+
+static portMUX_TYPE clock_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static audio_element_handle_t clock_writer = NULL;
+static i2s_port_t clock_port = I2S_NUM_0;
+static int dma_frames = 0;
+
+static int clock_rate = 48000;
+static int frame_bytes = 4;
+
+// Frames accepted by the DMA since boot, when the last write returned and what the DMA held then
+static int64_t written_frames = 0;
+static int64_t last_write_us = 0;
+static int64_t dma_fill = 0;
+static int partial_bytes = 0;
+static uint32_t underruns = 0;
+
+// Write position at the start of the current track
+static int64_t track_start = 0;
+static int64_t track_duration_ms = -1;
+
+// Write callback of the i2s_stream writer, what _i2s_write does plus equalizing, normalizing and counting
+static int clock_write_cb(audio_element_handle_t self, char *buffer, int len, TickType_t ticks_to_wait, void *context)
+{
+    size_t written = 0;
+    eq_process(buffer, len);
+    normalizer_process(buffer, len);
+    power_governor_audio_begin();
+    i2s_write(clock_port, buffer, len, &written, ticks_to_wait);
+    power_governor_audio_end();
+    playback_clock_on_write(written);
+    return written;
+}
+
+/**
+ * @brief Counts the audio written by an i2s_stream writer.
+ */
+esp_err_t playback_clock_attach(audio_element_handle_t i2s_writer, i2s_port_t port, int frames)
+{
+    clock_writer = i2s_writer;
+    clock_port = port;
+    dma_frames = frames;
+    return audio_element_set_write_cb(i2s_writer, clock_write_cb, NULL);
+}
+
+/**
+ * @brief Sets the I2S format, call it together with i2s_stream_set_clk().
+ */
+void playback_clock_set_format(int rate, int channels, int bits)
+{
+    if (rate <= 0 || channels <= 0 || bits <= 0) {
+        return;
+    }
+    portENTER_CRITICAL(&clock_lock);
+    clock_rate = rate;
+    frame_bytes = channels * ((bits + 15) / 16) * 2;
+    partial_bytes = 0;
+    portEXIT_CRITICAL(&clock_lock);
+}
+
+/**
+ * @brief Counts audio an element wrote to the I2S driver itself.
+ */
+void playback_clock_on_write(int bytes)
+{
+    if (bytes <= 0) {
+        return;
+    }
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&clock_lock);
+    partial_bytes += bytes;
+    int64_t frames = partial_bytes / frame_bytes;
+    written_frames += frames;
+    partial_bytes %= frame_bytes;
+    // More clocked out since the last write than the DMA held means it ran empty before this write, which then
+    // did not have to wait. A gap beyond the idle timeout is a pause, not an underrun.
+    int64_t gap_us = now - last_write_us;
+    int64_t left = dma_fill + frames - gap_us * clock_rate / 1000000;
+    if (last_write_us && gap_us < IDLE_TIMEOUT_US && left < frames - dma_frames / 8) {
+        underruns++;
+    }
+    left = left < frames ? frames : left;
+    dma_fill = left > dma_frames ? dma_frames : left;
+    last_write_us = now;
+    portEXIT_CRITICAL(&clock_lock);
+}
+
+/**
+ * @brief Starts counting a new track at the current write position.
+ */
+void playback_clock_start_track(int64_t duration_ms)
+{
+    portENTER_CRITICAL(&clock_lock);
+    track_start = written_frames;
+    track_duration_ms = duration_ms;
+    portEXIT_CRITICAL(&clock_lock);
+    ESP_LOGD(TAG, "Track started at frame %lld", (long long)track_start);
+}
+
+/**
+ * @brief Sets the length of the current track once it is known.
+ */
+void playback_clock_set_duration(int64_t duration_ms)
+{
+    portENTER_CRITICAL(&clock_lock);
+    track_duration_ms = duration_ms;
+    portEXIT_CRITICAL(&clock_lock);
+}
+
+/**
+ * @brief Moves the position of the current track after a seek.
+ */
+void playback_clock_seek(int64_t position_ms)
+{
+    portENTER_CRITICAL(&clock_lock);
+    track_start = written_frames - position_ms * clock_rate / 1000;
+    portEXIT_CRITICAL(&clock_lock);
+}
+
+// Frames still in the DMA, it held fill when the last write returned and has drained at the sample rate since
+static int64_t frames_in_dma(int64_t fill, int64_t since_write_us, int rate)
+{
+    int64_t drained = since_write_us * rate / 1000000;
+    return drained >= fill ? 0 : fill - drained;
+}
+
+// Decoded frames waiting in front of the writer
+static int64_t frames_before_writer(int bytes_per_frame)
+{
+    if (clock_writer && audio_element_get_state(clock_writer) == AEL_STATE_RUNNING) {
+        ringbuf_handle_t rb = audio_element_get_input_ringbuf(clock_writer);
+        if (rb) {
+            return rb_bytes_filled(rb) / bytes_per_frame;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Reads the position of the current track.
+ */
+void playback_clock_get(playback_position_t *pos)
+{
+    int64_t now = esp_timer_get_time();
+    portENTER_CRITICAL(&clock_lock);
+    int64_t written = written_frames;
+    int64_t since_write_us = now - last_write_us;
+    int64_t fill = dma_fill;
+    int64_t start = track_start;
+    int64_t duration_ms = track_duration_ms;
+    int rate = clock_rate;
+    int bytes_per_frame = frame_bytes;
+    pos->underruns = underruns;
+    portEXIT_CRITICAL(&clock_lock);
+
+    int64_t in_dma = frames_in_dma(fill, since_write_us, rate);
+    // Audio still in the DMA when the track started belongs to the previous track
+    int64_t heard = written - in_dma - start;
+    heard = heard < 0 ? 0 : heard;
+
+    pos->frames = heard;
+    pos->position_ms = heard * 1000 / rate;
+    pos->duration_ms = duration_ms;
+    pos->remaining_ms = duration_ms < 0 ? -1 : (duration_ms > pos->position_ms ? duration_ms - pos->position_ms : 0);
+    pos->running = written > start && since_write_us < IDLE_TIMEOUT_US;
+
+    // Decoded audio waiting in front of the writer adds to what is still to be heard
+    int64_t queued = in_dma + frames_before_writer(bytes_per_frame);
+    pos->latency_ms = queued * 1000 / rate;
+}
+
+/**
+ * @brief Returns how long after now a frame handed to the writer now will be heard.
+ */
+int64_t playback_clock_get_latency_us(int64_t now)
+{
+    portENTER_CRITICAL(&clock_lock);
+    int64_t since_write_us = now - last_write_us;
+    int64_t fill = dma_fill;
+    int rate = clock_rate;
+    int bytes_per_frame = frame_bytes;
+    portEXIT_CRITICAL(&clock_lock);
+
+    int64_t queued = frames_in_dma(fill, since_write_us, rate) + frames_before_writer(bytes_per_frame);
+    return queued * 1000000 / rate;
+}
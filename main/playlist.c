@@ -1,5 +1,7 @@
 #include "playlist.h"
+#include "phrase.h"
 #include "stdlib.h"
+#include "string.h"
 
 // Array of strings representing base numbers
 const char *baseNumberStrings[] = {
@@ -149,3 +151,38 @@ char ** get_filenames_based_on_time(struct tm *timeinfo) {
 
     return full_file_array;
 }
+
+
+/**
+ * @brief Fills an array with the voice pack clip ids for a given number.
+ *
+ * @param num The number for which the clips are to be returned.
+ * @param clips Array of at least MAX_NUM_CLIPS entries that receives the clip ids.
+ * @return The number of clip ids written.
+ */
+int get_clips_based_on_num(int num, uint16_t *clips) {
+    phrase_plan_t plan;
+    phrase_clear(&plan);
+    // Check if the number is within the valid range, the numbers up to 99 take at most MAX_NUM_CLIPS clips
+    if (num < MIN_NUM || num > MAX_NUM) {
+        phrase_add(&plan, VOICE_CLIP_INVALID);
+    } else {
+        phrase_number(&plan, num);
+    }
+    memcpy(clips, plan.clips, plan.count * sizeof(clips[0]));
+    return plan.count;
+}
+
+/**
+ * @brief Fills an array with the voice pack clip ids for the full time.
+ *
+ * @param timeinfo Pointer to the struct tm containing the time information.
+ * @param clips Array of at least MAX_TIME_CLIPS entries that receives the clip ids.
+ * @return The number of clip ids written.
+ */
+int get_clips_based_on_time(struct tm *timeinfo, uint16_t *clips) {
+    phrase_plan_t plan;
+    phrase_announcement(&plan, timeinfo, PHRASE_TIME_DIGITAL, false);
+    memcpy(clips, plan.clips, plan.count * sizeof(clips[0]));
+    return plan.count;
+}
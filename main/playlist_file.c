@@ -0,0 +1,386 @@
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "esp_log.h"
+#include "esp_http_client.h"
+#include "playlist_file.h"
+
+static const char *TAG = "PLAYLIST_FILE";
+
+/* Bytes read from the file or the connection per chunk */
+#define LOAD_CHUNK_SIZE 512
+
+#define LOAD_TIMEOUT_MS 5000
+#define LOAD_MAX_REDIRECTS 3
+
+static bool is_url(const char *s)
+{
+    return strncasecmp(s, "http://", 7) == 0 || strncasecmp(s, "https://", 8) == 0;
+}
+
+// Absolute url with any scheme, letters followed by "://"
+static bool has_scheme(const char *s)
+{
+    const char *p = s;
+    while (isalpha((unsigned char)*p)) {
+        p++;
+    }
+    return p > s && strncmp(p, "://", 3) == 0;
+}
+
+static bool ends_with(const char *s, const char *suffix)
+{
+    int len = strlen(s), suffix_len = strlen(suffix);
+    return len >= suffix_len && strcasecmp(s + len - suffix_len, suffix) == 0;
+}
+
+static void copy_trimmed(char *dst, int size, const char *src)
+{
+    while (isspace((unsigned char)*src)) {
+        src++;
+    }
+    snprintf(dst, size, "%s", src);
+    int len = strlen(dst);
+    while (len > 0 && isspace((unsigned char)dst[len - 1])) {
+        dst[--len] = '\0';
+    }
+}
+
+// Removes "." and ".." segments in place, a ".." at the root or at the start of a relative path is dropped
+static void remove_dot_segments(char *path)
+{
+    char *w = path;
+    const char *r = path;
+    while (*r) {
+        const char *end = strchr(r, '/');
+        int len = end ? (int)(end - r) : (int)strlen(r);
+        if (len == 1 && r[0] == '.') {
+            // Nothing to write
+        } else if (len == 2 && r[0] == '.' && r[1] == '.') {
+            if (w > path) {
+                w--;
+                while (w > path && w[-1] != '/') {
+                    w--;
+                }
+                if (w == path && path[0] == '/') {
+                    w++;
+                }
+            }
+        } else {
+            memmove(w, r, len);
+            w += len;
+            if (end) {
+                *w++ = '/';
+            }
+        }
+        r += len;
+        if (*r == '/') {
+            r++;
+        }
+    }
+    *w = '\0';
+}
+
+/**
+ * @brief Resolves a playlist entry against the location of the playlist.
+ */
+esp_err_t playlist_file_resolve(const char *base, const char *ref, char *out, int size)
+{
+    int prefix_len = 0;
+    if (!has_scheme(ref)) {
+        const char *host = strstr(base, "://");
+        if (ref[0] == '/' || ref[0] == '\\') {
+            // Keep only the scheme and host of a url base, nothing of a path base
+            const char *path = host ? strchr(host + 3, '/') : NULL;
+            prefix_len = host ? (path ? (int)(path - base) : (int)strlen(base)) : 0;
+        } else {
+            prefix_len = strlen(base);
+        }
+    }
+    int ref_len = strlen(ref);
+    if (prefix_len + ref_len + 1 > size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(out, base, prefix_len);
+    memcpy(out + prefix_len, ref, ref_len + 1);
+
+    // Playlists written on Windows use backslashes, and the path of a url starts after the host
+    char *path = out;
+    const char *host = strstr(out, "://");
+    if (host) {
+        path = strchr(host + 3, '/');
+        if (path == NULL) {
+            return ESP_OK;
+        }
+    } else {
+        for (char *p = out; *p; p++) {
+            *p = *p == '\\' ? '/' : *p;
+        }
+    }
+    char *query = strpbrk(path, "?#");
+    char saved = query ? *query : '\0';
+    if (query) {
+        // The query is moved back behind the normalized path
+        *query = '\0';
+        remove_dot_segments(path);
+        int path_len = strlen(path);
+        *query = saved;
+        memmove(path + path_len, query, strlen(query) + 1);
+    } else {
+        remove_dot_segments(path);
+    }
+    return ESP_OK;
+}
+
+static void emit(playlist_file_parser_t *p, const char *ref, const char *title)
+{
+    char uri[PLAYLIST_FILE_LINE_MAX];
+    if (playlist_file_resolve(p->base, ref, uri, sizeof(uri)) != ESP_OK) {
+        p->skipped++;
+        return;
+    }
+    p->entries++;
+    p->cb(p->ctx, uri, title);
+}
+
+static void flush_pending(playlist_file_parser_t *p)
+{
+    if (p->pending_index > 0) {
+        emit(p, p->pending_uri, p->pending_title);
+        p->pending_index = 0;
+    }
+}
+
+// "#EXTINF:<seconds>,<title>" titles the next entry, every other '#' line is a comment or an unused tag
+static void parse_m3u_line(playlist_file_parser_t *p, const char *s)
+{
+    if (s[0] == '#') {
+        if (strncasecmp(s, "#EXTINF:", 8) == 0) {
+            const char *comma = strchr(s + 8, ',');
+            copy_trimmed(p->title, sizeof(p->title), comma ? comma + 1 : "");
+        }
+        return;
+    }
+    emit(p, s, p->title);
+    p->title[0] = '\0';
+}
+
+// An entry is held back until a line of another entry, since its TitleN= may follow its FileN=
+static void parse_pls_line(playlist_file_parser_t *p, char *s)
+{
+    char *eq = strchr(s, '=');
+    if (eq == NULL) {
+        return;
+    }
+    *eq = '\0';
+    char key[16];
+    copy_trimmed(key, sizeof(key), s);
+    const char *value = eq + 1;
+    while (isspace((unsigned char)*value)) {
+        value++;
+    }
+
+    bool file = strncasecmp(key, "File", 4) == 0 && isdigit((unsigned char)key[4]);
+    bool title = strncasecmp(key, "Title", 5) == 0 && isdigit((unsigned char)key[5]);
+    if (!file && !title) {
+        return;
+    }
+    int index = atoi(key + (file ? 4 : 5));
+    if (index <= 0) {
+        return;
+    }
+    if (p->pending_index != index) {
+        flush_pending(p);
+    }
+    if (file) {
+        snprintf(p->pending_uri, sizeof(p->pending_uri), "%s", value);
+        // A title that came before its file
+        snprintf(p->pending_title, sizeof(p->pending_title), "%s", p->title_index == index ? p->title : "");
+        p->pending_index = index;
+    } else if (p->pending_index == index) {
+        copy_trimmed(p->pending_title, sizeof(p->pending_title), value);
+    } else {
+        copy_trimmed(p->title, sizeof(p->title), value);
+        p->title_index = index;
+    }
+}
+
+static void end_line(playlist_file_parser_t *p)
+{
+    if (p->line_overflow) {
+        ESP_LOGW(TAG, "Skipped a line of more than %d characters", PLAYLIST_FILE_LINE_MAX - 1);
+        p->skipped++;
+        p->line_overflow = false;
+        p->line_len = 0;
+        return;
+    }
+    p->line[p->line_len] = '\0';
+    p->line_len = 0;
+
+    char *s = p->line;
+    if (p->first_line) {
+        p->first_line = false;
+        // UTF-8 byte order mark of M3U8 files
+        if (strncmp(s, "\xEF\xBB\xBF", 3) == 0) {
+            s += 3;
+        }
+    }
+    while (isspace((unsigned char)*s)) {
+        s++;
+    }
+    int len = strlen(s);
+    while (len > 0 && isspace((unsigned char)s[len - 1])) {
+        s[--len] = '\0';
+    }
+    if (len == 0) {
+        return;
+    }
+
+    if (p->format == PLAYLIST_FILE_UNKNOWN) {
+        p->format = strcasecmp(s, "[playlist]") == 0 ? PLAYLIST_FILE_PLS : PLAYLIST_FILE_M3U;
+    }
+    if (p->format == PLAYLIST_FILE_PLS) {
+        if (s[0] != '[' && s[0] != ';' && s[0] != '#') {
+            parse_pls_line(p, s);
+        }
+    } else {
+        parse_m3u_line(p, s);
+    }
+}
+
+/**
+ * @brief Prepares a parse.
+ */
+void playlist_file_parser_init(playlist_file_parser_t *p, const char *location, playlist_file_format_t format,
+                               playlist_file_entry_cb_t cb, void *ctx)
+{
+    memset(p, 0, sizeof(*p));
+    p->cb = cb;
+    p->ctx = ctx;
+    p->first_line = true;
+
+    const char *slash = strrchr(location, '/');
+    int base_len = slash ? slash - location + 1 : 0;
+    if (base_len < (int)sizeof(p->base)) {
+        memcpy(p->base, location, base_len);
+        p->base[base_len] = '\0';
+    }
+
+    if (format == PLAYLIST_FILE_UNKNOWN) {
+        // A url may end in a query, the first line decides then
+        if (ends_with(location, ".pls")) {
+            format = PLAYLIST_FILE_PLS;
+        } else if (ends_with(location, ".m3u") || ends_with(location, ".m3u8")) {
+            format = PLAYLIST_FILE_M3U;
+        }
+    }
+    p->format = format;
+}
+
+/**
+ * @brief Feeds the next chunk of the playlist.
+ */
+void playlist_file_parser_feed(playlist_file_parser_t *p, const char *data, int len)
+{
+    for (int i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == '\n' || c == '\r') {
+            if (p->line_len > 0 || p->line_overflow) {
+                end_line(p);
+            }
+        } else if (p->line_len < PLAYLIST_FILE_LINE_MAX - 1) {
+            p->line[p->line_len++] = c;
+        } else {
+            p->line_overflow = true;
+        }
+    }
+}
+
+/**
+ * @brief Ends the parse, reporting an entry held back by a missing newline or PLS title.
+ */
+int playlist_file_parser_finish(playlist_file_parser_t *p)
+{
+    if (p->line_len > 0 || p->line_overflow) {
+        end_line(p);
+    }
+    flush_pending(p);
+    return p->entries;
+}
+
+static esp_err_t load_file(const char *path, playlist_file_parser_t *p, char *buf)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    int r;
+    while ((r = fread(buf, 1, LOAD_CHUNK_SIZE, file)) > 0) {
+        playlist_file_parser_feed(p, buf, r);
+    }
+    fclose(file);
+    return ESP_OK;
+}
+
+static esp_err_t load_url(const char *url, playlist_file_parser_t *p, char *buf)
+{
+    esp_http_client_config_t http_cfg = {
+        .url = url,
+        .timeout_ms = LOAD_TIMEOUT_MS,
+        .buffer_size = LOAD_CHUNK_SIZE,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&http_cfg);
+    if (client == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = ESP_FAIL;
+    for (int redirects = 0; redirects <= LOAD_MAX_REDIRECTS; redirects++) {
+        if (esp_http_client_open(client, 0) != ESP_OK) {
+            break;
+        }
+        esp_http_client_fetch_headers(client);
+        int status = esp_http_client_get_status_code(client);
+        if (status == 301 || status == 302 || status == 303 || status == 307 || status == 308) {
+            esp_http_client_set_redirection(client);
+            esp_http_client_close(client);
+            continue;
+        }
+        if (status != 200) {
+            ESP_LOGW(TAG, "%s answered %d", url, status);
+            break;
+        }
+        int r;
+        while ((r = esp_http_client_read(client, buf, LOAD_CHUNK_SIZE)) > 0) {
+            playlist_file_parser_feed(p, buf, r);
+        }
+        ret = ESP_OK;
+        break;
+    }
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+    return ret;
+}
+
+/**
+ * @brief Reads a playlist from the SD card or over http(s) and reports its entries.
+ */
+int playlist_file_load(const char *location, playlist_file_entry_cb_t cb, void *ctx)
+{
+    playlist_file_parser_t *p = malloc(sizeof(playlist_file_parser_t));
+    char *buf = malloc(LOAD_CHUNK_SIZE);
+    int entries = -1;
+    if (p && buf) {
+        playlist_file_parser_init(p, location, PLAYLIST_FILE_UNKNOWN, cb, ctx);
+        esp_err_t ret = is_url(location) ? load_url(location, p, buf) : load_file(location, p, buf);
+        if (ret == ESP_OK) {
+            entries = playlist_file_parser_finish(p);
+            ESP_LOGI(TAG, "%s: %d entries, %d skipped", location, entries, p->skipped);
+        }
+    }
+    free(buf);
+    free(p);
+    return entries;
+}
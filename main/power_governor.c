@@ -0,0 +1,238 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_pm.h"
+#include "esp_timer.h"
+#include "playback_clock.h"
+#include "scheduler.h"
+#include "trace_recorder.h"
+#include "power_governor.h"
+
+static const char *TAG = "POWER";
+
+/* Frequency of the crystal, the lowest the CPU runs at while light sleep is allowed */
+#define XTAL_MHZ 40
+
+static power_governor_cfg_t gov_cfg;
+static power_policy_t policy;
+static scheduler_timer_t sample_timer;
+static portMUX_TYPE stats_lock = portMUX_INITIALIZER_UNLOCKED;
+static power_stats_t stats;
+
+// Holds of modules, the lock keeps the chip awake before the next sample notices them
+static esp_pm_lock_handle_t hold_lock = NULL;
+static volatile int holds = 0;
+
+// I2S stopped for light sleep, changed under i2s_mutex
+static SemaphoreHandle_t i2s_mutex = NULL;
+static bool i2s_stopped = false;
+static int i2s_writers = 0;
+
+// Idle task run time and time of the last sample
+static uint32_t last_idle[portNUM_PROCESSORS];
+static int64_t last_sample_us = 0;
+static uint32_t report_elapsed_ms = 0;
+
+static uint32_t idle_run_time(int core)
+{
+    TaskStatus_t status;
+    vTaskGetInfo(xTaskGetIdleTaskHandleForCPU(core), &status, pdFALSE, eRunning);
+    return status.ulRunTimeCounter;
+}
+
+// Load of the busiest core since the last sample, from the time its idle task ran
+static int measure_load(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t elapsed = (uint32_t)(now - last_sample_us);
+    last_sample_us = now;
+    int load = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        uint32_t idle = idle_run_time(core);
+        uint32_t idle_us = idle - last_idle[core];
+        last_idle[core] = idle;
+        int core_load = elapsed > 0 && idle_us < elapsed ? (int)(100 - (uint64_t)idle_us * 100 / elapsed) : 0;
+        load = core_load > load ? core_load : load;
+    }
+    return load;
+}
+
+static esp_err_t apply(int level, bool sleep)
+{
+    esp_pm_config_esp32_t pm = {
+        .max_freq_mhz = power_level_mhz[level],
+        .min_freq_mhz = sleep ? XTAL_MHZ : power_level_mhz[level],
+        .light_sleep_enable = sleep,
+    };
+    if (sleep) {
+        // A running I2S DMA keeps the APB clock up, nothing writes to it now
+        xSemaphoreTake(i2s_mutex, portMAX_DELAY);
+        if (i2s_writers == 0 && !i2s_stopped) {
+            i2s_stop(gov_cfg.i2s_port);
+            i2s_stopped = true;
+        }
+        xSemaphoreGive(i2s_mutex);
+    }
+    return esp_pm_configure(&pm);
+}
+
+static void report(void)
+{
+    power_stats_t s;
+    power_governor_get_stats(&s);
+    uint32_t total = s.sleep_ms;
+    for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+        total += s.residency_ms[i];
+    }
+    if (total == 0) {
+        return;
+    }
+    ESP_LOGI(TAG, "[ * ] CPU residency: %d MHz %d%%, %d MHz %d%%, %d MHz %d%%, light sleep %d%%, %d changes",
+             power_level_mhz[0], (int)((uint64_t)s.residency_ms[0] * 100 / total),
+             power_level_mhz[1], (int)((uint64_t)s.residency_ms[1] * 100 / total),
+             power_level_mhz[2], (int)((uint64_t)s.residency_ms[2] * 100 / total),
+             (int)((uint64_t)s.sleep_ms * 100 / total), (int)s.changes);
+}
+
+static void sample_cb(scheduler_timer_t *timer, void *arg)
+{
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    power_sample_t sample = {
+        .load_pct = measure_load(),
+        .playing = pos.running,
+        .hold = holds > 0,
+        .underruns = pos.underruns,
+    };
+
+    // The time since the last sample was spent in the state before this one
+    portENTER_CRITICAL(&stats_lock);
+    if (policy.sleep) {
+        stats.sleep_ms += gov_cfg.sample_ms;
+    } else {
+        stats.residency_ms[policy.level] += gov_cfg.sample_ms;
+    }
+    stats.load_pct = sample.load_pct;
+    portEXIT_CRITICAL(&stats_lock);
+
+    if (power_policy_update(&policy, &sample)) {
+        esp_err_t ret = apply(policy.level, policy.sleep);
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to set %d MHz: %s", power_level_mhz[policy.level], esp_err_to_name(ret));
+        }
+        portENTER_CRITICAL(&stats_lock);
+        stats.changes++;
+        stats.mhz = power_level_mhz[policy.level];
+        stats.sleep = policy.sleep;
+        portEXIT_CRITICAL(&stats_lock);
+        ESP_LOGD(TAG, "%d MHz%s at %d%% load", power_level_mhz[policy.level], policy.sleep ? ", light sleep" : "",
+                 sample.load_pct);
+    }
+
+    trace_recorder_cpu(sample.load_pct, power_level_mhz[policy.level], sample.underruns);
+
+    report_elapsed_ms += gov_cfg.sample_ms;
+    if (gov_cfg.report_s > 0 && report_elapsed_ms >= gov_cfg.report_s * 1000) {
+        report_elapsed_ms = 0;
+        report();
+    }
+    scheduler_start_after(timer, gov_cfg.sample_ms);
+}
+
+/**
+ * @brief Starts the governor.
+ */
+esp_err_t power_governor_init(const power_governor_cfg_t *config)
+{
+    gov_cfg = *config;
+    power_policy_init(&policy, &gov_cfg.policy);
+    i2s_mutex = xSemaphoreCreateMutex();
+    if (i2s_mutex == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (hold_lock == NULL) {
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power_hold", &hold_lock);
+    }
+
+    esp_err_t ret = apply(policy.level, policy.sleep);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Power management not available: %s", esp_err_to_name(ret));
+        return ret;
+    }
+    stats.mhz = power_level_mhz[policy.level];
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        last_idle[core] = idle_run_time(core);
+    }
+    last_sample_us = esp_timer_get_time();
+    scheduler_timer_init(&sample_timer, sample_cb, NULL);
+    scheduler_start_after(&sample_timer, gov_cfg.sample_ms);
+    return ESP_OK;
+}
+
+/**
+ * @brief Keeps the chip out of light sleep until power_governor_release().
+ */
+void power_governor_hold(void)
+{
+    if (hold_lock == NULL) {
+        esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "power_hold", &hold_lock);
+    }
+    if (hold_lock) {
+        esp_pm_lock_acquire(hold_lock);
+    }
+    holds++;
+}
+
+/**
+ * @brief Ends a power_governor_hold().
+ */
+void power_governor_release(void)
+{
+    holds--;
+    if (hold_lock) {
+        esp_pm_lock_release(hold_lock);
+    }
+}
+
+/**
+ * @brief Called before writing to I2S, starts I2S again when it was stopped for light sleep.
+ */
+void power_governor_audio_begin(void)
+{
+    if (i2s_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(i2s_mutex, portMAX_DELAY);
+    i2s_writers++;
+    if (i2s_stopped) {
+        i2s_start(gov_cfg.i2s_port);
+        i2s_stopped = false;
+    }
+    xSemaphoreGive(i2s_mutex);
+}
+
+/**
+ * @brief Called after writing to I2S.
+ */
+void power_governor_audio_end(void)
+{
+    if (i2s_mutex == NULL) {
+        return;
+    }
+    xSemaphoreTake(i2s_mutex, portMAX_DELAY);
+    i2s_writers--;
+    xSemaphoreGive(i2s_mutex);
+}
+
+/**
+ * @brief Reads the residency statistics.
+ */
+void power_governor_get_stats(power_stats_t *out)
+{
+    portENTER_CRITICAL(&stats_lock);
+    *out = stats;
+    portEXIT_CRITICAL(&stats_lock);
+}
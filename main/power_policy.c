@@ -0,0 +1,77 @@
+#include <string.h>
+#include "power_policy.h"
+
+const int power_level_mhz[POWER_LEVEL_COUNT] = { 80, 160, 240 };
+
+// Lowest level at which a demand in MHz stays under the target load
+static int level_for(const power_policy_t *p, int demand_mhz)
+{
+    for (int level = 0; level < POWER_LEVEL_COUNT; level++) {
+        if (demand_mhz * 100 <= power_level_mhz[level] * p->cfg.target_pct) {
+            return level;
+        }
+    }
+    return POWER_LEVEL_COUNT - 1;
+}
+
+/**
+ * @brief Starts a policy at the highest frequency, awake.
+ */
+void power_policy_init(power_policy_t *p, const power_policy_cfg_t *config)
+{
+    memset(p, 0, sizeof(*p));
+    p->cfg = *config;
+    p->level = POWER_LEVEL_COUNT - 1;
+}
+
+/**
+ * @brief Takes a sample and updates the level and the sleep permission.
+ */
+bool power_policy_update(power_policy_t *p, const power_sample_t *s)
+{
+    int level = p->level;
+    bool sleep = p->sleep;
+
+    // Sleep only after a while without audio, so the gap between two songs stays awake
+    p->quiet = s->playing || s->hold ? 0 : p->quiet + 1;
+    sleep = p->quiet >= p->cfg.idle_samples;
+
+    if (s->underruns != p->underruns) {
+        p->underruns = s->underruns;
+        p->boost = p->cfg.boost_samples;
+        level = POWER_LEVEL_COUNT - 1;
+    } else if (p->boost > 0) {
+        p->boost--;
+    }
+
+    if (sleep) {
+        level = 0;
+        p->below = 0;
+        p->boost = 0;
+    } else if (p->sleep) {
+        // Waking up: the load of what starts is unknown, start high and come down
+        level = POWER_LEVEL_COUNT - 1;
+    } else if (p->boost == 0) {
+        // The load was measured at the current level, scale it to the MHz the work needs
+        int demand_mhz = s->load_pct * power_level_mhz[p->level] / 100;
+        int wanted = level_for(p, demand_mhz);
+        if (s->load_pct > p->cfg.up_pct) {
+            // A saturated core hides how much more the work needs, go at least one level up
+            int up = p->level + 1 < POWER_LEVEL_COUNT ? p->level + 1 : p->level;
+            level = wanted > up ? wanted : up;
+            p->below = 0;
+        } else if (wanted < p->level) {
+            if (++p->below >= p->cfg.down_samples) {
+                level = p->level - 1;
+                p->below = 0;
+            }
+        } else {
+            p->below = 0;
+        }
+    }
+
+    bool changed = level != p->level || sleep != p->sleep;
+    p->level = level;
+    p->sleep = sleep;
+    return changed;
+}
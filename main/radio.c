@@ -1,159 +1,418 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <strings.h>
+#include "esp_timer.h"
 #include "radio.h"
+#include "timeshift.h"
+#include "resilient_http.h"
+#include "lean_http.h"
+#include "station_probe.h"
+#include "vu_meter.h"
+#include "playback_clock.h"
+#include "normalizer.h"
+#include "eq.h"
+#include "playlist_file.h"
+#include "power_governor.h"
+#include "group.h"
+#include "scheduler.h"
 
 // Define a tag for logging purposes
 const static char *TAG = "RADIO";
 
-/**
- * @brief Task function to initialize the internet radio.
- *
- * This function initializes the audio pipeline, connects to a server, and streams MP3 from the server to play on the speaker.
- * It sets up the Wi-Fi connection, configures the audio pipeline with an HTTP stream and MP3 decoder, and starts the audio pipeline.
- * The function listens for events from the pipeline and the peripherals, handling music info updates and stop events.
- * Finally, it cleans up by stopping the audio pipeline, releasing resources, and terminating the peripheral set.
- *
- * @param arg Optional argument for passing additional initialization parameters. Must be void* and will be cast to const char*.
- */
-void init_radio(void *arg)
-{
-    // Initialization steps
-    ESP_LOGI(TAG, "[ 3 ] Start and wait for Wi-Fi network");
-    esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
-    esp_periph_set_handle_t set = esp_periph_set_init(&periph_cfg);
-    periph_wifi_cfg_t wifi_cfg = {
-        .ssid = CONFIG_ESP_WIFI_SSID,
-        .password = CONFIG_ESP_WIFI_PASSWORD,
-    };
+// Elements of the radio chain, registered in the shared pipeline of the mode manager
+static audio_element_handle_t http_stream_reader, mp3_decoder, timeshift_buffer;
+static audio_element_handle_t i2s_stream_writer;
+
+// Timeshift element of the running radio pipeline, NULL when the radio is not running
+static audio_element_handle_t timeshift = NULL;
+
+// The stream keeps filling the timeshift buffer while paused, Wi-Fi must not sleep
+static bool power_held = false;
+
+// The radio chain runs through the group sender, this speaker leads a group
+static bool grouped = false;
+
+// Restarts the chain after it stopped by itself, see RADIO_RESTART_MIN_MS
+static scheduler_timer_t restart_timer;
+static int restart_delay_ms = 0;
+static int64_t started_us = 0;
+
+// Stations used when the station list cannot be read
+static const char *default_stations[] = {
+    "https://www.mp3streams.nl/zender/radio-538/stream/4-mp3-128",
+    "https://www.mp3streams.nl/zender/qmusic-non-stop/stream/125-mp3-96",
+    "https://www.mp3streams.nl/zender/concertzender-klassiek/stream/110-mp3-128"};
+
+// Station urls, owned by the resilient http reader for its lifetime
+static const char *stations[RADIO_STATION_MAX];
+static int station_count = 0;
+
+// Station currently selected in stations
+static int station = 0;
+
+static const char *radio_link_tag[4] = {"http", "tshift", "mp3", "i2s"};
+#if CONFIG_SPEAKER_GROUP
+// As the leader of a group the decoded stream goes to the group first, see group.h
+static const char *radio_group_link_tag[6] = {"http", "tshift", "mp3", "gfilter", "gsend", "i2s"};
+#endif
+
+const player_mode_ops_t radio_mode_ops = {
+    .name = "Internet Radio",
+    .init = radio_init,
+    .activate = radio_activate,
+    .deactivate = radio_deactivate,
+    .handle_event = radio_handle_event,
+    .handle_key = radio_handle_key,
+};
 
-    // NVS initialization and error handling
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES)
+// Take a station from the station list, other entries cannot be played by the http reader
+static void station_list_cb(void *ctx, const char *uri, const char *title)
+{
+    if (station_count >= RADIO_STATION_MAX || strncasecmp(uri, "http", 4) != 0)
+    {
+        return;
+    }
+    char *copy = strdup(uri);
+    if (copy)
     {
-        ESP_ERROR_CHECK(nvs_flash_erase());
-        err = nvs_flash_init();
+        ESP_LOGI(TAG, "[ * ] Station %d: %s", station_count, title[0] ? title : uri);
+        stations[station_count++] = copy;
     }
+}
 
-    ESP_ERROR_CHECK(esp_netif_init());
+// Restarts the chain on the current station, unless it was restarted or the mode changed since
+static void restart_cb(scheduler_timer_t *timer, void *arg)
+{
+    mode_manager_lock();
+    if (mode_manager_get_mode() == PLAYER_MODE_RADIO && audio_element_get_state(i2s_stream_writer) != AEL_STATE_RUNNING)
+    {
+        BINLOGW(TAG, "[ * ] Restarting the radio on station %d", station);
+        radio_select_station(station);
+    }
+    mode_manager_unlock();
+}
 
-    // Wi-Fi connection
-    esp_periph_handle_t wifi_handle = periph_wifi_init(&wifi_cfg);
-    esp_periph_start(set, wifi_handle);
-    periph_wifi_wait_for_connected(wifi_handle, portMAX_DELAY);
+// Schedules a restart of the chain, backing off while it keeps stopping soon after a restart
+static void schedule_restart(void)
+{
+    if (restart_delay_ms == 0 || esp_timer_get_time() - started_us > (int64_t)RADIO_RESTART_RESET_MS * 1000)
+    {
+        restart_delay_ms = RADIO_RESTART_MIN_MS;
+    }
+    else if (restart_delay_ms < RADIO_RESTART_MAX_MS)
+    {
+        restart_delay_ms = restart_delay_ms * 2 < RADIO_RESTART_MAX_MS ? restart_delay_ms * 2 : RADIO_RESTART_MAX_MS;
+    }
+    BINLOGW(TAG, "[ * ] Radio stopped, restarting in %d ms", restart_delay_ms);
+    scheduler_start_after(&restart_timer, restart_delay_ms);
+}
 
-    // Audio pipeline setup
-    audio_pipeline_handle_t pipeline;
-    audio_element_handle_t http_stream_reader, i2s_stream_writer, mp3_decoder;
+// Fill the station table from the station list, or with the built-in stations
+static void load_stations(void)
+{
+    playlist_file_load(CONFIG_RADIO_STATION_LIST, station_list_cb, NULL);
+    if (station_count == 0)
+    {
+        ESP_LOGI(TAG, "[ * ] No stations in %s, using the built-in stations", CONFIG_RADIO_STATION_LIST);
+        for (int i = 0; i < sizeof(default_stations) / sizeof(default_stations[0]); i++)
+        {
+            stations[station_count++] = default_stations[i];
+        }
+    }
+}
 
-    // Logging level configuration
-    esp_log_level_set("*", ESP_LOG_WARN);
-    esp_log_level_set(TAG, ESP_LOG_DEBUG);
+/**
+ * @brief Creates the radio elements and registers them in the shared pipeline.
+ *
+ * Loads the station list, probes the radio stations to start with the fastest one, then creates the
+ * reconnecting http stream, the timeshift buffer and the mp3 decoder. The Wi-Fi
+ * connection, codec and i2s writer are set up by the mode manager.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t radio_init(void)
+{
+    // Quiet the per element chatter of the ADF pipeline, the tags of this project keep INFO
+    static const char *const adf_tags[] = {"AUDIO_ELEMENT", "AUDIO_PIPELINE", "AUDIO_THREAD", "MP3_DECODER", "I2S_STREAM"};
+    for (int i = 0; i < sizeof(adf_tags) / sizeof(adf_tags[0]); i++)
+    {
+        esp_log_level_set(adf_tags[i], ESP_LOG_WARN);
+    }
 
-    // Audio codec chip initialization
-    ESP_LOGI(TAG, "[ 1 ] Start audio codec chip");
-    audio_board_handle_t board_handle = audio_board_init();
-    audio_hal_ctrl_codec(board_handle->audio_hal, AUDIO_HAL_CODEC_MODE_DECODE, AUDIO_HAL_CTRL_START);
+    ESP_LOGI(TAG, "[1.1] Load the radio stations");
+    load_stations();
+    scheduler_timer_init(&restart_timer, restart_cb, NULL);
 
-    // Audio pipeline creation and element registration
-    ESP_LOGI(TAG, "[2.0] Create audio pipeline for playback");
-    audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
-    pipeline = audio_pipeline_init(&pipeline_cfg);
-    mem_assert(pipeline);
+    // Continue the station saved before the power cycle, otherwise start with the one that answers fastest
+    const resume_state_t *resumed = mode_manager_get_resume_state();
+    if (resumed->station >= 0 && resumed->station < station_count)
+    {
+        station = resumed->station;
+        ESP_LOGI(TAG, "[ 1 ] Resume radio station %d", station);
+    }
+    else
+    {
+        ESP_LOGI(TAG, "[ 1 ] Probe radio stations");
+        station = station_probe_fastest(stations, station_count, RADIO_PROBE_PARALLEL, RADIO_PROBE_TIMEOUT_MS, NULL);
+        if (station < 0)
+        {
+            ESP_LOGW(TAG, "[ * ] No healthy station found, starting with the first one");
+            station = 0;
+        }
+    }
 
-    ESP_LOGI(TAG, "[2.1] Create http stream to read data");
-    http_stream_cfg_t http_cfg = HTTP_STREAM_CFG_DEFAULT();
-    http_stream_reader = http_stream_init(&http_cfg);
+    audio_pipeline_handle_t pipeline = mode_manager_get_pipeline();
+    i2s_stream_writer = mode_manager_get_i2s_writer();
 
-    ESP_LOGI(TAG, "[2.2] Create i2s stream to write data to codec chip");
-    i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
-    i2s_cfg.type = AUDIO_STREAM_WRITER;
-    i2s_stream_writer = i2s_stream_init(&i2s_cfg);
+    ESP_LOGI(TAG, "[2.1] Create reconnecting http stream to read data");
+    lean_http_cfg_t tls_cfg = LEAN_HTTP_CFG_DEFAULT();
+    tls_cfg.max_fragment_len = CONFIG_RADIO_TLS_MAX_FRAGMENT;
+#if !CONFIG_RADIO_TLS_SESSION_TICKETS
+    tls_cfg.resume_sessions = false;
+#endif
+#if CONFIG_RADIO_HTTP_FALLBACK
+    tls_cfg.plain_fallback = true;
+#endif
+    ESP_ERROR_CHECK(lean_http_init(&tls_cfg));
+    resilient_http_cfg_t http_cfg = RESILIENT_HTTP_CFG_DEFAULT();
+    http_cfg.urls = stations;
+    http_cfg.url_count = station_count;
+    http_cfg.start_index = station;
+    http_stream_reader = resilient_http_init(&http_cfg);
+    mem_assert(http_stream_reader);
 
-    ESP_LOGI(TAG, "[2.3] Create mp3 decoder to decode mp3 file");
+    ESP_LOGI(TAG, "[2.2] Create mp3 decoder to decode mp3 file");
     mp3_decoder_cfg_t mp3_cfg = DEFAULT_MP3_DECODER_CONFIG();
     mp3_decoder = mp3_decoder_init(&mp3_cfg);
+    mem_assert(mp3_decoder);
+
+    ESP_LOGI(TAG, "[2.3] Create timeshift buffer to pause the live stream");
+    timeshift_cfg_t timeshift_cfg = TIMESHIFT_CFG_DEFAULT();
+    timeshift_cfg.ram_size = CONFIG_RADIO_TIMESHIFT_RAM_SIZE;
+#if CONFIG_RADIO_TIMESHIFT_SPILL
+    timeshift_cfg.spill_path = TIMESHIFT_SPILL_PATH;
+    timeshift_cfg.spill_size = CONFIG_RADIO_TIMESHIFT_SPILL_SIZE;
+#endif
+    timeshift_buffer = timeshift_init(&timeshift_cfg);
+    mem_assert(timeshift_buffer);
 
     ESP_LOGI(TAG, "[2.4] Register all elements to audio pipeline");
     audio_pipeline_register(pipeline, http_stream_reader, "http");
+    audio_pipeline_register(pipeline, timeshift_buffer, "tshift");
     audio_pipeline_register(pipeline, mp3_decoder, "mp3");
-    audio_pipeline_register(pipeline, i2s_stream_writer, "i2s");
-
-    ESP_LOGI(TAG, "[2.5] Link it together http_stream-->mp3_decoder-->i2s_stream-->[codec_chip]");
-    const char *link_tag[3] = {"http", "mp3", "i2s"};
-    audio_pipeline_link(pipeline, &link_tag[0], 3);
+    return ESP_OK;
+}
 
-    // Set up URI for the stream
-    ESP_LOGI(TAG, "[2.6] Set up uri (http as http_stream, mp3 as mp3 decoder, and default output is i2s)");
-    audio_element_set_uri(http_stream_reader, radio_streams[0]);
+/**
+ * @brief Links http_stream-->timeshift-->mp3_decoder-->i2s_stream-->[codec_chip] and starts it.
+ *
+ * As the leader of a group the resampler and the group sender go between the decoder
+ * and the i2s stream.
+ *
+ * @return ESP_OK on success.
+ */
+esp_err_t radio_activate(void)
+{
+    ESP_LOGI(TAG, "[ 3 ] Start radio on station %d", station);
+    resilient_http_set_url_index(http_stream_reader, station);
+    resume_state_set_station(station);
+    timeshift_set_paused(timeshift_buffer, false);
+    timeshift = timeshift_buffer;
+    if (!power_held)
+    {
+        power_governor_hold();
+        power_held = true;
+    }
+    // A stream has no length, the clock shows the time listened to this station
+    playback_clock_start_track(-1);
+    started_us = esp_timer_get_time();
+    // Streams are not measured beforehand, the gain follows the loudness heard so far
+    normalizer_follow_stream();
+#if CONFIG_SPEAKER_GROUP
+    // A station change restarts the chain without a deactivate, the role may have changed since
+    if (grouped && !group_is_leader())
+    {
+        group_stop();
+    }
+    grouped = group_is_leader() && group_start() == ESP_OK;
+    if (grouped)
+    {
+        return mode_manager_run_chain(radio_group_link_tag, 6);
+    }
+#endif
+    return mode_manager_run_chain(radio_link_tag, 4);
+}
 
-    // Set up event listener for pipeline
-    ESP_LOGI(TAG, "[ 3 ] Set up event listener");
-    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
-    audio_event_iface_handle_t evt = audio_event_iface_init(&evt_cfg);
+/**
+ * @brief Called by the mode manager after the radio chain was stopped.
+ */
+void radio_deactivate(void)
+{
+    timeshift = NULL;
+    scheduler_cancel(&restart_timer);
+    if (grouped)
+    {
+        group_stop();
+        grouped = false;
+    }
+    if (power_held)
+    {
+        power_governor_release();
+        power_held = false;
+    }
+}
 
-    ESP_LOGI(TAG, "[3.1] Listening event from all elements of pipeline");
-    audio_pipeline_set_listener(pipeline, evt);
+/**
+ * @brief Handles pipeline events while the radio is active.
+ *
+ * Sets the i2s clock to the format reported by the mp3 decoder, or the resampler in
+ * front of the group sender when leading a group. Restarts the chain when it stopped by
+ * itself, after a delay that grows while it keeps stopping, or on the next station when
+ * the reader ran out of retries.
+ *
+ * @param msg Event from the shared event interface.
+ */
+void radio_handle_event(audio_event_iface_msg_t *msg)
+{
+    /* Receive a mp3 stream from the server and play it */
+    if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg->source == (void *)mp3_decoder && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
+    {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(mp3_decoder, &music_info);
 
-    ESP_LOGI(TAG, "[3.2] Listening event from peripherals");
-    audio_event_iface_set_listener(esp_periph_set_get_event_iface(set), evt);
+        BINLOGI(TAG, "[ * ] Receive music info from mp3 decoder, sample_rates=%d, bits=%d, ch=%d",
+                 music_info.sample_rates, music_info.bits, music_info.channels);
 
-    ESP_LOGI(TAG, "[ 4 ] Start audio_pipeline");
-    audio_pipeline_run(pipeline);
+        if (grouped)
+        {
+            // The group plays its own format, the resampler converts to it
+            group_set_source_format(music_info.sample_rates, music_info.channels);
+            return;
+        }
+        i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates, music_info.bits, music_info.channels);
+        vu_meter_set_format(music_info.sample_rates, music_info.channels);
+        playback_clock_set_format(music_info.sample_rates, music_info.channels, music_info.bits);
+        normalizer_set_format(music_info.sample_rates, music_info.channels, music_info.bits);
+        eq_set_format(music_info.sample_rates, music_info.channels, music_info.bits);
+        return;
+    }
 
-    // Event loop for handling music info and stop events
-    while (1)
+    /* The reader reconnects by itself, a stop of the last element means the stream really ended */
+    if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg->source == (void *)i2s_stream_writer && msg->cmd == AEL_MSG_CMD_REPORT_STATUS && (((int)msg->data == AEL_STATUS_STATE_STOPPED) || ((int)msg->data == AEL_STATUS_STATE_FINISHED)))
     {
-        audio_event_iface_msg_t msg;
-        esp_err_t ret = audio_event_iface_listen(evt, &msg, portMAX_DELAY);
-        if (ret != ESP_OK)
+        BINLOGW(TAG, "[ * ] Stop event received");
+        // A station change stops the chain too, it is running again by the time its event arrives
+        if (audio_element_get_state(i2s_stream_writer) == AEL_STATE_RUNNING)
         {
-            ESP_LOGE(TAG, "[ * ] Event interface error : %d", ret);
-            continue;
+            return;
         }
-        /* Receive a mp3 stream from the server and play it */
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *)mp3_decoder && msg.cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
+        resilient_http_stats_t stats;
+        resilient_http_get_stats(http_stream_reader, &stats);
+        if (stats.gave_up)
         {
-            audio_element_info_t music_info = {0};
-            audio_element_getinfo(mp3_decoder, &music_info);
-
-            ESP_LOGI(TAG, "[ * ] Receive music info from mp3 decoder, sample_rates=%d, bits=%d, ch=%d",
-                     music_info.sample_rates, music_info.bits, music_info.channels);
-
-            i2s_stream_set_clk(i2s_stream_writer, music_info.sample_rates, music_info.bits, music_info.channels);
-            continue;
+            // The reader already backed off on every mirror it tried, move on at once
+            int next = (stats.url_index + 1) % station_count;
+            BINLOGW(TAG, "[ * ] Station %d does not answer, moving to station %d", stats.url_index, next);
+            radio_select_station(next);
+            return;
         }
+        schedule_restart();
+    }
+}
 
-        /* Stop when the last pipeline element (i2s_stream_writer in this case) receives stop event */
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT && msg.source == (void *)i2s_stream_writer && msg.cmd == AEL_MSG_CMD_REPORT_STATUS && (((int)msg.data == AEL_STATUS_STATE_STOPPED) || ((int)msg.data == AEL_STATUS_STATE_FINISHED)))
-        {
-            ESP_LOGW(TAG, "[ * ] Stop event received");
-            break;
-        }
+/**
+ * @brief Handles the keys while the radio is active.
+ *
+ * [Play] pauses and resumes through the timeshift buffer, [Set] goes to the next station.
+ *
+ * @param key_id Id of the clicked key.
+ */
+void radio_handle_key(int key_id)
+{
+    switch (key_id)
+    {
+    case INPUT_KEY_USER_ID_PLAY:
+        radio_toggle_pause();
+        break;
+    case INPUT_KEY_USER_ID_SET:
+        radio_next_station();
+        break;
+    case INPUT_KEY_USER_ID_REC:
+        radio_jump_to_live();
+        break;
+    }
+}
+
+/**
+ * @brief Restarts the radio chain on the next station.
+ */
+void radio_next_station(void)
+{
+    radio_select_station((station + 1) % station_count);
+}
 
-        // Cleanup and stop the audio pipeline
-        ESP_LOGI(TAG, "[ 6 ] Stop audio_pipeline");
-        audio_pipeline_stop(pipeline);
-        audio_pipeline_wait_for_stop(pipeline);
-        audio_pipeline_terminate(pipeline);
+/**
+ * @brief Selects a station, restarting the radio chain on it when the radio is active.
+ */
+esp_err_t radio_select_station(int index)
+{
+    if (index < 0 || index >= station_count)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+    station = index;
+    BINLOGI(TAG, "[ * ] Switching to station %d", station);
+    if (mode_manager_get_mode() != PLAYER_MODE_RADIO)
+    {
+        // Started when the radio is activated
+        resume_state_set_station(station);
+        return ESP_OK;
+    }
+    audio_pipeline_handle_t pipeline = mode_manager_get_pipeline();
+    audio_pipeline_stop(pipeline);
+    audio_pipeline_wait_for_stop(pipeline);
+    return radio_activate();
+}
 
-        /* Terminate the pipeline before removing the listener */
-        audio_pipeline_unregister(pipeline, http_stream_reader);
-        audio_pipeline_unregister(pipeline, i2s_stream_writer);
-        audio_pipeline_unregister(pipeline, mp3_decoder);
+int radio_get_station(void)
+{
+    return station;
+}
 
-        audio_pipeline_remove_listener(pipeline);
+int radio_get_station_count(void)
+{
+    return station_count;
+}
 
-        /* Stop all peripherals before removing the listener */
-        esp_periph_set_stop_all(set);
-        audio_event_iface_remove_listener(esp_periph_set_get_event_iface(set), evt);
+const char *radio_get_station_url(int index)
+{
+    return index >= 0 && index < station_count ? stations[index] : NULL;
+}
 
-        /* Make sure audio_pipeline_remove_listener & audio_event_iface_remove_listener are called before destroying event_iface */
-        audio_event_iface_destroy(evt);
+/**
+ * @brief Pauses or resumes the radio without dropping the stream.
+ */
+void radio_toggle_pause(void)
+{
+    if (timeshift == NULL)
+    {
+        return;
+    }
+    bool paused = !timeshift_is_paused(timeshift);
+    timeshift_set_paused(timeshift, paused);
+    BINLOGI(TAG, "[ * ] Radio %s", paused ? "paused" : "resumed");
+}
 
-        /* Release all resources */
-        audio_pipeline_deinit(pipeline);
-        audio_element_deinit(http_stream_reader);
-        audio_element_deinit(i2s_stream_writer);
-        audio_element_deinit(mp3_decoder);
-        esp_periph_set_destroy(set);
+/**
+ * @brief Continues the radio at the live point.
+ */
+void radio_jump_to_live(void)
+{
+    if (timeshift == NULL)
+    {
+        return;
     }
-}
\ No newline at end of file
+    timeshift_jump_to_live(timeshift);
+    timeshift_set_paused(timeshift, false);
+    BINLOGI(TAG, "[ * ] Radio back to live");
+}
@@ -0,0 +1,307 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "binlog.h"
+#include "esp_timer.h"
+#include "lean_http.h"
+#include "audio_mem.h"
+#include "mp3_frame.h"
+#include "trace_recorder.h"
+#include "resilient_http.h"
+
+static const char *TAG = "RESILIENT_HTTP";
+
+/* Wait in short slices so a pipeline stop is never delayed by a backoff */
+#define WAIT_SLICE_MS 100
+/* Give up looking for a frame header after this many bytes, the stream may not be MP3 */
+#define RESYNC_LIMIT (16 * 1024)
+
+/**
+ * @brief Private state of the resilient http reader.
+ */
+typedef struct {
+    resilient_http_cfg_t cfg;
+    lean_http_handle_t client;
+    bool connected;
+    bool accept_ranges;
+    bool resync;
+    int resync_dropped;
+
+    int url_index;
+    int url_failures;
+    int failures;
+    int64_t next_attempt_us;
+    int64_t drop_time_us;
+
+    int64_t content_length;
+    int64_t pos;
+    resilient_http_stats_t stats;
+} resilient_http_t;
+
+/**
+ * @brief Opens a connection to the current mirror.
+ *
+ * @return ESP_OK when the server answered with audio data.
+ */
+static esp_err_t connect_stream(resilient_http_t *rh)
+{
+    if (rh->client == NULL) {
+        rh->client = lean_http_create();
+        if (rh->client == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    // Resume a file where it dropped, live streams always restart at the live point
+    bool resume = rh->accept_ranges && rh->content_length > 0 && rh->pos > 0;
+    lean_http_response_t response;
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = lean_http_open(rh->client, rh->cfg.urls[rh->url_index], resume ? rh->pos : 0,
+                                   rh->cfg.timeout_ms, &response);
+    lean_http_get_stats(rh->client, &rh->stats.connection);
+    if (err != ESP_OK) {
+        trace_recorder_io(TRACE_IO_HTTP_CONNECT, start, -1);
+        BINLOGW(TAG, "Connect to mirror %d failed: %s", rh->url_index, esp_err_to_name(err));
+        return err;
+    }
+
+    int status = response.status;
+    trace_recorder_io(TRACE_IO_HTTP_CONNECT, start, status);
+    if (status != 200 && !(resume && status == 206)) {
+        BINLOGW(TAG, "Mirror %d answered with status %d", rh->url_index, status);
+        lean_http_close(rh->client);
+        return ESP_FAIL;
+    }
+
+    rh->accept_ranges = response.accept_ranges;
+    if (status == 200) {
+        rh->pos = 0;
+        rh->content_length = response.content_length > 0 ? response.content_length : -1;
+    }
+    rh->connected = true;
+    rh->resync = true;
+    rh->resync_dropped = 0;
+    BINLOGI(TAG, "Connected to mirror %d in %d ms%s", rh->url_index,
+             (int)((esp_timer_get_time() - start) / 1000), status == 206 ? ", resumed" : "");
+    const lean_http_stats_t *conn = &rh->stats.connection;
+    if (conn->tls) {
+        BINLOGI(TAG, "TLS handshake %d ms%s, %u bytes, %u at the peak", conn->handshake_ms,
+                 conn->resumed ? " resumed" : "", conn->tls_heap, conn->tls_heap_peak);
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Closes the connection and schedules the next attempt with exponential backoff.
+ */
+static void schedule_reconnect(resilient_http_t *rh)
+{
+    int64_t now = esp_timer_get_time();
+    if (rh->connected) {
+        lean_http_close(rh->client);
+        rh->connected = false;
+    }
+    if (rh->drop_time_us == 0) {
+        rh->drop_time_us = now;
+    }
+
+    rh->failures++;
+    if (++rh->url_failures >= rh->cfg.retries_per_url && rh->cfg.url_count > 1) {
+        rh->url_index = (rh->url_index + 1) % rh->cfg.url_count;
+        rh->url_failures = 0;
+        rh->pos = 0;
+        rh->content_length = -1;
+        BINLOGW(TAG, "Switching to mirror %d", rh->url_index);
+    }
+
+    int shift = rh->failures - 1 < 16 ? rh->failures - 1 : 16;
+    int64_t delay_ms = (int64_t)rh->cfg.backoff_min_ms << shift;
+    if (delay_ms > rh->cfg.backoff_max_ms) {
+        delay_ms = rh->cfg.backoff_max_ms;
+    }
+    rh->next_attempt_us = now + delay_ms * 1000;
+    BINLOGW(TAG, "Stream dropped, reconnecting in %d ms", (int)delay_ms);
+}
+
+/**
+ * @brief Returns whether the reader is out of retries, the stream is then finished.
+ */
+static bool out_of_retries(resilient_http_t *rh)
+{
+    if (rh->cfg.max_failures <= 0 || rh->failures < rh->cfg.max_failures) {
+        return false;
+    }
+    if (!rh->stats.gave_up) {
+        BINLOGE(TAG, "Giving up after %d failed attempts", rh->failures);
+        rh->stats.gave_up = true;
+    }
+    return true;
+}
+
+/**
+ * @brief Records the recovery time once audio flows again after a drop.
+ */
+static void mark_recovered(resilient_http_t *rh)
+{
+    if (rh->drop_time_us == 0) {
+        return;
+    }
+    int ms = (esp_timer_get_time() - rh->drop_time_us) / 1000;
+    rh->stats.reconnects++;
+    rh->stats.last_recovery_ms = ms;
+    if (ms > rh->stats.max_recovery_ms) {
+        rh->stats.max_recovery_ms = ms;
+    }
+    rh->drop_time_us = 0;
+    rh->failures = 0;
+    rh->url_failures = 0;
+    BINLOGW(TAG, "Stream recovered after %d ms", ms);
+}
+
+static esp_err_t _resilient_open(audio_element_handle_t self)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(self);
+    if (rh->cfg.url_count == 0) {
+        ESP_LOGE(TAG, "No stream urls set");
+        return ESP_FAIL;
+    }
+    rh->connected = false;
+    rh->failures = 0;
+    rh->url_failures = 0;
+    rh->next_attempt_us = 0;
+    rh->drop_time_us = 0;
+    rh->pos = 0;
+    rh->content_length = -1;
+    memset(&rh->stats, 0, sizeof(rh->stats));
+    // The first connect happens in process so a dead mirror does not fail the pipeline
+    return ESP_OK;
+}
+
+static int _resilient_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(self);
+
+    if (!rh->connected) {
+        int64_t wait_us = rh->next_attempt_us - esp_timer_get_time();
+        if (wait_us > 0) {
+            int wait_ms = wait_us / 1000 < WAIT_SLICE_MS ? wait_us / 1000 + 1 : WAIT_SLICE_MS;
+            vTaskDelay(pdMS_TO_TICKS(wait_ms));
+            return AEL_IO_TIMEOUT;
+        }
+        if (connect_stream(rh) != ESP_OK) {
+            schedule_reconnect(rh);
+            return out_of_retries(rh) ? AEL_IO_DONE : AEL_IO_TIMEOUT;
+        }
+    }
+
+    int64_t read_start = trace_recorder_now();
+    int r = lean_http_read(rh->client, in_buffer, in_len);
+    trace_recorder_io(TRACE_IO_HTTP_READ, read_start, r);
+    if (r <= 0) {
+        if (rh->content_length > 0 && rh->pos >= rh->content_length) {
+            return AEL_IO_DONE;
+        }
+        schedule_reconnect(rh);
+        return out_of_retries(rh) ? AEL_IO_DONE : AEL_IO_TIMEOUT;
+    }
+    rh->pos += r;
+    rh->stats.bytes_read += r;
+
+    int offset = 0;
+    if (rh->resync) {
+        offset = mp3_frame_find_sync((const uint8_t *)in_buffer, r);
+        if (offset < 0) {
+            rh->resync_dropped += r;
+            if (rh->resync_dropped < RESYNC_LIMIT) {
+                return AEL_IO_TIMEOUT;
+            }
+            BINLOGW(TAG, "No MP3 frame header found, passing the stream through");
+            offset = 0;
+        }
+        rh->resync = false;
+    }
+    mark_recovered(rh);
+
+    int w = audio_element_output(self, in_buffer + offset, r - offset);
+    if (w > 0) {
+        audio_element_update_byte_pos(self, w);
+    }
+    return w;
+}
+
+static esp_err_t _resilient_close(audio_element_handle_t self)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(self);
+    if (rh->client) {
+        lean_http_destroy(rh->client);
+        rh->client = NULL;
+    }
+    rh->connected = false;
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _resilient_destroy(audio_element_handle_t self)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(self);
+    audio_free(rh);
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates the resilient http reader.
+ */
+audio_element_handle_t resilient_http_init(resilient_http_cfg_t *config)
+{
+    resilient_http_t *rh = audio_calloc(1, sizeof(resilient_http_t));
+    AUDIO_MEM_CHECK(TAG, rh, return NULL);
+    rh->cfg = *config;
+    rh->url_index = config->start_index;
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _resilient_open;
+    cfg.process = _resilient_process;
+    cfg.close = _resilient_close;
+    cfg.destroy = _resilient_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.buffer_len = config->buf_sz;
+    cfg.tag = "http";
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(rh);
+        return NULL;
+    });
+    audio_element_setdata(el, rh);
+    return el;
+}
+
+/**
+ * @brief Selects the mirror used on the next open.
+ */
+void resilient_http_set_url_index(audio_element_handle_t el, int index)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(el);
+    if (index >= 0 && index < rh->cfg.url_count) {
+        rh->url_index = index;
+    }
+}
+
+/**
+ * @brief Reads the reconnect statistics.
+ */
+void resilient_http_get_stats(audio_element_handle_t el, resilient_http_stats_t *stats)
+{
+    resilient_http_t *rh = (resilient_http_t *)audio_element_getdata(el);
+    *stats = rh->stats;
+    stats->url_index = rh->url_index;
+    if (rh->client) {
+        lean_http_get_stats(rh->client, &stats->connection);
+    }
+}
@@ -0,0 +1,217 @@
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "nvs_flash.h"
+#include "nvs.h"
+#include "resume_state.h"
+
+static const char *TAG = "RESUME_STATE";
+
+#define NVS_NAMESPACE "resume"
+#define NVS_KEY "state"
+
+/* Interval of the writer task, also the position poll interval */
+#define POLL_INTERVAL_MS 1000
+
+/* Interval of the write count log */
+#define STATS_INTERVAL_US (3600LL * 1000 * 1000)
+
+static resume_state_cfg_t resume_cfg;
+static portMUX_TYPE state_lock = portMUX_INITIALIZER_UNLOCKED;
+static SemaphoreHandle_t write_lock = NULL;
+static nvs_handle_t nvs = 0;
+
+// State in RAM and the state last written to NVS
+static resume_state_t state;
+static resume_state_t written;
+static int64_t last_write_us = 0;
+static uint32_t writes = 0;
+
+static volatile resume_position_source_t position_source = NULL;
+
+/**
+ * @brief Writes the state when it changed and the interval for that kind of change has passed.
+ *
+ * @param force Ignore the intervals.
+ */
+static esp_err_t write_state(bool force)
+{
+    if (write_lock == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    xSemaphoreTake(write_lock, portMAX_DELAY);
+    resume_state_t copy;
+    portENTER_CRITICAL(&state_lock);
+    copy = state;
+    portEXIT_CRITICAL(&state_lock);
+
+    esp_err_t ret = ESP_OK;
+    if (memcmp(&copy, &written, sizeof(copy)) != 0) {
+        // Everything but the position counts as a change worth writing soon
+        resume_state_t moved = written;
+        moved.position_ms = copy.position_ms;
+        bool changed = memcmp(&copy, &moved, sizeof(copy)) != 0;
+        int interval_ms = changed ? resume_cfg.change_interval_ms : resume_cfg.position_interval_ms;
+        int64_t now = esp_timer_get_time();
+
+        if (force || now - last_write_us >= (int64_t)interval_ms * 1000) {
+            ret = nvs_set_blob(nvs, NVS_KEY, &copy, sizeof(copy));
+            if (ret == ESP_OK) {
+                ret = nvs_commit(nvs);
+            }
+            if (ret == ESP_OK) {
+                written = copy;
+                writes++;
+                last_write_us = now;
+            } else {
+                ESP_LOGE(TAG, "Failed to write the state: %s", esp_err_to_name(ret));
+            }
+        }
+    }
+    xSemaphoreGive(write_lock);
+    return ret;
+}
+
+static void resume_state_task(void *pvParameters)
+{
+    uint32_t reported = 0;
+    int64_t stats_start_us = esp_timer_get_time();
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(POLL_INTERVAL_MS));
+
+        resume_position_source_t source = position_source;
+        int32_t position_ms = source ? source() : -1;
+        if (position_ms >= 0) {
+            portENTER_CRITICAL(&state_lock);
+            state.position_ms = position_ms;
+            portEXIT_CRITICAL(&state_lock);
+        }
+        write_state(false);
+
+        int64_t now = esp_timer_get_time();
+        if (now - stats_start_us >= STATS_INTERVAL_US) {
+            ESP_LOGI(TAG, "%u state writes in the last hour", (unsigned)(writes - reported));
+            reported = writes;
+            stats_start_us = now;
+        }
+    }
+}
+
+// Called by esp_restart()
+static void shutdown_handler(void)
+{
+    write_state(true);
+}
+
+/**
+ * @brief Loads the saved state and starts the writer task.
+ */
+esp_err_t resume_state_init(const resume_state_cfg_t *config, resume_state_t *saved)
+{
+    resume_cfg = *config;
+    memset(&state, 0, sizeof(state));
+    state.mode = state.volume = state.station = state.track_id = -1;
+    state.position_ms = 0;
+
+    esp_err_t ret = nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs);
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to open NVS: %s", esp_err_to_name(ret));
+        *saved = state;
+        return ESP_FAIL;
+    }
+
+    size_t len = sizeof(state);
+    ret = nvs_get_blob(nvs, NVS_KEY, &state, &len);
+    if (ret != ESP_OK || len != sizeof(state)) {
+        // Nothing saved yet, or saved by a firmware with another layout
+        memset(&state, 0, sizeof(state));
+        state.mode = state.volume = state.station = state.track_id = -1;
+        ret = ESP_ERR_NOT_FOUND;
+    }
+    state.track[RESUME_STATE_PATH_LEN - 1] = '\0';
+    written = state;
+    *saved = state;
+
+    write_lock = xSemaphoreCreateMutex();
+    if (write_lock == NULL ||
+        xTaskCreate(resume_state_task, "resume_state", 3072, NULL, resume_cfg.task_prio, NULL) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the writer task");
+        return ESP_FAIL;
+    }
+    esp_register_shutdown_handler(shutdown_handler);
+    return ret;
+}
+
+/**
+ * @brief Saves the active mode.
+ */
+void resume_state_set_mode(int mode)
+{
+    portENTER_CRITICAL(&state_lock);
+    state.mode = mode;
+    portEXIT_CRITICAL(&state_lock);
+}
+
+/**
+ * @brief Saves the codec volume.
+ */
+void resume_state_set_volume(int volume)
+{
+    portENTER_CRITICAL(&state_lock);
+    state.volume = volume;
+    portEXIT_CRITICAL(&state_lock);
+}
+
+/**
+ * @brief Saves the radio station.
+ */
+void resume_state_set_station(int station)
+{
+    portENTER_CRITICAL(&state_lock);
+    state.station = station;
+    portEXIT_CRITICAL(&state_lock);
+}
+
+/**
+ * @brief Saves the song that starts playing, at position 0.
+ */
+void resume_state_set_track(int track_id, const char *path)
+{
+    char track[RESUME_STATE_PATH_LEN] = "";
+    if (path && strlen(path) < sizeof(track)) {
+        strcpy(track, path);
+    }
+    portENTER_CRITICAL(&state_lock);
+    state.track_id = track_id;
+    state.position_ms = 0;
+    memcpy(state.track, track, sizeof(track));
+    portEXIT_CRITICAL(&state_lock);
+}
+
+/**
+ * @brief Sets the source the writer polls for the position, NULL to stop polling.
+ */
+void resume_state_set_position_source(resume_position_source_t source)
+{
+    position_source = source;
+}
+
+/**
+ * @brief Writes the state now if it changed, regardless of the intervals.
+ */
+esp_err_t resume_state_flush(void)
+{
+    return write_state(true);
+}
+
+/**
+ * @brief Returns the number of NVS writes since boot.
+ */
+uint32_t resume_state_get_writes(void)
+{
+    return writes;
+}
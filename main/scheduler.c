@@ -0,0 +1,304 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "scheduler.h"
+
+static const char *TAG = "SCHEDULER";
+
+#define TICK_US (SCHEDULER_TICK_MS * 1000)
+
+/* Kinds of timers, stored in the hour field */
+#define KIND_HOURLY -1
+#define KIND_DELAY -2
+
+/* Times before 2016 mean the clock was never set */
+#define TIME_VALID_AFTER 1451606400
+
+/* Difference between the wall clock and esp_timer that counts as setting the clock */
+#define CLOCK_STEP_US 2000000
+
+/* Largest daylight saving time shift, a daily timer never expires twice within it */
+#define DST_SHIFT_S 3600
+
+static SemaphoreHandle_t lock = NULL;
+static TaskHandle_t task = NULL;
+static timer_wheel_t wheel;
+static scheduler_timer_t *wall_timers = NULL;
+static scheduler_stats_t stats;
+static int64_t wall_offset_us = 0;
+
+static int64_t wall_now_us(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+// Wakes the scheduler task so it sleeps for the right time again
+static void wake_task(void)
+{
+    if (task && xTaskGetCurrentTaskHandle() != task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+// Puts a timer in the wheel, rounded up so it never expires before it is due
+static void arm(scheduler_timer_t *t, int64_t due_us)
+{
+    t->due_us = due_us;
+    timer_wheel_add(&wheel, &t->wheel, (uint32_t)((due_us + TICK_US - 1) / TICK_US));
+}
+
+// Arms a wall clock timer for its first occurrence after a time, or lets it wait for the clock to be set
+static void arm_wall(scheduler_timer_t *t, time_t after)
+{
+    int64_t wall_us = wall_now_us();
+    if (wall_us / 1000000 < TIME_VALID_AFTER) {
+        t->at = 0;
+        timer_wheel_cancel(&wheel, &t->wheel);
+        return;
+    }
+    t->at = t->hour == KIND_HOURLY ? scheduler_next_hour(after) : scheduler_next_daily(after, t->hour, t->minute);
+    arm(t, esp_timer_get_time() + (int64_t)t->at * 1000000 - wall_us);
+}
+
+static void wall_link(scheduler_timer_t *t)
+{
+    if (t->wall_pprev) {
+        return;
+    }
+    t->wall_next = wall_timers;
+    if (wall_timers) {
+        wall_timers->wall_pprev = &t->wall_next;
+    }
+    wall_timers = t;
+    t->wall_pprev = &wall_timers;
+}
+
+static void wall_unlink(scheduler_timer_t *t)
+{
+    if (t->wall_pprev == NULL) {
+        return;
+    }
+    *t->wall_pprev = t->wall_next;
+    if (t->wall_next) {
+        t->wall_next->wall_pprev = t->wall_pprev;
+    }
+    t->wall_pprev = NULL;
+}
+
+static void rearm_wall_timers(void)
+{
+    time_t now = time(NULL);
+    for (scheduler_timer_t *t = wall_timers; t; t = t->wall_next) {
+        arm_wall(t, now);
+    }
+}
+
+// Callback of the wheel, runs the callback of the timer when it is really due
+static void dispatch(timer_wheel_timer_t *wheel_timer, void *arg)
+{
+    scheduler_timer_t *t = (scheduler_timer_t *)arg;
+    int64_t now = esp_timer_get_time();
+    int64_t late = now - t->due_us;
+    if (t->hour != KIND_DELAY) {
+        // The wall clock may run slower than esp_timer between SNTP updates
+        int64_t wall_us = wall_now_us();
+        if (wall_us < (int64_t)t->at * 1000000) {
+            arm(t, now + (int64_t)t->at * 1000000 - wall_us);
+            return;
+        }
+        arm_wall(t, t->hour == KIND_HOURLY ? t->at : t->at + DST_SHIFT_S);
+    }
+
+    stats.dispatched++;
+    stats.total_late_us += late;
+    stats.max_late_us = late > stats.max_late_us ? late : stats.max_late_us;
+
+    // The timer is out of the wheel, which stays consistent while other tasks change it
+    xSemaphoreGiveRecursive(lock);
+    t->cb(t, t->arg);
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+}
+
+static void scheduler_task(void *pvParameters)
+{
+    while (1) {
+        xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+        int64_t now = esp_timer_get_time();
+        int64_t offset = wall_now_us() - now;
+        if (llabs(offset - wall_offset_us) > CLOCK_STEP_US) {
+            ESP_LOGI(TAG, "Clock set, computing the wall clock timers again");
+            wall_offset_us = offset;
+            rearm_wall_timers();
+        }
+        timer_wheel_advance(&wheel, (uint32_t)(now / TICK_US));
+        uint32_t due = timer_wheel_next_due(&wheel);
+        int64_t wait_us = due == TIMER_WHEEL_IDLE ? -1 : (int64_t)(wheel.now + due) * TICK_US - esp_timer_get_time();
+        xSemaphoreGiveRecursive(lock);
+
+        // Sleep until the wheel has work, or until a timer is started
+        TickType_t wait = portMAX_DELAY;
+        if (wait_us >= 0) {
+            wait = (wait_us + portTICK_PERIOD_MS * 1000 - 1) / (portTICK_PERIOD_MS * 1000);
+        }
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+/**
+ * @brief Starts the scheduler task.
+ */
+esp_err_t scheduler_init(const scheduler_cfg_t *config)
+{
+    timer_wheel_init(&wheel, (uint32_t)(esp_timer_get_time() / TICK_US));
+    wall_offset_us = wall_now_us() - esp_timer_get_time();
+    lock = xSemaphoreCreateRecursiveMutex();
+    if (lock == NULL ||
+        xTaskCreate(scheduler_task, "scheduler", config->task_stack, NULL, config->task_prio, &task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the scheduler task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Prepares a timer, call it once before starting the timer.
+ */
+void scheduler_timer_init(scheduler_timer_t *t, scheduler_cb_t cb, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    timer_wheel_timer_init(&t->wheel, dispatch, t);
+    t->cb = cb;
+    t->arg = arg;
+    t->hour = KIND_DELAY;
+}
+
+/**
+ * @brief Starts a timer that expires once after a delay, restarting it when it runs.
+ */
+void scheduler_start_after(scheduler_timer_t *t, uint32_t delay_ms)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    wall_unlink(t);
+    t->hour = KIND_DELAY;
+    arm(t, esp_timer_get_time() + (int64_t)delay_ms * 1000);
+    xSemaphoreGiveRecursive(lock);
+    wake_task();
+}
+
+/**
+ * @brief Starts a timer that expires every hour on the hour, local time.
+ */
+void scheduler_start_hourly(scheduler_timer_t *t)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    t->hour = KIND_HOURLY;
+    wall_link(t);
+    arm_wall(t, time(NULL));
+    xSemaphoreGiveRecursive(lock);
+    wake_task();
+}
+
+/**
+ * @brief Starts a timer that expires every day at a local time.
+ */
+void scheduler_start_daily(scheduler_timer_t *t, int hour, int minute)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    t->hour = hour;
+    t->minute = minute;
+    wall_link(t);
+    arm_wall(t, time(NULL));
+    xSemaphoreGiveRecursive(lock);
+    wake_task();
+}
+
+/**
+ * @brief Stops a timer, nothing happens when it is not running.
+ */
+void scheduler_cancel(scheduler_timer_t *t)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    wall_unlink(t);
+    timer_wheel_cancel(&wheel, &t->wheel);
+    xSemaphoreGiveRecursive(lock);
+}
+
+/**
+ * @brief Returns whether a timer is running.
+ */
+bool scheduler_is_running(scheduler_timer_t *t)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    // A wall clock timer waiting for the clock to be set is running too
+    bool running = timer_wheel_pending(&t->wheel) || t->wall_pprev != NULL;
+    xSemaphoreGiveRecursive(lock);
+    return running;
+}
+
+/**
+ * @brief Computes the wall clock timers again after the clock was set.
+ */
+void scheduler_time_changed(void)
+{
+    if (lock == NULL) {
+        return;
+    }
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    wall_offset_us = wall_now_us() - esp_timer_get_time();
+    rearm_wall_timers();
+    xSemaphoreGiveRecursive(lock);
+    wake_task();
+}
+
+/**
+ * @brief Returns the next time after a time at which the local clock shows hour:minute.
+ *
+ * mktime() picks the UTC offset of the day, so the result follows the daylight saving time changes.
+ */
+time_t scheduler_next_daily(time_t after, int hour, int minute)
+{
+    struct tm today;
+    localtime_r(&after, &today);
+    for (int day = 0; day < 2; day++) {
+        struct tm tm = today;
+        tm.tm_mday += day;
+        tm.tm_hour = hour;
+        tm.tm_min = minute;
+        tm.tm_sec = 0;
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        if (t > after) {
+            return t;
+        }
+    }
+    return after + 24 * 3600;
+}
+
+/**
+ * @brief Returns the next full hour after a time.
+ *
+ * The UTC offsets of the time zone are whole hours, so a full hour in local time is one in UTC.
+ */
+time_t scheduler_next_hour(time_t after)
+{
+    struct tm tm;
+    localtime_r(&after, &tm);
+    return after - tm.tm_min * 60 - tm.tm_sec + 3600;
+}
+
+/**
+ * @brief Reads the dispatch statistics.
+ */
+void scheduler_get_stats(scheduler_stats_t *out)
+{
+    xSemaphoreTakeRecursive(lock, portMAX_DELAY);
+    *out = stats;
+    xSemaphoreGiveRecursive(lock);
+}
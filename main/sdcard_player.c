@@ -11,211 +11,424 @@
 static const char *TAG = "SDCARD_PLAYER";
 audio_pipeline_handle_t pipeline;
 audio_element_handle_t i2s_stream_writer, wav_decoder, fatfs_stream_reader, rsp_handle;
+static audio_element_handle_t fused_player = NULL;
+// Element that opens the track file and element that finishes last, depends on the playback chain
+static audio_element_handle_t track_reader, track_tail;
 playlist_operator_handle_t sdcard_list_handle = NULL;
 esp_periph_set_handle_t set;
 audio_event_iface_handle_t evt;
 char *url = NULL;
-int player_volume = 0;
 audio_board_handle_t board_handle;
-periph_service_handle_t input_ser;
-
-void sdcard_player_init()
+static voicepack_t *voice_pack = NULL;
+static audio_element_handle_t voicepack_reader = NULL;
+static bool announcing = false;
+
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+static const char *file_link_tag[1] = {"fused"};
+#else
+static const char *file_link_tag[4] = {"file", "wav", "filter", "i2s"};
+#endif
+#define FILE_LINK_NUM (sizeof(file_link_tag) / sizeof(file_link_tag[0]))
+static const char *voicepack_link_tag[3] = {"vpak", "filter", "i2s"};
+#if !CONFIG_SDCARD_FUSED_PLAYBACK
+// Format and data chunk of the track last sought in, parsed again when the track changes
+static wav_file_info_t seek_wav;
+static char seek_path[128] = "";
+#endif
+
+/* Scrubbing: one step per period while Vol+ or Vol- is held, bigger steps after holding a while */
+#define SCRUB_PERIOD_MS 250
+#define SCRUB_STEP_MS 5000
+#define SCRUB_FAST_STEP_MS 20000
+#define SCRUB_FAST_AFTER_MS 3000
+
+static TimerHandle_t scrub_timer = NULL;
+static audio_event_iface_handle_t scrub_evt = NULL;
+static int scrub_direction = 0;
+static int64_t scrub_start_us = 0;
+
+// Song saved before the last power cycle, played while the playlist scan runs in the background
+static char resume_path[RESUME_STATE_PATH_LEN] = "";
+static int resume_track_id = -1;
+static int32_t resume_position_ms = 0;
+static volatile bool playlist_ready = false;
+// A playlist song plays, not a sound or an announcement, so its position is saved
+static bool playing_playlist = false;
+
+// Give the playback clock the length of the track from the size of the source and its format
+static void set_track_duration(audio_element_handle_t source, const audio_element_info_t *format, int header_size)
 {
-    initialize_peripherals();
-    setup_sdcard_playlist();
-    start_codec_chip();
-    create_input_key_service();
-    create_audio_pipeline();
-    set_up_event_listener();
+    audio_element_info_t source_info = {0};
+    audio_element_getinfo(source, &source_info);
+    int bytes_per_sec = format->sample_rates * format->channels * format->bits / 8;
+    if (bytes_per_sec <= 0 || source_info.total_bytes <= header_size)
+    {
+        playback_clock_set_duration(-1);
+        return;
+    }
+    playback_clock_set_duration((source_info.total_bytes - header_size) * 1000 / bytes_per_sec);
+}
 
-    ESP_LOGW(TAG, "[ 6 ] Press the keys to control music player:");
-    ESP_LOGW(TAG, "      [Play] to start, pause and resume, [Set] next song.");
-    ESP_LOGW(TAG, "      [Vol-] or [Vol+] to adjust volume.");
+// Give the playback clock the length of the data chunk the decoder found, cut to the file for recordings that were cut off
+static void set_wav_duration()
+{
+    wav_file_info_t wav;
+    audio_element_info_t source_info = {0};
+    wav_stream_get_format(wav_decoder, &wav);
+    audio_element_getinfo(fatfs_stream_reader, &source_info);
+    if (source_info.total_bytes > wav.data_offset && wav.data_size > source_info.total_bytes - wav.data_offset)
+    {
+        wav.data_size = (source_info.total_bytes - wav.data_offset) / wav.block_align * wav.block_align;
+    }
+    playback_clock_set_duration(wav.data_size == UINT32_MAX ? -1 : wav_file_duration_ms(&wav));
 }
 
-// Initialize peripherals management and audio board
-void initialize_peripherals()
+const player_mode_ops_t sdcard_mode_ops = {
+    .name = "Sampler",
+    .init = sdcard_player_init,
+    .activate = sdcard_player_activate,
+    .deactivate = sdcard_player_deactivate,
+    .handle_event = sdcard_player_handle_event,
+    .handle_key = sdcard_player_handle_key,
+    .handle_scrub = sdcard_player_handle_scrub,
+};
+
+// Runs in the timer task, hands the scrub step to the mode manager task through the event interface
+static void scrub_timer_cb(TimerHandle_t timer)
 {
-    ESP_LOGW(TAG, "[1.0] Initialize peripherals management");
-    esp_periph_config_t periph_cfg = DEFAULT_ESP_PERIPH_SET_CONFIG();
+    audio_event_iface_msg_t msg = {0};
+    msg.source = (void *)scrub_evt;
+    audio_event_iface_sendout(scrub_evt, &msg);
+}
 
-    set = esp_periph_set_init(&periph_cfg);
+// Position saved for a resume, only while a playlist song plays
+static int32_t resume_position()
+{
+    if (announcing || !playing_playlist || mode_manager_get_mode() != PLAYER_MODE_SDCARD)
+    {
+        return -1;
+    }
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    return pos.running ? (int32_t)pos.position_ms : -1;
+}
 
-    ESP_LOGW(TAG, "[1.1] Initialize and start peripherals");
-    audio_board_key_init(set);
+// Save the playlist song that starts for a resume after a power cycle
+static void remember_track()
+{
+    playing_playlist = true;
+    normalizer_select_track(url);
+    resume_state_set_track(playlist_ready ? sdcard_list_get_url_id(sdcard_list_handle) : resume_track_id, url);
+}
 
-    audio_board_sdcard_init(set, SD_MODE_1_LINE);
+// Add a playlist file entry, the sdcard chain only plays files
+static void playlist_entry_cb(void *ctx, const char *uri, const char *title)
+{
+    if (strstr(uri, "://") == NULL)
+    {
+        sdcard_url_save_cb(ctx, (char *)uri);
+    }
 }
 
-// Set up SD card playlist and scan music
-void setup_sdcard_playlist()
+// Fill the playlist in the order of the playlist file, or with every WAV file the scan finds
+static void load_playlist()
 {
-    ESP_LOGW(TAG, "[1.2] Set up a sdcard playlist and scan sdcard music save to it");
-    sdcard_list_create(&sdcard_list_handle);
-    sdcard_scan(sdcard_url_save_cb, "/sdcard", 0, (const char *[]){"wav"}, 1, sdcard_list_handle);
+    if (playlist_file_load(CONFIG_SDCARD_PLAYLIST, playlist_entry_cb, sdcard_list_handle) > 0)
+    {
+        ESP_LOGW(TAG, "[ * ] Songs taken from %s", CONFIG_SDCARD_PLAYLIST);
+    }
+    else
+    {
+        sdcard_scan(sdcard_url_save_cb, "/sdcard", 0, (const char *[]){"wav"}, 1, sdcard_list_handle);
+    }
     sdcard_list_show(sdcard_list_handle);
 }
 
-// Start codec chip for audio playback
-void start_codec_chip()
+// Load the playlist while the resumed song plays, then move the playlist to that song
+static void playlist_scan_task(void *pvParameters)
 {
-    ESP_LOGW(TAG, "[ 2 ] Start codec chip");
-    board_handle = audio_board_init();
-    audio_hal_ctrl_codec(board_handle->audio_hal, AUDIO_HAL_CODEC_MODE_DECODE, AUDIO_HAL_CTRL_START);
+    load_playlist();
+
+    // The saved index is right unless songs were added or removed, then look the path up
+    char *found = NULL;
+    int num = sdcard_list_get_url_num(sdcard_list_handle);
+    if (resume_track_id >= 0 && resume_track_id < num)
+    {
+        sdcard_list_choose(sdcard_list_handle, resume_track_id, &found);
+    }
+    for (int i = 0; i < num && (found == NULL || strcmp(found, resume_path) != 0); i++)
+    {
+        sdcard_list_choose(sdcard_list_handle, i, &found);
+    }
+    if (found == NULL || strcmp(found, resume_path) != 0)
+    {
+        ESP_LOGW(TAG, "[ * ] Resumed song is not in the playlist, [Set] starts at the top");
+        sdcard_list_choose(sdcard_list_handle, 0, &found);
+    }
+    else
+    {
+        url = found;
+    }
+    playlist_ready = true;
+    ESP_LOGW(TAG, "[ * ] Playlist ready with %d songs", num);
+    vTaskDelete(NULL);
 }
 
-// Create and start input key service
-void create_input_key_service()
+// Take the shared resources from the mode manager and register the player elements
+esp_err_t sdcard_player_init()
 {
-    ESP_LOGW(TAG, "[ 3 ] Create and start input key service");
-    input_key_service_info_t input_key_info[] = INPUT_KEY_DEFAULT_INFO();
-    input_key_service_cfg_t input_cfg = INPUT_KEY_SERVICE_DEFAULT_CONFIG();
-    input_cfg.handle = set;
-    input_ser = input_key_service_create(&input_cfg);
-    input_key_service_add_key(input_ser, input_key_info, INPUT_KEY_NUM);
-    periph_service_set_callback(input_ser, input_key_service_cb, (void *)board_handle);
+    pipeline = mode_manager_get_pipeline();
+    i2s_stream_writer = mode_manager_get_i2s_writer();
+    evt = mode_manager_get_event_iface();
+    set = mode_manager_get_periph_set();
+    board_handle = mode_manager_get_board();
+
+    setup_sdcard_playlist();
+    create_audio_elements();
+    // Measure the songs while nothing else needs the CPU, the results survive a power cycle
+    if (normalizer_scan_start("/sdcard") != ESP_OK)
+    {
+        ESP_LOGE(TAG, "[ * ] Failed to start the loudness scan");
+    }
+
+    audio_event_iface_cfg_t scrub_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
+    scrub_evt = audio_event_iface_init(&scrub_cfg);
+    audio_event_iface_set_listener(scrub_evt, evt);
+    scrub_timer = xTimerCreate("scrub", pdMS_TO_TICKS(SCRUB_PERIOD_MS), pdTRUE, NULL, scrub_timer_cb);
+
+    ESP_LOGW(TAG, "[ 6 ] Press the keys to control music player:");
+    ESP_LOGW(TAG, "      [Play] to start, pause and resume, [Set] next song.");
+    ESP_LOGW(TAG, "      [Vol-] or [Vol+] to adjust volume, hold to rewind or fast forward.");
+    return ESP_OK;
 }
 
-// Create audio pipeline for playback
-void create_audio_pipeline()
+// Set up SD card playlist and scan music, in the background when a saved song can play meanwhile
+void setup_sdcard_playlist()
 {
-    ESP_LOGW(TAG, "[4.0] Create audio pipeline for playback");
-    audio_pipeline_cfg_t pipeline_cfg = DEFAULT_AUDIO_PIPELINE_CONFIG();
-    pipeline = audio_pipeline_init(&pipeline_cfg);
-    mem_assert(pipeline);
+    sdcard_list_create(&sdcard_list_handle);
+    resume_state_set_position_source(resume_position);
 
-    create_audio_elements();
+    const resume_state_t *resumed = mode_manager_get_resume_state();
+    struct stat st;
+    if (resumed->track[0] != '\0' && stat(playlist_file_vfs_path(resumed->track), &st) == 0)
+    {
+        snprintf(resume_path, sizeof(resume_path), "%s", resumed->track);
+        resume_track_id = resumed->track_id;
+        resume_position_ms = resumed->position_ms;
+        url = resume_path;
+        ESP_LOGW(TAG, "[1.2] Resume %s at %d ms, load the playlist in the background", url, (int)resume_position_ms);
+        if (xTaskCreate(playlist_scan_task, "playlist_scan", 4096, NULL, 2, NULL) == pdPASS)
+        {
+            return;
+        }
+    }
+
+    ESP_LOGW(TAG, "[1.2] Set up a sdcard playlist from the playlist file or a scan of the sdcard music");
+    load_playlist();
+    sdcard_list_current(sdcard_list_handle, &url);
+    resume_position_ms = 0;
+    playlist_ready = true;
 }
 
 // Create audio elements for the pipeline
 void create_audio_elements()
 {
-    ESP_LOGW(TAG, "[4.1] Create i2s stream to write data to codec chip");
-    i2s_stream_cfg_t i2s_cfg = I2S_STREAM_CFG_DEFAULT();
-    i2s_cfg.type = AUDIO_STREAM_WRITER;
-    i2s_stream_writer = i2s_stream_init(&i2s_cfg);
-    i2s_stream_set_clk(i2s_stream_writer, 48000, 16, 2);
-
-    ESP_LOGW(TAG, "[4.2] Create wav decoder to decode wav file");
-    wav_decoder_cfg_t wav_cfg = DEFAULT_WAV_DECODER_CONFIG();
-    wav_decoder = wav_decoder_init(&wav_cfg);
-
-    ESP_LOGW(TAG, "[4.3] Create resample filter");
+    ESP_LOGW(TAG, "[4.2] Create resample filter");
     rsp_filter_cfg_t rsp_cfg = DEFAULT_RESAMPLE_FILTER_CONFIG();
     rsp_handle = rsp_filter_init(&rsp_cfg);
 
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+    ESP_LOGW(TAG, "[4.3] Create fused player to read, decode and play wav files in one task");
+    fused_player_cfg_t fused_cfg = FUSED_PLAYER_CFG_DEFAULT();
+    fused_cfg.multi_out_num = 1;
+    fused_player = fused_player_init(&fused_cfg);
+    vu_meter_attach(fused_player);
+    audio_element_set_uri(fused_player, url);
+    track_reader = fused_player;
+    track_tail = fused_player;
+#else
+    ESP_LOGW(TAG, "[4.3] Create wav decoder to decode wav file");
+    wav_stream_cfg_t wav_cfg = WAV_STREAM_CFG_DEFAULT();
+    wav_decoder = wav_stream_init(&wav_cfg);
+
     ESP_LOGW(TAG, "[4.4] Create fatfs stream to read data from sdcard");
-    sdcard_list_current(sdcard_list_handle, &url);
     fatfs_stream_cfg_t fatfs_cfg = FATFS_STREAM_CFG_DEFAULT();
     fatfs_cfg.type = AUDIO_STREAM_READER;
     fatfs_stream_reader = fatfs_stream_init(&fatfs_cfg);
     audio_element_set_uri(fatfs_stream_reader, url);
+    track_reader = fatfs_stream_reader;
+    track_tail = i2s_stream_writer;
+#endif
+
+    ESP_LOGW(TAG, "[4.5] Open voice pack for announcements");
+    if (voicepack_open(VOICEPACK_PATH, &voice_pack) == ESP_OK)
+    {
+        voicepack_stream_cfg_t vpak_cfg = VOICEPACK_STREAM_CFG_DEFAULT();
+        vpak_cfg.pack = voice_pack;
+        voicepack_reader = voicepack_stream_init(&vpak_cfg);
+    }
 
-    ESP_LOGW(TAG, "[4.5] Register all elements to audio pipeline");
+    ESP_LOGW(TAG, "[4.6] Register all elements to audio pipeline");
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+    audio_pipeline_register(pipeline, fused_player, "fused");
+#else
     audio_pipeline_register(pipeline, fatfs_stream_reader, "file");
     audio_pipeline_register(pipeline, wav_decoder, "wav");
+#endif
     audio_pipeline_register(pipeline, rsp_handle, "filter");
-    audio_pipeline_register(pipeline, i2s_stream_writer, "i2s");
+    if (voicepack_reader)
+    {
+        audio_pipeline_register(pipeline, voicepack_reader, "vpak");
+    }
 
-    ESP_LOGW(TAG, "[4.6] Link it together [sdcard]-->fatfs_stream-->wav_decoder-->resample-->i2s_stream-->[codec_chip]");
-    const char *link_tag[4] = {"file", "wav", "filter", "i2s"};
-    audio_pipeline_link(pipeline, &link_tag[0], 4);
+    ESP_LOGW(TAG, "[4.7] Free heap after player setup: %d bytes", (int)esp_get_free_heap_size());
 }
 
-// Set up event listener for pipeline events
-void set_up_event_listener()
+// Link the playlist chain and start the current song
+esp_err_t sdcard_player_activate()
 {
-    ESP_LOGW(TAG, "[5.0] Set up  event listener");
-    audio_event_iface_cfg_t evt_cfg = AUDIO_EVENT_IFACE_DEFAULT_CFG();
-    evt = audio_event_iface_init(&evt_cfg);
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+    ESP_LOGW(TAG, "[ 5 ] Link it together [sdcard]-->fused_player-->[codec_chip]");
+#else
+    ESP_LOGW(TAG, "[ 5 ] Link it together [sdcard]-->fatfs_stream-->wav_decoder-->resample-->i2s_stream-->[codec_chip]");
+#endif
+    // Another mode may have left the shared i2s writer at a different rate
+    i2s_stream_set_clk(i2s_stream_writer, 48000, 16, 2);
+    vu_meter_set_format(48000, 2);
+    playback_clock_set_format(48000, 2, 16);
+    normalizer_set_format(48000, 2, 16);
+    eq_set_format(48000, 2, 16);
+    announcing = false;
+    if (playlist_ready)
+    {
+        sdcard_list_current(sdcard_list_handle, &url);
+    }
+    if (url == NULL)
+    {
+        BINLOGW(TAG, "[ * ] No songs on the sdcard");
+        return ESP_ERR_NOT_FOUND;
+    }
+    remember_track();
+    audio_element_set_uri(track_reader, url);
+    playback_clock_start_track(-1);
+
+    // The first activation after boot continues the saved song where it was left
+    int32_t position_ms = resume_position_ms;
+    resume_position_ms = 0;
+    if (position_ms > 0)
+    {
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+        fused_player_seek(fused_player, position_ms);
+#else
+        return sdcard_player_seek(position_ms);
+#endif
+    }
+    return mode_manager_run_chain(file_link_tag, FILE_LINK_NUM);
+}
+
+// Called by the mode manager after the pipeline was stopped
+void sdcard_player_deactivate()
+{
+    announcing = false;
+    sdcard_player_handle_scrub(0);
+}
+
+// Start a file from the beginning
+static esp_err_t start_track(const char *uri)
+{
+    audio_element_set_uri(track_reader, uri);
+    playback_clock_start_track(-1);
+    audio_pipeline_reset_ringbuffer(pipeline);
+    audio_pipeline_reset_elements(pipeline);
+    audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
+    return audio_pipeline_run(pipeline);
+}
 
-    ESP_LOGW(TAG, "[5.1] Listen for all pipeline events");
-    audio_pipeline_set_listener(pipeline, evt);
+// One scrub step, longer the longer the key is held
+static void scrub_step()
+{
+    if (scrub_direction == 0)
+    {
+        return;
+    }
+    int64_t held_ms = (esp_timer_get_time() - scrub_start_us) / 1000;
+    int step_ms = held_ms >= SCRUB_FAST_AFTER_MS ? SCRUB_FAST_STEP_MS : SCRUB_STEP_MS;
+    sdcard_player_seek_relative(scrub_direction * step_ms);
 }
 
-void sdcard_player_start()
+// Handle pipeline events to set music info and to advance to the next song
+void sdcard_player_handle_event(audio_event_iface_msg_t *msg)
 {
-    while (1)
-    {
-        /* Handle event interface messages from pipeline
-           to set music info and to advance to the next song
-        */
-        audio_event_iface_msg_t msg;
-        esp_err_t ret = audio_event_iface_listen(evt, &msg, portMAX_DELAY);
-        if (ret != ESP_OK)
+    if (msg->source == (void *)scrub_evt)
+    {
+        scrub_step();
+        return;
+    }
+    if (msg->source_type != AUDIO_ELEMENT_TYPE_ELEMENT)
+    {
+        return;
+    }
+    // Set music info for a new song to be played
+    if (msg->source == (void *)wav_decoder && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
+    {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(wav_decoder, &music_info);
+        BINLOGW(TAG, "[ * ] Received music info from wav decoder, sample_rates=%d, bits=%d, ch=%d",
+                 music_info.sample_rates, music_info.bits, music_info.channels);
+        audio_element_setinfo(i2s_stream_writer, &music_info);
+        rsp_filter_set_src_info(rsp_handle, music_info.sample_rates, music_info.channels);
+        set_wav_duration();
+        return;
+    }
+    // The fused player converts to the i2s format itself
+    if (fused_player && msg->source == (void *)fused_player && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
+    {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(fused_player, &music_info);
+        BINLOGW(TAG, "[ * ] Received music info from fused player, sample_rates=%d, bits=%d, ch=%d",
+                 music_info.sample_rates, music_info.bits, music_info.channels);
+        return;
+    }
+    // Set music info for an announcement
+    if (voicepack_reader && msg->source == (void *)voicepack_reader && msg->cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
+    {
+        audio_element_info_t music_info = {0};
+        audio_element_getinfo(voicepack_reader, &music_info);
+        rsp_filter_set_src_info(rsp_handle, music_info.sample_rates, music_info.channels);
+        set_track_duration(voicepack_reader, &music_info, 0);
+        return;
+    }
+    // Advance to the next song when previous finishes
+    audio_element_handle_t tail = announcing ? i2s_stream_writer : track_tail;
+    if (msg->source == (void *)tail && msg->cmd == AEL_MSG_CMD_REPORT_STATUS)
+    {
+        audio_element_state_t el_state = audio_element_get_state(tail);
+        if (el_state == AEL_STATE_FINISHED && announcing)
+        {
+            BINLOGW(TAG, "[ * ] Announcement finished, restoring playlist");
+            audio_pipeline_stop(pipeline);
+            audio_pipeline_wait_for_stop(pipeline);
+            sdcard_player_activate();
+        }
+        else if (el_state == AEL_STATE_FINISHED && !playlist_ready)
         {
-            ESP_LOGE(TAG, "[ * ] Event interface error : %d", ret);
-            continue;
+            BINLOGW(TAG, "[ * ] Finished, the playlist is still loading");
         }
-        if (msg.source_type == AUDIO_ELEMENT_TYPE_ELEMENT)
+        else if (el_state == AEL_STATE_FINISHED)
         {
-            // Set music info for a new song to be played
-            if (msg.source == (void *)wav_decoder && msg.cmd == AEL_MSG_CMD_REPORT_MUSIC_INFO)
-            {
-                audio_element_info_t music_info = {0};
-                audio_element_getinfo(wav_decoder, &music_info);
-                ESP_LOGW(TAG, "[ * ] Received music info from wav decoder, sample_rates=%d, bits=%d, ch=%d",
-                         music_info.sample_rates, music_info.bits, music_info.channels);
-                audio_element_setinfo(i2s_stream_writer, &music_info);
-                rsp_filter_set_src_info(rsp_handle, music_info.sample_rates, music_info.channels);
-                continue;
-            }
-            // Advance to the next song when previous finishes
-            if (msg.source == (void *)i2s_stream_writer && msg.cmd == AEL_MSG_CMD_REPORT_STATUS)
-            {
-                audio_element_state_t el_state = audio_element_get_state(i2s_stream_writer);
-                if (el_state == AEL_STATE_FINISHED)
-                {
-                    ESP_LOGW(TAG, "[ * ] Finished, advancing to the next song");
-                    // sdcard_player_stop();
-                    sdcard_list_next(sdcard_list_handle, 1, &url);
-                    ESP_LOGW(TAG, "URL: %s", url);
-                    /* In previous versions, audio_pipeline_terminal() was called here. It will close all the element task and when we use
-                     * the pipeline next time, all the tasks should be restarted again. It wastes too much time when we switch to another music.
-                     * So we use another method to achieve this as below.
-                     */
-                    audio_element_set_uri(fatfs_stream_reader, url);
-                    audio_pipeline_reset_ringbuffer(pipeline);
-                    audio_pipeline_reset_elements(pipeline);
-                    audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
-                    audio_pipeline_run(pipeline);
-                }
-                continue;
-            }
+            BINLOGW(TAG, "[ * ] Finished, advancing to the next song");
+            sdcard_list_next(sdcard_list_handle, 1, &url);
+            ESP_LOGW(TAG, "URL: %s", url);
+            /* In previous versions, audio_pipeline_terminal() was called here. It will close all the element task and when we use
+             * the pipeline next time, all the tasks should be restarted again. It wastes too much time when we switch to another music.
+             * So we use another method to achieve this as below.
+             */
+            remember_track();
+            start_track(url);
         }
     }
 }
 
-void sdcard_player_stop(){
-    ESP_LOGW(TAG, "[ 7 ] Stop audio_pipeline");
-    audio_pipeline_stop(pipeline);
-    audio_pipeline_wait_for_stop(pipeline);
-    audio_pipeline_terminate(pipeline);
-
-    audio_pipeline_unregister(pipeline, wav_decoder);
-    audio_pipeline_unregister(pipeline, i2s_stream_writer);
-    audio_pipeline_unregister(pipeline, rsp_handle);
-
-    /* Terminate the pipeline before removing the listener */
-    audio_pipeline_remove_listener(pipeline);
-
-    /* Stop all peripherals before removing the listener */
-    esp_periph_set_stop_all(set);
-    audio_event_iface_remove_listener(esp_periph_set_get_event_iface(set), evt);
-
-    /* Make sure audio_pipeline_remove_listener & audio_event_iface_remove_listener are called before destroying event_iface */
-    audio_event_iface_destroy(evt);
-
-    /* Release all resources */
-    sdcard_list_destroy(sdcard_list_handle);
-    audio_pipeline_deinit(pipeline);
-    audio_element_deinit(i2s_stream_writer);
-    audio_element_deinit(wav_decoder);
-    audio_element_deinit(rsp_handle);
-    periph_service_destroy(input_ser);
-    esp_periph_set_destroy(set);
-}
-
 void sdcard_url_save_cb(void *user_data, char *url)
 {
     sdcard_list_handle = (playlist_operator_handle_t)user_data;
@@ -226,54 +439,26 @@ void sdcard_url_save_cb(void *user_data, char *url)
     }
 }
 
-// Callback function for input key service
-esp_err_t input_key_service_cb(periph_service_handle_t handle, periph_service_event_t *evt,void *ctx)
+// Handle the player keys, mode and volume keys are handled by the mode manager
+void sdcard_player_handle_key(int key_id)
 {
-    // Handle touch pad events to control music playback and adjust volume
-    return handle_touchpad_event(evt, ctx);
-}
+    BINLOGW(TAG, "[ * ] input key id is %d", key_id);
 
-// Handle touch pad events to control music playback and adjust volume
-esp_err_t handle_touchpad_event(periph_service_event_t *evt, void *ctx)
-{
-    board_handle = (audio_board_handle_t)ctx;
-    audio_hal_get_volume(board_handle->audio_hal, &player_volume);
-
-    if (evt->type == INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE)
+    switch (key_id)
     {
-        ESP_LOGW(TAG, "[ * ] input key id is %d", (int)evt->data);
-        
-        switch ((int)evt->data)
-        {
-        case INPUT_KEY_USER_ID_PLAY:
-            ESP_LOGW(TAG, "[ * ] [Play] input key event");
-            handle_play_pause_resume(audio_element_get_state(i2s_stream_writer));
-            break;
-        case INPUT_KEY_USER_ID_SET:
-            ESP_LOGW(TAG, "[ * ] [Set] input key event");
-            handle_next_song();
-            break;
-        case INPUT_KEY_USER_ID_VOLUP:
-            ESP_LOGW(TAG, "[ * ] [Vol+] input key event");
-            handle_volume_up();
-            break;
-        case INPUT_KEY_USER_ID_VOLDOWN:
-            ESP_LOGW(TAG, "[ * ] [Vol-] input key event");
-            handle_volume_down();
-            break;
-        case INPUT_KEY_USER_ID_MODE:
-            ESP_LOGW(TAG, "[ * ] [MODE-] input key event");
-            //handle_volume_down();
-            break; 
-        case INPUT_KEY_USER_ID_REC:
-            ESP_LOGW(TAG, "[ * ] [REC-] input key event");
-            // Handle maken
-            break; 
-
-        }
+    case INPUT_KEY_USER_ID_PLAY:
+        BINLOGW(TAG, "[ * ] [Play] input key event");
+        handle_play_pause_resume(audio_element_get_state(track_tail));
+        break;
+    case INPUT_KEY_USER_ID_SET:
+        BINLOGW(TAG, "[ * ] [Set] input key event");
+        handle_next_song();
+        break;
+    case INPUT_KEY_USER_ID_REC:
+        BINLOGW(TAG, "[ * ] [REC-] input key event");
+        // Handle maken
+        break;
     }
-
-    return ESP_OK;
 }
 
 // Play, pause, or resume music playback
@@ -282,82 +467,206 @@ void handle_play_pause_resume(audio_element_state_t el_state)
     switch (el_state)
     {
     case AEL_STATE_INIT:
-        ESP_LOGW(TAG, "[ * ] Starting audio pipeline");
+        BINLOGW(TAG, "[ * ] Starting audio pipeline");
         audio_pipeline_run(pipeline);
         break;
     case AEL_STATE_RUNNING:
-        ESP_LOGW(TAG, "[ * ] Pausing audio pipeline");
+        BINLOGW(TAG, "[ * ] Pausing audio pipeline");
         audio_pipeline_pause(pipeline);
         break;
     case AEL_STATE_PAUSED:
-        ESP_LOGW(TAG, "[ * ] Resuming audio pipeline");
+        BINLOGW(TAG, "[ * ] Resuming audio pipeline");
         audio_pipeline_resume(pipeline);
         break;
     default:
-        ESP_LOGW(TAG, "[ * ] Not supported state %d", el_state);
+        BINLOGW(TAG, "[ * ] Not supported state %d", el_state);
     }
 }
 
 // Advance to the next song
 void handle_next_song()
 {
-    char *url = NULL;
-    ESP_LOGW(TAG, "[ * ] Stopped, advancing to the next song");
+    if (!playlist_ready)
+    {
+        BINLOGW(TAG, "[ * ] The playlist is still loading");
+        return;
+    }
+    BINLOGW(TAG, "[ * ] Stopped, advancing to the next song");
     audio_pipeline_stop(pipeline);
     audio_pipeline_wait_for_stop(pipeline);
-    audio_pipeline_terminate(pipeline);
     sdcard_list_next(sdcard_list_handle, 1, &url);
     ESP_LOGW(TAG, "URL: %s", url);
-    audio_element_set_uri(fatfs_stream_reader, url);
-    audio_pipeline_reset_ringbuffer(pipeline);
-    audio_pipeline_reset_elements(pipeline);
-    audio_pipeline_run(pipeline);
+    remember_track();
+    start_track(url);
+}
+
+void play_sound(const char *sound_file) {
+    // Stop any currently playing sound
+    audio_pipeline_stop(pipeline);
+    audio_pipeline_wait_for_stop(pipeline);
+    
+    // Set the URI to the sound file on the SD card
+    char uri[64];
+    snprintf(uri, sizeof(uri), "/sdcard/%s", sound_file);
+    
+    // Reset the pipeline and run it to play the sound
+    playing_playlist = false;
+    normalizer_bypass();
+    start_track(uri);
 }
 
-// Adjust volume up
-void handle_volume_up()
+void play_sound_by_filename(const char *sound_filename) {
+    // Play sound directly by filename
+    play_sound(sound_filename);
+}
+
+// Play a sequence of voice pack clips through the resample filter and i2s
+esp_err_t play_announcement(const uint16_t *clip_ids, int count)
 {
-    player_volume += 10;
-    if (player_volume > 100)
+    if (voicepack_reader == NULL || mode_manager_get_mode() != PLAYER_MODE_SDCARD)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    audio_pipeline_stop(pipeline);
+    audio_pipeline_wait_for_stop(pipeline);
+
+    esp_err_t ret = voicepack_stream_set_clips(voicepack_reader, clip_ids, count);
+    if (ret != ESP_OK)
+    {
+        return ret;
+    }
+
+    // One open file and sequential reads instead of a FAT lookup per clip
+    if (!announcing)
     {
-        player_volume = 100;
+        audio_pipeline_relink(pipeline, &voicepack_link_tag[0], 3);
+        audio_pipeline_set_listener(pipeline, evt);
+        announcing = true;
     }
-    audio_hal_set_volume(board_handle->audio_hal, player_volume);
-    ESP_LOGW(TAG, "[ * ] Volume set to %d %%", player_volume);
+    audio_pipeline_reset_ringbuffer(pipeline);
+    audio_pipeline_reset_elements(pipeline);
+    audio_pipeline_change_state(pipeline, AEL_STATE_INIT);
+    playback_clock_start_track(-1);
+    normalizer_bypass();
+    return audio_pipeline_run(pipeline);
 }
 
-// Adjust volume down
-void handle_volume_down()
+#if !CONFIG_SDCARD_FUSED_PLAYBACK
+// Parse the header of the track unless it is the one parsed last time
+static esp_err_t load_seek_info(const char *path)
 {
-    player_volume -= 10;
-    if (player_volume < 0)
+    if (strcmp(path, seek_path) == 0)
+    {
+        return ESP_OK;
+    }
+    int64_t start = trace_recorder_now();
+    FILE *file = fopen(playlist_file_vfs_path(path), "rb");
+    if (file == NULL)
+    {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = wav_file_parse(file, &seek_wav);
+    fclose(file);
+    trace_recorder_io(TRACE_IO_SD_OPEN, start, ret);
+    if (ret != ESP_OK || pcm_format_of(&seek_wav) == PCM_FORMAT_NONE)
     {
-        player_volume = 0;
+        seek_path[0] = '\0';
+        return ESP_ERR_NOT_SUPPORTED;
     }
-    audio_hal_set_volume(board_handle->audio_hal, player_volume);
-    ESP_LOGW(TAG, "[ * ] Volume set to %d %%", player_volume);
+    snprintf(seek_path, sizeof(seek_path), "%s", path);
+    return ESP_OK;
 }
+#endif
+
+/**
+ * @brief Jumps to a time in the current song.
+ *
+ * @param position_ms Time from the start of the song, clamped to the song.
+ * @return ESP_OK on success, ESP_ERR_INVALID_STATE during an announcement or in another mode,
+ *         ESP_ERR_NOT_SUPPORTED when the file is not in a format the player supports.
+ */
+esp_err_t sdcard_player_seek(int64_t position_ms)
+{
+    if (announcing || mode_manager_get_mode() != PLAYER_MODE_SDCARD || url == NULL)
+    {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (position_ms < 0)
+    {
+        position_ms = 0;
+    }
+    BINLOGI(TAG, "[ * ] Seek to %d ms", (int)position_ms);
+
+#if CONFIG_SDCARD_FUSED_PLAYBACK
+    // The element moves its file between two buffers, nothing is stopped
+    return fused_player_seek(fused_player, position_ms);
+#else
+    esp_err_t ret = load_seek_info(url);
+    if (ret != ESP_OK)
+    {
+        ESP_LOGW(TAG, "[ * ] Cannot seek in %s", url);
+        return ret;
+    }
+    uint32_t offset = wav_file_offset(&seek_wav, position_ms);
 
-void play_sound(const char *sound_file) {
-    // Stop any currently playing sound
     audio_pipeline_stop(pipeline);
     audio_pipeline_wait_for_stop(pipeline);
-    audio_pipeline_terminate(pipeline);
-    
-    // Set the URI to the sound file on the SD card
-    char uri[15];
-    snprintf(uri, 15, "/sdcard/%s", sound_file);
-    audio_element_set_uri(fatfs_stream_reader, uri);
-    
-    // Reset the pipeline and run it to play the sound
-    audio_pipeline_reset_ringbuffer(pipeline);
-    audio_pipeline_reset_elements(pipeline);
-    audio_pipeline_run(pipeline);
+
+    // fatfs_stream moves to the byte position when it opens the file, the header stays behind
+    // and the decoder takes the format from the parsed header instead
+    audio_element_set_byte_pos(fatfs_stream_reader, seek_wav.data_offset + offset);
+    wav_stream_start_at(wav_decoder, &seek_wav, offset);
+    playback_clock_set_duration(wav_file_duration_ms(&seek_wav));
+    playback_clock_seek((int64_t)(offset / seek_wav.block_align) * 1000 / seek_wav.sample_rate);
+    return mode_manager_run_chain(file_link_tag, FILE_LINK_NUM);
+#endif
 }
 
-void play_sound_by_filename(const char *sound_filename) {
-    // Play sound directly by filename
-    play_sound(sound_filename);
+/**
+ * @brief Jumps forward or back from the position that is playing.
+ *
+ * @param delta_ms Time to jump, negative to go back.
+ * @return See sdcard_player_seek().
+ */
+esp_err_t sdcard_player_seek_relative(int64_t delta_ms)
+{
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    int64_t target = pos.position_ms + delta_ms;
+    if (pos.duration_ms >= 0 && target > pos.duration_ms)
+    {
+        target = pos.duration_ms;
+    }
+    return sdcard_player_seek(target);
 }
 
+/**
+ * @brief Returns the path of the current song.
+ */
+const char *sdcard_player_get_track(void)
+{
+    return url;
+}
 
+/**
+ * @brief Starts or stops scrubbing, called by the mode manager for a long press on Vol+ or Vol-.
+ *
+ * @param direction 1 to fast forward, -1 to rewind, 0 when the key is released.
+ */
+void sdcard_player_handle_scrub(int direction)
+{
+    scrub_direction = direction;
+    if (scrub_timer == NULL)
+    {
+        return;
+    }
+    if (direction == 0)
+    {
+        xTimerStop(scrub_timer, 0);
+        return;
+    }
+    scrub_start_us = esp_timer_get_time();
+    scrub_step();
+    xTimerStart(scrub_timer, 0);
+}
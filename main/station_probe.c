@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_http_client.h"
+#include "mp3_frame.h"
+#include "station_probe.h"
+
+static const char *TAG = "STATION_PROBE";
+
+#define PROBE_TASK_STACK (6 * 1024)
+#define PROBE_READ_LIMIT (8 * 1024)
+#define PROBE_BUF_SIZE 1024
+#define PROBE_MAX_STATIONS 24
+#define PROBE_MAX_REDIRECTS 3
+
+/**
+ * @brief Shared state of one probe run.
+ */
+typedef struct {
+    const char *const *urls;
+    int timeout_ms;
+    station_probe_result_t *results;
+    SemaphoreHandle_t slots;
+    EventGroupHandle_t done;
+} probe_run_t;
+
+/**
+ * @brief Arguments of one probe task.
+ */
+typedef struct {
+    probe_run_t *run;
+    int index;
+} probe_arg_t;
+
+/**
+ * @brief Connects to one station and measures the time until audio arrives.
+ */
+static void probe_station(probe_run_t *run, int index, station_probe_result_t *result)
+{
+    memset(result, 0, sizeof(*result));
+    esp_http_client_config_t http_cfg = {
+        .url = run->urls[index],
+        .timeout_ms = run->timeout_ms,
+        .buffer_size = PROBE_BUF_SIZE,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&http_cfg);
+    if (client == NULL) {
+        return;
+    }
+
+    // The station urls are often redirectors to the server that streams
+    int64_t start = esp_timer_get_time();
+    for (int redirects = 0; redirects <= PROBE_MAX_REDIRECTS; redirects++) {
+        if (esp_http_client_open(client, 0) != ESP_OK) {
+            break;
+        }
+        esp_http_client_fetch_headers(client);
+        result->status = esp_http_client_get_status_code(client);
+        int s = result->status;
+        if (s != 301 && s != 302 && s != 303 && s != 307 && s != 308) {
+            break;
+        }
+        esp_http_client_set_redirection(client);
+        esp_http_client_close(client);
+    }
+
+    if (result->status == 200) {
+        uint8_t *buf = malloc(PROBE_BUF_SIZE);
+        int total = 0;
+        while (buf && total < PROBE_READ_LIMIT) {
+            int r = esp_http_client_read(client, (char *)buf, PROBE_BUF_SIZE);
+            if (r <= 0) {
+                break;
+            }
+            total += r;
+            if (mp3_frame_find_sync(buf, r) >= 0) {
+                result->healthy = true;
+                result->latency_ms = (esp_timer_get_time() - start) / 1000;
+                break;
+            }
+        }
+        free(buf);
+    }
+
+    esp_http_client_close(client);
+    esp_http_client_cleanup(client);
+}
+
+static void probe_task(void *pvParameters)
+{
+    probe_arg_t *arg = (probe_arg_t *)pvParameters;
+    probe_run_t *run = arg->run;
+
+    xSemaphoreTake(run->slots, portMAX_DELAY);
+    probe_station(run, arg->index, &run->results[arg->index]);
+    xSemaphoreGive(run->slots);
+
+    xEventGroupSetBits(run->done, 1 << arg->index);
+    free(arg);
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Probes radio stations concurrently and picks the fastest healthy one.
+ */
+int station_probe_fastest(const char *const *urls, int count, int max_parallel, int timeout_ms,
+                          station_probe_result_t *results)
+{
+    if (count <= 0 || count > PROBE_MAX_STATIONS) {
+        return -1;
+    }
+
+    station_probe_result_t local_results[PROBE_MAX_STATIONS];
+    probe_run_t run = {
+        .urls = urls,
+        .timeout_ms = timeout_ms,
+        .results = results ? results : local_results,
+        .slots = xSemaphoreCreateCounting(max_parallel > 0 ? max_parallel : count, max_parallel > 0 ? max_parallel : count),
+        .done = xEventGroupCreate(),
+    };
+    memset(run.results, 0, count * sizeof(station_probe_result_t));
+    if (run.slots == NULL || run.done == NULL) {
+        goto cleanup;
+    }
+
+    EventBits_t started = 0;
+    for (int i = 0; i < count; i++) {
+        probe_arg_t *arg = malloc(sizeof(probe_arg_t));
+        if (arg == NULL) {
+            memset(&run.results[i], 0, sizeof(station_probe_result_t));
+            continue;
+        }
+        arg->run = &run;
+        arg->index = i;
+        if (xTaskCreate(probe_task, "station_probe", PROBE_TASK_STACK, arg, 4, NULL) != pdPASS) {
+            free(arg);
+            memset(&run.results[i], 0, sizeof(station_probe_result_t));
+            continue;
+        }
+        started |= 1 << i;
+    }
+
+    // Every probe is bounded by its own timeouts, so waiting for all of them always ends
+    if (started) {
+        xEventGroupWaitBits(run.done, started, pdFALSE, pdTRUE, portMAX_DELAY);
+    }
+
+cleanup:;
+    int best = -1;
+    for (int i = 0; i < count && run.done; i++) {
+        station_probe_result_t *r = &run.results[i];
+        ESP_LOGI(TAG, "Station %d: status %d, %s, %d ms", i, r->status, r->healthy ? "healthy" : "unhealthy", r->latency_ms);
+        if (r->healthy && (best < 0 || r->latency_ms < run.results[best].latency_ms)) {
+            best = i;
+        }
+    }
+    if (run.slots) {
+        vSemaphoreDelete(run.slots);
+    }
+    if (run.done) {
+        vEventGroupDelete(run.done);
+    }
+    return best;
+}
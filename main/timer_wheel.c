@@ -0,0 +1,193 @@
+#include <string.h>
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+/* Ticks covered by the wheel, timers further away are parked in the last level */
+#define WHEEL_SPAN (1u << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_SLOT_BITS))
+
+static void link_timer(timer_wheel_t *w, timer_wheel_timer_t *t, int level, int slot)
+{
+    timer_wheel_timer_t **head = &w->slots[level][slot];
+    t->level = level;
+    t->slot = slot;
+    t->next = *head;
+    if (*head) {
+        (*head)->pprev = &t->next;
+    }
+    *head = t;
+    t->pprev = head;
+    w->used[level] |= 1ull << slot;
+}
+
+static void unlink_timer(timer_wheel_t *w, timer_wheel_timer_t *t)
+{
+    *t->pprev = t->next;
+    if (t->next) {
+        t->next->pprev = t->pprev;
+    }
+    t->pprev = NULL;
+    if (w->slots[t->level][t->slot] == NULL) {
+        w->used[t->level] &= ~(1ull << t->slot);
+    }
+}
+
+// Puts a timer in the level whose slots are as fine as its distance needs
+static void place(timer_wheel_t *w, timer_wheel_timer_t *t)
+{
+    uint32_t delta = t->expires - w->now;
+    if ((int32_t)delta < 0) {
+        // Already due, runs on the next tick
+        link_timer(w, t, 0, w->now & SLOT_MASK);
+        return;
+    }
+    uint32_t at = delta < WHEEL_SPAN ? t->expires : w->now + WHEEL_SPAN - 1;
+    delta = at - w->now;
+    int level = 0;
+    while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1u << ((level + 1) * TIMER_WHEEL_SLOT_BITS))) {
+        level++;
+    }
+    link_timer(w, t, level, (at >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK);
+}
+
+// Moves the timers of one slot down, returns the slot so the caller knows whether the level wrapped
+static int cascade(timer_wheel_t *w, int level, int slot)
+{
+    timer_wheel_timer_t *list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    w->used[level] &= ~(1ull << slot);
+    while (list) {
+        timer_wheel_timer_t *t = list;
+        list = t->next;
+        place(w, t);
+    }
+    return slot;
+}
+
+// Processes the tick w->now
+static void step(timer_wheel_t *w)
+{
+    uint32_t tick = w->now;
+    int slot = tick & SLOT_MASK;
+    if (slot == 0) {
+        for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+            if (cascade(w, level, (tick >> (level * TIMER_WHEEL_SLOT_BITS)) & SLOT_MASK) != 0) {
+                break;
+            }
+        }
+    }
+    w->now++;
+
+    // Detach the slot, callbacks may add timers to it again
+    timer_wheel_timer_t *list = w->slots[0][slot];
+    w->slots[0][slot] = NULL;
+    w->used[0] &= ~(1ull << slot);
+    if (list) {
+        list->pprev = &list;
+    }
+    while (list) {
+        timer_wheel_timer_t *t = list;
+        unlink_timer(w, t);
+        if ((int32_t)(t->expires - tick) > 0) {
+            // Parked beyond the span of the wheel
+            place(w, t);
+            continue;
+        }
+        t->cb(t, t->arg);
+    }
+}
+
+/**
+ * @brief Empties a wheel.
+ */
+void timer_wheel_init(timer_wheel_t *w, uint32_t now)
+{
+    memset(w, 0, sizeof(*w));
+    w->now = now;
+}
+
+/**
+ * @brief Prepares a timer, it is not pending until added.
+ */
+void timer_wheel_timer_init(timer_wheel_timer_t *t, timer_wheel_cb_t cb, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+/**
+ * @brief Adds a timer, or moves it when it is pending.
+ */
+void timer_wheel_add(timer_wheel_t *w, timer_wheel_timer_t *t, uint32_t expires)
+{
+    if (t->pprev) {
+        unlink_timer(w, t);
+    }
+    t->expires = expires;
+    place(w, t);
+}
+
+/**
+ * @brief Cancels a timer, nothing happens when it is not pending.
+ */
+void timer_wheel_cancel(timer_wheel_t *w, timer_wheel_timer_t *t)
+{
+    if (t->pprev) {
+        unlink_timer(w, t);
+    }
+}
+
+// Rotates a slot bitmap so bit 0 is the slot at index
+static uint64_t from_slot(uint64_t used, int index)
+{
+    return index ? (used >> index) | (used << (TIMER_WHEEL_SLOTS - index)) : used;
+}
+
+/**
+ * @brief Returns the number of ticks from the next tick to process until the wheel has work.
+ */
+uint32_t timer_wheel_next_due(const timer_wheel_t *w)
+{
+    uint64_t upper = 0;
+    for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+        upper |= w->used[level];
+    }
+    if (w->used[0] == 0 && upper == 0) {
+        return TIMER_WHEEL_IDLE;
+    }
+
+    int index = w->now & SLOT_MASK;
+    uint32_t due = TIMER_WHEEL_IDLE;
+    uint64_t level0 = from_slot(w->used[0], index);
+    if (level0) {
+        due = __builtin_ctzll(level0);
+    }
+
+    // Cascades happen every TIMER_WHEEL_SLOTS ticks, the first one may be the next tick
+    uint32_t boundary = index ? TIMER_WHEEL_SLOTS - index : 0;
+    for (int k = 0; k < TIMER_WHEEL_SLOTS && boundary < due; k++, boundary += TIMER_WHEEL_SLOTS) {
+        int slot = ((w->now + boundary) >> TIMER_WHEEL_SLOT_BITS) & SLOT_MASK;
+        // The first slot of level 1 also cascades the levels above
+        if (((w->used[1] >> slot) & 1) || (slot == 0 && (w->used[2] | w->used[3]))) {
+            due = boundary;
+        }
+    }
+    return due;
+}
+
+/**
+ * @brief Processes all ticks up to and including a tick, calling back every expired timer.
+ */
+void timer_wheel_advance(timer_wheel_t *w, uint32_t now)
+{
+    while ((int32_t)(now - w->now) >= 0) {
+        uint32_t due = timer_wheel_next_due(w);
+        if (due > now - w->now) {
+            w->now = now + 1;
+            return;
+        }
+        w->now += due;
+        step(w);
+    }
+}
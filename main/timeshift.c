@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "esp_log.h"
+#include "binlog.h"
+#include "esp_timer.h"
+#include "audio_mem.h"
+#include "timeshift.h"
+
+static const char *TAG = "TIMESHIFT";
+
+/* The ring file is written in whole blocks, the RAM ring must hold at least two */
+#define SPILL_BLOCK_SIZE 4096
+#define INPUT_TIMEOUT_MS 50
+#define STATS_INTERVAL_US (10 * 1000 * 1000)
+
+/**
+ * @brief Private state of the timeshift element.
+ *
+ * Positions are absolute stream offsets. The RAM ring holds the last ram_size bytes
+ * before write_pos, the ring file the last spill_size bytes before flushed_pos.
+ */
+typedef struct {
+    timeshift_cfg_t cfg;
+    uint8_t *ram;
+    FILE *spill;
+
+    int64_t write_pos;
+    int64_t read_pos;
+    int64_t flushed_pos;
+    int64_t dropped;
+    int64_t spill_written;
+
+    volatile bool paused;
+    volatile bool jump_to_live;
+    bool input_done;
+
+    int64_t stats_time;
+    int64_t stats_spill_written;
+    portMUX_TYPE lock;
+} timeshift_t;
+
+/**
+ * @brief Writes one block of the RAM ring to the ring file.
+ */
+static void spill_block(timeshift_t *ts)
+{
+    int ram_off = ts->flushed_pos % ts->cfg.ram_size;
+    long file_off = ts->flushed_pos % ts->cfg.spill_size;
+    int first = ts->cfg.ram_size - ram_off;
+    if (first > SPILL_BLOCK_SIZE) {
+        first = SPILL_BLOCK_SIZE;
+    }
+
+    if (fseek(ts->spill, file_off, SEEK_SET) != 0 ||
+        fwrite(ts->ram + ram_off, 1, first, ts->spill) != (size_t)first ||
+        fwrite(ts->ram, 1, SPILL_BLOCK_SIZE - first, ts->spill) != (size_t)(SPILL_BLOCK_SIZE - first)) {
+        ESP_LOGE(TAG, "Ring file write failed, keeping history in RAM only");
+        fclose(ts->spill);
+        ts->spill = NULL;
+        return;
+    }
+    ts->flushed_pos += SPILL_BLOCK_SIZE;
+    ts->spill_written += SPILL_BLOCK_SIZE;
+}
+
+/**
+ * @brief Appends stream data to the history.
+ */
+static void store_write(timeshift_t *ts, const uint8_t *data, int len)
+{
+    int off = ts->write_pos % ts->cfg.ram_size;
+    int first = ts->cfg.ram_size - off;
+    if (first > len) {
+        first = len;
+    }
+    memcpy(ts->ram + off, data, first);
+    memcpy(ts->ram, data + first, len - first);
+
+    portENTER_CRITICAL(&ts->lock);
+    ts->write_pos += len;
+    portEXIT_CRITICAL(&ts->lock);
+
+    while (ts->spill && ts->write_pos - ts->flushed_pos >= SPILL_BLOCK_SIZE) {
+        spill_block(ts);
+    }
+}
+
+/**
+ * @brief Returns the oldest stream offset that is still in the history.
+ */
+static int64_t store_oldest(timeshift_t *ts)
+{
+    int64_t oldest = ts->write_pos - ts->cfg.ram_size;
+    if (ts->spill && ts->flushed_pos - ts->cfg.spill_size < oldest) {
+        oldest = ts->flushed_pos - ts->cfg.spill_size;
+    }
+    return oldest > 0 ? oldest : 0;
+}
+
+/**
+ * @brief Reads history from the play point onwards.
+ *
+ * @return Number of bytes read, 0 when the play point is at the live point.
+ */
+static int store_read(timeshift_t *ts, uint8_t *buf, int len)
+{
+    int64_t oldest = store_oldest(ts);
+    if (ts->read_pos < oldest) {
+        BINLOGW(TAG, "History overflowed, skipping %d bytes", (int)(oldest - ts->read_pos));
+        ts->dropped += oldest - ts->read_pos;
+        ts->read_pos = oldest;
+    }
+    if (len > ts->write_pos - ts->read_pos) {
+        len = ts->write_pos - ts->read_pos;
+    }
+    if (len <= 0) {
+        return 0;
+    }
+
+    if (ts->read_pos >= ts->write_pos - ts->cfg.ram_size) {
+        int off = ts->read_pos % ts->cfg.ram_size;
+        int first = ts->cfg.ram_size - off;
+        if (first > len) {
+            first = len;
+        }
+        memcpy(buf, ts->ram + off, first);
+        memcpy(buf + first, ts->ram, len - first);
+    } else {
+        // Older than the RAM ring, so it was flushed to the ring file
+        long off = ts->read_pos % ts->cfg.spill_size;
+        if (len > ts->flushed_pos - ts->read_pos) {
+            len = ts->flushed_pos - ts->read_pos;
+        }
+        if (len > ts->cfg.spill_size - off) {
+            len = ts->cfg.spill_size - off;
+        }
+        if (fseek(ts->spill, off, SEEK_SET) != 0 || fread(buf, 1, len, ts->spill) != (size_t)len) {
+            ESP_LOGE(TAG, "Ring file read failed");
+            return 0;
+        }
+    }
+
+    portENTER_CRITICAL(&ts->lock);
+    ts->read_pos += len;
+    portEXIT_CRITICAL(&ts->lock);
+    return len;
+}
+
+/**
+ * @brief Opens and preallocates the ring file.
+ */
+static void open_spill(timeshift_t *ts)
+{
+    ts->spill = fopen(ts->cfg.spill_path, "w+b");
+    if (ts->spill == NULL) {
+        ESP_LOGW(TAG, "Cannot open %s, keeping history in RAM only", ts->cfg.spill_path);
+        return;
+    }
+    // Blocks are written whole, the stdio buffer would only add a copy
+    setvbuf(ts->spill, NULL, _IONBF, 0);
+    // Allocate the clusters once so ring writes never extend the file
+    if (fseek(ts->spill, ts->cfg.spill_size - 1, SEEK_SET) != 0 || fputc(0, ts->spill) == EOF) {
+        ESP_LOGW(TAG, "Cannot preallocate %s, keeping history in RAM only", ts->cfg.spill_path);
+        fclose(ts->spill);
+        ts->spill = NULL;
+    }
+}
+
+static void log_stats(timeshift_t *ts)
+{
+    int64_t now = esp_timer_get_time();
+    if (now - ts->stats_time < STATS_INTERVAL_US) {
+        return;
+    }
+    int bandwidth = (ts->spill_written - ts->stats_spill_written) * 1000000 / (now - ts->stats_time);
+    BINLOGI(TAG, "%d bytes behind live, %d dropped, SD writes %d B/s",
+             (int)(ts->write_pos - ts->read_pos), (int)ts->dropped, bandwidth);
+    ts->stats_time = now;
+    ts->stats_spill_written = ts->spill_written;
+}
+
+static esp_err_t _timeshift_open(audio_element_handle_t self)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(self);
+    ts->write_pos = 0;
+    ts->read_pos = 0;
+    ts->flushed_pos = 0;
+    ts->dropped = 0;
+    ts->spill_written = 0;
+    ts->input_done = false;
+    ts->jump_to_live = false;
+    ts->stats_time = esp_timer_get_time();
+    ts->stats_spill_written = 0;
+
+    if (ts->cfg.spill_path) {
+        open_spill(ts);
+    }
+    audio_element_set_input_timeout(self, pdMS_TO_TICKS(INPUT_TIMEOUT_MS));
+    return ESP_OK;
+}
+
+static int _timeshift_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(self);
+
+    if (ts->jump_to_live) {
+        ts->jump_to_live = false;
+        int64_t oldest = store_oldest(ts);
+        portENTER_CRITICAL(&ts->lock);
+        // What overflowed during the pause was dropped, the rest is skipped
+        if (ts->read_pos < oldest) {
+            ts->dropped += oldest - ts->read_pos;
+        }
+        ts->read_pos = ts->write_pos;
+        portEXIT_CRITICAL(&ts->lock);
+    }
+
+    // Keep reading the stream even while paused so the connection stays alive
+    if (!ts->input_done) {
+        int r = audio_element_input(self, in_buffer, in_len);
+        if (r > 0) {
+            store_write(ts, (uint8_t *)in_buffer, r);
+        } else if (r != AEL_IO_TIMEOUT) {
+            ts->input_done = true;
+        }
+    }
+    log_stats(ts);
+
+    if (ts->paused) {
+        return in_len;
+    }
+    int n = store_read(ts, (uint8_t *)in_buffer, in_len);
+    if (n > 0) {
+        return audio_element_output(self, in_buffer, n);
+    }
+    return ts->input_done ? AEL_IO_DONE : in_len;
+}
+
+static esp_err_t _timeshift_close(audio_element_handle_t self)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(self);
+    if (ts->spill) {
+        fclose(ts->spill);
+        ts->spill = NULL;
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _timeshift_destroy(audio_element_handle_t self)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(self);
+    audio_free(ts->ram);
+    audio_free(ts);
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates the timeshift element.
+ */
+audio_element_handle_t timeshift_init(timeshift_cfg_t *config)
+{
+    if (config->ram_size < 2 * SPILL_BLOCK_SIZE || config->spill_size % SPILL_BLOCK_SIZE != 0) {
+        ESP_LOGE(TAG, "RAM ring must hold two blocks and the ring file whole blocks");
+        return NULL;
+    }
+
+    timeshift_t *ts = audio_calloc(1, sizeof(timeshift_t));
+    AUDIO_MEM_CHECK(TAG, ts, return NULL);
+    ts->cfg = *config;
+    portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+    ts->lock = lock;
+    ts->ram = audio_malloc(config->ram_size);
+    AUDIO_MEM_CHECK(TAG, ts->ram, {
+        audio_free(ts);
+        return NULL;
+    });
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _timeshift_open;
+    cfg.process = _timeshift_process;
+    cfg.close = _timeshift_close;
+    cfg.destroy = _timeshift_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.buffer_len = config->buf_sz;
+    cfg.tag = "tshift";
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(ts->ram);
+        audio_free(ts);
+        return NULL;
+    });
+    audio_element_setdata(el, ts);
+    return el;
+}
+
+/**
+ * @brief Pauses or resumes output while input keeps being recorded.
+ */
+void timeshift_set_paused(audio_element_handle_t el, bool paused)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(el);
+    ts->paused = paused;
+}
+
+/**
+ * @brief Returns whether output is paused.
+ */
+bool timeshift_is_paused(audio_element_handle_t el)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(el);
+    return ts->paused;
+}
+
+/**
+ * @brief Drops the recorded history and continues at the live point.
+ */
+void timeshift_jump_to_live(audio_element_handle_t el)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(el);
+    ts->jump_to_live = true;
+}
+
+/**
+ * @brief Reads the statistics of the timeshift element.
+ */
+void timeshift_get_stats(audio_element_handle_t el, timeshift_stats_t *stats)
+{
+    timeshift_t *ts = (timeshift_t *)audio_element_getdata(el);
+    portENTER_CRITICAL(&ts->lock);
+    int64_t oldest = store_oldest(ts);
+    // While paused the overflow is only dropped on resume, count it as dropped already
+    int64_t lost = oldest > ts->read_pos ? oldest - ts->read_pos : 0;
+    stats->behind_live = ts->write_pos - ts->read_pos - lost;
+    stats->available = ts->write_pos - oldest;
+    stats->dropped = ts->dropped + lost;
+    stats->spill_written = ts->spill_written;
+    portEXIT_CRITICAL(&ts->lock);
+}
@@ -13,6 +13,19 @@ static const char * TAG = "Timesync";
 void time_sync_notification_cb(struct timeval *tv)
 {
     ESP_LOGI(TAG, "Notification of a time synchronization event");
+    scheduler_time_changed();
+}
+
+/**
+ * @brief Sets the local time zone, with its daylight saving time rules.
+ *
+ * The time zone is not kept over a reset, so this runs on every boot, also when the
+ * clock survived and no synchronization is needed.
+ */
+void timesync_set_timezone(void)
+{
+    setenv("TZ", TIMESYNC_TZ, 1);
+    tzset();
 }
 
 /**
@@ -51,8 +64,7 @@ void obtain_time(void)
     }
 
     // Set timezone
-    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
-    tzset();
+    timesync_set_timezone();
 
     // Disconnect from network
     ESP_ERROR_CHECK( example_disconnect());
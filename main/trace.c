@@ -0,0 +1,181 @@
+#include <string.h>
+#include "trace.h"
+
+#define TRACE_VERSION 1
+
+static int put_varint(uint8_t *out, int size, uint64_t value)
+{
+    int n = 0;
+    do {
+        if (n >= size) {
+            return 0;
+        }
+        uint8_t byte = value & 0x7f;
+        value >>= 7;
+        out[n++] = byte | (value ? 0x80 : 0);
+    } while (value);
+    return n;
+}
+
+static int get_varint(const uint8_t *in, int len, uint64_t *value)
+{
+    uint64_t v = 0;
+    for (int n = 0; n < len && n < 10; n++) {
+        v |= (uint64_t)(in[n] & 0x7f) << (7 * n);
+        if (!(in[n] & 0x80)) {
+            *value = v;
+            return n + 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Writes the file header.
+ */
+void trace_write_header(uint8_t *out)
+{
+    memcpy(out, TRACE_MAGIC, 4);
+    out[4] = TRACE_VERSION;
+    out[5] = TRACE_HEADER_SIZE;
+    out[6] = 0;
+    out[7] = 0;
+}
+
+/**
+ * @brief Checks the file header.
+ */
+bool trace_check_header(const uint8_t *in, int len)
+{
+    return len >= TRACE_HEADER_SIZE && memcmp(in, TRACE_MAGIC, 4) == 0 && in[4] == TRACE_VERSION &&
+           in[5] == TRACE_HEADER_SIZE;
+}
+
+/**
+ * @brief Encodes a record.
+ */
+int trace_encode(uint8_t *out, int size, const trace_record_t *rec, int64_t *last_us)
+{
+    if (size < 1 || rec->nargs > TRACE_MAX_ARGS) {
+        return 0;
+    }
+    int64_t delta = rec->time_us - *last_us;
+    int n = 0;
+    out[n++] = (rec->type & 0x0f) | (rec->nargs << 4);
+    int w = put_varint(out + n, size - n, delta > 0 ? delta : 0);
+    if (w == 0) {
+        return 0;
+    }
+    n += w;
+    for (int i = 0; i < rec->nargs; i++) {
+        // Zigzag, small negative values stay short
+        uint32_t zz = ((uint32_t)rec->args[i] << 1) ^ (uint32_t)(rec->args[i] >> 31);
+        w = put_varint(out + n, size - n, zz);
+        if (w == 0) {
+            return 0;
+        }
+        n += w;
+    }
+    if (delta > 0) {
+        *last_us = rec->time_us;
+    }
+    return n;
+}
+
+/**
+ * @brief Decodes a record.
+ */
+int trace_decode(const uint8_t *in, int len, trace_record_t *rec, int64_t *last_us)
+{
+    if (len <= 0) {
+        return 0;
+    }
+    memset(rec, 0, sizeof(*rec));
+    rec->type = in[0] & 0x0f;
+    rec->nargs = in[0] >> 4;
+    if (rec->type == 0 || rec->nargs > TRACE_MAX_ARGS) {
+        return -1;
+    }
+    int n = 1;
+    uint64_t value;
+    int r = get_varint(in + n, len - n, &value);
+    if (r < 0) {
+        return -1;
+    }
+    n += r;
+    *last_us += value;
+    rec->time_us = *last_us;
+    for (int i = 0; i < rec->nargs; i++) {
+        r = get_varint(in + n, len - n, &value);
+        if (r < 0 || value > UINT32_MAX) {
+            return -1;
+        }
+        n += r;
+        uint32_t zz = value;
+        rec->args[i] = (int32_t)((zz >> 1) ^ -(zz & 1));
+    }
+    return n;
+}
+
+// Moves what is left to the front and fills the buffer, until it is full or the trace ends
+static void fill(trace_reader_t *reader)
+{
+    int left = reader->len - reader->pos;
+    memmove(reader->buf, reader->buf + reader->pos, left);
+    reader->offset += reader->pos;
+    reader->pos = 0;
+    reader->len = left;
+    while (!reader->end && reader->len < TRACE_READ_CHUNK) {
+        int n = reader->read(reader->ctx, reader->buf + reader->len, TRACE_READ_CHUNK - reader->len);
+        if (n <= 0) {
+            reader->end = true;
+        } else {
+            reader->len += n;
+        }
+    }
+}
+
+/**
+ * @brief Starts reading a trace, reads and checks its header.
+ */
+bool trace_reader_init(trace_reader_t *reader, trace_read_fn read, void *ctx)
+{
+    memset(reader, 0, sizeof(*reader));
+    reader->read = read;
+    reader->ctx = ctx;
+    fill(reader);
+    if (!trace_check_header(reader->buf, reader->len)) {
+        return false;
+    }
+    reader->pos = TRACE_HEADER_SIZE;
+    return true;
+}
+
+/**
+ * @brief Decodes the next record, reading the next chunk when the buffer runs low.
+ */
+int trace_reader_next(trace_reader_t *reader, trace_record_t *rec)
+{
+    // A whole record is in the buffer, unless the trace ends before it
+    if (reader->len - reader->pos < TRACE_RECORD_MAX && !reader->end) {
+        fill(reader);
+    }
+    int n = trace_decode(reader->buf + reader->pos, reader->len - reader->pos, rec, &reader->last_us);
+    if (n <= 0) {
+        return n;
+    }
+    reader->pos += n;
+    return 1;
+}
+
+/**
+ * @brief Returns the 16-bit id of an element tag.
+ */
+uint16_t trace_tag_id(const char *tag)
+{
+    uint32_t hash = 2166136261u;
+    for (const char *p = tag ? tag : ""; *p; p++) {
+        hash = (hash ^ (uint8_t)*p) * 16777619u;
+    }
+    return (hash >> 16) ^ (hash & 0xffff);
+}
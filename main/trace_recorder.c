@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "audio_element.h"
+#include "esp_peripherals.h"
+#include "mode_manager.h"
+#include "trace_recorder.h"
+
+static const char *TAG = "TRACE";
+
+static uint8_t *buffer = NULL;
+static int used = 0;
+static int64_t base_us = 0;
+static int64_t last_us = 0;
+static bool full = false;
+static portMUX_TYPE buffer_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static volatile bool replaying = false;
+
+typedef struct {
+    FILE *file;
+    trace_reader_t reader;
+    const char *out_path;
+} replay_t;
+
+static void restart(void)
+{
+    portENTER_CRITICAL(&buffer_lock);
+    trace_write_header(buffer);
+    used = TRACE_HEADER_SIZE;
+    base_us = esp_timer_get_time();
+    last_us = 0;
+    full = false;
+    portEXIT_CRITICAL(&buffer_lock);
+}
+
+static void add(trace_type_t type, int nargs, int32_t a, int32_t b, int32_t c, int32_t d)
+{
+    if (buffer == NULL) {
+        return;
+    }
+    trace_record_t rec = {
+        .type = type,
+        .nargs = nargs,
+        .args = {a, b, c, d},
+    };
+    bool now_full = false;
+    portENTER_CRITICAL(&buffer_lock);
+    if (!full) {
+        rec.time_us = esp_timer_get_time() - base_us;
+        int n = trace_encode(buffer + used, CONFIG_SPEAKER_TRACE_BUFFER_SIZE - used, &rec, &last_us);
+        used += n;
+        now_full = full = n == 0;
+    }
+    portEXIT_CRITICAL(&buffer_lock);
+    if (now_full) {
+        ESP_LOGW(TAG, "Trace buffer full, recording stopped");
+    }
+}
+
+/**
+ * @brief Allocates the buffer and starts recording.
+ */
+esp_err_t trace_recorder_init(void)
+{
+    buffer = heap_caps_malloc(CONFIG_SPEAKER_TRACE_BUFFER_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (buffer == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate %d bytes for the trace", CONFIG_SPEAKER_TRACE_BUFFER_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+    restart();
+    ESP_LOGI(TAG, "[ * ] Recording keys and events into %d bytes", CONFIG_SPEAKER_TRACE_BUFFER_SIZE);
+    return ESP_OK;
+}
+
+void trace_recorder_key(int key_id, int action)
+{
+    add(TRACE_KEY, 2, key_id, action, 0, 0);
+}
+
+void trace_recorder_event(const audio_event_iface_msg_t *msg)
+{
+    int source_id;
+    int data = 0;
+    if (msg->source_type == AUDIO_ELEMENT_TYPE_ELEMENT) {
+        source_id = trace_tag_id(audio_element_get_tag((audio_element_handle_t)msg->source));
+        // Only a status is a value, the data of the other commands points to something
+        if (msg->cmd == AEL_MSG_CMD_REPORT_STATUS) {
+            data = (int)msg->data;
+        }
+    } else {
+        source_id = esp_periph_get_id((esp_periph_handle_t)msg->source);
+        data = (int)msg->data;
+    }
+    add(TRACE_EVENT, 4, msg->source_type, source_id, msg->cmd, data);
+}
+
+void trace_recorder_mode(int mode, int switch_ms)
+{
+    add(TRACE_MODE, 2, mode, switch_ms, 0, 0);
+}
+
+/**
+ * @brief Records an I/O operation that started at start_us, reads only when slow.
+ */
+void trace_recorder_io(trace_io_t kind, int64_t start_us, int result)
+{
+    int duration_us = esp_timer_get_time() - start_us;
+    if ((kind == TRACE_IO_HTTP_READ || kind == TRACE_IO_SD_READ) && duration_us < TRACE_SLOW_IO_US) {
+        return;
+    }
+    add(TRACE_IO, 3, kind, duration_us, result, 0);
+}
+
+void trace_recorder_cpu(int load_pct, int mhz, uint32_t underruns)
+{
+    add(TRACE_CPU, 3, load_pct, mhz, underruns, 0);
+}
+
+/**
+ * @brief Writes what was recorded so far to a file.
+ */
+esp_err_t trace_recorder_save(const char *path)
+{
+    if (buffer == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    // Records are only appended, what is below used stays as it is while it is written
+    portENTER_CRITICAL(&buffer_lock);
+    int len = used;
+    portEXIT_CRITICAL(&buffer_lock);
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        ESP_LOGE(TAG, "Failed to create %s", path);
+        return ESP_FAIL;
+    }
+    bool ok = fwrite(buffer, 1, len, file) == (size_t)len;
+    ok = fclose(file) == 0 && ok;
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to write %s", path);
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "[ * ] Saved %d bytes of trace to %s", len, path);
+    return ESP_OK;
+}
+
+static int read_file(void *ctx, uint8_t *buf, int size)
+{
+    return fread(buf, 1, size, (FILE *)ctx);
+}
+
+static void replay_task(void *pvParameters)
+{
+    replay_t *replay = pvParameters;
+    int64_t first_key_us = -1;
+    int keys = 0;
+
+    restart();
+    add(TRACE_MARK, 0, 0, 0, 0, 0);
+    int64_t start_us = esp_timer_get_time();
+
+    trace_record_t rec;
+    int n;
+    while ((n = trace_reader_next(&replay->reader, &rec)) > 0) {
+        if (rec.type != TRACE_KEY) {
+            continue;
+        }
+        // The trace clock runs from the first key, the time before it was the boot
+        if (first_key_us < 0) {
+            first_key_us = rec.time_us;
+        }
+        int64_t wait_us = start_us + (rec.time_us - first_key_us) - esp_timer_get_time();
+        if (wait_us > 0) {
+            vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+        }
+        mode_manager_inject_key(rec.args[0], rec.args[1]);
+        keys++;
+    }
+    if (n < 0) {
+        ESP_LOGW(TAG, "Trace cut off at byte %d, replayed what came before",
+                 (int)(replay->reader.offset + replay->reader.pos));
+    }
+
+    vTaskDelay(pdMS_TO_TICKS(TRACE_REPLAY_TAIL_MS));
+    ESP_LOGI(TAG, "[ * ] Replayed %d keys", keys);
+    trace_recorder_save(replay->out_path);
+
+    fclose(replay->file);
+    free(replay);
+    replaying = false;
+    vTaskDelete(NULL);
+}
+
+/**
+ * @brief Starts replaying the keys of a trace in a task.
+ */
+esp_err_t trace_recorder_replay(const char *path, const char *out_path)
+{
+    if (buffer == NULL || replaying) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    // The trace is read a chunk at a time while it is replayed, it can be larger than the free heap
+    replay_t *replay = calloc(1, sizeof(replay_t));
+    if (replay == NULL || !trace_reader_init(&replay->reader, read_file, file)) {
+        fclose(file);
+        free(replay);
+        ESP_LOGE(TAG, "%s is not a trace", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    replay->file = file;
+    replay->out_path = out_path;
+    replaying = true;
+    if (xTaskCreate(replay_task, "trace_replay", 3072, replay, 4, NULL) != pdPASS) {
+        fclose(file);
+        free(replay);
+        replaying = false;
+        return ESP_ERR_NO_MEM;
+    }
+    ESP_LOGI(TAG, "[ * ] Replaying %s", path);
+    return ESP_OK;
+}
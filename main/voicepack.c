@@ -0,0 +1,301 @@
+#include <stdlib.h>
+#include <string.h>
+#include "esp_log.h"
+#include "audio_mem.h"
+#include "voicepack.h"
+
+static const char *TAG = "VOICEPACK";
+
+#define VOICEPACK_MAX_CLIPS 32
+
+/**
+ * @brief Private state of the voice pack reader element.
+ */
+typedef struct {
+    voicepack_t *pack;
+    const voicepack_clip_t *clips[VOICEPACK_MAX_CLIPS];
+    int clip_count;
+    int clip_index;
+    uint32_t clip_pos;
+} voicepack_stream_t;
+
+/**
+ * @brief Reads exactly len bytes at an absolute offset of the pack file.
+ *
+ * @param pack Pack handle.
+ * @param offset Absolute file offset.
+ * @param buf Destination buffer.
+ * @param len Number of bytes to read.
+ * @return ESP_OK on success, ESP_FAIL on a short read.
+ */
+static esp_err_t read_at(voicepack_t *pack, uint32_t offset, void *buf, size_t len)
+{
+    if (fseek(pack->file, offset, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    return fread(buf, 1, len, pack->file) == len ? ESP_OK : ESP_FAIL;
+}
+
+/**
+ * @brief Opens a voice pack and loads its voice and clip tables.
+ */
+esp_err_t voicepack_open(const char *path, voicepack_t **pack)
+{
+    voicepack_t *vp = calloc(1, sizeof(voicepack_t));
+    if (vp == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    vp->file = fopen(path, "rb");
+    if (vp->file == NULL) {
+        ESP_LOGW(TAG, "No voice pack at %s", path);
+        free(vp);
+        return ESP_ERR_NOT_FOUND;
+    }
+    // Payloads are read in whole sectors straight into the caller's buffer
+    setvbuf(vp->file, NULL, _IONBF, 0);
+
+    esp_err_t ret = read_at(vp, 0, &vp->header, sizeof(vp->header));
+    if (ret != ESP_OK || memcmp(vp->header.magic, VOICEPACK_MAGIC, 4) != 0) {
+        ESP_LOGE(TAG, "%s is not a voice pack", path);
+        ret = ESP_ERR_INVALID_RESPONSE;
+        goto fail;
+    }
+    if (vp->header.version != VOICEPACK_VERSION) {
+        ESP_LOGE(TAG, "Unsupported voice pack version %d", vp->header.version);
+        ret = ESP_ERR_INVALID_VERSION;
+        goto fail;
+    }
+    if (vp->header.voice_count == 0 || vp->header.clip_count == 0) {
+        ret = ESP_ERR_INVALID_RESPONSE;
+        goto fail;
+    }
+
+    vp->voices = calloc(vp->header.voice_count, sizeof(voicepack_voice_t));
+    vp->clips = calloc(vp->header.clip_count, sizeof(voicepack_clip_t));
+    if (vp->voices == NULL || vp->clips == NULL) {
+        ret = ESP_ERR_NO_MEM;
+        goto fail;
+    }
+    if (read_at(vp, vp->header.voice_table_offset, vp->voices,
+                vp->header.voice_count * sizeof(voicepack_voice_t)) != ESP_OK ||
+        read_at(vp, vp->header.clip_table_offset, vp->clips,
+                vp->header.clip_count * sizeof(voicepack_clip_t)) != ESP_OK) {
+        ESP_LOGE(TAG, "Truncated voice pack tables");
+        ret = ESP_ERR_INVALID_RESPONSE;
+        goto fail;
+    }
+
+    ESP_LOGI(TAG, "Opened %s: %d voices, %d clips", path, vp->header.voice_count, vp->header.clip_count);
+    *pack = vp;
+    return ESP_OK;
+
+fail:
+    voicepack_close(vp);
+    return ret;
+}
+
+/**
+ * @brief Closes the pack file and releases its tables.
+ */
+void voicepack_close(voicepack_t *pack)
+{
+    if (pack == NULL) {
+        return;
+    }
+    if (pack->file) {
+        fclose(pack->file);
+    }
+    free(pack->voices);
+    free(pack->clips);
+    free(pack);
+}
+
+/**
+ * @brief Selects the voice used by voicepack_find_clip().
+ */
+esp_err_t voicepack_select_voice(voicepack_t *pack, const char *lang)
+{
+    for (int i = 0; i < pack->header.voice_count; i++) {
+        if (strncmp(pack->voices[i].lang, lang, VOICEPACK_LANG_LEN) == 0) {
+            pack->voice = i;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+/**
+ * @brief Looks up a clip of the selected voice with a binary search.
+ */
+const voicepack_clip_t *voicepack_find_clip(const voicepack_t *pack, uint16_t clip_id)
+{
+    uint32_t key = ((uint32_t)pack->voice << 16) | clip_id;
+    int low = 0;
+    int high = pack->header.clip_count - 1;
+
+    while (low <= high) {
+        int mid = (low + high) / 2;
+        const voicepack_clip_t *clip = &pack->clips[mid];
+        uint32_t mid_key = ((uint32_t)clip->voice << 16) | clip->clip_id;
+        if (mid_key == key) {
+            return clip;
+        }
+        if (mid_key < key) {
+            low = mid + 1;
+        } else {
+            high = mid - 1;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Reads PCM data of a clip.
+ */
+int voicepack_read(voicepack_t *pack, const voicepack_clip_t *clip, uint32_t offset, char *buf, int len)
+{
+    if (offset >= clip->length) {
+        return 0;
+    }
+    if ((uint32_t)len > clip->length - offset) {
+        len = clip->length - offset;
+    }
+    // Sequential reads continue where the previous one stopped, so only seek on a jump
+    long pos = clip->offset + offset;
+    if (ftell(pack->file) != pos && fseek(pack->file, pos, SEEK_SET) != 0) {
+        return -1;
+    }
+    size_t r = fread(buf, 1, len, pack->file);
+    return r > 0 ? (int)r : -1;
+}
+
+static esp_err_t _voicepack_open(audio_element_handle_t self)
+{
+    voicepack_stream_t *vs = (voicepack_stream_t *)audio_element_getdata(self);
+    if (vs->clip_count == 0) {
+        ESP_LOGE(TAG, "No clips set");
+        return ESP_FAIL;
+    }
+    vs->clip_index = 0;
+    vs->clip_pos = 0;
+
+    audio_element_info_t info = {0};
+    audio_element_getinfo(self, &info);
+    info.sample_rates = vs->clips[0]->sample_rate;
+    info.bits = vs->clips[0]->bits;
+    info.channels = vs->clips[0]->channels;
+    info.byte_pos = 0;
+    info.total_bytes = 0;
+    for (int i = 0; i < vs->clip_count; i++) {
+        info.total_bytes += vs->clips[i]->length;
+    }
+    audio_element_setinfo(self, &info);
+    audio_element_report_info(self);
+    return ESP_OK;
+}
+
+static int _voicepack_read(audio_element_handle_t self, char *buffer, int len, TickType_t ticks_to_wait, void *context)
+{
+    voicepack_stream_t *vs = (voicepack_stream_t *)audio_element_getdata(self);
+
+    while (vs->clip_index < vs->clip_count) {
+        int r = voicepack_read(vs->pack, vs->clips[vs->clip_index], vs->clip_pos, buffer, len);
+        if (r < 0) {
+            ESP_LOGE(TAG, "Read error in clip %d", vs->clips[vs->clip_index]->clip_id);
+            return AEL_IO_FAIL;
+        }
+        if (r > 0) {
+            vs->clip_pos += r;
+            return r;
+        }
+        vs->clip_index++;
+        vs->clip_pos = 0;
+    }
+    return AEL_IO_DONE;
+}
+
+static int _voicepack_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    int r_size = audio_element_input(self, in_buffer, in_len);
+    int w_size = 0;
+    if (r_size > 0) {
+        w_size = audio_element_output(self, in_buffer, r_size);
+        if (w_size > 0) {
+            audio_element_update_byte_pos(self, r_size);
+        }
+    } else {
+        w_size = r_size;
+    }
+    return w_size;
+}
+
+static esp_err_t _voicepack_close(audio_element_handle_t self)
+{
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _voicepack_destroy(audio_element_handle_t self)
+{
+    voicepack_stream_t *vs = (voicepack_stream_t *)audio_element_getdata(self);
+    audio_free(vs);
+    return ESP_OK;
+}
+
+/**
+ * @brief Creates an audio element that outputs a sequence of clips as PCM.
+ */
+audio_element_handle_t voicepack_stream_init(voicepack_stream_cfg_t *config)
+{
+    voicepack_stream_t *vs = audio_calloc(1, sizeof(voicepack_stream_t));
+    AUDIO_MEM_CHECK(TAG, vs, return NULL);
+    vs->pack = config->pack;
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _voicepack_open;
+    cfg.read = _voicepack_read;
+    cfg.process = _voicepack_process;
+    cfg.close = _voicepack_close;
+    cfg.destroy = _voicepack_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.buffer_len = config->buf_sz;
+    cfg.tag = "vpak";
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(vs);
+        return NULL;
+    });
+    audio_element_setdata(el, vs);
+    return el;
+}
+
+/**
+ * @brief Sets the clips played by the element on its next run.
+ */
+esp_err_t voicepack_stream_set_clips(audio_element_handle_t el, const uint16_t *clip_ids, int count)
+{
+    voicepack_stream_t *vs = (voicepack_stream_t *)audio_element_getdata(el);
+    if (count > VOICEPACK_MAX_CLIPS) {
+        count = VOICEPACK_MAX_CLIPS;
+    }
+
+    vs->clip_count = 0;
+    for (int i = 0; i < count; i++) {
+        const voicepack_clip_t *clip = voicepack_find_clip(vs->pack, clip_ids[i]);
+        if (clip == NULL) {
+            // Nothing rather than half a phrase
+            ESP_LOGE(TAG, "Clip %d missing from voice pack", clip_ids[i]);
+            return ESP_ERR_INVALID_ARG;
+        }
+        vs->clips[i] = clip;
+    }
+    vs->clip_count = count;
+    return ESP_OK;
+}
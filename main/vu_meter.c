@@ -0,0 +1,290 @@
+#include <math.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "ringbuf.h"
+#include "vu_meter.h"
+
+static const char *TAG = "VU_METER";
+
+#define FFT_SIZE VU_METER_FFT_SIZE
+
+/* Highest frequency shown in the spectrum */
+#define TOP_FREQ_HZ 16000
+
+/* Fall speed of the levels when no audio arrives */
+#define DECAY_DB_PER_FRAME 3
+
+/* Interval of the CPU load log */
+#define STATS_INTERVAL_US (10 * 1000 * 1000)
+
+/* log2 of full scale power: a 16-bit sample squared, and a full scale sine in the windowed and scaled FFT */
+#define SAMPLE_REF_LOG2 30
+#define FFT_REF_LOG2 26
+
+static vu_meter_cfg_t vu_cfg;
+static ringbuf_handle_t tap_rb = NULL;
+static QueueHandle_t frame_queue = NULL;
+static void (*volatile activity_listener)(bool active) = NULL;
+static volatile int tap_rate = 48000;
+static volatile int tap_channels = 2;
+
+static int16_t window[FFT_SIZE];
+static int16_t cos_tab[FFT_SIZE / 2];
+static int16_t sin_tab[FFT_SIZE / 2];
+static int16_t pcm[FFT_SIZE * 2];
+static int16_t re[FFT_SIZE];
+static int16_t im[FFT_SIZE];
+static uint8_t band_edge[VU_METER_BANDS + 1];
+
+/**
+ * @brief Converts a power to dBFS.
+ *
+ * log2 in Q8 from the position of the highest bit and the 8 bits below it,
+ * then 10 * log10(x) = 3.0103 * log2(x).
+ */
+static int8_t power_to_db(uint64_t power, int ref_log2)
+{
+    if (power == 0) {
+        return VU_METER_FLOOR_DB;
+    }
+    int n = 63 - __builtin_clzll(power);
+    uint32_t frac = n >= 8 ? (power >> (n - 8)) & 0xFF : (power << (8 - n)) & 0xFF;
+    int log2_q8 = ((n - ref_log2) << 8) | frac;
+    int db = log2_q8 * 3083 / 262144;
+    return db < VU_METER_FLOOR_DB ? VU_METER_FLOOR_DB : (db > 0 ? 0 : db);
+}
+
+/**
+ * @brief Places the band edges on a logarithmic scale up to TOP_FREQ_HZ, at least one bin per band.
+ */
+static void compute_band_edges(int rate)
+{
+    int top = (int64_t)TOP_FREQ_HZ * FFT_SIZE / rate;
+    top = top > FFT_SIZE / 2 ? FFT_SIZE / 2 : top;
+    band_edge[0] = 1;
+    for (int b = 1; b <= vu_cfg.bands; b++) {
+        int edge = (int)lroundf(powf((float)top, (float)b / vu_cfg.bands));
+        int min = band_edge[b - 1] + 1;
+        int max = top - (vu_cfg.bands - b);
+        band_edge[b] = edge < min ? min : (edge > max ? max : edge);
+    }
+}
+
+/**
+ * @brief In place radix-2 FFT in Q15, every stage scaled by 1/2.
+ */
+static void fft_q15(int16_t *xr, int16_t *xi)
+{
+    for (int i = 1, j = 0; i < FFT_SIZE; i++) {
+        int bit = FFT_SIZE >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j ^= bit;
+        if (i < j) {
+            int16_t t = xr[i];
+            xr[i] = xr[j];
+            xr[j] = t;
+            t = xi[i];
+            xi[i] = xi[j];
+            xi[j] = t;
+        }
+    }
+
+    for (int len = 2; len <= FFT_SIZE; len <<= 1) {
+        int half = len >> 1;
+        int step = FFT_SIZE / len;
+        for (int i = 0; i < FFT_SIZE; i += len) {
+            for (int k = 0; k < half; k++) {
+                int32_t wr = cos_tab[k * step];
+                int32_t wi = -sin_tab[k * step];
+                int a = i + k, b = a + half;
+                int32_t tr = (xr[b] * wr - xi[b] * wi) >> 15;
+                int32_t ti = (xr[b] * wi + xi[b] * wr) >> 15;
+                xr[b] = (xr[a] - tr) >> 1;
+                xi[b] = (xi[a] - ti) >> 1;
+                xr[a] = (xr[a] + tr) >> 1;
+                xi[a] = (xi[a] + ti) >> 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Computes levels and spectrum of one window.
+ */
+static void analyze(vu_frame_t *frame, int channels)
+{
+    uint64_t sum_sq[2] = {0, 0};
+    int peak[2] = {0, 0};
+
+    for (int i = 0; i < FFT_SIZE; i++) {
+        int mono = 0;
+        for (int c = 0; c < channels; c++) {
+            int s = pcm[i * channels + c];
+            int a = s < 0 ? -s : s;
+            peak[c] = a > peak[c] ? a : peak[c];
+            sum_sq[c] += s * s;
+            mono += s;
+        }
+        mono /= channels;
+        re[i] = (mono * window[i]) >> 15;
+        im[i] = 0;
+    }
+    if (channels == 1) {
+        peak[1] = peak[0];
+        sum_sq[1] = sum_sq[0];
+    }
+    for (int c = 0; c < 2; c++) {
+        frame->peak_db[c] = power_to_db((uint64_t)peak[c] * peak[c], SAMPLE_REF_LOG2);
+        frame->rms_db[c] = power_to_db(sum_sq[c] / FFT_SIZE, SAMPLE_REF_LOG2);
+    }
+
+    fft_q15(re, im);
+    for (int b = 0; b < vu_cfg.bands; b++) {
+        uint64_t power = 0;
+        for (int k = band_edge[b]; k < band_edge[b + 1]; k++) {
+            power += re[k] * re[k] + im[k] * im[k];
+        }
+        frame->band_db[b] = power_to_db(power, FFT_REF_LOG2);
+    }
+}
+
+// Let the levels fall while no audio arrives
+static void decay(vu_frame_t *frame)
+{
+    int8_t *levels[] = {frame->peak_db, frame->rms_db, frame->band_db};
+    int counts[] = {2, 2, vu_cfg.bands};
+    for (int l = 0; l < 3; l++) {
+        for (int i = 0; i < counts[l]; i++) {
+            int db = levels[l][i] - DECAY_DB_PER_FRAME;
+            levels[l][i] = db < VU_METER_FLOOR_DB ? VU_METER_FLOOR_DB : db;
+        }
+    }
+}
+
+static void vu_meter_task(void *pvParameters)
+{
+    vu_frame_t frame = {0};
+    frame.bands = vu_cfg.bands;
+    decay(&frame);
+
+    int rate = 0;
+    int64_t busy_us = 0;
+    int64_t stats_start_us = esp_timer_get_time();
+    TickType_t period = pdMS_TO_TICKS(vu_cfg.frame_ms) > 0 ? pdMS_TO_TICKS(vu_cfg.frame_ms) : 1;
+    TickType_t last_wake = xTaskGetTickCount();
+
+    while (1) {
+        vTaskDelayUntil(&last_wake, period);
+
+        // Drop what queued up since the last frame and wait for one fresh window
+        int channels = tap_channels;
+        int need = FFT_SIZE * channels * sizeof(int16_t);
+        rb_reset(tap_rb);
+        int r = rb_read(tap_rb, (char *)pcm, need, period);
+
+        int64_t start = esp_timer_get_time();
+        if (rate != tap_rate) {
+            rate = tap_rate;
+            compute_band_edges(rate);
+        }
+        bool was_active = frame.active;
+        frame.active = r == need;
+        if (frame.active) {
+            analyze(&frame, channels);
+        } else {
+            decay(&frame);
+        }
+        frame.seq++;
+        xQueueOverwrite(frame_queue, &frame);
+        void (*listener)(bool active) = activity_listener;
+        if (listener && frame.active != was_active) {
+            listener(frame.active);
+        }
+
+        int64_t now = esp_timer_get_time();
+        busy_us += now - start;
+        if (now - stats_start_us >= STATS_INTERVAL_US) {
+            int64_t load = busy_us * 10000 / (now - stats_start_us);
+            ESP_LOGI(TAG, "Analysis CPU load %d.%02d%%", (int)(load / 100), (int)(load % 100));
+            busy_us = 0;
+            stats_start_us = now;
+        }
+    }
+}
+
+/**
+ * @brief Creates the tap ring buffer and starts the analysis task.
+ */
+esp_err_t vu_meter_init(const vu_meter_cfg_t *config)
+{
+    vu_cfg = *config;
+    if (vu_cfg.bands < 8 || vu_cfg.bands > VU_METER_BANDS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    for (int i = 0; i < FFT_SIZE; i++) {
+        window[i] = (int16_t)(32767.0f * 0.5f * (1.0f - cosf(2.0f * (float)M_PI * i / FFT_SIZE)));
+    }
+    for (int k = 0; k < FFT_SIZE / 2; k++) {
+        cos_tab[k] = (int16_t)(32767.0f * cosf(2.0f * (float)M_PI * k / FFT_SIZE));
+        sin_tab[k] = (int16_t)(32767.0f * sinf(2.0f * (float)M_PI * k / FFT_SIZE));
+    }
+
+    // Room for one stereo window, the writer drops the rest
+    tap_rb = rb_create(FFT_SIZE * 2 * sizeof(int16_t), 1);
+    frame_queue = xQueueCreate(1, sizeof(vu_frame_t));
+    if (tap_rb == NULL || frame_queue == NULL) {
+        ESP_LOGE(TAG, "Failed to allocate the tap");
+        return ESP_ERR_NO_MEM;
+    }
+    if (xTaskCreatePinnedToCore(vu_meter_task, "vu_meter", vu_cfg.task_stack, NULL, vu_cfg.task_prio, NULL,
+                                vu_cfg.task_core) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to start the analysis task");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Connects the tap to an element.
+ */
+esp_err_t vu_meter_attach(audio_element_handle_t el)
+{
+    if (tap_rb == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return audio_element_set_multi_output_ringbuf(el, tap_rb, 0);
+}
+
+/**
+ * @brief Sets the format of the tapped audio, always 16-bit.
+ */
+void vu_meter_set_format(int rate, int channels)
+{
+    if (rate > 0 && (channels == 1 || channels == 2)) {
+        tap_rate = rate;
+        tap_channels = channels;
+    }
+}
+
+/**
+ * @brief Reads the latest frame without waiting.
+ */
+bool vu_meter_get_frame(vu_frame_t *frame)
+{
+    return frame_queue && xQueuePeek(frame_queue, frame, 0) == pdTRUE;
+}
+
+/**
+ * @brief Sets a function the analysis task calls when audio starts or stops arriving.
+ */
+void vu_meter_set_listener(void (*listener)(bool active))
+{
+    activity_listener = listener;
+}
@@ -0,0 +1,228 @@
+#include <stdbool.h>
+#include <string.h>
+#include "wav_file.h"
+
+static uint32_t read_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static int read_le16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+enum {
+    PARSE_RIFF,
+    PARSE_CHUNK,
+    PARSE_FMT,
+    PARSE_SKIP,
+    PARSE_DATA,
+};
+
+/* Bytes 2 to 15 of the sub format GUIDs of WAVE_FORMAT_EXTENSIBLE, the first two are the format tag */
+static const uint8_t subformat_guid[14] = {
+    0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71
+};
+
+static esp_err_t parse_fmt(const uint8_t *fmt, uint32_t size, wav_file_info_t *info)
+{
+    if (size < 16) {
+        return ESP_FAIL;
+    }
+    info->format = read_le16(fmt);
+    info->channels = read_le16(fmt + 2);
+    info->sample_rate = read_le32(fmt + 4);
+    info->block_align = read_le16(fmt + 12);
+    info->bits = read_le16(fmt + 14);
+    info->valid_bits = info->bits;
+    if (info->format == WAV_FORMAT_EXTENSIBLE) {
+        // Extension size, valid bits, channel mask and the sub format GUID
+        if (size < WAV_FMT_MAX || read_le16(fmt + 16) < 22 ||
+            memcmp(fmt + 26, subformat_guid, sizeof(subformat_guid)) != 0) {
+            return ESP_FAIL;
+        }
+        int valid_bits = read_le16(fmt + 18);
+        if (valid_bits > 0 && valid_bits <= info->bits) {
+            info->valid_bits = valid_bits;
+        }
+        info->format = read_le16(fmt + 24);
+    }
+    if (info->channels == 0 || info->sample_rate == 0 || info->block_align == 0) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/**
+ * @brief Parses the RIFF/WAVE header and leaves the file at the start of the data chunk.
+ */
+esp_err_t wav_file_parse(FILE *file, wav_file_info_t *info)
+{
+    uint8_t riff[12];
+    if (fread(riff, 1, sizeof(riff), file) != sizeof(riff) ||
+        memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return ESP_FAIL;
+    }
+
+    bool have_fmt = false;
+    while (1) {
+        uint8_t hdr[8];
+        if (fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+            return ESP_FAIL;
+        }
+        uint32_t size = read_le32(hdr + 4);
+        uint32_t pad = size & 1;
+
+        if (memcmp(hdr, "fmt ", 4) == 0 && size >= 16) {
+            uint8_t fmt[WAV_FMT_MAX];
+            uint32_t len = size < sizeof(fmt) ? size : sizeof(fmt);
+            if (fread(fmt, 1, len, file) != len || parse_fmt(fmt, len, info) != ESP_OK) {
+                return ESP_FAIL;
+            }
+            have_fmt = true;
+            size -= len;
+        } else if (memcmp(hdr, "data", 4) == 0) {
+            if (!have_fmt) {
+                return ESP_FAIL;
+            }
+            long start = ftell(file);
+            if (start < 0 || fseek(file, 0, SEEK_END) != 0) {
+                return ESP_FAIL;
+            }
+            long end = ftell(file);
+            if (end < start || fseek(file, start, SEEK_SET) != 0) {
+                return ESP_FAIL;
+            }
+            // Streaming writers leave the size at 0 or UINT32_MAX, the file ends the data
+            if (size == 0 || size > (uint32_t)(end - start)) {
+                size = end - start;
+            }
+            info->data_offset = start;
+            info->data_size = size - size % info->block_align;
+            return ESP_OK;
+        }
+
+        // Skip the rest of the chunk, chunks are padded to an even size
+        if (fseek(file, size + pad, SEEK_CUR) != 0) {
+            return ESP_FAIL;
+        }
+    }
+}
+
+/**
+ * @brief Resets the streaming parser to the start of a RIFF/WAVE header.
+ */
+void wav_parser_init(wav_parser_t *parser)
+{
+    memset(parser, 0, sizeof(*parser));
+    parser->state = PARSE_RIFF;
+    parser->need = 12;
+}
+
+static void next_part(wav_parser_t *parser, int state, uint32_t need)
+{
+    parser->state = state;
+    parser->need = need;
+    parser->have = 0;
+}
+
+/**
+ * @brief Feeds the next bytes of a stream to the parser.
+ */
+wav_parser_result_t wav_parser_feed(wav_parser_t *parser, const uint8_t *data, int len, int *used)
+{
+    int pos = 0;
+    wav_parser_result_t result = WAV_PARSER_MORE;
+
+    while (result == WAV_PARSER_MORE) {
+        if (parser->state == PARSE_DATA) {
+            result = WAV_PARSER_DATA;
+            break;
+        }
+        uint32_t left = (uint32_t)(len - pos);
+        if (parser->state == PARSE_SKIP) {
+            // Counted, not buffered, so a chunk of any size costs nothing
+            uint32_t n = left < parser->skip ? left : parser->skip;
+            pos += n;
+            parser->skip -= n;
+            if (parser->skip > 0) {
+                break;
+            }
+            next_part(parser, PARSE_CHUNK, 8);
+            continue;
+        }
+
+        uint32_t n = left < parser->need - parser->have ? left : parser->need - parser->have;
+        memcpy(parser->buf + parser->have, data + pos, n);
+        parser->have += n;
+        pos += n;
+        if (parser->have < parser->need) {
+            break;
+        }
+
+        const uint8_t *buf = parser->buf;
+        uint32_t size = read_le32(buf + 4);
+        switch (parser->state) {
+        case PARSE_RIFF:
+            if (memcmp(buf, "RIFF", 4) != 0 || memcmp(buf + 8, "WAVE", 4) != 0) {
+                result = WAV_PARSER_ERROR;
+                break;
+            }
+            next_part(parser, PARSE_CHUNK, 8);
+            break;
+        case PARSE_CHUNK:
+            if (memcmp(buf, "fmt ", 4) == 0 && size >= 16) {
+                // Chunks are padded to an even size
+                next_part(parser, PARSE_FMT, size < WAV_FMT_MAX ? size : WAV_FMT_MAX);
+                parser->skip = size - parser->need + (size & 1);
+            } else if (memcmp(buf, "data", 4) == 0) {
+                if (!parser->have_fmt) {
+                    result = WAV_PARSER_ERROR;
+                    break;
+                }
+                parser->info.data_offset = parser->offset + pos;
+                parser->info.data_size = size == 0 || size == UINT32_MAX ? UINT32_MAX :
+                                         size - size % parser->info.block_align;
+                parser->state = PARSE_DATA;
+            } else {
+                parser->state = PARSE_SKIP;
+                parser->skip = size + (size & 1 && size < UINT32_MAX);
+            }
+            break;
+        case PARSE_FMT:
+            if (parse_fmt(buf, parser->need, &parser->info) != ESP_OK) {
+                result = WAV_PARSER_ERROR;
+                break;
+            }
+            parser->have_fmt = true;
+            parser->state = PARSE_SKIP;
+            break;
+        }
+    }
+    parser->offset += pos;
+    *used = pos;
+    return result;
+}
+
+/**
+ * @brief Converts a time to an offset into the data chunk.
+ */
+uint32_t wav_file_offset(const wav_file_info_t *info, int64_t position_ms)
+{
+    if (position_ms <= 0) {
+        return 0;
+    }
+    // Whole frames first, so the offset stays on a frame boundary for any rate
+    uint64_t frame = (uint64_t)position_ms * info->sample_rate / 1000;
+    uint64_t offset = frame * info->block_align;
+    return offset >= info->data_size ? info->data_size : (uint32_t)offset;
+}
+
+/**
+ * @brief Returns the length of the data chunk.
+ */
+int64_t wav_file_duration_ms(const wav_file_info_t *info)
+{
+    return (int64_t)(info->data_size / info->block_align) * 1000 / info->sample_rate;
+}
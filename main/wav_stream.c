@@ -0,0 +1,196 @@
+#include <string.h>
+#include "esp_log.h"
+#include "audio_mem.h"
+#include "wav_stream.h"
+#include "pcm_convert.h"
+
+static const char *TAG = "WAV_STREAM";
+
+/**
+ * @brief Private state of the WAV decoder element.
+ */
+typedef struct {
+    wav_stream_cfg_t cfg;
+    int16_t *out;
+    int out_sz;
+
+    wav_parser_t parser;
+    bool parsing;
+
+    // Format of the samples, bytes of the data chunk still to read
+    wav_file_info_t info;
+    pcm_convert_t conv;
+    uint32_t data_left;
+
+    // Bytes at the start of the input buffer left over from the previous iteration
+    int carry;
+
+    // Start inside the data chunk set by wav_stream_start_at() for the next open
+    bool start_pending;
+    wav_file_info_t start_info;
+    uint32_t start_offset;
+} wav_stream_t;
+
+static esp_err_t start_data(audio_element_handle_t self, wav_stream_t *ws, const wav_file_info_t *info,
+                            uint32_t offset)
+{
+    pcm_format_t format = pcm_format_of(info);
+    if (format == PCM_FORMAT_NONE) {
+        ESP_LOGE(TAG, "Unsupported format %d, %d bits, %d channels", info->format, info->bits, info->channels);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    ws->info = *info;
+    ws->parsing = false;
+    pcm_convert_init(&ws->conv, format);
+    ws->data_left = info->data_size == UINT32_MAX ? UINT32_MAX : info->data_size - offset;
+
+    audio_element_info_t el_info = {0};
+    audio_element_getinfo(self, &el_info);
+    el_info.sample_rates = info->sample_rate;
+    el_info.channels = info->channels;
+    el_info.bits = 16;
+    el_info.byte_pos = offset;
+    el_info.total_bytes = info->data_size == UINT32_MAX ? 0 : info->data_size;
+    audio_element_setinfo(self, &el_info);
+    audio_element_report_info(self);
+    return ESP_OK;
+}
+
+static esp_err_t _wav_open(audio_element_handle_t self)
+{
+    wav_stream_t *ws = (wav_stream_t *)audio_element_getdata(self);
+    ws->carry = 0;
+    if (ws->start_pending) {
+        ws->start_pending = false;
+        return start_data(self, ws, &ws->start_info, ws->start_offset);
+    }
+    wav_parser_init(&ws->parser);
+    ws->parsing = true;
+    return ESP_OK;
+}
+
+static int _wav_process(audio_element_handle_t self, char *in_buffer, int in_len)
+{
+    wav_stream_t *ws = (wav_stream_t *)audio_element_getdata(self);
+    int r = audio_element_input(self, in_buffer + ws->carry, in_len - ws->carry);
+    if (r <= 0) {
+        return r;
+    }
+    int len = ws->carry + r;
+    ws->carry = 0;
+
+    if (ws->parsing) {
+        int used;
+        wav_parser_result_t result = wav_parser_feed(&ws->parser, (const uint8_t *)in_buffer, len, &used);
+        if (result == WAV_PARSER_MORE) {
+            return r;
+        }
+        if (result == WAV_PARSER_ERROR || start_data(self, ws, &ws->parser.info, 0) != ESP_OK) {
+            ESP_LOGE(TAG, "Not a playable WAV stream");
+            return AEL_IO_FAIL;
+        }
+        // The samples start at the buffer start, 32-bit samples are then aligned
+        len -= used;
+        memmove(in_buffer, in_buffer + used, len);
+    }
+
+    if ((uint32_t)len > ws->data_left) {
+        len = ws->data_left;
+    }
+    int frames = len / ws->info.block_align;
+    int bytes = frames * ws->info.block_align;
+    if (ws->data_left != UINT32_MAX) {
+        ws->data_left -= bytes;
+    }
+
+    if (frames > 0) {
+        int samples = frames * ws->info.channels;
+        pcm_convert_to_s16(&ws->conv, in_buffer, samples, ws->out);
+        int w = audio_element_output(self, (char *)ws->out, samples * sizeof(int16_t));
+        if (w < 0) {
+            return w;
+        }
+        audio_element_update_byte_pos(self, bytes);
+    }
+    if (ws->data_left == 0) {
+        return AEL_IO_DONE;
+    }
+    // A partial frame goes first next time
+    ws->carry = len - bytes;
+    memmove(in_buffer, in_buffer + bytes, ws->carry);
+    return r;
+}
+
+static esp_err_t _wav_close(audio_element_handle_t self)
+{
+    if (AEL_STATE_PAUSED != audio_element_get_state(self)) {
+        audio_element_set_byte_pos(self, 0);
+    }
+    return ESP_OK;
+}
+
+static esp_err_t _wav_destroy(audio_element_handle_t self)
+{
+    wav_stream_t *ws = (wav_stream_t *)audio_element_getdata(self);
+    audio_free(ws->out);
+    audio_free(ws);
+    return ESP_OK;
+}
+
+/**
+ * @brief Makes the next run start inside the data chunk, for a seek.
+ */
+void wav_stream_start_at(audio_element_handle_t el, const wav_file_info_t *info, uint32_t offset)
+{
+    wav_stream_t *ws = (wav_stream_t *)audio_element_getdata(el);
+    ws->start_info = *info;
+    ws->start_offset = offset;
+    ws->start_pending = true;
+}
+
+/**
+ * @brief Returns the header of the stream that plays.
+ */
+void wav_stream_get_format(audio_element_handle_t el, wav_file_info_t *info)
+{
+    wav_stream_t *ws = (wav_stream_t *)audio_element_getdata(el);
+    *info = ws->info;
+}
+
+/**
+ * @brief Creates the WAV decoder element.
+ */
+audio_element_handle_t wav_stream_init(wav_stream_cfg_t *config)
+{
+    wav_stream_t *ws = audio_calloc(1, sizeof(wav_stream_t));
+    AUDIO_MEM_CHECK(TAG, ws, return NULL);
+    ws->cfg = *config;
+    // Room for a whole input buffer of 8-bit samples, the only format that grows
+    ws->out_sz = config->buf_sz * 2;
+    ws->out = audio_malloc(ws->out_sz);
+    AUDIO_MEM_CHECK(TAG, ws->out, {
+        audio_free(ws);
+        return NULL;
+    });
+
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.open = _wav_open;
+    cfg.process = _wav_process;
+    cfg.close = _wav_close;
+    cfg.destroy = _wav_destroy;
+    cfg.task_stack = config->task_stack;
+    cfg.task_prio = config->task_prio;
+    cfg.task_core = config->task_core;
+    cfg.out_rb_size = config->out_rb_size;
+    cfg.buffer_len = config->buf_sz;
+    cfg.tag = "wav";
+
+    audio_element_handle_t el = audio_element_init(&cfg);
+    AUDIO_MEM_CHECK(TAG, el, {
+        audio_free(ws->out);
+        audio_free(ws);
+        return NULL;
+    });
+    audio_element_setdata(el, ws);
+    return el;
+}
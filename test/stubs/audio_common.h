@@ -0,0 +1,26 @@
+#pragma once
+
+typedef enum {
+    AUDIO_ELEMENT_TYPE_UNKNOW = 0x01 << 16,
+    AUDIO_ELEMENT_TYPE_ELEMENT = 0x01 << 17,
+    AUDIO_ELEMENT_TYPE_PLAYER = 0x01 << 18,
+    AUDIO_ELEMENT_TYPE_SERVICE = 0x01 << 19,
+    AUDIO_ELEMENT_TYPE_PERIPH = 0x01 << 20,
+} audio_element_type_t;
+
+typedef enum {
+    AUDIO_STREAM_NONE = 0,
+    AUDIO_STREAM_READER,
+    AUDIO_STREAM_WRITER,
+} audio_stream_type_t;
+
+typedef enum {
+    AUDIO_HAL_CODEC_MODE_ENCODE = 1,
+    AUDIO_HAL_CODEC_MODE_DECODE,
+    AUDIO_HAL_CODEC_MODE_BOTH,
+} audio_hal_codec_mode_t;
+
+typedef enum {
+    AUDIO_HAL_CTRL_STOP = 0,
+    AUDIO_HAL_CTRL_START,
+} audio_hal_ctrl_t;
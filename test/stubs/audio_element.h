@@ -0,0 +1,157 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "audio_common.h"
+#include "audio_event_iface.h"
+#include "ringbuf.h"
+
+typedef struct audio_element *audio_element_handle_t;
+
+typedef enum {
+    AEL_IO_OK = 0,
+    AEL_IO_FAIL = -1,
+    AEL_IO_DONE = -2,
+    AEL_IO_ABORT = -3,
+    AEL_IO_TIMEOUT = -4,
+} audio_element_err_t;
+
+typedef enum {
+    AEL_STATE_NONE,
+    AEL_STATE_INIT,
+    AEL_STATE_INITIALIZING,
+    AEL_STATE_RUNNING,
+    AEL_STATE_PAUSED,
+    AEL_STATE_STOPPED,
+    AEL_STATE_FINISHED,
+    AEL_STATE_ERROR,
+} audio_element_state_t;
+
+typedef enum {
+    AEL_MSG_CMD_NONE,
+    AEL_MSG_CMD_FINISH = 2,
+    AEL_MSG_CMD_STOP,
+    AEL_MSG_CMD_PAUSE,
+    AEL_MSG_CMD_RESUME,
+    AEL_MSG_CMD_DESTROY,
+    AEL_MSG_CMD_REPORT_STATUS = 8,
+    AEL_MSG_CMD_REPORT_MUSIC_INFO,
+    AEL_MSG_CMD_REPORT_CODEC_FMT,
+    AEL_MSG_CMD_REPORT_POSITION,
+} audio_element_msg_cmd_t;
+
+typedef enum {
+    AEL_STATUS_NONE,
+    AEL_STATUS_ERROR_OPEN,
+    AEL_STATUS_ERROR_INPUT,
+    AEL_STATUS_ERROR_PROCESS,
+    AEL_STATUS_ERROR_OUTPUT,
+    AEL_STATUS_ERROR_CLOSE,
+    AEL_STATUS_ERROR_TIMEOUT,
+    AEL_STATUS_ERROR_UNKNOWN,
+    AEL_STATUS_INPUT_DONE,
+    AEL_STATUS_INPUT_BUFFERING,
+    AEL_STATUS_OUTPUT_DONE,
+    AEL_STATUS_OUTPUT_BUFFERING,
+    AEL_STATUS_STATE_RUNNING,
+    AEL_STATUS_STATE_PAUSED,
+    AEL_STATUS_STATE_STOPPED,
+    AEL_STATUS_STATE_FINISHED,
+    AEL_STATUS_MOUNTED,
+    AEL_STATUS_UNMOUNTED,
+} audio_element_status_t;
+
+typedef enum {
+    ESP_CODEC_TYPE_UNKNOW,
+} esp_codec_type_t;
+
+typedef struct {
+    int sample_rates;
+    int channels;
+    int bits;
+    int bps;
+    int64_t byte_pos;
+    int64_t total_bytes;
+    int duration;
+    char *uri;
+    esp_codec_type_t codec_fmt;
+} audio_element_info_t;
+
+typedef esp_err_t (*el_io_func)(audio_element_handle_t self);
+typedef audio_element_err_t (*process_func)(audio_element_handle_t self, char *el_buffer, int el_buf_len);
+typedef audio_element_err_t (*stream_func)(audio_element_handle_t self, char *buffer, int len,
+                                           TickType_t ticks_to_wait, void *context);
+typedef esp_err_t (*ctrl_func)(audio_element_handle_t self, void *in_data, int in_size, void *out_data,
+                               int *out_size);
+
+typedef struct {
+    el_io_func open;
+    ctrl_func seek;
+    process_func process;
+    el_io_func close;
+    el_io_func destroy;
+    stream_func read;
+    stream_func write;
+    int buffer_len;
+    int task_stack;
+    int task_prio;
+    int task_core;
+    int out_rb_size;
+    void *data;
+    const char *tag;
+    bool stack_in_ext;
+    int multi_in_rb_num;
+    int multi_out_rb_num;
+} audio_element_cfg_t;
+
+#define DEFAULT_AUDIO_ELEMENT_CONFIG() \
+    {                                  \
+        .buffer_len = 2048,            \
+        .task_stack = 4096,            \
+        .task_prio = 5,                \
+        .out_rb_size = 8192,           \
+    }
+
+/* Implemented by test/stubs/element.c, see host.h for how a test drives an element */
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config);
+esp_err_t audio_element_deinit(audio_element_handle_t el);
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data);
+void *audio_element_getdata(audio_element_handle_t el);
+esp_err_t audio_element_set_tag(audio_element_handle_t el, const char *tag);
+char *audio_element_get_tag(audio_element_handle_t el);
+esp_err_t audio_element_setinfo(audio_element_handle_t el, audio_element_info_t *info);
+esp_err_t audio_element_getinfo(audio_element_handle_t el, audio_element_info_t *info);
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri);
+char *audio_element_get_uri(audio_element_handle_t el);
+esp_err_t audio_element_run(audio_element_handle_t el);
+esp_err_t audio_element_terminate(audio_element_handle_t el);
+esp_err_t audio_element_stop(audio_element_handle_t el);
+esp_err_t audio_element_wait_for_stop(audio_element_handle_t el);
+esp_err_t audio_element_pause(audio_element_handle_t el);
+esp_err_t audio_element_resume(audio_element_handle_t el, float wait_for_rb_threshold, TickType_t timeout);
+audio_element_state_t audio_element_get_state(audio_element_handle_t el);
+esp_err_t audio_element_report_info(audio_element_handle_t el);
+esp_err_t audio_element_report_pos(audio_element_handle_t el);
+esp_err_t audio_element_report_status(audio_element_handle_t el, audio_element_status_t status);
+esp_err_t audio_element_set_byte_pos(audio_element_handle_t el, int64_t pos);
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el, int pos);
+esp_err_t audio_element_set_total_bytes(audio_element_handle_t el, int64_t total_bytes);
+esp_err_t audio_element_update_total_bytes(audio_element_handle_t el, int total_bytes);
+audio_element_err_t audio_element_input(audio_element_handle_t self, char *buffer, int wanted_size);
+audio_element_err_t audio_element_output(audio_element_handle_t self, char *buffer, int write_size);
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn, void *context);
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn, void *context);
+esp_err_t audio_element_reset_state(audio_element_handle_t el);
+esp_err_t audio_element_set_input_timeout(audio_element_handle_t el, TickType_t timeout);
+esp_err_t audio_element_set_output_timeout(audio_element_handle_t el, TickType_t timeout);
+esp_err_t audio_element_finish_state(audio_element_handle_t el);
+ringbuf_handle_t audio_element_get_output_ringbuf(audio_element_handle_t el);
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el);
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb);
+int audio_element_get_output_ringbuf_size(audio_element_handle_t el);
+esp_err_t audio_element_set_multi_output_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb, int index);
+ringbuf_handle_t audio_element_get_multi_output_ringbuf(audio_element_handle_t el, int index);
+/* Writes to every multi output ring buffer without waiting, like with an output timeout of 0 */
+audio_element_err_t audio_element_multi_output(audio_element_handle_t el, char *buffer, int wanted_size);
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct audio_event_iface *audio_event_iface_handle_t;
+
+typedef struct {
+    int cmd;
+    void *data;
+    int data_len;
+    void *source;
+    int source_type;
+    bool need_free_data;
+} audio_event_iface_msg_t;
+
+typedef esp_err_t (*on_event_iface_func)(audio_event_iface_msg_t *, void *);
+
+typedef struct {
+    int internal_queue_size;
+    int external_queue_size;
+    int queue_set_size;
+    on_event_iface_func on_cmd;
+    void *context;
+    TickType_t wait_time;
+    int type;
+} audio_event_iface_cfg_t;
+
+#define AUDIO_EVENT_IFACE_DEFAULT_CFG()   \
+    {                                     \
+        .internal_queue_size = 5,         \
+        .external_queue_size = 5,         \
+        .queue_set_size = 5,              \
+        .wait_time = portMAX_DELAY,       \
+    }
+
+/* Messages sent out go to the listener's queue, listen() takes them without waiting */
+audio_event_iface_handle_t audio_event_iface_init(audio_event_iface_cfg_t *config);
+esp_err_t audio_event_iface_destroy(audio_event_iface_handle_t evt);
+esp_err_t audio_event_iface_set_listener(audio_event_iface_handle_t evt, audio_event_iface_handle_t listener);
+esp_err_t audio_event_iface_remove_listener(audio_event_iface_handle_t listen, audio_event_iface_handle_t evt);
+esp_err_t audio_event_iface_listen(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg, TickType_t wait_time);
+esp_err_t audio_event_iface_sendout(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg);
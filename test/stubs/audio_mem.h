@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdlib.h>
+
+#define audio_malloc malloc
+#define audio_calloc calloc
+#define audio_realloc realloc
+#define audio_free free
+#define AUDIO_MEM_CHECK(tag, x, action) \
+    if (!(x)) {                         \
+        action;                         \
+    }
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "esp_peripherals.h"
+#include "audio_common.h"
+
+typedef struct audio_hal *audio_hal_handle_t;
+
+struct audio_board_handle {
+    audio_hal_handle_t audio_hal;
+};
+typedef struct audio_board_handle *audio_board_handle_t;
+
+typedef enum {
+    SD_MODE_1_LINE = 1,
+    SD_MODE_4_LINE = 4,
+} periph_sdcard_mode_t;
+
+audio_board_handle_t audio_board_init(void);
+esp_err_t audio_board_key_init(esp_periph_set_handle_t set);
+esp_err_t audio_board_sdcard_init(esp_periph_set_handle_t set, periph_sdcard_mode_t mode);
+esp_err_t audio_hal_ctrl_codec(audio_hal_handle_t hal, audio_hal_codec_mode_t mode, audio_hal_ctrl_t ctrl);
+esp_err_t audio_hal_set_volume(audio_hal_handle_t hal, int volume);
+esp_err_t audio_hal_get_volume(audio_hal_handle_t hal, int *volume);
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+/* The part of the legacy I2S driver the modules use, the DMA runs on the virtual clock */
+
+typedef enum {
+    I2S_NUM_0 = 0,
+    I2S_NUM_1,
+    I2S_NUM_MAX,
+} i2s_port_t;
+
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait);
+esp_err_t i2s_start(i2s_port_t i2s_num);
+esp_err_t i2s_stop(i2s_port_t i2s_num);
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num);
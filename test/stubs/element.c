@@ -0,0 +1,365 @@
+#include <stdlib.h>
+#include <string.h>
+#include "audio_element.h"
+#include "audio_event_iface.h"
+#include "esp_peripherals.h"
+#include "host.h"
+
+#define QUEUE_SIZE 32
+#define MULTI_OUT_MAX 4
+
+struct audio_event_iface {
+    audio_event_iface_msg_t queue[QUEUE_SIZE];
+    int head;
+    int count;
+    audio_event_iface_handle_t listener;
+};
+
+struct audio_element {
+    audio_element_cfg_t cfg;
+    char *tag;
+    char *uri;
+    void *data;
+    audio_element_info_t info;
+    audio_element_state_t state;
+    audio_element_status_t status;
+    bool opened;
+    char *buffer;
+    stream_func read;
+    void *read_ctx;
+    stream_func write;
+    void *write_ctx;
+    TickType_t input_timeout;
+    ringbuf_handle_t input_rb;
+    ringbuf_handle_t multi_out[MULTI_OUT_MAX];
+};
+
+audio_event_iface_handle_t audio_event_iface_init(audio_event_iface_cfg_t *config)
+{
+    return calloc(1, sizeof(struct audio_event_iface));
+}
+
+esp_err_t audio_event_iface_destroy(audio_event_iface_handle_t evt)
+{
+    free(evt);
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_set_listener(audio_event_iface_handle_t evt, audio_event_iface_handle_t listener)
+{
+    evt->listener = listener;
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_remove_listener(audio_event_iface_handle_t listen, audio_event_iface_handle_t evt)
+{
+    evt->listener = NULL;
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_sendout(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg)
+{
+    audio_event_iface_handle_t to = evt->listener != NULL ? evt->listener : evt;
+    if (to->count == QUEUE_SIZE) {
+        return ESP_FAIL;
+    }
+    to->queue[(to->head + to->count++) % QUEUE_SIZE] = *msg;
+    return ESP_OK;
+}
+
+esp_err_t audio_event_iface_listen(audio_event_iface_handle_t evt, audio_event_iface_msg_t *msg, TickType_t wait_time)
+{
+    if (evt->count == 0) {
+        return ESP_FAIL;
+    }
+    *msg = evt->queue[evt->head];
+    evt->head = (evt->head + 1) % QUEUE_SIZE;
+    evt->count--;
+    return ESP_OK;
+}
+
+int host_event_count(audio_event_iface_handle_t evt)
+{
+    return evt->count;
+}
+
+int esp_periph_get_id(esp_periph_handle_t periph)
+{
+    return (int)(intptr_t)periph;
+}
+
+audio_element_handle_t audio_element_init(audio_element_cfg_t *config)
+{
+    audio_element_handle_t el = calloc(1, sizeof(struct audio_element));
+    el->cfg = *config;
+    el->data = config->data;
+    el->tag = strdup(config->tag != NULL ? config->tag : "unknown");
+    el->state = AEL_STATE_INIT;
+    // Like ADF, the read and write functions of the element are its callbacks until others are set
+    el->read = config->read;
+    el->write = config->write;
+    el->buffer = malloc(config->buffer_len > 0 ? config->buffer_len : 1);
+    return el;
+}
+
+esp_err_t audio_element_deinit(audio_element_handle_t el)
+{
+    if (el->opened && el->cfg.close != NULL) {
+        el->cfg.close(el);
+    }
+    if (el->cfg.destroy != NULL) {
+        el->cfg.destroy(el);
+    }
+    free(el->tag);
+    free(el->uri);
+    free(el->buffer);
+    free(el);
+    return ESP_OK;
+}
+
+esp_err_t audio_element_setdata(audio_element_handle_t el, void *data)
+{
+    el->data = data;
+    return ESP_OK;
+}
+
+void *audio_element_getdata(audio_element_handle_t el)
+{
+    return el->data;
+}
+
+esp_err_t audio_element_set_tag(audio_element_handle_t el, const char *tag)
+{
+    free(el->tag);
+    el->tag = strdup(tag);
+    return ESP_OK;
+}
+
+char *audio_element_get_tag(audio_element_handle_t el)
+{
+    return el->tag;
+}
+
+esp_err_t audio_element_setinfo(audio_element_handle_t el, audio_element_info_t *info)
+{
+    el->info = *info;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_getinfo(audio_element_handle_t el, audio_element_info_t *info)
+{
+    *info = el->info;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_uri(audio_element_handle_t el, const char *uri)
+{
+    free(el->uri);
+    el->uri = uri != NULL ? strdup(uri) : NULL;
+    return ESP_OK;
+}
+
+char *audio_element_get_uri(audio_element_handle_t el)
+{
+    return el->uri;
+}
+
+esp_err_t audio_element_run(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_RUNNING;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_terminate(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_STOPPED;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_stop(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_STOPPED;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_wait_for_stop(audio_element_handle_t el)
+{
+    return ESP_OK;
+}
+
+esp_err_t audio_element_pause(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_PAUSED;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_resume(audio_element_handle_t el, float wait_for_rb_threshold, TickType_t timeout)
+{
+    el->state = AEL_STATE_RUNNING;
+    return ESP_OK;
+}
+
+audio_element_state_t audio_element_get_state(audio_element_handle_t el)
+{
+    return el->state;
+}
+
+esp_err_t audio_element_report_info(audio_element_handle_t el)
+{
+    return ESP_OK;
+}
+
+esp_err_t audio_element_report_pos(audio_element_handle_t el)
+{
+    return ESP_OK;
+}
+
+esp_err_t audio_element_report_status(audio_element_handle_t el, audio_element_status_t status)
+{
+    el->status = status;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_byte_pos(audio_element_handle_t el, int64_t pos)
+{
+    el->info.byte_pos = pos;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_update_byte_pos(audio_element_handle_t el, int pos)
+{
+    el->info.byte_pos += pos;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_total_bytes(audio_element_handle_t el, int64_t total_bytes)
+{
+    el->info.total_bytes = total_bytes;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_update_total_bytes(audio_element_handle_t el, int total_bytes)
+{
+    el->info.total_bytes += total_bytes;
+    return ESP_OK;
+}
+
+audio_element_err_t audio_element_input(audio_element_handle_t self, char *buffer, int wanted_size)
+{
+    if (self->read == NULL) {
+        return AEL_IO_FAIL;
+    }
+    return self->read(self, buffer, wanted_size, self->input_timeout, self->read_ctx);
+}
+
+audio_element_err_t audio_element_output(audio_element_handle_t self, char *buffer, int write_size)
+{
+    if (self->write == NULL) {
+        return write_size;
+    }
+    return self->write(self, buffer, write_size, portMAX_DELAY, self->write_ctx);
+}
+
+esp_err_t audio_element_set_read_cb(audio_element_handle_t el, stream_func fn, void *context)
+{
+    el->read = fn;
+    el->read_ctx = context;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_write_cb(audio_element_handle_t el, stream_func fn, void *context)
+{
+    el->write = fn;
+    el->write_ctx = context;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_input_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb)
+{
+    el->input_rb = rb;
+    return ESP_OK;
+}
+
+ringbuf_handle_t audio_element_get_input_ringbuf(audio_element_handle_t el)
+{
+    return el->input_rb;
+}
+
+esp_err_t audio_element_set_multi_output_ringbuf(audio_element_handle_t el, ringbuf_handle_t rb, int index)
+{
+    if (index < 0 || index >= MULTI_OUT_MAX || index >= el->cfg.multi_out_rb_num) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    el->multi_out[index] = rb;
+    return ESP_OK;
+}
+
+ringbuf_handle_t audio_element_get_multi_output_ringbuf(audio_element_handle_t el, int index)
+{
+    return index >= 0 && index < MULTI_OUT_MAX ? el->multi_out[index] : NULL;
+}
+
+audio_element_err_t audio_element_multi_output(audio_element_handle_t el, char *buffer, int wanted_size)
+{
+    for (int i = 0; i < MULTI_OUT_MAX; i++) {
+        if (el->multi_out[i] != NULL) {
+            rb_write(el->multi_out[i], buffer, wanted_size, 0);
+        }
+    }
+    return wanted_size;
+}
+
+esp_err_t audio_element_reset_state(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_INIT;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_input_timeout(audio_element_handle_t el, TickType_t timeout)
+{
+    el->input_timeout = timeout;
+    return ESP_OK;
+}
+
+esp_err_t audio_element_set_output_timeout(audio_element_handle_t el, TickType_t timeout)
+{
+    return ESP_OK;
+}
+
+esp_err_t audio_element_finish_state(audio_element_handle_t el)
+{
+    el->state = AEL_STATE_FINISHED;
+    return ESP_OK;
+}
+
+audio_element_err_t host_element_process(audio_element_handle_t el)
+{
+    if (!el->opened) {
+        if (el->cfg.open != NULL && el->cfg.open(el) != ESP_OK) {
+            return AEL_IO_FAIL;
+        }
+        el->opened = true;
+        el->state = AEL_STATE_RUNNING;
+    }
+    return el->cfg.process(el, el->buffer, el->cfg.buffer_len);
+}
+
+esp_err_t host_element_close(audio_element_handle_t el)
+{
+    esp_err_t ret = ESP_OK;
+    if (el->opened && el->cfg.close != NULL) {
+        ret = el->cfg.close(el);
+    }
+    el->opened = false;
+    return ret;
+}
+
+audio_element_status_t host_element_status(audio_element_handle_t el)
+{
+    return el->status;
+}
+
+void host_element_set_state(audio_element_handle_t el, audio_element_state_t state)
+{
+    el->state = state;
+}
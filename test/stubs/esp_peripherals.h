@@ -0,0 +1,27 @@
+#pragma once
+
+#include "esp_err.h"
+#include "audio_event_iface.h"
+
+typedef struct esp_periph_set *esp_periph_set_handle_t;
+typedef struct esp_periph *esp_periph_handle_t;
+
+typedef struct {
+    int task_stack;
+    int task_prio;
+    int task_core;
+    bool extern_stack;
+} esp_periph_config_t;
+
+#define DEFAULT_ESP_PERIPH_SET_CONFIG() \
+    {                                   \
+        .task_stack = 4096,             \
+        .task_prio = 5,                 \
+    }
+
+esp_periph_set_handle_t esp_periph_set_init(esp_periph_config_t *config);
+esp_err_t esp_periph_set_destroy(esp_periph_set_handle_t periph_set);
+esp_err_t esp_periph_set_stop_all(esp_periph_set_handle_t periph_set);
+esp_err_t esp_periph_start(esp_periph_set_handle_t periph_set, esp_periph_handle_t periph);
+audio_event_iface_handle_t esp_periph_set_get_event_iface(esp_periph_set_handle_t periph_set);
+int esp_periph_get_id(esp_periph_handle_t periph);
@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef void (*shutdown_handler_t)(void);
+
+uint32_t esp_get_free_heap_size(void);
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle);
+void esp_restart(void);
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
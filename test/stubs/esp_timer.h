@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/* Virtual time, see host.h */
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,110 @@
+#include <string.h>
+#include "hd44780.h"
+#include "pcf8574.h"
+#include "host.h"
+
+/*
+ * One 20x4 display: DDRAM with the line addresses of the 20x4 modules, CGRAM and the
+ * address counter, which moves on after every byte written like on the real controller.
+ * The PCF8574 expander under it only has to exist, the display is emulated above it.
+ */
+
+static const uint8_t line_addr[4] = {0x00, 0x40, 0x14, 0x54};
+
+static uint8_t ddram[0x80];
+static uint8_t cgram[8][8];
+static uint8_t addr = 0;
+static uint32_t bytes = 0;
+
+esp_err_t hd44780_init(const hd44780_t *lcd)
+{
+    host_lcd_reset();
+    return ESP_OK;
+}
+
+esp_err_t hd44780_control(const hd44780_t *lcd, bool on, bool cursor, bool cursor_blink)
+{
+    bytes++;
+    return ESP_OK;
+}
+
+esp_err_t hd44780_clear(const hd44780_t *lcd)
+{
+    memset(ddram, ' ', sizeof(ddram));
+    addr = 0;
+    bytes++;
+    return ESP_OK;
+}
+
+esp_err_t hd44780_gotoxy(const hd44780_t *lcd, uint8_t col, uint8_t line)
+{
+    addr = (line_addr[line % 4] + col) & 0x7F;
+    bytes++;
+    return ESP_OK;
+}
+
+esp_err_t hd44780_putc(const hd44780_t *lcd, char c)
+{
+    ddram[addr] = (uint8_t)c;
+    addr = (addr + 1) & 0x7F;
+    bytes++;
+    return ESP_OK;
+}
+
+esp_err_t hd44780_puts(const hd44780_t *lcd, const char *s)
+{
+    while (*s) {
+        hd44780_putc(lcd, *s++);
+    }
+    return ESP_OK;
+}
+
+esp_err_t hd44780_switch_backlight(hd44780_t *lcd, bool on)
+{
+    lcd->backlight = on;
+    bytes++;
+    return ESP_OK;
+}
+
+esp_err_t hd44780_upload_character(const hd44780_t *lcd, uint8_t num, const uint8_t *data)
+{
+    // Set the CGRAM address, the rows, then the driver moves the cursor home
+    memcpy(cgram[num % 8], data, 8);
+    bytes += 1 + 8;
+    return hd44780_gotoxy(lcd, 0, 0);
+}
+
+void host_lcd_reset(void)
+{
+    memset(ddram, ' ', sizeof(ddram));
+    memset(cgram, 0, sizeof(cgram));
+    addr = 0;
+    bytes = 0;
+}
+
+uint8_t host_lcd_char(int x, int y)
+{
+    return ddram[(line_addr[y % 4] + x) & 0x7F];
+}
+
+const uint8_t *host_lcd_cgram(int slot)
+{
+    return cgram[slot % 8];
+}
+
+uint32_t host_lcd_bytes(void)
+{
+    return bytes;
+}
+
+esp_err_t pcf8574_init_desc(i2c_dev_t *dev, uint8_t addr, int port, int sda_gpio, int scl_gpio)
+{
+    dev->port = port;
+    dev->addr = addr;
+    return ESP_OK;
+}
+
+esp_err_t pcf8574_port_write(i2c_dev_t *dev, uint8_t value)
+{
+    return ESP_OK;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+/* The part of the esp-idf-lib driver the modules use, host.h reads the emulated display */
+
+typedef struct hd44780 hd44780_t;
+
+typedef esp_err_t (*hd44780_write_cb_t)(const hd44780_t *lcd, uint8_t data);
+
+typedef enum {
+    HD44780_FONT_5X8 = 0,
+    HD44780_FONT_5X10
+} hd44780_font_t;
+
+struct hd44780 {
+    hd44780_write_cb_t write_cb;
+    struct {
+        uint8_t rs, e, d4, d5, d6, d7, bl;
+    } pins;
+    hd44780_font_t font;
+    uint8_t lines;
+    bool backlight;
+};
+
+esp_err_t hd44780_init(const hd44780_t *lcd);
+esp_err_t hd44780_control(const hd44780_t *lcd, bool on, bool cursor, bool cursor_blink);
+esp_err_t hd44780_clear(const hd44780_t *lcd);
+esp_err_t hd44780_gotoxy(const hd44780_t *lcd, uint8_t col, uint8_t line);
+esp_err_t hd44780_putc(const hd44780_t *lcd, char c);
+esp_err_t hd44780_puts(const hd44780_t *lcd, const char *s);
+esp_err_t hd44780_switch_backlight(hd44780_t *lcd, bool on);
+esp_err_t hd44780_upload_character(const hd44780_t *lcd, uint8_t num, const uint8_t *data);
@@ -0,0 +1,576 @@
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "freertos/queue.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_system.h"
+#include "esp_heap_caps.h"
+#include "host.h"
+
+#define MAX_TASKS 32
+#define MAX_TAGS 16
+#define MAX_SHUTDOWN_HANDLERS 5
+
+typedef struct {
+    TaskFunction_t fn;
+    void *arg;
+} task_t;
+
+static int64_t now_us = 0;
+static int64_t wall_offset_us = 0;
+static task_t tasks[MAX_TASKS];
+static int task_count = 0;
+static uint32_t random_state = 1;
+static int wake_early_us = 0;
+static int wake_late_us = 0;
+static int core_id = 0;
+static void (*time_read_hook)(void) = NULL;
+static bool (*queue_wait_hook)(int64_t until_us) = NULL;
+static char *log_capture = NULL;
+static size_t log_capture_size = 0;
+static shutdown_handler_t shutdown_handlers[MAX_SHUTDOWN_HANDLERS];
+static int shutdown_count = 0;
+
+// Where a wait that reaches stop_us goes, set while host_run_tasks_until() runs
+static jmp_buf *stop_jump = NULL;
+static int64_t stop_us = INT64_MAX;
+
+static struct {
+    const char *tag;
+    esp_log_level_t level;
+} levels[MAX_TAGS];
+static int level_count = 0;
+static esp_log_level_t default_level = ESP_LOG_INFO;
+
+int64_t host_time_us(void)
+{
+    return now_us;
+}
+
+void host_set_time_us(int64_t us)
+{
+    now_us = us;
+}
+
+void host_advance_us(int64_t us)
+{
+    now_us += us;
+}
+
+uint32_t host_log_ms(void)
+{
+    return now_us / 1000;
+}
+
+void host_set_wall_us(int64_t wall_us)
+{
+    wall_offset_us = wall_us - now_us;
+}
+
+void host_set_wake_jitter_us(int early_us, int late_us)
+{
+    wake_early_us = early_us;
+    wake_late_us = late_us;
+}
+
+int host_run_tasks(void)
+{
+    int run = 0;
+    // A task may create tasks, they run after it
+    while (run < task_count) {
+        task_t task = tasks[run++];
+        task.fn(task.arg);
+    }
+    task_count = 0;
+    return run;
+}
+
+int host_run_tasks_until(int64_t end_us)
+{
+    jmp_buf jump;
+    int run = 0;
+    stop_us = end_us;
+    stop_jump = &jump;
+    while (run < task_count) {
+        task_t task = tasks[run++];
+        if (setjmp(jump) == 0) {
+            task.fn(task.arg);
+        }
+    }
+    stop_jump = NULL;
+    stop_us = INT64_MAX;
+    task_count = 0;
+    return run;
+}
+
+// When a wait of ticks that starts now ends
+static int64_t wake_time(TickType_t ticks)
+{
+    int64_t wake_us = ticks == portMAX_DELAY ? INT64_MAX : now_us + (int64_t)ticks * 1000000 / configTICK_RATE_HZ;
+    if (ticks > 0 && ticks != portMAX_DELAY) {
+        if (wake_early_us > 0) {
+            wake_us -= esp_random() % wake_early_us;
+        }
+        if (wake_late_us > 0) {
+            wake_us += esp_random() % wake_late_us;
+        }
+    }
+    return wake_us;
+}
+
+// Blocks the running task until wake_us, ends it when the wait reaches the end of host_run_tasks_until()
+static void wait_until(TickType_t ticks, int64_t wake_us)
+{
+    if (stop_jump != NULL && wake_us >= stop_us) {
+        now_us = stop_us;
+        longjmp(*stop_jump, 1);
+    }
+    // Nothing else runs that could end a wait without a timeout
+    if (ticks != portMAX_DELAY && wake_us > now_us) {
+        now_us = wake_us;
+    }
+}
+
+static void wait_ticks(TickType_t ticks)
+{
+    wait_until(ticks, wake_time(ticks));
+}
+
+// Blocks the running task until the queue holds an item or the wait ends
+static void wait_queue(const UBaseType_t *count, TickType_t ticks)
+{
+    int64_t wake_us = wake_time(ticks);
+    while (queue_wait_hook != NULL && ticks > 0 && *count == 0 &&
+           queue_wait_hook(wake_us < stop_us ? wake_us : stop_us)) {
+    }
+    if (*count == 0) {
+        wait_until(ticks, wake_us);
+    }
+}
+
+void host_drop_tasks(void)
+{
+    task_count = 0;
+}
+
+void host_set_core_id(int core)
+{
+    core_id = core;
+}
+
+void host_on_next_time_read(void (*hook)(void))
+{
+    time_read_hook = hook;
+}
+
+void host_on_queue_wait(bool (*hook)(int64_t until_us))
+{
+    queue_wait_hook = hook;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    void (*hook)(void) = time_read_hook;
+    if (hook != NULL) {
+        time_read_hook = NULL;
+        hook();
+    }
+    return now_us;
+}
+
+/* The wall clock runs on the virtual clock too, these take the place of the C library's */
+int gettimeofday(struct timeval *restrict tv, void *restrict tz)
+{
+    int64_t wall_us = wall_offset_us + now_us;
+    tv->tv_sec = wall_us / 1000000;
+    tv->tv_usec = wall_us % 1000000;
+    return 0;
+}
+
+int settimeofday(const struct timeval *tv, const struct timezone *tz)
+{
+    host_set_wall_us((int64_t)tv->tv_sec * 1000000 + tv->tv_usec);
+    return 0;
+}
+
+time_t time(time_t *out)
+{
+    time_t now = (wall_offset_us + now_us) / 1000000;
+    if (out != NULL) {
+        *out = now;
+    }
+    return now;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t fn, const char *name, uint32_t stack, void *arg, UBaseType_t prio,
+                       TaskHandle_t *handle)
+{
+    if (task_count == MAX_TASKS) {
+        return pdFAIL;
+    }
+    tasks[task_count++] = (task_t){fn, arg};
+    if (handle != NULL) {
+        *handle = &tasks[task_count - 1];
+    }
+    return pdPASS;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack, void *arg,
+                                   UBaseType_t prio, TaskHandle_t *handle, BaseType_t core)
+{
+    return xTaskCreate(fn, name, stack, arg, prio, handle);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    wait_ticks(ticks);
+}
+
+void vTaskDelayUntil(TickType_t *previous_wake, TickType_t period)
+{
+    *previous_wake += period;
+    TickType_t now = xTaskGetTickCount();
+    // A task that is late runs again at once
+    if ((int32_t)(*previous_wake - now) > 0) {
+        wait_ticks(*previous_wake - now);
+    }
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return now_us * configTICK_RATE_HZ / 1000000;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return (TaskHandle_t)&tasks[0];
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    return 1024;
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return core_id;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    wait_ticks(ticks);
+    return 0;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action)
+{
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks)
+{
+    wait_ticks(ticks);
+    return pdFALSE;
+}
+
+/* A semaphore is its count, taking one that is not free fails at once */
+static SemaphoreHandle_t create_semaphore(int count)
+{
+    int *sem = malloc(sizeof(int));
+    *sem = count;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return create_semaphore(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void)
+{
+    return create_semaphore(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return create_semaphore(0);
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial)
+{
+    return create_semaphore(initial);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    int *count = sem;
+    if (*count == 0) {
+        wait_ticks(ticks);
+        return pdFALSE;
+    }
+    (*count)--;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    (*(int *)sem)++;
+    return pdTRUE;
+}
+
+/* One thread holds a recursive mutex as often as it likes */
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    free(sem);
+}
+
+typedef struct {
+    char *items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+} queue_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size)
+{
+    queue_t *q = calloc(1, sizeof(queue_t));
+    q->items = malloc(length * item_size);
+    q->length = length;
+    q->item_size = item_size;
+    return q;
+}
+
+void vQueueDelete(QueueHandle_t queue)
+{
+    queue_t *q = queue;
+    free(q->items);
+    free(q);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks)
+{
+    queue_t *q = queue;
+    if (q->count == q->length) {
+        wait_ticks(ticks);
+        return pdFALSE;
+    }
+    memcpy(q->items + (q->head + q->count++) % q->length * q->item_size, item, q->item_size);
+    return pdTRUE;
+}
+
+/* Like FreeRTOS, for queues of one item */
+BaseType_t xQueueOverwrite(QueueHandle_t queue, const void *item)
+{
+    queue_t *q = queue;
+    q->count = 0;
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    queue_t *q = queue;
+    if (q->count == 0) {
+        wait_queue(&q->count, ticks);
+    }
+    if (q->count == 0) {
+        return pdFALSE;
+    }
+    memcpy(item, q->items + q->head * q->item_size, q->item_size);
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks)
+{
+    queue_t *q = queue;
+    if (xQueuePeek(queue, item, ticks) != pdTRUE) {
+        return pdFALSE;
+    }
+    q->head = (q->head + 1) % q->length;
+    q->count--;
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    return ((queue_t *)queue)->count;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    if (strcmp(tag, "*") == 0) {
+        default_level = level;
+        level_count = 0;
+        return;
+    }
+    for (int i = 0; i < level_count; i++) {
+        if (strcmp(levels[i].tag, tag) == 0) {
+            levels[i].level = level;
+            return;
+        }
+    }
+    if (level_count < MAX_TAGS) {
+        levels[level_count].tag = tag;
+        levels[level_count++].level = level;
+    }
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    esp_log_level_t allowed = default_level;
+    for (int i = 0; i < level_count; i++) {
+        if (strcmp(levels[i].tag, tag) == 0) {
+            allowed = levels[i].level;
+        }
+    }
+    if (level > allowed) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    if (log_capture != NULL) {
+        size_t len = strlen(log_capture);
+        vsnprintf(log_capture + len, log_capture_size - len, format, args);
+    } else {
+        vprintf(format, args);
+    }
+    va_end(args);
+}
+
+void host_capture_log(char *buf, size_t size)
+{
+    log_capture = buf;
+    log_capture_size = size;
+    if (buf != NULL) {
+        buf[0] = '\0';
+    }
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "ERROR";
+    }
+}
+
+uint32_t esp_get_free_heap_size(void)
+{
+    return 100000;
+}
+
+esp_err_t esp_register_shutdown_handler(shutdown_handler_t handle)
+{
+    for (int i = 0; i < shutdown_count; i++) {
+        if (shutdown_handlers[i] == handle) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    if (shutdown_count == MAX_SHUTDOWN_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    shutdown_handlers[shutdown_count++] = handle;
+    return ESP_OK;
+}
+
+int host_run_shutdown_handlers(void)
+{
+    for (int i = 0; i < shutdown_count; i++) {
+        shutdown_handlers[i]();
+    }
+    return shutdown_count;
+}
+
+void esp_restart(void)
+{
+    printf("esp_restart()\n");
+    exit(1);
+}
+
+/* xorshift32, the same numbers on every run */
+uint32_t esp_random(void)
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return random_state;
+}
+
+void esp_fill_random(void *buf, size_t len)
+{
+    uint8_t *p = buf;
+    for (size_t i = 0; i < len; i++) {
+        p[i] = esp_random();
+    }
+}
+
+void *heap_caps_malloc(size_t size, uint32_t caps)
+{
+    return malloc(size);
+}
+
+void *heap_caps_calloc(size_t n, size_t size, uint32_t caps)
+{
+    return calloc(n, size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return 100000;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return 100000;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return 65536;
+}
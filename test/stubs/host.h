@@ -0,0 +1,345 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief Host side of the IDF, FreeRTOS and ESP-ADF stand-ins of the host tests.
+ *
+ * esp_timer_get_time() and the FreeRTOS ticks run on a virtual clock that only moves
+ * when a test or a vTaskDelay() moves it, so every run is the same. Tasks are not
+ * started by xTaskCreate(), a test runs them with host_run_tasks() when it wants them
+ * to, and they run to their end on the calling thread.
+ */
+
+/**
+ * @brief Returns the virtual time in microseconds.
+ */
+int64_t host_time_us(void);
+
+/**
+ * @brief Sets the virtual time.
+ */
+void host_set_time_us(int64_t us);
+
+/**
+ * @brief Moves the virtual time forward.
+ */
+void host_advance_us(int64_t us);
+
+/**
+ * @brief Sets the wall clock, gettimeofday() and time() run on the virtual clock from it.
+ */
+void host_set_wall_us(int64_t wall_us);
+
+/**
+ * @brief Makes every wait of a tick or more end up to early_us sooner and up to late_us later.
+ *
+ * FreeRTOS ends a wait of n ticks up to a tick early, and the task may not run at once.
+ */
+void host_set_wake_jitter_us(int early_us, int late_us);
+
+/**
+ * @brief Runs the tasks created since the last call, in the order they were created.
+ *
+ * @return Number of tasks run.
+ */
+int host_run_tasks(void);
+
+/**
+ * @brief Runs the tasks like host_run_tasks(), for tasks that never end.
+ *
+ * A wait that would reach end_us sets the virtual time to end_us and ends the task there.
+ *
+ * @return Number of tasks run.
+ */
+int host_run_tasks_until(int64_t end_us);
+
+/**
+ * @brief Drops the tasks created since the last call without running them.
+ */
+void host_drop_tasks(void);
+
+/**
+ * @brief Returns the virtual time in ms, the time of the log lines.
+ */
+uint32_t host_log_ms(void);
+
+/**
+ * @brief Appends the log lines to buf instead of printing them, NULL prints them again.
+ */
+void host_capture_log(char *buf, size_t size);
+
+/**
+ * @brief Sets the core xPortGetCoreID() returns.
+ */
+void host_set_core_id(int core);
+
+/**
+ * @brief Calls hook once, the next time esp_timer_get_time() is read.
+ *
+ * Lets a test run code in the middle of a function, like a task that preempts it.
+ */
+void host_on_next_time_read(void (*hook)(void));
+
+/**
+ * @brief Calls hook while a task waits for an item of an empty queue.
+ *
+ * The hook stands for the other tasks and the interrupts: each call it may move the
+ * virtual time up to until_us and send to queues, and returns false when nothing more
+ * happens before until_us. The wait ends where the hook left the time once the queue
+ * holds an item. NULL for none.
+ */
+void host_on_queue_wait(bool (*hook)(int64_t until_us));
+
+/**
+ * @brief Calls the handlers registered with esp_register_shutdown_handler(), like esp_restart().
+ *
+ * @return Number of handlers called.
+ */
+int host_run_shutdown_handlers(void);
+
+/*
+ * Elements: audio_element_input() and audio_element_output() call the read and write
+ * callbacks set on the element, output without a write callback swallows the data.
+ */
+#include "audio_element.h"
+
+/**
+ * @brief Opens the element the first time, then calls its process function once.
+ */
+audio_element_err_t host_element_process(audio_element_handle_t el);
+
+/**
+ * @brief Calls the close function of an opened element.
+ */
+esp_err_t host_element_close(audio_element_handle_t el);
+
+/**
+ * @brief Returns the status the element reported last.
+ */
+audio_element_status_t host_element_status(audio_element_handle_t el);
+
+/**
+ * @brief Sets the state audio_element_get_state() returns.
+ */
+void host_element_set_state(audio_element_handle_t el, audio_element_state_t state);
+
+/**
+ * @brief Returns the messages waiting on an event interface.
+ */
+int host_event_count(audio_event_iface_handle_t evt);
+
+/*
+ * HD44780: every hd44780_t drives one emulated 20x4 display.
+ */
+
+/**
+ * @brief Clears the display and CGRAM and the byte count.
+ */
+void host_lcd_reset(void);
+
+/**
+ * @brief Returns the character code shown in a cell, 0 to 7 for CGRAM.
+ */
+uint8_t host_lcd_char(int x, int y);
+
+/**
+ * @brief Returns the 8 rows of a CGRAM character.
+ */
+const uint8_t *host_lcd_cgram(int slot);
+
+/**
+ * @brief Returns the bytes sent to the display since the reset, commands and data.
+ */
+uint32_t host_lcd_bytes(void);
+
+/*
+ * Ring buffers: the writer of a ring buffer runs while a reader waits for it.
+ */
+#include "ringbuf.h"
+
+/**
+ * @brief Sets a function rb_read() calls when the buffer holds less than it wants.
+ */
+void host_rb_set_writer(ringbuf_handle_t rb, void (*writer)(ringbuf_handle_t rb, void *ctx), void *ctx);
+
+/*
+ * I2S: one port whose DMA clocks out the frames written at the sample rate.
+ */
+
+/**
+ * @brief Sets the format and the DMA buffers, the DMA keeps what it holds.
+ */
+void host_i2s_set_dma(int rate, int frame_bytes, int buf_count, int buf_len);
+
+/**
+ * @brief Returns the frames clocked out, the audio heard.
+ */
+int64_t host_i2s_played(void);
+
+/**
+ * @brief Returns the frames in the DMA.
+ */
+int64_t host_i2s_queued(void);
+
+/**
+ * @brief Returns the times the DMA ran out of frames while it was started.
+ */
+uint32_t host_i2s_empties(void);
+
+/*
+ * NVS: the namespaces and keys are kept in RAM until host_nvs_reset().
+ */
+
+/**
+ * @brief Erases every namespace and the entry count.
+ */
+void host_nvs_reset(void);
+
+/**
+ * @brief Returns the 32-byte entries written to the flash pages since the reset.
+ *
+ * A page holds 126 entries, the wear of the flash follows from the pages filled.
+ */
+uint32_t host_nvs_entries(void);
+
+/**
+ * @brief Makes every write fail like a full partition while fail is set.
+ */
+void host_nvs_fail_writes(bool fail);
+
+/*
+ * HTTP client: esp_http_client connects to the urls a test serves, nothing else.
+ */
+
+/**
+ * @brief Stops serving every url and clears the counts.
+ */
+void host_http_reset(void);
+
+/**
+ * @brief Serves an url with a status and a body, the body of a redirect is its Location.
+ */
+void host_http_serve(const char *url, int status, const char *body);
+
+/**
+ * @brief Makes every read return at most bytes, 0 for as much as asked.
+ */
+void host_http_set_read_chunk(int bytes);
+
+/**
+ * @brief Returns the connections opened since the reset.
+ */
+uint32_t host_http_opens(void);
+
+/*
+ * HTTP server: esp_http_server answers the clients a test connects, without sockets.
+ */
+
+/**
+ * @brief Opens a connection, the least recently used one is closed when the server is full and purges.
+ *
+ * @return The descriptor, -1 when the server is not started or refuses it.
+ */
+int host_httpd_connect(void);
+
+/**
+ * @brief Closes a connection from the client side.
+ */
+void host_httpd_close(int fd);
+
+/**
+ * @brief Returns whether the server still holds the connection open.
+ */
+bool host_httpd_is_open(int fd);
+
+/**
+ * @brief Sends a request on a connection and copies the body of the answer to body.
+ *
+ * @return The status of the answer, 404 or 405 without a handler, -1 on a closed connection.
+ */
+int host_httpd_request(int fd, int method, const char *uri, char *body, size_t size);
+
+/**
+ * @brief Connects a WebSocket client to uri.
+ *
+ * @return The descriptor, -1 when the handler refused it.
+ */
+int host_httpd_ws_open(const char *uri);
+
+/**
+ * @brief Sends a text frame from a WebSocket client.
+ */
+esp_err_t host_httpd_ws_send(int fd, const char *text);
+
+/**
+ * @brief Copies the frames a WebSocket client got since the last call, one a line, and forgets them.
+ *
+ * @return Number of frames.
+ */
+int host_httpd_ws_read(int fd, char *buf, size_t size);
+
+/**
+ * @brief Makes every send to a client fail, like a client gone without closing.
+ */
+void host_httpd_ws_fail_sends(int fd);
+
+/**
+ * @brief Runs the work queued for the server task.
+ *
+ * @return Number of works run.
+ */
+int host_httpd_run_work(void);
+
+/**
+ * @brief Returns the works waiting for the server task.
+ */
+int host_httpd_pending_work(void);
+
+/*
+ * Sockets: lwIP connects to the servers a test runs, without a network.
+ */
+
+/**
+ * @brief Server of a port, called with no data when a client connects, then with what it sends.
+ *
+ * It answers with host_socket_reply() and host_socket_end() on fd, the connection.
+ */
+typedef void (*host_server_t)(int fd, const char *data, int len, void *ctx);
+
+/**
+ * @brief Stops serving every port, forgets the connections and clears the counts.
+ */
+void host_socket_reset(void);
+
+/**
+ * @brief Serves a port of a host, a NULL server never answers a connect.
+ */
+void host_socket_serve(const char *host, uint16_t port, host_server_t server, void *ctx);
+
+/**
+ * @brief Queues bytes for the client of a connection to read.
+ */
+void host_socket_reply(int fd, const void *data, int len);
+
+/**
+ * @brief Closes a connection from the server side, the client reads what is queued first.
+ */
+void host_socket_end(int fd);
+
+/**
+ * @brief Makes every read return at most bytes, 0 for as much as asked.
+ */
+void host_socket_set_read_chunk(int bytes);
+
+/**
+ * @brief Returns the connections servers accepted since the reset.
+ */
+uint32_t host_socket_connects(void);
+
+/**
+ * @brief Returns the sockets not closed.
+ */
+int host_socket_open_count(void);
@@ -0,0 +1,147 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "esp_http_client.h"
+#include "host.h"
+
+/*
+ * An HTTP server of fixed answers: a test sets the status and the body of every url it
+ * serves, the body of a redirect is its Location. An url that is not served cannot be
+ * connected to. Reads return at most the chunk size set, as a slow connection does.
+ */
+
+#define MAX_ROUTES 16
+#define URL_LEN 512
+
+typedef struct {
+    char url[URL_LEN];
+    int status;
+    const char *body;
+} route_t;
+
+struct esp_http_client {
+    char url[URL_LEN];
+    const route_t *route;
+    int pos;
+    int buffer_size;
+};
+
+static route_t routes[MAX_ROUTES];
+static int route_count = 0;
+static int read_chunk = 0;
+static uint32_t opens = 0;
+
+void host_http_reset(void)
+{
+    route_count = 0;
+    read_chunk = 0;
+    opens = 0;
+}
+
+void host_http_serve(const char *url, int status, const char *body)
+{
+    if (route_count < MAX_ROUTES) {
+        route_t *r = &routes[route_count++];
+        snprintf(r->url, sizeof(r->url), "%s", url);
+        r->status = status;
+        r->body = body;
+    }
+}
+
+void host_http_set_read_chunk(int bytes)
+{
+    read_chunk = bytes;
+}
+
+uint32_t host_http_opens(void)
+{
+    return opens;
+}
+
+esp_http_client_handle_t esp_http_client_init(const esp_http_client_config_t *config)
+{
+    esp_http_client_handle_t client = calloc(1, sizeof(struct esp_http_client));
+    snprintf(client->url, sizeof(client->url), "%s", config->url);
+    client->buffer_size = config->buffer_size;
+    return client;
+}
+
+esp_err_t esp_http_client_set_url(esp_http_client_handle_t client, const char *url)
+{
+    snprintf(client->url, sizeof(client->url), "%s", url);
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_open(esp_http_client_handle_t client, int write_len)
+{
+    opens++;
+    client->route = NULL;
+    client->pos = 0;
+    for (int i = 0; i < route_count; i++) {
+        if (strcmp(routes[i].url, client->url) == 0) {
+            client->route = &routes[i];
+            return ESP_OK;
+        }
+    }
+    return ESP_FAIL;
+}
+
+int esp_http_client_fetch_headers(esp_http_client_handle_t client)
+{
+    return esp_http_client_get_content_length(client);
+}
+
+int esp_http_client_get_status_code(esp_http_client_handle_t client)
+{
+    return client->route ? client->route->status : -1;
+}
+
+int esp_http_client_get_content_length(esp_http_client_handle_t client)
+{
+    return client->route && client->route->body ? (int)strlen(client->route->body) : 0;
+}
+
+int esp_http_client_read(esp_http_client_handle_t client, char *buffer, int len)
+{
+    if (client->route == NULL || client->route->body == NULL) {
+        return client->route ? 0 : -1;
+    }
+    int left = strlen(client->route->body) - client->pos;
+    len = len < left ? len : left;
+    len = read_chunk > 0 && len > read_chunk ? read_chunk : len;
+    memcpy(buffer, client->route->body + client->pos, len);
+    client->pos += len;
+    return len;
+}
+
+// The Location of the last answer, a path keeps the scheme and host
+esp_err_t esp_http_client_set_redirection(esp_http_client_handle_t client)
+{
+    const char *location = client->route ? client->route->body : NULL;
+    if (location == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (location[0] == '/') {
+        char *host = strstr(client->url, "://");
+        char *path = host ? strchr(host + 3, '/') : NULL;
+        if (path != NULL) {
+            *path = '\0';
+        }
+        char url[URL_LEN];
+        snprintf(url, sizeof(url), "%s%s", client->url, location);
+        return esp_http_client_set_url(client, url);
+    }
+    return esp_http_client_set_url(client, location);
+}
+
+esp_err_t esp_http_client_close(esp_http_client_handle_t client)
+{
+    client->route = NULL;
+    return ESP_OK;
+}
+
+esp_err_t esp_http_client_cleanup(esp_http_client_handle_t client)
+{
+    free(client);
+    return ESP_OK;
+}
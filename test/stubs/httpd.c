@@ -0,0 +1,405 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "esp_http_server.h"
+#include "host.h"
+
+/*
+ * One esp_http_server without sockets: a test connects clients and sends requests and
+ * WebSocket frames with the host_httpd_ calls, the handlers run on the calling thread
+ * like in the server task. Work queued with httpd_queue_work() and the closes triggered
+ * with httpd_sess_trigger_close() wait for host_httpd_run_work(), as they wait for the
+ * server task. The descriptors start far above those a test opens, the close() of the
+ * close function fails on them and does no harm.
+ */
+
+#define MAX_HANDLERS 16
+#define MAX_SESSIONS 16
+#define MAX_WORK 8
+#define FIRST_FD 1000
+#define URI_LEN 256
+#define RX_LEN 256
+#define FRAMES_LEN 8192
+
+typedef struct {
+    bool open;
+    bool websocket;
+    bool fail_sends;
+    uint32_t last_used;
+    const char *rx;                 /* Frame sent by the client, read by the handler */
+    char frames[FRAMES_LEN];        /* Frames sent to the client, one a line */
+    int frame_count;
+} session_t;
+
+typedef struct {
+    httpd_work_fn_t fn;
+    void *arg;
+} work_t;
+
+typedef struct {
+    int fd;
+    const char *query;
+    int status;
+    char *body;
+    size_t body_size;
+} request_t;
+
+static httpd_config_t config;
+static bool started = false;
+static httpd_uri_t handlers[MAX_HANDLERS];
+static int handler_count = 0;
+static session_t sessions[MAX_SESSIONS];
+static uint32_t activity = 0;
+static work_t work[MAX_WORK];
+static int work_count = 0;
+
+static session_t *session(int fd)
+{
+    int i = fd - FIRST_FD;
+    return i >= 0 && i < MAX_SESSIONS && sessions[i].open ? &sessions[i] : NULL;
+}
+
+static void close_session(int fd)
+{
+    session_t *s = session(fd);
+    if (s == NULL) {
+        return;
+    }
+    s->open = false;
+    if (config.close_fn != NULL) {
+        config.close_fn(&config, fd);
+    }
+}
+
+static void close_work(void *arg)
+{
+    close_session((int)(intptr_t)arg);
+}
+
+static const httpd_uri_t *find_handler(const char *uri, int method, bool *path_found)
+{
+    size_t len = strcspn(uri, "?");
+    *path_found = false;
+    for (int i = 0; i < handler_count; i++) {
+        if (strlen(handlers[i].uri) == len && strncmp(handlers[i].uri, uri, len) == 0) {
+            *path_found = true;
+            if ((int)handlers[i].method == method) {
+                return &handlers[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+// Runs a handler like the server task, a handler that fails closes the session
+static esp_err_t run_handler(const httpd_uri_t *h, int fd, int method, const char *uri, request_t *r)
+{
+    httpd_req_t req = {
+        .handle = &config,
+        .method = method,
+        .uri = uri,
+        .user_ctx = h->user_ctx,
+        .aux = r,
+    };
+    r->fd = fd;
+    r->query = strchr(uri, '?');
+    esp_err_t ret = h->handler(&req);
+    if (ret != ESP_OK) {
+        close_session(fd);
+    }
+    return ret;
+}
+
+int host_httpd_connect(void)
+{
+    if (!started) {
+        return -1;
+    }
+    int open = 0;
+    int free_slot = -1;
+    int oldest = -1;
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        if (!sessions[i].open) {
+            free_slot = free_slot < 0 ? i : free_slot;
+            continue;
+        }
+        open++;
+        if (oldest < 0 || sessions[i].last_used < sessions[oldest].last_used) {
+            oldest = i;
+        }
+    }
+    if (open >= config.max_open_sockets) {
+        if (!config.lru_purge_enable) {
+            return -1;
+        }
+        close_session(FIRST_FD + oldest);
+        free_slot = free_slot < 0 ? oldest : free_slot;
+    }
+    if (free_slot < 0) {
+        return -1;
+    }
+    session_t *s = &sessions[free_slot];
+    memset(s, 0, sizeof(*s));
+    s->open = true;
+    s->last_used = ++activity;
+    return FIRST_FD + free_slot;
+}
+
+void host_httpd_close(int fd)
+{
+    close_session(fd);
+}
+
+bool host_httpd_is_open(int fd)
+{
+    return session(fd) != NULL;
+}
+
+int host_httpd_request(int fd, int method, const char *uri, char *body, size_t size)
+{
+    session_t *s = session(fd);
+    if (s == NULL) {
+        return -1;
+    }
+    s->last_used = ++activity;
+    if (body != NULL && size > 0) {
+        body[0] = '\0';
+    }
+    request_t r = { .body = body, .body_size = size };
+    bool path_found;
+    const httpd_uri_t *h = find_handler(uri, method, &path_found);
+    if (h == NULL || h->is_websocket) {
+        return path_found ? 405 : 404;
+    }
+    run_handler(h, fd, method, uri, &r);
+    return r.status;
+}
+
+int host_httpd_ws_open(const char *uri)
+{
+    int fd = host_httpd_connect();
+    bool path_found;
+    const httpd_uri_t *h = fd < 0 ? NULL : find_handler(uri, HTTP_GET, &path_found);
+    if (h == NULL || !h->is_websocket) {
+        close_session(fd);
+        return -1;
+    }
+    // The handshake is done by the server, the handler sees it as a GET
+    session(fd)->websocket = true;
+    request_t r = { 0 };
+    return run_handler(h, fd, HTTP_GET, uri, &r) == ESP_OK ? fd : -1;
+}
+
+esp_err_t host_httpd_ws_send(int fd, const char *text)
+{
+    session_t *s = session(fd);
+    if (s == NULL || !s->websocket) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    s->last_used = ++activity;
+    s->rx = text;
+    for (int i = 0; i < handler_count; i++) {
+        if (handlers[i].is_websocket) {
+            request_t r = { 0 };
+            return run_handler(&handlers[i], fd, 0, handlers[i].uri, &r);
+        }
+    }
+    return ESP_FAIL;
+}
+
+int host_httpd_ws_read(int fd, char *buf, size_t size)
+{
+    session_t *s = &sessions[fd - FIRST_FD];
+    int count = s->frame_count;
+    snprintf(buf, size, "%s", s->frames);
+    s->frames[0] = '\0';
+    s->frame_count = 0;
+    return count;
+}
+
+void host_httpd_ws_fail_sends(int fd)
+{
+    session_t *s = session(fd);
+    if (s != NULL) {
+        s->fail_sends = true;
+    }
+}
+
+int host_httpd_run_work(void)
+{
+    int count = 0;
+    while (work_count > 0) {
+        work_t w = work[0];
+        memmove(work, work + 1, --work_count * sizeof(work[0]));
+        w.fn(w.arg);
+        count++;
+    }
+    return count;
+}
+
+int host_httpd_pending_work(void)
+{
+    return work_count;
+}
+
+esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *cfg)
+{
+    if (started) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    config = *cfg;
+    started = true;
+    handler_count = 0;
+    work_count = 0;
+    memset(sessions, 0, sizeof(sessions));
+    *handle = &config;
+    return ESP_OK;
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    for (int i = 0; i < MAX_SESSIONS; i++) {
+        close_session(FIRST_FD + i);
+    }
+    started = false;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t *uri_handler)
+{
+    if (handler_count >= config.max_uri_handlers || handler_count >= MAX_HANDLERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    for (int i = 0; i < handler_count; i++) {
+        if (strcmp(handlers[i].uri, uri_handler->uri) == 0 && handlers[i].method == uri_handler->method) {
+            return ESP_ERR_INVALID_STATE;
+        }
+    }
+    handlers[handler_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
+{
+    return ESP_OK;
+}
+
+static esp_err_t respond(httpd_req_t *req, int status, const char *buf, size_t len)
+{
+    request_t *r = req->aux;
+    session_t *s = session(r->fd);
+    if (s == NULL || s->fail_sends) {
+        return ESP_FAIL;
+    }
+    r->status = status;
+    if (r->body != NULL && r->body_size > 0) {
+        size_t n = len < r->body_size - 1 ? len : r->body_size - 1;
+        memcpy(r->body, buf, n);
+        r->body[n] = '\0';
+    }
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t *req, const char *buf, ssize_t buf_len)
+{
+    return respond(req, 200, buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : (size_t)buf_len);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t *req, httpd_err_code_t error, const char *msg)
+{
+    respond(req, error, msg, strlen(msg));
+    // The server closes the connection after an error
+    return ESP_FAIL;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t *req, char *buf, size_t buf_len)
+{
+    request_t *r = req->aux;
+    if (r->query == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    snprintf(buf, buf_len, "%s", r->query + 1);
+    return strlen(r->query + 1) < buf_len ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+}
+
+esp_err_t httpd_query_key_value(const char *qry, const char *key, char *val, size_t val_size)
+{
+    size_t key_len = strlen(key);
+    for (const char *p = qry; p != NULL && *p; p = strchr(p, '&'), p = p ? p + 1 : NULL) {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            const char *v = p + key_len + 1;
+            size_t len = strcspn(v, "&");
+            size_t n = len < val_size - 1 ? len : val_size - 1;
+            memcpy(val, v, n);
+            val[n] = '\0';
+            return len < val_size ? ESP_OK : ESP_ERR_HTTPD_RESULT_TRUNC;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+int httpd_req_to_sockfd(httpd_req_t *req)
+{
+    return ((request_t *)req->aux)->fd;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t fn, void *arg)
+{
+    if (work_count >= MAX_WORK) {
+        return ESP_FAIL;
+    }
+    work[work_count++] = (work_t){ fn, arg };
+    return ESP_OK;
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    if (session(sockfd) == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    return httpd_queue_work(handle, close_work, (void *)(intptr_t)sockfd);
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t *req, httpd_ws_frame_t *pkt, size_t max_len)
+{
+    session_t *s = session(((request_t *)req->aux)->fd);
+    if (s == NULL || s->rx == NULL) {
+        return ESP_FAIL;
+    }
+    pkt->final = true;
+    pkt->type = HTTPD_WS_TYPE_TEXT;
+    pkt->len = strlen(s->rx);
+    if (max_len == 0) {
+        return ESP_OK;
+    }
+    if (pkt->len > max_len) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    memcpy(pkt->payload, s->rx, pkt->len);
+    s->rx = NULL;
+    return ESP_OK;
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t hd, int fd, httpd_ws_frame_t *frame)
+{
+    session_t *s = session(fd);
+    if (s == NULL || !s->websocket) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (s->fail_sends) {
+        return ESP_FAIL;
+    }
+    size_t used = strlen(s->frames);
+    snprintf(s->frames + used, sizeof(s->frames) - used, "%.*s\n", (int)frame->len, (const char *)frame->payload);
+    s->frame_count++;
+    return ESP_OK;
+}
+
+httpd_ws_client_info_t httpd_ws_get_fd_info(httpd_handle_t hd, int fd)
+{
+    session_t *s = session(fd);
+    if (s == NULL) {
+        return HTTPD_WS_CLIENT_INVALID;
+    }
+    return s->websocket ? HTTPD_WS_CLIENT_WEBSOCKET : HTTPD_WS_CLIENT_HTTP;
+}
@@ -0,0 +1,107 @@
+#include "driver/i2s.h"
+#include "host.h"
+
+/*
+ * One I2S port: the DMA holds up to buf_count * buf_len frames and clocks them out at
+ * the sample rate. i2s_write() waits while every buffer is full, until one is free.
+ */
+
+static int dma_rate = 48000;
+static int dma_frame_bytes = 4;
+static int dma_buf_len = 300;
+static int64_t dma_capacity = 900;
+
+static bool running = true;
+static int64_t queued = 0;          /* Frames in the DMA */
+static int64_t played = 0;          /* Frames clocked out since the reset */
+static uint32_t empties = 0;
+static int64_t updated_us = 0;
+
+// Clocks out what the time since the last update allows
+static void update(void)
+{
+    int64_t now = host_time_us();
+    if (running) {
+        int64_t due = now * dma_rate / 1000000 - updated_us * dma_rate / 1000000;
+        if (queued > 0 && due > queued) {
+            empties++;
+        }
+        due = due < queued ? due : queued;
+        queued -= due;
+        played += due;
+    }
+    updated_us = now;
+}
+
+esp_err_t i2s_write(i2s_port_t i2s_num, const void *src, size_t size, size_t *bytes_written, TickType_t ticks_to_wait)
+{
+    int64_t frames = size / dma_frame_bytes;
+    int64_t waited_us = 0;
+    *bytes_written = 0;
+    int64_t timeout_us = ticks_to_wait == portMAX_DELAY ? INT64_MAX : (int64_t)ticks_to_wait * 1000000 / configTICK_RATE_HZ;
+    update();
+    while (frames > 0) {
+        int64_t space = dma_capacity - queued;
+        space = space < frames ? space : frames;
+        queued += space;
+        frames -= space;
+        *bytes_written += space * dma_frame_bytes;
+        if (frames == 0 || !running || waited_us >= timeout_us) {
+            break;
+        }
+        // Until the DMA is done with one buffer
+        int64_t wait_us = ((int64_t)dma_buf_len * 1000000 + dma_rate - 1) / dma_rate;
+        host_advance_us(wait_us);
+        waited_us += wait_us;
+        update();
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2s_start(i2s_port_t i2s_num)
+{
+    update();
+    running = true;
+    return ESP_OK;
+}
+
+esp_err_t i2s_stop(i2s_port_t i2s_num)
+{
+    update();
+    running = false;
+    return ESP_OK;
+}
+
+esp_err_t i2s_zero_dma_buffer(i2s_port_t i2s_num)
+{
+    update();
+    queued = 0;
+    return ESP_OK;
+}
+
+void host_i2s_set_dma(int rate, int frame_bytes, int buf_count, int buf_len)
+{
+    dma_rate = rate;
+    dma_frame_bytes = frame_bytes;
+    dma_buf_len = buf_len;
+    dma_capacity = (int64_t)buf_count * buf_len;
+    update();
+}
+
+int64_t host_i2s_played(void)
+{
+    update();
+    return played;
+}
+
+int64_t host_i2s_queued(void)
+{
+    update();
+    return queued;
+}
+
+uint32_t host_i2s_empties(void)
+{
+    update();
+    return empties;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "periph_service.h"
+
+typedef enum {
+    INPUT_KEY_USER_ID_UNKNOWN = -1,
+    INPUT_KEY_USER_ID_REC = 0x01,
+    INPUT_KEY_USER_ID_SET = 0x02,
+    INPUT_KEY_USER_ID_PLAY = 0x03,
+    INPUT_KEY_USER_ID_MODE = 0x04,
+    INPUT_KEY_USER_ID_VOLDOWN = 0x05,
+    INPUT_KEY_USER_ID_VOLUP = 0x06,
+    INPUT_KEY_USER_ID_MUTE = 0x07,
+} input_key_user_id_t;
+
+typedef enum {
+    INPUT_KEY_SERVICE_ACTION_UNKNOWN = 0,
+    INPUT_KEY_SERVICE_ACTION_CLICK,
+    INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE,
+    INPUT_KEY_SERVICE_ACTION_PRESS,
+    INPUT_KEY_SERVICE_ACTION_PRESS_RELEASE,
+} input_key_service_action_id_t;
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <netdb.h>
+
+/* Name lookup of the hosts sockets.c serves, see host.h */
+
+int lwip_getaddrinfo(const char *nodename, const char *servname, const struct addrinfo *hints,
+                     struct addrinfo **res);
+void lwip_freeaddrinfo(struct addrinfo *ai);
+
+#define getaddrinfo(nodename, servname, hints, res) lwip_getaddrinfo(nodename, servname, hints, res)
+#define freeaddrinfo(ai) lwip_freeaddrinfo(ai)
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+
+/*
+ * The part of the lwIP sockets lean_http.c uses, mapped like LWIP_POSIX_SOCKETS_IO_NAMES
+ * does to the connections of sockets.c, see host.h. The types and constants are the
+ * system ones.
+ */
+
+int lwip_socket(int domain, int type, int protocol);
+int lwip_connect(int s, const struct sockaddr *name, socklen_t namelen);
+int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout);
+int lwip_getsockopt(int s, int level, int optname, void *optval, socklen_t *optlen);
+int lwip_setsockopt(int s, int level, int optname, const void *optval, socklen_t optlen);
+ssize_t lwip_send(int s, const void *dataptr, size_t size, int flags);
+ssize_t lwip_recv(int s, void *mem, size_t len, int flags);
+int lwip_fcntl(int s, int cmd, int val);
+int lwip_close(int s);
+
+#define socket(domain, type, protocol) lwip_socket(domain, type, protocol)
+#define connect(s, name, namelen) lwip_connect(s, name, namelen)
+#define select(maxfdp1, readset, writeset, exceptset, timeout) \
+    lwip_select(maxfdp1, readset, writeset, exceptset, timeout)
+#define getsockopt(s, level, optname, optval, optlen) lwip_getsockopt(s, level, optname, optval, optlen)
+#define setsockopt(s, level, optname, optval, optlen) lwip_setsockopt(s, level, optname, optval, optlen)
+#define send(s, dataptr, size, flags) lwip_send(s, dataptr, size, flags)
+#define recv(s, mem, len, flags) lwip_recv(s, mem, len, flags)
+#define fcntl(s, cmd, val) lwip_fcntl(s, cmd, val)
+#define close(s) lwip_close(s)
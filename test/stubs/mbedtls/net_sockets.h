@@ -0,0 +1,7 @@
+#pragma once
+
+/* The errors of the network callbacks lean_http.c returns, mbedTLS 2.28 values */
+
+#define MBEDTLS_ERR_NET_RECV_FAILED -0x004C
+#define MBEDTLS_ERR_NET_SEND_FAILED -0x004E
+#define MBEDTLS_ERR_NET_CONN_RESET -0x0050
@@ -0,0 +1,250 @@
+#include <stdbool.h>
+#include <string.h>
+#include "nvs_flash.h"
+#include "host.h"
+
+/*
+ * NVS in RAM. Every write is counted in the 32-byte entries the IDF would append to its
+ * pages: one for an integer, and for a blob its index, its data header and the data
+ * spans. Like the IDF, a write of the value already stored costs nothing.
+ */
+
+#define MAX_NAMESPACES 8
+#define MAX_ITEMS 32
+#define KEY_LEN 16
+#define MAX_BLOB 512
+#define ENTRY_SIZE 32
+
+typedef enum {
+    TYPE_U8,
+    TYPE_I16,
+    TYPE_I32,
+    TYPE_BLOB,
+} item_type_t;
+
+typedef struct {
+    int ns;
+    char key[KEY_LEN];
+    item_type_t type;
+    size_t len;
+    uint8_t data[MAX_BLOB];
+} item_t;
+
+static char namespaces[MAX_NAMESPACES][KEY_LEN];
+static int namespace_count = 0;
+static item_t items[MAX_ITEMS];
+static int item_count = 0;
+static bool initialized = false;
+static bool fail_writes = false;
+static uint32_t entries = 0;
+
+void host_nvs_reset(void)
+{
+    namespace_count = 0;
+    item_count = 0;
+    entries = 0;
+    fail_writes = false;
+}
+
+uint32_t host_nvs_entries(void)
+{
+    return entries;
+}
+
+void host_nvs_fail_writes(bool fail)
+{
+    fail_writes = fail;
+}
+
+esp_err_t nvs_flash_init(void)
+{
+    initialized = true;
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    host_nvs_reset();
+    return ESP_OK;
+}
+
+// A handle is the namespace index plus one, with the read-only flag above it
+#define HANDLE_READONLY 0x100
+
+esp_err_t nvs_open(const char *name, nvs_open_mode_t open_mode, nvs_handle_t *out_handle)
+{
+    if (!initialized) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+    if (strlen(name) >= KEY_LEN) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int ns = 0;
+    while (ns < namespace_count && strcmp(namespaces[ns], name) != 0) {
+        ns++;
+    }
+    if (ns == namespace_count) {
+        if (open_mode == NVS_READONLY) {
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        if (namespace_count == MAX_NAMESPACES) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        strcpy(namespaces[namespace_count++], name);
+        entries++;
+    }
+    *out_handle = (ns + 1) | (open_mode == NVS_READONLY ? HANDLE_READONLY : 0);
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+static int handle_ns(nvs_handle_t handle)
+{
+    int ns = (int)(handle & ~HANDLE_READONLY) - 1;
+    return ns >= 0 && ns < namespace_count ? ns : -1;
+}
+
+static item_t *find(int ns, const char *key)
+{
+    for (int i = 0; i < item_count; i++) {
+        if (items[i].ns == ns && strcmp(items[i].key, key) == 0) {
+            return &items[i];
+        }
+    }
+    return NULL;
+}
+
+static esp_err_t set_item(nvs_handle_t handle, const char *key, item_type_t type, const void *value, size_t len)
+{
+    int ns = handle_ns(handle);
+    if (ns < 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (handle & HANDLE_READONLY) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (strlen(key) >= KEY_LEN || len > MAX_BLOB) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (fail_writes) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    item_t *item = find(ns, key);
+    if (item != NULL && item->type == type && item->len == len && memcmp(item->data, value, len) == 0) {
+        return ESP_OK;
+    }
+    if (item == NULL) {
+        if (item_count == MAX_ITEMS) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+        item = &items[item_count++];
+        item->ns = ns;
+        strcpy(item->key, key);
+    }
+    item->type = type;
+    item->len = len;
+    memcpy(item->data, value, len);
+    entries += type == TYPE_BLOB ? 2 + (len + ENTRY_SIZE - 1) / ENTRY_SIZE : 1;
+    return ESP_OK;
+}
+
+static esp_err_t get_item(nvs_handle_t handle, const char *key, item_type_t type, void *out, size_t len)
+{
+    int ns = handle_ns(handle);
+    if (ns < 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    item_t *item = find(ns, key);
+    if (item == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (item->type != type) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    memcpy(out, item->data, len);
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    return handle_ns(handle) < 0 ? ESP_ERR_NVS_INVALID_HANDLE : ESP_OK;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char *key)
+{
+    int ns = handle_ns(handle);
+    if (ns < 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    item_t *item = find(ns, key);
+    if (item == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    *item = items[--item_count];
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_u8(nvs_handle_t handle, const char *key, uint8_t value)
+{
+    return set_item(handle, key, TYPE_U8, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u8(nvs_handle_t handle, const char *key, uint8_t *out_value)
+{
+    return get_item(handle, key, TYPE_U8, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_i16(nvs_handle_t handle, const char *key, int16_t value)
+{
+    return set_item(handle, key, TYPE_I16, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i16(nvs_handle_t handle, const char *key, int16_t *out_value)
+{
+    return get_item(handle, key, TYPE_I16, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_i32(nvs_handle_t handle, const char *key, int32_t value)
+{
+    return set_item(handle, key, TYPE_I32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_i32(nvs_handle_t handle, const char *key, int32_t *out_value)
+{
+    return get_item(handle, key, TYPE_I32, out_value, sizeof(*out_value));
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char *key, const void *value, size_t length)
+{
+    return set_item(handle, key, TYPE_BLOB, value, length);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char *key, void *out_value, size_t *length)
+{
+    int ns = handle_ns(handle);
+    if (ns < 0) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    item_t *item = find(ns, key);
+    if (item == NULL) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    if (item->type != TYPE_BLOB) {
+        return ESP_ERR_NVS_TYPE_MISMATCH;
+    }
+    // Without a buffer only the length is returned, a buffer too short gets nothing
+    if (out_value == NULL) {
+        *length = item->len;
+        return ESP_OK;
+    }
+    if (*length < item->len) {
+        *length = item->len;
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+    memcpy(out_value, item->data, item->len);
+    *length = item->len;
+    return ESP_OK;
+}
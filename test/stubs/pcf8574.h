@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+/* The part of the esp-idf-lib driver lcd.c uses, the display is emulated above it by hd44780.c */
+
+typedef struct {
+    int port;
+    uint8_t addr;
+} i2c_dev_t;
+
+esp_err_t pcf8574_init_desc(i2c_dev_t *dev, uint8_t addr, int port, int sda_gpio, int scl_gpio);
+esp_err_t pcf8574_port_write(i2c_dev_t *dev, uint8_t value);
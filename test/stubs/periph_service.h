@@ -0,0 +1,17 @@
+#pragma once
+
+#include "esp_err.h"
+
+typedef struct periph_service_impl *periph_service_handle_t;
+
+typedef struct {
+    int type;
+    void *source;
+    void *data;
+    int len;
+} periph_service_event_t;
+
+typedef esp_err_t (*periph_service_cb)(periph_service_handle_t handle, periph_service_event_t *evt, void *ctx);
+
+esp_err_t periph_service_set_callback(periph_service_handle_t handle, periph_service_cb cb, void *ctx);
+esp_err_t periph_service_destroy(periph_service_handle_t handle);
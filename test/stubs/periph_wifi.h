@@ -0,0 +1,3 @@
+#pragma once
+
+/* Only included by the headers of the modules, the host tests use none of it */
@@ -0,0 +1,96 @@
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/task.h"
+#include "ringbuf.h"
+#include "host.h"
+
+struct ringbuf {
+    char *data;
+    int size;
+    int read_pos;
+    int filled;
+    void (*writer)(ringbuf_handle_t rb, void *ctx);
+    void *writer_ctx;
+};
+
+ringbuf_handle_t rb_create(int block_size, int n_blocks)
+{
+    ringbuf_handle_t rb = calloc(1, sizeof(struct ringbuf));
+    rb->size = block_size * n_blocks;
+    rb->data = malloc(rb->size);
+    return rb;
+}
+
+esp_err_t rb_destroy(ringbuf_handle_t rb)
+{
+    free(rb->data);
+    free(rb);
+    return ESP_OK;
+}
+
+esp_err_t rb_reset(ringbuf_handle_t rb)
+{
+    rb->read_pos = 0;
+    rb->filled = 0;
+    return ESP_OK;
+}
+
+static int copy_out(ringbuf_handle_t rb, char *buf, int len)
+{
+    len = len < rb->filled ? len : rb->filled;
+    for (int i = 0; i < len; i++) {
+        buf[i] = rb->data[(rb->read_pos + i) % rb->size];
+    }
+    rb->read_pos = (rb->read_pos + len) % rb->size;
+    rb->filled -= len;
+    return len;
+}
+
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait)
+{
+    int r = copy_out(rb, buf, len);
+    if (r < len && ticks_to_wait > 0 && rb->writer != NULL) {
+        // The writer runs while the reader waits
+        rb->writer(rb, rb->writer_ctx);
+        r += copy_out(rb, buf + r, len - r);
+    }
+    if (r < len) {
+        vTaskDelay(ticks_to_wait);
+    }
+    return r > 0 ? r : RB_TIMEOUT;
+}
+
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait)
+{
+    int w = rb->size - rb->filled;
+    w = len < w ? len : w;
+    for (int i = 0; i < w; i++) {
+        rb->data[(rb->read_pos + rb->filled + i) % rb->size] = buf[i];
+    }
+    rb->filled += w;
+    if (w < len) {
+        vTaskDelay(ticks_to_wait);
+    }
+    return w > 0 ? w : RB_TIMEOUT;
+}
+
+int rb_bytes_filled(ringbuf_handle_t rb)
+{
+    return rb->filled;
+}
+
+int rb_bytes_available(ringbuf_handle_t rb)
+{
+    return rb->size - rb->filled;
+}
+
+int rb_get_size(ringbuf_handle_t rb)
+{
+    return rb->size;
+}
+
+void host_rb_set_writer(ringbuf_handle_t rb, void (*writer)(ringbuf_handle_t rb, void *ctx), void *ctx)
+{
+    rb->writer = writer;
+    rb->writer_ctx = ctx;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef struct ringbuf *ringbuf_handle_t;
+
+#define RB_OK 0
+#define RB_FAIL -1
+#define RB_DONE -2
+#define RB_ABORT -3
+#define RB_TIMEOUT -4
+
+/* Byte rings, a read or write that does not fit waits its timeout on the virtual clock */
+ringbuf_handle_t rb_create(int block_size, int n_blocks);
+esp_err_t rb_destroy(ringbuf_handle_t rb);
+esp_err_t rb_reset(ringbuf_handle_t rb);
+int rb_read(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait);
+int rb_write(ringbuf_handle_t rb, char *buf, int len, TickType_t ticks_to_wait);
+int rb_bytes_filled(ringbuf_handle_t rb);
+int rb_bytes_available(ringbuf_handle_t rb);
+int rb_get_size(ringbuf_handle_t rb);
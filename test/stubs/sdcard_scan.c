@@ -0,0 +1,57 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "sdcard_scan.h"
+
+/*
+ * Walks a directory of the host like ADF does the SD card: the files with one of the
+ * extensions are reported as "file:/" and their path, directories are entered up to
+ * depth levels down. Unlike FATFS the entries come in name order, so every run is the
+ * same.
+ */
+
+static int by_name(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+static void scan_dir(sdcard_scan_cb_t cb, const char *path, int level, int depth, const char *file_extension[],
+                     int filter_num, void *user_data)
+{
+    struct dirent **entries;
+    int n = scandir(path, &entries, NULL, by_name);
+    for (int i = 0; i < n; i++) {
+        struct dirent *entry = entries[i];
+        char url[512];
+        if (entry->d_name[0] == '.') {
+            // Hidden, and . and ..
+        } else if (entry->d_type == DT_DIR) {
+            if (level < depth) {
+                snprintf(url, sizeof(url), "%s/%s", path, entry->d_name);
+                scan_dir(cb, url, level + 1, depth, file_extension, filter_num, user_data);
+            }
+        } else {
+            const char *ext = strrchr(entry->d_name, '.');
+            for (int f = 0; ext != NULL && f < filter_num; f++) {
+                if (strcasecmp(ext + 1, file_extension[f]) == 0) {
+                    snprintf(url, sizeof(url), "file:/%s/%s", path, entry->d_name);
+                    cb(user_data, url);
+                    break;
+                }
+            }
+        }
+        free(entry);
+    }
+    if (n >= 0) {
+        free(entries);
+    }
+}
+
+esp_err_t sdcard_scan(sdcard_scan_cb_t cb, const char *path, int depth, const char *file_extension[], int filter_num,
+                      void *user_data)
+{
+    scan_dir(cb, path, 0, depth, file_extension, filter_num, user_data);
+    return ESP_OK;
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+/* The Kconfig defaults the modules are tested with, a test target overrides them with -D */
+
+#ifndef CONFIG_FREERTOS_HZ
+#define CONFIG_FREERTOS_HZ 100
+#endif
+#ifndef CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ 160
+#endif
+#ifndef CONFIG_SPEAKER_TRACE_BUFFER_SIZE
+#define CONFIG_SPEAKER_TRACE_BUFFER_SIZE 16384
+#endif
+#ifndef CONFIG_RADIO_TIMESHIFT_RAM_SIZE
+#define CONFIG_RADIO_TIMESHIFT_RAM_SIZE 32768
+#endif
+#ifndef CONFIG_RADIO_TLS_MAX_FRAGMENT
+#define CONFIG_RADIO_TLS_MAX_FRAGMENT 4096
+#endif
+#ifndef CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN
+#define CONFIG_MBEDTLS_SSL_IN_CONTENT_LEN 16384
+#endif
+#ifndef CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN
+#define CONFIG_MBEDTLS_SSL_OUT_CONTENT_LEN 4096
+#endif
+#ifndef CONFIG_SPEAKER_GROUP_DELAY_MS
+#define CONFIG_SPEAKER_GROUP_DELAY_MS 100
+#endif
+#ifndef CONFIG_SPEAKER_MODE_MANAGER_STACK_SIZE
+#define CONFIG_SPEAKER_MODE_MANAGER_STACK_SIZE 8192
+#endif
@@ -0,0 +1,313 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lwip/sockets.h"
+#include "lwip/netdb.h"
+#include "host.h"
+
+/*
+ * TCP connections to the servers a test runs, without a network: a server is a function
+ * called with what the client sends, which queues its answer for the reads. A name
+ * resolves when one of its ports is served, to 10.0.0.x. A connect to a port that is not
+ * served is refused, one to a port served by NULL never completes. A read of an empty
+ * connection waits for SO_RCVTIMEO of virtual time and times out, a select() for a
+ * connect waits for its timeout. The descriptors start above those a test opens and stay
+ * below FD_SETSIZE.
+ */
+
+#define MAX_PORTS 32
+#define MAX_NAMES 32
+#define MAX_SOCKETS 8
+#define FIRST_FD 200
+#define NAME_LEN 64
+#define RX_LEN 32768
+
+typedef struct {
+    int name;                       /* Index in names */
+    uint16_t port;
+    host_server_t server;
+    void *ctx;
+} port_t;
+
+typedef struct {
+    bool used;
+    int flags;                      /* Of F_SETFL */
+    int error;                      /* SO_ERROR of a connect without blocking */
+    int64_t timeout_us;             /* SO_RCVTIMEO */
+    const port_t *port;             /* Connected to, NULL before */
+    bool connecting;                /* To a server that does not answer */
+    bool ended;                     /* The server closed after its answer */
+    char rx[RX_LEN];                /* Answered, not read yet */
+    int rx_pos;
+    int rx_len;
+} socket_t;
+
+typedef struct {
+    struct addrinfo ai;
+    struct sockaddr_in addr;
+} addrinfo_t;
+
+static char names[MAX_NAMES][NAME_LEN];
+static int name_count = 0;
+static port_t ports[MAX_PORTS];
+static int port_count = 0;
+static socket_t sockets[MAX_SOCKETS];
+static int read_chunk = 0;
+static uint32_t connects = 0;
+
+static socket_t *find_socket(int s)
+{
+    if (s < FIRST_FD || s >= FIRST_FD + MAX_SOCKETS || !sockets[s - FIRST_FD].used) {
+        return NULL;
+    }
+    return &sockets[s - FIRST_FD];
+}
+
+static int find_name(const char *name)
+{
+    for (int i = 0; i < name_count; i++) {
+        if (strcmp(names[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int fail(int error)
+{
+    errno = error;
+    return -1;
+}
+
+void host_socket_reset(void)
+{
+    name_count = 0;
+    port_count = 0;
+    memset(sockets, 0, sizeof(sockets));
+    read_chunk = 0;
+    connects = 0;
+}
+
+void host_socket_serve(const char *host, uint16_t port, host_server_t server, void *ctx)
+{
+    int name = find_name(host);
+    if (name < 0 && name_count < MAX_NAMES) {
+        name = name_count++;
+        snprintf(names[name], NAME_LEN, "%s", host);
+    }
+    if (name >= 0 && port_count < MAX_PORTS) {
+        ports[port_count++] = (port_t){ .name = name, .port = port, .server = server, .ctx = ctx };
+    }
+}
+
+void host_socket_reply(int fd, const void *data, int len)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return;
+    }
+    memmove(s->rx, s->rx + s->rx_pos, s->rx_len - s->rx_pos);
+    s->rx_len -= s->rx_pos;
+    s->rx_pos = 0;
+    len = len < RX_LEN - s->rx_len ? len : RX_LEN - s->rx_len;
+    memcpy(s->rx + s->rx_len, data, len);
+    s->rx_len += len;
+}
+
+void host_socket_end(int fd)
+{
+    socket_t *s = find_socket(fd);
+    if (s != NULL) {
+        s->ended = true;
+    }
+}
+
+void host_socket_set_read_chunk(int bytes)
+{
+    read_chunk = bytes;
+}
+
+uint32_t host_socket_connects(void)
+{
+    return connects;
+}
+
+int host_socket_open_count(void)
+{
+    int count = 0;
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+        count += sockets[i].used;
+    }
+    return count;
+}
+
+int lwip_getaddrinfo(const char *nodename, const char *servname, const struct addrinfo *hints,
+                     struct addrinfo **res)
+{
+    int name = find_name(nodename);
+    if (name < 0) {
+        return EAI_NONAME;
+    }
+    addrinfo_t *a = calloc(1, sizeof(addrinfo_t));
+    a->addr.sin_family = AF_INET;
+    a->addr.sin_port = htons(atoi(servname));
+    a->addr.sin_addr.s_addr = htonl(0x0a000001 + name);
+    a->ai.ai_family = AF_INET;
+    a->ai.ai_socktype = SOCK_STREAM;
+    a->ai.ai_addr = (struct sockaddr *)&a->addr;
+    a->ai.ai_addrlen = sizeof(a->addr);
+    *res = &a->ai;
+    return 0;
+}
+
+void lwip_freeaddrinfo(struct addrinfo *ai)
+{
+    free(ai);
+}
+
+int lwip_socket(int domain, int type, int protocol)
+{
+    for (int i = 0; i < MAX_SOCKETS; i++) {
+        if (!sockets[i].used) {
+            memset(&sockets[i], 0, sizeof(sockets[i]));
+            sockets[i].used = true;
+            return FIRST_FD + i;
+        }
+    }
+    return fail(ENFILE);
+}
+
+int lwip_connect(int fd, const struct sockaddr *name, socklen_t namelen)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return fail(EBADF);
+    }
+    const struct sockaddr_in *addr = (const struct sockaddr_in *)name;
+    int host = ntohl(addr->sin_addr.s_addr) - 0x0a000001;
+    const port_t *port = NULL;
+    for (int i = 0; i < port_count && port == NULL; i++) {
+        if (ports[i].name == host && ports[i].port == ntohs(addr->sin_port)) {
+            port = &ports[i];
+        }
+    }
+    bool blocking = !(s->flags & O_NONBLOCK);
+    if (port == NULL || port->server == NULL) {
+        s->error = port == NULL ? ECONNREFUSED : ETIMEDOUT;
+        s->connecting = port != NULL;
+        return fail(blocking ? s->error : EINPROGRESS);
+    }
+    s->port = port;
+    connects++;
+    port->server(fd, NULL, 0, port->ctx);
+    return blocking ? 0 : fail(EINPROGRESS);
+}
+
+/* Only waits for connects, in the write set */
+int lwip_select(int maxfdp1, fd_set *readset, fd_set *writeset, fd_set *exceptset, struct timeval *timeout)
+{
+    int ready = 0;
+    for (int fd = FIRST_FD; fd < maxfdp1 && writeset != NULL; fd++) {
+        socket_t *s = find_socket(fd);
+        if (s != NULL && FD_ISSET(fd, writeset)) {
+            if (s->connecting) {
+                FD_CLR(fd, writeset);
+            } else {
+                ready++;
+            }
+        }
+    }
+    if (ready == 0 && timeout != NULL) {
+        host_advance_us(timeout->tv_sec * 1000000LL + timeout->tv_usec);
+    }
+    return ready;
+}
+
+int lwip_getsockopt(int fd, int level, int optname, void *optval, socklen_t *optlen)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return fail(EBADF);
+    }
+    if (level != SOL_SOCKET || optname != SO_ERROR || *optlen < sizeof(int)) {
+        return fail(ENOPROTOOPT);
+    }
+    *(int *)optval = s->error;
+    s->error = 0;
+    return 0;
+}
+
+int lwip_setsockopt(int fd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return fail(EBADF);
+    }
+    if (level == SOL_SOCKET && optname == SO_RCVTIMEO && optlen >= sizeof(struct timeval)) {
+        const struct timeval *tv = optval;
+        s->timeout_us = tv->tv_sec * 1000000LL + tv->tv_usec;
+    }
+    return 0;
+}
+
+ssize_t lwip_send(int fd, const void *dataptr, size_t size, int flags)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL || s->port == NULL) {
+        return fail(s == NULL ? EBADF : ENOTCONN);
+    }
+    if (!s->ended) {
+        s->port->server(fd, dataptr, size, s->port->ctx);
+    }
+    return size;
+}
+
+ssize_t lwip_recv(int fd, void *mem, size_t len, int flags)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL || s->port == NULL) {
+        return fail(s == NULL ? EBADF : ENOTCONN);
+    }
+    int n = s->rx_len - s->rx_pos;
+    if (n == 0) {
+        if (s->ended) {
+            return 0;
+        }
+        if (!(s->flags & O_NONBLOCK)) {
+            host_advance_us(s->timeout_us);
+        }
+        return fail(EAGAIN);
+    }
+    n = n < (int)len ? n : (int)len;
+    n = read_chunk > 0 && n > read_chunk ? read_chunk : n;
+    memcpy(mem, s->rx + s->rx_pos, n);
+    s->rx_pos += n;
+    return n;
+}
+
+int lwip_fcntl(int fd, int cmd, int val)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return fail(EBADF);
+    }
+    if (cmd == F_GETFL) {
+        return s->flags;
+    }
+    if (cmd == F_SETFL) {
+        s->flags = val;
+        return 0;
+    }
+    return fail(EINVAL);
+}
+
+int lwip_close(int fd)
+{
+    socket_t *s = find_socket(fd);
+    if (s == NULL) {
+        return fail(EBADF);
+    }
+    s->used = false;
+    return 0;
+}
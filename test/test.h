@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdio.h>
+
+/**
+ * @brief Checks of the host tests, a failed check is printed and the test goes on.
+ *
+ * main() ends with return test_end(), which fails the test when a check failed.
+ */
+
+extern int test_failures;
+
+#define CHECK(cond, ...)                                        \
+    do {                                                        \
+        if (!(cond)) {                                          \
+            test_failures++;                                    \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #cond); \
+            printf(__VA_ARGS__);                                \
+            printf("\n");                                       \
+        }                                                       \
+    } while (0)
+
+static inline int test_end(void)
+{
+    printf(test_failures == 0 ? "ok\n" : "%d checks failed\n", test_failures);
+    return test_failures == 0 ? 0 : 1;
+}
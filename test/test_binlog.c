@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "binlog.h"
+
+/*
+ * Writes records on both cores, flushes them into a captured log and compares the lines
+ * with what ESP_LOGx would print. A writer that preempts another in the middle of its
+ * record, a ring that wraps before the drain task runs and the level filter are covered.
+ */
+
+#define TAG "TEST"
+
+static char captured[16384];
+
+static void test_format(void)
+{
+    host_set_time_us(123456);
+    BINLOGW(TAG, "volume %d %%", 50);
+    BINLOGI(TAG, "%d frames in %u ms", -7, 3000000000u);
+    BINLOGE(TAG, "%s: %c%c 0x%08x", "mode", 'o', 'k', 0xDEADBEEF);
+    BINLOGD(TAG, "not shown");
+    BINLOGI(TAG, "no arguments");
+    host_capture_log(captured, sizeof(captured));
+    CHECK(binlog_flush() == 5, "5 records");
+    host_capture_log(NULL, 0);
+    CHECK(strcmp(captured, "W (123) TEST: volume 50 %\n"
+                           "I (123) TEST: -7 frames in 3000000000 ms\n"
+                           "E (123) TEST: mode: ok 0xdeadbeef\n"
+                           "I (123) TEST: no arguments\n") == 0,
+          "printed like ESP_LOGx:\n%s", captured);
+    CHECK(binlog_flush() == 0, "the rings are empty");
+
+    esp_log_level_set(TAG, ESP_LOG_WARN);
+    BINLOGI(TAG, "filtered");
+    BINLOGW(TAG, "warned");
+    host_capture_log(captured, sizeof(captured));
+    binlog_flush();
+    host_capture_log(NULL, 0);
+    esp_log_level_set(TAG, ESP_LOG_INFO);
+    CHECK(strcmp(captured, "W (123) TEST: warned\n") == 0, "the level of the tag applies:\n%s", captured);
+}
+
+/* Each core has its own ring, the records of a core come out in order */
+static void test_cores(void)
+{
+    for (int i = 0; i < 40; i++) {
+        host_set_core_id(i % 3 == 0);
+        BINLOGI(TAG, "%d on core %d", i, i % 3 == 0);
+    }
+    host_set_core_id(0);
+    host_capture_log(captured, sizeof(captured));
+    CHECK(binlog_flush() == 40, "40 records");
+    host_capture_log(NULL, 0);
+
+    int last[2] = {-1, -1};
+    int lines = 0;
+    int core_before = 0;
+    bool order = true;
+    for (char *line = strtok(captured, "\n"); line; line = strtok(NULL, "\n")) {
+        int n, core;
+        if (sscanf(line, "I (%*u) TEST: %d on core %d", &n, &core) != 2) {
+            continue;
+        }
+        // Core 0 is drained before core 1
+        order &= n > last[core] && core >= core_before;
+        last[core] = n;
+        core_before = core;
+        lines++;
+    }
+    CHECK(lines == 40 && order, "%d lines in order", lines);
+}
+
+static int preempted_printed = -1;
+
+/* Runs while the first record has its slot but is not published */
+static void preempt(void)
+{
+    BINLOGI(TAG, "second");
+    // The drain task on the other core must not print the second before the first
+    preempted_printed = binlog_flush();
+}
+
+static void test_preempted(void)
+{
+    host_on_next_time_read(preempt);
+    BINLOGI(TAG, "first");
+    CHECK(preempted_printed == 0, "%d records printed while the first was written", preempted_printed);
+    host_capture_log(captured, sizeof(captured));
+    CHECK(binlog_flush() == 2, "both printed after");
+    host_capture_log(NULL, 0);
+    CHECK(strcmp(captured, "I (123) TEST: first\nI (123) TEST: second\n") == 0, "in the order of the slots:\n%s",
+          captured);
+}
+
+/* The writers lap the drain task, the oldest records are dropped and reported */
+static void test_wrap(void)
+{
+    uint32_t dropped = binlog_get_dropped();
+    for (int i = 0; i < 200; i++) {
+        BINLOGI(TAG, "n=%d", i);
+    }
+    CHECK(binlog_init(1) == ESP_OK, "drain task started");
+    host_set_time_us(0);
+    host_capture_log(captured, sizeof(captured));
+    host_run_tasks_until(BINLOG_DRAIN_MS * 1000 + 500);
+    host_capture_log(NULL, 0);
+
+    CHECK(binlog_get_dropped() - dropped == 200 - BINLOG_RING_SIZE, "%u dropped",
+          (unsigned)(binlog_get_dropped() - dropped));
+    char expect[64];
+    snprintf(expect, sizeof(expect), "I (123) TEST: n=%d\n", 200 - BINLOG_RING_SIZE);
+    CHECK(strncmp(captured, expect, strlen(expect)) == 0, "the oldest record kept comes first:\n%.40s", captured);
+    CHECK(strstr(captured, "I (123) TEST: n=199\nW (100) BINLOG: 136 log records dropped\n") != NULL,
+          "the newest last, then the drop count");
+}
+
+int main(void)
+{
+    test_format();
+    test_cores();
+    test_preempted();
+    test_wrap();
+    return test_end();
+}
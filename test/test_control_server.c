@@ -0,0 +1,523 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "test.h"
+#include "esp_http_server.h"
+#include "mode_manager.h"
+#include "radio.h"
+#include "playback_clock.h"
+#include "scheduler.h"
+#include "control_server.h"
+
+/*
+ * Drives the control server through the stand-in of esp_http_server: every call of the
+ * API against a mode manager, radio and playback clock faked below, the errors of bad
+ * queries, and the JSON of tracks that need escaping or cutting. WebSocket clients
+ * rebuild the status from the pushes, which must only carry what changed, while the
+ * clients come and go, fail and are purged. Then 4 clients make 5000 requests with the
+ * push running.
+ */
+
+#define BODY_MAX 1024
+#define MAX_FIELDS 12
+#define VALUE_LEN 400
+
+typedef struct {
+    int count;
+    char key[MAX_FIELDS][16];
+    char value[MAX_FIELDS][VALUE_LEN];
+} fields_t;
+
+// The state the fakes report
+static int mode = PLAYER_MODE_RADIO;
+static int volume = 50;
+static int station = 0;
+static char long_url[200];
+static const char *urls[] = {"http://a.example/live", "https://b.example/s.mp3", "http://c.example/\"q\"\\\t", long_url};
+static playback_position_t clock_pos = { .running = true, .position_ms = 12000, .duration_ms = -1, .latency_ms = 300 };
+static int last_key = -1;
+static int last_action = -1;
+static int keys = 0;
+static int switch_to = -1;
+static esp_err_t switch_ret = ESP_OK;
+static int locked = 0;
+
+static scheduler_timer_t *push_timer = NULL;
+static uint32_t push_delay_ms = 0;
+
+static char body[BODY_MAX];
+
+/* Reads a JSON string or bare value from *p into out, false when it is not valid JSON */
+static bool parse_value(const char **p, char *out, size_t size)
+{
+    const char *s = *p;
+    size_t n = 0;
+    if (*s == '"') {
+        out[n++] = *s++;
+        while (*s != '"') {
+            if ((unsigned char)*s < 0x20) {
+                return false;
+            }
+            if (*s == '\\') {
+                out[n++] = *s++;
+                if (*s == 'u') {
+                    for (int i = 1; i <= 4; i++) {
+                        if (!strchr("0123456789abcdefABCDEF", s[i]) || s[i] == '\0') {
+                            return false;
+                        }
+                    }
+                } else if (*s != '"' && *s != '\\') {
+                    return false;
+                }
+            }
+            out[n++] = *s++;
+            if (n >= size - 1) {
+                return false;
+            }
+        }
+        out[n++] = *s++;
+    } else {
+        while (*s && strchr("-0123456789truefals", *s) && n < size - 1) {
+            out[n++] = *s++;
+        }
+        if (n == 0) {
+            return false;
+        }
+    }
+    out[n] = '\0';
+    *p = s;
+    return true;
+}
+
+/* Merges the fields of a JSON object into f, false when the text is not one object */
+static bool parse_json(const char *text, fields_t *f)
+{
+    const char *p = text;
+    if (*p++ != '{') {
+        return false;
+    }
+    while (*p != '}') {
+        char key[VALUE_LEN];
+        char value[VALUE_LEN];
+        if (!parse_value(&p, key, sizeof(key)) || key[0] != '"' || *p++ != ':' || !parse_value(&p, value, sizeof(value))) {
+            return false;
+        }
+        int i = 0;
+        while (i < f->count && strncmp(f->key[i], key + 1, strlen(key) - 2) != 0) {
+            i++;
+        }
+        if (i == f->count) {
+            if (f->count == MAX_FIELDS) {
+                return false;
+            }
+            snprintf(f->key[f->count++], sizeof(f->key[0]), "%.*s", (int)strlen(key) - 2, key + 1);
+        }
+        snprintf(f->value[i], VALUE_LEN, "%s", value);
+        if (*p == ',') {
+            p++;
+        } else if (*p != '}') {
+            return false;
+        }
+    }
+    return p[1] == '\0' || p[1] == '\n';
+}
+
+static const char *field(const fields_t *f, const char *key)
+{
+    for (int i = 0; i < f->count; i++) {
+        if (strcmp(f->key[i], key) == 0) {
+            return f->value[i];
+        }
+    }
+    return "";
+}
+
+static bool same_fields(const fields_t *a, const fields_t *b)
+{
+    if (a->count != b->count) {
+        return false;
+    }
+    for (int i = 0; i < a->count; i++) {
+        if (strcmp(a->value[i], field(b, a->key[i])) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int request(int fd, int method, const char *uri)
+{
+    return host_httpd_request(fd, method, uri, body, sizeof(body));
+}
+
+/* Runs the push timer and the server task once */
+static void push(void)
+{
+    scheduler_timer_t *t = push_timer;
+    push_timer = NULL;
+    t->cb(t, t->arg);
+    host_httpd_run_work();
+}
+
+/* Applies the frames a client got to its copy of the status, returns their count */
+static int apply_frames(int fd, fields_t *model, char *last, size_t size)
+{
+    static char frames[8192];
+    int count = host_httpd_ws_read(fd, frames, sizeof(frames));
+    last[0] = '\0';
+    for (char *line = strtok(frames, "\n"); line != NULL; line = strtok(NULL, "\n")) {
+        CHECK(parse_json(line, model), "not a JSON object: %s", line);
+        snprintf(last, size, "%s", line);
+    }
+    return count;
+}
+
+/* The status a GET answers now */
+static void get_status(int fd, fields_t *f)
+{
+    memset(f, 0, sizeof(*f));
+    CHECK(request(fd, HTTP_GET, "/api/status") == 200 && parse_json(body, f), "status: %s", body);
+}
+
+static void test_start(void)
+{
+    control_server_cfg_t cfg = CONTROL_SERVER_CFG_DEFAULT();
+    CHECK(host_httpd_connect() == -1, "no server before the start");
+    CHECK(control_server_start(&cfg) == ESP_OK, "started");
+    CHECK(push_timer != NULL && push_delay_ms == 250, "push timer armed for %u ms", push_delay_ms);
+}
+
+static void test_api(void)
+{
+    int fd = host_httpd_connect();
+    CHECK(request(fd, HTTP_GET, "/api/status") == 200, "status");
+    const char *expect = "{\"mode\":\"radio\",\"track\":\"http://a.example/live\",\"playing\":true,\"position\":12,"
+                         "\"duration\":-1,\"volume\":50,\"station\":0,\"buffer_ms\":300,\"underruns\":0}";
+    CHECK(strcmp(body, expect) == 0, "status %s", body);
+
+    CHECK(request(fd, HTTP_POST, "/api/play") == 200 && last_key == INPUT_KEY_USER_ID_PLAY &&
+              last_action == INPUT_KEY_SERVICE_ACTION_CLICK_RELEASE, "play is a click of [Play]");
+    CHECK(request(fd, HTTP_POST, "/api/next") == 200 && last_key == INPUT_KEY_USER_ID_SET && keys == 2,
+          "next is a click of [Set]");
+    CHECK(request(fd, HTTP_POST, "/api/volume?level=80") == 200 && volume == 80 && strstr(body, "\"volume\":80"),
+          "level: %s", body);
+    CHECK(request(fd, HTTP_POST, "/api/volume?x=1&delta=-5") == 200 && volume == 75, "delta, volume %d", volume);
+    CHECK(request(fd, HTTP_POST, "/api/volume?delta=50") == 200 && volume == 100, "clamped, volume %d", volume);
+    CHECK(request(fd, HTTP_POST, "/api/station?index=2") == 200 && station == 2 &&
+              strstr(body, "\"station\":2") != NULL, "station: %s", body);
+    CHECK(request(fd, HTTP_POST, "/api/mode?name=tuner") == 200 && switch_to == PLAYER_MODE_TUNER,
+          "switch to the tuner requested");
+    CHECK(request(fd, HTTP_GET, "/api/play") == 405, "a GET of a POST");
+    CHECK(request(fd, HTTP_POST, "/api/nothing") == 404, "no such call");
+    CHECK(locked == 0, "the mode lock released, %d", locked);
+
+    // A bad query is refused and the server closes the connection, nothing changes
+    static const char *const bad[][2] = {
+        {"/api/volume", "level or delta expected"},
+        {"/api/volume?level=", "level or delta expected"},
+        {"/api/volume?level=abc", "level or delta expected"},
+        {"/api/volume?level=12x", "level or delta expected"},
+        {"/api/volume?level=00000000000000000042", "level or delta expected"},
+        {"/api/volume?pad=0123456789012345678901234567890123456789012345678901234567&level=1",
+         "level or delta expected"},
+        {"/api/station?index=4", "unknown station"},
+        {"/api/station?index=-1", "unknown station"},
+        {"/api/station", "index expected"},
+        {"/api/mode?name=sdcard", "unknown mode"},
+        {"/api/mode?name=radioradioradioradio", "name expected"},
+        {"/api/mode", "name expected"},
+    };
+    for (int i = 0; i < (int)(sizeof(bad) / sizeof(bad[0])); i++) {
+        fd = host_httpd_connect();
+        int status = request(fd, HTTP_POST, bad[i][0]);
+        CHECK(status == 400 && strcmp(body, bad[i][1]) == 0 && !host_httpd_is_open(fd), "%s: %d %s", bad[i][0],
+              status, body);
+    }
+    CHECK(volume == 100 && station == 2 && switch_to == PLAYER_MODE_TUNER, "volume %d station %d mode %d", volume,
+          station, switch_to);
+
+    fd = host_httpd_connect();
+    switch_ret = ESP_FAIL;
+    CHECK(request(fd, HTTP_POST, "/api/mode?name=radio") == 500 && strcmp(body, "mode switch not queued") == 0,
+          "a full mode queue: %s", body);
+    switch_ret = ESP_OK;
+    host_httpd_close(fd);
+}
+
+/* Track names with characters to escape, and one too long for the message */
+static void test_json(void)
+{
+    int fd = host_httpd_connect();
+    fields_t f = { 0 };
+    station = 2;
+    CHECK(request(fd, HTTP_GET, "/api/status") == 200 && parse_json(body, &f) &&
+              strcmp(field(&f, "track"), "\"http://c.example/\\\"q\\\"\\\\\\u0009\"") == 0, "escaped: %s", body);
+
+    // Every character escaped to 6, the track is cut and the fields after it still fit
+    memset(long_url, '\x01', sizeof(long_url) - 1);
+    station = 3;
+    memset(&f, 0, sizeof(f));
+    CHECK(request(fd, HTTP_GET, "/api/status") == 200 && parse_json(body, &f) && f.count == 9 &&
+              strcmp(field(&f, "underruns"), "0") == 0, "cut track: %s", body);
+    printf("status with the longest track: %d bytes\n", (int)strlen(body));
+    memset(long_url, '"', sizeof(long_url) - 1);
+    memset(&f, 0, sizeof(f));
+    CHECK(request(fd, HTTP_GET, "/api/status") == 200 && parse_json(body, &f) && f.count == 9, "cut quotes: %s", body);
+    station = 0;
+    host_httpd_close(fd);
+}
+
+static void test_push(void)
+{
+    char last[BODY_MAX];
+    fields_t status;
+    int http = host_httpd_connect();
+
+    // Nobody listens, nothing is queued, the timer goes on
+    push();
+    CHECK(host_httpd_pending_work() == 0 && push_timer != NULL && push_delay_ms == 250, "no push without clients");
+
+    int a = host_httpd_ws_open("/ws");
+    fields_t model_a = { 0 };
+    CHECK(a >= 0 && apply_frames(a, &model_a, last, sizeof(last)) == 1 && model_a.count == 9, "full status first: %s",
+          last);
+    get_status(http, &status);
+    CHECK(same_fields(&model_a, &status), "the first frame is the status");
+
+    // The first push carries what changed since the server started, the client has it already
+    push();
+    apply_frames(a, &model_a, last, sizeof(last));
+    CHECK(same_fields(&model_a, &status), "the status again after the first push");
+    push();
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 0, "nothing changed, nothing sent: %s", last);
+
+    volume = 60;
+    push();
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 1 && strcmp(last, "{\"volume\":60}") == 0, "%s", last);
+
+    // Position in seconds and the buffer in steps of 100 ms, not every change is sent
+    clock_pos.position_ms = 12400;
+    clock_pos.latency_ms = 399;
+    push();
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 0, "within the second and the step: %s", last);
+    clock_pos.position_ms = 13000;
+    clock_pos.latency_ms = 420;
+    clock_pos.underruns = 1;
+    push();
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 1 &&
+              strcmp(last, "{\"position\":13,\"buffer_ms\":400,\"underruns\":1}") == 0, "%s", last);
+
+    // One push in the queue at a time
+    push_timer->cb(push_timer, push_timer->arg);
+    push_timer->cb(push_timer, push_timer->arg);
+    CHECK(host_httpd_pending_work() == 1, "%d pushes queued", host_httpd_pending_work());
+    host_httpd_run_work();
+
+    // A second client, a third is refused
+    int b = host_httpd_ws_open("/ws");
+    fields_t model_b = { 0 };
+    CHECK(b >= 0 && apply_frames(b, &model_b, last, sizeof(last)) == 1 && same_fields(&model_a, &model_b),
+          "the second client gets the status: %s", last);
+    char log[512] = "";
+    host_capture_log(log, sizeof(log));
+    CHECK(host_httpd_ws_open("/ws") == -1, "a third client refused");
+    host_capture_log(NULL, 0);
+    CHECK(strstr(log, "WebSocket client refused, 2 are connected") != NULL, "refusal logged: %s", log);
+
+    mode = PLAYER_MODE_TUNER;
+    push();
+    const char *tuner = "{\"mode\":\"tuner\",\"track\":\"\"}";
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 1 && strcmp(last, tuner) == 0, "%s", last);
+    CHECK(apply_frames(b, &model_b, last, sizeof(last)) == 1 && strcmp(last, tuner) == 0, "%s", last);
+
+    // What clients send is read and dropped, a frame too long closes the client
+    CHECK(host_httpd_ws_send(a, "ping") == ESP_OK && host_httpd_is_open(a), "a short frame dropped");
+    CHECK(host_httpd_ws_send(a, "0123456789012345678901234567890123456789012345678901234567890123456789") != ESP_OK &&
+              !host_httpd_is_open(a), "a long frame closes the client");
+
+    // A client gone without closing is closed by the push that fails, after the push
+    host_httpd_ws_fail_sends(b);
+    volume = 65;
+    push();
+    CHECK(!host_httpd_is_open(b), "a failed send closes the client");
+    push();
+    CHECK(host_httpd_pending_work() == 0, "no clients left, no pushes");
+
+    // Their places are free again
+    a = host_httpd_ws_open("/ws");
+    b = host_httpd_ws_open("/ws");
+    memset(&model_a, 0, sizeof(model_a));
+    memset(&model_b, 0, sizeof(model_b));
+    CHECK(apply_frames(a, &model_a, last, sizeof(last)) == 1 && apply_frames(b, &model_b, last, sizeof(last)) == 1,
+          "two new clients");
+    host_httpd_close(a);
+    host_httpd_close(b);
+    host_httpd_close(http);
+    mode = PLAYER_MODE_RADIO;
+}
+
+/* Beyond 4 sockets the least recently used is closed, a WebSocket client too */
+static void test_lru(void)
+{
+    char last[BODY_MAX];
+    int a = host_httpd_ws_open("/ws");
+    int b = host_httpd_ws_open("/ws");
+    int http1 = host_httpd_connect();
+    int http2 = host_httpd_connect();
+    fields_t model_b = { 0 };
+    host_httpd_ws_send(b, "keep");
+    request(http1, HTTP_GET, "/api/status");
+    request(http2, HTTP_GET, "/api/status");
+    int http3 = host_httpd_connect();
+    CHECK(http3 >= 0 && !host_httpd_is_open(a) && host_httpd_is_open(b), "the oldest client purged");
+
+    // The purged client left its place, the request least recently used goes for the next
+    host_httpd_ws_send(b, "keep");
+    int c = host_httpd_ws_open("/ws");
+    fields_t model_c = { 0 };
+    CHECK(c >= 0 && apply_frames(c, &model_c, last, sizeof(last)) == 1, "a new client in its place");
+    CHECK(!host_httpd_is_open(http1), "and the oldest request purged for it");
+    apply_frames(b, &model_b, last, sizeof(last));
+    volume = 30;
+    push();
+    CHECK(apply_frames(b, &model_b, last, sizeof(last)) == 1 && apply_frames(c, &model_c, last, sizeof(last)) == 1,
+          "both get the push");
+    host_httpd_close(b);
+    host_httpd_close(c);
+    host_httpd_close(http2);
+    host_httpd_close(http3);
+}
+
+/* 4 clients at 500 requests a second for 10 s, a push every 250 ms */
+static void test_load(void)
+{
+    char last[BODY_MAX];
+    int clients[3];
+    for (int i = 0; i < 3; i++) {
+        clients[i] = host_httpd_connect();
+    }
+    int ws = host_httpd_ws_open("/ws");
+    fields_t model = { 0 };
+    apply_frames(ws, &model, last, sizeof(last));
+
+    static const char *const calls[] = {"/api/status", "/api/play", "/api/volume?delta=1", "/api/volume?delta=-1",
+                                        "/api/next", "/api/station?index=1"};
+    int failed = 0;
+    int wrong = 0;
+    int frames = 0;
+    clock_t start = clock();
+    for (int i = 0; i < 5000; i++) {
+        int fd = clients[i % 3];
+        const char *call = calls[i % 6];
+        fields_t f = { 0 };
+        failed += request(fd, i % 6 ? HTTP_POST : HTTP_GET, call) != 200 || !parse_json(body, &f) || f.count != 9;
+        clock_pos.position_ms += 2;
+        clock_pos.latency_ms = 200 + i % 300;
+        if (i % 125 == 124) {
+            push();
+            frames += apply_frames(ws, &model, last, sizeof(last));
+            fields_t status;
+            get_status(clients[0], &status);
+            wrong += !same_fields(&model, &status);
+        }
+    }
+    double us = (clock() - start) * 1e6 / CLOCKS_PER_SEC / 5000;
+    printf("5000 requests, %.1f us each, %d pushes\n", us, frames);
+    CHECK(failed == 0, "%d requests failed", failed);
+    CHECK(wrong == 0 && frames > 30, "%d of %d pushes left the client behind", wrong, frames);
+    for (int i = 0; i < 3; i++) {
+        CHECK(host_httpd_is_open(clients[i]), "client %d still connected", i);
+    }
+    CHECK(locked == 0, "the mode lock released, %d", locked);
+}
+
+int main(void)
+{
+    test_start();
+    test_api();
+    test_json();
+    test_push();
+    test_lru();
+    test_load();
+    return test_end();
+}
+
+// The mode manager, radio, playback clock and scheduler the server talks to
+
+void mode_manager_lock(void)
+{
+    locked++;
+}
+
+void mode_manager_unlock(void)
+{
+    locked--;
+}
+
+player_mode_t mode_manager_get_mode(void)
+{
+    return (player_mode_t)mode;
+}
+
+int mode_manager_get_volume(void)
+{
+    return volume;
+}
+
+void mode_manager_set_volume(int v)
+{
+    volume = v < 0 ? 0 : (v > 100 ? 100 : v);
+}
+
+void mode_manager_inject_key(int key_id, int action)
+{
+    last_key = key_id;
+    last_action = action;
+    keys++;
+}
+
+esp_err_t mode_manager_request_switch(player_mode_t m)
+{
+    if (switch_ret == ESP_OK) {
+        switch_to = m;
+    }
+    return switch_ret;
+}
+
+int radio_get_station(void)
+{
+    return station;
+}
+
+const char *radio_get_station_url(int index)
+{
+    return index >= 0 && index < 4 ? urls[index] : NULL;
+}
+
+esp_err_t radio_select_station(int index)
+{
+    if (index < 0 || index >= 4) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    station = index;
+    return ESP_OK;
+}
+
+void playback_clock_get(playback_position_t *pos)
+{
+    *pos = clock_pos;
+}
+
+void scheduler_timer_init(scheduler_timer_t *t, scheduler_cb_t cb, void *arg)
+{
+    memset(t, 0, sizeof(*t));
+    t->cb = cb;
+    t->arg = arg;
+}
+
+void scheduler_start_after(scheduler_timer_t *t, uint32_t delay_ms)
+{
+    push_timer = t;
+    push_delay_ms = delay_ms;
+}
@@ -0,0 +1,324 @@
+#include <complex.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "esp_system.h"
+#include "nvs_flash.h"
+#include "eq.h"
+
+/*
+ * Measures the response of the fixed-point cascade with sine tones from 30 Hz to 16 kHz
+ * and compares it with the response the Audio EQ Cookbook gives for the preset,
+ * computed here in double. A flat or bypassed equalizer must be bit exact, a preset
+ * change mid-tone must not step, boosts past full scale saturate, and the presets are
+ * kept in NVS.
+ */
+
+#define BUFFER_FRAMES 1000
+#define POINTS 24
+#define LEVEL 0.25              /* Of full scale, room for the boosts of the presets */
+
+static int16_t in[BUFFER_FRAMES * 2];
+static int16_t out[BUFFER_FRAMES * 2];
+static int rate = 48000;
+static int channels = 2;
+static int64_t phase = 0;       /* Frames of the tone so far */
+
+static void set_format(int new_rate, int new_channels)
+{
+    rate = new_rate;
+    channels = new_channels;
+    eq_set_format(rate, channels, 16);
+}
+
+/* Least squares amplitude and phase of a tone of w radians per sample */
+typedef struct {
+    double ss, cc, sc, ys, yc;
+} fit_t;
+
+static void fit_add(fit_t *f, double w, int64_t n, double y)
+{
+    double s = sin(w * n), c = cos(w * n);
+    f->ss += s * s;
+    f->cc += c * c;
+    f->sc += s * c;
+    f->ys += y * s;
+    f->yc += y * c;
+}
+
+static double complex fit_result(const fit_t *f)
+{
+    double det = f->ss * f->cc - f->sc * f->sc;
+    double a = (f->ys * f->cc - f->yc * f->sc) / det;
+    double b = (f->yc * f->ss - f->ys * f->sc) / det;
+    return a + I * b;
+}
+
+/* Plays a tone through the equalizer, returns the gain in dB of the last measure_s seconds */
+static double measure(double freq, double settle_s, double measure_s)
+{
+    double w = 2 * M_PI * freq / rate;
+    int64_t settle = settle_s * rate;
+    int64_t total = settle + (int64_t)(measure_s * rate);
+    fit_t fin = {0}, fout = {0};
+    for (int64_t done = 0; done < total; done += BUFFER_FRAMES) {
+        int len = total - done < BUFFER_FRAMES ? total - done : BUFFER_FRAMES;
+        for (int i = 0; i < len; i++) {
+            int16_t v = (int16_t)lround(LEVEL * 32767 * sin(w * (phase + i)));
+            for (int c = 0; c < channels; c++) {
+                in[i * channels + c] = v;
+            }
+        }
+        memcpy(out, in, len * channels * sizeof(int16_t));
+        eq_process((char *)out, len * channels * sizeof(int16_t));
+        for (int i = 0; i < len && done + i >= settle; i++) {
+            fit_add(&fin, w, phase + i, in[i * channels]);
+            fit_add(&fout, w, phase + i, out[i * channels + channels - 1]);
+        }
+        phase += len;
+    }
+    return 20 * log10(cabs(fit_result(&fout)) / cabs(fit_result(&fin)));
+}
+
+/* Coefficients of a band after the Audio EQ Cookbook, not normalized */
+static void band_coefs(const eq_band_t *band, double b[3], double d[3])
+{
+    double f = band->freq_hz;
+    double q = band->q100 / 100.0;
+    double a = pow(10, band->gain_db10 / 400.0);
+    double w0 = 2 * M_PI * f / rate;
+    double cw = cos(w0), alpha = sin(w0) / (2 * q), sa = 2 * sqrt(a) * alpha;
+    switch (band->type) {
+    case EQ_BAND_LOW_SHELF:
+        b[0] = a * ((a + 1) - (a - 1) * cw + sa);
+        b[1] = 2 * a * ((a - 1) - (a + 1) * cw);
+        b[2] = a * ((a + 1) - (a - 1) * cw - sa);
+        d[0] = (a + 1) + (a - 1) * cw + sa;
+        d[1] = -2 * ((a - 1) + (a + 1) * cw);
+        d[2] = (a + 1) + (a - 1) * cw - sa;
+        break;
+    case EQ_BAND_HIGH_SHELF:
+        b[0] = a * ((a + 1) + (a - 1) * cw + sa);
+        b[1] = -2 * a * ((a - 1) + (a + 1) * cw);
+        b[2] = a * ((a + 1) + (a - 1) * cw - sa);
+        d[0] = (a + 1) - (a - 1) * cw + sa;
+        d[1] = 2 * ((a - 1) - (a + 1) * cw);
+        d[2] = (a + 1) - (a - 1) * cw - sa;
+        break;
+    case EQ_BAND_HIGH_PASS:
+        b[0] = b[2] = (1 + cw) / 2;
+        b[1] = -(1 + cw);
+        d[0] = 1 + alpha;
+        d[1] = -2 * cw;
+        d[2] = 1 - alpha;
+        break;
+    default:
+        b[0] = 1 + alpha * a;
+        b[1] = d[1] = -2 * cw;
+        b[2] = 1 - alpha * a;
+        d[0] = 1 + alpha / a;
+        d[2] = 1 - alpha / a;
+        break;
+    }
+}
+
+static double complex band_response(const eq_band_t *band, double w)
+{
+    double b[3], d[3];
+    band_coefs(band, b, d);
+    double complex z1 = cexp(-I * w), z2 = cexp(-2 * I * w);
+    return (b[0] + b[1] * z1 + b[2] * z2) / (d[0] + d[1] * z1 + d[2] * z2);
+}
+
+static double preset_response_db(const eq_preset_t *p, double freq)
+{
+    double w = 2 * M_PI * freq / rate;
+    double complex h = pow(10, p->preamp_db10 / 200.0);
+    for (int i = 0; i < p->band_count; i++) {
+        h *= band_response(&p->bands[i], w);
+    }
+    return 20 * log10(cabs(h));
+}
+
+/* The response at POINTS frequencies from 30 Hz to 16 kHz, returns the largest error */
+static double check_response(const char *what, const eq_preset_t *p)
+{
+    eq_apply(p, false);
+    double worst = 0;
+    double worst_freq = 0;
+    for (int i = 0; i < POINTS; i++) {
+        double freq = 30 * pow(16000 / 30.0, i / (POINTS - 1.0));
+        double err = fabs(measure(freq, 0.2, 0.5) - preset_response_db(p, freq));
+        if (err > worst) {
+            worst = err;
+            worst_freq = freq;
+        }
+    }
+    printf("%s at %d Hz: within %.4f dB of the cookbook, worst at %.0f Hz\n", what, rate, worst, worst_freq);
+    CHECK(worst < 0.01, "%s at %d Hz: %.4f dB off at %.0f Hz", what, rate, worst, worst_freq);
+    return worst;
+}
+
+static void test_response(void)
+{
+    eq_preset_t peak = {.name = "Peak", .band_count = 1, .bands = {{EQ_BAND_PEAK, 1000, 60, 100}}};
+    const int rates[] = {48000, 44100};
+    for (int r = 0; r < 2; r++) {
+        set_format(rates[r], 2);
+        check_response("LyraT speaker", eq_get_builtin(EQ_PRESET_LYRAT_SPEAKER));
+        check_response("Voice", eq_get_builtin(EQ_PRESET_VOICE));
+        eq_apply(&peak, false);
+        double db = measure(1000, 0.2, 1);
+        printf("6 dB peak at 1 kHz: %.4f dB\n", db);
+        CHECK(fabs(db - 6) < 0.005, "6 dB peak measured %.4f dB at %d Hz", db, rate);
+    }
+    set_format(22050, 1);
+    check_response("Voice, mono", eq_get_builtin(EQ_PRESET_VOICE));
+    set_format(48000, 2);
+}
+
+/* Bit exact once the crossfade to flat or to the bypass is over */
+static void check_exact(const char *what)
+{
+    measure(1000, 0.01, 0);
+    int wrong = 0;
+    for (int n = 0; n < 20; n++) {
+        for (int i = 0; i < BUFFER_FRAMES * 2; i++) {
+            in[i] = (int16_t)(esp_random() & 0xFFFF);
+        }
+        memcpy(out, in, sizeof(in));
+        eq_process((char *)out, sizeof(out));
+        wrong += memcmp(in, out, sizeof(in)) != 0;
+    }
+    CHECK(wrong == 0, "%s: %d buffers of noise changed", what, wrong);
+}
+
+static void test_exact(void)
+{
+    eq_apply(eq_get_builtin(EQ_PRESET_FLAT), false);
+    check_exact("flat");
+    eq_apply(eq_get_builtin(EQ_PRESET_VOICE), false);
+    eq_set_bypass(true);
+    check_exact("bypassed");
+    eq_set_bypass(false);
+    CHECK(fabs(measure(2500, 0.2, 0.5) - preset_response_db(eq_get_builtin(EQ_PRESET_VOICE), 2500)) < 0.01,
+          "the preset is back after the bypass");
+
+    // Only 16-bit audio is equalized
+    eq_set_format(48000, 2, 32);
+    memcpy(out, in, sizeof(in));
+    eq_process((char *)out, sizeof(out));
+    CHECK(memcmp(in, out, sizeof(in)) == 0, "32-bit audio passes");
+    eq_set_format(48000, 2, 16);
+}
+
+/* A preset change in the middle of a tone, the output must not jump */
+static void test_crossfade(void)
+{
+    eq_preset_t peak = {.name = "Peak", .band_count = 1, .bands = {{EQ_BAND_PEAK, 1000, 60, 100}}};
+    eq_apply(eq_get_builtin(EQ_PRESET_FLAT), false);
+    measure(1000, 0.1, 0);
+    int before = 0, during = 0, after = 0;
+    int16_t last = 0;
+    for (int n = 0; n < 30; n++) {
+        if (n == 10) {
+            eq_apply(&peak, false);
+        }
+        measure(1000, 0, (double)BUFFER_FRAMES / rate);
+        int step = 0;
+        for (int i = 0; i < BUFFER_FRAMES; i++) {
+            int16_t v = out[i * 2];
+            step = abs(v - last) > step ? abs(v - last) : step;
+            last = v;
+        }
+        int *slot = n < 10 ? &before : n == 10 ? &during : &after;
+        *slot = step > *slot ? step : *slot;
+    }
+    printf("largest step between samples: %d before, %d at the change, %d after\n", before, during, after);
+    CHECK(during <= after + 2, "the change steps by %d, the louder tone by %d", during, after);
+    CHECK(after > before * 18 / 10, "louder after the change, %d and %d", before, after);
+}
+
+/* 15 dB over full scale saturates like the filter in double, nothing wraps */
+static void test_saturation(void)
+{
+    eq_preset_t boost = {.name = "Boost", .band_count = 1, .bands = {{EQ_BAND_PEAK, 3000, 150, 100}}};
+    eq_apply(&boost, false);
+    double b[3], d[3];
+    band_coefs(&boost.bands[0], b, d);
+    double x1 = 0, x2 = 0, y1 = 0, y2 = 0;
+    int64_t total = rate / 2;
+    int max = 0, min = 0, worst = 0;
+    for (int64_t done = 0; done < total; done += BUFFER_FRAMES) {
+        for (int i = 0; i < BUFFER_FRAMES; i++) {
+            in[2 * i] = in[2 * i + 1] = (int16_t)lround(32767 * sin(2 * M_PI * 3000 * (done + i) / rate));
+        }
+        memcpy(out, in, sizeof(in));
+        eq_process((char *)out, sizeof(out));
+        for (int i = 0; i < BUFFER_FRAMES; i++) {
+            double y = (b[0] * in[2 * i] + b[1] * x1 + b[2] * x2 - d[1] * y1 - d[2] * y2) / d[0];
+            x2 = x1;
+            x1 = in[2 * i];
+            y2 = y1;
+            y1 = y;
+            int16_t v = out[2 * i];
+            max = v > max ? v : max;
+            min = v < min ? v : min;
+            // After the crossfade from the preset before
+            int expect = lround(y > 32767 ? 32767 : y < -32768 ? -32768 : y);
+            if (done >= rate / 10 && abs(v - expect) > worst) {
+                worst = abs(v - expect);
+            }
+        }
+    }
+    CHECK(max == 32767 && min == -32768 && worst <= 2, "clipped to %d and %d, %d off the filter in double", min, max,
+          worst);
+}
+
+static void test_presets(void)
+{
+    eq_preset_t p;
+    CHECK(eq_load_preset(1, &p) == ESP_ERR_NVS_NOT_FOUND, "the slot is empty");
+    eq_preset_t mine = {.name = "Mine", .preamp_db10 = -30, .band_count = 2,
+                        .bands = {{EQ_BAND_LOW_SHELF, 100, 60, 71}, {EQ_BAND_HIGH_SHELF, 10000, -30, 71}}};
+    CHECK(eq_store_preset(1, &mine) == ESP_OK && eq_load_preset(1, &p) == ESP_OK && memcmp(&p, &mine, sizeof(p)) == 0,
+          "stored and loaded");
+    CHECK(eq_store_preset(EQ_USER_PRESETS, &mine) == ESP_ERR_INVALID_ARG && eq_load_preset(-1, &p) ==
+          ESP_ERR_INVALID_ARG, "slots out of range");
+    eq_preset_t bad = mine;
+    bad.band_count = EQ_MAX_BANDS + 1;
+    CHECK(eq_apply(&bad, false) == ESP_ERR_INVALID_ARG && eq_store_preset(0, &bad) == ESP_ERR_INVALID_ARG,
+          "too many bands");
+    bad = mine;
+    bad.bands[1].type = EQ_BAND_HIGH_PASS + 1;
+    CHECK(eq_apply(&bad, false) == ESP_ERR_INVALID_ARG, "unknown band type");
+
+    // The applied preset and the bypass are what the next boot starts with
+    CHECK(eq_apply(&mine, true) == ESP_OK, "applied and saved");
+    eq_set_bypass(true);
+    eq_apply(eq_get_builtin(EQ_PRESET_VOICE), false);
+    CHECK(eq_init() == ESP_OK, "loaded again");
+    eq_get_active(&p);
+    CHECK(strcmp(p.name, "Mine") == 0, "the saved preset, %s", p.name);
+    check_exact("bypassed after a restart");
+    eq_set_bypass(false);
+    check_response("Mine", &mine);
+}
+
+int main(void)
+{
+    nvs_flash_init();
+    CHECK(eq_init() == ESP_OK, "equalizer started");
+    eq_preset_t p;
+    eq_get_active(&p);
+    CHECK(strcmp(p.name, eq_get_builtin(EQ_PRESET_LYRAT_SPEAKER)->name) == 0, "the LyraT speaker preset first, %s",
+          p.name);
+    test_response();
+    test_exact();
+    test_crossfade();
+    test_saturation();
+    test_presets();
+    return test_end();
+}
@@ -0,0 +1,516 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "group_sync.h"
+
+/*
+ * Round trips every datagram type through the codec and feeds it broken ones, checks
+ * the clock filter against exchanges with queueing in one direction, and walks the
+ * jitter buffer through reordering, duplicates, late and early packets, concealment,
+ * new timelines and the wrap of the packet number. Then simulates a group of four
+ * speakers in steps of 50 us: clocks with an offset and a drift, DACs that are off
+ * their crystal, a network with jitter and loss, clock exchanges every 125 ms. Each
+ * speaker renders when its DMA buffer has room and the frame it renders is compared
+ * with when it is heard. After the start the speakers must stay within a spread of a
+ * few hundred microseconds, without a resync.
+ */
+
+#define SPEAKERS 4
+#define STEP_US 50
+#define SIM_S 60
+#define SETTLE_S 10
+#define DELAY_US 100000
+#define SLOT_COUNT (DELAY_US / GROUP_PACKET_US + 8)
+#define DMA_FRAMES (3 * GROUP_PACKET_FRAMES)
+#define PENDING 64
+
+static int16_t pcm[GROUP_PACKET_FRAMES * GROUP_CHANNELS];
+static int16_t out[GROUP_PACKET_FRAMES * GROUP_CHANNELS];
+static group_slot_t slots[SLOT_COUNT];
+
+static double uniform(void)
+{
+    return (double)rand() / RAND_MAX;
+}
+
+/* Queueing delay of a network hop, exponential */
+static double queueing(double mean_us)
+{
+    return -mean_us * log(1 - uniform() * 0.999999);
+}
+
+/* Packet seq holds (seq % 64) * 256 + frame + 1, negated on the right */
+static int16_t sample(uint32_t seq, int frame)
+{
+    return (int16_t)((seq % 64) * 256 + frame + 1);
+}
+
+static void fill(uint32_t seq)
+{
+    for (int i = 0; i < GROUP_PACKET_FRAMES; i++) {
+        pcm[i * GROUP_CHANNELS] = sample(seq, i);
+        pcm[i * GROUP_CHANNELS + 1] = -sample(seq, i);
+    }
+}
+
+static void test_codec(void)
+{
+    uint8_t buf[GROUP_DATAGRAM_MAX + 1];
+    group_msg_t msg;
+    fill(7);
+    group_msg_t audio = {
+        .type = GROUP_MSG_AUDIO, .node = 0xdeadbeef, .seq = 123456789, .time_us = {-5000000123LL}, .pcm = pcm,
+    };
+    int n = group_msg_encode(buf, &audio);
+    CHECK(n == GROUP_DATAGRAM_MAX, "audio datagram %d bytes", n);
+    CHECK(group_msg_decode(buf, n, &msg) && msg.type == GROUP_MSG_AUDIO && msg.node == audio.node &&
+          msg.seq == audio.seq && msg.time_us[0] == audio.time_us[0] &&
+          memcmp(msg.pcm, pcm, GROUP_PACKET_BYTES) == 0, "audio round trip");
+
+    group_msg_t clock = { .type = GROUP_MSG_CLOCK_RESP, .node = 3, .time_us = {1, INT64_MAX, -1} };
+    n = group_msg_encode(buf, &clock);
+    CHECK(n == GROUP_HEADER_SIZE + 24 && group_msg_decode(buf, n, &msg) && msg.type == GROUP_MSG_CLOCK_RESP &&
+          msg.time_us[0] == 1 && msg.time_us[1] == INT64_MAX && msg.time_us[2] == -1, "clock round trip, %d bytes",
+          n);
+
+    group_msg_t report = {
+        .type = GROUP_MSG_REPORT,
+        .node = 9,
+        .stats = { .leader = 1, .locked = 1, .error_us = -250, .rtt_us = 1800, .correction_ppb = -42000,
+                   .received = 4000000000u, .concealed = 17, .late = 3, .resyncs = 1 },
+    };
+    n = group_msg_encode(buf, &report);
+    CHECK(n == GROUP_HEADER_SIZE + 32 && group_msg_decode(buf, n, &msg) && msg.type == GROUP_MSG_REPORT &&
+          memcmp(&msg.stats, &report.stats, sizeof(report.stats)) == 0, "report round trip, %d bytes", n);
+
+    // A byte short or long, another magic or version, an unknown type
+    n = group_msg_encode(buf, &audio);
+    int accepted = group_msg_decode(buf, n - 1, &msg) + group_msg_decode(buf, n + 1, &msg) +
+                   group_msg_decode(buf, GROUP_HEADER_SIZE - 1, &msg);
+    for (int i = 0; i < 4; i++) {
+        uint8_t save = buf[i];
+        buf[i] = i < 3 ? buf[i] + 1 : 0x7f;
+        accepted += group_msg_decode(buf, n, &msg);
+        buf[i] = save;
+    }
+    n = group_msg_encode(buf, &clock);
+    accepted += group_msg_decode(buf, n - 8, &msg);
+    n = group_msg_encode(buf, &report);
+    accepted += group_msg_decode(buf, n + 4, &msg);
+    CHECK(accepted == 0, "%d broken datagrams accepted", accepted);
+}
+
+static void test_clock(void)
+{
+    group_clock_t clock;
+    group_clock_reset(&clock);
+    int64_t offset = 0;
+    int32_t rtt = 0;
+    CHECK(!group_clock_get(&clock, 0, &offset, NULL), "offset before an exchange");
+
+    // Leader 1 s ahead, 300 us on the wire each way, queueing in either direction
+    srand(47);
+    const int64_t truth = 1000000;
+    int64_t worst_single = 0;
+    int64_t worst = 0;
+    for (int i = 0; i < 400; i++) {
+        int64_t t1 = i * 125000LL;
+        int64_t up = 300 + (int64_t)queueing(2000 * uniform());
+        int64_t down = 300 + (int64_t)queueing(2000 * uniform());
+        int64_t t2 = t1 + up + truth;
+        int64_t t3 = t2 + 40;
+        int64_t t4 = t3 - truth + down;
+        group_clock_add(&clock, t1, t2, t3, t4);
+        int64_t single = llabs(((t2 - t1) + (t3 - t4)) / 2 - truth);
+        worst_single = single > worst_single ? single : worst_single;
+        CHECK(group_clock_get(&clock, t4, &offset, &rtt), "offset after %d exchanges", i + 1);
+        if (i >= 8) {
+            worst = llabs(offset - truth) > worst ? llabs(offset - truth) : worst;
+        }
+    }
+    printf("clock filter: single exchanges off by up to %lld us, the filter by %lld us\n",
+           (long long)worst_single, (long long)worst);
+    CHECK(worst < 500 && worst < worst_single / 4, "offset off by %lld us, single exchanges by %lld us",
+          (long long)worst, (long long)worst_single);
+
+    // Exchanges with an impossible or too long round trip are ignored
+    group_clock_reset(&clock);
+    group_clock_add(&clock, 0, 1000, 2000, 500);
+    group_clock_add(&clock, 0, 1000, 1000, GROUP_CLOCK_RTT_MAX_US + 1);
+    CHECK(clock.count == 0, "%d exchanges with a bad round trip kept", clock.count);
+
+    // A fast exchange is preferred until it is older by its 900 us less bound, 18 s at 50 ppm
+    group_clock_add(&clock, 0, 5000, 5000, 200);                   // rtt 200, offset 4900
+    group_clock_add(&clock, 10000000, 10006000, 10006000, 10002000);
+    group_clock_get(&clock, 10002000, &offset, &rtt);
+    CHECK(offset == 4900 && rtt == 200, "fast exchange not used: %lld, rtt %d", (long long)offset, (int)rtt);
+    group_clock_add(&clock, 20000000, 20006100, 20006100, 20002000);
+    group_clock_get(&clock, 20002000, &offset, &rtt);
+    CHECK(offset == 5100 && rtt == 2000, "aged exchange still used: %lld, rtt %d", (long long)offset, (int)rtt);
+
+    // The window forgets the oldest
+    for (int i = 0; i < GROUP_CLOCK_WINDOW; i++) {
+        group_clock_add(&clock, 30000000, 30007000, 30007000, 30004000);
+    }
+    group_clock_get(&clock, 30004000, &offset, &rtt);
+    CHECK(clock.count == GROUP_CLOCK_WINDOW && rtt == 4000, "window holds %d, rtt %d", clock.count, (int)rtt);
+}
+
+/* Reads packet n whole, returns the packet number % 64 it holds, -2 for silence, -1 otherwise */
+static int read_packet(group_jitter_t *jitter, int64_t n)
+{
+    group_jitter_read(jitter, n * GROUP_PACKET_FRAMES, GROUP_PACKET_FRAMES, out);
+    bool silent = true;
+    for (int i = 0; i < GROUP_PACKET_FRAMES * GROUP_CHANNELS; i++) {
+        silent = silent && out[i] == 0;
+    }
+    if (silent) {
+        return -2;
+    }
+    int16_t first = out[0];
+    for (int i = 0; i < GROUP_PACKET_FRAMES; i++) {
+        if (out[i * GROUP_CHANNELS] != (int16_t)(first + i) || out[i * GROUP_CHANNELS + 1] != -out[i * GROUP_CHANNELS]) {
+            return -1;
+        }
+    }
+    return (first - 1) / 256;
+}
+
+static group_push_result_t push(group_jitter_t *jitter, int64_t base_us, uint32_t seq)
+{
+    fill(seq);
+    return group_jitter_push(jitter, base_us, seq, pcm);
+}
+
+static void test_jitter(void)
+{
+    group_jitter_t jitter;
+    group_jitter_init(&jitter, slots, SLOT_COUNT);
+    group_jitter_read(&jitter, 0, GROUP_PACKET_FRAMES, out);
+    CHECK(out[0] == 0 && out[GROUP_PACKET_FRAMES * GROUP_CHANNELS - 1] == 0, "not silent without a timeline");
+
+    // Out of order and a duplicate
+    CHECK(push(&jitter, 1000000, 0) == GROUP_PUSH_NEW_TIMELINE, "first packet starts no timeline");
+    CHECK(push(&jitter, 1000000, 2) == GROUP_PUSH_STORED && push(&jitter, 1000000, 1) == GROUP_PUSH_STORED &&
+          push(&jitter, 1000000, 3) == GROUP_PUSH_STORED, "reordered packets not stored");
+    CHECK(push(&jitter, 1000000, 2) == GROUP_PUSH_DROPPED && jitter.late == 1, "duplicate stored");
+    // Within the slack of the base it is the same timeline
+    CHECK(push(&jitter, 1000000 + GROUP_TIMELINE_SLACK_US, 4) == GROUP_PUSH_STORED, "base within slack");
+    int wrong = 0;
+    for (uint32_t seq = 0; seq < 5; seq++) {
+        wrong += read_packet(&jitter, seq) != (int)seq;
+    }
+    CHECK(wrong == 0 && jitter.received == 5 && jitter.concealed == 0, "%d of 5 packets wrong", wrong);
+
+    // Frames before packet 0 are silence, a read across packets joins them
+    group_jitter_reset(&jitter);
+    push(&jitter, 0, 0);
+    push(&jitter, 0, 1);
+    group_jitter_read(&jitter, -10, GROUP_PACKET_FRAMES, out);
+    CHECK(out[9 * GROUP_CHANNELS] == 0 && out[10 * GROUP_CHANNELS] == 1, "start of the timeline at %d",
+          out[10 * GROUP_CHANNELS]);
+    group_jitter_read(&jitter, 200, GROUP_PACKET_FRAMES, out);
+    CHECK(out[0] == sample(0, 200) && out[39 * GROUP_CHANNELS] == sample(0, 239) &&
+          out[40 * GROUP_CHANNELS] == sample(1, 0),
+          "read across packets: %d %d %d", out[0], out[39 * GROUP_CHANNELS], out[40 * GROUP_CHANNELS]);
+
+    // A packet that comes after it was needed, one too far ahead
+    group_jitter_reset(&jitter);
+    push(&jitter, 0, 1);
+    uint32_t late = jitter.late;
+    CHECK(push(&jitter, 0, 0) == GROUP_PUSH_DROPPED && jitter.late == late + 1, "late packet stored");
+    CHECK(push(&jitter, 0, 1 + SLOT_COUNT) == GROUP_PUSH_DROPPED, "packet beyond the buffer stored");
+    CHECK(push(&jitter, 0, SLOT_COUNT) == GROUP_PUSH_STORED, "last packet of the buffer dropped");
+
+    // Missing packets repeat the last one with a falling gain, then silence
+    group_jitter_reset(&jitter);
+    push(&jitter, 0, 0);
+    push(&jitter, 0, 5);
+    read_packet(&jitter, 0);
+    int16_t level = out[(GROUP_PACKET_FRAMES - 1) * GROUP_CHANNELS];
+    int peaks[4];
+    for (uint32_t seq = 1; seq <= 4; seq++) {
+        group_jitter_read(&jitter, seq * GROUP_PACKET_FRAMES, GROUP_PACKET_FRAMES, out);
+        peaks[seq - 1] = out[(GROUP_PACKET_FRAMES - 1) * GROUP_CHANNELS];
+    }
+    CHECK(peaks[0] > 0 && peaks[0] <= level / 2 && peaks[1] > 0 && peaks[1] < peaks[0] && peaks[2] == 0 &&
+          peaks[3] == 0, "concealment ends at %d, %d, %d, %d of %d", peaks[0], peaks[1], peaks[2], peaks[3], level);
+    CHECK(jitter.concealed == 4 && read_packet(&jitter, 5) == 5 && jitter.conceal_run == 0,
+          "%u concealed, next packet played %d", jitter.concealed, jitter.conceal_run);
+    // Reading a concealed packet again gives the same concealment, it is not counted again
+    group_jitter_read(&jitter, 5 * GROUP_PACKET_FRAMES + 100, 10, out);
+    CHECK(jitter.concealed == 4 && out[0] == sample(5, 100), "reread of packet 5 gave %d", out[0]);
+
+    // A base that moved starts a new timeline and forgets the packets
+    push(&jitter, 0, 6);
+    CHECK(push(&jitter, 5000000, 40) == GROUP_PUSH_NEW_TIMELINE && jitter.read_seq == 40, "no new timeline");
+    CHECK(read_packet(&jitter, 40) == 40, "first packet of the new timeline");
+    CHECK(read_packet(&jitter, 41) != 6 && jitter.concealed == 5, "packet of the old timeline played");
+
+    // The packet number wraps, the position of the player does not
+    group_jitter_reset(&jitter);
+    const int64_t first = UINT32_MAX - 3;
+    uint32_t concealed = jitter.concealed;
+    wrong = 0;
+    for (int i = 0; i < 8; i++) {
+        wrong += push(&jitter, 0, (uint32_t)(first + i)) == GROUP_PUSH_DROPPED;
+    }
+    for (int i = 0; i < 8; i++) {
+        wrong += read_packet(&jitter, first + i) != (int)((first + i) % 64);
+    }
+    CHECK(wrong == 0 && jitter.concealed == concealed, "%d packets wrong across the wrap, %u concealed", wrong,
+          jitter.concealed - concealed);
+}
+
+static void test_player(void)
+{
+    group_jitter_t jitter;
+    group_player_t player;
+    memset(&player, 0, sizeof(player));
+    group_jitter_init(&jitter, slots, SLOT_COUNT);
+    group_player_render(&player, &jitter, 0, out, GROUP_PACKET_FRAMES);
+    CHECK(!player.locked && out[0] == 0, "played without a timeline");
+
+    // Locks on the frame of play_us and plays the packets in order at the nominal rate
+    for (uint32_t seq = 0; seq < 20; seq++) {
+        push(&jitter, 1000000, seq);
+    }
+    int64_t play_us = 1000000 + 2 * GROUP_PACKET_US;
+    int wrong = 0;
+    for (int i = 0; i < 10; i++, play_us += GROUP_PACKET_US) {
+        group_player_render(&player, &jitter, play_us, out, GROUP_PACKET_FRAMES);
+        wrong += out[0] != sample(2 + i, 0) ||
+                 out[(GROUP_PACKET_FRAMES - 1) * GROUP_CHANNELS] != sample(2 + i, GROUP_PACKET_FRAMES - 1);
+    }
+    CHECK(player.locked && wrong == 0 && player.resyncs == 0 && fabsf(player.ppm) < 0.01f,
+          "%d packets played wrong, %.3f ppm", wrong, player.ppm);
+
+    // An error below the limit is corrected by the rate, beyond it the player jumps
+    group_player_render(&player, &jitter, play_us + 1000, out, GROUP_PACKET_FRAMES);
+    CHECK(player.resyncs == 0 && player.ppm > 0, "1 ms late: %u resyncs, %.1f ppm", player.resyncs, player.ppm);
+    play_us += GROUP_PACKET_US;
+    group_player_render(&player, &jitter, play_us + (GROUP_RESYNC_FRAMES + 10) * 1000000LL / GROUP_RATE, out,
+                        GROUP_PACKET_FRAMES);
+    CHECK(player.resyncs == 1, "%u resyncs after a jump of 10 ms", player.resyncs);
+    group_player_reset(&player);
+    CHECK(!player.locked, "locked after a reset");
+}
+
+/* A speaker of the simulation, all times in true microseconds unless named local */
+typedef struct {
+    double clock_offset_us;     /* Its clock minus the true time at 0 */
+    double clock_ppm;           /* Drift of its clock */
+    double dac_ppm;             /* Rate of its DAC off its clock */
+    double start_us;            /* When its DAC started */
+    int64_t written;            /* Frames handed to the DAC */
+    group_clock_t clock;
+    group_jitter_t jitter;
+    group_player_t player;
+    group_slot_t slots[SLOT_COUNT];
+    struct {
+        double at;
+        uint32_t seq;
+    } pending[PENDING];
+    int pending_count;
+    double exchange_at;         /* Next clock request */
+    double response_at;         /* Pending response arrives, 0 for none */
+    int64_t exchange[4];
+    bool measured;
+    double error_us;            /* Heard minus due of the last render */
+} speaker_t;
+
+typedef struct {
+    double jitter_us;           /* Mean queueing delay of a hop */
+    double loss;                /* Of the audio packets */
+    double drift_ppm;           /* Largest drift of a clock */
+} network_t;
+
+typedef struct {
+    double mean_us;             /* Mean spread of the speakers */
+    double max_us;
+    uint32_t resyncs;
+    uint32_t concealed;
+    uint32_t sent;
+} group_result_t;
+
+static double local_clock(const speaker_t *s, double t)
+{
+    return s->clock_offset_us + t * (1 + s->clock_ppm / 1e6);
+}
+
+static double dac_rate(const speaker_t *s)
+{
+    return GROUP_RATE * (1 + (s->clock_ppm + s->dac_ppm) / 1e6) / 1e6;
+}
+
+/* Frames the DAC of a speaker still has to play at t */
+static double queued(const speaker_t *s, double t)
+{
+    double played = t < s->start_us ? 0 : (t - s->start_us) * dac_rate(s);
+    return s->written - played;
+}
+
+static void simulate(const network_t *net, int seed, group_result_t *r)
+{
+    static speaker_t speakers[SPEAKERS];
+    srand(seed);
+    memset(r, 0, sizeof(*r));
+    for (int i = 0; i < SPEAKERS; i++) {
+        speaker_t *s = &speakers[i];
+        memset(s, 0, sizeof(*s));
+        // Speaker 0 leads, its clock is the true time
+        if (i > 0) {
+            s->clock_offset_us = (uniform() - 0.5) * 1e9;
+            s->clock_ppm = (2 * uniform() - 1) * net->drift_ppm;
+        }
+        s->dac_ppm = (2 * uniform() - 1) * 20;
+        s->start_us = uniform() * 100000;
+        s->exchange_at = 1000 + uniform() * 125000;
+        group_clock_reset(&s->clock);
+        group_jitter_init(&s->jitter, s->slots, SLOT_COUNT);
+    }
+
+    const double base_us = DELAY_US + 1000;
+    uint32_t next_seq = 0;
+    double spread_sum = 0;
+    int spread_count = 0;
+    for (int64_t step = 0; step * STEP_US < SIM_S * 1000000LL; step++) {
+        double t = step * (double)STEP_US;
+        bool settled = t >= SETTLE_S * 1000000.0;
+
+        // The leader sends a group delay ahead, plays its own packets without the network
+        while (base_us + next_seq * (double)GROUP_PACKET_US < t + DELAY_US) {
+            fill(next_seq);
+            group_jitter_push(&speakers[0].jitter, (int64_t)base_us, next_seq, pcm);
+            for (int i = 1; i < SPEAKERS; i++) {
+                speaker_t *s = &speakers[i];
+                if (uniform() < net->loss || s->pending_count == PENDING) {
+                    continue;
+                }
+                s->pending[s->pending_count].at = t + 500 + queueing(net->jitter_us);
+                s->pending[s->pending_count++].seq = next_seq;
+            }
+            next_seq++;
+            r->sent++;
+        }
+
+        for (int i = 0; i < SPEAKERS; i++) {
+            speaker_t *s = &speakers[i];
+            for (int k = 0; k < s->pending_count;) {
+                if (s->pending[k].at <= t) {
+                    fill(s->pending[k].seq);
+                    group_jitter_push(&s->jitter, (int64_t)base_us, s->pending[k].seq, pcm);
+                    s->pending[k] = s->pending[--s->pending_count];
+                } else {
+                    k++;
+                }
+            }
+
+            // Clock exchanges with queueing on both hops, the leader answers at once
+            if (i > 0 && s->response_at == 0 && t >= s->exchange_at) {
+                double up = 300 + queueing(net->jitter_us);
+                double down = 300 + queueing(net->jitter_us);
+                s->exchange[0] = (int64_t)local_clock(s, t);
+                s->exchange[1] = (int64_t)(t + up);
+                s->exchange[2] = (int64_t)(t + up + 40);
+                s->response_at = t + up + 40 + down;
+                s->exchange_at += GROUP_CLOCK_INTERVAL_MS * 1000;
+            }
+            if (s->response_at != 0 && t >= s->response_at) {
+                s->exchange[3] = (int64_t)local_clock(s, t);
+                group_clock_add(&s->clock, s->exchange[0], s->exchange[1], s->exchange[2], s->exchange[3]);
+                s->response_at = 0;
+            }
+
+            // The writer renders a packet whenever the DMA buffer has room for it
+            while (t >= s->start_us && queued(s, t) <= DMA_FRAMES - GROUP_PACKET_FRAMES) {
+                double local = local_clock(s, t);
+                // What the playback clock reports: the queued frames at the nominal rate, in local time
+                double latency = queued(s, t) * 1e6 / GROUP_RATE;
+                int64_t offset = 0;
+                bool known = i == 0 || group_clock_get(&s->clock, (int64_t)local, &offset, NULL);
+                int64_t first = s->player.pos;
+                double frac = s->player.frac / 4294967296.0;
+                uint32_t resyncs = s->player.resyncs;
+                if (known) {
+                    group_player_render(&s->player, &s->jitter, (int64_t)(local + latency) + offset, out,
+                                        GROUP_PACKET_FRAMES);
+                } else {
+                    s->player.locked = false;
+                }
+                if (known && s->player.locked && s->player.resyncs == resyncs) {
+                    // Frame first + frac of the timeline is heard when the DAC reaches written
+                    double heard = s->start_us + s->written / dac_rate(s);
+                    double due = base_us + (first + frac) * 1e6 / GROUP_RATE;
+                    s->error_us = heard - due;
+                    s->measured = true;
+                }
+                if (settled) {
+                    r->resyncs += s->player.resyncs - resyncs;
+                }
+                s->written += GROUP_PACKET_FRAMES;
+            }
+        }
+
+        // The spread every 10 ms, once every speaker has settled
+        if (settled && step % (10000 / STEP_US) == 0) {
+            double lo = 1e18, hi = -1e18;
+            for (int i = 0; i < SPEAKERS; i++) {
+                lo = fmin(lo, speakers[i].error_us);
+                hi = fmax(hi, speakers[i].error_us);
+            }
+            spread_sum += hi - lo;
+            spread_count++;
+            r->max_us = fmax(r->max_us, hi - lo);
+        }
+    }
+    r->mean_us = spread_sum / spread_count;
+    for (int i = 0; i < SPEAKERS; i++) {
+        r->concealed += speakers[i].jitter.concealed;
+        CHECK(speakers[i].measured, "speaker %d never played in sync", i);
+    }
+}
+
+static void test_group(void)
+{
+    static const struct {
+        const char *name;
+        network_t net;
+        double mean_us, max_us;
+    } cases[] = {
+        { "quiet network", { 200, 0, 30 }, 150, 600 },
+        { "busy network", { 2000, 0.01, 30 }, 300, 1000 },
+        { "bad crystals", { 1000, 0.01, 50 }, 400, 1200 },
+    };
+    for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+        double mean = 0, max = 0;
+        uint32_t resyncs = 0, concealed = 0, sent = 0;
+        for (int seed = 1; seed <= 5; seed++) {
+            group_result_t r;
+            simulate(&cases[c].net, seed, &r);
+            mean += r.mean_us / 5;
+            max = fmax(max, r.max_us);
+            resyncs += r.resyncs;
+            concealed += r.concealed;
+            sent += r.sent;
+        }
+        printf("%-13s spread %3.0f us mean, %4.0f us max, %u resyncs, %.2f%% concealed\n", cases[c].name, mean,
+               max, resyncs, 100.0 * concealed / (sent * (SPEAKERS - 1)));
+        CHECK(mean < cases[c].mean_us && max < cases[c].max_us && resyncs == 0,
+              "%s: spread %.0f us mean, %.0f us max, %u resyncs", cases[c].name, mean, max, resyncs);
+        // Loss and the start are concealed, nothing comes late after the group delay
+        CHECK(concealed <= sent * (SPEAKERS - 1) * (cases[c].net.loss + 0.005), "%s: %u of %u concealed",
+              cases[c].name, concealed, sent * (SPEAKERS - 1));
+    }
+}
+
+int main(void)
+{
+    test_codec();
+    test_clock();
+    test_jitter();
+    test_player();
+    test_group();
+    return test_end();
+}
@@ -0,0 +1,215 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "lcd_glyphs.h"
+
+/*
+ * Renders frames into the emulated HD44780 and reads back what it shows: every text
+ * cell must hold its character and every glyph cell the right pixels, or a fallback
+ * character while the budget defers the upload. The byte count of the emulator must
+ * match what the cache says it sent. A VU meter animation runs the cache out of slots.
+ */
+
+static hd44780_t lcd;
+
+/* The pixels every glyph must show, the icons as drawn in lcd_glyphs.c */
+static void expected_bitmap(lcd_glyph_id_t g, uint8_t rows[8])
+{
+    static const uint8_t icons[][8] = {
+        [GLYPH_INTERNET_RADIO] = {0x00, 0x06, 0x09, 0x11, 0x15, 0x11, 0x09, 0x06},
+        [GLYPH_SAMPLER] = {0x00, 0x08, 0x18, 0x08, 0x0E, 0x0F, 0x0E, 0x0C},
+        [GLYPH_TUNER] = {0x00, 0x04, 0x0E, 0x15, 0x15, 0x15, 0x1F, 0x1F},
+        [GLYPH_GROUP] = {0x00, 0x1B, 0x1B, 0x00, 0x1B, 0x1B, 0x1B, 0x00},
+        [GLYPH_MENU_PAGE] = {0x1F, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x1F},
+        [GLYPH_CURRENT_PAGE] = {0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F, 0x1F},
+        [GLYPH_ARROW] = {0x00, 0x04, 0x02, 0x1F, 0x1F, 0x02, 0x04, 0x00},
+    };
+    for (int r = 0; r < 8; r++) {
+        if (g <= GLYPH_ARROW) {
+            rows[r] = icons[g][r];
+        } else if (g >= GLYPH_HBAR_1 && g <= GLYPH_HBAR_4) {
+            rows[r] = (0x1F << (4 - (g - GLYPH_HBAR_1))) & 0x1F;
+        } else if (g >= GLYPH_VBAR_1 && g <= GLYPH_VBAR_7) {
+            rows[r] = r >= 7 - (int)(g - GLYPH_VBAR_1) ? 0x1F : 0;
+        } else if (g >= GLYPH_NEEDLE_0 && g <= GLYPH_NEEDLE_4) {
+            rows[r] = 0x10 >> (g - GLYPH_NEEDLE_0);
+        } else {
+            rows[r] = 0;
+        }
+    }
+}
+
+/* Checks every cell against the frame, returns the cells showing a fallback */
+static int check_screen(const lcd_frame_t *frame, const char *what)
+{
+    int fallbacks = 0;
+    int wrong = 0;
+    for (int y = 0; y < LCD_ROWS; y++) {
+        for (int x = 0; x < LCD_COLS; x++) {
+            uint16_t cell = frame->cells[y][x];
+            uint8_t shown = host_lcd_char(x, y);
+            if (!(cell & 0x100)) {
+                wrong += shown != cell;
+                continue;
+            }
+            lcd_glyph_id_t g = cell & 0xFF;
+            if (g == GLYPH_EMPTY || g == GLYPH_CURRENT_PAGE) {
+                // From the character ROM
+                wrong += shown != (g == GLYPH_EMPTY ? ' ' : 0xFF);
+                continue;
+            }
+            if (shown >= 8) {
+                fallbacks++;
+                continue;
+            }
+            uint8_t rows[8];
+            expected_bitmap(g, rows);
+            wrong += memcmp(host_lcd_cgram(shown), rows, 8) != 0;
+        }
+    }
+    CHECK(wrong == 0, "%s: %d cells wrong", what, wrong);
+    return fallbacks;
+}
+
+/* Renders a frame and checks the screen and the bytes sent */
+static int render(const lcd_frame_t *frame, const char *what)
+{
+    uint32_t before = host_lcd_bytes();
+    int bytes = lcd_glyphs_render(frame);
+    CHECK(bytes == (int)(host_lcd_bytes() - before) * LCD_GLYPHS_I2C_PER_LCD_BYTE, "%s: %d bytes counted, %d sent",
+          what, bytes, (int)(host_lcd_bytes() - before) * LCD_GLYPHS_I2C_PER_LCD_BYTE);
+    int fallbacks = check_screen(frame, what);
+    CHECK((fallbacks == 0) == lcd_glyphs_complete(), "%s: %d fallbacks, complete %d", what, fallbacks,
+          lcd_glyphs_complete());
+    return bytes;
+}
+
+static void test_menu(void)
+{
+    hd44780_init(&lcd);
+    lcd_glyphs_init(&lcd, 0);
+    lcd_frame_t frame;
+    lcd_frame_clear(&frame);
+    lcd_frame_puts(&frame, 2, 0, "Internet radio");
+    for (int i = 0; i < 4; i++) {
+        lcd_frame_put_glyph(&frame, 2 + 2 * i, 1, GLYPH_INTERNET_RADIO + i);
+        lcd_frame_put_glyph(&frame, 8 + i, 3, i == 1 ? GLYPH_CURRENT_PAGE : GLYPH_MENU_PAGE);
+    }
+    lcd_frame_put_glyph(&frame, 0, 0, GLYPH_ARROW);
+    lcd_frame_puts(&frame, 18, 2, "\x03x");
+
+    render(&frame, "menu");
+    lcd_glyphs_stats_t stats;
+    lcd_glyphs_get_stats(&stats);
+    CHECK(stats.uploads == 6 && lcd_glyphs_complete(), "%u uploads for 4 icons, the page and the arrow",
+          stats.uploads);
+    CHECK(host_lcd_char(18, 2) == ' ', "control codes in text do not reach CGRAM");
+    CHECK(render(&frame, "menu again") == 0, "the same frame again sends nothing");
+
+    // The arrow moves a row down, two cells change
+    lcd_frame_puts(&frame, 0, 0, " ");
+    lcd_frame_put_glyph(&frame, 0, 1, GLYPH_ARROW);
+    int bytes = render(&frame, "arrow");
+    CHECK(bytes == 4 * LCD_GLYPHS_I2C_PER_LCD_BYTE, "%d bytes for two cells on two rows", bytes);
+
+    // Written around the cache, then repaired
+    hd44780_gotoxy(&lcd, 0, 3);
+    hd44780_puts(&lcd, "garbage");
+    lcd_glyphs_invalidate_cells(0, 3, 7);
+    render(&frame, "repaired");
+}
+
+static void test_sharing(void)
+{
+    hd44780_init(&lcd);
+    lcd_glyphs_init(&lcd, 0);
+    lcd_frame_t frame;
+    lcd_frame_clear(&frame);
+    // A bar of 1 step and the needle at the left of a cell look the same
+    lcd_frame_hbar(&frame, 0, 0, 10, 1, 50);
+    lcd_frame_needle(&frame, 0, 1, 10, 0, 100);
+    lcd_frame_hbar(&frame, 0, 2, 10, 50, 50);
+    lcd_frame_vbar(&frame, 0, 3, 8);
+    lcd_frame_vbar(&frame, 1, 3, 0);
+    render(&frame, "sharing");
+    lcd_glyphs_stats_t stats;
+    lcd_glyphs_get_stats(&stats);
+    CHECK(stats.uploads == 1, "%u uploads, full and empty cells come from the ROM", stats.uploads);
+    CHECK(host_lcd_char(0, 0) == host_lcd_char(0, 1), "one slot for the same pixels");
+}
+
+static void test_budget(void)
+{
+    hd44780_init(&lcd);
+    lcd_glyphs_init(&lcd, LCD_GLYPHS_DEFAULT_BUDGET);
+    lcd_frame_t frame;
+    lcd_frame_clear(&frame);
+    lcd_frame_puts(&frame, 0, 0, "A full screen of new");
+    lcd_frame_puts(&frame, 0, 1, "text leaves room for");
+    lcd_frame_puts(&frame, 0, 2, "one glyph upload....");
+    for (int i = 0; i < 7; i++) {
+        lcd_frame_vbar(&frame, i, 3, i + 1);
+    }
+    lcd_frame_put_glyph(&frame, 19, 3, GLYPH_ARROW);
+
+    int frames = 0;
+    int bytes;
+    do {
+        bytes = render(&frame, "budget");
+        frames++;
+        CHECK(bytes <= LCD_GLYPHS_DEFAULT_BUDGET, "frame %d sent %d bytes", frames, bytes);
+    } while (!lcd_glyphs_complete() && frames < 10);
+    lcd_glyphs_stats_t stats;
+    lcd_glyphs_get_stats(&stats);
+    CHECK(frames == 2 && stats.deferred == 7 && stats.uploads == 8, "complete after %d frames, %u deferred", frames,
+          stats.deferred);
+}
+
+/* A spectrum of 8 bars, a level bar and a needle that wander, and a title now and then */
+static void test_animation(void)
+{
+    hd44780_init(&lcd);
+    lcd_glyphs_init(&lcd, LCD_GLYPHS_DEFAULT_BUDGET);
+    srand(31);
+    int levels[8] = {0};
+    int level = 0;
+    int needle = 50;
+    int frames = 3000;
+    int incomplete = 0;
+    long bytes = 0;
+    for (int f = 0; f < frames; f++) {
+        lcd_frame_t frame;
+        lcd_frame_clear(&frame);
+        lcd_frame_puts(&frame, 0, 0, (f / 500) % 2 ? "Radio 1  12:34" : "NPO Klassiek 12:35");
+        for (int i = 0; i < 8; i++) {
+            levels[i] += rand() % 5 - 2;
+            levels[i] = levels[i] < 0 ? 0 : (levels[i] > 8 ? 8 : levels[i]);
+            lcd_frame_vbar(&frame, 2 * i, 1, levels[i]);
+        }
+        level += rand() % 9 - 4;
+        level = level < 0 ? 0 : (level > 100 ? 100 : level);
+        lcd_frame_hbar(&frame, 0, 2, 20, level, 100);
+        needle += rand() % 3 - 1;
+        needle = needle < 0 ? 0 : (needle > 100 ? 100 : needle);
+        lcd_frame_needle(&frame, 0, 3, 20, needle, 100);
+        bytes += render(&frame, "animation");
+        incomplete += !lcd_glyphs_complete();
+    }
+    lcd_glyphs_stats_t stats;
+    lcd_glyphs_get_stats(&stats);
+    printf("%d frames: %.2f uploads and %.0f bytes per frame, %u visible re-uploads, %d frames incomplete\n", frames,
+           (double)stats.uploads / frames, (double)bytes / frames, stats.visible_reuploads, incomplete);
+    CHECK(stats.frames == (uint32_t)frames && stats.i2c_bytes == (uint32_t)bytes, "statistics add up");
+    // Up to 7 bar heights, a partial level cell and a needle want more than 8 slots now and then
+    CHECK(incomplete < frames / 10, "%d of %d frames incomplete", incomplete, frames);
+}
+
+int main(void)
+{
+    test_menu();
+    test_sharing();
+    test_budget();
+    test_animation();
+    return test_end();
+}
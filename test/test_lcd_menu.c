@@ -0,0 +1,538 @@
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "lcd.h"
+#include "lcd_menu.h"
+#include "alarm_clock.h"
+#include "eq.h"
+#include "radio.h"
+#include "input_key_service.h"
+
+/*
+ * Walks the menu engine through its tables: the cursor wraps and the window follows it,
+ * submenus open at their current choice and stop at the depth limit, Back and the page
+ * keys, and what it draws. Then runs the menu task of lcd.c on the virtual clock with a
+ * script of keys, mode switches, playback and audio, the other modules faked below. The
+ * emulated display must show what the script expects, and the task must only wake for
+ * what changes the screen: never while idle, once a second for the time shown, ten times
+ * a second for the spectrum and once a key while the menu is open.
+ */
+
+static const uint8_t arrow_rows[8] = {0x00, 0x04, 0x02, 0x1F, 0x1F, 0x02, 0x04, 0x00};
+
+static int last_action = -1;
+static int checked_item = 4;
+
+static void action(int arg)
+{
+    last_action = arg;
+}
+
+static bool checked(int arg)
+{
+    return arg == checked_item;
+}
+
+static void draw_custom(lcd_frame_t *frame, int y, const lcd_menu_item_t *item)
+{
+    lcd_frame_puts(frame, 2, y, "custom");
+}
+
+static const lcd_menu_item_t choice_items[] = {
+    {"Zero", GLYPH_EMPTY, NULL, action, checked, 0},
+    {"One", GLYPH_EMPTY, NULL, action, checked, 1},
+    {"Two", GLYPH_EMPTY, NULL, action, checked, 2},
+    {"Three", GLYPH_EMPTY, NULL, action, checked, 3},
+    {"Four", GLYPH_EMPTY, NULL, action, checked, 4},
+    {"Five", GLYPH_EMPTY, NULL, action, checked, 5},
+};
+static const lcd_menu_page_t choice_page = {"Choice", choice_items, 6, NULL};
+
+static const lcd_menu_page_t deep_page;
+static const lcd_menu_item_t deep_items[] = {
+    {"Deeper", GLYPH_EMPTY, &deep_page, NULL, NULL, 0},
+};
+static const lcd_menu_page_t deep_page = {"Deep", deep_items, 1, NULL};
+
+static const lcd_menu_item_t first_items[] = {
+    {"Radio", GLYPH_INTERNET_RADIO, NULL, action, NULL, 10},
+    {"Choose", GLYPH_EMPTY, &choice_page, NULL, NULL, 0},
+    {"Deep", GLYPH_EMPTY, &deep_page, NULL, NULL, 0},
+    {"Label only", GLYPH_EMPTY, NULL, NULL, NULL, 0},
+    {"Five", GLYPH_EMPTY, NULL, action, NULL, 14},
+};
+static const lcd_menu_page_t first_page = {"First", first_items, 5, NULL};
+static const lcd_menu_page_t custom_page = {"Custom", first_items, 2, draw_custom};
+static const lcd_menu_page_t empty_page = {"Empty", NULL, 0, NULL};
+static const lcd_menu_page_t *const test_pages[] = {&first_page, &custom_page, &empty_page};
+
+/* A line of a frame, glyphs as # */
+static const char *frame_line(const lcd_frame_t *frame, int y)
+{
+    static char line[LCD_COLS + 1];
+    for (int x = 0; x < LCD_COLS; x++) {
+        uint16_t c = frame->cells[y][x];
+        line[x] = c == LCD_CELL_GLYPH(GLYPH_EMPTY) ? ' ' : c >= 0x100 ? '#' : (char)c;
+    }
+    line[LCD_COLS] = '\0';
+    return line;
+}
+
+static void test_engine(void)
+{
+    lcd_menu_t m;
+    lcd_menu_init(&m, test_pages, 3);
+    CHECK(lcd_menu_is_home(&m) && m.cursor[0] == 0, "not home after init");
+
+    // The window follows the cursor down, the cursor wraps both ways
+    int firsts[5];
+    for (int i = 0; i < 5; i++) {
+        lcd_menu_handle(&m, LCD_MENU_DOWN);
+        firsts[i] = m.first[0];
+    }
+    CHECK(firsts[0] == 0 && firsts[1] == 0 && firsts[2] == 1 && firsts[3] == 2 && firsts[4] == 0 &&
+          m.cursor[0] == 0, "window %d %d %d %d %d, cursor %d", firsts[0], firsts[1], firsts[2], firsts[3],
+          firsts[4], m.cursor[0]);
+    lcd_menu_handle(&m, LCD_MENU_UP);
+    CHECK(m.cursor[0] == 4 && m.first[0] == 2, "up from the top: cursor %d, window %d", m.cursor[0], m.first[0]);
+
+    // Actions get their argument, an item without one changes nothing
+    lcd_menu_handle(&m, LCD_MENU_ENTER);
+    CHECK(last_action == 14, "action %d", last_action);
+    lcd_menu_handle(&m, LCD_MENU_UP);
+    CHECK(!lcd_menu_handle(&m, LCD_MENU_ENTER), "Enter on a label did something");
+    CHECK(!lcd_menu_handle(&m, LCD_MENU_BACK) && lcd_menu_is_home(&m), "Back on a top level page");
+
+    // A submenu opens at its current choice with it in the window, Back returns to the item
+    lcd_menu_home(&m, 1);
+    CHECK(lcd_menu_handle(&m, LCD_MENU_ENTER) && m.depth == 1 && m.cursor[1] == 4 && m.first[1] == 2,
+          "submenu at depth %d, cursor %d, window %d", m.depth, m.cursor[1], m.first[1]);
+    CHECK(!lcd_menu_is_home(&m), "home in a submenu");
+    lcd_menu_handle(&m, LCD_MENU_ENTER);
+    CHECK(last_action == 4 && m.depth == 1, "choice %d at depth %d", last_action, m.depth);
+    lcd_menu_handle(&m, LCD_MENU_BACK);
+    CHECK(m.depth == 0 && m.cursor[0] == 1 && lcd_menu_is_home(&m), "back at depth %d, cursor %d", m.depth,
+          m.cursor[0]);
+    checked_item = -1;
+    lcd_menu_handle(&m, LCD_MENU_ENTER);
+    CHECK(m.cursor[1] == 0 && m.first[1] == 0, "submenu without a choice at %d", m.cursor[1]);
+
+    // The page keys close the submenus and wrap
+    lcd_menu_handle(&m, LCD_MENU_PREV_PAGE);
+    CHECK(m.page == 2 && m.depth == 0 && m.cursor[0] == 0, "previous page %d, depth %d", m.page, m.depth);
+    CHECK(!lcd_menu_handle(&m, LCD_MENU_DOWN) && !lcd_menu_handle(&m, LCD_MENU_ENTER), "moved on an empty page");
+    lcd_menu_handle(&m, LCD_MENU_NEXT_PAGE);
+    CHECK(m.page == 0, "next page %d", m.page);
+
+    // Submenus stop at the depth limit
+    lcd_menu_home(&m, 2);
+    int entered = 0;
+    while (lcd_menu_handle(&m, LCD_MENU_ENTER) && entered < 10) {
+        entered++;
+    }
+    CHECK(entered == LCD_MENU_DEPTH_MAX && m.depth == LCD_MENU_DEPTH_MAX, "%d submenus opened", entered);
+
+    // The page bar, the arrow, the icons, the marks of submenus and choices
+    lcd_frame_t frame;
+    lcd_frame_clear(&frame);
+    lcd_menu_home(&m, 1);
+    lcd_menu_draw_page_bar(&m, &frame, 0);
+    lcd_menu_draw_items(&m, &frame, true);
+    CHECK(frame.cells[0][0] == LCD_CELL_GLYPH(GLYPH_CURRENT_PAGE) &&
+          frame.cells[0][1] == LCD_CELL_GLYPH(GLYPH_MENU_PAGE) && strncmp(frame_line(&frame, 0) + 3, " First", 6) == 0,
+          "page bar \"%s\"", frame_line(&frame, 0));
+    CHECK(frame.cells[1][1] == LCD_CELL_GLYPH(GLYPH_INTERNET_RADIO) && frame.cells[1][0] == LCD_CELL_GLYPH(GLYPH_EMPTY) &&
+          frame.cells[2][0] == LCD_CELL_GLYPH(GLYPH_ARROW), "arrow or icon missing");
+    CHECK(strcmp(frame_line(&frame, 2), "#  Choose          >") == 0, "submenu line \"%s\"", frame_line(&frame, 2));
+    checked_item = 2;
+    lcd_menu_handle(&m, LCD_MENU_ENTER);
+    lcd_menu_draw_items(&m, &frame, false);
+    CHECK(strcmp(frame_line(&frame, 3), "   Two             *") == 0 && frame.cells[3][0] == LCD_CELL_GLYPH(GLYPH_EMPTY),
+          "choice line \"%s\"", frame_line(&frame, 3));
+    lcd_menu_handle(&m, LCD_MENU_NEXT_PAGE);
+    lcd_menu_draw_items(&m, &frame, true);
+    CHECK(strncmp(frame_line(&frame, 1) + 2, "custom", 6) == 0, "custom line \"%s\"", frame_line(&frame, 1));
+    CHECK(strcmp(frame_line(&frame, 3), "                    ") == 0, "line past the items \"%s\"",
+          frame_line(&frame, 3));
+}
+
+/* The modules lcd.c uses */
+
+#define TRACK_MS 200500
+
+static player_mode_t mode = PLAYER_MODE_NONE;
+static bool playing = false;
+static int64_t track_start_us = 0;
+static bool audio = false;
+static void (*audio_listener)(bool active) = NULL;
+static int station = 1;
+static int sleep_timer = 0;
+static const char *station_urls[] = {"http://radio.example:8000/live", "https://jazz.example/stream.mp3",
+                                     "news.example/aac"};
+
+/* What the display shows on a line, CGRAM characters as # */
+static const char *lcd_line(int y)
+{
+    static char line[LCD_COLS + 1];
+    for (int x = 0; x < LCD_COLS; x++) {
+        uint8_t c = host_lcd_char(x, y);
+        line[x] = c < 8 ? '#' : (char)c;
+    }
+    line[LCD_COLS] = '\0';
+    return line;
+}
+
+/* The line the arrow is on, -1 for none */
+static int arrow_line(void)
+{
+    for (int y = 1; y < LCD_ROWS; y++) {
+        uint8_t c = host_lcd_char(0, y);
+        if (c < 8 && memcmp(host_lcd_cgram(c), arrow_rows, 8) == 0) {
+            return y;
+        }
+    }
+    return -1;
+}
+
+/* A step of the script, at a time since the start */
+typedef struct {
+    int ms;
+    void (*fn)(int arg);
+    int arg;
+} step_t;
+
+#define KEY(k, action) (INPUT_KEY_USER_ID_##k * 16 + INPUT_KEY_SERVICE_ACTION_##action)
+
+static bool key_taken;
+static uint32_t key_frames;         /* Frames rendered when the last key came */
+static uint32_t key_bytes;          /* I2C bytes sent by then */
+static uint32_t wakeups[8];
+
+static lcd_glyphs_stats_t stats(void)
+{
+    lcd_glyphs_stats_t s;
+    lcd_glyphs_get_stats(&s);
+    return s;
+}
+
+static void key(int arg)
+{
+    lcd_glyphs_stats_t s = stats();
+    key_frames = s.frames;
+    key_bytes = s.i2c_bytes;
+    key_taken = menu_handle_key(arg / 16, arg % 16);
+}
+
+static void start_track(int m)
+{
+    mode_manager_switch((player_mode_t)m);
+    playing = true;
+    track_start_us = host_time_us();
+    menu_refresh();
+}
+
+static void stop_track(int arg)
+{
+    playing = false;
+    menu_refresh();
+}
+
+static void set_audio(int active)
+{
+    audio = active;
+    audio_listener(audio);
+}
+
+/* Frames rendered by now, the wakeups of the task */
+static void mark(int i)
+{
+    wakeups[i] = stats().frames;
+}
+
+static void check_taken(int taken)
+{
+    CHECK(key_taken == taken, "key at %d ms %s", (int)(host_time_us() / 1000), taken ? "ignored" : "taken");
+}
+
+/* The time of the track ms after its start, on the line of the sampler */
+static void check_time(int ms)
+{
+    char want[32];
+    int rem = (TRACK_MS - ms) / 1000;
+    snprintf(want, sizeof(want), "%d:%02d -%d:%02d", ms / 1000 / 60, ms / 1000 % 60, rem / 60, rem % 60);
+    CHECK(strstr(lcd_line(2), want) != NULL, "%d ms into the track: \"%s\", expected %s", ms, lcd_line(2), want);
+}
+
+static void check_spectrum(int arg)
+{
+    CHECK(strstr(lcd_line(0), "Modes") == NULL && host_lcd_char(0, 0) == ' ', "no spectrum: \"%s\"", lcd_line(0));
+}
+
+/* The title of the page and the line of the arrow */
+static void check_page(int arrow)
+{
+    static const char *titles[] = {"Modes", "Stations", "Settings", "Sleep timer", "Equalizer"};
+    const char *title = titles[arrow / 16];
+    CHECK(strstr(lcd_line(0), title) != NULL && arrow_line() == arrow % 16, "%d ms: \"%s\" arrow on %d, expected %s on %d",
+          (int)(host_time_us() / 1000), lcd_line(0), arrow_line(), title, arrow % 16);
+}
+
+#define PAGE(title, line) ((title) * 16 + (line))
+enum { MODES, STATIONS, SETTINGS, SLEEP, EQUALIZER };
+
+/* Bytes sent for the frames of the last key, printed under a name */
+static void measure(int what)
+{
+    static const char *names[] = {"cursor move", "page change", "enter", "back"};
+    static const int limits[] = {40, 400, 400, 400};
+    lcd_glyphs_stats_t s = stats();
+    uint32_t bytes = s.i2c_bytes - key_bytes;
+    printf("%-11s %3u I2C bytes, %u frames\n", names[what], bytes, s.frames - key_frames);
+    CHECK(bytes > 0 && bytes <= (uint32_t)limits[what] && s.frames - key_frames <= 2, "%s: %u bytes in %u frames",
+          names[what], bytes, s.frames - key_frames);
+}
+
+static void check_stations(int arg)
+{
+    CHECK(strncmp(lcd_line(1) + 2, " radio.example", 14) == 0 && strncmp(lcd_line(2) + 2, " jazz.example", 13) == 0 &&
+          strncmp(lcd_line(3) + 2, " news.example", 13) == 0, "stations \"%s\" \"%s\" \"%s\"", lcd_line(1), lcd_line(2),
+          lcd_line(3));
+    // The station playing is marked
+    CHECK(lcd_line(1 + station)[LCD_COLS - 1] == '*', "station %d not marked", station);
+}
+
+static void check_selected(int arg)
+{
+    CHECK(station == 0 && mode == PLAYER_MODE_RADIO && lcd_line(1)[LCD_COLS - 1] == '*' &&
+          lcd_line(2)[LCD_COLS - 1] == ' ', "station %d, mode %d", station, mode);
+}
+
+static void check_sleep(int minutes)
+{
+    int line = minutes == 0 ? 1 : minutes == 15 ? 2 : 3;
+    CHECK(sleep_timer == minutes && lcd_line(line)[LCD_COLS - 1] == '*', "sleep timer %d, %d marked: \"%s\"",
+          sleep_timer, minutes, lcd_line(line));
+}
+
+static void check_eq(int preset)
+{
+    eq_preset_t active;
+    eq_get_active(&active);
+    CHECK(strcmp(active.name, eq_get_builtin((eq_builtin_t)preset)->name) == 0 &&
+          lcd_line(1 + preset)[LCD_COLS - 1] == '*', "equalizer %s", active.name);
+}
+
+static const step_t script[] = {
+    // Idle: nothing plays, the menu is closed
+    {5000, mark, 0},
+    {60000, mark, 1},
+    // The time of a track ticks over, the position and the remaining time on their own seconds
+    {60000, start_track, PLAYER_MODE_SDCARD},
+    {60500, check_page, PAGE(MODES, 2)},
+    {90300, check_time, 30300},
+    {90520, check_time, 30520},
+    {91020, check_time, 31020},
+    {120000, mark, 2},
+    // The spectrum while audio arrives
+    {120000, set_audio, 1},
+    {150000, check_spectrum, 0},
+    {180000, mark, 3},
+    {180000, set_audio, 0},
+    {180500, check_time, 120500},
+    {181000, key, KEY(VOLUP, CLICK_RELEASE)},
+    {181000, check_taken, false},
+    // The menu: open, move, change pages, select, enter, back
+    {190000, mark, 4},
+    {190000, key, KEY(MODE, PRESS)},
+    {190000, check_taken, true},
+    {190500, check_page, PAGE(MODES, 2)},
+    {191000, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {191500, measure, 0},
+    {191500, check_page, PAGE(MODES, 3)},
+    {192000, key, KEY(MODE, CLICK_RELEASE)},
+    {192500, measure, 1},
+    {192500, check_page, PAGE(STATIONS, 1)},
+    {192500, check_stations, 0},
+    {193000, key, KEY(PLAY, CLICK_RELEASE)},
+    {193500, check_selected, 0},
+    {194000, key, KEY(MODE, CLICK_RELEASE)},
+    {194500, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {195000, key, KEY(PLAY, CLICK_RELEASE)},
+    {195500, measure, 2},
+    {195500, check_page, PAGE(SLEEP, 1)},
+    {195500, check_sleep, 0},
+    {196000, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {196500, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {197000, key, KEY(PLAY, CLICK_RELEASE)},
+    {197500, check_sleep, 30},
+    {198000, key, KEY(SET, CLICK_RELEASE)},
+    {198500, measure, 3},
+    {198500, check_page, PAGE(SETTINGS, 2)},
+    {199000, key, KEY(VOLUP, CLICK_RELEASE)},
+    {199500, key, KEY(PLAY, CLICK_RELEASE)},
+    {199700, check_page, PAGE(EQUALIZER, 1)},
+    {200000, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {200500, key, KEY(VOLDOWN, CLICK_RELEASE)},
+    {201000, key, KEY(PLAY, CLICK_RELEASE)},
+    {201500, check_eq, EQ_PRESET_VOICE},
+    {202000, key, KEY(SET, CLICK_RELEASE)},
+    {202500, key, KEY(SET, CLICK_RELEASE)},
+    {203000, check_page, PAGE(MODES, 1)},
+    {203000, key, KEY(VOLUP, CLICK_RELEASE)},
+    {203000, check_taken, false},
+    {204000, mark, 5},
+    // Without a key the menu closes after the timeout
+    {204000, stop_track, 0},
+    {210000, key, KEY(MODE, PRESS)},
+    {211000, key, KEY(MODE, CLICK_RELEASE)},
+    {211000 + LCD_MENU_TIMEOUT_MS - 100, check_page, PAGE(STATIONS, 1)},
+    {211000 + LCD_MENU_TIMEOUT_MS + 100, check_page, PAGE(MODES, 1)},
+    {225000, mark, 6},
+    {285000, mark, 7},
+};
+#define STEPS (int)(sizeof(script) / sizeof(script[0]))
+
+static int next_step = 0;
+
+/* Runs the next step of the script due by until_us */
+static bool run_step(int64_t until_us)
+{
+    if (next_step == STEPS || script[next_step].ms * 1000LL > until_us) {
+        return false;
+    }
+    const step_t *s = &script[next_step++];
+    if (s->ms * 1000LL > host_time_us()) {
+        host_set_time_us(s->ms * 1000LL);
+    }
+    s->fn(s->arg);
+    return true;
+}
+
+static void test_task(void)
+{
+    char log[4096];
+    host_capture_log(log, sizeof(log));
+    host_on_queue_wait(run_step);
+    xTaskCreate(menu, "menu", 4096, NULL, 5, NULL);
+    host_run_tasks_until(290000 * 1000LL);
+    host_on_queue_wait(NULL);
+    host_capture_log(NULL, 0);
+    CHECK(next_step == STEPS, "script stopped at step %d of %d", next_step, STEPS);
+
+    uint32_t idle = wakeups[1] - wakeups[0];
+    uint32_t time_shown = wakeups[2] - wakeups[1];
+    uint32_t spectrum = wakeups[3] - wakeups[2];
+    uint32_t open = wakeups[5] - wakeups[4];
+    uint32_t closed = wakeups[7] - wakeups[6];
+    printf("wakeups: %u idle, %u with the time, %u with the spectrum a minute, %u with the menu open for 14 s, "
+           "%u idle after\n", idle, time_shown, spectrum, open, closed);
+    CHECK(idle == 0 && closed == 0, "%u and %u wakeups while idle", idle, closed);
+    // The position and the remaining time tick over half a second apart
+    CHECK(time_shown >= 118 && time_shown <= 122, "%u wakeups a minute for the time", time_shown);
+    CHECK(spectrum >= 590 && spectrum <= 610, "%u wakeups a minute for the spectrum", spectrum);
+    // 24 keys and the time while the modes page shows it
+    CHECK(open <= 40, "%u wakeups with the menu open", open);
+}
+
+int main(void)
+{
+    test_engine();
+    test_task();
+    return test_end();
+}
+
+player_mode_t mode_manager_get_mode(void)
+{
+    return mode;
+}
+
+esp_err_t mode_manager_switch(player_mode_t m)
+{
+    mode = m;
+    menu_refresh();
+    return ESP_OK;
+}
+
+void mode_manager_lock(void)
+{
+}
+
+void mode_manager_unlock(void)
+{
+}
+
+void playback_clock_get(playback_position_t *pos)
+{
+    memset(pos, 0, sizeof(*pos));
+    pos->running = playing;
+    pos->duration_ms = TRACK_MS;
+    pos->position_ms = playing ? (host_time_us() - track_start_us) / 1000 : 0;
+    pos->remaining_ms = TRACK_MS - pos->position_ms;
+}
+
+bool vu_meter_get_frame(vu_frame_t *frame)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->active = audio;
+    frame->bands = 16;
+    for (int b = 0; b < frame->bands; b++) {
+        frame->band_db[b] = -48 + 3 * b;
+    }
+    frame->rms_db[0] = frame->rms_db[1] = -6;
+    return true;
+}
+
+void vu_meter_set_listener(void (*listener)(bool active))
+{
+    audio_listener = listener;
+}
+
+int radio_get_station(void)
+{
+    return station;
+}
+
+int radio_get_station_count(void)
+{
+    return sizeof(station_urls) / sizeof(station_urls[0]);
+}
+
+const char *radio_get_station_url(int index)
+{
+    return station_urls[index];
+}
+
+esp_err_t radio_select_station(int index)
+{
+    station = index;
+    return ESP_OK;
+}
+
+void alarm_clock_start_sleep_timer(int minutes)
+{
+    sleep_timer = minutes;
+}
+
+void alarm_clock_cancel_sleep_timer(void)
+{
+    sleep_timer = 0;
+}
+
+static eq_preset_t active_eq = {.name = "Flat"};
+static const eq_preset_t builtin_eq[EQ_PRESET_COUNT] = {{.name = "Flat"}, {.name = "LyraT speaker"}, {.name = "Voice"}};
+
+const eq_preset_t *eq_get_builtin(eq_builtin_t preset)
+{
+    return &builtin_eq[preset];
+}
+
+esp_err_t eq_apply(const eq_preset_t *preset, bool save)
+{
+    active_eq = *preset;
+    return ESP_OK;
+}
+
+void eq_get_active(eq_preset_t *preset)
+{
+    *preset = active_eq;
+}
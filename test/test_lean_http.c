@@ -0,0 +1,721 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "esp_timer.h"
+#include "mbedtls/ssl.h"
+#include "mbedtls/net_sockets.h"
+#include "mem_plan.h"
+#include "lean_http.h"
+
+/*
+ * Runs the client against servers on the socket stand-in: the request it sends, status
+ * lines and headers split anywhere, lines too long to keep, the body read with the head,
+ * answers that are not HTTP or never end, redirects, urls it refuses and servers that
+ * refuse, never answer or stall. mbedTLS is faked below with a handshake of one line each
+ * way, which carries the fragment length asked and the session offered, so the servers
+ * decide what the memory of the servers is tested against: resumption, a server that
+ * fails with the fragment length, one that refuses the session, and the plain HTTP
+ * fallback after failed handshakes but not after timeouts.
+ */
+
+#define TIMEOUT_MS 1000
+#define MAX_ROUTES 4
+#define IN_LEN 4096
+#define BODY_MAX 4096
+
+typedef struct {
+    const char *path;
+    const char *answer;
+} route_t;
+
+typedef struct {
+    const char *answer;             /* To every request, after the routes, NULL for none */
+    route_t routes[MAX_ROUTES];
+    bool tls;
+    bool fail_fragment;             /* Fails a handshake that asks for the fragment length */
+    bool fail_resume;               /* Fails a handshake that offers a session */
+    bool no_resume;                 /* Runs a full handshake when offered a session */
+    bool fail_always;
+    bool mute;                      /* Never answers the handshake */
+    // What the client sent
+    char in[IN_LEN];
+    int in_len;
+    bool hello_read;
+    char hello[64];                 /* Last handshake line */
+    char request[1024];             /* Last request */
+    int handshakes;
+    char session[16];               /* Of the last full handshake */
+} site_t;
+
+// The fake mbedTLS and mem_plan
+static int session_count = 0;
+static int ssl_inits = 0;
+static int ssl_frees = 0;
+static int close_notifies = 0;
+static bool setup_fails = false;
+static uint32_t tls_in_use = 20000;     /* Another TLS connection holds some */
+static uint32_t tls_peak = 20000;
+
+static lean_http_handle_t h;
+static char body[BODY_MAX];
+
+static void server(int fd, const char *data, int len, void *ctx)
+{
+    site_t *site = ctx;
+    if (data == NULL) {
+        site->in_len = 0;
+        site->hello_read = !site->tls;
+        return;
+    }
+    len = len < IN_LEN - 1 - site->in_len ? len : IN_LEN - 1 - site->in_len;
+    memcpy(site->in + site->in_len, data, len);
+    site->in_len += len;
+    site->in[site->in_len] = '\0';
+
+    if (!site->hello_read) {
+        char *eol = strchr(site->in, '\n');
+        if (eol == NULL) {
+            return;
+        }
+        *eol = '\0';
+        snprintf(site->hello, sizeof(site->hello), "%.*s", (int)sizeof(site->hello) - 1, site->in);
+        site->in_len -= eol + 1 - site->in;
+        memmove(site->in, eol + 1, site->in_len + 1);
+        site->hello_read = true;
+        site->handshakes++;
+        if (site->mute) {
+            return;
+        }
+        int code = -1;
+        char offered[48] = "-";
+        sscanf(site->hello, "HELLO %d %47s", &code, offered);
+        bool resume = strcmp(offered, "-") != 0;
+        if (site->fail_always || (site->fail_fragment && code != 0) || (site->fail_resume && resume)) {
+            host_socket_reply(fd, "FAIL\n", 5);
+            host_socket_end(fd);
+            return;
+        }
+        if (!resume || site->no_resume || strcmp(offered, site->session) != 0) {
+            snprintf(site->session, sizeof(site->session), "s%d", ++session_count);
+        }
+        char answer[32];
+        host_socket_reply(fd, answer, snprintf(answer, sizeof(answer), "OK %s\n", site->session));
+    }
+
+    char *end = strstr(site->in, "\r\n\r\n");
+    if (end == NULL) {
+        return;
+    }
+    snprintf(site->request, sizeof(site->request), "%.*s", (int)(end + 4 - site->in), site->in);
+    const char *answer = site->answer;
+    for (int i = 0; i < MAX_ROUTES && site->routes[i].path != NULL; i++) {
+        char line[128];
+        snprintf(line, sizeof(line), "GET %s HTTP/1.0\r\n", site->routes[i].path);
+        if (strncmp(site->request, line, strlen(line)) == 0) {
+            answer = site->routes[i].answer;
+        }
+    }
+    if (answer != NULL) {
+        host_socket_reply(fd, answer, strlen(answer));
+        host_socket_end(fd);
+    }
+}
+
+static void serve(const char *host, uint16_t port, site_t *site)
+{
+    host_socket_serve(host, port, server, site);
+}
+
+static esp_err_t open_url(const char *url, int64_t range_from, lean_http_response_t *response)
+{
+    return lean_http_open(h, url, range_from, TIMEOUT_MS, response);
+}
+
+/* Reads the body to its end in reads of at most len, returns its length or -1 */
+static int read_body(int len)
+{
+    int n = 0;
+    for (;;) {
+        int r = lean_http_read(h, body + n, len < BODY_MAX - 1 - n ? len : BODY_MAX - 1 - n);
+        if (r <= 0) {
+            body[n] = '\0';
+            return r == 0 ? n : -1;
+        }
+        n += r;
+    }
+}
+
+static void test_get(void)
+{
+    static char answer[3000];
+    static char content[2000];
+    for (int i = 0; i < (int)sizeof(content) - 1; i++) {
+        content[i] = 'a' + i % 26;
+    }
+    snprintf(answer, sizeof(answer),
+             "HTTP/1.1 200 OK\r\nContent-Type: audio/mpeg\r\nContent-Length: %d\r\nAccept-Ranges: bytes\r\n\r\n%s",
+             (int)strlen(content), content);
+    static site_t site = { .answer = answer };
+    serve("radio.example", 80, &site);
+
+    // The head and the body split anywhere, the first bytes of the body come with the head
+    static const int chunks[] = { 0, 1, 3, 7, 100 };
+    for (int i = 0; i < 5; i++) {
+        host_socket_set_read_chunk(chunks[i]);
+        lean_http_response_t response;
+        esp_err_t err = open_url("http://radio.example/live.mp3", 0, &response);
+        CHECK(err == ESP_OK && response.status == 200 && response.content_length == (int64_t)strlen(content) &&
+              response.accept_ranges, "chunk %d: %d, status %d, length %lld, ranges %d", chunks[i], err,
+              response.status, (long long)response.content_length, response.accept_ranges);
+        CHECK(strcmp(site.request, "GET /live.mp3 HTTP/1.0\r\nHost: radio.example\r\n"
+                                   "User-Agent: ESP32 HTTP Client/1.0\r\n\r\n") == 0,
+              "chunk %d: request %s", chunks[i], site.request);
+        int n = read_body(1 + i * 300);
+        CHECK(n == (int)strlen(content) && strcmp(body, content) == 0, "chunk %d: body of %d bytes", chunks[i], n);
+        CHECK(lean_http_read(h, body, 10) == 0, "chunk %d: read after the end", chunks[i]);
+        lean_http_stats_t stats;
+        lean_http_get_stats(h, &stats);
+        CHECK(!stats.tls && !stats.plain_fallback && stats.max_fragment_len == 0, "chunk %d: stats of TLS",
+              chunks[i]);
+        lean_http_close(h);
+        lean_http_close(h);
+    }
+    host_socket_set_read_chunk(0);
+    CHECK(lean_http_read(h, body, 10) == -1, "read when closed");
+    CHECK(host_socket_open_count() == 0, "%d sockets open", host_socket_open_count());
+}
+
+static void test_request(void)
+{
+    static site_t site = { .answer = "HTTP/1.1 206 Partial Content\r\nContent-Length: 3\r\n\r\nabc" };
+    serve("files.example", 8000, &site);
+    lean_http_response_t response;
+    esp_err_t err = open_url("http://files.example:8000/a/b.mp3?x=1", 123456789012LL, &response);
+    CHECK(err == ESP_OK && response.status == 206 && response.content_length == 3 && !response.accept_ranges,
+          "%d, status %d", err, response.status);
+    CHECK(strcmp(site.request, "GET /a/b.mp3?x=1 HTTP/1.0\r\nHost: files.example:8000\r\n"
+                               "User-Agent: ESP32 HTTP Client/1.0\r\nRange: bytes=123456789012-\r\n\r\n") == 0,
+          "request %s", site.request);
+    lean_http_close(h);
+
+    // The root without a path
+    err = open_url("HTTP://files.example:8000", 0, &response);
+    CHECK(err == ESP_OK && strncmp(site.request, "GET / HTTP/1.0\r\n", 16) == 0, "request %s", site.request);
+    lean_http_close(h);
+}
+
+static void test_headers(void)
+{
+    // Names in any case, bare LF, lines longer than the buffer are skipped whole
+    static char answer[8000];
+    int len = snprintf(answer, sizeof(answer), "ICY 200 OK\nicy-name: Jazz\r\nX-Long: ");
+    for (int i = 0; i < 3000; i++) {
+        answer[len++] = 'x';
+    }
+    len += snprintf(answer + len, sizeof(answer) - len, "\r\ncontent-length:42\nX-Line: ");
+    for (int i = 0; i < 700; i++) {
+        answer[len++] = i % 10 + '0';
+    }
+    snprintf(answer + len, sizeof(answer) - len, "\r\nACCEPT-RANGES:  Bytes\r\nLocation: /x\r\n\r\nbody");
+    static site_t site = { .answer = answer };
+    serve("icy.example", 80, &site);
+    static const int chunks[] = { 0, 1, 511, 512, 513 };
+    for (int i = 0; i < 5; i++) {
+        host_socket_set_read_chunk(chunks[i]);
+        lean_http_response_t response;
+        esp_err_t err = open_url("http://icy.example/", 0, &response);
+        int n = err == ESP_OK ? read_body(64) : -1;
+        CHECK(err == ESP_OK && response.status == 200 && response.content_length == 42 && response.accept_ranges &&
+              n == 4 && strcmp(body, "body") == 0, "chunk %d: %d, status %d, length %lld, ranges %d, body %d",
+              chunks[i], err, response.status, (long long)response.content_length, response.accept_ranges, n);
+        lean_http_close(h);
+    }
+    host_socket_set_read_chunk(0);
+
+    // No length for a live stream, the body starts with the head
+    static site_t live = { .answer = "HTTP/1.0 200 OK\r\nAccept-Ranges: none\r\n\r\n" };
+    serve("live.example", 80, &live);
+    lean_http_response_t response;
+    esp_err_t err = open_url("http://live.example/", 0, &response);
+    CHECK(err == ESP_OK && response.content_length == -1 && !response.accept_ranges && read_body(64) == 0,
+          "%d, length %lld, ranges %d", err, (long long)response.content_length, response.accept_ranges);
+    lean_http_close(h);
+}
+
+static void test_bad_answers(void)
+{
+    static char too_long[10000];
+    int len = snprintf(too_long, sizeof(too_long), "HTTP/1.1 200 OK\r\n");
+    while (len < 9000) {
+        len += snprintf(too_long + len, sizeof(too_long) - len, "X-Filler: %080d\r\n", len);
+    }
+    snprintf(too_long + len, sizeof(too_long) - len, "\r\n");
+    static site_t sites[] = {
+        { .answer = "SSH-2.0-OpenSSH_8.9\r\n\r\n" },
+        { .answer = "" },
+        { .answer = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n" },
+        { .answer = too_long },
+        { .answer = NULL },
+    };
+    static const char *names[] = { "not HTTP", "empty", "cut", "too long", "stalled" };
+    for (int i = 0; i < 5; i++) {
+        serve("bad.example", 8000 + i, &sites[i]);
+        char url[64];
+        snprintf(url, sizeof(url), "http://bad.example:%d/", 8000 + i);
+        lean_http_response_t response;
+        int64_t start = host_time_us();
+        esp_err_t err = open_url(url, 0, &response);
+        int ms = (host_time_us() - start) / 1000;
+        CHECK(err == ESP_FAIL && lean_http_read(h, body, 10) == -1, "%s: %d", names[i], err);
+        CHECK(ms == (sites[i].answer == NULL ? TIMEOUT_MS : 0), "%s: failed after %d ms", names[i], ms);
+    }
+    CHECK(host_socket_open_count() == 0, "%d sockets open", host_socket_open_count());
+}
+
+static void test_redirects(void)
+{
+    static site_t a = { .answer = "HTTP/1.1 302 Found\r\nLocation: http://b.example:8080/dir/new.mp3\r\n\r\n" };
+    static site_t b = {
+        .routes = {
+            { "/dir/new.mp3", "HTTP/1.1 301 Moved\r\nLocation: next/x.mp3\r\n\r\n" },
+            { "/dir/next/x.mp3", "HTTP/1.1 307 Temporary\r\nLocation: /top.mp3\r\n\r\n" },
+            { "/top.mp3", "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\ndone" },
+        },
+    };
+    serve("a.example", 80, &a);
+    serve("b.example", 8080, &b);
+    uint32_t connects = host_socket_connects();
+    lean_http_response_t response;
+    esp_err_t err = open_url("http://a.example/old", 1000, &response);
+    CHECK(err == ESP_OK && response.status == 200 && read_body(64) == 4 && strcmp(body, "done") == 0,
+          "%d, status %d", err, response.status);
+    CHECK(host_socket_connects() - connects == 4 && strstr(b.request, "GET /top.mp3 HTTP/1.0\r\n") == b.request &&
+          strstr(b.request, "Range: bytes=1000-\r\n") != NULL,
+          "%u connects, last request %s", host_socket_connects() - connects, b.request);
+    lean_http_close(h);
+
+    // The redirect is returned open after too many, or without a Location
+    static site_t loop = {
+        .routes = {
+            { "/loop", "HTTP/1.1 302 Found\r\nLocation: /loop\r\n\r\nmoved" },
+            { "/nowhere", "HTTP/1.1 303 See Other\r\n\r\n" },
+            { "/ftp", "HTTP/1.1 308 Permanent\r\nLocation: ftp://loop.example/x\r\n\r\n" },
+        },
+    };
+    serve("loop.example", 80, &loop);
+    connects = host_socket_connects();
+    err = open_url("http://loop.example/loop", 0, &response);
+    CHECK(err == ESP_OK && response.status == 302 && read_body(64) == 5,
+          "%d, status %d", err, response.status);
+    CHECK(host_socket_connects() - connects == LEAN_HTTP_MAX_REDIRECTS + 1, "%u connects",
+          host_socket_connects() - connects);
+    lean_http_close(h);
+    err = open_url("http://loop.example/nowhere", 0, &response);
+    CHECK(err == ESP_OK && response.status == 303, "%d, status %d", err, response.status);
+    lean_http_close(h);
+    err = open_url("http://loop.example/ftp", 0, &response);
+    CHECK(err != ESP_OK, "redirect to ftp: %d", err);
+    CHECK(host_socket_open_count() == 0, "%d sockets open", host_socket_open_count());
+}
+
+static void test_urls(void)
+{
+    static char long_url[300];
+    snprintf(long_url, sizeof(long_url), "http://radio.example/%0270d", 0);
+    static char long_host[100];
+    snprintf(long_host, sizeof(long_host), "http://%070d.example/", 0);
+    static const char *urls[] = {
+        "ftp://radio.example/a", "radio.example/a", "http://", "http:///a", "http://radio.example:0/",
+        "http://radio.example:65536/", "http://radio.example:x/", "http://radio.example?a", long_url, long_host,
+    };
+    uint32_t connects = host_socket_connects();
+    for (int i = 0; i < (int)(sizeof(urls) / sizeof(urls[0])); i++) {
+        lean_http_response_t response;
+        esp_err_t err = open_url(urls[i], 0, &response);
+        CHECK(err == ESP_ERR_INVALID_ARG, "%s: %d", urls[i], err);
+    }
+    CHECK(host_socket_connects() == connects && host_socket_open_count() == 0, "%u connects",
+          host_socket_connects() - connects);
+}
+
+static void test_connect_failures(void)
+{
+    static site_t stalled = { .answer = NULL };
+    host_socket_serve("down.example", 80, NULL, NULL);
+    serve("down.example", 81, &stalled);
+    static const struct {
+        const char *url;
+        int ms;
+    } cases[] = {
+        { "http://unknown.example/", 0 },
+        { "http://down.example:82/", 0 },           // Refused
+        { "http://down.example/", TIMEOUT_MS },     // The connect is not answered
+        { "http://down.example:81/", TIMEOUT_MS },  // Connected, the answer never comes
+    };
+    for (int i = 0; i < 4; i++) {
+        int64_t start = host_time_us();
+        lean_http_response_t response;
+        esp_err_t err = open_url(cases[i].url, 0, &response);
+        int ms = (host_time_us() - start) / 1000;
+        lean_http_stats_t stats;
+        lean_http_get_stats(h, &stats);
+        CHECK(err == ESP_FAIL && ms == cases[i].ms, "%s: %d after %d ms", cases[i].url, err, ms);
+        CHECK(stats.connect_ms == (i == 2 ? TIMEOUT_MS : 0), "%s: connect of %d ms", cases[i].url, stats.connect_ms);
+    }
+    CHECK(host_socket_open_count() == 0, "%d sockets open", host_socket_open_count());
+}
+
+/* Opens an https url and reads its body, returns the stats and the result */
+static esp_err_t open_tls(const char *url, lean_http_stats_t *stats)
+{
+    lean_http_response_t response;
+    esp_err_t err = open_url(url, 0, &response);
+    lean_http_get_stats(h, stats);
+    if (err == ESP_OK) {
+        read_body(1000);
+        lean_http_get_stats(h, stats);
+    }
+    lean_http_close(h);
+    return err;
+}
+
+static void test_tls(void)
+{
+    lean_http_cfg_t cfg = LEAN_HTTP_CFG_DEFAULT();
+    lean_http_init(&cfg);
+    static site_t secure = { .tls = true, .answer = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello" };
+    serve("secure.example", 443, &secure);
+
+    // A full handshake, then the session is resumed
+    lean_http_stats_t stats;
+    esp_err_t err = open_tls("https://secure.example/s.mp3", &stats);
+    CHECK(err == ESP_OK && strcmp(body, "hello") == 0 && strcmp(secure.hello, "HELLO 4 -") == 0,
+          "%d, hello %s", err, secure.hello);
+    CHECK(stats.tls && !stats.resumed && stats.max_fragment_len == 4096 && stats.handshake_ms == 80,
+          "tls %d, resumed %d, fragment %d, handshake %d ms", stats.tls, stats.resumed, stats.max_fragment_len,
+          stats.handshake_ms);
+    CHECK(strstr(secure.request, "\r\nHost: secure.example\r\n") != NULL, "request %s", secure.request);
+    // Against what mbedTLS held before, the other connection is not counted
+    CHECK(stats.tls_heap_peak == 36000 && stats.tls_heap == 1500 && stats.tls_heap_stream == 1500 + 4096,
+          "heap peak %u, after %u, streaming %u", stats.tls_heap_peak, stats.tls_heap, stats.tls_heap_stream);
+    char session[16];
+    snprintf(session, sizeof(session), "%s", secure.session);
+    err = open_tls("https://secure.example/s.mp3", &stats);
+    char hello[64];
+    snprintf(hello, sizeof(hello), "HELLO 4 %s", session);
+    CHECK(err == ESP_OK && strcmp(secure.hello, hello) == 0 && stats.resumed && stats.handshake_ms == 2 &&
+          stats.tls_heap_peak == 9000, "%d, hello %s, resumed %d, handshake %d ms, heap peak %u", err,
+          secure.hello, stats.resumed, stats.handshake_ms, stats.tls_heap_peak);
+    CHECK(ssl_inits == ssl_frees && close_notifies == ssl_inits && tls_in_use == 20000,
+          "%d contexts, %d freed, %d close notifies, %u bytes held", ssl_inits, ssl_frees, close_notifies,
+          tls_in_use);
+
+    // A server that does not resume runs a full handshake, it is not counted as resumed
+    static site_t forgetful = { .tls = true, .no_resume = true, .answer = "HTTP/1.1 200 OK\r\n\r\n" };
+    serve("forgetful.example", 443, &forgetful);
+    open_tls("https://forgetful.example/", &stats);
+    err = open_tls("https://forgetful.example/", &stats);
+    CHECK(err == ESP_OK && strcmp(forgetful.hello, "HELLO 4 -") != 0 && !stats.resumed && stats.handshake_ms == 80,
+          "%d, hello %s, resumed %d", err, forgetful.hello, stats.resumed);
+
+    // A server that fails on the session: the next handshake is a full one, with the fragment length
+    static site_t picky = { .tls = true, .fail_resume = true, .answer = "HTTP/1.1 200 OK\r\n\r\n" };
+    serve("picky.example", 443, &picky);
+    open_tls("https://picky.example/", &stats);
+    err = open_tls("https://picky.example/", &stats);
+    CHECK(err == ESP_FAIL && strncmp(picky.hello, "HELLO 4 s", 9) == 0, "%d, hello %s", err, picky.hello);
+    err = open_tls("https://picky.example/", &stats);
+    CHECK(err == ESP_OK && strcmp(picky.hello, "HELLO 4 -") == 0 && stats.max_fragment_len == 4096,
+          "%d, hello %s, fragment %d", err, picky.hello, stats.max_fragment_len);
+
+    // A server that fails with the fragment length is asked without it from then on
+    static site_t big = { .tls = true, .fail_fragment = true, .answer = "HTTP/1.1 200 OK\r\n\r\n" };
+    serve("big.example", 8443, &big);
+    err = open_tls("https://big.example:8443/", &stats);
+    CHECK(err == ESP_FAIL && stats.max_fragment_len == 4096, "%d, fragment %d", err, stats.max_fragment_len);
+    err = open_tls("https://big.example:8443/", &stats);
+    CHECK(err == ESP_OK && strcmp(big.hello, "HELLO 0 -") == 0 && stats.max_fragment_len == 0 &&
+          stats.tls_heap_stream == 1500 + 16384, "%d, hello %s, fragment %d, streaming %u", err, big.hello,
+          stats.max_fragment_len, stats.tls_heap_stream);
+    CHECK(strstr(big.request, "\r\nHost: big.example:8443\r\n") != NULL, "request %s", big.request);
+
+    // The least recently used of the servers is forgotten
+    static site_t others[LEAN_HTTP_SERVERS];
+    for (int i = 0; i < LEAN_HTTP_SERVERS; i++) {
+        char url[64];
+        snprintf(url, sizeof(url), "https://secure.example:%d/", 9000 + i);
+        others[i] = (site_t){ .tls = true, .answer = "HTTP/1.1 200 OK\r\n\r\n" };
+        serve("secure.example", 9000 + i, &others[i]);
+        open_tls(url, &stats);
+    }
+    err = open_tls("https://secure.example/s.mp3", &stats);
+    CHECK(err == ESP_OK && strcmp(secure.hello, "HELLO 4 -") == 0 && !stats.resumed, "%d, hello %s", err,
+          secure.hello);
+
+    setup_fails = true;
+    err = open_tls("https://secure.example/s.mp3", &stats);
+    setup_fails = false;
+    CHECK(err == ESP_ERR_NO_MEM, "setup failed: %d", err);
+    CHECK(ssl_inits == ssl_frees && tls_in_use == 20000 && host_socket_open_count() == 0,
+          "%d contexts, %d freed, %u bytes held, %d sockets open", ssl_inits, ssl_frees, tls_in_use,
+          host_socket_open_count());
+}
+
+static void test_plain_fallback(void)
+{
+    static site_t broken = { .tls = true, .fail_always = true };
+    static site_t plain = { .answer = "HTTP/1.1 200 OK\r\n\r\nplain" };
+    static site_t mute = { .tls = true, .mute = true };
+    serve("broken.example", 443, &broken);
+    serve("broken.example", 80, &plain);
+    serve("mute.example", 443, &mute);
+
+    // Off: the handshakes go on failing
+    lean_http_cfg_t cfg = LEAN_HTTP_CFG_DEFAULT();
+    lean_http_init(&cfg);
+    lean_http_stats_t stats;
+    for (int i = 0; i < 5; i++) {
+        esp_err_t err = open_tls("https://broken.example/live", &stats);
+        CHECK(err == ESP_FAIL && stats.tls && !stats.plain_fallback, "fallback off, open %d: %d", i, err);
+    }
+    CHECK(broken.handshakes == 5 && plain.request[0] == '\0', "%d handshakes, request %s", broken.handshakes,
+          plain.request);
+
+    // On: plain HTTP on port 80 after tls_failures failed handshakes in a row
+    cfg.plain_fallback = true;
+    lean_http_init(&cfg);
+    static site_t broken2 = { .tls = true, .fail_always = true };
+    static site_t plain2 = { .answer = "HTTP/1.1 200 OK\r\n\r\nplain" };
+    serve("broken2.example", 443, &broken2);
+    serve("broken2.example", 80, &plain2);
+    char log[1024] = "";
+    host_capture_log(log, sizeof(log));
+    for (int i = 0; i < cfg.tls_failures; i++) {
+        esp_err_t err = open_tls("https://broken2.example/live", &stats);
+        CHECK(err == ESP_FAIL && strcmp(broken2.hello, i == 0 ? "HELLO 4 -" : "HELLO 0 -") == 0,
+              "open %d: %d, hello %s", i, err, broken2.hello);
+    }
+    host_capture_log(NULL, 0);
+    CHECK(strstr(log, "using plain HTTP from now on") != NULL, "log %s", log);
+    esp_err_t err = open_tls("https://broken2.example/live", &stats);
+    CHECK(err == ESP_OK && strcmp(body, "plain") == 0 && !stats.tls && stats.plain_fallback &&
+          broken2.handshakes == cfg.tls_failures, "%d, tls %d, fallback %d, %d handshakes", err, stats.tls,
+          stats.plain_fallback, broken2.handshakes);
+    CHECK(strstr(plain2.request, "\r\nHost: broken2.example\r\n") != NULL, "request %s", plain2.request);
+
+    // A handshake that times out is not the server's fault
+    for (int i = 0; i < 5; i++) {
+        int64_t start = host_time_us();
+        err = open_tls("https://mute.example/", &stats);
+        int ms = (host_time_us() - start) / 1000;
+        CHECK(err == ESP_FAIL && stats.tls && strcmp(mute.hello, "HELLO 4 -") == 0 && ms == TIMEOUT_MS,
+              "timeout %d: %d, hello %s, after %d ms", i, err, mute.hello, ms);
+    }
+    CHECK(ssl_inits == ssl_frees && host_socket_open_count() == 0, "%d contexts, %d freed, %d sockets open",
+          ssl_inits, ssl_frees, host_socket_open_count());
+}
+
+int main(void)
+{
+    host_socket_reset();
+    lean_http_cfg_t cfg = LEAN_HTTP_CFG_DEFAULT();
+    lean_http_init(&cfg);
+    h = lean_http_create();
+    test_get();
+    test_request();
+    test_headers();
+    test_bad_answers();
+    test_redirects();
+    test_urls();
+    test_connect_failures();
+    test_tls();
+    test_plain_fallback();
+    lean_http_destroy(h);
+    return test_end();
+}
+
+/*
+ * mem_plan: the bytes mbedTLS holds, which the fake below moves.
+ */
+
+static void tls_hold(int32_t bytes)
+{
+    tls_in_use += bytes;
+    tls_peak = tls_in_use > tls_peak ? tls_in_use : tls_peak;
+}
+
+void mem_plan_tls_usage(uint32_t *in_use, uint32_t *peak)
+{
+    if (in_use != NULL) {
+        *in_use = tls_in_use;
+    }
+    if (peak != NULL) {
+        *peak = tls_peak;
+    }
+}
+
+void mem_plan_tls_reset_peak(void)
+{
+    tls_peak = tls_in_use;
+}
+
+/*
+ * mbedTLS: the client sends "HELLO <fragment code> <session or ->" and the server answers
+ * "OK <session>", the session it resumes or a new one, or "FAIL". A full handshake takes
+ * 80 ms and at most 36000 bytes, a resumed one 2 ms and 9000, the session then holds 1500
+ * and a read a record of the fragment length. The data goes through as it is.
+ */
+
+void mbedtls_ssl_session_init(mbedtls_ssl_session *session)
+{
+    memset(session, 0, sizeof(*session));
+}
+
+void mbedtls_ssl_session_free(mbedtls_ssl_session *session)
+{
+    memset(session, 0, sizeof(*session));
+}
+
+void mbedtls_ssl_config_init(mbedtls_ssl_config *conf)
+{
+    memset(conf, 0, sizeof(*conf));
+}
+
+int mbedtls_ssl_config_defaults(mbedtls_ssl_config *conf, int endpoint, int transport, int preset)
+{
+    conf->endpoint = endpoint;
+    return 0;
+}
+
+void mbedtls_ssl_config_free(mbedtls_ssl_config *conf)
+{
+}
+
+void mbedtls_ssl_conf_rng(mbedtls_ssl_config *conf, int (*f_rng)(void *, unsigned char *, size_t), void *p_rng)
+{
+    conf->f_rng = f_rng;
+    conf->p_rng = p_rng;
+}
+
+void mbedtls_ssl_conf_authmode(mbedtls_ssl_config *conf, int authmode)
+{
+    conf->authmode = authmode;
+}
+
+void mbedtls_ssl_conf_session_tickets(mbedtls_ssl_config *conf, int use_tickets)
+{
+    conf->session_tickets = use_tickets;
+}
+
+int mbedtls_ssl_conf_max_frag_len(mbedtls_ssl_config *conf, unsigned char mfl_code)
+{
+    conf->mfl_code = mfl_code;
+    return 0;
+}
+
+void mbedtls_ssl_init(mbedtls_ssl_context *ssl)
+{
+    memset(ssl, 0, sizeof(*ssl));
+    ssl_inits++;
+}
+
+int mbedtls_ssl_setup(mbedtls_ssl_context *ssl, const mbedtls_ssl_config *conf)
+{
+    ssl->conf = conf;
+    return setup_fails ? -0x7F00 : 0;
+}
+
+int mbedtls_ssl_set_hostname(mbedtls_ssl_context *ssl, const char *hostname)
+{
+    snprintf(ssl->hostname, sizeof(ssl->hostname), "%s", hostname);
+    return 0;
+}
+
+int mbedtls_ssl_set_session(mbedtls_ssl_context *ssl, const mbedtls_ssl_session *session)
+{
+    ssl->session = *session;
+    ssl->offered = 1;
+    return 0;
+}
+
+void mbedtls_ssl_set_bio(mbedtls_ssl_context *ssl, void *p_bio, mbedtls_ssl_send_t *f_send,
+                         mbedtls_ssl_recv_t *f_recv, mbedtls_ssl_recv_timeout_t *f_recv_timeout)
+{
+    ssl->p_bio = p_bio;
+    ssl->f_send = f_send;
+    ssl->f_recv = f_recv;
+}
+
+int mbedtls_ssl_handshake(mbedtls_ssl_context *ssl)
+{
+    unsigned char random[32];
+    ssl->conf->f_rng(ssl->conf->p_rng, random, sizeof(random));
+    char line[80];
+    int len = snprintf(line, sizeof(line), "HELLO %d %s\n", ssl->conf->mfl_code,
+                       ssl->offered ? (const char *)ssl->session.master : "-");
+    int r = ssl->f_send(ssl->p_bio, (const unsigned char *)line, len);
+    if (r < 0) {
+        return r;
+    }
+    len = 0;
+    while (len == 0 || line[len - 1] != '\n') {
+        r = len < (int)sizeof(line) - 1 ? ssl->f_recv(ssl->p_bio, (unsigned char *)line + len, 1) : -1;
+        if (r <= 0) {
+            return r < 0 ? r : MBEDTLS_ERR_NET_CONN_RESET;
+        }
+        len++;
+    }
+    line[len - 1] = '\0';
+    if (strncmp(line, "OK ", 3) != 0) {
+        return MBEDTLS_ERR_SSL_FATAL_ALERT_MESSAGE;
+    }
+    bool resumed = ssl->offered && strcmp((const char *)ssl->session.master, line + 3) == 0;
+    host_advance_us(resumed ? 2000 : 80000);
+    tls_hold(resumed ? 9000 : 36000);
+    tls_hold((resumed ? -9000 : -36000) + 1500);
+    memset(&ssl->session, 0, sizeof(ssl->session));
+    snprintf((char *)ssl->session.master, sizeof(ssl->session.master), "%s", line + 3);
+    ssl->handshake_done = 1;
+    return 0;
+}
+
+const mbedtls_ssl_session *mbedtls_ssl_get_session_pointer(const mbedtls_ssl_context *ssl)
+{
+    return &ssl->session;
+}
+
+int mbedtls_ssl_get_session(const mbedtls_ssl_context *ssl, mbedtls_ssl_session *session)
+{
+    *session = ssl->session;
+    return 0;
+}
+
+int mbedtls_ssl_read(mbedtls_ssl_context *ssl, unsigned char *buf, size_t len)
+{
+    static const int records[] = { 16384, 512, 1024, 2048, 4096 };
+    tls_hold(records[ssl->conf->mfl_code]);
+    tls_hold(-records[ssl->conf->mfl_code]);
+    int r = ssl->f_recv(ssl->p_bio, buf, len);
+    return r == 0 ? MBEDTLS_ERR_SSL_PEER_CLOSE_NOTIFY : r;
+}
+
+int mbedtls_ssl_write(mbedtls_ssl_context *ssl, const unsigned char *buf, size_t len)
+{
+    return ssl->f_send(ssl->p_bio, buf, len);
+}
+
+int mbedtls_ssl_close_notify(mbedtls_ssl_context *ssl)
+{
+    close_notifies++;
+    return 0;
+}
+
+void mbedtls_ssl_free(mbedtls_ssl_context *ssl)
+{
+    if (ssl->handshake_done) {
+        tls_hold(-1500);
+    }
+    memset(ssl, 0, sizeof(*ssl));
+    ssl_frees++;
+}
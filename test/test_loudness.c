@@ -0,0 +1,160 @@
+#include <math.h>
+#include <stdlib.h>
+#include "test.h"
+#include "loudness.h"
+
+/*
+ * Feeds sine tones to the meter and compares the readings with what BS.1770 gives for
+ * them: a 1 kHz tone at -23 dBFS in both channels is -23 LUFS at any sample rate, the
+ * relative gate leaves out the quiet parts of a track, the absolute gate leaves out
+ * silence, and the K-weighting lifts high tones and cuts low ones. The test signals
+ * of EBU Tech 3341 are built the same way.
+ */
+
+#define RATE 48000
+#define CHUNK 1024
+
+typedef struct {
+    double freq;
+    double dbfs;            /* Level of the tone in each channel */
+    double seconds;
+} tone_t;
+
+static int16_t pcm[CHUNK * 2];
+
+/* Feeds a tone in chunks of chunk frames, the phase runs on from *n */
+static void feed(loudness_meter_t *m, int rate, int channels, const tone_t *t, int chunk, int64_t *n)
+{
+    double amplitude = pow(10, t->dbfs / 20) * 32767;
+    int64_t frames = t->seconds * rate;
+    for (int64_t done = 0; done < frames; done += chunk) {
+        int len = frames - done < chunk ? frames - done : chunk;
+        for (int i = 0; i < len; i++) {
+            int16_t v = (int16_t)lround(amplitude * sin(2 * M_PI * t->freq * (*n + i) / rate));
+            for (int c = 0; c < channels; c++) {
+                pcm[i * channels + c] = v;
+            }
+        }
+        loudness_meter_process(m, pcm, len);
+        *n += len;
+    }
+}
+
+/* Returns the integrated loudness of a sequence of tones */
+static int measure(int rate, int channels, const tone_t *tones, int count)
+{
+    static loudness_meter_t m;
+    loudness_meter_init(&m, rate, channels);
+    int64_t n = 0;
+    for (int i = 0; i < count; i++) {
+        feed(&m, rate, channels, &tones[i], CHUNK, &n);
+    }
+    return loudness_meter_integrated(&m);
+}
+
+static void check_lufs(const char *what, int lufs10, double expect, double tolerance)
+{
+    printf("%s: %.1f LUFS\n", what, lufs10 / 10.0);
+    CHECK(lufs10 != LOUDNESS_UNKNOWN && fabs(lufs10 / 10.0 - expect) <= tolerance, "%s: %.1f LUFS, expected %.1f",
+          what, lufs10 / 10.0, expect);
+}
+
+static void test_reference(void)
+{
+    // The histogram bins are 0.25 LU wide
+    const tone_t tone = {1000, -23, 20};
+    check_lufs("1 kHz at -23 dBFS", measure(RATE, 2, &tone, 1), -23, 0.15);
+    check_lufs("at 44.1 kHz", measure(44100, 2, &tone, 1), -23, 0.15);
+    check_lufs("at 22.05 kHz", measure(22050, 2, &tone, 1), -23, 0.15);
+    // One channel holds half the energy of two
+    check_lufs("mono", measure(RATE, 1, &tone, 1), -26, 0.15);
+
+    // Tech 3341 case 2
+    const tone_t quiet = {1000, -33, 20};
+    check_lufs("1 kHz at -33 dBFS", measure(RATE, 2, &quiet, 1), -33, 0.15);
+}
+
+/* Tech 3341 cases 3 to 5, the quiet parts fall below the relative gate */
+static void test_gates(void)
+{
+    const tone_t case3[] = {{1000, -36, 10}, {1000, -23, 60}, {1000, -36, 10}};
+    check_lufs("-36, -23, -36 dBFS", measure(RATE, 2, case3, 3), -23, 0.15);
+    const tone_t case4[] = {{1000, -72, 10}, {1000, -36, 10}, {1000, -23, 60}, {1000, -36, 10}, {1000, -72, 10}};
+    check_lufs("-72, -36, -23, -36, -72 dBFS", measure(RATE, 2, case4, 5), -23, 0.15);
+    // Silence does not count, the gated loudness is that of the tone
+    const tone_t pauses[] = {{0, -100, 30}, {1000, -23, 10}, {0, -100, 30}};
+    check_lufs("a tone between silence", measure(RATE, 2, pauses, 3), -23, 0.15);
+
+    const tone_t silence = {0, -100, 10};
+    CHECK(measure(RATE, 2, &silence, 1) == LOUDNESS_UNKNOWN, "silence has no loudness");
+    const tone_t faint = {1000, -80, 10};
+    CHECK(measure(RATE, 2, &faint, 1) == LOUDNESS_UNKNOWN, "below the absolute gate");
+    const tone_t short_tone = {1000, -23, 0.3};
+    CHECK(measure(RATE, 2, &short_tone, 1) == LOUDNESS_UNKNOWN, "shorter than a block");
+}
+
+/* The shelf adds 4 dB above 2 kHz, 3.3 dB more than at 1 kHz, the high-pass takes away below 40 Hz */
+static void test_weighting(void)
+{
+    const tone_t mid = {1000, -23, 10};
+    const tone_t high = {10000, -23, 10};
+    const tone_t low = {20, -23, 10};
+    int at_1k = measure(RATE, 2, &mid, 1);
+    int at_10k = measure(RATE, 2, &high, 1);
+    int at_20 = measure(RATE, 2, &low, 1);
+    printf("10 kHz %+.1f LU, 20 Hz %+.1f LU of 1 kHz\n", (at_10k - at_1k) / 10.0, (at_20 - at_1k) / 10.0);
+    CHECK(at_10k - at_1k >= 30 && at_10k - at_1k <= 36, "10 kHz %+.1f LU", (at_10k - at_1k) / 10.0);
+    CHECK(at_1k - at_20 >= 100, "20 Hz %+.1f LU", (at_20 - at_1k) / 10.0);
+    // The filter follows the rate, up to the warping of the shelf near the Nyquist frequency
+    int at_10k_22k = measure(22050, 2, &high, 1);
+    CHECK(abs(at_10k_22k - at_10k) <= 5, "10 kHz at 22.05 kHz %+.1f LU", (at_10k_22k - at_1k) / 10.0);
+}
+
+/* The last 3 seconds, whatever came before */
+static void test_short_term(void)
+{
+    static loudness_meter_t m;
+    loudness_meter_init(&m, RATE, 2);
+    int64_t n = 0;
+    const tone_t loud = {1000, -23, 2.9};
+    feed(&m, RATE, 2, &loud, CHUNK, &n);
+    CHECK(loudness_meter_short_term(&m) == LOUDNESS_UNKNOWN, "not 3 seconds yet");
+    const tone_t rest = {1000, -23, 0.2};
+    feed(&m, RATE, 2, &rest, CHUNK, &n);
+    check_lufs("short-term", loudness_meter_short_term(&m), -23, 0.1);
+    const tone_t quiet = {1000, -33, 3};
+    feed(&m, RATE, 2, &quiet, CHUNK, &n);
+    check_lufs("short-term after 3 s quieter", loudness_meter_short_term(&m), -33, 0.1);
+    const tone_t silence = {0, -100, 3};
+    feed(&m, RATE, 2, &silence, CHUNK, &n);
+    CHECK(loudness_meter_short_term(&m) == LOUDNESS_UNKNOWN, "silence");
+    check_lufs("integrated over all", loudness_meter_integrated(&m), -25.5, 0.2);
+}
+
+/* The meter keeps its state between calls, how the audio is cut up does not matter */
+static void test_chunks(void)
+{
+    static loudness_meter_t whole, cut;
+    const tone_t tones[] = {{440, -20, 4}, {3000, -30, 3}};
+    loudness_meter_init(&whole, 44100, 2);
+    loudness_meter_init(&cut, 44100, 2);
+    int64_t n = 0, k = 0;
+    for (int i = 0; i < 2; i++) {
+        feed(&whole, 44100, 2, &tones[i], CHUNK, &n);
+        feed(&cut, 44100, 2, &tones[i], 7 + i * 300, &k);
+    }
+    CHECK(loudness_meter_integrated(&whole) == loudness_meter_integrated(&cut) &&
+              loudness_meter_short_term(&whole) == loudness_meter_short_term(&cut),
+          "integrated %d and %d, short-term %d and %d", loudness_meter_integrated(&whole),
+          loudness_meter_integrated(&cut), loudness_meter_short_term(&whole), loudness_meter_short_term(&cut));
+}
+
+int main(void)
+{
+    test_reference();
+    test_gates();
+    test_weighting();
+    test_short_term();
+    test_chunks();
+    return test_end();
+}
@@ -0,0 +1,312 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "mem_pool.h"
+
+/*
+ * Runs 10000 random mode, station and track switches in a model of the internal heap,
+ * a first fit heap that merges free neighbours like the one of IDF 4.4. Each reconnect
+ * allocates what mbedTLS does for a session, other modules replace the small blocks they
+ * keep. With the TLS pool of mem_plan.c no allocation may fail and no later window of
+ * 1000 switches may be more fragmented than the second, the first warms up.
+ */
+
+#define ARENA (150 * 1024)
+#define BOOT_KB 70
+#define SWITCHES 10000
+#define WINDOW 1000
+#define SEEDS 20
+#define STATIONS 8
+
+typedef struct block {
+    uint32_t size;          /* With the header */
+    uint32_t free;
+    struct block *next;     /* In address order */
+} block_t;
+
+#define HEADER sizeof(block_t)
+
+/* The classes of mem_plan.c with the record lengths of sdkconfig */
+static const mem_pool_class_cfg_t classes[] = {
+    { 64, 16 },
+    { 256, 28 },
+    { 640, 32 },
+    { 2048, 4 },
+    { 4096 + 512, 2 },
+    { 16384 + 512, 1 },
+};
+#define CLASSES (int)(sizeof(classes) / sizeof(classes[0]))
+
+static uint8_t arena[ARENA] __attribute__((aligned(8)));
+static block_t *heap;
+static mem_pool_t pool;
+static bool use_pool;
+static int failed;
+
+static void heap_init(void)
+{
+    heap = (block_t *)arena;
+    heap->size = ARENA;
+    heap->free = 1;
+    heap->next = NULL;
+}
+
+static void *heap_alloc(size_t size)
+{
+    size = (size + HEADER + 7) & ~7u;
+    for (block_t *b = heap; b; b = b->next) {
+        if (!b->free || b->size < size) {
+            continue;
+        }
+        if (b->size - size >= HEADER + 16) {
+            block_t *rest = (block_t *)((uint8_t *)b + size);
+            rest->size = b->size - size;
+            rest->free = 1;
+            rest->next = b->next;
+            b->size = size;
+            b->next = rest;
+        }
+        b->free = 0;
+        return (uint8_t *)b + HEADER;
+    }
+    failed++;
+    return NULL;
+}
+
+static void heap_free(void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    block_t *b = (block_t *)((uint8_t *)ptr - HEADER);
+    block_t *prev = NULL;
+    for (block_t *x = heap; x != b; x = x->next) {
+        prev = x;
+    }
+    b->free = 1;
+    if (b->next && b->next->free) {
+        b->size += b->next->size;
+        b->next = b->next->next;
+    }
+    if (prev && prev->free) {
+        prev->size += b->size;
+        prev->next = b->next;
+    }
+}
+
+/* Percentage of the free heap outside the largest free block */
+static int heap_fragmentation(size_t *largest)
+{
+    size_t free_bytes = 0;
+    *largest = 0;
+    for (block_t *b = heap; b; b = b->next) {
+        if (b->free) {
+            free_bytes += b->size - HEADER;
+            if (b->size - HEADER > *largest) {
+                *largest = b->size - HEADER;
+            }
+        }
+    }
+    return free_bytes ? 100 - (int)(*largest * 100 / free_bytes) : 0;
+}
+
+/* What esp_mbedtls_mem_calloc() does, the heap when the class is used up */
+static void *tls_alloc(size_t size)
+{
+    void *ptr = use_pool ? mem_pool_alloc(&pool, size) : NULL;
+    return ptr ? ptr : heap_alloc(size);
+}
+
+static void tls_free(void *ptr)
+{
+    if (ptr && !(use_pool && mem_pool_free(&pool, ptr))) {
+        heap_free(ptr);
+    }
+}
+
+typedef struct {
+    void *ssl, *conf, *in, *out, *session;
+} tls_t;
+
+/* Sizes that depend on the certificates of a station */
+static unsigned station_sizes[STATIONS][64];
+
+/* The context and record buffers live as long as the connection, the handshake state does not */
+static void tls_open(tls_t *t, int station)
+{
+    const unsigned *sizes = station_sizes[station];
+    t->ssl = tls_alloc(600);
+    t->conf = tls_alloc(380);
+    t->in = tls_alloc(16717);
+    t->out = tls_alloc(4429);
+    void *handshake = tls_alloc(1850);
+    void *temp[46];
+    int n = 0;
+    for (int c = 0; c < 3; c++) {
+        temp[n++] = tls_alloc(1100 + sizes[c] % 800);
+        temp[n++] = tls_alloc(620);
+    }
+    for (int i = 0; i < 40; i++) {
+        temp[n++] = tls_alloc(16 + sizes[3 + i] % 500);
+    }
+    t->session = tls_alloc(160);
+    while (n) {
+        tls_free(temp[--n]);
+    }
+    tls_free(handshake);
+}
+
+static void tls_close(tls_t *t)
+{
+    tls_free(t->in);
+    tls_free(t->out);
+    tls_free(t->ssl);
+    tls_free(t->conf);
+    tls_free(t->session);
+    memset(t, 0, sizeof(*t));
+}
+
+/* Blocks other modules keep across switches, a new one is allocated before the old one is freed */
+static void *kept[4];
+
+static void replace(int i, size_t size)
+{
+    void *ptr = heap_alloc(size);
+    heap_free(kept[i]);
+    kept[i] = ptr;
+}
+
+typedef struct {
+    double frag[SWITCHES / WINDOW];         /* Mean fragmentation of a window in percent */
+    double largest[SWITCHES / WINDOW];      /* Mean largest free block of a window */
+} windows_t;
+
+/* Returns whether a later window is more fragmented or has a smaller largest block than the second */
+static bool run(bool with_pool, unsigned seed, windows_t *w)
+{
+    srand(seed);
+    heap_init();
+    failed = 0;
+    use_pool = with_pool;
+    memset(kept, 0, sizeof(kept));
+    memset(w, 0, sizeof(*w));
+    if (with_pool) {
+        mem_pool_init(&pool, heap_alloc(mem_pool_region_size(classes, CLASSES)), classes, CLASSES);
+    }
+    // Pipelines, ring buffers and tasks reserved at boot
+    heap_alloc(BOOT_KB * 1024);
+    for (int s = 0; s < STATIONS; s++) {
+        for (int i = 0; i < 64; i++) {
+            station_sizes[s][i] = rand();
+        }
+    }
+
+    int station = 0;
+    bool radio = true;
+    tls_t tls = {0};
+    tls_open(&tls, station);
+    for (int i = 0; i < SWITCHES; i++) {
+        int op = rand() % 10;
+        if (op < 2) {
+            // Mode switch, the mode name on the LCD
+            if (radio) {
+                tls_close(&tls);
+            }
+            replace(0, radio ? 24 : 40);
+            if (!radio) {
+                tls_open(&tls, station);
+                replace(1, 40 + station_sizes[station][50] % 260);
+            }
+            radio = !radio;
+        } else if (op < 6 && radio) {
+            // Station change or reconnect, the url and name, then the ICY metadata
+            tls_close(&tls);
+            station = rand() % STATIONS;
+            replace(2, 64 + station_sizes[station][51] % 180);
+            tls_open(&tls, station);
+            replace(1, 40 + station_sizes[station][50] % 260);
+        } else {
+            // Track change and the status pushed to the web page
+            int track = rand() % 20;
+            replace(3, 40 + track * 9);
+            heap_free(heap_alloc(200 + track * 13));
+        }
+        size_t largest;
+        int frag = heap_fragmentation(&largest);
+        w->frag[i / WINDOW] += frag / (double)WINDOW;
+        w->largest[i / WINDOW] += largest / (double)WINDOW;
+    }
+
+    bool growth = false;
+    for (int i = 2; i < SWITCHES / WINDOW; i++) {
+        growth |= w->frag[i] > w->frag[1] + 1.0 || w->largest[i] < w->largest[1] * 0.98;
+    }
+    return growth;
+}
+
+static void test_switches(void)
+{
+    windows_t w;
+    int heap_growth = 0;
+    for (unsigned seed = 1; seed <= SEEDS; seed++) {
+        bool growth = run(true, seed, &w);
+        CHECK(failed == 0, "seed %u: %d allocations failed with the pool", seed, failed);
+        CHECK(!growth, "seed %u: fragmentation grew with the pool, %.1f%% after 2000 switches", seed, w.frag[1]);
+        if (seed == 1) {
+            printf("pool: %.1f%% fragmented, largest block %.0f bytes, peaks", w.frag[SWITCHES / WINDOW - 1],
+                   w.largest[SWITCHES / WINDOW - 1]);
+            for (int c = 0; c < CLASSES; c++) {
+                printf(" %u/%u", pool.classes[c].peak, pool.classes[c].count);
+            }
+            printf("\n");
+        }
+
+        heap_growth += run(false, seed, &w);
+        if (seed == 1) {
+            printf("heap: %.1f%% fragmented, largest block %.0f bytes\n", w.frag[SWITCHES / WINDOW - 1],
+                   w.largest[SWITCHES / WINDOW - 1]);
+        }
+    }
+    // Without the pool the model must show what the pool is for
+    printf("fragmentation grew in %d of %d runs without the pool\n", heap_growth, SEEDS);
+    CHECK(heap_growth >= SEEDS / 2, "only %d runs without the pool fragmented", heap_growth);
+}
+
+static void test_classes(void)
+{
+    static uint8_t region[64 * 1024] __attribute__((aligned(8)));
+    CHECK(mem_pool_region_size(classes, CLASSES) <= sizeof(region), "region size");
+    mem_pool_t p;
+    mem_pool_init(&p, region, classes, CLASSES);
+
+    // A full class does not take a block of the next
+    void *blocks[4];
+    for (int i = 0; i < 4; i++) {
+        blocks[i] = mem_pool_alloc(&p, 1500);
+    }
+    CHECK(mem_pool_alloc(&p, 1500) == NULL && p.classes[3].full == 1, "the 2048 class is used up");
+    CHECK(p.classes[4].used == 0, "the record buffer class was left alone");
+
+    void *small = mem_pool_alloc(&p, 1);
+    CHECK(small && p.classes[0].used == 1, "one byte from the smallest class");
+    CHECK(mem_pool_alloc(&p, 20000) == NULL, "nothing larger than every class");
+    void *in = mem_pool_alloc(&p, 16717);
+    CHECK(in && mem_pool_block_size(&p, in) == 16384 + 512, "the input record buffer");
+    CHECK(mem_pool_alloc(&p, 16717) == NULL, "one input record buffer");
+
+    for (int i = 0; i < 4; i++) {
+        CHECK(mem_pool_free(&p, blocks[i]), "block %d freed", i);
+    }
+    CHECK(mem_pool_free(&p, in) && mem_pool_free(&p, small), "freed");
+    CHECK(!mem_pool_free(&p, region + p.size) && !mem_pool_owns(&p, region + p.size), "not from the pool");
+    CHECK(p.classes[3].used == 0 && p.classes[3].peak == 4, "peak of the 2048 class");
+    // The last freed block comes back first
+    CHECK(mem_pool_alloc(&p, 1500) == blocks[3], "free list order");
+}
+
+int main(void)
+{
+    test_classes();
+    test_switches();
+    return test_end();
+}
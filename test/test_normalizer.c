@@ -0,0 +1,322 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "host.h"
+#include "test.h"
+#include "nvs_flash.h"
+#include "loudness.h"
+#include "normalizer.h"
+
+/*
+ * Writes WAV files of known loudness to a directory, lets the scan task measure them
+ * into NVS, then plays the same audio through the I2S write path and measures what
+ * comes out: a measured song must reach -18 LUFS with a steady Q12 gain, a quiet song
+ * with clicks is held at the limiter ceiling, a stream follows the running estimate at
+ * 1 dB a second, and unity gain is bit exact.
+ */
+
+#define CHUNK 1024
+#define TARGET_LUFS -18
+
+typedef struct {
+    const char *name;
+    int rate;
+    int channels;
+    int bits;
+    double dbfs;                /* Level of the 1 kHz tone */
+    double seconds;
+    bool clicks;                /* A full scale sample every second */
+} song_t;
+
+static const song_t songs[] = {
+    {"a_loud.wav", 48000, 2, 16, -12, 10, false},
+    {"b_mid.wav", 22050, 1, 8, -20, 10, false},
+    {"c_quiet.wav", 44100, 2, 16, -36, 10, true},
+};
+#define SONGS (int)(sizeof(songs) / sizeof(songs[0]))
+
+static char dir[256];
+static char captured[4096];
+static int16_t in[CHUNK * 2];
+static int16_t out[CHUNK * 2];
+
+static int16_t sample(const song_t *s, int64_t n)
+{
+    if (s->clicks && n % s->rate == s->rate / 2) {
+        return 32767;
+    }
+    return (int16_t)lround(pow(10, s->dbfs / 20) * 32767 * sin(2 * M_PI * 1000 * n / s->rate));
+}
+
+static void put_le(uint8_t *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static void write_wav(const char *name, const song_t *s)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "wb");
+    int frames = s->seconds * s->rate;
+    int block = s->channels * s->bits / 8;
+    uint8_t header[44];
+    memcpy(header, "RIFF\0\0\0\0WAVEfmt ", 16);
+    put_le(header + 4, 36 + frames * block, 4);
+    put_le(header + 16, 16, 4);
+    put_le(header + 20, 1, 2);
+    put_le(header + 22, s->channels, 2);
+    put_le(header + 24, s->rate, 4);
+    put_le(header + 28, s->rate * block, 4);
+    put_le(header + 32, block, 2);
+    put_le(header + 34, s->bits, 2);
+    memcpy(header + 36, "data", 4);
+    put_le(header + 40, frames * block, 4);
+    fwrite(header, 1, sizeof(header), f);
+    for (int i = 0; i < frames; i++) {
+        int16_t v = sample(s, i);
+        for (int c = 0; c < s->channels; c++) {
+            if (s->bits == 8) {
+                fputc((v >> 8) + 128, f);
+            } else {
+                fputc(v & 0xFF, f);
+                fputc(v >> 8, f);
+            }
+        }
+    }
+    fclose(f);
+}
+
+static void url_of(const char *name, char *url, int size)
+{
+    snprintf(url, size, "file:/%s/%s", dir, name);
+}
+
+/* What the scan reads in a file, the 8-bit samples lose their low byte */
+static int16_t heard(const song_t *s, int64_t n)
+{
+    int16_t v = sample(s, n);
+    return s->bits == 8 ? (int16_t)((v >> 8) * 256) : v;
+}
+
+typedef struct {
+    int in_lufs;
+    int out_lufs;
+    int peak;                   /* Largest output sample */
+    double gain_db[64];         /* Gain of every second, from the RMS out and in */
+    int seconds;
+    double chunk_db[512];       /* Gain of every chunk of the first 512 */
+    int clicks[16];             /* Chunks with a click */
+    int click_count;
+} played_t;
+
+/* Plays seconds of a song through the write path from frame start on */
+static void play(const song_t *s, double seconds, int64_t start, played_t *p)
+{
+    static loudness_meter_t in_meter, out_meter;
+    loudness_meter_init(&in_meter, s->rate, s->channels);
+    loudness_meter_init(&out_meter, s->rate, s->channels);
+    memset(p, 0, sizeof(*p));
+    double in_sum = 0, out_sum = 0;
+    int64_t frames = seconds * s->rate;
+    for (int64_t done = 0; done < frames; done += CHUNK) {
+        int len = frames - done < CHUNK ? frames - done : CHUNK;
+        for (int i = 0; i < len; i++) {
+            for (int c = 0; c < s->channels; c++) {
+                in[i * s->channels + c] = heard(s, start + done + i);
+            }
+        }
+        memcpy(out, in, len * s->channels * sizeof(int16_t));
+        normalizer_process((char *)out, len * s->channels * sizeof(int16_t));
+        loudness_meter_process(&in_meter, in, len);
+        loudness_meter_process(&out_meter, out, len);
+        double chunk_in = 0, chunk_out = 0;
+        for (int i = 0; i < len * s->channels; i++) {
+            p->peak = abs(out[i]) > p->peak ? abs(out[i]) : p->peak;
+            chunk_in += (double)in[i] * in[i];
+            chunk_out += (double)out[i] * out[i];
+            if (in[i] == 32767 && i % s->channels == 0 && p->click_count < 16) {
+                p->clicks[p->click_count++] = done / CHUNK;
+            }
+        }
+        if (done / CHUNK < 512) {
+            p->chunk_db[done / CHUNK] = 10 * log10(chunk_out / chunk_in);
+        }
+        in_sum += chunk_in;
+        out_sum += chunk_out;
+        // Once a second of audio
+        if ((done + len) / s->rate != done / s->rate && p->seconds < 64) {
+            p->gain_db[p->seconds++] = 10 * log10(out_sum / in_sum);
+            in_sum = out_sum = 0;
+        }
+    }
+    p->in_lufs = loudness_meter_integrated(&in_meter);
+    p->out_lufs = loudness_meter_integrated(&out_meter);
+}
+
+static int count_lines(const char *text, const char *what)
+{
+    int n = 0;
+    for (const char *p = strstr(text, what); p; p = strstr(p + 1, what)) {
+        n++;
+    }
+    return n;
+}
+
+static void test_scan(void)
+{
+    snprintf(dir + strlen(dir), sizeof(dir) - strlen(dir), "/normalizer_wav");
+    mkdir(dir, 0755);
+    for (int i = 0; i < SONGS; i++) {
+        write_wav(songs[i].name, &songs[i]);
+    }
+    char path[512];
+    snprintf(path, sizeof(path), "%s/d_broken.wav", dir);
+    FILE *f = fopen(path, "wb");
+    fputs("not a wav file at all", f);
+    fclose(f);
+    snprintf(path, sizeof(path), "%s/notes.txt", dir);
+    f = fopen(path, "wb");
+    fclose(f);
+
+    uint32_t entries = host_nvs_entries();
+    CHECK(normalizer_scan_start(dir) == ESP_OK, "scan started");
+    host_capture_log(captured, sizeof(captured));
+    host_run_tasks();
+    host_capture_log(NULL, 0);
+    printf("%s", captured);
+    CHECK(count_lines(captured, " LUFS, ") == SONGS, "%d songs measured", SONGS);
+    CHECK(host_nvs_entries() - entries == SONGS + 1, "%u results stored, one for the broken file",
+          host_nvs_entries() - entries);
+
+    // A scan after a restart skips what was measured
+    entries = host_nvs_entries();
+    captured[0] = '\0';
+    normalizer_scan_start(dir);
+    host_capture_log(captured, sizeof(captured));
+    host_run_tasks();
+    host_capture_log(NULL, 0);
+    CHECK(count_lines(captured, " LUFS, ") == 0 && host_nvs_entries() == entries, "nothing measured again");
+}
+
+static void test_fixed(void)
+{
+    char url[512];
+    int ceiling = lround(pow(10, -1 / 20.0) * 4096) * 32767 / 4096;
+    for (int i = 0; i < SONGS; i++) {
+        const song_t *s = &songs[i];
+        url_of(s->name, url, sizeof(url));
+        normalizer_set_format(s->rate, s->channels, 16);
+        normalizer_select_track(url);
+        played_t p;
+        play(s, s->seconds, 0, &p);
+        double expect = p.in_lufs / 10.0 + 12 < TARGET_LUFS ? p.in_lufs / 10.0 + 12 : TARGET_LUFS;
+        printf("%s: %.1f LUFS in, %.1f LUFS out, peak %d\n", s->name, p.in_lufs / 10.0, p.out_lufs / 10.0, p.peak);
+        // The limiter takes some of the 12 dB away after every click
+        double below = s->clicks ? 2 : 0.3;
+        CHECK(p.out_lufs / 10.0 <= expect + 0.3 && p.out_lufs / 10.0 >= expect - below, "%s: %.1f LUFS, expected %.1f",
+              s->name, p.out_lufs / 10.0, expect);
+        CHECK(p.peak <= ceiling, "%s: peak %d above the ceiling %d", s->name, p.peak, ceiling);
+        // The gain ramps in over the first buffer, then stays
+        double spread = 0;
+        for (int sec = 2; sec < p.seconds; sec++) {
+            spread = fmax(spread, fabs(p.gain_db[sec] - p.gain_db[1]));
+        }
+        if (!s->clicks) {
+            CHECK(spread < 0.01, "%s: the gain moved by %.3f dB", s->name, spread);
+            continue;
+        }
+        // The clicks hit the ceiling, the limiter lets go of the tone after them before the next
+        CHECK(p.peak >= ceiling - 8 && p.click_count == (int)s->seconds, "peak %d at the ceiling %d", p.peak,
+              ceiling);
+        int wrong = 0;
+        for (int c = 1; c < p.click_count; c++) {
+            double after = p.chunk_db[p.clicks[c] + 1];
+            double before = p.chunk_db[p.clicks[c] - 1];
+            wrong += after > 9 || fabs(before - 12) > 0.1;
+            if (c == 1) {
+                printf("%s: %.2f dB before a click, %.2f dB after\n", s->name, before, after);
+            }
+        }
+        CHECK(wrong == 0, "%d clicks not limited or not released", wrong);
+    }
+}
+
+static void test_follow(void)
+{
+    const song_t stream = {"stream", 48000, 2, 16, -30, 40, false};
+    normalizer_set_format(stream.rate, stream.channels, 16);
+    normalizer_follow_stream();
+    played_t p;
+    play(&stream, stream.seconds, 0, &p);
+    // 3 s before the estimate counts, then 1 dB a second up to the gain of the target
+    double target = TARGET_LUFS - p.in_lufs / 10.0;
+    double fastest = 0;
+    for (int sec = 1; sec < p.seconds; sec++) {
+        fastest = fmax(fastest, p.gain_db[sec] - p.gain_db[sec - 1]);
+    }
+    printf("stream: %.1f LUFS, gain %.2f dB after 3 s, %.2f dB after 10 s, %.2f dB at the end\n", p.in_lufs / 10.0,
+           p.gain_db[2], p.gain_db[9], p.gain_db[p.seconds - 1]);
+    CHECK(fabs(p.gain_db[1]) < 0.01, "unity until the estimate has 3 seconds, %.2f dB", p.gain_db[1]);
+    CHECK(fastest <= NORMALIZER_SLEW_DB_PER_S + 0.05, "%.2f dB in a second", fastest);
+    CHECK(fabs(p.gain_db[p.seconds - 1] - target) < 0.1, "%.2f dB at the end, %.2f dB wanted",
+          p.gain_db[p.seconds - 1], target);
+
+    // A song without a result follows too, the gain stays until its own estimate has 3 seconds
+    char url[512];
+    url_of("d_broken.wav", url, sizeof(url));
+    normalizer_select_track(url);
+    const song_t song = {"song", 48000, 2, 16, -24, 12, false};
+    play(&song, song.seconds, 0, &p);
+    double song_target = TARGET_LUFS - p.in_lufs / 10.0;
+    printf("song: %.2f dB after 2 s, %.2f dB at the end\n", p.gain_db[1], p.gain_db[p.seconds - 1]);
+    CHECK(fabs(p.gain_db[1] - target) < 0.1 && fabs(p.gain_db[p.seconds - 1] - song_target) < 0.1,
+          "%.2f dB after 2 s, %.2f dB at the end, %.2f dB wanted", p.gain_db[1], p.gain_db[p.seconds - 1],
+          song_target);
+}
+
+static void test_unity(void)
+{
+    const song_t s = {"sound", 48000, 2, 16, -3, 2, true};
+    normalizer_set_format(s.rate, s.channels, 16);
+    normalizer_bypass();
+    played_t p;
+    play(&s, 0.1, 0, &p);
+    // Back at unity after the ramp, the limiter released
+    play(&s, 1, s.rate, &p);
+    CHECK(p.peak == 32767 && memcmp(in, out, sizeof(in)) == 0, "bit exact at unity");
+
+    // 24-bit audio is not touched
+    char url[512];
+    url_of(songs[0].name, url, sizeof(url));
+    normalizer_select_track(url);
+    normalizer_set_format(s.rate, s.channels, 24);
+    play(&s, 0.5, 0, &p);
+    CHECK(memcmp(in, out, sizeof(in)) == 0, "24-bit passes");
+}
+
+int main(void)
+{
+    CHECK(getcwd(dir, sizeof(dir) - 32) != NULL, "working directory");
+    nvs_flash_init();
+    normalizer_cfg_t cfg = NORMALIZER_CFG_DEFAULT();
+    CHECK(normalizer_init(&cfg) == ESP_OK, "loudness store opened");
+    test_scan();
+    test_fixed();
+    test_follow();
+    test_unity();
+    return test_end();
+}
+
+/* The power governor is not under test */
+void power_governor_hold(void)
+{
+}
+
+void power_governor_release(void)
+{
+}
@@ -0,0 +1,238 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "test.h"
+#include "pcm_convert.h"
+
+/*
+ * Converts every 8 and 16-bit value, ramps and random samples of the wider formats and
+ * the float values that need clamping, and compares the result with the exact value:
+ * 8 and 16-bit must be equal, the rest within 1 LSB with an error of zero mean that
+ * also carries a level below 1 LSB. In place, out of place and every count up to a few
+ * blocks, then the throughput of the three dithered formats.
+ */
+
+#define MAX_SAMPLES 4096
+
+static int32_t in32[MAX_SAMPLES];
+static uint8_t in24[MAX_SAMPLES * 3];
+static float inf32[MAX_SAMPLES];
+static int16_t out[MAX_SAMPLES * 2];
+
+static void put_s24(uint8_t *p, int32_t x)
+{
+    p[0] = x >> 8;
+    p[1] = x >> 16;
+    p[2] = x >> 24;
+}
+
+/* The 16-bit value of a sample at 2^31 full scale, exactly */
+static double exact(int32_t x)
+{
+    return x / 65536.0;
+}
+
+static void test_formats(void)
+{
+    static const struct {
+        wav_file_info_t info;
+        pcm_format_t format;
+    } cases[] = {
+        {{ .format = WAV_FORMAT_PCM, .channels = 1, .bits = 8, .block_align = 1 }, PCM_FORMAT_U8},
+        {{ .format = WAV_FORMAT_PCM, .channels = 2, .bits = 16, .block_align = 4 }, PCM_FORMAT_S16},
+        {{ .format = WAV_FORMAT_PCM, .channels = 2, .bits = 24, .block_align = 6 }, PCM_FORMAT_S24},
+        {{ .format = WAV_FORMAT_PCM, .channels = 1, .bits = 32, .block_align = 4 }, PCM_FORMAT_S32},
+        {{ .format = WAV_FORMAT_IEEE_FLOAT, .channels = 2, .bits = 32, .block_align = 8 }, PCM_FORMAT_F32},
+        {{ .format = WAV_FORMAT_IEEE_FLOAT, .channels = 2, .bits = 64, .block_align = 16 }, PCM_FORMAT_NONE},
+        {{ .format = WAV_FORMAT_PCM, .channels = 2, .bits = 12, .block_align = 4 }, PCM_FORMAT_NONE},
+        {{ .format = 2, .channels = 2, .bits = 4, .block_align = 2048 }, PCM_FORMAT_NONE},
+        {{ .format = WAV_FORMAT_PCM, .channels = 6, .bits = 16, .block_align = 12 }, PCM_FORMAT_NONE},
+        {{ .format = WAV_FORMAT_PCM, .channels = 2, .bits = 24, .block_align = 8 }, PCM_FORMAT_NONE},
+    };
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        const wav_file_info_t *info = &cases[i].info;
+        CHECK(pcm_format_of(info) == cases[i].format, "format %d, %d bits, %d channels, block %d: %d, expected %d",
+              info->format, info->bits, info->channels, info->block_align, pcm_format_of(info), cases[i].format);
+    }
+}
+
+static void test_exact(void)
+{
+    pcm_convert_t conv;
+    // 8-bit grows, the input may sit in the second half of the output
+    uint8_t *u8 = (uint8_t *)out + 256;
+    for (int i = 0; i < 256; i++) {
+        u8[i] = i;
+    }
+    pcm_convert_init(&conv, PCM_FORMAT_U8);
+    pcm_convert_to_s16(&conv, u8, 256, out);
+    int wrong = 0;
+    for (int i = 0; i < 256; i++) {
+        wrong += out[i] != (i - 128) * 256;
+    }
+    CHECK(wrong == 0, "%d of 256 8-bit values wrong", wrong);
+
+    int16_t s16[MAX_SAMPLES];
+    for (int i = 0; i < 65536; i += MAX_SAMPLES) {
+        for (int j = 0; j < MAX_SAMPLES; j++) {
+            s16[j] = (int16_t)(i + j - 32768);
+        }
+        pcm_convert_init(&conv, PCM_FORMAT_S16);
+        pcm_convert_to_s16(&conv, s16, MAX_SAMPLES, out);
+        wrong += memcmp(out, s16, sizeof(s16)) != 0;
+        pcm_convert_to_s16(&conv, out, MAX_SAMPLES, out);
+        wrong += memcmp(out, s16, sizeof(s16)) != 0;
+    }
+    CHECK(wrong == 0, "16-bit changed");
+}
+
+typedef struct {
+    double sum;             /* Of the errors against the exact value */
+    double max;             /* Largest distance from the rounded value */
+    int count;
+} errors_t;
+
+static void add_errors(errors_t *e, const int32_t *x, const int16_t *y, int n)
+{
+    for (int i = 0; i < n; i++) {
+        // The clamp at full scale is not an error of the dither
+        double want = fmin(fmax(exact(x[i]), -32768), 32767);
+        e->sum += y[i] - want;
+        e->max = fmax(e->max, fabs(y[i] - floor(want + 0.5)));
+        e->count++;
+    }
+}
+
+/* Loads x into the input buffer of a format, floats at x / 2^31 */
+static const void *load(pcm_format_t format, const int32_t *x, int n)
+{
+    for (int i = 0; i < n; i++) {
+        put_s24(in24 + 3 * i, x[i]);
+        inf32[i] = x[i] / 2147483648.0f;
+    }
+    return format == PCM_FORMAT_S24 ? (const void *)in24 : format == PCM_FORMAT_F32 ? (const void *)inf32 : x;
+}
+
+static void test_dither(void)
+{
+    static const pcm_format_t formats[] = { PCM_FORMAT_S24, PCM_FORMAT_S32, PCM_FORMAT_F32 };
+    static const char *names[] = { "24-bit", "32-bit", "float" };
+    srand(46);
+    for (int f = 0; f < 3; f++) {
+        pcm_convert_t conv;
+        pcm_convert_init(&conv, formats[f]);
+        errors_t e = { 0 };
+        // Random samples over the whole range, and the extremes
+        for (int round = 0; round < 100; round++) {
+            for (int i = 0; i < MAX_SAMPLES; i++) {
+                in32[i] = (int32_t)((uint32_t)rand() << 16 ^ (uint32_t)rand()) & ~0xff;
+            }
+            in32[0] = INT32_MAX & ~0xff;
+            in32[1] = INT32_MIN;
+            if (formats[f] == PCM_FORMAT_F32) {
+                // A float has 24 bits of precision
+                for (int i = 0; i < MAX_SAMPLES; i++) {
+                    in32[i] = (int32_t)((float)in32[i]) == in32[i] ? in32[i] : 0;
+                }
+            }
+            pcm_convert_to_s16(&conv, load(formats[f], in32, MAX_SAMPLES), MAX_SAMPLES, out);
+            add_errors(&e, in32, out, MAX_SAMPLES);
+        }
+        printf("%-6s error mean %+.4f LSB, at most %.0f LSB from rounding\n", names[f], e.sum / e.count, e.max);
+        CHECK(e.max <= 1 && fabs(e.sum / e.count) < 0.01, "%s: error mean %+.4f, max %.3f LSB", names[f],
+              e.sum / e.count, e.max);
+
+        // A level of 0.3 LSB is kept by the dither, not rounded away
+        errors_t dc = { 0 };
+        for (int round = 0; round < 25; round++) {
+            for (int i = 0; i < MAX_SAMPLES; i++) {
+                in32[i] = (i & 1 ? 1 : -1) * (int32_t)(0.3 * 65536);
+            }
+            pcm_convert_to_s16(&conv, load(formats[f], in32, MAX_SAMPLES), MAX_SAMPLES, out);
+            add_errors(&dc, in32, out, MAX_SAMPLES);
+        }
+        double sum_left = 0;
+        for (int i = 0; i < MAX_SAMPLES; i += 2) {
+            sum_left += out[i];
+        }
+        CHECK(fabs(dc.sum / dc.count) < 0.02 && fabs(sum_left / (MAX_SAMPLES / 2) + 0.3) < 0.05,
+              "%s: -0.3 LSB reads %.3f", names[f], sum_left / (MAX_SAMPLES / 2));
+    }
+}
+
+/* Every count up to three blocks and a bit, in place and out of place agree */
+static void test_counts(void)
+{
+    static const pcm_format_t formats[] = { PCM_FORMAT_S24, PCM_FORMAT_S32, PCM_FORMAT_F32 };
+    static int32_t buf[256];
+    int wrong = 0;
+    for (int f = 0; f < 3; f++) {
+        for (int n = 1; n <= 3 * PCM_CONVERT_BLOCK + 5; n++) {
+            for (int i = 0; i < n; i++) {
+                in32[i] = (int32_t)(i * 0x01234567u) & ~0xff;
+            }
+            pcm_convert_t a, b;
+            pcm_convert_init(&a, formats[f]);
+            pcm_convert_init(&b, formats[f]);
+            const void *in = load(formats[f], in32, n);
+            memcpy(buf, in, n * (formats[f] == PCM_FORMAT_S24 ? 3 : 4));
+            pcm_convert_to_s16(&a, in, n, out);
+            pcm_convert_to_s16(&b, buf, n, (int16_t *)buf);
+            errors_t e = { 0 };
+            add_errors(&e, in32, out, n);
+            wrong += memcmp(out, buf, n * sizeof(int16_t)) != 0 || e.max > 1;
+        }
+    }
+    CHECK(wrong == 0, "%d counts convert differently in place or beyond 1 LSB", wrong);
+}
+
+/* Beyond full scale, infinity and NaN */
+static void test_float_clamp(void)
+{
+    static const float values[] = { 1.5f, -1.5f, 1.0f, -1.0f, INFINITY, -INFINITY, NAN, 0.0f };
+    static const int expect[] = { 32767, -32768, 32767, -32768, 32767, -32768, 0, 0 };
+    pcm_convert_t conv;
+    pcm_convert_init(&conv, PCM_FORMAT_F32);
+    int wrong = 0;
+    for (int round = 0; round < 1000; round++) {
+        memcpy(inf32, values, sizeof(values));
+        pcm_convert_to_s16(&conv, inf32, 8, out);
+        for (int i = 0; i < 8; i++) {
+            wrong += abs(out[i] - expect[i]) > 1;
+        }
+    }
+    CHECK(wrong == 0, "%d clamped values beyond 1 LSB", wrong);
+}
+
+static void test_throughput(void)
+{
+    static const pcm_format_t formats[] = { PCM_FORMAT_S24, PCM_FORMAT_S32, PCM_FORMAT_F32 };
+    static const char *names[] = { "s24", "s32", "f32" };
+    for (int i = 0; i < MAX_SAMPLES; i++) {
+        in32[i] = (int32_t)(i * 0x01234567u) & ~0xff;
+    }
+    for (int f = 0; f < 3; f++) {
+        const void *in = load(formats[f], in32, MAX_SAMPLES);
+        pcm_convert_t conv;
+        pcm_convert_init(&conv, formats[f]);
+        int rounds = 2000;
+        clock_t start = clock();
+        for (int r = 0; r < rounds; r++) {
+            pcm_convert_to_s16(&conv, in, MAX_SAMPLES, out);
+        }
+        double s = (double)(clock() - start) / CLOCKS_PER_SEC;
+        printf("%s %.0f Msamples/s\n", names[f], rounds * (double)MAX_SAMPLES / s / 1e6);
+    }
+}
+
+int main(void)
+{
+    test_formats();
+    test_exact();
+    test_dither();
+    test_counts();
+    test_float_clamp();
+    test_throughput();
+    return test_end();
+}
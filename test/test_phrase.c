@@ -0,0 +1,389 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include "test.h"
+#include "phrase.h"
+#include "playlist.h"
+
+/*
+ * Compares every phrase the talking clock can build with a reference speller written
+ * out word by word: every number -1 to 10000, every year, every second of the day in
+ * the three styles and every date from 1900 to 2099 after the longest time. A few
+ * sentences are spelled out by hand as well, so the reference and the rules cannot
+ * agree on a wrong wording.
+ */
+
+typedef char text_t[256];
+
+static const char *words[] = {
+    "en", "het is", "uur", "ongeldig", "honderd", "duizend", "kwart", "half", "over", "voor",
+    "seconde", "seconden", "'s nachts", "'s ochtends", "'s middags", "'s avonds",
+    "zondag", "maandag", "dinsdag", "woensdag", "donderdag", "vrijdag", "zaterdag",
+    "januari", "februari", "maart", "april", "mei", "juni", "juli", "augustus", "september",
+    "oktober", "november", "december",
+};
+
+static const char *dutch[] = {
+    "nul", "een", "twee", "drie", "vier", "vijf", "zes", "zeven", "acht", "negen", "tien",
+    "elf", "twaalf", "dertien", "veertien", "vijftien", "zestien", "zeventien", "achttien", "negentien",
+};
+
+static const char *tens[] = {
+    "", "", "twintig", "dertig", "veertig", "vijftig", "zestig", "zeventig", "tachtig", "negentig",
+};
+
+static int cases = 0;
+static int longest = 0;
+
+/* The text of a plan, numbers as digits */
+static void render(const phrase_plan_t *plan, text_t text)
+{
+    text[0] = '\0';
+    for (int i = 0; i < plan->count; i++) {
+        int clip = plan->clips[i];
+        size_t len = strlen(text);
+        const char *sep = i == 0 ? "" : " ";
+        if (clip < VOICE_CLIP_EN) {
+            snprintf(text + len, sizeof(text_t) - len, "%s%d", sep, clip);
+        } else if (clip - VOICE_CLIP_EN < (int)(sizeof(words) / sizeof(words[0]))) {
+            snprintf(text + len, sizeof(text_t) - len, "%s%s", sep, words[clip - VOICE_CLIP_EN]);
+        } else {
+            snprintf(text + len, sizeof(text_t) - len, "%s?%d", sep, clip);
+        }
+    }
+}
+
+/* The same text written as Dutch is written, "4 en 20 honderd" as "vierentwintighonderd" */
+static void spell(const text_t text, text_t out)
+{
+    char *tokens[PHRASE_MAX_CLIPS * 2];
+    int count = 0;
+    text_t copy;
+    strcpy(copy, text);
+    for (char *word = strtok(copy, " "); word != NULL && count < PHRASE_MAX_CLIPS * 2; word = strtok(NULL, " ")) {
+        tokens[count++] = word;
+    }
+    out[0] = '\0';
+    bool after_number = false;
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(out);
+        const char *sep = len == 0 ? "" : " ";
+        int num;
+        int ten;
+        if (sscanf(tokens[i], "%d", &num) != 1) {
+            bool group = strcmp(tokens[i], "honderd") == 0 || strcmp(tokens[i], "duizend") == 0;
+            snprintf(out + len, sizeof(text_t) - len, "%s%s", group && after_number ? "" : sep, tokens[i]);
+            after_number = false;
+            continue;
+        }
+        after_number = true;
+        // A unit, "en" and the tens are one word, after twee and drie the e of en gets a trema
+        if (num < 10 && i + 2 < count && strcmp(tokens[i + 1], "en") == 0 && sscanf(tokens[i + 2], "%d", &ten) == 1) {
+            const char *and = num == 2 || num == 3 ? "ën" : "en";
+            snprintf(out + len, sizeof(text_t) - len, "%s%s%s%s", sep, dutch[num], and, tens[ten / 10]);
+            i += 2;
+            continue;
+        }
+        snprintf(out + len, sizeof(text_t) - len, "%s%s", sep, num < 20 ? dutch[num] : tens[num / 10]);
+    }
+}
+
+static void append(text_t text, const char *format, ...)
+{
+    size_t len = strlen(text);
+    va_list args;
+    va_start(args, format);
+    vsnprintf(text + len, sizeof(text_t) - len, format, args);
+    va_end(args);
+}
+
+/* Reference speller, numbers as digits like render() */
+static void ref_below100(text_t out, int n)
+{
+    if (n < 20 || n % 10 == 0) {
+        append(out, " %d", n);
+    } else {
+        append(out, " %d en %d", n % 10, n - n % 10);
+    }
+}
+
+static void ref_number(text_t out, int n)
+{
+    int thousands = n / 1000;
+    int hundreds = n / 100 % 10;
+    int rest = n % 100;
+    if (thousands > 1) {
+        ref_below100(out, thousands);
+    }
+    if (thousands > 0) {
+        append(out, " duizend");
+    }
+    if (hundreds > 1) {
+        ref_below100(out, hundreds);
+    }
+    if (hundreds > 0) {
+        append(out, " honderd");
+    }
+    if (rest > 0 || n < 100) {
+        ref_below100(out, rest);
+    }
+}
+
+static void ref_year(text_t out, int year)
+{
+    if (year >= 1100 && year < 2000) {
+        ref_below100(out, year / 100);
+        append(out, " honderd");
+        if (year % 100 != 0) {
+            ref_below100(out, year % 100);
+        }
+    } else {
+        ref_number(out, year);
+    }
+}
+
+static void ref_dial(text_t out, int hour)
+{
+    ref_below100(out, hour % 12 == 0 ? 12 : hour % 12);
+}
+
+static void ref_colloquial(text_t out, int h, int m)
+{
+    static const char *parts[] = {"'s nachts", "'s ochtends", "'s middags", "'s avonds"};
+    if (m == 0) {
+        ref_dial(out, h);
+        append(out, " uur");
+    } else if (m < 15) {
+        ref_number(out, m);
+        append(out, " over");
+        ref_dial(out, h);
+    } else if (m == 15) {
+        append(out, " kwart over");
+        ref_dial(out, h);
+    } else if (m < 30) {
+        ref_number(out, 30 - m);
+        append(out, " voor half");
+        ref_dial(out, h + 1);
+    } else if (m == 30) {
+        append(out, " half");
+        ref_dial(out, h + 1);
+    } else if (m < 45) {
+        ref_number(out, m - 30);
+        append(out, " over half");
+        ref_dial(out, h + 1);
+    } else if (m == 45) {
+        append(out, " kwart voor");
+        ref_dial(out, h + 1);
+    } else {
+        ref_number(out, 60 - m);
+        append(out, " voor");
+        ref_dial(out, h + 1);
+    }
+    append(out, " %s", parts[h / 6]);
+}
+
+static void ref_time(text_t out, int h, int m, int s, phrase_time_style_t style)
+{
+    if (style == PHRASE_TIME_COLLOQUIAL) {
+        ref_colloquial(out, h, m);
+        return;
+    }
+    ref_below100(out, h);
+    append(out, " uur");
+    if (m > 0) {
+        ref_below100(out, m);
+    }
+    if (style == PHRASE_TIME_DIGITAL_SECONDS && s > 0) {
+        append(out, " en");
+        ref_below100(out, s);
+        append(out, s == 1 ? " seconde" : " seconden");
+    }
+}
+
+static void compare(const phrase_plan_t *plan, bool ok, const text_t want, const char *what)
+{
+    text_t got;
+    render(plan, got);
+    // The reference starts every word with a space
+    const char *expected = want[0] == ' ' ? want + 1 : want;
+    CHECK(strcmp(got, expected) == 0, "%s: \"%s\", expected \"%s\"", what, got, expected);
+    CHECK(ok && !plan->overflow, "%s: built", what);
+    if (plan->count > longest) {
+        longest = plan->count;
+    }
+    cases++;
+}
+
+static void test_numbers(void)
+{
+    phrase_plan_t plan;
+    char what[32];
+    for (int n = 0; n <= PHRASE_NUMBER_MAX; n++) {
+        text_t want = "";
+        ref_number(want, n);
+        phrase_clear(&plan);
+        bool ok = phrase_number(&plan, n);
+        snprintf(what, sizeof(what), "number %d", n);
+        compare(&plan, ok, want, what);
+
+        want[0] = '\0';
+        ref_year(want, n);
+        phrase_clear(&plan);
+        ok = phrase_year(&plan, n);
+        snprintf(what, sizeof(what), "year %d", n);
+        compare(&plan, ok, want, what);
+    }
+    int invalid[] = {-1, PHRASE_NUMBER_MAX + 1};
+    for (int i = 0; i < 2; i++) {
+        phrase_clear(&plan);
+        CHECK(!phrase_number(&plan, invalid[i]) && plan.count == 1 && plan.clips[0] == VOICE_CLIP_INVALID,
+              "number %d is invalid", invalid[i]);
+        phrase_clear(&plan);
+        CHECK(!phrase_year(&plan, invalid[i]), "year %d is invalid", invalid[i]);
+    }
+}
+
+static void test_times(void)
+{
+    phrase_plan_t plan;
+    char what[48];
+    for (int style = PHRASE_TIME_DIGITAL; style <= PHRASE_TIME_COLLOQUIAL; style++) {
+        for (int s = 0; s < 86400; s++) {
+            if (style != PHRASE_TIME_DIGITAL_SECONDS && s % 60 != 0) {
+                continue;
+            }
+            struct tm t = {.tm_hour = s / 3600, .tm_min = s / 60 % 60, .tm_sec = s % 60};
+            text_t want = " het is";
+            ref_time(want, t.tm_hour, t.tm_min, t.tm_sec, style);
+            bool ok = phrase_announcement(&plan, &t, style, false);
+            snprintf(what, sizeof(what), "style %d at %02d:%02d:%02d", style, t.tm_hour, t.tm_min, t.tm_sec);
+            compare(&plan, ok, want, what);
+        }
+    }
+    // A leap second is the last second of its minute
+    struct tm leap = {.tm_hour = 23, .tm_min = 59, .tm_sec = 60};
+    text_t want = " het is";
+    ref_time(want, 23, 59, 59, PHRASE_TIME_DIGITAL_SECONDS);
+    compare(&plan, phrase_announcement(&plan, &leap, PHRASE_TIME_DIGITAL_SECONDS, false), want, "leap second");
+
+    struct tm invalid[] = {{.tm_hour = 24}, {.tm_hour = -1}, {.tm_min = 60}, {.tm_sec = 61}};
+    for (int i = 0; i < 4; i++) {
+        CHECK(!phrase_announcement(&plan, &invalid[i], PHRASE_TIME_DIGITAL, false), "time %d is invalid", i);
+        CHECK(plan.clips[plan.count - 1] == VOICE_CLIP_INVALID, "time %d says so", i);
+    }
+}
+
+static void test_dates(void)
+{
+    static const char *months[] = {"januari", "februari", "maart", "april", "mei", "juni", "juli",
+                                   "augustus", "september", "oktober", "november", "december"};
+    static const char *days[] = {"zondag", "maandag", "dinsdag", "woensdag", "donderdag", "vrijdag", "zaterdag"};
+    static const int month_days[] = {31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31};
+    phrase_plan_t plan;
+    char what[32];
+    // 1 January 1900 was a Monday
+    int wday = 1;
+    for (int year = 1900; year < 2100; year++) {
+        bool leap = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+        for (int mon = 0; mon < 12; mon++) {
+            int count = month_days[mon] + (mon == 1 && leap);
+            for (int mday = 1; mday <= count; mday++) {
+                // The longest time there is goes with the date too
+                struct tm t = {.tm_hour = 22, .tm_min = 47, .tm_sec = 58, .tm_mday = mday, .tm_mon = mon,
+                               .tm_year = year - 1900, .tm_wday = wday};
+                for (int style = PHRASE_TIME_DIGITAL_SECONDS; style <= PHRASE_TIME_COLLOQUIAL; style++) {
+                    text_t want = " het is";
+                    ref_time(want, t.tm_hour, t.tm_min, t.tm_sec, style);
+                    append(want, " %s", days[wday]);
+                    ref_number(want, mday);
+                    append(want, " %s", months[mon]);
+                    ref_year(want, year);
+                    bool ok = phrase_announcement(&plan, &t, style, true);
+                    snprintf(what, sizeof(what), "style %d date %04d-%02d-%02d", style, year, mon + 1, mday);
+                    compare(&plan, ok, want, what);
+                }
+                wday = (wday + 1) % 7;
+            }
+        }
+    }
+    struct tm invalid = {.tm_mday = 32, .tm_wday = 0};
+    CHECK(!phrase_date(&plan, &invalid), "day 32 is invalid");
+}
+
+/* Sentences written out by hand, as a Dutch speaker says them */
+static void test_wording(void)
+{
+    static const struct {
+        int hour;
+        int min;
+        int sec;
+        phrase_time_style_t style;
+        const char *text;
+    } sentences[] = {
+        {15, 20, 0, PHRASE_TIME_COLLOQUIAL, "het is tien voor half vier 's middags"},
+        {15, 20, 0, PHRASE_TIME_DIGITAL, "het is vijftien uur twintig"},
+        {15, 20, 5, PHRASE_TIME_DIGITAL_SECONDS, "het is vijftien uur twintig en vijf seconden"},
+        {0, 0, 1, PHRASE_TIME_DIGITAL_SECONDS, "het is nul uur en een seconde"},
+        {23, 45, 0, PHRASE_TIME_COLLOQUIAL, "het is kwart voor twaalf 's avonds"},
+        {11, 45, 0, PHRASE_TIME_COLLOQUIAL, "het is kwart voor twaalf 's ochtends"},
+        {0, 0, 0, PHRASE_TIME_COLLOQUIAL, "het is twaalf uur 's nachts"},
+        {12, 15, 0, PHRASE_TIME_COLLOQUIAL, "het is kwart over twaalf 's middags"},
+        {5, 35, 0, PHRASE_TIME_COLLOQUIAL, "het is vijf over half zes 's nachts"},
+        {6, 30, 0, PHRASE_TIME_COLLOQUIAL, "het is half zeven 's ochtends"},
+        {18, 1, 0, PHRASE_TIME_COLLOQUIAL, "het is een over zes 's avonds"},
+        {21, 59, 0, PHRASE_TIME_COLLOQUIAL, "het is een voor tien 's avonds"},
+        {9, 47, 0, PHRASE_TIME_DIGITAL, "het is negen uur zevenenveertig"},
+        {22, 22, 22, PHRASE_TIME_DIGITAL_SECONDS, "het is tweeëntwintig uur tweeëntwintig en tweeëntwintig seconden"},
+        {23, 33, 0, PHRASE_TIME_DIGITAL, "het is drieëntwintig uur drieëndertig"},
+    };
+    phrase_plan_t plan;
+    text_t got;
+    text_t spelled;
+    for (int i = 0; i < (int)(sizeof(sentences) / sizeof(sentences[0])); i++) {
+        struct tm t = {.tm_hour = sentences[i].hour, .tm_min = sentences[i].min, .tm_sec = sentences[i].sec};
+        phrase_announcement(&plan, &t, sentences[i].style, false);
+        render(&plan, got);
+        spell(got, spelled);
+        CHECK(strcmp(spelled, sentences[i].text) == 0, "\"%s\", expected \"%s\"", spelled, sentences[i].text);
+    }
+
+    struct tm date = {.tm_hour = 8, .tm_wday = 5, .tm_mday = 19, .tm_mon = 9, .tm_year = 84};
+    phrase_announcement(&plan, &date, PHRASE_TIME_DIGITAL, true);
+    render(&plan, got);
+    spell(got, spelled);
+    const char *want = "het is acht uur vrijdag negentien oktober negentienhonderd vierentachtig";
+    CHECK(strcmp(spelled, want) == 0, "\"%s\", expected \"%s\"", spelled, want);
+    phrase_clear(&plan);
+    phrase_number(&plan, 2006);
+    render(&plan, got);
+    spell(got, spelled);
+    CHECK(strcmp(spelled, "tweeduizend zes") == 0, "\"%s\"", spelled);
+}
+
+/* The old callers of playlist.c get at most their array sizes */
+static void test_playlist(void)
+{
+    uint16_t clips[PHRASE_MAX_CLIPS];
+    for (int n = MIN_NUM - 1; n <= MAX_NUM + 1; n++) {
+        int count = get_clips_based_on_num(n, clips);
+        CHECK(count >= 1 && count <= MAX_NUM_CLIPS, "%d takes %d clips", n, count);
+    }
+    for (int m = 0; m < 24 * 60; m++) {
+        struct tm t = {.tm_hour = m / 60, .tm_min = m % 60};
+        int count = get_clips_based_on_time(&t, clips);
+        CHECK(count >= 2 && count <= MAX_TIME_CLIPS, "%02d:%02d takes %d clips", t.tm_hour, t.tm_min, count);
+    }
+}
+
+int main(void)
+{
+    CHECK(phrase_init(), "rules compiled");
+    test_numbers();
+    test_times();
+    test_dates();
+    test_wording();
+    test_playlist();
+    printf("%d phrases, the longest %d clips\n", cases, longest);
+    CHECK(longest <= 25 && longest < PHRASE_MAX_CLIPS, "the longest phrase has %d clips", longest);
+    return test_end();
+}
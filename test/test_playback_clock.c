@@ -0,0 +1,242 @@
+#include <stdlib.h>
+#include "host.h"
+#include "test.h"
+#include "playback_clock.h"
+
+/*
+ * A decoder writes chunks through the write callback of the clock into the emulated I2S
+ * DMA, taking a random time per chunk. Between writes the position of the clock is
+ * compared with the frames the DMA really clocked out: the clock may lag by one DMA buffer
+ * and never lead. A pause, stalls, a slow decoder, a new track, a seek and a format
+ * change are covered.
+ */
+
+#define RATE 44100
+#define BUF_COUNT 3
+#define BUF_LEN 300
+#define DMA_FRAMES (BUF_COUNT * BUF_LEN)
+#define CHUNK 2048
+
+static audio_element_handle_t writer;
+static char chunk[CHUNK];
+static int frame_bytes = 4;
+static int rate = RATE;
+
+/* Frames written when the current track started, what the DMA played before is not of it */
+static int64_t track_written = 0;
+static int64_t written = 0;
+
+typedef struct {
+    int64_t min_err;            /* Frames heard minus the frames of the clock */
+    int64_t max_err;
+    int samples;
+} errors_t;
+
+/* The stand-ins of the audio processing in front of the DMA keep the audio as it is */
+void normalizer_process(char *buffer, int len)
+{
+}
+
+void power_governor_audio_begin(void)
+{
+}
+
+void power_governor_audio_end(void)
+{
+}
+
+static void sample(errors_t *e)
+{
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    int64_t heard = host_i2s_played() - track_written;
+    heard = heard < 0 ? 0 : heard;
+    int64_t err = heard - pos.frames;
+    if (e->samples++ == 0 || err < e->min_err) {
+        e->min_err = err;
+    }
+    if (e->samples == 1 || err > e->max_err) {
+        e->max_err = err;
+    }
+    CHECK(pos.frames <= written - track_written, "the clock is past the audio written");
+    CHECK(pos.position_ms == pos.frames * 1000 / rate, "position in ms");
+}
+
+/* Decodes frames at load times real time, with a stall of stall_us before the first chunk */
+static void decode(int64_t frames, double load, int64_t stall_us, errors_t *e)
+{
+    int chunk_frames = CHUNK / frame_bytes;
+    int64_t chunk_us = (int64_t)chunk_frames * 1000000 / rate;
+    host_advance_us(stall_us / 2);
+    sample(e);
+    host_advance_us(stall_us - stall_us / 2);
+    for (int64_t done = 0; done < frames; done += chunk_frames) {
+        int64_t decode_us = chunk_us * load * (0.5 + rand() / (double)RAND_MAX);
+        int64_t part = rand() % (decode_us + 1);
+        host_advance_us(part);
+        sample(e);
+        host_advance_us(decode_us - part);
+        int len = frames - done < chunk_frames ? (frames - done) * frame_bytes : CHUNK;
+        CHECK(audio_element_output(writer, chunk, len) == len, "chunk written");
+        written += len / frame_bytes;
+        sample(e);
+    }
+}
+
+static void start_track(int64_t duration_ms)
+{
+    playback_clock_start_track(duration_ms);
+    track_written = written;
+}
+
+static void test_steady(void)
+{
+    errors_t e = {0};
+    start_track(30000);
+    decode(RATE * 10, 0.3, 0, &e);
+    printf("steady: the clock lags by %lld to %lld frames\n", (long long)e.min_err, (long long)e.max_err);
+    CHECK(e.min_err >= 0 && e.max_err <= BUF_LEN, "within one DMA buffer, %lld to %lld", (long long)e.min_err,
+          (long long)e.max_err);
+
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    CHECK(pos.running && pos.duration_ms == 30000 && pos.remaining_ms == 30000 - pos.position_ms, "%lld ms left",
+          (long long)pos.remaining_ms);
+    CHECK(pos.latency_ms <= DMA_FRAMES * 1000 / RATE && pos.underruns == 0, "latency of the DMA, %d ms",
+          pos.latency_ms);
+
+    // The decoded audio in front of the writer adds to the latency
+    static char decoded[1500 * 4];
+    ringbuf_handle_t rb = rb_create(sizeof(decoded), 1);
+    audio_element_set_input_ringbuf(writer, rb);
+    host_element_set_state(writer, AEL_STATE_RUNNING);
+    rb_write(rb, decoded, sizeof(decoded), 0);
+    int64_t latency_us = playback_clock_get_latency_us(host_time_us());
+    int64_t expect_us = (host_i2s_queued() + 1500) * 1000000 / RATE;
+    CHECK(latency_us >= expect_us && latency_us - expect_us <= BUF_LEN * 1000000 / RATE, "latency %lld us of %lld",
+          (long long)latency_us, (long long)expect_us);
+    host_element_set_state(writer, AEL_STATE_PAUSED);
+    CHECK(playback_clock_get_latency_us(host_time_us()) < latency_us, "only the ring of a running writer counts");
+    audio_element_set_input_ringbuf(writer, NULL);
+    rb_destroy(rb);
+}
+
+/* No writes for 2 s: the position stops where the audio ran out, no underrun */
+static void test_pause(void)
+{
+    errors_t e = {0};
+    decode(0, 0, 2000000, &e);
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    CHECK(!pos.running && pos.frames == written - track_written && pos.latency_ms == 0, "stopped at the end");
+    CHECK(pos.underruns == 0 && e.min_err >= 0 && e.max_err <= BUF_LEN, "a pause is not an underrun");
+    decode(RATE, 0.3, 0, &e);
+    playback_clock_get(&pos);
+    CHECK(pos.running && pos.underruns == 0, "running again");
+}
+
+/* The decoder stalls for longer than the DMA holds, then catches up */
+static void test_stall(void)
+{
+    errors_t e = {0};
+    uint32_t empties = host_i2s_empties();
+    decode(RATE, 0.3, 100000, &e);
+    decode(RATE, 0.3, 60000, &e);
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    CHECK(host_i2s_empties() - empties == 2 && pos.underruns == 2, "%u underruns counted, %u happened",
+          pos.underruns, host_i2s_empties() - empties);
+    CHECK(e.min_err >= 0 && e.max_err <= BUF_LEN, "within one DMA buffer through the stalls, %lld to %lld",
+          (long long)e.min_err, (long long)e.max_err);
+}
+
+/* A decoder slower than real time, the DMA runs empty before most writes */
+static void test_slow(void)
+{
+    errors_t e = {0};
+    uint32_t empties = host_i2s_empties();
+    playback_position_t before;
+    playback_clock_get(&before);
+    decode(RATE * 2, 1.4, 0, &e);
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    printf("slow decoder: the clock lags by %lld to %lld frames, %u of %u underruns counted\n", (long long)e.min_err,
+           (long long)e.max_err, pos.underruns - before.underruns, host_i2s_empties() - empties);
+    CHECK(e.min_err >= 0 && e.max_err <= BUF_LEN, "within one DMA buffer, %lld to %lld", (long long)e.min_err,
+          (long long)e.max_err);
+    // Gaps shorter than an eighth of the DMA are not counted
+    uint32_t counted = pos.underruns - before.underruns;
+    uint32_t happened = host_i2s_empties() - empties;
+    CHECK(counted <= happened && counted >= happened * 3 / 4, "%u of %u underruns counted", counted, happened);
+    // Back to a full DMA
+    decode(RATE, 0.3, 0, &e);
+}
+
+static void test_tracks(void)
+{
+    // The end of the previous track is still in the DMA
+    start_track(-1);
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    CHECK(pos.frames == 0 && pos.duration_ms == -1 && pos.remaining_ms == -1, "a stream starts at 0");
+    errors_t e = {0};
+    decode(RATE * 3, 0.3, 0, &e);
+    CHECK(e.min_err >= 0 && e.max_err <= BUF_LEN, "new track, %lld to %lld", (long long)e.min_err,
+          (long long)e.max_err);
+    playback_clock_set_duration(180000);
+    playback_clock_get(&pos);
+    CHECK(pos.remaining_ms == 180000 - pos.position_ms, "length known later");
+
+    // Seek to 1:00, heard once the DMA played out what it holds
+    playback_clock_seek(60000);
+    track_written = written - (int64_t)60 * RATE;
+    decode(RATE, 0.3, 0, &e);
+    playback_clock_get(&pos);
+    CHECK(pos.position_ms >= 61000 - 1000 * DMA_FRAMES / RATE && pos.position_ms <= 61000, "at %lld ms after the seek",
+          (long long)pos.position_ms);
+}
+
+/* 22050 Hz mono, the DMA runs at the new rate */
+static void test_format(void)
+{
+    decode(0, 0, 100000, &(errors_t){0});
+    rate = 22050;
+    frame_bytes = 2;
+    host_i2s_set_dma(rate, frame_bytes, BUF_COUNT, BUF_LEN);
+    playback_clock_set_format(rate, 1, 16);
+    start_track(5000);
+    errors_t e = {0};
+    decode(rate * 5, 0.3, 0, &e);
+    CHECK(e.min_err >= 0 && e.max_err <= BUF_LEN, "mono, %lld to %lld", (long long)e.min_err, (long long)e.max_err);
+    decode(0, 0, 1000000, &e);
+    playback_position_t pos;
+    playback_clock_get(&pos);
+    CHECK(pos.position_ms == 5000 && pos.remaining_ms == 0 && !pos.running, "the whole track heard, %lld ms",
+          (long long)pos.position_ms);
+
+    // Half a frame is counted with the next write, then heard
+    playback_clock_on_write(1);
+    playback_clock_on_write(1);
+    host_advance_us(1000);
+    playback_clock_get(&pos);
+    CHECK(pos.frames == rate * 5 + 1, "odd bytes add up");
+}
+
+int main(void)
+{
+    srand(34);
+    host_set_time_us(1000000);
+    host_i2s_set_dma(RATE, frame_bytes, BUF_COUNT, BUF_LEN);
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    writer = audio_element_init(&cfg);
+    playback_clock_attach(writer, I2S_NUM_0, DMA_FRAMES);
+    playback_clock_set_format(RATE, 2, 16);
+
+    test_steady();
+    test_pause();
+    test_stall();
+    test_slow();
+    test_tracks();
+    test_format();
+    return test_end();
+}
@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "host.h"
+#include "test.h"
+#include "playlist_file.h"
+
+/*
+ * Parses M3U and PLS playlists fed in chunks of every size and compares the entries
+ * with what was written: titles, relative entries resolved against the location, lines
+ * too long to keep, a PLS title before or after its file. Then a playlist of 100000
+ * entries, and loading from a file and from an http server that redirects.
+ */
+
+#define MAX_ENTRIES 16
+
+typedef struct {
+    char uri[MAX_ENTRIES][PLAYLIST_FILE_LINE_MAX];
+    char title[MAX_ENTRIES][PLAYLIST_FILE_TITLE_MAX];
+    int count;
+    uint32_t hash;              /* Of every entry, for the entries that do not fit */
+} entries_t;
+
+static void on_entry(void *ctx, const char *uri, const char *title)
+{
+    entries_t *e = ctx;
+    if (e->count < MAX_ENTRIES) {
+        snprintf(e->uri[e->count], PLAYLIST_FILE_LINE_MAX, "%s", uri);
+        snprintf(e->title[e->count], PLAYLIST_FILE_TITLE_MAX, "%s", title);
+    }
+    for (const char *p = uri; *p; p++) {
+        e->hash = (e->hash ^ (uint8_t)*p) * 16777619u;
+    }
+    e->count++;
+}
+
+/* Parses text fed in chunks of chunk bytes, 0 for all at once */
+static int parse(const char *location, const char *text, int chunk, entries_t *e, int *skipped)
+{
+    static playlist_file_parser_t p;
+    memset(e, 0, sizeof(*e));
+    playlist_file_parser_init(&p, location, PLAYLIST_FILE_UNKNOWN, on_entry, e);
+    int len = strlen(text);
+    for (int done = 0; done < len;) {
+        int n = chunk > 0 && len - done > chunk ? chunk : len - done;
+        playlist_file_parser_feed(&p, text + done, n);
+        done += n;
+    }
+    int count = playlist_file_parser_finish(&p);
+    if (skipped != NULL) {
+        *skipped = p.skipped;
+    }
+    return count;
+}
+
+/* Entries and titles as "uri|title" lines */
+static void check_entries(const char *what, const entries_t *e, const char *const expect[][2], int count)
+{
+    CHECK(e->count == count, "%s: %d entries, expected %d", what, e->count, count);
+    for (int i = 0; i < count && i < e->count; i++) {
+        CHECK(strcmp(e->uri[i], expect[i][0]) == 0 && strcmp(e->title[i], expect[i][1]) == 0,
+              "%s: entry %d is %s|%s, expected %s|%s", what, i, e->uri[i], e->title[i], expect[i][0], expect[i][1]);
+    }
+}
+
+/* The same entries whatever the chunks the text arrives in */
+static void check_chunks(const char *what, const char *location, const char *text, const char *const expect[][2],
+                         int count)
+{
+    entries_t whole;
+    parse(location, text, 0, &whole, NULL);
+    check_entries(what, &whole, expect, count);
+    int wrong = 0;
+    for (int chunk = 1; chunk < 64; chunk++) {
+        entries_t e;
+        parse(location, text, chunk, &e, NULL);
+        wrong += e.count != whole.count || e.hash != whole.hash || memcmp(e.title, whole.title, sizeof(e.title)) != 0;
+    }
+    CHECK(wrong == 0, "%s: %d chunk sizes give other entries", what, wrong);
+}
+
+static void test_resolve(void)
+{
+    static const char *const cases[][3] = {
+        {"/sdcard/music/", "song.wav", "/sdcard/music/song.wav"},
+        {"/sdcard/music/", "../other/./song.wav", "/sdcard/other/song.wav"},
+        {"/sdcard/music/", "Album\\CD 1\\01.wav", "/sdcard/music/Album/CD 1/01.wav"},
+        {"/sdcard/music/", "/sdcard/x.wav", "/sdcard/x.wav"},
+        {"/sdcard/", "../../../x.wav", "/x.wav"},
+        {"", "a/../b.wav", "b.wav"},
+        {"http://host:8000/lists/", "radio.mp3", "http://host:8000/lists/radio.mp3"},
+        {"http://host:8000/lists/", "/live?sid=1&x=../y", "http://host:8000/live?sid=1&x=../y"},
+        {"http://host:8000/lists/", "../a/./b.mp3#t=1", "http://host:8000/a/b.mp3#t=1"},
+        {"http://host/lists/", "https://other.example/stream", "https://other.example/stream"},
+        {"/sdcard/", "icecast://host/x", "icecast://host/x"},
+        {"https://host", "/a.mp3", "https://host/a.mp3"},
+    };
+    for (int i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+        char out[PLAYLIST_FILE_LINE_MAX];
+        esp_err_t ret = playlist_file_resolve(cases[i][0], cases[i][1], out, sizeof(out));
+        CHECK(ret == ESP_OK && strcmp(out, cases[i][2]) == 0, "%s + %s: %s, expected %s", cases[i][0], cases[i][1],
+              ret == ESP_OK ? out : esp_err_to_name(ret), cases[i][2]);
+    }
+    char small[16];
+    CHECK(playlist_file_resolve("/sdcard/music/", "song.wav", small, sizeof(small)) == ESP_ERR_INVALID_SIZE,
+          "too long for the buffer");
+}
+
+static void test_m3u(void)
+{
+    const char *text = "\xEF\xBB\xBF#EXTM3U\r\n"
+                       "#EXTINF:123, First Song \r\n"
+                       "01 first.wav\r\n"
+                       "\r\n"
+                       "# a comment\r\n"
+                       "  sub\\02 second.wav  \r\n"
+                       "#EXTINF:-1,Radio\n"
+                       "http://radio.example/live\n"
+                       "../elsewhere/03.wav";
+    static const char *const expect[][2] = {
+        {"/sdcard/music/01 first.wav", "First Song"},
+        {"/sdcard/music/sub/02 second.wav", ""},
+        {"http://radio.example/live", "Radio"},
+        {"/sdcard/elsewhere/03.wav", ""},
+    };
+    check_chunks("m3u8", "/sdcard/music/list.m3u8", text, expect, 4);
+}
+
+static void test_pls(void)
+{
+    const char *text = "[playlist]\n"
+                       "NumberOfEntries=4\n"
+                       "File1=http://a.example/stream\n"
+                       "Title1=Station A\n"
+                       "Length1=-1\n"
+                       "; a comment\n"
+                       "Title2 = Station B \n"
+                       "File2=/b/stream\n"
+                       "File3=c.mp3\n"
+                       "File4=http://d.example/\n"
+                       "Title4=Station D\n"
+                       "Version=2\n";
+    static const char *const expect[][2] = {
+        {"http://a.example/stream", "Station A"},
+        {"http://lists.example/b/stream", "Station B"},
+        {"http://lists.example/radio/c.mp3", ""},
+        {"http://d.example/", "Station D"},
+    };
+    check_chunks("pls", "http://lists.example/radio/list.pls", text, expect, 4);
+
+    // Without an extension the first line tells
+    entries_t e;
+    CHECK(parse("http://lists.example/get?id=7", text, 0, &e, NULL) == 4 && strcmp(e.title[0], "Station A") == 0,
+          "pls by its first line");
+    CHECK(parse("http://lists.example/get?id=7", "http://a.example/x\nhttp://b.example/y\n", 0, &e, NULL) == 2,
+          "m3u by its first line");
+}
+
+static void test_long_lines(void)
+{
+    // 255 characters fit, 256 do not
+    static char text[2048];
+    char fits[PLAYLIST_FILE_LINE_MAX];
+    memset(fits, 'a', PLAYLIST_FILE_LINE_MAX - 1);
+    fits[0] = '/';
+    fits[PLAYLIST_FILE_LINE_MAX - 1] = '\0';
+    snprintf(text, sizeof(text), "%s\n%sb\nshort.wav\n%sbb", fits, fits, fits);
+    entries_t e;
+    int skipped;
+    int count = parse("/sdcard/list.m3u", text, 0, &e, &skipped);
+    CHECK(count == 2 && skipped == 2 && strcmp(e.uri[0], fits) == 0 && strcmp(e.uri[1], "/sdcard/short.wav") == 0,
+          "%d entries, %d skipped", count, skipped);
+
+    // Fits as a line, but not once resolved
+    snprintf(text, sizeof(text), "%s\n", fits + 1);
+    count = parse("/sdcard/list.m3u", text, 0, &e, &skipped);
+    CHECK(count == 0 && skipped == 1, "too long resolved, %d entries, %d skipped", count, skipped);
+}
+
+/* 100000 entries in the constant state of the parser */
+static void test_large(void)
+{
+    const int entries = 100000;
+    char *text = malloc(entries * 40);
+    int len = 0;
+    for (int i = 0; i < entries; i++) {
+        len += sprintf(text + len, "#EXTINF:%d,Song %d\nsongs/%06d.wav\n", 180 + i % 60, i, i);
+    }
+    entries_t e;
+    clock_t start = clock();
+    int count = parse("/sdcard/big.m3u", text, 512, &e, NULL);
+    double ms = (clock() - start) * 1000.0 / CLOCKS_PER_SEC;
+    printf("%d entries of %d bytes in %.0f ms, %d bytes of parser state\n", count, len, ms,
+           (int)sizeof(playlist_file_parser_t));
+    CHECK(count == entries && strcmp(e.uri[15], "/sdcard/songs/000015.wav") == 0 &&
+              strcmp(e.title[15], "Song 15") == 0, "%d entries", count);
+    free(text);
+}
+
+static void test_load(void)
+{
+    // A file next to the test, its entries relative to it
+    char cwd[256];
+    char path[300];
+    CHECK(getcwd(cwd, sizeof(cwd)) != NULL, "working directory");
+    snprintf(path, sizeof(path), "%s/test_playlist.m3u", cwd);
+    FILE *f = fopen(path, "w");
+    fputs("#EXTM3U\n#EXTINF:1,One\n1.wav\nsub/2.wav\n", f);
+    fclose(f);
+    entries_t e = {0};
+    CHECK(playlist_file_load(path, on_entry, &e) == 2, "2 entries from the file");
+    char expect[400];
+    snprintf(expect, sizeof(expect), "%s/sub/2.wav", cwd);
+    CHECK(e.count == 2 && strcmp(e.uri[1], expect) == 0 && strcmp(e.title[0], "One") == 0, "%s", e.uri[1]);
+    CHECK(playlist_file_load("/nonexistent/list.m3u", on_entry, &e) == -1, "a missing file");
+
+    // Redirected twice, read in small pieces, the entries resolve against the url asked for
+    host_http_reset();
+    host_http_set_read_chunk(7);
+    host_http_serve("http://lists.example/radio.pls", 302, "http://cdn.example/r/radio.pls");
+    host_http_serve("http://cdn.example/r/radio.pls", 301, "/final/radio.pls");
+    host_http_serve("http://cdn.example/final/radio.pls", 200, "[playlist]\nFile1=live\nTitle1=Live\n");
+    memset(&e, 0, sizeof(e));
+    CHECK(playlist_file_load("http://lists.example/radio.pls", on_entry, &e) == 1 && host_http_opens() == 3,
+          "one entry after 2 redirects, %u connections", host_http_opens());
+    CHECK(strcmp(e.uri[0], "http://lists.example/live") == 0 && strcmp(e.title[0], "Live") == 0, "%s|%s", e.uri[0],
+          e.title[0]);
+
+    host_http_serve("http://lists.example/gone.m3u", 404, "not found");
+    CHECK(playlist_file_load("http://lists.example/gone.m3u", on_entry, &e) == -1, "404");
+    CHECK(playlist_file_load("http://nowhere.example/x.m3u", on_entry, &e) == -1, "no connection");
+    host_http_serve("http://loop.example/a.m3u", 302, "http://loop.example/b.m3u");
+    host_http_serve("http://loop.example/b.m3u", 302, "http://loop.example/a.m3u");
+    uint32_t opens = host_http_opens();
+    CHECK(playlist_file_load("http://loop.example/a.m3u", on_entry, &e) == -1 && host_http_opens() - opens == 4,
+          "gives up after 3 redirects, %u connections", host_http_opens() - opens);
+}
+
+int main(void)
+{
+    test_resolve();
+    test_m3u();
+    test_pls();
+    test_long_lines();
+    test_large();
+    test_load();
+    return test_end();
+}
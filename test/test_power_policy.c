@@ -0,0 +1,313 @@
+#include <stdlib.h>
+#include <string.h>
+#include "test.h"
+#include "power_policy.h"
+
+/*
+ * Steps the policy through the cases of its rules: the steps down after enough quiet
+ * samples, a dip too short for one, the jump up on a saturated core, the boost after an
+ * underrun and light sleep without audio. Then replays load traces on a model of the
+ * busiest core in 10 ms ticks: Wi-Fi above the decoder, the decoder filling a 60 ms DMA
+ * buffer, background work below, a sample every 100 ms. Over 50 seeds of every trace
+ * the DMA must never run empty, and the energy is compared with a fixed 160 MHz.
+ */
+
+#define TICK_MS 10
+#define SAMPLE_TICKS 10
+#define DMA_MS 60
+#define TRACE_S 120
+#define SEEDS 50
+
+/* Current of the chip at each level, idle and with a busy core, from the ESP32 datasheet */
+static const double idle_ma[POWER_LEVEL_COUNT] = { 20, 27, 30 };
+static const double busy_ma[POWER_LEVEL_COUNT] = { 31, 44, 68 };
+#define LIGHT_SLEEP_MA 0.8
+
+/* What runs during a tick, MHz of work a second of each */
+typedef struct {
+    double audio_mhz;       /* Decoder, 0 when nothing plays */
+    double wifi_mhz;        /* Above the decoder */
+    double background_mhz;  /* Below the decoder, TLS handshakes, mode switches, scans */
+    bool hold;
+} load_t;
+
+typedef void (*trace_fn_t)(int ms, load_t *l);
+
+typedef struct {
+    uint32_t underruns;
+    double energy;          /* mA * ms */
+    int ticks[POWER_LEVEL_COUNT];
+    int sleep_ticks;
+} result_t;
+
+static double jitter(double mhz, double spread)
+{
+    return mhz * (1 + spread * (2.0 * rand() / RAND_MAX - 1));
+}
+
+static void sample(power_policy_t *p, int load, bool playing, bool hold, uint32_t underruns)
+{
+    power_sample_t s = { .load_pct = load, .playing = playing, .hold = hold, .underruns = underruns };
+    power_policy_update(p, &s);
+}
+
+/* Samples until the level changes, returns the samples taken, -1 when it does not within limit */
+static int samples_to_change(power_policy_t *p, int load, int limit)
+{
+    int level = p->level;
+    for (int i = 1; i <= limit; i++) {
+        sample(p, load, true, false, p->underruns);
+        if (p->level != level) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void test_steps(void)
+{
+    power_policy_cfg_t cfg = POWER_POLICY_CFG_DEFAULT();
+    power_policy_t p;
+    power_policy_init(&p, &cfg);
+    CHECK(p.level == POWER_LEVEL_COUNT - 1 && !p.sleep, "starts at %d MHz awake", power_level_mhz[p.level]);
+
+    // 24 MHz of work fits 80 MHz, one level at a time after 15 samples each
+    CHECK(samples_to_change(&p, 10, 100) == 15 && p.level == 1, "240 to 160 MHz");
+    CHECK(samples_to_change(&p, 15, 100) == 15 && p.level == 0, "160 to 80 MHz");
+    CHECK(samples_to_change(&p, 30, 100) == -1, "stays at 80 MHz");
+
+    // At 160 MHz, a dip of 14 samples does not take it down
+    power_sample_t busy = { .load_pct = 90, .playing = true };
+    CHECK(power_policy_update(&p, &busy) && p.level == 1, "90%% at 80 MHz goes up at once");
+    for (int i = 0; i < 14; i++) {
+        sample(&p, 20, true, false, 0);
+    }
+    CHECK(p.level == 1 && !power_policy_update(&p, &(power_sample_t){ .load_pct = 40, .playing = true }),
+          "a short dip keeps 160 MHz");
+    CHECK(samples_to_change(&p, 20, 100) == 15, "a long one does not");
+
+    // A saturated core hides what the work needs, it goes up a level a sample
+    sample(&p, 100, true, false, 0);
+    CHECK(p.level == 1, "100%% at 80 MHz is 80 MHz of work, 160 is enough");
+    sample(&p, 100, true, false, 0);
+    CHECK(p.level == 2, "100%% at 160 MHz goes to 240 MHz");
+
+    // Between the target and up thresholds nothing moves, even when a higher level is wanted
+    power_policy_init(&p, &cfg);
+    p.level = 0;
+    CHECK(samples_to_change(&p, 70, 100) == -1, "70%% at 80 MHz stays");
+}
+
+static void test_underrun(void)
+{
+    power_policy_cfg_t cfg = POWER_POLICY_CFG_DEFAULT();
+    power_policy_t p;
+    power_policy_init(&p, &cfg);
+    p.level = 0;
+    sample(&p, 10, true, false, 1);
+    CHECK(p.level == 2, "an underrun goes to 240 MHz");
+    int held = 0;
+    while (p.level == 2 && held < 200) {
+        sample(&p, 5, true, false, 1);
+        held++;
+    }
+    // The underrun is the first sample of the boost, the last one already counts for the step down
+    CHECK(held == cfg.boost_samples - 1 + cfg.down_samples, "held for %d samples", held);
+    sample(&p, 5, true, false, 2);
+    CHECK(p.level == 2 && p.boost == cfg.boost_samples, "the next underrun boosts again");
+}
+
+static void test_sleep(void)
+{
+    power_policy_cfg_t cfg = POWER_POLICY_CFG_DEFAULT();
+    power_policy_t p;
+    power_policy_init(&p, &cfg);
+    int samples = 0;
+    while (!p.sleep && samples < 100) {
+        sample(&p, 2, false, false, 0);
+        samples++;
+    }
+    CHECK(samples == cfg.idle_samples && p.level == 0, "light sleep after %d samples without audio", samples);
+
+    // A hold wakes it and keeps it awake
+    sample(&p, 2, false, true, 0);
+    CHECK(!p.sleep && p.level == 2, "a hold wakes up at 240 MHz");
+    for (int i = 0; i < 100; i++) {
+        sample(&p, 2, false, true, 0);
+    }
+    CHECK(!p.sleep, "awake while held");
+
+    // Audio after sleep starts high, a gap shorter than the idle samples stays awake
+    power_policy_init(&p, &cfg);
+    for (int i = 0; i < cfg.idle_samples; i++) {
+        sample(&p, 2, false, false, 0);
+    }
+    CHECK(p.sleep, "asleep");
+    sample(&p, 30, true, false, 0);
+    CHECK(!p.sleep && p.level == 2, "audio wakes up at 240 MHz");
+    for (int i = 0; i < cfg.idle_samples - 1; i++) {
+        sample(&p, 2, false, false, 0);
+    }
+    CHECK(!p.sleep, "the gap between two songs stays awake");
+    // An underrun while asleep does not keep the boost once audio returns
+    sample(&p, 2, false, false, 1);
+    CHECK(p.sleep && p.level == 0 && p.boost == 0, "asleep despite the count");
+}
+
+/* A WAV from the SD card, paused from 50 to 80 s */
+static void trace_wav(int ms, load_t *l)
+{
+    bool playing = ms < 50000 || ms >= 80000;
+    l->audio_mhz = playing ? jitter(10, 0.3) : 0;
+    l->background_mhz = playing && ms % 500 < 20 ? 60 : 0;
+}
+
+/* The radio over HTTP, reconnecting every 30 s */
+static void trace_mp3(int ms, load_t *l)
+{
+    l->audio_mhz = jitter(40, 0.25);
+    l->wifi_mhz = rand() % 8 == 0 ? 30 : 6;
+    l->background_mhz = ms % 30000 < 100 ? 60 : 0;
+    l->hold = true;
+}
+
+/* The radio over HTTPS, a handshake at every reconnect */
+static void trace_https(int ms, load_t *l)
+{
+    trace_mp3(ms, l);
+    l->background_mhz = ms % 20000 < 800 ? 160 : 0;
+}
+
+/* A WAV, a mode switch, the tuner, another switch and the radio, every 15 s */
+static void trace_modes(int ms, load_t *l)
+{
+    int t = ms % 15000;
+    if (t < 5000) {
+        trace_wav(0, l);
+    } else if (t < 5500 || (t >= 10000 && t < 10500)) {
+        l->background_mhz = 150;
+    } else if (t >= 10500) {
+        trace_mp3(ms, l);
+    }
+}
+
+/* A decoder whose work steps every 5 s */
+static void trace_steps(int ms, load_t *l)
+{
+    static const double steps[] = { 10, 40, 70, 100, 120, 30, 5, 90 };
+    l->audio_mhz = jitter(steps[ms / 5000 % 8], 0.1);
+    l->wifi_mhz = 4;
+}
+
+/* Runs a trace on one core, fixed at a level when fixed_level >= 0 */
+static void run(trace_fn_t trace, int seed, int fixed_level, result_t *r)
+{
+    power_policy_cfg_t cfg = POWER_POLICY_CFG_DEFAULT();
+    power_policy_t p;
+    power_policy_init(&p, &cfg);
+    memset(r, 0, sizeof(*r));
+    srand(seed);
+
+    double dma_ms = 0;
+    bool started = false;       /* The DMA clocks out */
+    double background = 0;      /* Work waiting, MHz * ms */
+    double busy = 0, capacity = 0;
+    bool played = false;
+    bool held = false;
+    for (int tick = 0; tick < TRACE_S * 1000 / TICK_MS; tick++) {
+        load_t l = { 0 };
+        trace(tick * TICK_MS, &l);
+        int level = fixed_level >= 0 ? fixed_level : p.level;
+        double cap = power_level_mhz[level] * TICK_MS;
+        double used = l.wifi_mhz * TICK_MS < cap ? l.wifi_mhz * TICK_MS : cap;
+
+        if (l.audio_mhz > 0) {
+            // The decoder fills the DMA and what it clocks out this tick
+            double room = DMA_MS + TICK_MS - dma_ms;
+            double produced = (cap - used) / l.audio_mhz;
+            produced = produced < room ? produced : room;
+            used += produced * l.audio_mhz;
+            if (started && dma_ms + produced < TICK_MS) {
+                r->underruns++;
+            }
+            dma_ms = dma_ms + produced - TICK_MS;
+            dma_ms = dma_ms < 0 ? 0 : dma_ms;
+            started = true;
+            played = true;
+        } else {
+            dma_ms = 0;
+            started = false;
+        }
+        background += l.background_mhz * TICK_MS;
+        double bg = background < cap - used ? background : cap - used;
+        background -= bg;
+        used += bg;
+        held |= l.hold;
+
+        bool asleep = fixed_level < 0 && p.sleep && used == 0;
+        r->energy += asleep ? LIGHT_SLEEP_MA * TICK_MS
+                            : (idle_ma[level] + (busy_ma[level] - idle_ma[level]) * used / cap) * TICK_MS;
+        if (asleep) {
+            r->sleep_ticks++;
+        } else {
+            r->ticks[level]++;
+        }
+        busy += used;
+        capacity += cap;
+        if (tick % SAMPLE_TICKS == SAMPLE_TICKS - 1 && fixed_level < 0) {
+            sample(&p, (int)(busy * 100 / capacity), played, held, r->underruns);
+            busy = capacity = 0;
+            played = held = false;
+        }
+    }
+}
+
+static void test_traces(void)
+{
+    static const struct {
+        const char *name;
+        trace_fn_t fn;
+        double max_ratio;       /* Of the energy at a fixed 160 MHz */
+    } traces[] = {
+        { "wav with a pause", trace_wav, 0.7 },
+        { "mp3 over http", trace_mp3, 1.05 },
+        { "mp3 over https", trace_https, 1.1 },
+        { "mode switches", trace_modes, 0.95 },
+        { "load steps", trace_steps, 1.05 },
+    };
+    for (int t = 0; t < (int)(sizeof(traces) / sizeof(traces[0])); t++) {
+        uint32_t underruns = 0, fixed_underruns = 0;
+        double energy = 0, fixed_energy = 0;
+        int ticks[POWER_LEVEL_COUNT] = { 0 };
+        int sleep_ticks = 0;
+        for (int seed = 1; seed <= SEEDS; seed++) {
+            result_t r;
+            run(traces[t].fn, seed, 1, &r);
+            fixed_underruns += r.underruns;
+            fixed_energy += r.energy;
+            run(traces[t].fn, seed, -1, &r);
+            underruns += r.underruns;
+            energy += r.energy;
+            sleep_ticks += r.sleep_ticks;
+            for (int i = 0; i < POWER_LEVEL_COUNT; i++) {
+                ticks[i] += r.ticks[i];
+            }
+        }
+        int total = sleep_ticks + ticks[0] + ticks[1] + ticks[2];
+        printf("%-17s %u underruns (%u at 160 MHz), energy %3.0f%% of 160 MHz, 80/160/240 MHz/sleep %2.0f/%2.0f/%2.0f/%2.0f%%\n",
+               traces[t].name, underruns, fixed_underruns, energy * 100 / fixed_energy, ticks[0] * 100.0 / total,
+               ticks[1] * 100.0 / total, ticks[2] * 100.0 / total, sleep_ticks * 100.0 / total);
+        CHECK(underruns == 0, "%s: %u underruns in %d runs", traces[t].name, underruns, SEEDS);
+        CHECK(energy <= fixed_energy * traces[t].max_ratio, "%s: %.0f%% of the energy at 160 MHz", traces[t].name,
+              energy * 100 / fixed_energy);
+    }
+}
+
+int main(void)
+{
+    test_steps();
+    test_underrun();
+    test_sleep();
+    test_traces();
+    return test_end();
+}
@@ -0,0 +1,368 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "resilient_http.h"
+
+/*
+ * Runs the reader against fake mirrors that stand in for lean_http: live streams that
+ * drop and come back, files served with and without "Accept-Ranges: bytes", mirrors that
+ * are down or answer 404, and a stream that is not MP3. The stream is made of 417 byte
+ * MP3 frames whose payload, which never holds 0xFF, tells the frame number, so the sink
+ * sees every frame that came through whole and every one that was cut.
+ */
+
+#define FRAME_LEN 417       /* MPEG-1 layer III, 128 kbit/s, 44.1 kHz */
+#define BYTE_RATE 16000
+#define MIRRORS 3
+
+typedef struct {
+    int fail_connects;      /* Connects that fail before one works, -1 for all */
+    int status;
+    int64_t length;         /* -1 for a live stream */
+    bool ranges;
+    int drops;              /* Connections that drop in the middle of the stream */
+    bool mp3;
+    // What the reader did
+    int opens;
+    int failed_opens;
+    int ranged_opens;
+    int64_t served;         /* Stream offset after the last byte sent */
+} mirror_t;
+
+typedef struct lean_http {
+    mirror_t *mirror;
+    bool open;
+    int64_t pos;
+    int64_t drop_at;        /* Offset the connection drops at, -1 for none */
+} fake_conn_t;
+
+typedef struct {
+    int64_t bytes;
+    int64_t frames;         /* Frames that came through whole */
+    int64_t cut;            /* Frames a header interrupted */
+    int64_t restarts;       /* Frames whose number went back */
+    int64_t last;           /* Number of the last frame */
+    int64_t first;          /* Number of the first frame */
+    bool started;
+    int fill;               /* Bytes of the frame being collected */
+    uint8_t frame[FRAME_LEN];
+    int64_t errors;
+    int64_t first_byte_us;  /* When output started */
+} sink_t;
+
+static const char *const urls[MIRRORS] = {"http://a/s", "http://b/s", "http://c/s"};
+static mirror_t mirrors[MIRRORS];
+static sink_t sink;
+
+static uint8_t stream_byte(const mirror_t *m, int64_t pos)
+{
+    if (!m->mp3) {
+        return (uint8_t)(pos * 7 % 0x7F);
+    }
+    static const uint8_t header[4] = {0xFF, 0xFB, 0x90, 0x00};
+    int64_t k = pos / FRAME_LEN;
+    int at = pos % FRAME_LEN;
+    if (at < 4) {
+        return header[at];
+    }
+    if (at < 8) {
+        return (k >> (7 * (7 - at))) & 0x7F;
+    }
+    return (k + at) & 0x7F;
+}
+
+static int64_t live_point(void)
+{
+    return esp_timer_get_time() * BYTE_RATE / 1000000;
+}
+
+lean_http_handle_t lean_http_create(void)
+{
+    return calloc(1, sizeof(fake_conn_t));
+}
+
+esp_err_t lean_http_open(lean_http_handle_t h, const char *url, int64_t range_from, int timeout_ms,
+                         lean_http_response_t *response)
+{
+    mirror_t *m = NULL;
+    for (int i = 0; i < MIRRORS; i++) {
+        m = urls[i] == url ? &mirrors[i] : m;
+    }
+    CHECK(m != NULL && !h->open, "open of a known url on a closed connection");
+    m->opens++;
+    host_advance_us(30000);
+    if (m->fail_connects != 0) {
+        m->fail_connects -= m->fail_connects > 0;
+        m->failed_opens++;
+        host_advance_us(timeout_ms * 1000LL);
+        return ESP_ERR_TIMEOUT;
+    }
+    h->mirror = m;
+    h->open = true;
+    *response = (lean_http_response_t){.status = m->status, .content_length = m->length, .accept_ranges = m->ranges};
+    if (m->length < 0) {
+        h->pos = live_point();
+    } else if (range_from > 0 && m->ranges) {
+        // A file resumes where the last connection stopped
+        CHECK(range_from == m->served, "range from %lld, %lld was sent", (long long)range_from, (long long)m->served);
+        m->ranged_opens++;
+        response->status = 206;
+        h->pos = range_from;
+    } else {
+        h->pos = 0;
+    }
+    h->drop_at = -1;
+    if (m->drops > 0) {
+        m->drops--;
+        h->drop_at = h->pos + 1 + rand() % (64 * 1024);
+    }
+    return ESP_OK;
+}
+
+int lean_http_read(lean_http_handle_t h, char *buf, int len)
+{
+    mirror_t *m = h->mirror;
+    if (h->drop_at >= 0 && h->pos >= h->drop_at) {
+        // Down for a connect or not at all, never long enough to move to the next mirror
+        m->fail_connects = rand() % 2;
+        host_advance_us(500000);
+        return -1;
+    }
+    len = 1 + rand() % len;
+    if (m->length >= 0 && len > m->length - h->pos) {
+        len = m->length - h->pos;
+    }
+    if (h->drop_at >= 0 && len > h->drop_at - h->pos) {
+        len = h->drop_at - h->pos;
+    }
+    for (int i = 0; i < len; i++) {
+        buf[i] = stream_byte(m, h->pos + i);
+    }
+    h->pos += len;
+    m->served = h->pos;
+    host_advance_us((int64_t)len * 1000000 / BYTE_RATE);
+    return len;
+}
+
+void lean_http_close(lean_http_handle_t h)
+{
+    h->open = false;
+}
+
+void lean_http_destroy(lean_http_handle_t h)
+{
+    free(h);
+}
+
+void lean_http_get_stats(lean_http_handle_t h, lean_http_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+}
+
+static void frame_done(void)
+{
+    int64_t k = 0;
+    for (int i = 4; i < 8; i++) {
+        k = k << 7 | sink.frame[i];
+    }
+    for (int i = 8; i < FRAME_LEN; i++) {
+        sink.errors += sink.frame[i] != ((k + i) & 0x7F);
+    }
+    if (sink.frames == 0) {
+        sink.first = k;
+    } else if (k <= sink.last) {
+        sink.restarts++;
+    }
+    sink.last = k;
+    sink.frames++;
+}
+
+static int write_sink(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    if (sink.bytes == 0) {
+        sink.first_byte_us = esp_timer_get_time();
+        // The output starts on a frame header
+        sink.errors += (uint8_t)buf[0] != 0xFF;
+    }
+    sink.bytes += len;
+    for (int i = 0; i < len; i++) {
+        uint8_t b = buf[i];
+        if (b == 0xFF) {
+            sink.cut += sink.started && sink.fill != FRAME_LEN;
+            sink.started = true;
+            sink.fill = 0;
+        }
+        if (sink.started && sink.fill < FRAME_LEN) {
+            sink.frame[sink.fill++] = b;
+            if (sink.fill == FRAME_LEN) {
+                frame_done();
+            }
+        }
+    }
+    return len;
+}
+
+/* Runs the reader until it finishes the stream or for a while of virtual time */
+static audio_element_err_t run(resilient_http_cfg_t *cfg, int64_t for_us, resilient_http_stats_t *stats)
+{
+    sink = (sink_t){0};
+    audio_element_handle_t el = resilient_http_init(cfg);
+    audio_element_set_write_cb(el, write_sink, NULL);
+    int64_t end = esp_timer_get_time() + for_us;
+    audio_element_err_t ret;
+    do {
+        ret = host_element_process(el);
+    } while ((ret > 0 || ret == AEL_IO_TIMEOUT) && esp_timer_get_time() < end);
+    resilient_http_get_stats(el, stats);
+    audio_element_deinit(el);
+    return ret;
+}
+
+static void set_mirrors(const mirror_t *a, const mirror_t *b, const mirror_t *c)
+{
+    const mirror_t *all[MIRRORS] = {a, b, c};
+    for (int i = 0; i < MIRRORS; i++) {
+        mirrors[i] = all[i] ? *all[i] : (mirror_t){.fail_connects = -1, .status = 200, .length = -1, .mp3 = true};
+    }
+}
+
+static resilient_http_cfg_t config(int url_count)
+{
+    resilient_http_cfg_t cfg = RESILIENT_HTTP_CFG_DEFAULT();
+    cfg.urls = urls;
+    cfg.url_count = url_count;
+    return cfg;
+}
+
+static void test_live_drops(void)
+{
+    mirror_t live = {.status = 200, .length = -1, .drops = 40, .mp3 = true};
+    set_mirrors(&live, NULL, NULL);
+    resilient_http_cfg_t cfg = config(2);
+    resilient_http_stats_t stats;
+    audio_element_err_t ret = run(&cfg, 3600 * 1000000LL, &stats);
+    CHECK(ret == AEL_IO_TIMEOUT || ret > 0, "still playing after an hour, %d", ret);
+    CHECK(stats.reconnects == 40 && !stats.gave_up && stats.url_index == 0, "%d reconnects to mirror %d",
+          stats.reconnects, stats.url_index);
+    CHECK(sink.errors == 0 && sink.restarts == 0, "%lld bad frames, %lld out of order", (long long)sink.errors,
+          (long long)sink.restarts);
+    // Only the frame a drop cut short is cut, the output after a reconnect starts on a header
+    CHECK(sink.cut <= 40, "%lld frames cut", (long long)sink.cut);
+    // At worst 250 ms of backoff, a connect that times out, 500 ms more, the connect that works
+    // and up to two reads of 128 ms to the next header
+    CHECK(stats.max_recovery_ms <= 250 + 5030 + 500 + 30 + 2 * 128, "recovery took up to %d ms", stats.max_recovery_ms);
+    CHECK(mirrors[0].opens == 41 + mirrors[0].failed_opens && mirrors[1].opens == 0, "%d opens",
+          mirrors[0].opens);
+    printf("live: %lld frames, %lld cut, %d reconnects, %d ms at most, %d opens\n", (long long)sink.frames,
+           (long long)sink.cut, stats.reconnects, stats.max_recovery_ms, mirrors[0].opens);
+}
+
+static void test_file_resume(void)
+{
+    int64_t frames = 3000;
+    mirror_t file = {.status = 200, .length = frames * FRAME_LEN, .ranges = true, .drops = 12, .mp3 = true};
+    set_mirrors(&file, NULL, NULL);
+    resilient_http_cfg_t cfg = config(1);
+    resilient_http_stats_t stats;
+    audio_element_err_t ret = run(&cfg, 3600 * 1000000LL, &stats);
+    CHECK(ret == AEL_IO_DONE, "the file ends, %d", ret);
+    CHECK(mirrors[0].ranged_opens == 12 && stats.reconnects == 12, "%d resumed, %d reconnects",
+          mirrors[0].ranged_opens, stats.reconnects);
+    CHECK(stats.bytes_read == frames * FRAME_LEN, "%lld bytes read once each", (long long)stats.bytes_read);
+    CHECK(sink.errors == 0 && sink.restarts == 0 && sink.first == 0 && sink.last == frames - 1,
+          "frames %lld to %lld", (long long)sink.first, (long long)sink.last);
+    // A resume skips the rest of the frame the drop cut
+    CHECK(sink.frames + sink.cut + 12 >= frames && sink.frames >= frames - 24, "%lld frames whole, %lld cut",
+          (long long)sink.frames, (long long)sink.cut);
+    printf("file: %lld of %lld frames, resumed %d times\n", (long long)sink.frames, (long long)frames,
+           mirrors[0].ranged_opens);
+}
+
+static void test_file_restart(void)
+{
+    // Without ranges a file starts over, the drops all come early
+    int64_t frames = 100;
+    mirror_t file = {.status = 200, .length = frames * FRAME_LEN, .drops = 3, .mp3 = true};
+    set_mirrors(&file, NULL, NULL);
+    resilient_http_cfg_t cfg = config(1);
+    resilient_http_stats_t stats;
+    CHECK(run(&cfg, 3600 * 1000000LL, &stats) == AEL_IO_DONE, "the file ends");
+    CHECK(mirrors[0].ranged_opens == 0 && stats.reconnects == 3, "%d reconnects", stats.reconnects);
+    CHECK(sink.restarts == 3 && sink.last == frames - 1 && sink.errors == 0, "%lld restarts",
+          (long long)sink.restarts);
+}
+
+static void test_mirror_switch(void)
+{
+    // Down and 404, the third mirror plays after 3 failed attempts on each
+    mirror_t down = {.fail_connects = -1};
+    mirror_t missing = {.status = 404, .length = 100};
+    mirror_t live = {.status = 200, .length = -1, .mp3 = true};
+    set_mirrors(&down, &missing, &live);
+    resilient_http_cfg_t cfg = config(3);
+    resilient_http_stats_t stats;
+    int64_t start = esp_timer_get_time();
+    run(&cfg, 60 * 1000000LL, &stats);
+    CHECK(mirrors[0].opens == 3 && mirrors[1].opens == 3 && mirrors[2].opens == 1, "opens %d %d %d",
+          mirrors[0].opens, mirrors[1].opens, mirrors[2].opens);
+    CHECK(stats.url_index == 2 && stats.reconnects == 1 && !stats.gave_up, "plays from mirror %d", stats.url_index);
+    // 250 + 500 + ... + 8000 ms of backoff and the three connect timeouts of the first mirror
+    int64_t waited = sink.first_byte_us - start;
+    int64_t backoff = (250 + 500 + 1000 + 2000 + 4000 + 8000) * 1000LL + 3 * cfg.timeout_ms * 1000LL;
+    CHECK(waited >= backoff && waited < backoff + 1000000, "first audio after %lld ms", (long long)waited / 1000);
+    CHECK(stats.last_recovery_ms >= 15750 && stats.last_recovery_ms < waited / 1000, "recovery %d ms",
+          stats.last_recovery_ms);
+}
+
+static void test_give_up(void)
+{
+    set_mirrors(NULL, NULL, NULL);
+    resilient_http_cfg_t cfg = config(2);
+    cfg.timeout_ms = 100;
+    resilient_http_stats_t stats;
+    int64_t start = esp_timer_get_time();
+    audio_element_err_t ret = run(&cfg, 3600 * 1000000LL, &stats);
+    int64_t took_ms = (esp_timer_get_time() - start) / 1000;
+    CHECK(ret == AEL_IO_DONE && stats.gave_up, "gave up, %d", ret);
+    CHECK(mirrors[0].opens == 6 && mirrors[1].opens == 6, "opens %d %d", mirrors[0].opens, mirrors[1].opens);
+    CHECK(sink.bytes == 0, "nothing played");
+    // 11 backoffs up to the 16 s cap and 12 timed out connects
+    int64_t expect_ms = 250 + 500 + 1000 + 2000 + 4000 + 8000 + 5 * 16000 + 12 * (100 + 30);
+    CHECK(took_ms >= expect_ms && took_ms < expect_ms + 500, "gave up after %lld ms, expected %lld",
+          (long long)took_ms, (long long)expect_ms);
+
+    cfg.max_failures = 0;
+    set_mirrors(NULL, NULL, NULL);
+    ret = run(&cfg, 3600 * 1000000LL, &stats);
+    CHECK(ret == AEL_IO_TIMEOUT && !stats.gave_up && mirrors[0].opens + mirrors[1].opens > 200,
+          "retries forever, %d opens", mirrors[0].opens + mirrors[1].opens);
+}
+
+static void test_not_mp3(void)
+{
+    mirror_t other = {.status = 200, .length = -1, .mp3 = false};
+    set_mirrors(&other, NULL, NULL);
+    resilient_http_cfg_t cfg = config(1);
+    resilient_http_stats_t stats;
+    run(&cfg, 10 * 1000000LL, &stats);
+    // The reads up to 16 kB of looking for a header, then the rest as it is
+    int64_t held = stats.bytes_read - sink.bytes;
+    CHECK(sink.bytes > 0 && held > 16 * 1024 - cfg.buf_sz && held < 16 * 1024,
+          "%lld of %lld bytes passed through", (long long)sink.bytes, (long long)stats.bytes_read);
+}
+
+int main(void)
+{
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    srand(29);
+    test_live_drops();
+    test_file_resume();
+    test_file_restart();
+    test_mirror_switch();
+    test_give_up();
+    test_not_mp3();
+    return test_end();
+}
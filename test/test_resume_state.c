@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "nvs_flash.h"
+#include "resume_state.h"
+
+/*
+ * Runs the writer task for an hour of playback on the virtual clock against NVS in RAM:
+ * a song that plays, a volume change, a pause, the next song and a switch to the radio.
+ * The times of the writes must follow the two intervals, and the entries they cost are
+ * counted. Then a flush, a failing write, esp_restart() and reboots that read the state
+ * back, a path too long to save and a blob of another layout.
+ */
+
+#define HOUR_S 3600
+#define MAX_WRITES 200
+
+static const char *SONG = "/sdcard/music/03 - Song.mp3";
+static const char *NEXT_SONG = "/sdcard/music/04 - Next.mp3";
+
+static int write_s[MAX_WRITES];     /* Poll at which each write happened */
+static int write_count = 0;
+static int track_start_s = 0;
+static char captured[4096];
+
+/* The SD player, and what the other tasks change, once a second before the writer looks */
+static int32_t position_source(void)
+{
+    int now_s = host_time_us() / 1000000;
+    // The write of the poll before shows up now
+    if (resume_state_get_writes() > (uint32_t)write_count && write_count < MAX_WRITES) {
+        write_s[write_count++] = now_s - 1;
+    }
+    if (now_s == 100) {
+        resume_state_set_volume(70);
+    } else if (now_s == 2000) {
+        resume_state_set_track(4, NEXT_SONG);
+        track_start_s = now_s;
+    } else if (now_s == 3000) {
+        resume_state_set_mode(1);
+        resume_state_set_station(5);
+    }
+    if ((now_s >= 1200 && now_s < 1500) || now_s >= 3000) {
+        // Paused, then the radio, which cannot be resumed
+        return -1;
+    }
+    // The position stood still while paused
+    int paused_s = now_s >= 1500 && track_start_s < 1200 ? 300 : 0;
+    return (now_s - track_start_s - paused_s) * 1000;
+}
+
+/* The writes between from_s and to_s are 30 s apart, returns their count */
+static int check_steady(int from_s, int to_s)
+{
+    int count = 0;
+    int wrong = 0;
+    for (int i = 1; i < write_count; i++) {
+        if (write_s[i - 1] >= from_s && write_s[i] < to_s) {
+            wrong += write_s[i] - write_s[i - 1] != 30;
+            count++;
+        }
+    }
+    CHECK(wrong == 0 && count > 0, "%d of %d writes from %d s to %d s not 30 s apart", wrong, count, from_s, to_s);
+    return count;
+}
+
+/* Returns the first write at or after s */
+static int write_after(int s)
+{
+    for (int i = 0; i < write_count; i++) {
+        if (write_s[i] >= s) {
+            return write_s[i];
+        }
+    }
+    return -1;
+}
+
+static esp_err_t reboot(resume_state_t *saved)
+{
+    resume_state_cfg_t cfg = RESUME_STATE_CFG_DEFAULT();
+    esp_err_t ret = resume_state_init(&cfg, saved);
+    // The task of the boot before is gone with it
+    host_drop_tasks();
+    return ret;
+}
+
+static void test_first_boot(void)
+{
+    resume_state_t saved;
+    resume_state_cfg_t cfg = RESUME_STATE_CFG_DEFAULT();
+    CHECK(resume_state_init(&cfg, &saved) == ESP_ERR_NOT_FOUND, "nothing saved yet");
+    CHECK(saved.mode == -1 && saved.volume == -1 && saved.station == -1 && saved.track_id == -1 &&
+              saved.position_ms == 0 && saved.track[0] == '\0', "all -1 and no song");
+    CHECK(resume_state_get_writes() == 0 && host_nvs_entries() == 1, "only the namespace is written at boot");
+}
+
+static void test_hour(void)
+{
+    uint32_t entries = host_nvs_entries();
+    resume_state_set_mode(2);
+    resume_state_set_volume(60);
+    resume_state_set_track(3, SONG);
+    resume_state_set_position_source(position_source);
+
+    host_capture_log(captured, sizeof(captured));
+    host_run_tasks_until((int64_t)HOUR_S * 1000000 + 500000);
+    host_capture_log(NULL, 0);
+
+    uint32_t writes = resume_state_get_writes();
+    uint32_t per_write = 2 + (sizeof(resume_state_t) + 31) / 32;
+    printf("%u writes in an hour, %u NVS entries, %.1f pages of 126 entries\n", writes,
+           host_nvs_entries() - entries, (host_nvs_entries() - entries) / 126.0);
+    CHECK(write_count == (int)writes, "%d writes seen, %u made", write_count, writes);
+    CHECK(host_nvs_entries() - entries == writes * per_write, "%u entries a write",
+          (host_nvs_entries() - entries) / (writes ? writes : 1));
+
+    // A new state waits for the change interval after boot
+    CHECK(write_s[0] == 5, "first write at %d s", write_s[0]);
+    // Steady playback is 120 writes an hour
+    check_steady(5, 100);
+    int volume_s = write_after(100);
+    CHECK(volume_s >= 100 && volume_s <= 105, "the volume written at %d s", volume_s);
+    check_steady(volume_s, 1200);
+    // The last position before the pause, then nothing until it plays again
+    int resumed_s = write_after(1200 + 30);
+    CHECK(resumed_s >= 1500, "a paused song writes nothing, a write at %d s", resumed_s);
+    int song_s = write_after(2000);
+    CHECK(song_s >= 2000 && song_s <= 2005, "the next song written at %d s", song_s);
+    int steady = check_steady(song_s, 3000);
+    CHECK(steady >= 32, "%d writes in 1000 s of steady playback", steady);
+    int radio_s = write_after(3000);
+    CHECK(radio_s >= 3000 && radio_s <= 3005 && write_s[write_count - 1] == radio_s,
+          "the radio written at %d s, nothing after", radio_s);
+
+    char expect[64];
+    snprintf(expect, sizeof(expect), "I (3600000) RESUME_STATE: %u state writes in the last hour\n", writes);
+    CHECK(strstr(captured, expect) != NULL, "the hourly count logged:\n%s", captured);
+}
+
+static void test_flush(void)
+{
+    uint32_t writes = resume_state_get_writes();
+    CHECK(resume_state_flush() == ESP_OK && resume_state_get_writes() == writes, "nothing changed, nothing written");
+    resume_state_set_volume(40);
+    CHECK(resume_state_flush() == ESP_OK && resume_state_get_writes() == writes + 1, "a flush writes at once");
+
+    // A failed write is logged and the state written by the next
+    host_nvs_fail_writes(true);
+    resume_state_set_volume(45);
+    captured[0] = '\0';
+    host_capture_log(captured, sizeof(captured));
+    CHECK(resume_state_flush() == ESP_ERR_NVS_NOT_ENOUGH_SPACE && resume_state_get_writes() == writes + 1,
+          "the error returned");
+    host_capture_log(NULL, 0);
+    CHECK(strstr(captured, "Failed to write the state: ") != NULL, "the error logged:\n%s", captured);
+    host_nvs_fail_writes(false);
+    CHECK(resume_state_flush() == ESP_OK && resume_state_get_writes() == writes + 2, "written once NVS works");
+
+    // esp_restart() writes what changed since
+    resume_state_set_station(7);
+    CHECK(host_run_shutdown_handlers() == 1 && resume_state_get_writes() == writes + 3, "written on the restart");
+}
+
+static void test_reboot(void)
+{
+    resume_state_t saved;
+    CHECK(reboot(&saved) == ESP_OK, "the state of the boot before");
+    CHECK(saved.mode == 1 && saved.volume == 45 && saved.station == 7 && saved.track_id == 4 &&
+              strcmp(saved.track, NEXT_SONG) == 0, "mode %d volume %d station %d song %d %s", (int)saved.mode,
+          (int)saved.volume, (int)saved.station, (int)saved.track_id, saved.track);
+    // The last position polled before the radio took over
+    CHECK(saved.position_ms == 999000, "at %d ms", (int)saved.position_ms);
+    uint32_t writes = resume_state_get_writes();
+    CHECK(resume_state_flush() == ESP_OK && resume_state_get_writes() == writes,
+          "the loaded state is not written again");
+
+    // A path longer than the state holds is not cut, the song is resumed by its index
+    char path[200];
+    memset(path, 'a', sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    resume_state_set_track(9, path);
+    resume_state_flush();
+    CHECK(reboot(&saved) == ESP_OK && saved.track_id == 9 && saved.track[0] == '\0' && saved.position_ms == 0,
+          "song %d, path '%s'", (int)saved.track_id, saved.track);
+
+    // Saved by a firmware with another layout
+    nvs_handle_t nvs;
+    char old[RESUME_STATE_PATH_LEN] = {1};
+    CHECK(nvs_open("resume", NVS_READWRITE, &nvs) == ESP_OK && nvs_set_blob(nvs, "state", old, sizeof(old)) == ESP_OK,
+          "old blob written");
+    CHECK(reboot(&saved) == ESP_ERR_NOT_FOUND && saved.mode == -1 && saved.track_id == -1 && saved.track[0] == '\0',
+          "a blob of another size is not loaded");
+}
+
+int main(void)
+{
+    nvs_flash_init();
+    host_nvs_reset();
+    test_first_boot();
+    test_hour();
+    test_flush();
+    test_reboot();
+    return test_end();
+}
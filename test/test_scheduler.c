@@ -0,0 +1,145 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <time.h>
+#include "host.h"
+#include "test.h"
+#include "scheduler.h"
+
+/*
+ * Runs the scheduler task through 2026 in Central European time on the virtual clock,
+ * with waits that end up to a tick early and up to 2 ms late. The clock is set by
+ * "SNTP" 30 s after boot and stepped 2 hours 15 minutes forward on 1 June. On it run an
+ * hourly chime, alarms at 07:00 and at 02:30, which does not exist on the day summer
+ * time starts and comes twice on the day it ends, and a 100 ms animation.
+ */
+
+#define SECOND_US 1000000LL
+#define DAY_S (24 * 3600)
+#define STEP_S (135 * 60)
+#define FRAMES 100000
+
+static scheduler_timer_t chime;
+static scheduler_timer_t alarm_7;
+static scheduler_timer_t alarm_230;
+static scheduler_timer_t animation;
+static scheduler_timer_t sntp;
+
+static time_t year_start;
+static int chimes = 0;
+static int alarms_7 = 0;
+static int alarms_230 = 0;
+static int frames = 0;
+static bool stepped = false;
+
+static struct tm local_now(void)
+{
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    return tm;
+}
+
+static void chime_cb(scheduler_timer_t *t, void *arg)
+{
+    struct tm tm = local_now();
+    chimes++;
+    CHECK(!(tm.tm_mon == 2 && tm.tm_mday == 29 && tm.tm_hour == 2), "chime at 02:00 on 29 March");
+    CHECK(tm.tm_min == 0 && tm.tm_sec == 0, "chime at %02d:%02d:%02d on %d-%d", tm.tm_hour, tm.tm_min, tm.tm_sec,
+          tm.tm_mon + 1, tm.tm_mday);
+}
+
+static void alarm_7_cb(scheduler_timer_t *t, void *arg)
+{
+    struct tm tm = local_now();
+    alarms_7++;
+    CHECK(tm.tm_hour == 7 && tm.tm_min == 0 && tm.tm_sec == 0, "07:00 alarm at %02d:%02d:%02d on %d-%d", tm.tm_hour,
+          tm.tm_min, tm.tm_sec, tm.tm_mon + 1, tm.tm_mday);
+    if (tm.tm_mon == 5 && tm.tm_mday == 1) {
+        scheduler_start_after(&sntp, 30 * 60 * 1000);
+    }
+}
+
+static void sntp_cb(scheduler_timer_t *t, void *arg)
+{
+    // At 07:30 SNTP finds the clock 2 hours 15 minutes behind and says so, the 08:00 and 09:00 chimes are skipped
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    tv.tv_sec += STEP_S;
+    settimeofday(&tv, NULL);
+    scheduler_time_changed();
+    stepped = true;
+}
+
+static void alarm_230_cb(scheduler_timer_t *t, void *arg)
+{
+    struct tm tm = local_now();
+    alarms_230++;
+    // On 29 March the clock jumps from 02:00 to 03:00, the alarm comes at 03:30
+    int hour = tm.tm_mon == 2 && tm.tm_mday == 29 ? 3 : 2;
+    CHECK(tm.tm_hour == hour && tm.tm_min == 30 && tm.tm_sec == 0, "02:30 alarm at %02d:%02d:%02d %s on %d-%d",
+          tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_isdst ? "CEST" : "CET", tm.tm_mon + 1, tm.tm_mday);
+    CHECK(alarms_230 == tm.tm_yday + 1, "%d 02:30 alarms by day %d", alarms_230, tm.tm_yday + 1);
+}
+
+static void animation_cb(scheduler_timer_t *t, void *arg)
+{
+    frames++;
+    if (frames == 300) {
+        // 30 s after boot the clock is set to just after 2026 began, the task notices by itself
+        CHECK(chimes == 0 && alarms_7 == 0 && alarms_230 == 0, "nothing on the wall clock before it is set");
+        struct timeval tv = {.tv_sec = year_start, .tv_usec = 123456};
+        settimeofday(&tv, NULL);
+    }
+    if (frames < FRAMES) {
+        scheduler_start_after(t, 100);
+    }
+}
+
+int main(void)
+{
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    struct tm start = {.tm_year = 126, .tm_mon = 0, .tm_mday = 1, .tm_isdst = -1};
+    year_start = mktime(&start);
+
+    // Booted 5 s ago, the wall clock is not set
+    host_set_time_us(5 * SECOND_US);
+    host_set_wall_us(5 * SECOND_US);
+    host_set_wake_jitter_us(1000000 / CONFIG_FREERTOS_HZ, 2000);
+
+    scheduler_cfg_t cfg = SCHEDULER_CFG_DEFAULT();
+    CHECK(scheduler_init(&cfg) == ESP_OK, "scheduler started");
+    scheduler_timer_init(&chime, chime_cb, NULL);
+    scheduler_timer_init(&alarm_7, alarm_7_cb, NULL);
+    scheduler_timer_init(&alarm_230, alarm_230_cb, NULL);
+    scheduler_timer_init(&animation, animation_cb, NULL);
+    scheduler_timer_init(&sntp, sntp_cb, NULL);
+    scheduler_start_hourly(&chime);
+    scheduler_start_daily(&alarm_7, 7, 0);
+    scheduler_start_daily(&alarm_230, 2, 30);
+    scheduler_start_after(&animation, 100);
+    CHECK(scheduler_is_running(&chime), "a wall clock timer waiting for the clock runs");
+
+    // Into the last minute of 2026, the clock was set a little after 35 s and stepped by STEP_S
+    int64_t end_us = 35 * SECOND_US + (365LL * DAY_S - 1 - STEP_S) * SECOND_US;
+    host_run_tasks_until(end_us);
+    struct tm end = local_now();
+    CHECK(end.tm_year == 126 && end.tm_mon == 11 && end.tm_mday == 31 && end.tm_hour == 23 && end.tm_min == 59,
+          "ran to %d-%d-%d %02d:%02d", end.tm_year + 1900, end.tm_mon + 1, end.tm_mday, end.tm_hour, end.tm_min);
+
+    scheduler_stats_t stats;
+    scheduler_get_stats(&stats);
+    printf("%d chimes, %d 07:00 and %d 02:30 alarms, %d frames\n", chimes, alarms_7, alarms_230, frames);
+    printf("%u callbacks, %.2f ms late on average, %.2f ms at most\n", stats.dispatched,
+           stats.total_late_us / 1000.0 / stats.dispatched, stats.max_late_us / 1000.0);
+
+    // 01:00 on 1 January to 23:00 on 31 December without the two the step skipped, 02:00 twice on 25 October
+    CHECK(chimes == 365 * 24 - 1 - 2, "%d chimes", chimes);
+    CHECK(alarms_7 == 365 && alarms_230 == 365, "%d and %d alarms", alarms_7, alarms_230);
+    CHECK(frames == FRAMES && stepped, "%d frames", frames);
+    // A tick of rounding up, the 2 ms the task takes to run and a tick of waking early made up for
+    CHECK(stats.max_late_us < 2 * 1000000 / CONFIG_FREERTOS_HZ + 2000, "%lld us late",
+          (long long)stats.max_late_us);
+    return test_end();
+}
@@ -0,0 +1,146 @@
+#include <stdlib.h>
+#include "test.h"
+#include "timer_wheel.h"
+
+/*
+ * Runs random adds, moves, cancels and advances against a model that keeps the tick
+ * every timer is due on. Every callback must come on its tick, no pending timer may be
+ * left behind an advance and timer_wheel_next_due() must never sleep past a timer. It
+ * starts at 0xFFFF0000, so the ticks wrap, and again where the signed distance wraps.
+ */
+
+#define TIMERS 1000
+#define OPS 200000
+
+typedef struct {
+    timer_wheel_timer_t timer;
+    bool pending;
+    uint32_t due;           /* Tick the callback must come on */
+} model_t;
+
+static timer_wheel_t wheel;
+static model_t model[TIMERS];
+static long fired = 0;
+static long late_adds = 0;
+
+/* The distance of a tick after the next tick to process */
+static uint32_t ahead(uint32_t tick)
+{
+    return tick - wheel.now;
+}
+
+static uint32_t random_delay(void)
+{
+    switch (rand() % 6) {
+    case 0:
+        return 0;
+    case 1:
+        return rand() % 64;
+    case 2:
+        return rand() % 4096;
+    case 3:
+        return rand() % (1 << 24);
+    case 4:
+        // Beyond the span of the wheel, parked in the last level
+        return (1 << 24) + rand() % (1 << 28);
+    default:
+        return rand() % 100;
+    }
+}
+
+static void add(model_t *m, uint32_t expires)
+{
+    timer_wheel_add(&wheel, &m->timer, expires);
+    m->pending = true;
+    // A tick that passed expires on the next tick to process
+    m->due = (int32_t)(expires - wheel.now) < 0 ? wheel.now : expires;
+}
+
+static void expired(timer_wheel_timer_t *timer, void *arg)
+{
+    model_t *m = arg;
+    uint32_t tick = wheel.now - 1;
+    CHECK(m->pending, "timer %d expired while not pending", (int)(m - model));
+    CHECK(m->due == tick, "timer %d due on %u expired on %u", (int)(m - model), m->due, tick);
+    CHECK(!timer_wheel_pending(timer), "timer %d is out of the wheel in its callback", (int)(m - model));
+    m->pending = false;
+    fired++;
+    // Callbacks add timers again, now and then in the past
+    if (rand() % 3 == 0) {
+        late_adds++;
+        add(m, rand() % 4 == 0 ? tick - rand() % 1000 : tick + random_delay());
+    }
+}
+
+static void check_state(void)
+{
+    uint32_t nearest = TIMER_WHEEL_IDLE;
+    for (int i = 0; i < TIMERS; i++) {
+        CHECK(timer_wheel_pending(&model[i].timer) == model[i].pending, "timer %d pending", i);
+        if (model[i].pending) {
+            // Nothing due before the next tick to process is still waiting
+            CHECK(ahead(model[i].due) < 0x80000000u, "timer %d due on %u was left behind at %u", i, model[i].due,
+                  wheel.now);
+            if (ahead(model[i].due) < nearest) {
+                nearest = ahead(model[i].due);
+            }
+        }
+    }
+    uint32_t next = timer_wheel_next_due(&wheel);
+    CHECK(next <= nearest, "next due in %u ticks, a timer is due in %u", next, nearest);
+    CHECK((next == TIMER_WHEEL_IDLE) == (nearest == TIMER_WHEEL_IDLE), "idle only without timers");
+}
+
+static void run(uint32_t start, unsigned seed)
+{
+    srand(seed);
+    timer_wheel_init(&wheel, start);
+    for (int i = 0; i < TIMERS; i++) {
+        timer_wheel_timer_init(&model[i].timer, expired, &model[i]);
+        model[i].pending = false;
+    }
+    long advances = 0;
+    uint64_t passed = 0;
+    for (int op = 0; op < OPS; op++) {
+        model_t *m = &model[rand() % TIMERS];
+        int pick = rand() % 100;
+        if (pick < 40) {
+            add(m, wheel.now + random_delay());
+        } else if (pick < 45) {
+            add(m, wheel.now - 1 - rand() % 5000);
+        } else if (pick < 55) {
+            timer_wheel_cancel(&wheel, &m->timer);
+            m->pending = false;
+        } else {
+            // A tick, a while, to the next work or far ahead
+            uint32_t next = timer_wheel_next_due(&wheel);
+            uint32_t step = 0;
+            if (pick == 99) {
+                step = rand() % (1 << 24);
+            } else if (pick >= 85) {
+                step = next != TIMER_WHEEL_IDLE ? next : 1000;
+            } else if (pick >= 70) {
+                step = rand() % 200;
+            }
+            timer_wheel_advance(&wheel, wheel.now + step);
+            passed += step + 1;
+            advances++;
+        }
+        if (op % 100 == 0) {
+            check_state();
+        }
+    }
+    check_state();
+    CHECK(passed > 0x100000000ull, "only %llu ticks passed, the ticks did not wrap", (unsigned long long)passed);
+    printf("from 0x%08x: %ld advances over %llu ticks\n", start, advances, (unsigned long long)passed);
+}
+
+int main(void)
+{
+    run(0xFFFF0000u, 39);
+    run(0x7FFF0000u, 40);
+    run(0, 41);
+    printf("%ld callbacks, %ld added from a callback\n", fired, late_adds);
+    CHECK(fired > 100000, "%ld timers expired", fired);
+    return test_end();
+}
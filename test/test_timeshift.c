@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "timeshift.h"
+
+/*
+ * Streams a generated byte pattern through the timeshift element in random pieces, with
+ * input timeouts, pauses of random length and jumps to live, until the RAM ring and the
+ * ring file have wrapped many times. The sink knows where in the stream every byte must
+ * come from: the bytes played, plus what the element dropped and what a jump skipped.
+ */
+
+#define SPILL "test_timeshift.bin"
+#define RAM_SIZE (16 * 1024)
+#define SPILL_SIZE (256 * 1024)
+/* The ring file holds whole blocks, the block being filled is only in RAM */
+#define BLOCK 4096
+
+typedef struct {
+    int64_t pos;            /* Stream offset of the next byte */
+    int64_t end;            /* Length of the stream */
+    int max_read;
+    long timeouts;
+} source_t;
+
+typedef struct {
+    int64_t played;
+    int64_t skipped;        /* Bytes a jump to live left out */
+    int64_t errors;
+} sink_t;
+
+static source_t source;
+static sink_t sink;
+static audio_element_handle_t el;
+
+static uint8_t stream_byte(int64_t pos)
+{
+    return (uint8_t)(((uint32_t)pos * 0x9E3779B1u) >> 24);
+}
+
+static int read_source(audio_element_handle_t self, char *buf, int len, TickType_t wait, void *ctx)
+{
+    if (rand() % 10 == 0) {
+        source.timeouts++;
+        return AEL_IO_TIMEOUT;
+    }
+    len = 1 + rand() % (len < source.max_read ? len : source.max_read);
+    if (len > source.end - source.pos) {
+        len = source.end - source.pos;
+    }
+    if (len == 0) {
+        return AEL_IO_DONE;
+    }
+    for (int i = 0; i < len; i++) {
+        buf[i] = stream_byte(source.pos + i);
+    }
+    source.pos += len;
+    return len;
+}
+
+static int write_sink(audio_element_handle_t self, char *buf, int len, TickType_t wait, void *ctx)
+{
+    timeshift_stats_t stats;
+    timeshift_get_stats(el, &stats);
+    int64_t at = sink.played + sink.skipped + stats.dropped;
+    for (int i = 0; i < len; i++) {
+        if ((uint8_t)buf[i] != stream_byte(at + i)) {
+            sink.errors++;
+        }
+    }
+    sink.played += len;
+    return len;
+}
+
+static void check_stats(int64_t history)
+{
+    timeshift_stats_t stats;
+    timeshift_get_stats(el, &stats);
+    CHECK(stats.behind_live >= 0 && stats.behind_live <= stats.available, "%lld behind live, %lld available",
+          (long long)stats.behind_live, (long long)stats.available);
+    CHECK(stats.available <= history, "%lld bytes of history", (long long)stats.available);
+    CHECK(source.pos == sink.played + sink.skipped + stats.dropped + stats.behind_live, "bytes accounted for");
+}
+
+/* Runs the element like its task does, pausing, resuming and jumping to live at random */
+static void run(const char *spill_path, int64_t history, int64_t length, unsigned seed)
+{
+    timeshift_cfg_t cfg = TIMESHIFT_CFG_DEFAULT();
+    cfg.ram_size = RAM_SIZE;
+    cfg.spill_path = spill_path;
+    cfg.spill_size = SPILL_SIZE;
+    el = timeshift_init(&cfg);
+    audio_element_set_read_cb(el, read_source, NULL);
+    audio_element_set_write_cb(el, write_sink, NULL);
+
+    srand(seed);
+    source = (source_t){.end = length, .max_read = 3000};
+    sink = (sink_t){0};
+    int pause_left = 0;
+    int pauses = 0;
+    int jumps = 0;
+    int64_t deepest = 0;
+    audio_element_err_t ret;
+    while ((ret = host_element_process(el)) > 0) {
+        if (pause_left > 0 && --pause_left == 0) {
+            timeshift_stats_t stats;
+            timeshift_get_stats(el, &stats);
+            deepest = stats.behind_live > deepest ? stats.behind_live : deepest;
+            if (rand() % 4 == 0) {
+                // The jump happens on the next run, before more input comes in
+                sink.skipped += stats.behind_live;
+                timeshift_jump_to_live(el);
+                jumps++;
+            }
+            timeshift_set_paused(el, false);
+        } else if (pause_left == 0 && rand() % 500 == 0) {
+            // Up to about twice the history, so some pauses overflow it
+            pause_left = 1 + rand() % (int)(history * 4 / source.max_read);
+            pauses++;
+            timeshift_set_paused(el, true);
+        }
+        CHECK(timeshift_is_paused(el) == (pause_left > 0), "paused state");
+        if (rand() % 64 == 0) {
+            check_stats(history);
+        }
+    }
+    CHECK(ret == AEL_IO_DONE, "the stream ends, %d", ret);
+    timeshift_stats_t stats;
+    timeshift_get_stats(el, &stats);
+    CHECK(sink.errors == 0, "%lld bytes out of place", (long long)sink.errors);
+    CHECK(stats.behind_live == 0 && source.pos == length, "all played to the end");
+    check_stats(history);
+    CHECK(stats.dropped > 0 && deepest > RAM_SIZE / 2, "pauses overflowed the history, %lld dropped",
+          (long long)stats.dropped);
+    if (history > RAM_SIZE) {
+        CHECK(deepest > RAM_SIZE, "played from the ring file, at most %lld behind", (long long)deepest);
+        CHECK(stats.spill_written > 4 * SPILL_SIZE, "the ring file wrapped, %lld written",
+              (long long)stats.spill_written);
+    }
+    printf("%s: %lld bytes, %d pauses up to %lld behind, %d jumps skipping %lld, %lld dropped, %ld timeouts\n",
+           history > RAM_SIZE ? "ring file" : "RAM", (long long)length, pauses, (long long)deepest, jumps,
+           (long long)sink.skipped, (long long)stats.dropped, source.timeouts);
+    audio_element_deinit(el);
+}
+
+static void test_config(void)
+{
+    timeshift_cfg_t cfg = TIMESHIFT_CFG_DEFAULT();
+    cfg.ram_size = 4096;
+    CHECK(timeshift_init(&cfg) == NULL, "a RAM ring of one block is refused");
+    cfg = (timeshift_cfg_t)TIMESHIFT_CFG_DEFAULT();
+    cfg.spill_size = 10000;
+    CHECK(timeshift_init(&cfg) == NULL, "a ring file of part of a block is refused");
+}
+
+int main(void)
+{
+    test_config();
+    run(NULL, RAM_SIZE, 8 * 1024 * 1024, 28);
+    run(SPILL, SPILL_SIZE + BLOCK, 24 * 1024 * 1024, 29);
+    // A ring file that cannot be opened leaves the history in RAM
+    run("no/such/dir/" SPILL, RAM_SIZE, 2 * 1024 * 1024, 30);
+    remove(SPILL);
+    return test_end();
+}
@@ -0,0 +1,355 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "mode_manager.h"
+#include "trace_recorder.h"
+
+/*
+ * Replays data/session.trc, a recorded session, on a virtual clock and compares the
+ * trace of the replay byte for byte with data/session_replay.trc. The mode manager is
+ * replaced by reactions that take a fixed time, so the replay only changes when the
+ * recorder, the encoding or the replay timing changes. After an intended change,
+ * test_trace --update records the session again and rewrites both files.
+ */
+
+#define SESSION TEST_DATA_DIR "/session.trc"
+#define GOLDEN TEST_DATA_DIR "/session_replay.trc"
+#define REPLAY "session_replay.trc"
+#define CUT "session_cut.trc"
+
+#define MS 1000
+#define KEY_REC 1
+#define KEY_SET 2
+#define KEY_PLAY 3
+#define KEY_MODE 4
+#define KEY_VOLDOWN 5
+#define KEY_VOLUP 6
+#define CLICK 1
+#define CLICK_RELEASE 2
+#define PRESS 3
+#define PRESS_RELEASE 4
+
+static audio_element_handle_t i2s;
+static audio_element_handle_t http;
+static int mode = 0;
+static bool paused = false;
+
+static void element_status(audio_element_handle_t el, audio_element_status_t status)
+{
+    audio_event_iface_msg_t msg = {
+        .source_type = AUDIO_ELEMENT_TYPE_ELEMENT,
+        .source = el,
+        .cmd = AEL_MSG_CMD_REPORT_STATUS,
+        .data = (void *)(intptr_t)status,
+    };
+    trace_recorder_event(&msg);
+}
+
+static void periph_event(int periph_id, int cmd, int data)
+{
+    audio_event_iface_msg_t msg = {
+        .source_type = AUDIO_ELEMENT_TYPE_PERIPH,
+        .source = (void *)(intptr_t)periph_id,
+        .cmd = cmd,
+        .data = (void *)(intptr_t)data,
+    };
+    trace_recorder_event(&msg);
+}
+
+static void io(trace_io_t kind, int duration_ms, int result)
+{
+    int64_t start = host_time_us();
+    host_advance_us(duration_ms * MS);
+    trace_recorder_io(kind, start, result);
+}
+
+/**
+ * @brief Stands in for the mode manager, reacts to a key after a fixed time.
+ */
+void mode_manager_inject_key(int key_id, int action)
+{
+    trace_recorder_key(key_id, action);
+    periph_event(7, action, key_id);
+    if (action != CLICK_RELEASE) {
+        return;
+    }
+    switch (key_id) {
+    case KEY_MODE:
+        host_advance_us(40 * MS);
+        element_status(i2s, AEL_STATUS_STATE_STOPPED);
+        mode = (mode + 1) % 3;
+        io(TRACE_IO_SD_OPEN, 25, 0);
+        host_advance_us(150 * MS);
+        trace_recorder_mode(mode, 215);
+        host_advance_us(60 * MS);
+        element_status(i2s, AEL_STATUS_STATE_RUNNING);
+        break;
+    case KEY_PLAY:
+        host_advance_us(12 * MS);
+        paused = !paused;
+        element_status(i2s, paused ? AEL_STATUS_STATE_PAUSED : AEL_STATUS_STATE_RUNNING);
+        break;
+    case KEY_SET:
+        host_advance_us(30 * MS);
+        element_status(i2s, AEL_STATUS_STATE_STOPPED);
+        io(TRACE_IO_HTTP_CONNECT, 180, 200);
+        host_advance_us(90 * MS);
+        element_status(http, AEL_STATUS_STATE_RUNNING);
+        element_status(i2s, AEL_STATUS_STATE_RUNNING);
+        break;
+    default:
+        break;
+    }
+}
+
+static void key_at(int at_ms, int key_id, int action)
+{
+    if (host_time_us() < at_ms * MS) {
+        host_set_time_us(at_ms * MS);
+    }
+    mode_manager_inject_key(key_id, action);
+}
+
+static void click_at(int at_ms, int key_id)
+{
+    key_at(at_ms, key_id, CLICK);
+    key_at(at_ms + 90, key_id, CLICK_RELEASE);
+}
+
+/**
+ * @brief Records the session the golden replay comes from.
+ */
+static void record_session(void)
+{
+    host_set_time_us(0);
+    trace_recorder_init();
+
+    // Boot: card, Wi-Fi, the first station
+    periph_event(3, 0, 16);
+    host_advance_us(1450 * MS);
+    trace_recorder_mode(0, 1450);
+    io(TRACE_IO_HTTP_CONNECT, 640, 200);
+    element_status(http, AEL_STATUS_STATE_RUNNING);
+    host_advance_us(300 * MS);
+    element_status(i2s, AEL_STATUS_STATE_RUNNING);
+    trace_recorder_cpu(38, 160, 0);
+
+    click_at(4000, KEY_SET);
+    click_at(9500, KEY_PLAY);
+    click_at(11230, KEY_PLAY);
+    key_at(15000, KEY_VOLUP, PRESS);
+    key_at(16875, KEY_VOLUP, PRESS_RELEASE);
+    click_at(18004, KEY_VOLDOWN);
+    click_at(18413, KEY_VOLDOWN);
+    // A slow read the replay does not repeat
+    host_set_time_us(21000 * MS);
+    io(TRACE_IO_HTTP_READ, 260, 1024);
+    trace_recorder_cpu(52, 160, 1);
+    click_at(25000, KEY_MODE);
+    click_at(31777, KEY_SET);
+    click_at(32100, KEY_MODE);
+    click_at(40000, KEY_REC);
+    host_advance_us(TRACE_REPLAY_TAIL_MS * MS);
+    trace_recorder_cpu(41, 80, 1);
+    CHECK(trace_recorder_save(SESSION) == ESP_OK, "recording the session");
+}
+
+static void replay(const char *path, const char *out_path)
+{
+    mode = 0;
+    paused = false;
+    host_set_time_us(123456789);
+    CHECK(trace_recorder_replay(path, out_path) == ESP_OK, "replaying %s", path);
+    CHECK(host_run_tasks() == 1, "one replay task");
+}
+
+static uint8_t *load(const char *path, int *len)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        *len = 0;
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    *len = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = malloc(*len);
+    *len = fread(data, 1, *len, file);
+    fclose(file);
+    return data;
+}
+
+/* Serves a trace from memory in pieces of 1 to 13 bytes */
+typedef struct {
+    const uint8_t *data;
+    int len;
+    int pos;
+} memory_t;
+
+static int read_memory(void *ctx, uint8_t *buf, int size)
+{
+    memory_t *memory = ctx;
+    int n = 1 + rand() % 13;
+    if (n > size) {
+        n = size;
+    }
+    if (n > memory->len - memory->pos) {
+        n = memory->len - memory->pos;
+    }
+    memcpy(buf, memory->data + memory->pos, n);
+    memory->pos += n;
+    return n;
+}
+
+/* Decodes the keys of a trace, their times from the first one */
+static int read_keys(const uint8_t *data, int len, int64_t *times, int max)
+{
+    memory_t memory = {data, len, 0};
+    trace_reader_t reader;
+    if (!trace_reader_init(&reader, read_memory, &memory)) {
+        return -1;
+    }
+    trace_record_t rec;
+    int keys = 0;
+    while (trace_reader_next(&reader, &rec) > 0) {
+        if (rec.type == TRACE_KEY && keys < max) {
+            times[keys++] = rec.time_us;
+        }
+    }
+    for (int i = keys - 1; i >= 0; i--) {
+        times[i] -= times[0];
+    }
+    return keys;
+}
+
+static void test_codec(void)
+{
+    enum { RECORDS = 20000 };
+    int size = RECORDS * TRACE_RECORD_MAX + TRACE_HEADER_SIZE;
+    uint8_t *data = malloc(size);
+    trace_record_t *recs = malloc(RECORDS * sizeof(trace_record_t));
+    int64_t last_us = 0;
+    int64_t now_us = 0;
+    int len = TRACE_HEADER_SIZE;
+    trace_write_header(data);
+
+    srand(45);
+    for (int i = 0; i < RECORDS; i++) {
+        trace_record_t *rec = &recs[i];
+        memset(rec, 0, sizeof(*rec));
+        // Mostly short steps, now and then hours
+        now_us += rand() % 8 == 0 ? (int64_t)rand() * 1000 : rand() % 100000;
+        rec->time_us = now_us;
+        rec->type = 1 + rand() % TRACE_MARK;
+        rec->nargs = rand() % (TRACE_MAX_ARGS + 1);
+        for (int j = 0; j < rec->nargs; j++) {
+            int pick = rand() % 4;
+            rec->args[j] = pick == 0 ? INT32_MIN + rand() % 3 : pick == 1 ? INT32_MAX - rand() % 3 : rand() % 2001 - 1000;
+        }
+        int n = trace_encode(data + len, size - len, rec, &last_us);
+        CHECK(n > 0 && n <= TRACE_RECORD_MAX, "record %d encoded in %d bytes", i, n);
+        len += n;
+    }
+    trace_record_t rec = recs[0];
+    uint8_t small[3];
+    int64_t small_us = 0;
+    CHECK(trace_encode(small, sizeof(small), &rec, &small_us) == 0, "a record that does not fit is not written");
+
+    memory_t memory = {data, len, 0};
+    trace_reader_t reader;
+    CHECK(trace_reader_init(&reader, read_memory, &memory), "header read");
+    int i = 0;
+    while (trace_reader_next(&reader, &rec) > 0) {
+        if (i < RECORDS) {
+            const trace_record_t *want = &recs[i];
+            CHECK(rec.time_us == want->time_us && rec.type == want->type && rec.nargs == want->nargs &&
+                      memcmp(rec.args, want->args, want->nargs * sizeof(int32_t)) == 0,
+                  "record %d decoded as it was encoded", i);
+        }
+        i++;
+    }
+    CHECK(i == RECORDS, "%d of %d records read in chunks", i, RECORDS);
+
+    // Cut in the middle of the last record
+    memory = (memory_t){data, len - 1, 0};
+    trace_reader_init(&reader, read_memory, &memory);
+    int n;
+    i = 0;
+    while ((n = trace_reader_next(&reader, &rec)) > 0) {
+        i++;
+    }
+    CHECK(n == -1 && i == RECORDS - 1, "cut off trace ends with -1 after %d records", i);
+
+    memory = (memory_t){(const uint8_t *)"TRC0xxxx", 8, 0};
+    CHECK(!trace_reader_init(&reader, read_memory, &memory), "wrong magic refused");
+    free(recs);
+    free(data);
+}
+
+static void test_replay(void)
+{
+    int session_len;
+    int golden_len;
+    int replay_len;
+    uint8_t *session = load(SESSION, &session_len);
+    uint8_t *golden = load(GOLDEN, &golden_len);
+    CHECK(session != NULL && golden != NULL, "%s and %s are there", SESSION, GOLDEN);
+
+    replay(SESSION, REPLAY);
+    uint8_t *replayed = load(REPLAY, &replay_len);
+    CHECK(replayed != NULL && replay_len == golden_len && memcmp(replayed, golden, golden_len) == 0,
+          "the replay of %d bytes is the %d bytes of %s", replay_len, golden_len, GOLDEN);
+
+    // The keys come as far apart as they were recorded, give or take a tick
+    int64_t recorded[64];
+    int64_t played[64];
+    int keys = read_keys(session, session_len, recorded, 64);
+    CHECK(keys > 0 && read_keys(replayed, replay_len, played, 64) == keys, "%d keys replayed", keys);
+    for (int i = 0; i < keys; i++) {
+        int64_t error_us = played[i] - recorded[i];
+        CHECK(error_us > -1000000 / CONFIG_FREERTOS_HZ && error_us <= 0, "key %d off by %lld us", i,
+              (long long)error_us);
+    }
+
+    // A session that was cut off replays up to the cut
+    FILE *file = fopen(CUT, "wb");
+    fwrite(session, 1, session_len / 2, file);
+    fclose(file);
+    replay(CUT, REPLAY);
+    free(replayed);
+    replayed = load(REPLAY, &replay_len);
+    int cut_keys = read_keys(replayed, replay_len, played, 64);
+    CHECK(cut_keys > 0 && cut_keys < keys, "%d of %d keys replayed from half the session", cut_keys, keys);
+
+    CHECK(trace_recorder_replay(TEST_DATA_DIR "/missing.trc", REPLAY) == ESP_ERR_NOT_FOUND, "missing trace");
+    file = fopen(CUT, "wb");
+    fputs("#EXTM3U\n", file);
+    fclose(file);
+    CHECK(trace_recorder_replay(CUT, REPLAY) == ESP_ERR_NOT_FOUND, "not a trace");
+    CHECK(host_run_tasks() == 0, "nothing to replay");
+
+    free(replayed);
+    free(golden);
+    free(session);
+}
+
+int main(int argc, char **argv)
+{
+    audio_element_cfg_t cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    cfg.tag = "i2s";
+    i2s = audio_element_init(&cfg);
+    cfg.tag = "http";
+    http = audio_element_init(&cfg);
+
+    if (argc > 1 && strcmp(argv[1], "--update") == 0) {
+        record_session();
+        replay(SESSION, GOLDEN);
+        return test_end();
+    }
+    CHECK(trace_recorder_init() == ESP_OK, "recorder started");
+    test_codec();
+    test_replay();
+    return test_end();
+}
@@ -0,0 +1,290 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "host.h"
+#include "test.h"
+#include "voicepack.h"
+
+/*
+ * Writes voice packs in the layout of tools/voicepack.py, then opens them, looks up and
+ * reads every clip and streams a phrase through the reader element. Every payload byte
+ * tells the voice, clip and offset it belongs to. Packs with a wrong magic, a newer
+ * version, no clips or a cut-off table are refused. The tool verifies the pack after.
+ */
+
+#define PACK "test_voicepack.vpk"
+#define MAX_CLIPS 80
+#define READ_MAX (8 * VOICEPACK_SECTOR_SIZE)
+
+typedef struct {
+    uint16_t voice;
+    uint16_t clip_id;
+    uint32_t length;
+} clip_spec_t;
+
+static clip_spec_t specs[MAX_CLIPS];
+static int spec_count = 0;
+
+static uint8_t payload_byte(uint16_t voice, uint16_t clip_id, uint32_t pos)
+{
+    return (uint8_t)(voice * 101 + clip_id * 7 + pos + pos / 251);
+}
+
+static void add_spec(uint16_t voice, uint16_t clip_id, uint32_t length)
+{
+    specs[spec_count++] = (clip_spec_t){voice, clip_id, length};
+}
+
+/* The clips of a Dutch and a shorter English voice, sorted on (voice, clip id) */
+static void make_specs(void)
+{
+    spec_count = 0;
+    for (int id = 0; id <= 20; id++) {
+        add_spec(0, id, 3000 + id * 517);
+    }
+    for (int id = 100; id <= 134; id++) {
+        add_spec(0, id, id == 101 ? VOICEPACK_SECTOR_SIZE * 9 : 1 + id * 123);
+    }
+    for (int id = 0; id <= 12; id++) {
+        add_spec(1, id, 2048 + id * 33);
+    }
+    add_spec(1, 100, 777);
+}
+
+static uint32_t align(uint32_t value)
+{
+    return (value + VOICEPACK_SECTOR_SIZE - 1) / VOICEPACK_SECTOR_SIZE * VOICEPACK_SECTOR_SIZE;
+}
+
+/* Writes a pack, then lets a test break the header; truncate_at cuts the file when not 0 */
+static void write_pack(const char *path, void (*damage)(voicepack_header_t *), long truncate_at)
+{
+    voicepack_header_t header = {0};
+    memcpy(header.magic, VOICEPACK_MAGIC, 4);
+    header.version = VOICEPACK_VERSION;
+    header.header_size = sizeof(header);
+    header.voice_count = 2;
+    header.clip_count = spec_count;
+    header.sector_size = VOICEPACK_SECTOR_SIZE;
+    header.voice_table_offset = sizeof(header);
+    header.clip_table_offset = header.voice_table_offset + 2 * sizeof(voicepack_voice_t);
+
+    voicepack_voice_t voices[2] = {{"nl", "Nederlands"}, {"en", "English"}};
+    voicepack_clip_t clips[MAX_CLIPS];
+    uint32_t offset = align(header.clip_table_offset + spec_count * sizeof(voicepack_clip_t));
+    for (int i = 0; i < spec_count; i++) {
+        clips[i] = (voicepack_clip_t){specs[i].voice, specs[i].clip_id, offset, specs[i].length, 22050, 16, 1, 0};
+        offset = align(offset + specs[i].length);
+    }
+    if (damage) {
+        damage(&header);
+    }
+
+    FILE *f = fopen(path, "wb");
+    fwrite(&header, sizeof(header), 1, f);
+    fwrite(voices, sizeof(voices), 1, f);
+    fwrite(clips, sizeof(clips[0]), spec_count, f);
+    for (int i = 0; i < spec_count; i++) {
+        while (ftell(f) < clips[i].offset) {
+            fputc(0, f);
+        }
+        for (uint32_t pos = 0; pos < specs[i].length; pos++) {
+            fputc(payload_byte(specs[i].voice, specs[i].clip_id, pos), f);
+        }
+    }
+    while (ftell(f) % VOICEPACK_SECTOR_SIZE) {
+        fputc(0, f);
+    }
+    fclose(f);
+    if (truncate_at) {
+        CHECK(truncate(path, truncate_at) == 0, "truncated");
+    }
+}
+
+static bool clip_matches(voicepack_t *pack, const voicepack_clip_t *clip, int max_read)
+{
+    static char buf[READ_MAX];
+    uint32_t pos = 0;
+    while (1) {
+        int len = 1 + rand() % max_read;
+        int r = voicepack_read(pack, clip, pos, buf, len);
+        if (r == 0) {
+            break;
+        }
+        if (r < 0 || r > len) {
+            return false;
+        }
+        for (int i = 0; i < r; i++) {
+            if ((uint8_t)buf[i] != payload_byte(clip->voice, clip->clip_id, pos + i)) {
+                return false;
+            }
+        }
+        pos += r;
+    }
+    return pos == clip->length;
+}
+
+static void test_lookup(void)
+{
+    voicepack_t *pack = NULL;
+    CHECK(voicepack_open(PACK, &pack) == ESP_OK, "pack opened");
+    CHECK(pack->header.voice_count == 2 && pack->header.clip_count == spec_count, "%d clips",
+          pack->header.clip_count);
+
+    // Every clip of the first voice, read in pieces and from random offsets
+    srand(26);
+    for (int i = 0; i < spec_count; i++) {
+        if (specs[i].voice == 1 && i > 0 && specs[i - 1].voice == 0) {
+            CHECK(voicepack_find_clip(pack, 134) != NULL, "Dutch has clip 134");
+            CHECK(voicepack_select_voice(pack, "en") == ESP_OK, "English selected");
+        }
+        const voicepack_clip_t *clip = voicepack_find_clip(pack, specs[i].clip_id);
+        CHECK(clip && clip->voice == specs[i].voice && clip->length == specs[i].length, "clip %d of voice %d found",
+              specs[i].clip_id, specs[i].voice);
+        if (clip == NULL) {
+            continue;
+        }
+        CHECK(clip->offset % VOICEPACK_SECTOR_SIZE == 0, "clip %d starts on a sector", clip->clip_id);
+        CHECK(clip_matches(pack, clip, i % 2 ? 700 : READ_MAX), "clip %d read", clip->clip_id);
+        char byte;
+        uint32_t at = rand() % clip->length;
+        CHECK(voicepack_read(pack, clip, at, &byte, 1) == 1 &&
+                  (uint8_t)byte == payload_byte(clip->voice, clip->clip_id, at),
+              "byte %u of clip %d", at, clip->clip_id);
+        CHECK(voicepack_read(pack, clip, clip->length, &byte, 1) == 0, "nothing after the end of clip %d",
+              clip->clip_id);
+    }
+
+    CHECK(voicepack_find_clip(pack, 134) == NULL, "English has no clip 134");
+    CHECK(voicepack_find_clip(pack, 99) == NULL && voicepack_find_clip(pack, 0xFFFF) == NULL, "no clip 99");
+    CHECK(voicepack_select_voice(pack, "fr") == ESP_ERR_NOT_FOUND && pack->voice == 1, "no French voice");
+    CHECK(voicepack_select_voice(pack, "nl") == ESP_OK && voicepack_find_clip(pack, 134) != NULL, "back to Dutch");
+    voicepack_close(pack);
+    voicepack_close(NULL);
+}
+
+typedef struct {
+    const uint16_t *ids;
+    int clip;
+    uint32_t pos;
+    long bytes;
+    long errors;
+} sink_t;
+
+static int write_sink(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    sink_t *sink = ctx;
+    for (int i = 0; i < len; i++) {
+        while (sink->pos == specs[sink->ids[sink->clip]].length) {
+            sink->clip++;
+            sink->pos = 0;
+        }
+        uint16_t id = specs[sink->ids[sink->clip]].clip_id;
+        if ((uint8_t)buf[i] != payload_byte(0, id, sink->pos)) {
+            sink->errors++;
+        }
+        sink->pos++;
+        sink->bytes++;
+    }
+    return len;
+}
+
+/* Index in specs of a clip of the Dutch voice */
+static uint16_t spec_of(uint16_t clip_id)
+{
+    for (int i = 0; i < spec_count; i++) {
+        if (specs[i].voice == 0 && specs[i].clip_id == clip_id) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static void test_stream(void)
+{
+    voicepack_t *pack = NULL;
+    CHECK(voicepack_open(PACK, &pack) == ESP_OK, "pack opened");
+    voicepack_stream_cfg_t cfg = VOICEPACK_STREAM_CFG_DEFAULT();
+    cfg.pack = pack;
+    audio_element_handle_t el = voicepack_stream_init(&cfg);
+
+    // "het is twintig over zeven", twice the same clip in a row is fine
+    const uint16_t phrase[] = {101, 20, 108, 7, 7, 102};
+    uint16_t ids[6];
+    long total = 0;
+    for (int i = 0; i < 6; i++) {
+        ids[i] = spec_of(phrase[i]);
+        total += specs[ids[i]].length;
+    }
+    sink_t sink = {.ids = ids};
+    audio_element_set_write_cb(el, write_sink, &sink);
+    CHECK(voicepack_stream_set_clips(el, phrase, 6) == ESP_OK, "phrase set");
+
+    audio_element_err_t ret;
+    int runs = 0;
+    while ((ret = host_element_process(el)) > 0) {
+        CHECK(ret <= cfg.buf_sz, "read of %d bytes", ret);
+        runs++;
+    }
+    CHECK(ret == AEL_IO_DONE, "the phrase ends, %d", ret);
+    CHECK(sink.bytes == total && sink.errors == 0, "%ld of %ld bytes, %ld wrong", sink.bytes, total, sink.errors);
+
+    audio_element_info_t info;
+    audio_element_getinfo(el, &info);
+    CHECK(info.sample_rates == 22050 && info.bits == 16 && info.channels == 1, "format of the first clip");
+    CHECK(info.total_bytes == total && info.byte_pos == total, "position %lld of %lld", (long long)info.byte_pos,
+          (long long)info.total_bytes);
+    printf("%ld bytes in %d reads\n", sink.bytes, runs);
+
+    // A clip missing from the voice is refused
+    const uint16_t missing[] = {101, 99};
+    CHECK(voicepack_stream_set_clips(el, missing, 2) == ESP_ERR_INVALID_ARG, "clip 99 refused");
+    host_element_close(el);
+    CHECK(host_element_process(el) == AEL_IO_FAIL, "half a phrase is not played");
+
+    audio_element_deinit(el);
+    voicepack_close(pack);
+}
+
+static void bad_magic(voicepack_header_t *h)
+{
+    memcpy(h->magic, "RIFF", 4);
+}
+
+static void newer_version(voicepack_header_t *h)
+{
+    h->version = VOICEPACK_VERSION + 1;
+}
+
+static void no_clips(voicepack_header_t *h)
+{
+    h->clip_count = 0;
+}
+
+static void test_damaged(void)
+{
+    voicepack_t *pack = NULL;
+    CHECK(voicepack_open("missing.vpk", &pack) == ESP_ERR_NOT_FOUND && pack == NULL, "missing pack");
+    write_pack(PACK, bad_magic, 0);
+    CHECK(voicepack_open(PACK, &pack) == ESP_ERR_INVALID_RESPONSE, "wrong magic");
+    write_pack(PACK, newer_version, 0);
+    CHECK(voicepack_open(PACK, &pack) == ESP_ERR_INVALID_VERSION, "newer version");
+    write_pack(PACK, no_clips, 0);
+    CHECK(voicepack_open(PACK, &pack) == ESP_ERR_INVALID_RESPONSE, "no clips");
+    write_pack(PACK, NULL, sizeof(voicepack_header_t) + 2 * sizeof(voicepack_voice_t) + 10 * sizeof(voicepack_clip_t));
+    CHECK(voicepack_open(PACK, &pack) == ESP_ERR_INVALID_RESPONSE, "cut-off clip table");
+    write_pack(PACK, NULL, 10);
+    CHECK(voicepack_open(PACK, &pack) == ESP_ERR_INVALID_RESPONSE, "cut-off header");
+    CHECK(pack == NULL, "no pack handed out");
+}
+
+int main(void)
+{
+    make_specs();
+    test_damaged();
+    // The pack stays for tools/voicepack.py to verify
+    write_pack(PACK, NULL, 0);
+    test_lookup();
+    test_stream();
+    return test_end();
+}
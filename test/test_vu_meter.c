@@ -0,0 +1,173 @@
+#include <math.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "vu_meter.h"
+
+/*
+ * Runs the analysis task on the virtual clock against a writer element that sends a
+ * scripted signal through the tap: sine tones across the spectrum, unequal channels,
+ * a quiet tone, silence and a mono stream at another rate. Every segment lasts 10
+ * frames, the last frame of a segment must show its levels and the right band.
+ */
+
+#define SEGMENT_US 400000
+#define FRAME_US 40000
+
+typedef struct {
+    double freq;
+    double left;                /* Amplitude, 1 is full scale */
+    double right;
+    int rate;
+    int channels;
+} segment_t;
+
+static const segment_t segments[] = {
+    {200, 1, 1, 48000, 2},
+    {1000, 1, 1, 48000, 2},
+    {5000, 1, 1, 48000, 2},
+    {12000, 1, 1, 48000, 2},
+    {1000, 1, 1.0 / 16, 48000, 2},
+    {1000, 0.01, 0.01, 48000, 2},
+    {0, 0, 0, 48000, 2},
+    {1000, 0.5, 0.5, 22050, 1},
+    {5000, 0.5, 0.5, 22050, 1},
+};
+#define SEGMENTS (int)(sizeof(segments) / sizeof(segments[0]))
+
+static audio_element_handle_t writer_el;
+static int current = -1;
+static int written = -1;            /* Segment of the audio the last frame was computed from */
+static vu_frame_t last[SEGMENTS];   /* Last frame of each segment */
+static uint32_t last_seq = 0;
+static int transitions[4];
+static int transition_count = 0;
+
+/* What i2s_stream does for every buffer it writes, one frame period of audio */
+static void write_period(ringbuf_handle_t rb, void *ctx)
+{
+    vu_frame_t frame;
+    if (vu_meter_get_frame(&frame) && frame.seq != last_seq && written >= 0) {
+        last[written] = frame;
+        last_seq = frame.seq;
+    }
+
+    int seg = host_time_us() / SEGMENT_US;
+    if (seg >= SEGMENTS) {
+        return;
+    }
+    const segment_t *s = &segments[seg];
+    if (seg != current) {
+        vu_meter_set_format(s->rate, s->channels);
+        current = seg;
+    }
+    written = seg;
+    if (s->freq == 0) {
+        return;
+    }
+    static int16_t pcm[48 * 2 * FRAME_US / 1000];
+    int64_t start = host_time_us() * s->rate / 1000000;
+    int samples = (int64_t)s->rate * FRAME_US / 1000000;
+    for (int i = 0; i < samples; i++) {
+        double v = sin(2 * M_PI * s->freq * (start + i) / s->rate) * 32767;
+        pcm[i * s->channels] = (int16_t)(v * s->left);
+        if (s->channels == 2) {
+            pcm[i * 2 + 1] = (int16_t)(v * s->right);
+        }
+    }
+    // Far more than the tap holds, the rest is dropped without waiting
+    int64_t before = host_time_us();
+    audio_element_multi_output(writer_el, (char *)pcm, samples * s->channels * sizeof(int16_t));
+    CHECK(host_time_us() == before && rb_bytes_available(rb) == 0, "the writer never waits for the tap");
+}
+
+static void listener(bool active)
+{
+    if (transition_count < 4) {
+        transitions[transition_count] = active;
+    }
+    transition_count++;
+}
+
+static int loudest_band(const vu_frame_t *frame)
+{
+    int best = 0;
+    for (int b = 1; b < frame->bands; b++) {
+        best = frame->band_db[b] > frame->band_db[best] ? b : best;
+    }
+    return best;
+}
+
+static void check_level(int seg, const char *what, int db, double amplitude, double tolerance)
+{
+    double expect = 20 * log10(amplitude);
+    CHECK(fabs(db - expect) <= tolerance, "segment %d: %s %d dB, expected %.1f", seg, what, db, expect);
+}
+
+static void test_segments(void)
+{
+    vu_meter_cfg_t cfg = VU_METER_CFG_DEFAULT();
+    CHECK(vu_meter_init(&cfg) == ESP_OK, "analyzer started");
+    vu_meter_set_listener(listener);
+    audio_element_cfg_t el_cfg = DEFAULT_AUDIO_ELEMENT_CONFIG();
+    el_cfg.multi_out_rb_num = 1;
+    writer_el = audio_element_init(&el_cfg);
+    CHECK(vu_meter_attach(writer_el) == ESP_OK, "tap attached");
+    host_rb_set_writer(audio_element_get_multi_output_ringbuf(writer_el, 0), write_period, NULL);
+
+    host_run_tasks_until((int64_t)SEGMENTS * SEGMENT_US + FRAME_US);
+
+    int bands[SEGMENTS];
+    for (int seg = 0; seg < SEGMENTS; seg++) {
+        const segment_t *s = &segments[seg];
+        const vu_frame_t *f = &last[seg];
+        bands[seg] = loudest_band(f);
+        printf("%5.0f Hz at %d/%d: peak %d/%d rms %d/%d, band %d at %d dB\n", s->freq, s->rate, s->channels,
+               f->peak_db[0], f->peak_db[1], f->rms_db[0], f->rms_db[1], bands[seg], f->band_db[bands[seg]]);
+        CHECK(f->bands == VU_METER_BANDS, "segment %d: %d bands", seg, f->bands);
+        if (s->freq == 0) {
+            // Everything falls 3 dB a frame from the quiet tone before, down to the floor
+            int wrong = 0;
+            for (int b = 0; b < f->bands; b++) {
+                int expect = last[seg - 1].band_db[b] - 30;
+                wrong += f->band_db[b] != (expect < VU_METER_FLOOR_DB ? VU_METER_FLOOR_DB : expect);
+            }
+            CHECK(!f->active && f->peak_db[0] == last[seg - 1].peak_db[0] - 30 && wrong == 0,
+                  "silence falls 30 dB in 10 frames, %d bands wrong", wrong);
+            continue;
+        }
+        CHECK(f->active, "segment %d active", seg);
+        check_level(seg, "left peak", f->peak_db[0], s->left, 1.5);
+        check_level(seg, "right peak", f->peak_db[1], s->right, 1.5);
+        check_level(seg, "left rms", f->rms_db[0], s->left / sqrt(2), 1.5);
+        check_level(seg, "right rms", f->rms_db[1], s->right / sqrt(2), 1.5);
+        // The spectrum is of the mono mix, a band holds more than one bin of the window
+        check_level(seg, "band", f->band_db[bands[seg]], (s->left + s->right) / 2, 2.5);
+        if (s->left < 0.5) {
+            // Near the noise floor of the Q15 FFT
+            continue;
+        }
+        // The main lobe of the Hann window reaches the bands next to the tone
+        int far = -1;
+        for (int b = 0; b < f->bands; b++) {
+            if ((b < bands[seg] - 3 || b > bands[seg] + 3) && (far < 0 || f->band_db[b] > f->band_db[far])) {
+                far = b;
+            }
+        }
+        CHECK(f->band_db[bands[seg]] - f->band_db[far] >= 30, "segment %d: band %d at %d dB, band %d at %d dB", seg,
+              bands[seg], f->band_db[bands[seg]], far, f->band_db[far]);
+    }
+    CHECK(bands[0] == 0 && bands[0] < bands[1] && bands[1] < bands[2] && bands[2] < bands[3] &&
+              bands[3] >= VU_METER_BANDS - 2, "bands rise with the tones: %d %d %d %d", bands[0], bands[1],
+          bands[2], bands[3]);
+    CHECK(bands[1] == bands[4] && bands[1] == bands[5], "the level does not move the band");
+    CHECK(bands[7] > bands[1] && bands[8] > bands[2], "at 22050 Hz the same tone sits higher in the bands");
+    CHECK(transition_count == 3 && transitions[0] && !transitions[1] && transitions[2],
+          "listener told of the start, the silence and the mono stream, %d calls", transition_count);
+}
+
+int main(void)
+{
+    test_segments();
+    return test_end();
+}
@@ -0,0 +1,273 @@
+#include <stdlib.h>
+#include <string.h>
+#include "host.h"
+#include "test.h"
+#include "wav_file.h"
+#include "pcm_convert.h"
+#include "wav_stream.h"
+
+/*
+ * Reads the corpus tools/wavcorpus.py wrote into the directory given, wavcorpus by
+ * default, and checks every file against its MANIFEST.json entry: wav_file_parse(), the
+ * streaming parser fed in random pieces, the formats that are refused, the samples of
+ * pcm_convert_to_s16() in and out of place against the .s16 file, and the WAV decoder
+ * element playing each file whole and from its middle.
+ */
+
+#define MAX_FILE (256 * 1024)
+#define MAX_SAMPLES 65536
+
+typedef struct {
+    char name[64];
+    bool playable;
+    long format, channels, sample_rate, bits, valid_bits, data_offset, data_size;
+    long stream_data_size;          /* -1 when the header leaves it open */
+} entry_t;
+
+static const char *dir = "wavcorpus";
+static uint8_t content[MAX_FILE];
+static long content_len;
+static int16_t expect[MAX_SAMPLES];
+static int expect_count;
+static int16_t got[MAX_SAMPLES];
+static int got_count;
+static long read_pos;
+
+/* Reads a whole file of the corpus, returns its size or -1 */
+static long read_file(const char *name, void *buf, long size)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        return -1;
+    }
+    long n = fread(buf, 1, size, f);
+    fclose(f);
+    return n;
+}
+
+/* A number, true or false after "key": in obj, false when it is null or missing */
+static bool json_long(const char *obj, const char *key, long *value)
+{
+    char pattern[64];
+    snprintf(pattern, sizeof(pattern), "\"%s\": ", key);
+    const char *p = strstr(obj, pattern);
+    if (p == NULL || strncmp(p + strlen(pattern), "null", 4) == 0) {
+        return false;
+    }
+    p += strlen(pattern);
+    *value = strncmp(p, "true", 4) == 0 ? 1 : strncmp(p, "false", 5) == 0 ? 0 : strtol(p, NULL, 10);
+    return true;
+}
+
+/* Reads the entries of the manifest, returns their count */
+static int read_manifest(entry_t *entries, int max)
+{
+    static char manifest[32768];
+    long n = read_file("MANIFEST.json", manifest, sizeof(manifest) - 1);
+    if (n < 0) {
+        return 0;
+    }
+    manifest[n] = '\0';
+    int count = 0;
+    for (char *obj = strchr(manifest, '{'); obj != NULL && count < max; obj = strchr(obj + 1, '{')) {
+        char *end = strchr(obj, '}');
+        *end = '\0';
+        entry_t *e = &entries[count++];
+        const char *name = strstr(obj, "\"name\": \"") + 9;
+        snprintf(e->name, sizeof(e->name), "%.*s", (int)strcspn(name, "\""), name);
+        long playable = 0;
+        json_long(obj, "playable", &playable);
+        e->playable = playable;
+        json_long(obj, "format", &e->format);
+        json_long(obj, "channels", &e->channels);
+        json_long(obj, "sample_rate", &e->sample_rate);
+        json_long(obj, "bits", &e->bits);
+        json_long(obj, "valid_bits", &e->valid_bits);
+        json_long(obj, "data_offset", &e->data_offset);
+        json_long(obj, "data_size", &e->data_size);
+        if (!json_long(obj, "stream_data_size", &e->stream_data_size)) {
+            e->stream_data_size = -1;
+        }
+        obj = end;
+    }
+    return count;
+}
+
+static bool same_format(const wav_file_info_t *info, const entry_t *e)
+{
+    return info->format == e->format && info->channels == e->channels && info->sample_rate == e->sample_rate &&
+           info->bits == e->bits && info->valid_bits == e->valid_bits &&
+           info->data_offset == (uint32_t)e->data_offset;
+}
+
+static void check_parse(const entry_t *e)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.wav", dir, e->name);
+    FILE *f = fopen(path, "rb");
+    wav_file_info_t info;
+    CHECK(f != NULL && wav_file_parse(f, &info) == ESP_OK, "%s: parsed", e->name);
+    if (f == NULL) {
+        return;
+    }
+    CHECK(same_format(&info, e) && info.data_size == (uint32_t)e->data_size && ftell(f) == e->data_offset,
+          "%s: format %d, %d channels, %d Hz, %d/%d bits, data %u bytes at %u", e->name, info.format, info.channels,
+          info.sample_rate, info.valid_bits, info.bits, info.data_size, info.data_offset);
+    CHECK((pcm_format_of(&info) != PCM_FORMAT_NONE) == e->playable, "%s: %s", e->name,
+          e->playable ? "refused" : "not refused");
+    fclose(f);
+
+    // In pieces of 1 to 97 bytes, the pieces end anywhere
+    int wrong = 0;
+    for (int round = 0; round < 50; round++) {
+        wav_parser_t parser;
+        wav_parser_init(&parser);
+        long pos = 0;
+        wav_parser_result_t result = WAV_PARSER_MORE;
+        while (result == WAV_PARSER_MORE && pos < content_len) {
+            int len = 1 + rand() % 97;
+            len = len < content_len - pos ? len : content_len - pos;
+            int used;
+            result = wav_parser_feed(&parser, content + pos, len, &used);
+            pos += used;
+        }
+        uint32_t size = e->stream_data_size < 0 ? UINT32_MAX : (uint32_t)e->stream_data_size;
+        wrong += result != WAV_PARSER_DATA || pos != e->data_offset || !same_format(&parser.info, e) ||
+                 parser.info.data_size != size;
+    }
+    CHECK(wrong == 0, "%s: %d of 50 streams parsed differently", e->name, wrong);
+}
+
+/* Within 1 LSB of the .s16 file, 8 and 16-bit equal */
+static void check_samples(const char *what, const entry_t *e, const int16_t *samples, int count, int from)
+{
+    int exact = e->bits <= 16 && e->format == WAV_FORMAT_PCM;
+    int wrong = 0;
+    for (int i = 0; i < count && from + i < expect_count; i++) {
+        int d = abs(samples[i] - expect[from + i]);
+        wrong += exact ? d != 0 : d > 1;
+    }
+    CHECK(count == expect_count - from && wrong == 0, "%s %s: %d samples of %d, %d wrong", e->name, what, count,
+          expect_count - from, wrong);
+}
+
+static void check_convert(const entry_t *e)
+{
+    static uint8_t data[MAX_FILE] __attribute__((aligned(4)));
+    wav_file_info_t info = {
+        .format = e->format, .channels = e->channels, .bits = e->bits, .block_align = e->channels * e->bits / 8,
+    };
+    pcm_convert_t conv;
+    pcm_convert_init(&conv, pcm_format_of(&info));
+    int samples = e->data_size / (e->bits / 8);
+    memcpy(data, content + e->data_offset, e->data_size);
+
+    // Out of place in random pieces of whole samples, then in place
+    for (int done = 0; done < samples;) {
+        int n = 1 + rand() % 300;
+        n = n < samples - done ? n : samples - done;
+        pcm_convert_to_s16(&conv, data + done * conv.bytes, n, got + done);
+        done += n;
+    }
+    check_samples("out of place", e, got, samples, 0);
+    if (e->bits >= 16) {
+        pcm_convert_to_s16(&conv, data, samples, (int16_t *)data);
+        check_samples("in place", e, (int16_t *)data, samples, 0);
+    }
+}
+
+static int read_cb(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    len = 1 + rand() % len;
+    len = len < content_len - read_pos ? len : content_len - read_pos;
+    if (len <= 0) {
+        return AEL_IO_DONE;
+    }
+    memcpy(buf, content + read_pos, len);
+    read_pos += len;
+    return len;
+}
+
+static int write_cb(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    int n = len / 2 < MAX_SAMPLES - got_count ? len / 2 : MAX_SAMPLES - got_count;
+    memcpy(got + got_count, buf, n * 2);
+    got_count += n;
+    return len;
+}
+
+static audio_element_err_t play(audio_element_handle_t el)
+{
+    got_count = 0;
+    host_element_close(el);
+    audio_element_err_t ret;
+    do {
+        ret = host_element_process(el);
+    } while (ret > 0);
+    return ret;
+}
+
+static void check_stream(audio_element_handle_t el, const entry_t *e)
+{
+    read_pos = 0;
+    audio_element_err_t ret = play(el);
+    if (!e->playable) {
+        CHECK(ret == AEL_IO_FAIL, "%s: refused by the element, %d", e->name, ret);
+        return;
+    }
+    CHECK(ret == AEL_IO_DONE, "%s: played to the end, %d", e->name, ret);
+    // Chunks after the data are not played, a file cut short ends the data
+    check_samples("played", e, got, got_count, 0);
+
+    // From the middle, as the seek of the SD card player starts it
+    wav_file_info_t info;
+    wav_stream_get_format(el, &info);
+    if (info.data_size == UINT32_MAX) {
+        info.data_size = e->data_size;
+    }
+    int64_t half_ms = wav_file_duration_ms(&info) / 2;
+    uint32_t offset = wav_file_offset(&info, half_ms);
+    read_pos = e->data_offset + offset;
+    wav_stream_start_at(el, &info, offset);
+    ret = play(el);
+    CHECK(ret == AEL_IO_DONE, "%s: played from %lld ms, %d", e->name, (long long)half_ms, ret);
+    check_samples("from the middle", e, got, got_count, offset / (e->bits / 8));
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1) {
+        dir = argv[1];
+    }
+    static entry_t entries[64];
+    int count = read_manifest(entries, 64);
+    CHECK(count >= 20, "%d files in %s/MANIFEST.json, run tools/wavcorpus.py %s", count, dir, dir);
+
+    wav_stream_cfg_t cfg = WAV_STREAM_CFG_DEFAULT();
+    audio_element_handle_t el = wav_stream_init(&cfg);
+    audio_element_set_read_cb(el, read_cb, NULL);
+    audio_element_set_write_cb(el, write_cb, NULL);
+    srand(46);
+    char log[4096];
+    host_capture_log(log, sizeof(log));
+    for (int i = 0; i < count; i++) {
+        const entry_t *e = &entries[i];
+        char name[80];
+        snprintf(name, sizeof(name), "%s.wav", e->name);
+        content_len = read_file(name, content, sizeof(content));
+        CHECK(content_len > 0 && content_len < MAX_FILE, "%s: %ld bytes", name, content_len);
+        snprintf(name, sizeof(name), "%s.s16", e->name);
+        expect_count = e->playable ? read_file(name, expect, sizeof(expect)) / 2 : 0;
+        check_parse(e);
+        if (e->playable) {
+            check_convert(e);
+        }
+        check_stream(el, e);
+    }
+    host_capture_log(NULL, 0);
+    audio_element_deinit(el);
+    printf("%d files\n", count);
+    return test_end();
+}
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "host.h"
+#include "test.h"
+#include "wav_stream.h"
+
+/*
+ * Seeks with wav_stream_start_at() in a 3 hour 44.1 kHz 16-bit stereo file that is
+ * generated as it is read: the left sample of a frame is the low half of its index and
+ * the right sample the high half, so the first frame out of the decoder tells where it
+ * landed.
+ */
+
+#define RATE 44100
+#define FRAME 4
+#define HEADER 44
+#define DURATION_MS (3 * 3600 * 1000LL)
+#define DATA_SIZE ((uint32_t)(DURATION_MS * RATE / 1000 * FRAME))
+#define SEEKS 2000
+
+typedef struct {
+    uint32_t data_size;
+    uint64_t pos;           /* File offset of the next byte */
+    int max_read;           /* Largest read, smaller ones cut frames apart */
+} file_t;
+
+typedef struct {
+    int64_t first_frame;    /* -1 until something came out */
+    int64_t frames;
+    int64_t errors;         /* Frames that did not follow the previous one */
+} sink_t;
+
+static file_t file;
+static sink_t sink;
+
+static void put_le(uint8_t *p, uint32_t value, int bytes)
+{
+    for (int i = 0; i < bytes; i++) {
+        p[i] = value >> (8 * i);
+    }
+}
+
+static uint8_t file_byte(uint64_t pos)
+{
+    static uint8_t header[HEADER];
+    if (pos < HEADER) {
+        memcpy(header, "RIFF....WAVEfmt ", 16);
+        put_le(header + 4, file.data_size + HEADER - 8, 4);
+        put_le(header + 16, 16, 4);
+        put_le(header + 20, 1, 2);
+        put_le(header + 22, 2, 2);
+        put_le(header + 24, RATE, 4);
+        put_le(header + 28, RATE * FRAME, 4);
+        put_le(header + 32, FRAME, 2);
+        put_le(header + 34, 16, 2);
+        memcpy(header + 36, "data", 4);
+        put_le(header + 40, file.data_size, 4);
+        return header[pos];
+    }
+    uint64_t at = pos - HEADER;
+    uint32_t frame = at / FRAME;
+    uint16_t sample = at % FRAME < 2 ? frame & 0xFFFF : frame >> 16;
+    return sample >> (8 * (at % 2));
+}
+
+static int read_file(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    if (len > file.max_read) {
+        len = 1 + rand() % file.max_read;
+    }
+    if (file.pos + len > HEADER + (uint64_t)file.data_size) {
+        len = HEADER + file.data_size - file.pos;
+    }
+    if (len == 0) {
+        return AEL_IO_DONE;
+    }
+    for (int i = 0; i < len; i++) {
+        buf[i] = file_byte(file.pos + i);
+    }
+    file.pos += len;
+    return len;
+}
+
+static int write_sink(audio_element_handle_t el, char *buf, int len, TickType_t wait, void *ctx)
+{
+    int16_t *samples = (int16_t *)buf;
+    for (int i = 0; i + 1 < len / 2; i += 2) {
+        int64_t frame = (uint16_t)samples[i] | (int64_t)(uint16_t)samples[i + 1] << 16;
+        if (sink.first_frame < 0) {
+            sink.first_frame = frame;
+        } else if (frame != sink.first_frame + sink.frames) {
+            sink.errors++;
+        }
+        sink.frames++;
+    }
+    return len;
+}
+
+static double now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+/* Runs the element from the start of the file or from where a seek put it, times the first buffer */
+static audio_element_err_t run(audio_element_handle_t el, int64_t max_frames, double *first_us)
+{
+    sink = (sink_t){-1, 0, 0};
+    host_element_close(el);
+    double start = now_us();
+    audio_element_err_t ret = host_element_process(el);
+    *first_us += now_us() - start;
+    while (ret > 0 && sink.frames < max_frames) {
+        ret = host_element_process(el);
+    }
+    return ret;
+}
+
+static void test_header(audio_element_handle_t el)
+{
+    // The header comes in pieces of up to 7 bytes
+    file = (file_t){.data_size = RATE * FRAME, .pos = 0, .max_read = 7};
+    double first_us = 0;
+    audio_element_err_t ret = run(el, INT64_MAX, &first_us);
+    CHECK(ret == AEL_IO_DONE, "the second ends the stream, %d", ret);
+    CHECK(sink.first_frame == 0 && sink.frames == RATE && sink.errors == 0,
+          "frames %lld from %lld, %lld out of order", (long long)sink.frames, (long long)sink.first_frame,
+          (long long)sink.errors);
+
+    wav_file_info_t info;
+    wav_stream_get_format(el, &info);
+    CHECK(info.sample_rate == RATE && info.channels == 2 && info.bits == 16 && info.block_align == FRAME &&
+              info.data_offset == HEADER && info.data_size == RATE * FRAME,
+          "format of the stream");
+    audio_element_info_t el_info;
+    audio_element_getinfo(el, &el_info);
+    CHECK(el_info.byte_pos == RATE * FRAME, "byte position %lld at the end", (long long)el_info.byte_pos);
+}
+
+/* The ends and past them, around the 1 GB and 2 GB marks, then anywhere */
+static int64_t target_ms(int i)
+{
+    static const int64_t ends[] = {0, DURATION_MS - 1, DURATION_MS, DURATION_MS + 5000, -20};
+    if (i < 5) {
+        return ends[i];
+    }
+    if (i < 20) {
+        return (i % 2 ? 0x40000000LL : 0x7FFFFFF0LL) * 1000 / (RATE * FRAME) + i;
+    }
+    return (int64_t)rand() * 1000 % DURATION_MS + rand() % 1000;
+}
+
+static void test_seeks(audio_element_handle_t el)
+{
+    file = (file_t){.data_size = DATA_SIZE, .pos = 0, .max_read = 2048};
+    wav_parser_t parser;
+    wav_parser_init(&parser);
+    uint8_t header[HEADER];
+    for (int i = 0; i < HEADER; i++) {
+        header[i] = file_byte(i);
+    }
+    int used;
+    CHECK(wav_parser_feed(&parser, header, HEADER, &used) == WAV_PARSER_DATA && used == HEADER, "header parsed");
+    const wav_file_info_t *info = &parser.info;
+    CHECK(wav_file_duration_ms(info) == DURATION_MS, "%lld ms long", (long long)wav_file_duration_ms(info));
+
+    srand(35);
+    double seek_us = 0;
+    for (int i = 0; i < SEEKS; i++) {
+        int64_t ms = target_ms(i);
+        double start = now_us();
+        uint32_t offset = wav_file_offset(info, ms);
+        file.pos = info->data_offset + offset;
+        wav_stream_start_at(el, info, offset);
+        seek_us += now_us() - start;
+        audio_element_err_t ret = run(el, RATE / 4, &seek_us);
+
+        int64_t want = ms <= 0 ? 0 : ms >= DURATION_MS ? DATA_SIZE / FRAME : ms * RATE / 1000;
+        CHECK(offset % FRAME == 0 && offset / FRAME == want, "%lld ms at byte %u, frame %lld", (long long)ms, offset,
+              (long long)want);
+        if (want == DATA_SIZE / FRAME) {
+            CHECK(ret == AEL_IO_DONE && sink.frames == 0, "nothing after the end, %lld frames",
+                  (long long)sink.frames);
+            continue;
+        }
+        int64_t frames = (int64_t)DATA_SIZE / FRAME - want < RATE / 4 ? (int64_t)DATA_SIZE / FRAME - want : RATE / 4;
+        CHECK(sink.first_frame == want && sink.errors == 0 && sink.frames >= frames,
+              "%lld ms plays from frame %lld, expected %lld, %lld frames out of order", (long long)ms,
+              (long long)sink.first_frame, (long long)want, (long long)sink.errors);
+    }
+    // To the first buffer out, with generating the 2 KB it was decoded from
+    printf("%d seeks, %.1f us per seek\n", SEEKS, seek_us / SEEKS);
+}
+
+int main(void)
+{
+    wav_stream_cfg_t cfg = WAV_STREAM_CFG_DEFAULT();
+    audio_element_handle_t el = wav_stream_init(&cfg);
+    audio_element_set_read_cb(el, read_file, NULL);
+    audio_element_set_write_cb(el, write_sink, NULL);
+    test_header(el);
+    test_seeks(el);
+    audio_element_deinit(el);
+    return test_end();
+}
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Shows the reports of the speakers of a group (see main/include/group.h).
+
+Every speaker in a group multicasts a report once a second. On a computer in the same
+network:
+
+    python tools/group.py
+    python tools/group.py --address 239.255.77.1 --port 5077 --interval 5
+
+prints a line per speaker with its sync error, the round trip of its clock exchange,
+its rate correction and the packets it received, concealed and dropped, and the spread
+of the errors of the locked speakers, as GET /api/group of any speaker does. The
+errors are what each speaker measures against its estimate of the leader's clock, an
+offset that is common to the estimate and the speaker is not seen here.
+"""
+
+import argparse
+import socket
+import struct
+import time
+
+MAGIC = b"GS"
+VERSION = 1
+HEADER = struct.Struct("<2sBBII")
+REPORT = struct.Struct("<BBxxiiiIIII")
+MSG_REPORT = 4
+
+# A speaker that sent no report for this long has left, as GROUP_PEER_TIMEOUT_US
+PEER_TIMEOUT = 5.0
+
+
+def decode_report(data):
+    """Returns (node, fields) of a report datagram, None for any other datagram."""
+    if len(data) != HEADER.size + REPORT.size:
+        return None
+    magic, version, kind, node, _ = HEADER.unpack_from(data)
+    if magic != MAGIC or version != VERSION or kind != MSG_REPORT:
+        return None
+    names = ("leader", "locked", "error_us", "rtt_us", "correction_ppb", "received", "concealed", "late",
+             "resyncs")
+    return node, dict(zip(names, REPORT.unpack_from(data, HEADER.size)))
+
+
+def open_socket(address, port, interface):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(("", port))
+    membership = struct.pack("4s4s", socket.inet_aton(address), socket.inet_aton(interface))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    sock.settimeout(0.2)
+    return sock
+
+
+def show(nodes, now):
+    print(time.strftime("%H:%M:%S"))
+    errors = []
+    for node, (seen, r) in sorted(nodes.items()):
+        if now - seen > PEER_TIMEOUT:
+            continue
+        if r["locked"]:
+            errors.append(r["error_us"])
+        print("  %08x %-8s %-8s error %+6d us  rtt %6d us  %+8.3f ppm  recv %8d  concealed %6d  late %6d  resyncs %d"
+              % (node, "leader" if r["leader"] else "follower", "locked" if r["locked"] else "-", r["error_us"],
+                 r["rtt_us"], r["correction_ppb"] / 1000, r["received"], r["concealed"], r["late"], r["resyncs"]))
+    if errors:
+        print("  spread %d us over %d locked speakers" % (max(errors) - min(errors), len(errors)))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--address", default="239.255.77.1", help="CONFIG_SPEAKER_GROUP_ADDRESS")
+    parser.add_argument("--port", type=int, default=5077, help="CONFIG_SPEAKER_GROUP_PORT")
+    parser.add_argument("--interface", default="0.0.0.0", help="address of the interface to join on")
+    parser.add_argument("--interval", type=float, default=2, help="seconds between two prints")
+    args = parser.parse_args()
+
+    sock = open_socket(args.address, args.port, args.interface)
+    nodes = {}
+    next_show = time.monotonic() + args.interval
+    try:
+        while True:
+            try:
+                report = decode_report(sock.recv(2048))
+                if report:
+                    nodes[report[0]] = (time.monotonic(), report[1])
+            except socket.timeout:
+                pass
+            now = time.monotonic()
+            if now >= next_show:
+                next_show = now + args.interval
+                show(nodes, now)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,277 @@
+#!/usr/bin/env python3
+"""Reads the key and event traces of the speaker (see main/include/trace_recorder.h).
+
+Record a session with CONFIG_SPEAKER_TRACE, save it and replay its keys on the
+revision to compare:
+
+    curl -X POST 'http://speaker/api/trace?action=save'      # TRACE.BIN on the SD card
+    curl -X POST 'http://speaker/api/trace?action=replay'    # REPLAY.BIN, after the replay
+
+Then, with the SD card in the computer:
+
+    python tools/trace.py dump TRACE.BIN
+    python tools/trace.py metrics REPLAY.BIN -o new.json
+    python tools/trace.py diff old.json new.json
+
+The metrics are measured on the clock of the trace: how long after a key the pipeline
+reacts, how long the audio stops between tracks, how long mode switches, connects and
+slow reads take, and the CPU load. diff exits with 1 when a key latency, mode switch,
+gap or the underrun count grew by more than the tolerance. The network and SD card are
+not replayed, their timing is shown but not judged.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = b"TRC1"
+VERSION = 1
+HEADER_SIZE = 8
+
+KEY, EVENT, MODE, IO, CPU, MARK = range(1, 7)
+TYPE_NAMES = {KEY: "key", EVENT: "event", MODE: "mode", IO: "io", CPU: "cpu", MARK: "mark"}
+
+# From input_key_service.h and audio_element.h of ESP-ADF
+KEY_NAMES = {1: "rec", 2: "set", 3: "play", 4: "mode", 5: "vol-", 6: "vol+"}
+ACTION_NAMES = {1: "click", 2: "click-release", 3: "press", 4: "press-release"}
+ACTION_CLICK_RELEASE = 2
+KEYS_WITHOUT_PIPELINE = (5, 6)
+ELEMENT_TYPE = 1 << 17
+PERIPH_TYPE = 1 << 20
+PERIPH_NAMES = {1: "button", 2: "touch", 3: "sdcard", 4: "wifi", 5: "flash", 6: "aux", 7: "adc_btn"}
+CMD_REPORT_STATUS = 8
+CMD_NAMES = {2: "finish", 3: "stop", 4: "pause", 5: "resume", 8: "status", 9: "music-info",
+             10: "codec-fmt", 11: "position"}
+STATUS_RUNNING, STATUS_STOPPED, STATUS_FINISHED = 12, 14, 15
+STATUS_NAMES = {1: "error-open", 2: "error-input", 3: "error-process", 4: "error-output", 5: "error-close",
+                6: "error-timeout", 7: "error-unknown", 8: "input-done", 9: "input-buffering",
+                10: "output-done", 11: "output-buffering", 12: "running", 13: "paused", 14: "stopped",
+                15: "finished", 16: "mounted", 17: "unmounted"}
+IO_NAMES = {1: "http-connect", 2: "http-read", 3: "sd-open", 4: "sd-read"}
+
+# Tags of the elements the modes register, see audio_pipeline_register() in main/
+TAGS = ["file", "filter", "fused", "gfilter", "grecv", "gsend", "http", "i2s", "mp3", "tshift", "vpak", "wav"]
+
+# A reaction later than this belongs to something else
+REACTION_LIMIT_US = 5000000
+
+
+def tag_id(tag):
+    """Folded FNV-1a of a tag, as trace_tag_id() in main/trace.c."""
+    h = 2166136261
+    for byte in tag.encode():
+        h = ((h ^ byte) * 16777619) & 0xffffffff
+    return (h >> 16) ^ (h & 0xffff)
+
+
+TAG_BY_ID = {tag_id(tag): tag for tag in TAGS}
+
+
+def read_varint(data, pos):
+    value = 0
+    for shift in range(0, 70, 7):
+        if pos >= len(data):
+            raise ValueError("record cut off")
+        byte = data[pos]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return value, pos
+    raise ValueError("varint too long")
+
+
+def parse(data):
+    """Returns the records of a trace as (time_us, type, args) tuples."""
+    magic, version, header_size = struct.unpack_from("<4sBB", data, 0)
+    if magic != MAGIC or version != VERSION or header_size != HEADER_SIZE:
+        raise SystemExit("not a trace")
+    records = []
+    pos = HEADER_SIZE
+    now = 0
+    while pos < len(data):
+        start = pos
+        try:
+            kind, nargs = data[pos] & 0x0f, data[pos] >> 4
+            delta, pos = read_varint(data, pos + 1)
+            args = []
+            for _ in range(nargs):
+                zz, pos = read_varint(data, pos)
+                args.append((zz >> 1) ^ -(zz & 1))
+        except ValueError:
+            print("trace cut off at byte %d" % start, file=sys.stderr)
+            break
+        now += delta
+        records.append((now, kind, args))
+    return records
+
+
+def source_name(source_type, source_id):
+    if source_type == ELEMENT_TYPE:
+        return TAG_BY_ID.get(source_id, "element %04x" % source_id)
+    if source_type == PERIPH_TYPE:
+        return PERIPH_NAMES.get(source_id - PERIPH_TYPE, "periph %d" % source_id)
+    return "source %x/%d" % (source_type, source_id)
+
+
+def describe(kind, args):
+    if kind == KEY:
+        return "%s %s" % (KEY_NAMES.get(args[0], args[0]), ACTION_NAMES.get(args[1], args[1]))
+    if kind == EVENT:
+        source_type, source_id, cmd, value = args
+        text = "%s %s" % (source_name(source_type, source_id), CMD_NAMES.get(cmd, cmd))
+        if source_type == ELEMENT_TYPE and cmd == CMD_REPORT_STATUS:
+            text += " " + STATUS_NAMES.get(value, str(value))
+        elif source_type != ELEMENT_TYPE:
+            text += " %d" % value
+        return text
+    if kind == MODE:
+        return "mode %d in %d ms" % tuple(args)
+    if kind == IO:
+        return "%s %.1f ms, %d" % (IO_NAMES.get(args[0], args[0]), args[1] / 1000, args[2])
+    if kind == CPU:
+        return "load %d%% at %d MHz, %d underruns" % tuple(args)
+    return TYPE_NAMES.get(kind, str(kind)) + "".join(" %d" % a for a in args)
+
+
+def summary(values):
+    """Count, median, 95th percentile and maximum, in ms."""
+    if not values:
+        return {"count": 0}
+    values = sorted(values)
+    def pick(q):
+        return round(values[min(len(values) - 1, int(q * len(values)))] / 1000, 1)
+    return {"count": len(values), "p50_ms": pick(0.5), "p95_ms": pick(0.95), "max_ms": round(values[-1] / 1000, 1)}
+
+
+def is_status(record, statuses, tag=None):
+    _, kind, args = record
+    return (kind == EVENT and args[0] == ELEMENT_TYPE and args[2] == CMD_REPORT_STATUS and args[3] in statuses
+            and (tag is None or TAG_BY_ID.get(args[1]) == tag))
+
+
+def metrics(records):
+    """Computes the metrics of a trace on its own clock."""
+    key_latency = []
+    gaps = []
+    io = {}
+    loads = []
+    mhz = []
+    underruns = []
+    playing = False
+    gap_start = None
+
+    for i, record in enumerate(records):
+        now, kind, args = record
+        if kind == KEY and args[1] == ACTION_CLICK_RELEASE and args[0] not in KEYS_WITHOUT_PIPELINE:
+            # The first mode switch or element status after the key is its reaction
+            for later in records[i + 1:]:
+                if later[0] - now > REACTION_LIMIT_US:
+                    break
+                if later[1] == MODE or is_status(later, (STATUS_RUNNING, STATUS_STOPPED, STATUS_FINISHED)):
+                    key_latency.append(later[0] - now)
+                    break
+        elif kind == EVENT:
+            if is_status(record, (STATUS_RUNNING,), "i2s"):
+                if gap_start is not None:
+                    gaps.append(now - gap_start)
+                gap_start = None
+                playing = True
+            elif playing and gap_start is None and is_status(record, (STATUS_STOPPED, STATUS_FINISHED) + tuple(range(1, 8))):
+                gap_start = now
+        elif kind == IO:
+            io.setdefault(IO_NAMES.get(args[0], str(args[0])), []).append(args[1])
+        elif kind == CPU:
+            loads.append(args[0])
+            mhz.append(args[1])
+            underruns.append(args[2])
+
+    result = {
+        "duration_s": round(records[-1][0] / 1e6, 1) if records else 0,
+        "keys": sum(1 for r in records if r[1] == KEY),
+        "key_latency": summary(key_latency),
+        "mode_switch": summary([r[2][1] * 1000 for r in records if r[1] == MODE]),
+        "audio_gap": summary(gaps),
+        "io": {name: summary(values) for name, values in sorted(io.items())},
+        "underruns": underruns[-1] - underruns[0] if underruns else 0,
+    }
+    if loads:
+        result["cpu"] = {"mean_load_pct": round(sum(loads) / len(loads), 1), "max_load_pct": max(loads),
+                         "mean_mhz": round(sum(mhz) / len(mhz))}
+    return result
+
+
+def load_metrics(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if data.startswith(MAGIC):
+        return metrics(parse(data))
+    return json.loads(data)
+
+
+def flatten(value, prefix=""):
+    if isinstance(value, dict):
+        items = {}
+        for key, sub in value.items():
+            items.update(flatten(sub, prefix + key + "."))
+        return items
+    return {prefix[:-1]: value}
+
+
+def diff(old, new, tolerance):
+    """Prints the metrics side by side, returns the names of the regressions."""
+    old, new = flatten(old), flatten(new)
+    regressions = []
+    width = max(len(name) for name in set(old) | set(new))
+    for name in sorted(set(old) | set(new)):
+        a, b = old.get(name), new.get(name)
+        line = "%-*s %10s %10s" % (width, name, "-" if a is None else a, "-" if b is None else b)
+        if isinstance(a, (int, float)) and isinstance(b, (int, float)) and a != b:
+            line += " %+10.1f" % (b - a)
+            if a:
+                line += " %+6.0f%%" % ((b - a) * 100 / a)
+            # Latencies, gaps and underruns are better lower, the network and the card are not replayed
+            worse = (name.endswith("_ms") or name == "underruns") and not name.startswith("io.")
+            if worse and b > a * (1 + tolerance / 100) and b - a >= 1:
+                regressions.append(name)
+                line += "  worse"
+        print(line)
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    dump_parser = sub.add_parser("dump", help="print the records")
+    dump_parser.add_argument("trace")
+
+    metrics_parser = sub.add_parser("metrics", help="compute the metrics of a trace")
+    metrics_parser.add_argument("trace")
+    metrics_parser.add_argument("-o", "--output", help="write the metrics as JSON instead of printing them")
+
+    diff_parser = sub.add_parser("diff", help="compare the metrics of two traces or metric files")
+    diff_parser.add_argument("old")
+    diff_parser.add_argument("new")
+    diff_parser.add_argument("-t", "--tolerance", type=float, default=10, help="allowed growth in percent")
+
+    args = parser.parse_args()
+    if args.command == "dump":
+        with open(args.trace, "rb") as f:
+            for now, kind, record_args in parse(f.read()):
+                print("%10.3f %-5s %s" % (now / 1e6, TYPE_NAMES.get(kind, kind), describe(kind, record_args)))
+    elif args.command == "metrics":
+        text = json.dumps(load_metrics(args.trace), indent=2, sort_keys=True)
+        if args.output:
+            with open(args.output, "w") as f:
+                f.write(text + "\n")
+        else:
+            print(text)
+    else:
+        regressions = diff(load_metrics(args.old), load_metrics(args.new), args.tolerance)
+        if regressions:
+            raise SystemExit("%d metrics worse: %s" % (len(regressions), ", ".join(regressions)))
+
+
+if __name__ == "__main__":
+    main()
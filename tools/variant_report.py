@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""Builds the firmware in several variants and compares their size and boot time.
+
+A variant is the sdkconfig of the repository with profiles/*.defaults on top, named by
+the profiles joined with '+'. "debug" is the sdkconfig alone:
+
+    python tools/variant_report.py
+    python tools/variant_report.py debug performance performance+headless
+    python tools/variant_report.py --port /dev/ttyUSB0 performance+radio-only
+
+Every variant builds in build/variants/<name>. The sizes come from idf_size.py on the
+map file, main is the part of libmain.a. With --port each variant is flashed and the
+boot time is read from the "Boot took" line the mode manager logs. Sizes and boot
+times are compared with the first variant.
+
+Run it from the root of the repository in an ESP-IDF shell, the boot time needs pyserial.
+"""
+
+import argparse
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+import time
+
+PROJECT = "smartspeaker_a4"
+PROFILES_DIR = "profiles"
+BUILD_DIR = os.path.join("build", "variants")
+
+DEFAULT_VARIANTS = [
+    "debug",
+    "performance",
+    "performance+radio-only",
+    "performance+sdcard-only",
+    "performance+headless",
+]
+
+BOOT_LINE = re.compile(rb"Boot took (\d+) ms")
+BOOT_TIMEOUT_S = 60
+
+# Columns of the report: title, key of the sizes
+COLUMNS = [
+    ("flash code", "flash_code"),
+    ("rodata", "flash_rodata"),
+    ("DRAM", "dram"),
+    ("IRAM", "iram"),
+    ("main", "main"),
+    ("image", "image"),
+    ("boot ms", "boot_ms"),
+]
+
+
+def profiles_of(variant):
+    """Returns the defaults files of a variant."""
+    if variant == "debug":
+        return []
+    paths = [os.path.join(PROFILES_DIR, name + ".defaults") for name in variant.split("+")]
+    for path in paths:
+        if not os.path.isfile(path):
+            raise SystemExit("%s: no profile %s" % (variant, path))
+    return paths
+
+
+def build(variant):
+    """Builds a variant from a fresh sdkconfig, returns its build directory."""
+    build_dir = os.path.join(BUILD_DIR, variant)
+    os.makedirs(build_dir, exist_ok=True)
+    sdkconfig = os.path.join(build_dir, "sdkconfig")
+    # The defaults only apply to options the sdkconfig does not have yet
+    if os.path.exists(sdkconfig):
+        os.remove(sdkconfig)
+    defaults = ";".join(["sdkconfig"] + profiles_of(variant))
+    subprocess.run(["idf.py", "-B", build_dir, "-D", "SDKCONFIG=" + sdkconfig,
+                    "-D", "SDKCONFIG_DEFAULTS=" + defaults, "build"], check=True)
+    return build_dir
+
+
+def idf_size(args):
+    script = os.path.join(os.environ.get("IDF_PATH", ""), "tools", "idf_size.py")
+    output = subprocess.run([sys.executable, script, "--json"] + args, check=True,
+                            stdout=subprocess.PIPE).stdout
+    return json.loads(output)
+
+
+def parse_summary(summary):
+    """Picks the sizes of the report from the idf_size.py summary."""
+    def get(*keys):
+        return sum(summary.get(key, 0) for key in keys)
+    return {
+        "flash_code": get("flash_code"),
+        "flash_rodata": get("flash_rodata"),
+        "dram": get("dram_data", "dram_bss"),
+        "iram": get("iram_text", "iram_vectors"),
+    }
+
+
+def parse_archive(archives, name="libmain.a"):
+    """Returns the bytes an archive takes in all sections of the idf_size.py archive report."""
+    sections = archives.get(name, {})
+    return sum(size for section, size in sections.items() if isinstance(size, int) and section != "total")
+
+
+def measure(build_dir):
+    map_file = os.path.join(build_dir, PROJECT + ".map")
+    sizes = parse_summary(idf_size([map_file]))
+    sizes["main"] = parse_archive(idf_size(["--archives", map_file]))
+    sizes["image"] = os.path.getsize(os.path.join(build_dir, PROJECT + ".bin"))
+    return sizes
+
+
+def boot_time(build_dir, port):
+    """Flashes a variant, resets it and returns the boot time it logs, None on a timeout."""
+    import serial
+
+    subprocess.run(["idf.py", "-B", build_dir, "-p", port, "flash"], check=True)
+    with serial.Serial(port, 115200, timeout=1) as ser:
+        # EN is on RTS, like the reset of esptool
+        ser.dtr = False
+        ser.rts = True
+        time.sleep(0.1)
+        ser.rts = False
+        deadline = time.monotonic() + BOOT_TIMEOUT_S
+        while time.monotonic() < deadline:
+            match = BOOT_LINE.search(ser.readline())
+            if match:
+                return int(match.group(1))
+    return None
+
+
+def format_report(rows):
+    """Formats (variant, sizes) rows as a table, with the difference to the first row."""
+    width = max(len("variant"), max(len(variant) for variant, _ in rows))
+    lines = ["%-*s" % (width, "variant") + "".join("%16s" % title for title, _ in COLUMNS)]
+    base = rows[0][1]
+    for variant, sizes in rows:
+        cells = []
+        for _, key in COLUMNS:
+            value = sizes.get(key)
+            if value is None:
+                cells.append("%16s" % "-")
+            elif sizes is base or base.get(key) is None:
+                cells.append("%16d" % value)
+            else:
+                cells.append("%16s" % ("%d %+d" % (value, value - base[key])))
+        lines.append("%-*s" % (width, variant) + "".join(cells))
+    return "\n".join(lines)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("-p", "--port", help="flash every variant and measure its boot time")
+    parser.add_argument("--no-build", action="store_true", help="report the variants built before")
+    parser.add_argument("variants", nargs="*", default=DEFAULT_VARIANTS, metavar="VARIANT")
+    args = parser.parse_args()
+
+    if not args.no_build and shutil.which("idf.py") is None:
+        raise SystemExit("idf.py not found, run export.sh of ESP-IDF first")
+
+    rows = []
+    for variant in args.variants:
+        build_dir = os.path.join(BUILD_DIR, variant) if args.no_build else build(variant)
+        sizes = measure(build_dir)
+        sizes["boot_ms"] = boot_time(build_dir, args.port) if args.port else None
+        rows.append((variant, sizes))
+
+    print(format_report(rows))
+
+
+if __name__ == "__main__":
+    main()
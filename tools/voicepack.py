@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+"""Builds and verifies the talking clock voice pack (see main/include/voicepack.h).
+
+Pack one directory of WAV files per voice:
+
+    python tools/voicepack.py pack -o VOICE.VPK nl=voices/nl en=voices/en
+    python tools/voicepack.py verify VOICE.VPK voices/nl voices/en
+
+Copy the resulting VOICE.VPK to the root of the SD card.
+
+Numbers are named by their value, 0.wav to 19.wav and the tens 20.wav to 90.wav,
+the words by themselves: "het is.wav", "kwart.wav", "'s middags.wav", "maandag.wav".
+"""
+
+import argparse
+import os
+import struct
+import sys
+import wave
+
+MAGIC = b"VPAK"
+VERSION = 1
+SECTOR_SIZE = 512
+
+HEADER = struct.Struct("<4sHHHHHHII8x")
+VOICE = struct.Struct("<4s12s")
+CLIP = struct.Struct("<HHIIIBBH")
+
+# Clip ids of the words, must match voice_clip_id_t in main/include/playlist.h
+WORD_CLIPS = {
+    "en": 100,
+    "het is": 101,
+    "uur": 102,
+    "bruh": 103,
+    "honderd": 104,
+    "duizend": 105,
+    "kwart": 106,
+    "half": 107,
+    "over": 108,
+    "voor": 109,
+    "seconde": 110,
+    "seconden": 111,
+    "'s nachts": 112,
+    "'s ochtends": 113,
+    "'s middags": 114,
+    "'s avonds": 115,
+}
+WORD_CLIPS.update((day, 116 + i) for i, day in enumerate(
+    ["zondag", "maandag", "dinsdag", "woensdag", "donderdag", "vrijdag", "zaterdag"]))
+WORD_CLIPS.update((month, 123 + i) for i, month in enumerate(
+    ["januari", "februari", "maart", "april", "mei", "juni", "juli", "augustus", "september", "oktober",
+     "november", "december"]))
+
+
+def clip_id_for(filename):
+    """Maps a WAV file name to its clip id, or None for unknown files."""
+    name = os.path.splitext(filename)[0].lower()
+    if name.isdigit():
+        return int(name)
+    return WORD_CLIPS.get(name)
+
+
+def align(value):
+    return (value + SECTOR_SIZE - 1) // SECTOR_SIZE * SECTOR_SIZE
+
+
+def read_voice(directory):
+    """Returns a sorted list of (clip_id, params, pcm) for every known WAV in a directory."""
+    clips = []
+    for filename in sorted(os.listdir(directory)):
+        if not filename.lower().endswith(".wav"):
+            continue
+        clip_id = clip_id_for(filename)
+        if clip_id is None:
+            print("skipping unknown clip %s" % filename, file=sys.stderr)
+            continue
+        with wave.open(os.path.join(directory, filename), "rb") as wav:
+            params = (wav.getframerate(), wav.getsampwidth() * 8, wav.getnchannels())
+            pcm = wav.readframes(wav.getnframes())
+        clips.append((clip_id, params, pcm))
+    clips.sort(key=lambda clip: clip[0])
+
+    formats = set(clip[1] for clip in clips)
+    if len(formats) > 1:
+        raise SystemExit("%s mixes PCM formats %s, resample the clips first" % (directory, sorted(formats)))
+    return clips
+
+
+def pack(output, voices):
+    voice_entries = []
+    clip_entries = []
+    for voice_index, (lang, directory) in enumerate(voices):
+        voice_entries.append(VOICE.pack(lang.encode()[:4], os.path.basename(directory).encode()[:12]))
+        for clip_id, params, pcm in read_voice(directory):
+            clip_entries.append((voice_index, clip_id, params, pcm))
+
+    voice_table_offset = HEADER.size
+    clip_table_offset = voice_table_offset + len(voice_entries) * VOICE.size
+    data_offset = align(clip_table_offset + len(clip_entries) * CLIP.size)
+
+    table = []
+    payload = bytearray()
+    for voice_index, clip_id, (rate, bits, channels), pcm in clip_entries:
+        table.append(CLIP.pack(voice_index, clip_id, data_offset + len(payload), len(pcm), rate, bits, channels, 0))
+        payload += pcm
+        payload += bytes(align(len(payload)) - len(payload))
+
+    header = HEADER.pack(MAGIC, VERSION, HEADER.size, len(voice_entries), len(clip_entries),
+                         SECTOR_SIZE, 0, voice_table_offset, clip_table_offset)
+    head = header + b"".join(voice_entries) + b"".join(table)
+    with open(output, "wb") as f:
+        f.write(head)
+        f.write(bytes(data_offset - len(head)))
+        f.write(payload)
+    print("wrote %s: %d voices, %d clips, %d bytes" % (output, len(voice_entries), len(clip_entries),
+                                                      data_offset + len(payload)))
+
+
+def verify(path, directories):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    magic, version, header_size, voice_count, clip_count, sector_size, _, voice_offset, clip_offset = \
+        HEADER.unpack_from(data, 0)
+    if magic != MAGIC or version != VERSION or header_size != HEADER.size:
+        raise SystemExit("%s: bad header" % path)
+
+    errors = 0
+    previous = -1
+    clips = {}
+    for i in range(clip_count):
+        voice, clip_id, offset, length, rate, bits, channels, _ = CLIP.unpack_from(data, clip_offset + i * CLIP.size)
+        key = (voice << 16) | clip_id
+        if key <= previous:
+            print("clip table not sorted at entry %d" % i)
+            errors += 1
+        previous = key
+        if offset % sector_size != 0 or offset + length > len(data):
+            print("clip %d of voice %d has a bad payload range" % (clip_id, voice))
+            errors += 1
+        clips[(voice, clip_id)] = data[offset:offset + length]
+
+    for voice_index, directory in enumerate(directories):
+        for clip_id, _, pcm in read_voice(directory):
+            if clips.get((voice_index, clip_id)) != pcm:
+                print("clip %d of voice %d differs from %s" % (clip_id, voice_index, directory))
+                errors += 1
+
+    if errors:
+        raise SystemExit("%s: %d errors" % (path, errors))
+    print("%s: %d voices, %d clips OK" % (path, voice_count, clip_count))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+
+    pack_parser = sub.add_parser("pack", help="pack directories of WAV files")
+    pack_parser.add_argument("-o", "--output", default="VOICE.VPK")
+    pack_parser.add_argument("voices", nargs="+", metavar="LANG=DIR")
+
+    verify_parser = sub.add_parser("verify", help="check a pack against its source directories")
+    verify_parser.add_argument("pack")
+    verify_parser.add_argument("directories", nargs="*", metavar="DIR")
+
+    args = parser.parse_args()
+    if args.command == "pack":
+        pack(args.output, [voice.split("=", 1) for voice in args.voices])
+    else:
+        verify(args.pack, args.directories)
+
+
+if __name__ == "__main__":
+    main()
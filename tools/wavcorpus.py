@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Writes a corpus of WAV files that exercise the header parser and sample conversion
+of the SD card player (see main/include/wav_file.h and main/include/pcm_convert.h).
+
+    python tools/wavcorpus.py corpus/
+
+Every file holds the same two tones, 8 to 32-bit integer, 24 and 32-bit extensible and
+float, mono and stereo, with odd, large, LIST and trailing chunks, short and extensible
+fmt chunks, and data sizes that are unknown or larger than the file. Some encodings the
+player must refuse are included too. MANIFEST.json lists what the parser should report
+for each file, and the .s16 file next to each playable file the 16-bit samples the
+conversion should produce, within 1 LSB of dither.
+
+Copy the directory to the SD card to listen to them: every playable file sounds the same.
+"""
+
+import argparse
+import json
+import math
+import os
+import struct
+
+FORMAT_PCM = 1
+FORMAT_ADPCM = 2
+FORMAT_FLOAT = 3
+FORMAT_EXTENSIBLE = 0xFFFE
+SUBFORMAT_TAIL = bytes([0x00, 0x00, 0x00, 0x00, 0x10, 0x00, 0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71])
+
+SECONDS = 0.25
+
+
+def signal(rate, channels):
+    """Two tones and a quiet one below 16 bits, in floats, interleaved."""
+    frames = int(rate * SECONDS)
+    samples = []
+    for i in range(frames):
+        t = i / rate
+        for ch in range(channels):
+            value = 0.5 * math.sin(2 * math.pi * (440 + 220 * ch) * t) + 0.25 * math.sin(2 * math.pi * 3000 * t)
+            samples.append(value + 2 ** -18 * math.sin(2 * math.pi * 50 * t))
+    return samples
+
+
+def quantize(value, bits):
+    scale = 2 ** (bits - 1)
+    return max(-scale, min(scale - 1, int(math.floor(value * scale + 0.5))))
+
+
+def encode(samples, bits, fmt, valid_bits=None):
+    valid_bits = valid_bits or bits
+    if bits % 8:
+        return bytes(len(samples) * bits // 8)
+    if fmt == FORMAT_FLOAT:
+        return struct.pack("<%d%s" % (len(samples), "d" if bits == 64 else "f"), *samples)
+    if bits == 8:
+        return bytes(quantize(s, 8) + 128 for s in samples)
+    out = bytearray()
+    for s in samples:
+        # Valid bits sit at the top of the container
+        value = quantize(s, valid_bits) << (bits - valid_bits)
+        out += (value & ((1 << bits) - 1)).to_bytes(bits // 8, "little")
+    return bytes(out)
+
+
+def expected_s16(samples, bits, fmt):
+    """16-bit result of the conversion, without the dither."""
+    if fmt != FORMAT_FLOAT and bits <= 16:
+        return [quantize(s, bits) << (16 - bits) for s in samples]
+    return [quantize(min(max(s, -1.0), 1.0) if s == s else 0.0, 16) for s in samples]
+
+
+def chunk(tag, body):
+    data = tag + struct.pack("<I", len(body)) + body
+    return data + b"\0" * (len(body) & 1)
+
+
+def fmt_chunk(fmt, channels, rate, bits, valid_bits=None, cb_size=None, block_align=None):
+    block_align = block_align or channels * bits // 8
+    body = struct.pack("<HHIIHH", fmt, channels, rate, rate * block_align, block_align, bits)
+    if fmt == FORMAT_EXTENSIBLE:
+        sub = FORMAT_FLOAT if valid_bits == "float" else FORMAT_PCM
+        valid = bits if valid_bits in (None, "float") else valid_bits
+        body += struct.pack("<HHI", 22, valid, (1 << channels) - 1) + struct.pack("<H", sub) + SUBFORMAT_TAIL
+    elif cb_size is not None:
+        body += struct.pack("<H", cb_size)
+    return chunk(b"fmt ", body)
+
+
+def riff(chunks):
+    body = b"WAVE" + b"".join(chunks)
+    return b"RIFF" + struct.pack("<I", len(body)) + body
+
+
+def case(name, rate=48000, channels=2, bits=16, fmt=FORMAT_PCM, valid_bits=None, before=(), after=(),
+         cb_size=None, data_size=None, truncate=0, samples=None, playable=True):
+    """Builds one file, returns (name, bytes, manifest entry, expected samples)."""
+    is_float = fmt == FORMAT_FLOAT or valid_bits == "float"
+    samples = samples or signal(rate, channels)
+    sample_fmt = FORMAT_FLOAT if is_float else FORMAT_PCM
+    data = encode(samples, bits, sample_fmt, None if valid_bits == "float" else valid_bits)
+    head = riff([fmt_chunk(fmt, channels, rate, bits, valid_bits, cb_size)] + list(before))
+    data_chunk = chunk(b"data", data)
+    if data_size is not None:
+        data_chunk = b"data" + struct.pack("<I", data_size) + data
+    declared = len(data) if data_size is None else data_size
+    content = head + data_chunk + b"".join(after)
+    # Fix up the RIFF size after appending
+    content = content[:4] + struct.pack("<I", len(content) - 8) + content[8:]
+    if truncate:
+        content = content[:-truncate]
+        data = data[:len(data) - truncate]
+    block_align = channels * bits // 8
+    frames = len(data) // block_align
+    entry = {
+        "name": name,
+        "playable": playable,
+        "format": sample_fmt if fmt == FORMAT_EXTENSIBLE else fmt,
+        "channels": channels,
+        "sample_rate": rate,
+        "bits": bits,
+        "valid_bits": bits if valid_bits in (None, "float") else valid_bits,
+        "data_offset": len(head) + 8,
+        "data_size": frames * block_align,
+        "stream_data_size": None if data_size in (0, 0xFFFFFFFF) else
+                            declared // block_align * block_align,
+    }
+    expected = expected_s16(samples[:frames * channels], bits, sample_fmt) if playable else None
+    return name, content, entry, expected
+
+
+def corpus():
+    odd = chunk(b"odd ", b"x" * 7)
+    junk = chunk(b"JUNK", b"\0" * 65536)
+    info = chunk(b"LIST", b"INFOINAM" + struct.pack("<I", 6) + b"tones\0")
+    fact = chunk(b"fact", struct.pack("<I", 12000))
+    tail = chunk(b"id3 ", b"\0" * 128)
+    clip = [1.5, -1.5, float("nan"), 1.0, -1.0, 0.99999994, -0.99999994, 0.0] * 100
+    cases = [case("pcm8-mono-22050", rate=22050, channels=1, bits=8),
+             case("pcm16-stereo-44100", rate=44100),
+             case("pcm16-mono-16000", rate=16000, channels=1)]
+    for channels, layout in ((1, "mono"), (2, "stereo")):
+        cases += [
+            case("pcm24-%s-48000" % layout, channels=channels, bits=24),
+            case("pcm32-%s-96000" % layout, rate=96000, channels=channels, bits=32),
+            case("float-%s-48000" % layout, channels=channels, bits=32, fmt=FORMAT_FLOAT, before=[fact]),
+        ]
+    cases += [
+        case("ext-pcm16-stereo", fmt=FORMAT_EXTENSIBLE, bits=16),
+        case("ext-pcm24-stereo", fmt=FORMAT_EXTENSIBLE, bits=24),
+        case("ext-pcm24in32-stereo", fmt=FORMAT_EXTENSIBLE, bits=32, valid_bits=24),
+        case("ext-float-stereo", fmt=FORMAT_EXTENSIBLE, bits=32, valid_bits="float", before=[fact]),
+        case("chunks-odd-list", bits=24, before=[odd, info, odd]),
+        case("chunks-large-junk", before=[junk]),
+        case("chunks-trailing", bits=24, after=[info, tail]),
+        case("fmt-18-bytes", cb_size=0),
+        case("size-unknown", bits=24, data_size=0xFFFFFFFF),
+        case("size-zero", data_size=0),
+        case("size-beyond-file", bits=24, truncate=1001),
+        case("float-clip", channels=1, bits=32, fmt=FORMAT_FLOAT, samples=clip),
+        case("adpcm", fmt=FORMAT_ADPCM, bits=4, cb_size=0, playable=False),
+        case("float64", bits=64, fmt=FORMAT_FLOAT, playable=False),
+        case("six-channels", channels=6, playable=False),
+    ]
+    return cases
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("directory", help="output directory, created when missing")
+    args = parser.parse_args()
+
+    os.makedirs(args.directory, exist_ok=True)
+    manifest = []
+    for name, content, entry, expected in corpus():
+        with open(os.path.join(args.directory, name + ".wav"), "wb") as f:
+            f.write(content)
+        if expected is not None:
+            with open(os.path.join(args.directory, name + ".s16"), "wb") as f:
+                f.write(struct.pack("<%dh" % len(expected), *expected))
+        manifest.append(entry)
+    with open(os.path.join(args.directory, "MANIFEST.json"), "w") as f:
+        json.dump(manifest, f, indent=2)
+        f.write("\n")
+    print("%d files in %s" % (len(manifest), args.directory))
+
+
+if __name__ == "__main__":
+    main()